@@ -1,9 +1,45 @@
 #include "emerge-application.h"
 #include "emerge-window.h"
+#include "emerge-benchmark.h"
+#include "emerge-sd.h"
+#include "emerge-startup.h"
+
+#include <signal.h>
+#include <glib-unix.h>
+
+/* Regressions smaller than this are treated as noise */
+#define BENCHMARK_TOLERANCE 0.05
+
+/* Lets scripts and other tools queue work in the running instance, which
+ * may already have the model loaded, e.g.
+ *   gdbus call --session --dest com.github.emerge \
+ *     --object-path /com/github/emerge \
+ *     --method com.github.emerge.Queue.Enqueue '{"positive_prompt": "a cat"}'
+ * Enqueue takes a saved template's JSON; anything it leaves out comes from
+ * the window. Status returns the queue as JSON, with the seconds each job
+ * and the whole queue are expected to take yet. */
+static const char emerge_application_queue_xml[] =
+  "<node>"
+  "  <interface name='com.github.emerge.Queue'>"
+  "    <method name='Enqueue'>"
+  "      <arg type='s' name='template_json' direction='in'/>"
+  "      <arg type='t' name='job_id' direction='out'/>"
+  "    </method>"
+  "    <method name='Cancel'>"
+  "      <arg type='t' name='job_id' direction='in'/>"
+  "      <arg type='b' name='cancelled' direction='out'/>"
+  "    </method>"
+  "    <method name='Status'>"
+  "      <arg type='s' name='status_json' direction='out'/>"
+  "    </method>"
+  "  </interface>"
+  "</node>";
 
 struct _EmergeApplication
 {
   AdwApplication parent_instance;
+
+  guint          queue_registration_id;
 };
 
 G_DEFINE_TYPE (EmergeApplication, emerge_application, ADW_TYPE_APPLICATION)
@@ -24,14 +60,255 @@ emerge_application_activate (GApplication *app)
   g_assert (EMERGE_IS_APPLICATION (app));
 
   window = gtk_application_get_active_window (GTK_APPLICATION (app));
-  if (window == NULL)
+  if (window == NULL) {
+    emerge_startup_mark ("application activated");
     window = g_object_new (EMERGE_TYPE_WINDOW,
                            "application", app,
                            NULL);
+  }
 
   gtk_window_present (window);
 }
 
+static void
+queue_method_call_cb (GDBusConnection       *connection G_GNUC_UNUSED,
+                      const char            *sender G_GNUC_UNUSED,
+                      const char            *object_path G_GNUC_UNUSED,
+                      const char            *interface_name G_GNUC_UNUSED,
+                      const char            *method_name,
+                      GVariant              *parameters,
+                      GDBusMethodInvocation *invocation,
+                      gpointer               user_data)
+{
+  GtkWindow *window = gtk_application_get_active_window (GTK_APPLICATION (user_data));
+  EmergeWindow *self;
+
+  /* The queue belongs to the window, which may not be up yet */
+  if (!EMERGE_IS_WINDOW (window)) {
+    g_dbus_method_invocation_return_error_literal (invocation, G_IO_ERROR,
+                                                   G_IO_ERROR_NOT_INITIALIZED,
+                                                   "emerge has no window open");
+    return;
+  }
+  self = EMERGE_WINDOW (window);
+
+  if (g_str_equal (method_name, "Enqueue")) {
+    const char *template_json;
+    GError *error = NULL;
+    guint64 id;
+
+    g_variant_get (parameters, "(&s)", &template_json);
+    id = emerge_window_enqueue_json (self, template_json, &error);
+    if (id == 0)
+      g_dbus_method_invocation_take_error (invocation, error);
+    else
+      g_dbus_method_invocation_return_value (invocation, g_variant_new ("(t)", id));
+  } else if (g_str_equal (method_name, "Cancel")) {
+    guint64 id;
+
+    g_variant_get (parameters, "(t)", &id);
+    g_dbus_method_invocation_return_value (invocation,
+                                           g_variant_new ("(b)", emerge_window_cancel_job (self, id)));
+  } else if (g_str_equal (method_name, "Status")) {
+    gchar *status = emerge_window_get_queue_status (self);
+
+    g_dbus_method_invocation_return_value (invocation, g_variant_new ("(s)", status));
+    g_free (status);
+  }
+}
+
+static const GDBusInterfaceVTable queue_vtable = {
+  queue_method_call_cb,
+  NULL,
+  NULL,
+  { 0 }
+};
+
+static gboolean
+emerge_application_dbus_register (GApplication     *app,
+                                  GDBusConnection  *connection,
+                                  const char       *object_path,
+                                  GError          **error)
+{
+  EmergeApplication *self = EMERGE_APPLICATION (app);
+  GDBusNodeInfo *info;
+
+  if (!G_APPLICATION_CLASS (emerge_application_parent_class)->dbus_register (app, connection,
+                                                                             object_path, error))
+    return FALSE;
+
+  info = g_dbus_node_info_new_for_xml (emerge_application_queue_xml, error);
+  if (info == NULL)
+    return FALSE;
+
+  self->queue_registration_id = g_dbus_connection_register_object (connection, object_path,
+                                                                   info->interfaces[0],
+                                                                   &queue_vtable, self,
+                                                                   NULL, error);
+  g_dbus_node_info_unref (info);
+
+  return self->queue_registration_id != 0;
+}
+
+static void
+emerge_application_dbus_unregister (GApplication    *app,
+                                    GDBusConnection *connection,
+                                    const char      *object_path)
+{
+  EmergeApplication *self = EMERGE_APPLICATION (app);
+
+  if (self->queue_registration_id != 0) {
+    g_dbus_connection_unregister_object (connection, self->queue_registration_id);
+    self->queue_registration_id = 0;
+  }
+
+  G_APPLICATION_CLASS (emerge_application_parent_class)->dbus_unregister (app, connection,
+                                                                          object_path);
+}
+
+static void
+headless_benchmark_progress_cb (EmergeBenchmark *benchmark G_GNUC_UNUSED,
+                                guint            n_done,
+                                guint            n_total,
+                                gpointer         user_data G_GNUC_UNUSED)
+{
+  g_printerr ("Benchmark: %u of %u runs done\n", n_done, n_total);
+}
+
+static gboolean
+headless_benchmark_interrupt_cb (gpointer user_data)
+{
+  emerge_benchmark_cancel (EMERGE_BENCHMARK (user_data));
+
+  return G_SOURCE_CONTINUE;
+}
+
+static void
+headless_benchmark_finished_cb (EmergeBenchmark *benchmark G_GNUC_UNUSED,
+                                gboolean         completed G_GNUC_UNUSED,
+                                gpointer         user_data)
+{
+  g_main_loop_quit (user_data);
+}
+
+/* Runs the benchmark without a window. Exits with 0 on success, 1 if the
+ * baseline comparison found regressions and 2 on errors. */
+static int
+emerge_application_run_benchmark (GVariantDict *options)
+{
+  const char *model_path = NULL;
+  const char *output_path = "emerge-benchmark.json";
+  const char *baseline_path = NULL;
+  const char *samplers = NULL, *steps = NULL, *sizes = NULL, *threads = NULL;
+  gint repeats = 1;
+  g_autofree gchar *sd_path = NULL;
+  g_autoptr(EmergeProcessManager) manager = NULL;
+  g_autoptr(EmergeBenchmark) benchmark = NULL;
+  g_autoptr(GMainLoop) loop = NULL;
+  g_autoptr(JsonGenerator) generator = NULL;
+  g_autoptr(GError) error = NULL;
+  g_autofree gchar *table = NULL;
+  JsonNode *report;
+  int status = 0;
+
+  g_variant_dict_lookup (options, "benchmark", "^&ay", &model_path);
+  g_variant_dict_lookup (options, "benchmark-output", "^&ay", &output_path);
+  g_variant_dict_lookup (options, "benchmark-baseline", "^&ay", &baseline_path);
+  g_variant_dict_lookup (options, "benchmark-samplers", "&s", &samplers);
+  g_variant_dict_lookup (options, "benchmark-steps", "&s", &steps);
+  g_variant_dict_lookup (options, "benchmark-sizes", "&s", &sizes);
+  g_variant_dict_lookup (options, "benchmark-threads", "&s", &threads);
+  g_variant_dict_lookup (options, "benchmark-repeats", "i", &repeats);
+
+  sd_path = emerge_sd_find_executable ();
+  if (sd_path == NULL) {
+    g_autofree gchar *message = emerge_sd_format_not_found_message ();
+    g_printerr ("%s\n", message);
+    return 2;
+  }
+
+  manager = emerge_process_manager_new ();
+  benchmark = emerge_benchmark_new (manager, sd_path, model_path);
+  if (!emerge_benchmark_set_matrix (benchmark, samplers, steps, sizes, threads, &error)) {
+    g_printerr ("%s\n", error->message);
+    return 2;
+  }
+  emerge_benchmark_set_repeats (benchmark, MAX (repeats, 1));
+  emerge_benchmark_set_convergence (benchmark,
+                                    g_variant_dict_contains (options, "benchmark-convergence"));
+
+  loop = g_main_loop_new (NULL, FALSE);
+  g_signal_connect (benchmark, "progress",
+                    G_CALLBACK (headless_benchmark_progress_cb), NULL);
+  g_signal_connect (benchmark, "finished",
+                    G_CALLBACK (headless_benchmark_finished_cb), loop);
+
+  /* Ctrl+C stops the current sd instead of leaving it running */
+  guint interrupt_id = g_unix_signal_add (SIGINT, headless_benchmark_interrupt_cb, benchmark);
+
+  emerge_benchmark_start (benchmark);
+  if (emerge_benchmark_is_running (benchmark))
+    g_main_loop_run (loop);
+
+  g_source_remove (interrupt_id);
+
+  report = emerge_benchmark_get_report (benchmark);
+  if (report == NULL) {
+    g_printerr ("Benchmark did not complete\n");
+    return 2;
+  }
+
+  generator = json_generator_new ();
+  json_generator_set_root (generator, report);
+  json_generator_set_pretty (generator, TRUE);
+  if (!json_generator_to_file (generator, output_path, &error)) {
+    g_printerr ("Failed to write %s: %s\n", output_path, error->message);
+    return 2;
+  }
+
+  table = emerge_benchmark_format_report (json_node_get_object (report));
+  g_print ("%s\nReport written to %s\n", table, output_path);
+
+  if (baseline_path != NULL) {
+    g_autoptr(JsonParser) parser = json_parser_new ();
+    g_autoptr(GString) summary = g_string_new (NULL);
+    JsonNode *baseline;
+
+    if (!json_parser_load_from_file (parser, baseline_path, &error)) {
+      g_printerr ("Failed to read baseline %s: %s\n", baseline_path, error->message);
+      return 2;
+    }
+
+    baseline = json_parser_get_root (parser);
+    if (baseline == NULL || !JSON_NODE_HOLDS_OBJECT (baseline)) {
+      g_printerr ("%s is not a benchmark report\n", baseline_path);
+      return 2;
+    }
+
+    if (emerge_benchmark_compare (json_node_get_object (report),
+                                  json_node_get_object (baseline),
+                                  BENCHMARK_TOLERANCE, summary) > 0)
+      status = 1;
+
+    g_print ("\n%s", summary->str);
+  }
+
+  return status;
+}
+
+static gint
+emerge_application_handle_local_options (GApplication *app G_GNUC_UNUSED,
+                                         GVariantDict *options)
+{
+  if (g_variant_dict_contains (options, "benchmark"))
+    return emerge_application_run_benchmark (options);
+
+  if (g_variant_dict_contains (options, "profile-startup"))
+    emerge_startup_enable ();
+
+  return -1;
+}
+
 static void
 emerge_application_class_init (EmergeApplicationClass *klass)
 {
@@ -41,11 +318,39 @@ emerge_application_class_init (EmergeApplicationClass *klass)
   object_class->finalize = emerge_application_finalize;
 
   app_class->activate = emerge_application_activate;
+  app_class->handle_local_options = emerge_application_handle_local_options;
+  app_class->dbus_register = emerge_application_dbus_register;
+  app_class->dbus_unregister = emerge_application_dbus_unregister;
 }
 
+static const GOptionEntry emerge_application_options[] = {
+  { "benchmark", 0, 0, G_OPTION_ARG_FILENAME, NULL,
+    "Benchmark generation with MODEL and exit", "MODEL" },
+  { "benchmark-samplers", 0, 0, G_OPTION_ARG_STRING, NULL,
+    "Comma separated sampling methods to benchmark", "LIST" },
+  { "benchmark-steps", 0, 0, G_OPTION_ARG_STRING, NULL,
+    "Comma separated step counts to benchmark", "LIST" },
+  { "benchmark-sizes", 0, 0, G_OPTION_ARG_STRING, NULL,
+    "Comma separated resolutions to benchmark, e.g. 512x512,768x768", "LIST" },
+  { "benchmark-threads", 0, 0, G_OPTION_ARG_STRING, NULL,
+    "Comma separated thread counts to benchmark, 0 for the sd default", "LIST" },
+  { "benchmark-repeats", 0, 0, G_OPTION_ARG_INT, NULL,
+    "Runs of each combination", "N" },
+  { "benchmark-convergence", 0, 0, G_OPTION_ARG_NONE, NULL,
+    "Compare every step count with a full-step run, for choosing early-stopping thresholds", NULL },
+  { "benchmark-output", 0, 0, G_OPTION_ARG_FILENAME, NULL,
+    "Where to write the JSON report", "FILE" },
+  { "benchmark-baseline", 0, 0, G_OPTION_ARG_FILENAME, NULL,
+    "Report to compare against; exit status is 1 on regressions", "FILE" },
+  { "profile-startup", 0, 0, G_OPTION_ARG_NONE, NULL,
+    "Print how long each phase of startup took", NULL },
+  { NULL }
+};
+
 static void
-emerge_application_init (EmergeApplication *self G_GNUC_UNUSED)
+emerge_application_init (EmergeApplication *self)
 {
+  g_application_add_main_option_entries (G_APPLICATION (self), emerge_application_options);
 }
 
 EmergeApplication *
@@ -0,0 +1,520 @@
+#include "emerge-batch-convert.h"
+#include "emerge-sd.h"
+
+#include <string.h>
+#include <glib/gstdio.h>
+#include <json-glib/json-glib.h>
+
+/* Used when /proc/meminfo can't be read */
+#define FALLBACK_MEMORY_BUDGET (G_GUINT64_CONSTANT (8) * 1024 * 1024 * 1024)
+
+typedef enum {
+  ITEM_PENDING,
+  ITEM_RUNNING,
+  ITEM_CONVERTED,
+  ITEM_SKIPPED,
+  ITEM_FAILED,
+  ITEM_CANCELLED,
+} ItemStatus;
+
+static const char * const item_status_names[] = {
+  "pending", "running", "converted", "skipped", "failed", "cancelled",
+};
+
+typedef struct {
+  EmergeBatchConvert *batch;
+  gchar              *source_path;
+  gchar              *output_path;
+  gchar              *quant_type;
+  guint64             source_size;
+  guint64             output_size;
+  guint64             memory_estimate;
+  gint64              source_mtime;
+  double              seconds;
+  ItemStatus          status;
+  EmergeProcess      *process;
+} BatchItem;
+
+struct _EmergeBatchConvert
+{
+  GObject               parent_instance;
+
+  EmergeProcessManager *manager;
+  gchar                *sd_path;
+  guint                 max_parallel;
+  guint64               memory_budget;
+
+  GPtrArray            *items;
+  guint                 n_running;
+  guint64               running_memory;
+  guint                 n_done;
+  gboolean              running;
+  gboolean              cancelled;
+};
+
+G_DEFINE_TYPE (EmergeBatchConvert, emerge_batch_convert, G_TYPE_OBJECT)
+
+enum {
+  SIGNAL_PROGRESS,
+  SIGNAL_FINISHED,
+  N_SIGNALS
+};
+
+static guint batch_signals[N_SIGNALS];
+
+static void batch_schedule (EmergeBatchConvert *self);
+
+static void
+batch_item_free (gpointer data)
+{
+  BatchItem *item = data;
+
+  if (item->process) {
+    g_signal_handlers_disconnect_by_data (item->process, item);
+    g_object_unref (item->process);
+  }
+
+  g_free (item->source_path);
+  g_free (item->output_path);
+  g_free (item->quant_type);
+  g_free (item);
+}
+
+static void
+emerge_batch_convert_finalize (GObject *object)
+{
+  EmergeBatchConvert *self = EMERGE_BATCH_CONVERT (object);
+
+  g_ptr_array_unref (self->items);
+  g_object_unref (self->manager);
+  g_free (self->sd_path);
+
+  G_OBJECT_CLASS (emerge_batch_convert_parent_class)->finalize (object);
+}
+
+static void
+emerge_batch_convert_class_init (EmergeBatchConvertClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->finalize = emerge_batch_convert_finalize;
+
+  /* (n_done, n_items) whenever an item is converted, skipped or fails */
+  batch_signals[SIGNAL_PROGRESS] =
+    g_signal_new ("progress",
+                  G_TYPE_FROM_CLASS (klass),
+                  G_SIGNAL_RUN_LAST,
+                  0, NULL, NULL, NULL,
+                  G_TYPE_NONE, 2, G_TYPE_UINT, G_TYPE_UINT);
+
+  batch_signals[SIGNAL_FINISHED] =
+    g_signal_new ("finished",
+                  G_TYPE_FROM_CLASS (klass),
+                  G_SIGNAL_RUN_LAST,
+                  0, NULL, NULL, NULL,
+                  G_TYPE_NONE, 0);
+}
+
+/* MemAvailable from /proc/meminfo, in bytes, or 0 if unknown */
+static guint64
+read_available_memory (void)
+{
+  gchar *contents = NULL;
+  guint64 available = 0;
+
+  if (!g_file_get_contents ("/proc/meminfo", &contents, NULL, NULL))
+    return 0;
+
+  const char *line = strstr (contents, "MemAvailable:");
+  if (line != NULL)
+    available = g_ascii_strtoull (line + strlen ("MemAvailable:"), NULL, 10) * 1024;
+
+  g_free (contents);
+
+  return available;
+}
+
+static void
+emerge_batch_convert_init (EmergeBatchConvert *self)
+{
+  guint64 available = read_available_memory ();
+
+  self->items = g_ptr_array_new_with_free_func (batch_item_free);
+
+  /* Conversions are mostly bound by reading the source and writing the
+   * output, so more than a couple at once just thrashes the disk */
+  self->max_parallel = CLAMP (g_get_num_processors () / 4, 1, 2);
+
+  /* Leave a quarter of the free memory for everything else */
+  self->memory_budget = available > 0 ? available / 4 * 3 : FALLBACK_MEMORY_BUDGET;
+}
+
+EmergeBatchConvert *
+emerge_batch_convert_new (EmergeProcessManager *manager,
+                          const char           *sd_path)
+{
+  EmergeBatchConvert *self;
+
+  g_return_val_if_fail (EMERGE_IS_PROCESS_MANAGER (manager), NULL);
+  g_return_val_if_fail (sd_path != NULL, NULL);
+
+  self = g_object_new (EMERGE_TYPE_BATCH_CONVERT, NULL);
+  self->manager = g_object_ref (manager);
+  self->sd_path = g_strdup (sd_path);
+
+  return self;
+}
+
+void
+emerge_batch_convert_set_max_parallel (EmergeBatchConvert *self,
+                                       guint               max_parallel)
+{
+  g_return_if_fail (EMERGE_IS_BATCH_CONVERT (self));
+
+  self->max_parallel = MAX (max_parallel, 1);
+}
+
+void
+emerge_batch_convert_set_memory_budget (EmergeBatchConvert *self,
+                                        guint64             budget)
+{
+  g_return_if_fail (EMERGE_IS_BATCH_CONVERT (self));
+
+  self->memory_budget = budget;
+}
+
+/* "model.safetensors" + "q4_0" -> "model.q4_0.gguf", matching the name
+ * suggested by the single-model convert dialog */
+gchar *
+emerge_batch_convert_output_name (const char *model_path,
+                                  const char *quant_type)
+{
+  gchar *basename = g_path_get_basename (model_path);
+  char *dot = strrchr (basename, '.');
+  gchar *name;
+
+  if (dot != NULL && dot != basename)
+    *dot = '\0';
+
+  name = g_strdup_printf ("%s.%s.gguf", basename, quant_type);
+  g_free (basename);
+
+  return name;
+}
+
+void
+emerge_batch_convert_add (EmergeBatchConvert *self,
+                          const char         *model_path,
+                          const char         *quant_type,
+                          const char         *output_dir)
+{
+  BatchItem *item;
+  GStatBuf st;
+
+  g_return_if_fail (EMERGE_IS_BATCH_CONVERT (self));
+  g_return_if_fail (!self->running);
+
+  item = g_new0 (BatchItem, 1);
+  item->batch = self;
+  item->source_path = g_strdup (model_path);
+  item->quant_type = g_strdup (quant_type);
+  item->status = ITEM_PENDING;
+
+  gchar *name = emerge_batch_convert_output_name (model_path, quant_type);
+  item->output_path = g_build_filename (output_dir, name, NULL);
+  g_free (name);
+
+  if (g_stat (model_path, &st) == 0) {
+    item->source_size = st.st_size;
+    item->source_mtime = st.st_mtime;
+  }
+
+  /* sd holds the source tensors and the converted copy at the same time */
+  item->memory_estimate = item->source_size * 2;
+
+  g_ptr_array_add (self->items, item);
+}
+
+/* An output is up to date if it is non-empty and newer than its source */
+static gboolean
+batch_item_is_up_to_date (BatchItem *item)
+{
+  GStatBuf st;
+
+  if (g_stat (item->output_path, &st) != 0 || st.st_size == 0)
+    return FALSE;
+
+  item->output_size = st.st_size;
+
+  return st.st_mtime >= item->source_mtime;
+}
+
+static void
+batch_item_done (BatchItem  *item,
+                 ItemStatus  status)
+{
+  EmergeBatchConvert *self = item->batch;
+
+  item->status = status;
+  self->n_done++;
+
+  g_signal_emit (self, batch_signals[SIGNAL_PROGRESS], 0,
+                 self->n_done, self->items->len);
+}
+
+static void
+batch_item_exited_cb (EmergeProcess *process,
+                      gint           wait_status,
+                      gpointer       user_data)
+{
+  BatchItem *item = user_data;
+  EmergeBatchConvert *self = item->batch;
+  GStatBuf st;
+
+  g_object_ref (self);
+
+  item->seconds = emerge_process_get_elapsed (process);
+  self->n_running--;
+  self->running_memory -= item->memory_estimate;
+
+  if (emerge_process_was_cancelled (process)) {
+    /* Don't leave a truncated file that would look up to date next time */
+    g_unlink (item->output_path);
+    batch_item_done (item, ITEM_CANCELLED);
+  } else if (wait_status == 0 && g_stat (item->output_path, &st) == 0) {
+    item->output_size = st.st_size;
+    batch_item_done (item, ITEM_CONVERTED);
+  } else {
+    g_unlink (item->output_path);
+    batch_item_done (item, ITEM_FAILED);
+  }
+
+  g_signal_handlers_disconnect_by_data (process, item);
+  g_clear_object (&item->process);
+
+  batch_schedule (self);
+
+  g_object_unref (self);
+}
+
+static gboolean
+batch_item_spawn (BatchItem *item)
+{
+  EmergeBatchConvert *self = item->batch;
+  const EmergeProcessLimits limits = {
+    .nice = 10,
+    .idle_io = TRUE,
+    .max_memory = 0,
+  };
+  GError *error = NULL;
+  gchar **argv;
+
+  argv = emerge_sd_build_convert_argv (self->sd_path, item->source_path,
+                                       item->output_path, item->quant_type);
+  item->process = emerge_process_manager_spawn (self->manager, "batch-convert",
+                                                (const char * const *) argv,
+                                                &limits, &error);
+  g_strfreev (argv);
+
+  if (item->process == NULL) {
+    g_warning ("Failed to start conversion of %s: %s", item->source_path, error->message);
+    g_error_free (error);
+    return FALSE;
+  }
+
+  item->status = ITEM_RUNNING;
+  self->n_running++;
+  self->running_memory += item->memory_estimate;
+
+  g_signal_connect (item->process, "exited",
+                    G_CALLBACK (batch_item_exited_cb), item);
+
+  return TRUE;
+}
+
+/* Start as many pending conversions as the parallelism and memory budgets
+ * allow. A single conversion is always allowed to run, even if it alone
+ * exceeds the memory budget, so oversized models still make progress. */
+static void
+batch_schedule (EmergeBatchConvert *self)
+{
+  for (guint i = 0; i < self->items->len; i++) {
+    BatchItem *item = g_ptr_array_index (self->items, i);
+
+    if (item->status != ITEM_PENDING)
+      continue;
+
+    if (self->cancelled) {
+      batch_item_done (item, ITEM_CANCELLED);
+      continue;
+    }
+
+    if (batch_item_is_up_to_date (item)) {
+      batch_item_done (item, ITEM_SKIPPED);
+      continue;
+    }
+
+    if (self->n_running >= self->max_parallel)
+      break;
+
+    if (self->n_running > 0 &&
+        self->running_memory + item->memory_estimate > self->memory_budget)
+      continue;
+
+    if (!batch_item_spawn (item))
+      batch_item_done (item, ITEM_FAILED);
+  }
+
+  if (self->running && self->n_running == 0 && self->n_done == self->items->len) {
+    self->running = FALSE;
+    g_signal_emit (self, batch_signals[SIGNAL_FINISHED], 0);
+  }
+}
+
+void
+emerge_batch_convert_start (EmergeBatchConvert *self)
+{
+  g_return_if_fail (EMERGE_IS_BATCH_CONVERT (self));
+  g_return_if_fail (!self->running);
+
+  self->running = TRUE;
+
+  /* Everything may already be up to date, in which case "finished" is
+   * emitted right away and handlers may drop the last reference */
+  g_object_ref (self);
+  batch_schedule (self);
+  g_object_unref (self);
+}
+
+void
+emerge_batch_convert_cancel (EmergeBatchConvert *self)
+{
+  g_return_if_fail (EMERGE_IS_BATCH_CONVERT (self));
+
+  if (!self->running)
+    return;
+
+  self->cancelled = TRUE;
+
+  for (guint i = 0; i < self->items->len; i++) {
+    BatchItem *item = g_ptr_array_index (self->items, i);
+
+    if (item->process != NULL)
+      emerge_process_cancel (item->process);
+  }
+
+  /* Pending items are marked cancelled right away */
+  g_object_ref (self);
+  batch_schedule (self);
+  g_object_unref (self);
+}
+
+gboolean
+emerge_batch_convert_is_running (EmergeBatchConvert *self)
+{
+  g_return_val_if_fail (EMERGE_IS_BATCH_CONVERT (self), FALSE);
+
+  return self->running;
+}
+
+guint
+emerge_batch_convert_get_n_items (EmergeBatchConvert *self)
+{
+  g_return_val_if_fail (EMERGE_IS_BATCH_CONVERT (self), 0);
+
+  return self->items->len;
+}
+
+guint
+emerge_batch_convert_get_n_done (EmergeBatchConvert *self)
+{
+  g_return_val_if_fail (EMERGE_IS_BATCH_CONVERT (self), 0);
+
+  return self->n_done;
+}
+
+guint
+emerge_batch_convert_get_n_failed (EmergeBatchConvert *self)
+{
+  guint n_failed = 0;
+
+  g_return_val_if_fail (EMERGE_IS_BATCH_CONVERT (self), 0);
+
+  for (guint i = 0; i < self->items->len; i++) {
+    BatchItem *item = g_ptr_array_index (self->items, i);
+
+    if (item->status == ITEM_FAILED)
+      n_failed++;
+  }
+
+  return n_failed;
+}
+
+/**
+ * emerge_batch_convert_write_report:
+ * @self: a batch converter
+ * @path: where to write the JSON report
+ * @error: return location for an error
+ *
+ * Writes one entry per (model, type) pair with the outcome, sizes,
+ * conversion time and compression ratio of the output relative to the
+ * source file.
+ */
+gboolean
+emerge_batch_convert_write_report (EmergeBatchConvert  *self,
+                                   const char          *path,
+                                   GError             **error)
+{
+  JsonBuilder *builder;
+  JsonGenerator *generator;
+  JsonNode *root;
+  gboolean ret;
+
+  g_return_val_if_fail (EMERGE_IS_BATCH_CONVERT (self), FALSE);
+
+  builder = json_builder_new ();
+  json_builder_begin_array (builder);
+
+  for (guint i = 0; i < self->items->len; i++) {
+    BatchItem *item = g_ptr_array_index (self->items, i);
+
+    json_builder_begin_object (builder);
+
+    json_builder_set_member_name (builder, "source");
+    json_builder_add_string_value (builder, item->source_path);
+    json_builder_set_member_name (builder, "output");
+    json_builder_add_string_value (builder, item->output_path);
+    json_builder_set_member_name (builder, "type");
+    json_builder_add_string_value (builder, item->quant_type);
+    json_builder_set_member_name (builder, "status");
+    json_builder_add_string_value (builder, item_status_names[item->status]);
+    json_builder_set_member_name (builder, "source_size");
+    json_builder_add_int_value (builder, item->source_size);
+    json_builder_set_member_name (builder, "output_size");
+    json_builder_add_int_value (builder, item->output_size);
+    json_builder_set_member_name (builder, "seconds");
+    json_builder_add_double_value (builder, item->seconds);
+    json_builder_set_member_name (builder, "compression_ratio");
+    json_builder_add_double_value (builder,
+                                   item->output_size > 0
+                                     ? (double) item->source_size / item->output_size
+                                     : 0.0);
+
+    json_builder_end_object (builder);
+  }
+
+  json_builder_end_array (builder);
+
+  generator = json_generator_new ();
+  root = json_builder_get_root (builder);
+  json_generator_set_root (generator, root);
+  json_generator_set_pretty (generator, TRUE);
+
+  ret = json_generator_to_file (generator, path, error);
+
+  json_node_free (root);
+  g_object_unref (generator);
+  g_object_unref (builder);
+
+  return ret;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <gio/gio.h>
+
+#include "emerge-process-manager.h"
+
+G_BEGIN_DECLS
+
+#define EMERGE_TYPE_BATCH_CONVERT (emerge_batch_convert_get_type())
+
+G_DECLARE_FINAL_TYPE (EmergeBatchConvert, emerge_batch_convert, EMERGE, BATCH_CONVERT, GObject)
+
+EmergeBatchConvert *emerge_batch_convert_new               (EmergeProcessManager *manager,
+                                                            const char           *sd_path);
+void                emerge_batch_convert_set_max_parallel  (EmergeBatchConvert   *self,
+                                                            guint                 max_parallel);
+void                emerge_batch_convert_set_memory_budget (EmergeBatchConvert   *self,
+                                                            guint64               budget);
+void                emerge_batch_convert_add               (EmergeBatchConvert   *self,
+                                                            const char           *model_path,
+                                                            const char           *quant_type,
+                                                            const char           *output_dir);
+void                emerge_batch_convert_start             (EmergeBatchConvert   *self);
+void                emerge_batch_convert_cancel            (EmergeBatchConvert   *self);
+gboolean            emerge_batch_convert_is_running        (EmergeBatchConvert   *self);
+guint               emerge_batch_convert_get_n_items       (EmergeBatchConvert   *self);
+guint               emerge_batch_convert_get_n_done        (EmergeBatchConvert   *self);
+guint               emerge_batch_convert_get_n_failed      (EmergeBatchConvert   *self);
+gboolean            emerge_batch_convert_write_report      (EmergeBatchConvert   *self,
+                                                            const char           *path,
+                                                            GError              **error);
+
+gchar              *emerge_batch_convert_output_name       (const char           *model_path,
+                                                            const char           *quant_type);
+
+G_END_DECLS
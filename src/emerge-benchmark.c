@@ -0,0 +1,1077 @@
+#include "emerge-benchmark.h"
+#include "emerge-convergence.h"
+#include "emerge-host-info.h"
+#include "emerge-image-metrics.h"
+#include "emerge-job.h"
+#include "emerge-preload.h"
+#include "emerge-sd.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <glib/gstdio.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+/* Fixed so that runs stay comparable across versions and hosts */
+#define BENCHMARK_PROMPT  "a photograph of an astronaut riding a horse on the moon"
+#define BENCHMARK_SEED    42
+
+/* Bumped whenever the meaning of a report field changes */
+#define BENCHMARK_REPORT_VERSION 1
+
+typedef struct {
+  gint width;
+  gint height;
+} BenchSize;
+
+typedef struct {
+  gchar     *key;
+  gchar     *sampler;
+  gint       steps;
+  gint       width;
+  gint       height;
+  gint       threads;
+  GPtrArray *jobs;        /* EmergeJob, one per repeat */
+  struct _BenchTrace *trace;
+} BenchCase;
+
+/* A full-step run of one sampler, size and thread count with a preview
+ * after every step, which the other step counts are measured against */
+typedef struct _BenchTrace {
+  EmergeJob         *job;
+  EmergeConvergence *convergence;
+} BenchTrace;
+
+struct _EmergeBenchmark
+{
+  GObject               parent_instance;
+
+  EmergeProcessManager *manager;
+  gchar                *sd_path;
+  gchar                *model_path;
+
+  /* The matrix */
+  GPtrArray            *samplers;
+  GArray               *steps;
+  GArray               *sizes;
+  GArray               *threads;
+  guint                 repeats;
+  gboolean              convergence;
+
+  gchar                *work_dir;
+  GPtrArray            *cases;
+  EmergeJob            *cold_job;
+  gboolean              cold_evicted;
+  guint                 case_index;
+  guint                 job_index;
+  GPtrArray            *traces;
+  guint                 trace_index;
+  BenchTrace           *current_trace;
+  EmergeProcess        *process;
+  EmergeJob            *current_job;
+  guint                 n_done;
+  guint                 n_total;
+  GDateTime            *started;
+
+  JsonNode             *report;
+  GCancellable         *cancellable;
+  gboolean              running;
+};
+
+G_DEFINE_TYPE (EmergeBenchmark, emerge_benchmark, G_TYPE_OBJECT)
+
+enum {
+  SIGNAL_PROGRESS,
+  SIGNAL_FINISHED,
+  N_SIGNALS
+};
+
+static guint benchmark_signals[N_SIGNALS];
+
+static void benchmark_run_next (EmergeBenchmark *self);
+
+static void
+bench_case_free (gpointer data)
+{
+  BenchCase *bench_case = data;
+
+  g_free (bench_case->key);
+  g_free (bench_case->sampler);
+  g_ptr_array_unref (bench_case->jobs);
+  g_free (bench_case);
+}
+
+static void
+bench_trace_free (gpointer data)
+{
+  BenchTrace *trace = data;
+
+  emerge_job_unref (trace->job);
+  emerge_convergence_free (trace->convergence);
+  g_free (trace);
+}
+
+static void
+emerge_benchmark_dispose (GObject *object)
+{
+  EmergeBenchmark *self = EMERGE_BENCHMARK (object);
+
+  if (self->process) {
+    g_signal_handlers_disconnect_by_data (self->process, self);
+    emerge_process_cancel (self->process);
+    g_clear_object (&self->process);
+  }
+
+  G_OBJECT_CLASS (emerge_benchmark_parent_class)->dispose (object);
+}
+
+static void
+emerge_benchmark_finalize (GObject *object)
+{
+  EmergeBenchmark *self = EMERGE_BENCHMARK (object);
+
+  g_ptr_array_unref (self->samplers);
+  g_array_unref (self->steps);
+  g_array_unref (self->sizes);
+  g_array_unref (self->threads);
+  g_ptr_array_unref (self->cases);
+  g_ptr_array_unref (self->traces);
+  g_clear_pointer (&self->cold_job, emerge_job_unref);
+  g_clear_pointer (&self->current_job, emerge_job_unref);
+  g_clear_pointer (&self->started, g_date_time_unref);
+  g_clear_pointer (&self->report, json_node_unref);
+  g_object_unref (self->cancellable);
+  g_object_unref (self->manager);
+  g_free (self->sd_path);
+  g_free (self->model_path);
+  g_free (self->work_dir);
+
+  G_OBJECT_CLASS (emerge_benchmark_parent_class)->finalize (object);
+}
+
+static void
+emerge_benchmark_class_init (EmergeBenchmarkClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->dispose = emerge_benchmark_dispose;
+  object_class->finalize = emerge_benchmark_finalize;
+
+  /* (runs done, total runs), the cold run included */
+  benchmark_signals[SIGNAL_PROGRESS] =
+    g_signal_new ("progress",
+                  G_TYPE_FROM_CLASS (klass),
+                  G_SIGNAL_RUN_LAST,
+                  0, NULL, NULL, NULL,
+                  G_TYPE_NONE, 2, G_TYPE_UINT, G_TYPE_UINT);
+
+  /* Emitted once; the argument is FALSE if the run was cancelled */
+  benchmark_signals[SIGNAL_FINISHED] =
+    g_signal_new ("finished",
+                  G_TYPE_FROM_CLASS (klass),
+                  G_SIGNAL_RUN_LAST,
+                  0, NULL, NULL, NULL,
+                  G_TYPE_NONE, 1, G_TYPE_BOOLEAN);
+}
+
+static void
+emerge_benchmark_init (EmergeBenchmark *self)
+{
+  self->samplers = g_ptr_array_new_with_free_func (g_free);
+  self->steps = g_array_new (FALSE, FALSE, sizeof (gint));
+  self->sizes = g_array_new (FALSE, FALSE, sizeof (BenchSize));
+  self->threads = g_array_new (FALSE, FALSE, sizeof (gint));
+  self->cases = g_ptr_array_new_with_free_func (bench_case_free);
+  self->traces = g_ptr_array_new_with_free_func (bench_trace_free);
+  self->repeats = 1;
+  self->cancellable = g_cancellable_new ();
+}
+
+EmergeBenchmark *
+emerge_benchmark_new (EmergeProcessManager *manager,
+                      const char           *sd_path,
+                      const char           *model_path)
+{
+  EmergeBenchmark *self;
+
+  g_return_val_if_fail (EMERGE_IS_PROCESS_MANAGER (manager), NULL);
+  g_return_val_if_fail (sd_path != NULL && model_path != NULL, NULL);
+
+  self = g_object_new (EMERGE_TYPE_BENCHMARK, NULL);
+  self->manager = g_object_ref (manager);
+  self->sd_path = g_strdup (sd_path);
+  self->model_path = g_strdup (model_path);
+
+  return self;
+}
+
+static gboolean
+parse_int_list (const char  *list,
+                const char  *what,
+                gint         min,
+                GArray      *out,
+                GError     **error)
+{
+  gchar **items = g_strsplit (list, ",", -1);
+  gboolean ok = TRUE;
+
+  for (guint i = 0; items[i] != NULL && ok; i++) {
+    gint64 value;
+
+    g_strstrip (items[i]);
+    if (!g_ascii_string_to_signed (items[i], 10, min, G_MAXINT, &value, NULL)) {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                   "Invalid %s \"%s\"", what, items[i]);
+      ok = FALSE;
+    } else {
+      gint v = value;
+      g_array_append_val (out, v);
+    }
+  }
+
+  g_strfreev (items);
+  return ok;
+}
+
+/**
+ * emerge_benchmark_set_matrix:
+ * @self: a benchmark
+ * @samplers: (nullable): comma separated sampling methods
+ * @steps: (nullable): comma separated step counts
+ * @sizes: (nullable): comma separated resolutions, e.g. "512x512,768x512"
+ * @threads: (nullable): comma separated thread counts, 0 for sd's default
+ * @error: return location for an error
+ *
+ * Sets the axes of the benchmark matrix; every combination is run. A %NULL
+ * axis keeps its default: euler_a, 20 steps, 512x512 and sd's thread count.
+ *
+ * Returns: %TRUE if every list parsed
+ */
+gboolean
+emerge_benchmark_set_matrix (EmergeBenchmark  *self,
+                             const char       *samplers,
+                             const char       *steps,
+                             const char       *sizes,
+                             const char       *threads,
+                             GError          **error)
+{
+  g_return_val_if_fail (EMERGE_IS_BENCHMARK (self), FALSE);
+  g_return_val_if_fail (!self->running, FALSE);
+
+  g_ptr_array_set_size (self->samplers, 0);
+  g_array_set_size (self->steps, 0);
+  g_array_set_size (self->sizes, 0);
+  g_array_set_size (self->threads, 0);
+
+  if (samplers != NULL) {
+    gchar **items = g_strsplit (samplers, ",", -1);
+
+    for (guint i = 0; items[i] != NULL; i++) {
+      g_strstrip (items[i]);
+      if (!g_strv_contains (emerge_sd_sampling_methods, items[i])) {
+        g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                     "Unknown sampling method \"%s\"", items[i]);
+        g_strfreev (items);
+        return FALSE;
+      }
+      g_ptr_array_add (self->samplers, g_strdup (items[i]));
+    }
+    g_strfreev (items);
+  }
+
+  if (steps != NULL && !parse_int_list (steps, "step count", 1, self->steps, error))
+    return FALSE;
+
+  if (threads != NULL && !parse_int_list (threads, "thread count", 0, self->threads, error))
+    return FALSE;
+
+  if (sizes != NULL) {
+    gchar **items = g_strsplit (sizes, ",", -1);
+
+    for (guint i = 0; items[i] != NULL; i++) {
+      BenchSize size;
+
+      g_strstrip (items[i]);
+      if (sscanf (items[i], "%dx%d", &size.width, &size.height) != 2 ||
+          size.width <= 0 || size.height <= 0) {
+        g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                     "Invalid resolution \"%s\", expected WIDTHxHEIGHT", items[i]);
+        g_strfreev (items);
+        return FALSE;
+      }
+      g_array_append_val (self->sizes, size);
+    }
+    g_strfreev (items);
+  }
+
+  return TRUE;
+}
+
+/* Runs of every combination; step latencies are pooled across them */
+void
+emerge_benchmark_set_repeats (EmergeBenchmark *self,
+                              guint            repeats)
+{
+  g_return_if_fail (EMERGE_IS_BENCHMARK (self));
+  g_return_if_fail (!self->running);
+
+  self->repeats = MAX (repeats, 1);
+}
+
+/**
+ * emerge_benchmark_set_convergence:
+ * @self: a benchmark
+ * @enabled: whether to measure convergence
+ *
+ * Also runs every sampler, size and thread count once more at the most
+ * steps in the matrix, previewing every step. Each combination's image is
+ * then compared with that full-step one, next to how much the image was
+ * still changing per step at its step count, so early-stopping thresholds
+ * can be chosen per sampler. These runs aren't part of the timings.
+ */
+void
+emerge_benchmark_set_convergence (EmergeBenchmark *self,
+                                  gboolean         enabled)
+{
+  g_return_if_fail (EMERGE_IS_BENCHMARK (self));
+  g_return_if_fail (!self->running);
+
+  self->convergence = enabled;
+}
+
+static void
+benchmark_fill_defaults (EmergeBenchmark *self)
+{
+  if (self->samplers->len == 0)
+    g_ptr_array_add (self->samplers, g_strdup ("euler_a"));
+
+  if (self->steps->len == 0) {
+    gint steps = 20;
+    g_array_append_val (self->steps, steps);
+  }
+
+  if (self->sizes->len == 0) {
+    BenchSize size = { 512, 512 };
+    g_array_append_val (self->sizes, size);
+  }
+
+  if (self->threads->len == 0) {
+    gint threads = 0;
+    g_array_append_val (self->threads, threads);
+  }
+}
+
+static EmergeJob *
+benchmark_new_job (EmergeBenchmark *self,
+                   BenchCase       *bench_case,
+                   const char      *name)
+{
+  EmergeJob *job = emerge_job_new ();
+
+  job->model_path = g_strdup (self->model_path);
+  job->prompt = g_strdup (BENCHMARK_PROMPT);
+  job->negative_prompt = g_strdup ("");
+  job->seed = BENCHMARK_SEED;
+  job->width = bench_case->width;
+  job->height = bench_case->height;
+  job->steps = bench_case->steps;
+  job->threads = bench_case->threads;
+  g_free (job->sampling_method);
+  job->sampling_method = g_strdup (bench_case->sampler);
+  job->output_path = g_build_filename (self->work_dir, name, NULL);
+
+  return job;
+}
+
+/* The trace the cases of one sampler, size and thread count share */
+static BenchTrace *
+benchmark_get_trace (EmergeBenchmark *self,
+                     BenchCase       *bench_case)
+{
+  BenchCase full = *bench_case;
+  BenchTrace *trace;
+  gchar *name;
+
+  for (guint i = 0; i < self->traces->len; i++) {
+    trace = g_ptr_array_index (self->traces, i);
+
+    if (g_str_equal (trace->job->sampling_method, bench_case->sampler) &&
+        trace->job->width == bench_case->width &&
+        trace->job->height == bench_case->height &&
+        trace->job->threads == bench_case->threads)
+      return trace;
+  }
+
+  full.steps = 0;
+  for (guint i = 0; i < self->steps->len; i++)
+    full.steps = MAX (full.steps, g_array_index (self->steps, gint, i));
+
+  trace = g_new0 (BenchTrace, 1);
+  name = g_strdup_printf ("trace-%u.png", self->traces->len);
+  trace->job = benchmark_new_job (self, &full, name);
+  g_free (name);
+  name = g_strdup_printf ("trace-%u-preview.png", self->traces->len);
+  trace->job->preview_interval = 1;
+  trace->job->preview_path = g_build_filename (self->work_dir, name, NULL);
+  g_free (name);
+  trace->convergence = emerge_convergence_new (EMERGE_CONVERGENCE_DEFAULT_THRESHOLD,
+                                               EMERGE_CONVERGENCE_DEFAULT_PATIENCE);
+  g_ptr_array_add (self->traces, trace);
+
+  return trace;
+}
+
+static void
+benchmark_build_cases (EmergeBenchmark *self)
+{
+  g_ptr_array_set_size (self->cases, 0);
+  g_ptr_array_set_size (self->traces, 0);
+
+  for (guint s = 0; s < self->samplers->len; s++)
+    for (guint st = 0; st < self->steps->len; st++)
+      for (guint r = 0; r < self->sizes->len; r++)
+        for (guint t = 0; t < self->threads->len; t++) {
+          BenchCase *bench_case = g_new0 (BenchCase, 1);
+          BenchSize *size = &g_array_index (self->sizes, BenchSize, r);
+
+          bench_case->sampler = g_strdup (g_ptr_array_index (self->samplers, s));
+          bench_case->steps = g_array_index (self->steps, gint, st);
+          bench_case->width = size->width;
+          bench_case->height = size->height;
+          bench_case->threads = g_array_index (self->threads, gint, t);
+          bench_case->key = g_strdup_printf ("%s/%d/%dx%d/t%d",
+                                             bench_case->sampler, bench_case->steps,
+                                             bench_case->width, bench_case->height,
+                                             bench_case->threads);
+          bench_case->jobs = g_ptr_array_new_with_free_func ((GDestroyNotify) emerge_job_unref);
+
+          for (guint i = 0; i < self->repeats; i++) {
+            gchar *name = g_strdup_printf ("case-%u-%u.png", self->cases->len, i);
+
+            g_ptr_array_add (bench_case->jobs, benchmark_new_job (self, bench_case, name));
+            g_free (name);
+          }
+
+          if (self->convergence)
+            bench_case->trace = benchmark_get_trace (self, bench_case);
+
+          g_ptr_array_add (self->cases, bench_case);
+        }
+
+  /* The cold run uses the first combination; its load time is reported on
+   * its own and its sampling numbers are not pooled with the warm runs */
+  g_clear_pointer (&self->cold_job, emerge_job_unref);
+  self->cold_job = benchmark_new_job (self, g_ptr_array_index (self->cases, 0), "cold.png");
+
+  self->n_total = self->cases->len * self->repeats + self->traces->len + 1;
+}
+
+static gint
+compare_doubles (gconstpointer a,
+                 gconstpointer b)
+{
+  double x = *(const double *) a;
+  double y = *(const double *) b;
+
+  return (x > y) - (x < y);
+}
+
+/* Nearest-rank percentile of a sorted array */
+static double
+percentile (GArray *sorted,
+            double  p)
+{
+  guint rank;
+
+  if (sorted->len == 0)
+    return NAN;
+
+  rank = (guint) ceil (p / 100.0 * sorted->len);
+  return g_array_index (sorted, double, CLAMP (rank, 1, sorted->len) - 1);
+}
+
+static void
+add_double_or_null (JsonBuilder *builder,
+                    const char  *member,
+                    double       value)
+{
+  json_builder_set_member_name (builder, member);
+  if (isnan (value))
+    json_builder_add_null_value (builder);
+  else
+    json_builder_add_double_value (builder, value);
+}
+
+static void
+benchmark_add_file_info (JsonBuilder *builder,
+                         const char  *member,
+                         const char  *path)
+{
+  GStatBuf st;
+
+  json_builder_set_member_name (builder, member);
+  json_builder_begin_object (builder);
+  json_builder_set_member_name (builder, "path");
+  json_builder_add_string_value (builder, path);
+  if (g_stat (path, &st) == 0) {
+    json_builder_set_member_name (builder, "size");
+    json_builder_add_int_value (builder, st.st_size);
+    json_builder_set_member_name (builder, "mtime");
+    json_builder_add_int_value (builder, st.st_mtime);
+  }
+  json_builder_end_object (builder);
+}
+
+/* How close the case's first image came to the full-step one, and how
+ * much the full-step run was still changing at the case's step count */
+static void
+benchmark_add_convergence (JsonBuilder *builder,
+                           BenchCase   *bench_case)
+{
+  EmergeJob *trace_job = bench_case->trace->job;
+  EmergeJob *job = g_ptr_array_index (bench_case->jobs, 0);
+  EmergeImageMetrics metrics = { NAN, NAN };
+  GError *error = NULL;
+
+  if (trace_job->state == EMERGE_JOB_SUCCEEDED && job->state == EMERGE_JOB_SUCCEEDED &&
+      !emerge_image_metrics_compare_files (trace_job->output_path, job->output_path,
+                                           &metrics, &error)) {
+    g_warning ("Failed to compare %s with the full-step run: %s",
+               bench_case->key, error->message);
+    g_clear_error (&error);
+  }
+
+  json_builder_set_member_name (builder, "full_steps");
+  json_builder_add_int_value (builder, trace_job->steps);
+  add_double_or_null (builder, "ssim_vs_full", metrics.ssim);
+  add_double_or_null (builder, "psnr_vs_full",
+                      metrics.psnr == G_MAXDOUBLE ? NAN : metrics.psnr);
+  add_double_or_null (builder, "step_delta",
+                      emerge_convergence_get_delta (bench_case->trace->convergence,
+                                                    bench_case->steps));
+  json_builder_set_member_name (builder, "converged_step");
+  json_builder_add_int_value (builder,
+                              emerge_convergence_get_converged_step (bench_case->trace->convergence));
+}
+
+static JsonNode *
+benchmark_build_report (EmergeBenchmark *self)
+{
+  g_autoptr(EmergeHostInfo) host = emerge_host_info_get ();
+  g_autofree gchar *timestamp = g_date_time_format_iso8601 (self->started);
+  JsonBuilder *builder = json_builder_new ();
+  JsonNode *root;
+  double warm_load_sum = 0.0;
+  guint n_warm_loads = 0;
+
+  json_builder_begin_object (builder);
+
+  json_builder_set_member_name (builder, "version");
+  json_builder_add_int_value (builder, BENCHMARK_REPORT_VERSION);
+  json_builder_set_member_name (builder, "timestamp");
+  json_builder_add_string_value (builder, timestamp);
+  emerge_host_info_to_json (host, builder);
+  benchmark_add_file_info (builder, "model", self->model_path);
+  /* The sd binary's size and mtime tell stable-diffusion.cpp builds apart */
+  benchmark_add_file_info (builder, "sd", self->sd_path);
+  json_builder_set_member_name (builder, "prompt");
+  json_builder_add_string_value (builder, BENCHMARK_PROMPT);
+  json_builder_set_member_name (builder, "seed");
+  json_builder_add_int_value (builder, BENCHMARK_SEED);
+  json_builder_set_member_name (builder, "repeats");
+  json_builder_add_int_value (builder, self->repeats);
+
+  json_builder_set_member_name (builder, "cold_evicted");
+  json_builder_add_boolean_value (builder, self->cold_evicted);
+  add_double_or_null (builder, "cold_load_seconds",
+                      self->cold_job->stats && self->cold_job->stats->load_seconds >= 0.0
+                      ? self->cold_job->stats->load_seconds : NAN);
+
+  json_builder_set_member_name (builder, "cases");
+  json_builder_begin_array (builder);
+
+  for (guint i = 0; i < self->cases->len; i++) {
+    BenchCase *bench_case = g_ptr_array_index (self->cases, i);
+    GArray *steps = g_array_new (FALSE, FALSE, sizeof (double));
+    double load_sum = 0.0, decode_sum = 0.0, sampling_sum = 0.0, wall_sum = 0.0;
+    guint n_ok = 0, n_load = 0, n_decode = 0, n_sampling = 0;
+    guint64 peak_rss = 0;
+
+    for (guint j = 0; j < bench_case->jobs->len; j++) {
+      EmergeJob *job = g_ptr_array_index (bench_case->jobs, j);
+
+      if (job->state != EMERGE_JOB_SUCCEEDED)
+        continue;
+
+      n_ok++;
+      wall_sum += job->wall_seconds;
+      peak_rss = MAX (peak_rss, job->peak_rss);
+
+      if (job->stats->load_seconds >= 0.0) {
+        load_sum += job->stats->load_seconds;
+        n_load++;
+      }
+      if (job->stats->decode_seconds >= 0.0) {
+        decode_sum += job->stats->decode_seconds;
+        n_decode++;
+      }
+      if (job->stats->sampling_seconds >= 0.0) {
+        sampling_sum += job->stats->sampling_seconds;
+        n_sampling++;
+      }
+      g_array_append_vals (steps, job->stats->step_seconds->data,
+                           job->stats->step_seconds->len);
+    }
+
+    g_array_sort (steps, compare_doubles);
+    warm_load_sum += load_sum;
+    n_warm_loads += n_load;
+
+    json_builder_begin_object (builder);
+    json_builder_set_member_name (builder, "key");
+    json_builder_add_string_value (builder, bench_case->key);
+    json_builder_set_member_name (builder, "sampler");
+    json_builder_add_string_value (builder, bench_case->sampler);
+    json_builder_set_member_name (builder, "steps");
+    json_builder_add_int_value (builder, bench_case->steps);
+    json_builder_set_member_name (builder, "width");
+    json_builder_add_int_value (builder, bench_case->width);
+    json_builder_set_member_name (builder, "height");
+    json_builder_add_int_value (builder, bench_case->height);
+    json_builder_set_member_name (builder, "threads");
+    json_builder_add_int_value (builder, bench_case->threads);
+    json_builder_set_member_name (builder, "runs");
+    json_builder_add_int_value (builder, n_ok);
+    json_builder_set_member_name (builder, "failed");
+    json_builder_add_int_value (builder, bench_case->jobs->len - n_ok);
+    add_double_or_null (builder, "load_seconds", n_load ? load_sum / n_load : NAN);
+    add_double_or_null (builder, "step_p50", percentile (steps, 50));
+    add_double_or_null (builder, "step_p90", percentile (steps, 90));
+    add_double_or_null (builder, "step_p99", percentile (steps, 99));
+    add_double_or_null (builder, "sampling_seconds", n_sampling ? sampling_sum / n_sampling : NAN);
+    add_double_or_null (builder, "decode_seconds", n_decode ? decode_sum / n_decode : NAN);
+    add_double_or_null (builder, "wall_seconds", n_ok ? wall_sum / n_ok : NAN);
+    add_double_or_null (builder, "images_per_hour", n_ok ? 3600.0 * n_ok / wall_sum : NAN);
+    json_builder_set_member_name (builder, "peak_rss");
+    json_builder_add_int_value (builder, peak_rss);
+    if (bench_case->trace != NULL)
+      benchmark_add_convergence (builder, bench_case);
+    json_builder_end_object (builder);
+
+    g_array_unref (steps);
+  }
+
+  json_builder_end_array (builder);
+
+  add_double_or_null (builder, "warm_load_seconds",
+                      n_warm_loads ? warm_load_sum / n_warm_loads : NAN);
+
+  json_builder_end_object (builder);
+  root = json_builder_get_root (builder);
+  g_object_unref (builder);
+
+  return root;
+}
+
+static void
+benchmark_finish (EmergeBenchmark *self,
+                  gboolean         completed)
+{
+  if (!self->running)
+    return;
+
+  g_object_ref (self);
+
+  self->running = FALSE;
+  if (completed)
+    self->report = benchmark_build_report (self);
+
+  /* Images kept for comparing with the full-step runs */
+  for (guint i = 0; i < self->cases->len; i++) {
+    BenchCase *bench_case = g_ptr_array_index (self->cases, i);
+    g_unlink (((EmergeJob *) g_ptr_array_index (bench_case->jobs, 0))->output_path);
+  }
+  for (guint i = 0; i < self->traces->len; i++) {
+    BenchTrace *trace = g_ptr_array_index (self->traces, i);
+    g_unlink (trace->job->output_path);
+    g_unlink (trace->job->preview_path);
+  }
+
+  g_rmdir (self->work_dir);
+  g_signal_emit (self, benchmark_signals[SIGNAL_FINISHED], 0, completed);
+
+  g_object_unref (self);
+}
+
+static gboolean
+benchmark_is_first_repeat (EmergeBenchmark *self,
+                           EmergeJob       *job)
+{
+  for (guint i = 0; i < self->cases->len; i++) {
+    BenchCase *bench_case = g_ptr_array_index (self->cases, i);
+
+    if (g_ptr_array_index (bench_case->jobs, 0) == job)
+      return TRUE;
+  }
+
+  return FALSE;
+}
+
+/* sd has just written the preview for @step */
+static void
+benchmark_trace_progress_cb (EmergeProcess   *process G_GNUC_UNUSED,
+                             gint             step,
+                             gint             total_steps G_GNUC_UNUSED,
+                             gdouble          seconds_per_step G_GNUC_UNUSED,
+                             EmergeBenchmark *self)
+{
+  GdkPixbuf *preview = gdk_pixbuf_new_from_file (self->current_trace->job->preview_path, NULL);
+
+  if (preview == NULL)
+    return;
+
+  emerge_convergence_add (self->current_trace->convergence, step,
+                          gdk_pixbuf_read_pixels (preview),
+                          gdk_pixbuf_get_width (preview),
+                          gdk_pixbuf_get_height (preview),
+                          gdk_pixbuf_get_rowstride (preview),
+                          gdk_pixbuf_get_n_channels (preview));
+  g_object_unref (preview);
+}
+
+static void
+benchmark_job_exited_cb (EmergeProcess   *process,
+                         gint             wait_status G_GNUC_UNUSED,
+                         EmergeBenchmark *self)
+{
+  g_signal_handlers_disconnect_by_data (process, self);
+  g_clear_object (&self->process);
+
+  /* Only the timings are of interest, not the image, unless it is to be
+   * compared with a full-step run */
+  if (!self->convergence || self->current_trace != NULL ||
+      !benchmark_is_first_repeat (self, self->current_job))
+    g_unlink (self->current_job->output_path);
+  g_clear_pointer (&self->current_job, emerge_job_unref);
+  self->current_trace = NULL;
+
+  self->n_done++;
+  g_signal_emit (self, benchmark_signals[SIGNAL_PROGRESS], 0, self->n_done, self->n_total);
+
+  if (g_cancellable_is_cancelled (self->cancellable))
+    benchmark_finish (self, FALSE);
+  else
+    benchmark_run_next (self);
+}
+
+static gboolean
+benchmark_spawn (EmergeBenchmark *self,
+                 EmergeJob       *job)
+{
+  GError *error = NULL;
+
+  self->process = emerge_job_spawn (job, self->manager, self->sd_path, NULL, &error);
+  if (self->process == NULL) {
+    g_warning ("Failed to start benchmark run: %s", error->message);
+    g_error_free (error);
+    self->n_done++;
+    return FALSE;
+  }
+
+  self->current_job = emerge_job_ref (job);
+  g_signal_connect (self->process, "exited",
+                    G_CALLBACK (benchmark_job_exited_cb), self);
+  if (self->current_trace != NULL)
+    g_signal_connect (self->process, "progress",
+                      G_CALLBACK (benchmark_trace_progress_cb), self);
+  return TRUE;
+}
+
+/* One sd at a time; a concurrent run would distort every number here */
+static void
+benchmark_run_next (EmergeBenchmark *self)
+{
+  if (self->cold_job->state == EMERGE_JOB_PENDING) {
+    GError *error = NULL;
+
+    self->cold_evicted = emerge_preload_evict (self->model_path, &error);
+    if (!self->cold_evicted) {
+      g_warning ("Cold load time will be optimistic: %s", error->message);
+      g_error_free (error);
+    }
+
+    if (benchmark_spawn (self, self->cold_job))
+      return;
+  }
+
+  while (self->case_index < self->cases->len) {
+    BenchCase *bench_case = g_ptr_array_index (self->cases, self->case_index);
+
+    if (self->job_index >= bench_case->jobs->len) {
+      self->case_index++;
+      self->job_index = 0;
+      continue;
+    }
+
+    if (benchmark_spawn (self, g_ptr_array_index (bench_case->jobs, self->job_index++)))
+      return;
+  }
+
+  /* Last, so the previews don't slow down any of the timed runs */
+  while (self->trace_index < self->traces->len) {
+    self->current_trace = g_ptr_array_index (self->traces, self->trace_index++);
+    if (benchmark_spawn (self, self->current_trace->job))
+      return;
+    self->current_trace = NULL;
+  }
+
+  benchmark_finish (self, TRUE);
+}
+
+/**
+ * emerge_benchmark_start:
+ * @self: a benchmark
+ *
+ * Drops the model from the page cache and times one cold run, then runs
+ * every combination of the matrix with the model cached. "finished" is
+ * emitted at the end, after which the report is available.
+ */
+void
+emerge_benchmark_start (EmergeBenchmark *self)
+{
+  GError *error = NULL;
+
+  g_return_if_fail (EMERGE_IS_BENCHMARK (self));
+  g_return_if_fail (!self->running);
+
+  self->work_dir = g_dir_make_tmp ("emerge-benchmark-XXXXXX", &error);
+  if (self->work_dir == NULL) {
+    g_warning ("Failed to create benchmark directory: %s", error->message);
+    g_error_free (error);
+    self->work_dir = g_build_filename (g_get_tmp_dir (), "emerge-benchmark", NULL);
+    g_mkdir_with_parents (self->work_dir, 0700);
+  }
+
+  benchmark_fill_defaults (self);
+  benchmark_build_cases (self);
+
+  g_clear_pointer (&self->started, g_date_time_unref);
+  self->started = g_date_time_new_now_local ();
+  self->running = TRUE;
+  self->n_done = 0;
+  self->case_index = 0;
+  self->job_index = 0;
+  self->trace_index = 0;
+
+  g_signal_emit (self, benchmark_signals[SIGNAL_PROGRESS], 0, 0, self->n_total);
+
+  g_object_ref (self);
+  benchmark_run_next (self);
+  g_object_unref (self);
+}
+
+void
+emerge_benchmark_cancel (EmergeBenchmark *self)
+{
+  g_return_if_fail (EMERGE_IS_BENCHMARK (self));
+
+  g_cancellable_cancel (self->cancellable);
+
+  if (self->process)
+    emerge_process_cancel (self->process);
+}
+
+gboolean
+emerge_benchmark_is_running (EmergeBenchmark *self)
+{
+  g_return_val_if_fail (EMERGE_IS_BENCHMARK (self), FALSE);
+
+  return self->running;
+}
+
+/* Returns: (transfer none) (nullable): the report of a completed run */
+JsonNode *
+emerge_benchmark_get_report (EmergeBenchmark *self)
+{
+  g_return_val_if_fail (EMERGE_IS_BENCHMARK (self), NULL);
+
+  return self->report;
+}
+
+static double
+get_double_or_nan (JsonObject *object,
+                   const char *member)
+{
+  JsonNode *node = json_object_get_member (object, member);
+
+  if (node == NULL || JSON_NODE_HOLDS_NULL (node))
+    return NAN;
+
+  return json_node_get_double (node);
+}
+
+static void
+append_cell (GString    *out,
+             const char *format,
+             double      value)
+{
+  if (isnan (value))
+    g_string_append_printf (out, "%9s", "-");
+  else
+    g_string_append_printf (out, format, value);
+}
+
+/* Plain text table of a report, one line per combination */
+gchar *
+emerge_benchmark_format_report (JsonObject *report)
+{
+  GString *out = g_string_new (NULL);
+  JsonObject *host = json_object_get_object_member (report, "host");
+  JsonArray *cases = json_object_get_array_member (report, "cases");
+
+  g_string_append_printf (out, "Host: %s, %" G_GINT64_FORMAT " cores\n",
+                          json_object_get_string_member (host, "cpu"),
+                          json_object_get_int_member (host, "cores"));
+  g_string_append (out, "Load: cold ");
+  append_cell (out, "%8.2fs", get_double_or_nan (report, "cold_load_seconds"));
+  g_string_append (out, ", warm ");
+  append_cell (out, "%8.2fs", get_double_or_nan (report, "warm_load_seconds"));
+  g_string_append (out, "\n\n");
+
+  g_string_append_printf (out, "%-28s %9s %9s %9s %9s %9s\n",
+                          "case", "p50 s/it", "p90 s/it", "p99 s/it", "decode s", "img/hour");
+
+  for (guint i = 0; i < json_array_get_length (cases); i++) {
+    JsonObject *c = json_array_get_object_element (cases, i);
+
+    g_string_append_printf (out, "%-28s", json_object_get_string_member (c, "key"));
+    append_cell (out, " %9.3f", get_double_or_nan (c, "step_p50"));
+    append_cell (out, " %9.3f", get_double_or_nan (c, "step_p90"));
+    append_cell (out, " %9.3f", get_double_or_nan (c, "step_p99"));
+    append_cell (out, " %9.2f", get_double_or_nan (c, "decode_seconds"));
+    append_cell (out, " %9.1f", get_double_or_nan (c, "images_per_hour"));
+    if (json_object_has_member (c, "full_steps")) {
+      g_string_append_printf (out, "  vs %" G_GINT64_FORMAT " steps: SSIM",
+                              json_object_get_int_member (c, "full_steps"));
+      append_cell (out, " %.3f", get_double_or_nan (c, "ssim_vs_full"));
+      g_string_append (out, ", change/step");
+      append_cell (out, " %.4f", get_double_or_nan (c, "step_delta"));
+    }
+    if (json_object_get_int_member (c, "failed") > 0)
+      g_string_append_printf (out, "  (%" G_GINT64_FORMAT " failed)",
+                              json_object_get_int_member (c, "failed"));
+    g_string_append_c (out, '\n');
+  }
+
+  return g_string_free (out, FALSE);
+}
+
+/* Appends one comparison line; returns TRUE if it is a regression */
+static gboolean
+compare_metric (GString    *summary,
+                const char *label,
+                double      current,
+                double      baseline,
+                gboolean    higher_is_better,
+                double      tolerance)
+{
+  double change;
+  gboolean regressed;
+
+  if (isnan (current) || isnan (baseline) || baseline == 0.0)
+    return FALSE;
+
+  change = (current - baseline) / baseline;
+  regressed = higher_is_better ? change < -tolerance : change > tolerance;
+
+  g_string_append_printf (summary, "  %-36s %10.3f -> %10.3f  %+6.1f%%%s\n",
+                          label, baseline, current, change * 100.0,
+                          regressed ? "  REGRESSION" : "");
+
+  return regressed;
+}
+
+/**
+ * emerge_benchmark_compare:
+ * @report: a new report
+ * @baseline: a saved report to compare against
+ * @tolerance: relative change tolerated before flagging, e.g. 0.05
+ * @summary: string the comparison is appended to
+ *
+ * Matches combinations by sampler, steps, resolution and threads and
+ * compares images per hour, median step latency and load times.
+ *
+ * Returns: the number of regressions beyond @tolerance
+ */
+guint
+emerge_benchmark_compare (JsonObject *report,
+                          JsonObject *baseline,
+                          double      tolerance,
+                          GString    *summary)
+{
+  JsonArray *cases, *base_cases;
+  JsonObject *host, *base_host;
+  guint n_regressions = 0;
+
+  if (!json_object_has_member (baseline, "cases") ||
+      !json_object_has_member (baseline, "host")) {
+    g_string_append (summary, "Baseline is not a benchmark report\n");
+    return 0;
+  }
+
+  cases = json_object_get_array_member (report, "cases");
+  base_cases = json_object_get_array_member (baseline, "cases");
+  host = json_object_get_object_member (report, "host");
+  base_host = json_object_get_object_member (baseline, "host");
+
+  if (g_strcmp0 (json_object_get_string_member (host, "cpu"),
+                 json_object_get_string_member (base_host, "cpu")) != 0)
+    g_string_append_printf (summary, "Note: baseline was recorded on %s\n",
+                            json_object_get_string_member (base_host, "cpu"));
+
+  g_string_append_printf (summary, "Compared with baseline from %s:\n",
+                          json_object_get_string_member (baseline, "timestamp"));
+
+  n_regressions += compare_metric (summary, "cold load s",
+                                   get_double_or_nan (report, "cold_load_seconds"),
+                                   get_double_or_nan (baseline, "cold_load_seconds"),
+                                   FALSE, tolerance);
+  n_regressions += compare_metric (summary, "warm load s",
+                                   get_double_or_nan (report, "warm_load_seconds"),
+                                   get_double_or_nan (baseline, "warm_load_seconds"),
+                                   FALSE, tolerance);
+
+  for (guint i = 0; i < json_array_get_length (cases); i++) {
+    JsonObject *c = json_array_get_object_element (cases, i);
+    const char *key = json_object_get_string_member (c, "key");
+    JsonObject *base = NULL;
+
+    for (guint j = 0; j < json_array_get_length (base_cases) && base == NULL; j++) {
+      JsonObject *candidate = json_array_get_object_element (base_cases, j);
+
+      if (g_strcmp0 (json_object_get_string_member (candidate, "key"), key) == 0)
+        base = candidate;
+    }
+
+    if (base == NULL) {
+      g_string_append_printf (summary, "  %-36s not in baseline\n", key);
+      continue;
+    }
+
+    gchar *label = g_strdup_printf ("%s img/hour", key);
+    n_regressions += compare_metric (summary, label,
+                                     get_double_or_nan (c, "images_per_hour"),
+                                     get_double_or_nan (base, "images_per_hour"),
+                                     TRUE, tolerance);
+    g_free (label);
+
+    label = g_strdup_printf ("%s p50 s/it", key);
+    n_regressions += compare_metric (summary, label,
+                                     get_double_or_nan (c, "step_p50"),
+                                     get_double_or_nan (base, "step_p50"),
+                                     FALSE, tolerance);
+    g_free (label);
+  }
+
+  return n_regressions;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <gio/gio.h>
+#include <json-glib/json-glib.h>
+
+#include "emerge-process-manager.h"
+
+G_BEGIN_DECLS
+
+#define EMERGE_TYPE_BENCHMARK (emerge_benchmark_get_type())
+
+G_DECLARE_FINAL_TYPE (EmergeBenchmark, emerge_benchmark, EMERGE, BENCHMARK, GObject)
+
+EmergeBenchmark *emerge_benchmark_new            (EmergeProcessManager  *manager,
+                                                  const char            *sd_path,
+                                                  const char            *model_path);
+gboolean         emerge_benchmark_set_matrix     (EmergeBenchmark       *self,
+                                                  const char            *samplers,
+                                                  const char            *steps,
+                                                  const char            *sizes,
+                                                  const char            *threads,
+                                                  GError               **error);
+void             emerge_benchmark_set_repeats    (EmergeBenchmark       *self,
+                                                  guint                  repeats);
+void             emerge_benchmark_set_convergence (EmergeBenchmark      *self,
+                                                  gboolean               enabled);
+void             emerge_benchmark_start          (EmergeBenchmark       *self);
+void             emerge_benchmark_cancel         (EmergeBenchmark       *self);
+gboolean         emerge_benchmark_is_running     (EmergeBenchmark       *self);
+JsonNode        *emerge_benchmark_get_report     (EmergeBenchmark       *self);
+
+gchar           *emerge_benchmark_format_report  (JsonObject            *report);
+guint            emerge_benchmark_compare        (JsonObject            *report,
+                                                  JsonObject            *baseline,
+                                                  double                 tolerance,
+                                                  GString               *summary);
+
+G_END_DECLS
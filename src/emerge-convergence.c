@@ -0,0 +1,155 @@
+#include "emerge-convergence.h"
+
+#include <math.h>
+#include <string.h>
+
+struct _EmergeConvergence
+{
+  double  threshold;
+  guint   patience;
+
+  /* The last preview, packed RGB */
+  guint8 *previous;
+  int     width;
+  int     height;
+  gint    previous_step;
+
+  guint   n_below;
+  gint    converged_step;
+  GArray *deltas;         /* double per step, from step 1; NAN where unknown */
+};
+
+EmergeConvergence *
+emerge_convergence_new (double threshold,
+                        guint  patience)
+{
+  EmergeConvergence *self = g_new0 (EmergeConvergence, 1);
+
+  self->threshold = threshold;
+  self->patience = MAX (patience, 1);
+  self->deltas = g_array_new (FALSE, FALSE, sizeof (double));
+
+  return self;
+}
+
+void
+emerge_convergence_free (EmergeConvergence *self)
+{
+  if (self == NULL)
+    return;
+
+  g_array_unref (self->deltas);
+  g_free (self->previous);
+  g_free (self);
+}
+
+/* RMS difference from the previous preview, spread over the steps since */
+static double
+convergence_delta (EmergeConvergence *self,
+                   const guint8      *pixels,
+                   int                rowstride,
+                   int                n_channels,
+                   gint               n_steps)
+{
+  double sum = 0.0;
+
+  for (int y = 0; y < self->height; y++) {
+    const guint8 *row = pixels + (gsize) y * rowstride;
+    const guint8 *before = self->previous + (gsize) y * self->width * 3;
+
+    for (int x = 0; x < self->width; x++)
+      for (int c = 0; c < 3; c++) {
+        double d = (row[x * n_channels + c] - before[x * 3 + c]) / 255.0;
+        sum += d * d;
+      }
+  }
+
+  return sqrt (sum / ((double) self->width * self->height * 3)) / n_steps;
+}
+
+/**
+ * emerge_convergence_add:
+ * @self: a convergence tracker
+ * @step: the sampling step the preview was taken at
+ * @pixels: the preview, 8 bits per channel, RGB first
+ * @width: its width
+ * @height: its height
+ * @rowstride: bytes between rows
+ * @n_channels: bytes per pixel, 3 or 4
+ *
+ * Compares a preview with the one before it. A preview of a different
+ * size, or not later than the last, starts the comparison over.
+ *
+ * Returns: %TRUE if sampling has just been found to have converged
+ */
+gboolean
+emerge_convergence_add (EmergeConvergence *self,
+                        gint               step,
+                        const guint8      *pixels,
+                        int                width,
+                        int                height,
+                        int                rowstride,
+                        int                n_channels)
+{
+  gboolean converged = FALSE;
+
+  g_return_val_if_fail (self != NULL, FALSE);
+  g_return_val_if_fail (pixels != NULL && n_channels >= 3, FALSE);
+
+  if (self->previous != NULL && width == self->width && height == self->height &&
+      step > self->previous_step) {
+    double delta = convergence_delta (self, pixels, rowstride, n_channels,
+                                      step - self->previous_step);
+
+    while (self->deltas->len < (guint) step) {
+      double unknown = NAN;
+      g_array_append_val (self->deltas, unknown);
+    }
+    g_array_index (self->deltas, double, step - 1) = delta;
+
+    self->n_below = delta < self->threshold ? self->n_below + 1 : 0;
+    if (self->converged_step == 0 && self->n_below >= self->patience) {
+      self->converged_step = step;
+      converged = TRUE;
+    }
+  } else {
+    self->n_below = 0;
+  }
+
+  if (width != self->width || height != self->height || self->previous == NULL) {
+    g_free (self->previous);
+    self->previous = g_malloc ((gsize) width * height * 3);
+    self->width = width;
+    self->height = height;
+  }
+
+  for (int y = 0; y < height; y++)
+    for (int x = 0; x < width; x++)
+      memcpy (self->previous + ((gsize) y * width + x) * 3,
+              pixels + (gsize) y * rowstride + x * n_channels, 3);
+  self->previous_step = step;
+
+  return converged;
+}
+
+/* The step sampling settled at, or 0 if it hasn't yet */
+gint
+emerge_convergence_get_converged_step (EmergeConvergence *self)
+{
+  g_return_val_if_fail (self != NULL, 0);
+
+  return self->converged_step;
+}
+
+/* Change per step measured at @step, or NAN if there was no preview then */
+double
+emerge_convergence_get_delta (EmergeConvergence *self,
+                              gint               step)
+{
+  g_return_val_if_fail (self != NULL, NAN);
+
+  if (step < 1 || (guint) step > self->deltas->len)
+    return NAN;
+
+  return g_array_index (self->deltas, double, step - 1);
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Below this much change per step, as the RMS of 0–1 channel values between
+ * previews, sampling counts as settled; and this many previews in a row
+ * have to agree */
+#define EMERGE_CONVERGENCE_DEFAULT_THRESHOLD 0.004
+#define EMERGE_CONVERGENCE_DEFAULT_PATIENCE  3
+
+/* Watches the previews of a running generation and tells when the image
+ * has stopped changing, which is the step the run could have ended at */
+typedef struct _EmergeConvergence EmergeConvergence;
+
+EmergeConvergence *emerge_convergence_new                (double              threshold,
+                                                          guint               patience);
+void               emerge_convergence_free               (EmergeConvergence  *convergence);
+gboolean           emerge_convergence_add                (EmergeConvergence  *convergence,
+                                                          gint                step,
+                                                          const guint8       *pixels,
+                                                          int                 width,
+                                                          int                 height,
+                                                          int                 rowstride,
+                                                          int                 n_channels);
+gint               emerge_convergence_get_converged_step (EmergeConvergence  *convergence);
+double             emerge_convergence_get_delta          (EmergeConvergence  *convergence,
+                                                          gint                step);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (EmergeConvergence, emerge_convergence_free)
+
+G_END_DECLS
@@ -0,0 +1,569 @@
+#include "emerge-cost-model.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Least squares sums for y = a + b x */
+typedef struct {
+  double n;
+  double sx;
+  double sy;
+  double sxx;
+  double sxy;
+} CostFit;
+
+typedef enum {
+  PHASE_LOAD,       /* seconds */
+  PHASE_STEP,       /* seconds per model evaluation, against megapixels */
+  PHASE_DECODE,     /* seconds, against megapixels */
+  PHASE_OVERHEAD,   /* wall time sd reported no phase for */
+  N_PHASES
+} CostPhase;
+
+typedef struct {
+  CostFit fits[N_PHASES];
+} CostGroup;
+
+/* Groups from the most specific to the least */
+#define N_GROUP_KEYS 5
+
+/* One run, as recorded */
+typedef struct {
+  const char *host;
+  const char *model;
+  const char *quant;
+  const char *sampler;
+  gint        width;
+  gint        height;
+  gint        steps;
+  gint        threads;
+  double      load_seconds;
+  double      sampling_seconds;
+  double      decode_seconds;
+  double      wall_seconds;
+} CostRun;
+
+struct _EmergeCostModel
+{
+  gchar      *path;
+  gchar      *host;
+  GHashTable *groups;     /* key → CostGroup */
+  guint       n_runs;     /* on this host */
+};
+
+static void
+cost_fit_add (CostFit *fit,
+              double   x,
+              double   y)
+{
+  fit->n += 1.0;
+  fit->sx += x;
+  fit->sy += y;
+  fit->sxx += x * x;
+  fit->sxy += x * y;
+}
+
+/* Falls back to y proportional to x, or to the mean if there is no x,
+ * when the runs don't pin down a line that stays positive */
+static double
+cost_fit_eval (const CostFit *fit,
+               double         x)
+{
+  double det;
+
+  if (fit->n == 0.0)
+    return -1.0;
+
+  det = fit->n * fit->sxx - fit->sx * fit->sx;
+  if (fit->n >= 2.0 && det > 1e-9 * fit->n * fit->sxx) {
+    double b = (fit->n * fit->sxy - fit->sx * fit->sy) / det;
+    double a = (fit->sy - b * fit->sx) / fit->n;
+
+    if (a >= 0.0 && b >= 0.0)
+      return a + b * x;
+  }
+
+  if (fit->sx > 0.0 && x > 0.0)
+    return fit->sy / fit->sx * x;
+
+  return fit->sy / fit->n;
+}
+
+/* Samplers that evaluate the model twice per step */
+static double
+sampler_evaluations (const char *sampler)
+{
+  static const char * const twice[] = { "heun", "dpm2", "dpm++2s_a", NULL };
+
+  if (sampler != NULL && g_strv_contains (twice, sampler))
+    return 2.0;
+
+  return 1.0;
+}
+
+static void
+group_keys (const char *model,
+            const char *quant,
+            gint        threads,
+            gchar      *keys[N_GROUP_KEYS])
+{
+  keys[0] = g_strdup_printf ("model %s, %d threads", model, threads);
+  keys[1] = g_strdup_printf ("model %s", model);
+  keys[2] = g_strdup_printf ("quant %s, %d threads", quant, threads);
+  keys[3] = g_strdup_printf ("quant %s", quant);
+  keys[4] = g_strdup ("all");
+}
+
+static void
+group_keys_free (gchar *keys[N_GROUP_KEYS])
+{
+  for (guint i = 0; i < N_GROUP_KEYS; i++)
+    g_free (keys[i]);
+}
+
+static void
+cost_model_add_run (EmergeCostModel *self,
+                    const CostRun   *run)
+{
+  double megapixels = run->width * (double) run->height / 1e6;
+  double evaluations = MAX (run->steps, 1) * sampler_evaluations (run->sampler);
+  gchar *keys[N_GROUP_KEYS];
+
+  if (g_strcmp0 (run->host, self->host) != 0 || run->model == NULL)
+    return;
+
+  self->n_runs++;
+  group_keys (run->model, run->quant, run->threads, keys);
+
+  for (guint i = 0; i < N_GROUP_KEYS; i++) {
+    CostGroup *group = g_hash_table_lookup (self->groups, keys[i]);
+
+    if (group == NULL) {
+      group = g_new0 (CostGroup, 1);
+      g_hash_table_insert (self->groups, g_strdup (keys[i]), group);
+    }
+
+    if (run->load_seconds >= 0.0)
+      cost_fit_add (&group->fits[PHASE_LOAD], 0.0, run->load_seconds);
+    if (run->sampling_seconds >= 0.0)
+      cost_fit_add (&group->fits[PHASE_STEP], megapixels, run->sampling_seconds / evaluations);
+    if (run->decode_seconds >= 0.0)
+      cost_fit_add (&group->fits[PHASE_DECODE], megapixels, run->decode_seconds);
+    if (run->load_seconds >= 0.0 && run->sampling_seconds >= 0.0 &&
+        run->decode_seconds >= 0.0 && run->wall_seconds > 0.0)
+      cost_fit_add (&group->fits[PHASE_OVERHEAD], 0.0,
+                    MAX (run->wall_seconds - run->load_seconds -
+                         run->sampling_seconds - run->decode_seconds, 0.0));
+  }
+
+  group_keys_free (keys);
+}
+
+/**
+ * emerge_cost_model_new:
+ * @path: the file runs are kept in
+ * @host: (nullable): the machine to predict for, or %NULL for this one
+ *
+ * Returns: (transfer full): an empty model; see emerge_cost_model_load()
+ */
+EmergeCostModel *
+emerge_cost_model_new (const char *path,
+                       const char *host)
+{
+  EmergeCostModel *self;
+
+  g_return_val_if_fail (path != NULL, NULL);
+
+  self = g_new0 (EmergeCostModel, 1);
+  self->path = g_strdup (path);
+  self->host = g_strdup (host != NULL ? host : g_get_host_name ());
+  self->groups = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
+  return self;
+}
+
+void
+emerge_cost_model_free (EmergeCostModel *self)
+{
+  if (self == NULL)
+    return;
+
+  g_free (self->path);
+  g_free (self->host);
+  g_hash_table_unref (self->groups);
+  g_free (self);
+}
+
+/* Rewrites the file with only its last EMERGE_COST_MODEL_MAX_RUNS lines */
+static void
+cost_model_trim (EmergeCostModel *self,
+                 const char      *contents,
+                 gsize            length,
+                 guint            n_lines)
+{
+  const char *start = contents;
+  GError *error = NULL;
+
+  for (guint n_dropped = 0; n_dropped < n_lines - EMERGE_COST_MODEL_MAX_RUNS; n_dropped++) {
+    const char *end = memchr (start, '\n', contents + length - start);
+
+    if (end == NULL)
+      return;
+    start = end + 1;
+  }
+
+  if (!g_file_set_contents_full (self->path, start, contents + length - start,
+                                 G_FILE_SET_CONTENTS_CONSISTENT, 0644, &error)) {
+    g_warning ("Failed to trim %s: %s", self->path, error->message);
+    g_error_free (error);
+  }
+}
+
+/**
+ * emerge_cost_model_load:
+ * @self: a model
+ * @error: return location for an error
+ *
+ * Fits the model to the runs on file, replacing what it was fitted to
+ * before. A missing file is no error; unreadable lines are skipped.
+ *
+ * Returns: %TRUE unless the file couldn't be read
+ */
+gboolean
+emerge_cost_model_load (EmergeCostModel  *self,
+                        GError          **error)
+{
+  JsonParser *parser;
+  gchar *contents = NULL;
+  gsize length;
+  GError *local_error = NULL;
+  guint n_lines = 0;
+
+  g_return_val_if_fail (self != NULL, FALSE);
+
+  g_hash_table_remove_all (self->groups);
+  self->n_runs = 0;
+
+  if (!g_file_get_contents (self->path, &contents, &length, &local_error)) {
+    if (g_error_matches (local_error, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
+      g_error_free (local_error);
+      return TRUE;
+    }
+
+    g_propagate_error (error, local_error);
+    return FALSE;
+  }
+
+  parser = json_parser_new ();
+
+  for (char *line = contents, *end; line < contents + length; line = end + 1) {
+    JsonObject *object;
+    CostRun run;
+
+    end = memchr (line, '\n', contents + length - line);
+    if (end == NULL)
+      end = contents + length;
+
+    if (end == line)
+      continue;
+
+    n_lines++;
+
+    if (!json_parser_load_from_data (parser, line, end - line, NULL) ||
+        !JSON_NODE_HOLDS_OBJECT (json_parser_get_root (parser)))
+      continue;
+
+    object = json_node_get_object (json_parser_get_root (parser));
+    run.host = json_object_get_string_member_with_default (object, "host", NULL);
+    run.model = json_object_get_string_member_with_default (object, "model", NULL);
+    run.quant = json_object_get_string_member_with_default (object, "quant", "");
+    run.sampler = json_object_get_string_member_with_default (object, "sampler", NULL);
+    run.width = json_object_get_int_member_with_default (object, "width", 0);
+    run.height = json_object_get_int_member_with_default (object, "height", 0);
+    run.steps = json_object_get_int_member_with_default (object, "steps", 0);
+    run.threads = json_object_get_int_member_with_default (object, "threads", 0);
+    run.load_seconds = json_object_get_double_member_with_default (object, "load_seconds", -1.0);
+    run.sampling_seconds = json_object_get_double_member_with_default (object, "sampling_seconds", -1.0);
+    run.decode_seconds = json_object_get_double_member_with_default (object, "decode_seconds", -1.0);
+    run.wall_seconds = json_object_get_double_member_with_default (object, "wall_seconds", 0.0);
+    cost_model_add_run (self, &run);
+  }
+
+  g_object_unref (parser);
+
+  if (n_lines > 2 * EMERGE_COST_MODEL_MAX_RUNS)
+    cost_model_trim (self, contents, length, n_lines);
+  g_free (contents);
+
+  return TRUE;
+}
+
+static void
+add_seconds_member (JsonBuilder *builder,
+                    const char  *name,
+                    double       seconds)
+{
+  if (seconds < 0.0)
+    return;
+
+  json_builder_set_member_name (builder, name);
+  json_builder_add_double_value (builder, seconds);
+}
+
+/**
+ * emerge_cost_model_record:
+ * @self: a model
+ * @job: a job sd has run successfully
+ * @error: return location for an error
+ *
+ * Appends the timings of @job to the file and fits the model to them.
+ * A job that was paused while it ran is skipped, since the timings sd
+ * reports then include the time it spent stopped.
+ *
+ * Returns: %FALSE if they couldn't be written
+ */
+gboolean
+emerge_cost_model_record (EmergeCostModel  *self,
+                          const EmergeJob  *job,
+                          GError          **error)
+{
+  JsonBuilder *builder;
+  JsonGenerator *generator;
+  JsonNode *root;
+  CostRun run;
+  gchar *model, *quant, *line, *dir;
+  gsize length;
+  gboolean ok = TRUE;
+  int fd;
+
+  g_return_val_if_fail (self != NULL, FALSE);
+  g_return_val_if_fail (job != NULL && job->model_path != NULL, FALSE);
+
+  if (job->was_paused)
+    return TRUE;
+
+  model = g_path_get_basename (job->model_path);
+  quant = emerge_cost_model_get_quant (job->model_path);
+
+  run.host = self->host;
+  run.model = model;
+  run.quant = quant;
+  run.sampler = job->sampling_method;
+  run.width = job->width;
+  run.height = job->height;
+  run.steps = job->steps;
+  run.threads = job->threads;
+  run.load_seconds = job->stats != NULL ? job->stats->load_seconds : -1.0;
+  run.sampling_seconds = job->stats != NULL ? job->stats->sampling_seconds : -1.0;
+  run.decode_seconds = job->stats != NULL ? job->stats->decode_seconds : -1.0;
+  run.wall_seconds = job->wall_seconds;
+
+  builder = json_builder_new ();
+  json_builder_begin_object (builder);
+  json_builder_set_member_name (builder, "time");
+  json_builder_add_int_value (builder, g_get_real_time () / G_USEC_PER_SEC);
+  json_builder_set_member_name (builder, "host");
+  json_builder_add_string_value (builder, run.host);
+  json_builder_set_member_name (builder, "model");
+  json_builder_add_string_value (builder, run.model);
+  json_builder_set_member_name (builder, "quant");
+  json_builder_add_string_value (builder, run.quant);
+  json_builder_set_member_name (builder, "width");
+  json_builder_add_int_value (builder, run.width);
+  json_builder_set_member_name (builder, "height");
+  json_builder_add_int_value (builder, run.height);
+  json_builder_set_member_name (builder, "steps");
+  json_builder_add_int_value (builder, run.steps);
+  json_builder_set_member_name (builder, "sampler");
+  json_builder_add_string_value (builder, run.sampler);
+  json_builder_set_member_name (builder, "threads");
+  json_builder_add_int_value (builder, run.threads);
+  add_seconds_member (builder, "load_seconds", run.load_seconds);
+  add_seconds_member (builder, "sampling_seconds", run.sampling_seconds);
+  add_seconds_member (builder, "decode_seconds", run.decode_seconds);
+  add_seconds_member (builder, "wall_seconds", run.wall_seconds);
+  json_builder_end_object (builder);
+
+  root = json_builder_get_root (builder);
+  generator = json_generator_new ();
+  json_generator_set_root (generator, root);
+  line = json_generator_to_data (generator, &length);
+  line = g_realloc (line, length + 2);
+  line[length++] = '\n';
+  line[length] = '\0';
+  json_node_unref (root);
+  g_object_unref (generator);
+  g_object_unref (builder);
+
+  dir = g_path_get_dirname (self->path);
+  g_mkdir_with_parents (dir, 0755);
+  g_free (dir);
+
+  fd = open (self->path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+  if (fd < 0 || write (fd, line, length) != (gssize) length) {
+    int saved_errno = errno;
+
+    g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (saved_errno),
+                 "Failed to write %s: %s", self->path, g_strerror (saved_errno));
+    ok = FALSE;
+  }
+  if (fd >= 0)
+    close (fd);
+
+  /* Worth learning from even if it couldn't be kept */
+  cost_model_add_run (self, &run);
+
+  g_free (line);
+  g_free (quant);
+  g_free (model);
+
+  return ok;
+}
+
+/* How many runs on this host the model is fitted to */
+guint
+emerge_cost_model_get_n_runs (EmergeCostModel *self)
+{
+  g_return_val_if_fail (self != NULL, 0);
+
+  return self->n_runs;
+}
+
+/* The most specific fit of @phase there are runs for, or -1 */
+static double
+cost_model_predict_phase (EmergeCostModel *self,
+                          gchar           *keys[N_GROUP_KEYS],
+                          CostPhase        phase,
+                          double           megapixels)
+{
+  for (guint i = 0; i < N_GROUP_KEYS; i++) {
+    CostGroup *group = g_hash_table_lookup (self->groups, keys[i]);
+
+    if (group != NULL && group->fits[phase].n > 0.0)
+      return cost_fit_eval (&group->fits[phase], megapixels);
+  }
+
+  return -1.0;
+}
+
+/* Seconds per phase, with 0 for phases no run has reported */
+static gboolean
+cost_model_predict_phases (EmergeCostModel *self,
+                           const EmergeJob *job,
+                           double           seconds[N_PHASES])
+{
+  double megapixels = job->width * (double) job->height / 1e6;
+  gchar *model, *quant;
+  gchar *keys[N_GROUP_KEYS];
+
+  model = g_path_get_basename (job->model_path);
+  quant = emerge_cost_model_get_quant (job->model_path);
+  group_keys (model, quant, job->threads, keys);
+  g_free (quant);
+  g_free (model);
+
+  for (guint phase = 0; phase < N_PHASES; phase++)
+    seconds[phase] = cost_model_predict_phase (self, keys, phase, megapixels);
+  group_keys_free (keys);
+
+  /* Without sampling times there is nothing to go on */
+  if (seconds[PHASE_STEP] < 0.0)
+    return FALSE;
+
+  seconds[PHASE_STEP] *= sampler_evaluations (job->sampling_method);
+  for (guint phase = 0; phase < N_PHASES; phase++)
+    seconds[phase] = MAX (seconds[phase], 0.0);
+
+  return TRUE;
+}
+
+/**
+ * emerge_cost_model_predict:
+ * @self: a model
+ * @job: a job to run on this host
+ *
+ * Returns: the seconds sd is expected to take over @job, or -1 if no
+ *   run on this host says anything about it. Upscaling isn't included.
+ */
+double
+emerge_cost_model_predict (EmergeCostModel *self,
+                           const EmergeJob *job)
+{
+  double seconds[N_PHASES];
+
+  g_return_val_if_fail (self != NULL, -1.0);
+  g_return_val_if_fail (job != NULL, -1.0);
+
+  if (job->model_path == NULL || !cost_model_predict_phases (self, job, seconds))
+    return -1.0;
+
+  return seconds[PHASE_LOAD] + MAX (job->steps, 1) * seconds[PHASE_STEP] +
+         seconds[PHASE_DECODE] + seconds[PHASE_OVERHEAD];
+}
+
+/**
+ * emerge_cost_model_predict_remaining:
+ * @self: a model
+ * @job: a running job
+ * @step: the last step sd reported, or 0
+ * @elapsed: seconds since it started
+ *
+ * Returns: the seconds @job is expected to take yet, or -1 as for
+ *   emerge_cost_model_predict()
+ */
+double
+emerge_cost_model_predict_remaining (EmergeCostModel *self,
+                                     const EmergeJob *job,
+                                     gint             step,
+                                     double           elapsed)
+{
+  double seconds[N_PHASES];
+
+  g_return_val_if_fail (self != NULL, -1.0);
+  g_return_val_if_fail (job != NULL, -1.0);
+
+  if (job->model_path == NULL || !cost_model_predict_phases (self, job, seconds))
+    return -1.0;
+
+  /* Once sampling has begun the steps left say more than the clock */
+  if (step > 0 && step <= job->steps)
+    return (job->steps - step) * seconds[PHASE_STEP] +
+           seconds[PHASE_DECODE] + seconds[PHASE_OVERHEAD];
+
+  return MAX (seconds[PHASE_LOAD] + MAX (job->steps, 1) * seconds[PHASE_STEP] +
+              seconds[PHASE_DECODE] + seconds[PHASE_OVERHEAD] - elapsed, 0.0);
+}
+
+/**
+ * emerge_cost_model_get_quant:
+ * @model_path: a model file
+ *
+ * Returns: (transfer full): the weight type of a conversion named the way
+ *   emerge names them, e.g. "q8_0" for model.q8_0.gguf, or else the
+ *   file's extension
+ */
+gchar *
+emerge_cost_model_get_quant (const char *model_path)
+{
+  gchar *basename = g_path_get_basename (model_path);
+  gchar *extension = strrchr (basename, '.');
+  gchar *quant;
+
+  if (extension == NULL) {
+    g_free (basename);
+    return g_strdup ("");
+  }
+
+  *extension = '\0';
+  quant = strrchr (basename, '.');
+  if (g_str_equal (extension + 1, "gguf") && quant != NULL &&
+      g_strv_contains (emerge_sd_quant_types, quant + 1))
+    quant = g_strdup (quant + 1);
+  else
+    quant = g_strdup (extension + 1);
+
+  g_free (basename);
+  return quant;
+}
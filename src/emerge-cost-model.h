@@ -0,0 +1,43 @@
+#pragma once
+
+#include <glib.h>
+
+#include "emerge-job.h"
+
+G_BEGIN_DECLS
+
+/* Runs kept on file; older ones are dropped when it is loaded */
+#define EMERGE_COST_MODEL_MAX_RUNS 2000
+
+/* Predicts how long a job takes on this machine from how long earlier
+ * ones did. Each finished run is appended to a file as a line of JSON
+ * with its model, quant, size, steps, sampler, threads, host and the
+ * seconds sd spent loading, sampling and decoding. Per host, each phase
+ * is fitted by least squares against the image's megapixels: sampling
+ * per step, decoding per image, and loading and process overhead as
+ * plain means. Runs of the same model and thread count are preferred,
+ * falling back to the same model, then the same quant, then anything run
+ * on the host. */
+typedef struct _EmergeCostModel EmergeCostModel;
+
+EmergeCostModel *emerge_cost_model_new          (const char       *path,
+                                                 const char       *host);
+void             emerge_cost_model_free         (EmergeCostModel  *self);
+gboolean         emerge_cost_model_load         (EmergeCostModel  *self,
+                                                 GError          **error);
+gboolean         emerge_cost_model_record       (EmergeCostModel  *self,
+                                                 const EmergeJob  *job,
+                                                 GError          **error);
+guint            emerge_cost_model_get_n_runs   (EmergeCostModel  *self);
+double           emerge_cost_model_predict      (EmergeCostModel  *self,
+                                                 const EmergeJob  *job);
+double           emerge_cost_model_predict_remaining (EmergeCostModel *self,
+                                                      const EmergeJob *job,
+                                                      gint             step,
+                                                      double           elapsed);
+
+gchar           *emerge_cost_model_get_quant    (const char       *model_path);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (EmergeCostModel, emerge_cost_model_free)
+
+G_END_DECLS
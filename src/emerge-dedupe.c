@@ -0,0 +1,252 @@
+#include "emerge-dedupe.h"
+
+#include "emerge-image-metrics.h"
+
+#define NO_NODE G_MAXUINT
+
+/* Nodes live in one array and refer to each other by index; the children
+ * of a node form a list, each child labelled with its distance from the
+ * parent. A node has at most 65 children, one per possible distance. */
+typedef struct {
+  guint64  hash;
+  gpointer data;
+  guint    first_child;
+  guint    next_sibling;
+  guint    distance;
+} BkNode;
+
+struct _EmergeBkTree
+{
+  GArray *nodes;
+};
+
+EmergeBkTree *
+emerge_bk_tree_new (void)
+{
+  EmergeBkTree *tree = g_new0 (EmergeBkTree, 1);
+
+  tree->nodes = g_array_new (FALSE, FALSE, sizeof (BkNode));
+
+  return tree;
+}
+
+void
+emerge_bk_tree_free (EmergeBkTree *tree)
+{
+  if (tree == NULL)
+    return;
+
+  g_array_unref (tree->nodes);
+  g_free (tree);
+}
+
+guint
+emerge_bk_tree_get_size (EmergeBkTree *tree)
+{
+  g_return_val_if_fail (tree != NULL, 0);
+
+  return tree->nodes->len;
+}
+
+/* @data is not owned by the tree */
+void
+emerge_bk_tree_insert (EmergeBkTree *tree,
+                       guint64       hash,
+                       gpointer      data)
+{
+  BkNode node = { hash, data, NO_NODE, NO_NODE, 0 };
+  guint parent = 0;
+
+  g_return_if_fail (tree != NULL);
+
+  if (tree->nodes->len == 0) {
+    g_array_append_val (tree->nodes, node);
+    return;
+  }
+
+  for (;;) {
+    BkNode *p = &g_array_index (tree->nodes, BkNode, parent);
+    guint d = emerge_image_metrics_hamming (hash, p->hash);
+    guint child;
+
+    for (child = p->first_child; child != NO_NODE;
+         child = g_array_index (tree->nodes, BkNode, child).next_sibling)
+      if (g_array_index (tree->nodes, BkNode, child).distance == d)
+        break;
+
+    if (child == NO_NODE) {
+      node.distance = d;
+      node.next_sibling = p->first_child;
+      p->first_child = tree->nodes->len;
+      /* May move the array, so p is not used past here */
+      g_array_append_val (tree->nodes, node);
+      return;
+    }
+
+    parent = child;
+  }
+}
+
+/**
+ * emerge_bk_tree_find_nearest:
+ * @tree: a tree
+ * @hash: the hash to look up
+ * @max_distance: the largest distance to accept
+ * @distance: (out) (optional): the distance of the match
+ *
+ * Returns: (nullable): the data of the hash closest to @hash, or %NULL if
+ *   none is within @max_distance. Ties go to the earliest inserted hash.
+ */
+gpointer
+emerge_bk_tree_find_nearest (EmergeBkTree *tree,
+                             guint64       hash,
+                             guint         max_distance,
+                             guint        *distance)
+{
+  GArray *stack;
+  gpointer best = NULL;
+  guint best_distance = max_distance + 1;
+  guint best_node = NO_NODE;
+  guint root = 0;
+
+  g_return_val_if_fail (tree != NULL, NULL);
+
+  if (tree->nodes->len == 0)
+    return NULL;
+
+  stack = g_array_sized_new (FALSE, FALSE, sizeof (guint), 64);
+  g_array_append_val (stack, root);
+
+  while (stack->len > 0) {
+    guint index = g_array_index (stack, guint, stack->len - 1);
+    const BkNode *node = &g_array_index (tree->nodes, BkNode, index);
+    guint d = emerge_image_metrics_hamming (hash, node->hash);
+
+    g_array_set_size (stack, stack->len - 1);
+
+    if (d < best_distance || (d == best_distance && index < best_node)) {
+      best = node->data;
+      best_distance = d;
+      best_node = index;
+    }
+
+    /* Anything within best_distance of @hash is within that of d from
+     * this node, so only those children can lead to a better match */
+    for (guint child = node->first_child; child != NO_NODE;
+         child = g_array_index (tree->nodes, BkNode, child).next_sibling) {
+      guint cd = g_array_index (tree->nodes, BkNode, child).distance;
+
+      if (cd + best_distance >= d && cd <= d + best_distance)
+        g_array_append_val (stack, child);
+    }
+  }
+
+  g_array_unref (stack);
+
+  if (best != NULL && distance != NULL)
+    *distance = best_distance;
+
+  return best;
+}
+
+struct _EmergeDuplicates
+{
+  GPtrArray  *items;      /* the duplicates, in list order */
+  GHashTable *kept_of;    /* duplicate -> the entry it duplicates */
+  GHashTable *n_of;       /* kept entry -> number of duplicates */
+};
+
+/**
+ * emerge_duplicates_find:
+ * @items: a list of #EmergeHistoryItem
+ * @max_distance: the largest hash distance between duplicates
+ *
+ * Walks @items in order, keeping each entry that isn't within
+ * @max_distance of one kept before it. Only kept entries go into the tree,
+ * so when most of a sweep is redundant the lookups stay cheap.
+ */
+EmergeDuplicates *
+emerge_duplicates_find (GListModel *items,
+                        guint       max_distance)
+{
+  EmergeDuplicates *duplicates;
+  EmergeBkTree *kept;
+  guint n_items;
+
+  g_return_val_if_fail (G_IS_LIST_MODEL (items), NULL);
+
+  duplicates = g_new0 (EmergeDuplicates, 1);
+  duplicates->items = g_ptr_array_new_with_free_func (g_object_unref);
+  duplicates->kept_of = g_hash_table_new (NULL, NULL);
+  duplicates->n_of = g_hash_table_new_full (NULL, NULL, g_object_unref, NULL);
+
+  kept = emerge_bk_tree_new ();
+  n_items = g_list_model_get_n_items (items);
+
+  for (guint i = 0; i < n_items; i++) {
+    EmergeHistoryItem *item = g_list_model_get_item (items, i);
+    EmergeHistoryItem *original;
+    guint64 dhash;
+
+    if (!emerge_history_item_get_dhash (item, &dhash)) {
+      g_object_unref (item);
+      continue;
+    }
+
+    original = emerge_bk_tree_find_nearest (kept, dhash, max_distance, NULL);
+    if (original == NULL) {
+      emerge_bk_tree_insert (kept, dhash, item);
+      g_object_unref (item);
+      continue;
+    }
+
+    g_ptr_array_add (duplicates->items, item);
+    g_hash_table_insert (duplicates->kept_of, item, original);
+    g_hash_table_insert (duplicates->n_of, g_object_ref (original),
+                         GUINT_TO_POINTER (GPOINTER_TO_UINT (g_hash_table_lookup (duplicates->n_of, original)) + 1));
+  }
+
+  emerge_bk_tree_free (kept);
+
+  return duplicates;
+}
+
+void
+emerge_duplicates_free (EmergeDuplicates *duplicates)
+{
+  if (duplicates == NULL)
+    return;
+
+  g_hash_table_unref (duplicates->n_of);
+  g_hash_table_unref (duplicates->kept_of);
+  g_ptr_array_unref (duplicates->items);
+  g_free (duplicates);
+}
+
+gboolean
+emerge_duplicates_is_duplicate (EmergeDuplicates  *duplicates,
+                                EmergeHistoryItem *item)
+{
+  g_return_val_if_fail (duplicates != NULL, FALSE);
+
+  return g_hash_table_contains (duplicates->kept_of, item);
+}
+
+/* The number of entries that were grouped with @item */
+guint
+emerge_duplicates_get_n_duplicates (EmergeDuplicates  *duplicates,
+                                    EmergeHistoryItem *item)
+{
+  g_return_val_if_fail (duplicates != NULL, 0);
+
+  return GPOINTER_TO_UINT (g_hash_table_lookup (duplicates->n_of, item));
+}
+
+/* Returns: (transfer none) (element-type EmergeHistoryItem): every duplicate */
+GPtrArray *
+emerge_duplicates_get_items (EmergeDuplicates *duplicates)
+{
+  g_return_val_if_fail (duplicates != NULL, NULL);
+
+  return duplicates->items;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <gio/gio.h>
+
+#include "emerge-history.h"
+
+G_BEGIN_DECLS
+
+/* Images whose hashes differ in at most this many of 64 bits look the same
+ * at a glance: typically neighbouring seeds that converged */
+#define EMERGE_DEDUPE_DEFAULT_DISTANCE 6
+
+/* A BK-tree over 64-bit hashes with Hamming distance as the metric. Finding
+ * the neighbours of a hash only visits subtrees the triangle inequality
+ * can't rule out, instead of every hash. */
+typedef struct _EmergeBkTree EmergeBkTree;
+
+EmergeBkTree *emerge_bk_tree_new          (void);
+void          emerge_bk_tree_free         (EmergeBkTree *tree);
+guint         emerge_bk_tree_get_size     (EmergeBkTree *tree);
+void          emerge_bk_tree_insert       (EmergeBkTree *tree,
+                                           guint64       hash,
+                                           gpointer      data);
+gpointer      emerge_bk_tree_find_nearest (EmergeBkTree *tree,
+                                           guint64       hash,
+                                           guint         max_distance,
+                                           guint        *distance);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (EmergeBkTree, emerge_bk_tree_free)
+
+/* Groups of near-identical images in a list of history entries. Each group
+ * keeps its first entry, which for the history is the newest, and the rest
+ * are its duplicates. Entries without a hash are never duplicates. */
+typedef struct _EmergeDuplicates EmergeDuplicates;
+
+EmergeDuplicates *emerge_duplicates_find             (GListModel        *items,
+                                                      guint              max_distance);
+void              emerge_duplicates_free             (EmergeDuplicates  *duplicates);
+gboolean          emerge_duplicates_is_duplicate     (EmergeDuplicates  *duplicates,
+                                                      EmergeHistoryItem *item);
+guint             emerge_duplicates_get_n_duplicates (EmergeDuplicates  *duplicates,
+                                                      EmergeHistoryItem *item);
+GPtrArray        *emerge_duplicates_get_items        (EmergeDuplicates  *duplicates);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (EmergeDuplicates, emerge_duplicates_free)
+
+G_END_DECLS
@@ -0,0 +1,843 @@
+#include "emerge-history-index.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Keeps at most this many evaluated terms between keystrokes */
+#define MAX_CACHED_TERMS 64
+
+/* A set of documents, one bit each. Every set in use has room for all the
+ * documents, as the term cache is dropped whenever one is added. */
+typedef struct {
+  guint   n_words;
+  guint64 words[];
+} Bitset;
+
+static Bitset *
+bitset_new (guint n_bits)
+{
+  guint n_words = (n_bits + 63) / 64;
+  Bitset *bits = g_malloc0 (sizeof (Bitset) + n_words * sizeof (guint64));
+
+  bits->n_words = n_words;
+
+  return bits;
+}
+
+static inline void
+bitset_set (Bitset *bits,
+            guint   bit)
+{
+  bits->words[bit / 64] |= G_GUINT64_CONSTANT (1) << (bit % 64);
+}
+
+static void
+bitset_and (Bitset       *bits,
+            const Bitset *other)
+{
+  for (guint i = 0; i < bits->n_words; i++)
+    bits->words[i] &= other->words[i];
+}
+
+static void
+bitset_and_not (Bitset       *bits,
+                const Bitset *other)
+{
+  for (guint i = 0; i < bits->n_words; i++)
+    bits->words[i] &= ~other->words[i];
+}
+
+typedef enum {
+  CMP_EQ,
+  CMP_LT,
+  CMP_LE,
+  CMP_GT,
+  CMP_GE,
+} CmpOp;
+
+/* Interned strings for the low-cardinality columns */
+typedef struct {
+  GHashTable *ids;
+  GPtrArray  *values;   /* casefolded */
+} StringColumn;
+
+/* The history is searched through an inverted index over prompt and
+ * negative prompt tokens, plus the generation parameters kept column by
+ * column so a filter is a tight scan over one array. Documents are numbered
+ * oldest first; the results list the newest first, like the history. */
+struct _EmergeHistoryIndex
+{
+  GObject       parent_instance;
+
+  EmergeHistory *history;
+
+  GPtrArray    *docs;           /* EmergeHistoryItem */
+  GTree        *prompt_tokens;  /* token -> GArray of guint32 doc */
+  GTree        *negative_tokens;
+
+  StringColumn  models;
+  StringColumn  samplers;
+  GArray       *model_col;      /* guint32 */
+  GArray       *sampler_col;    /* guint32 */
+  GArray       *seed_col;       /* gint64 */
+  GArray       *width_col;      /* gint32 */
+  GArray       *height_col;     /* gint32 */
+  GArray       *steps_col;      /* gint32 */
+  GArray       *cfg_col;        /* float */
+  GArray       *created_col;    /* gint64 */
+
+  GHashTable   *term_cache;     /* term -> Bitset */
+
+  gchar        *query;
+  GArray       *results;        /* guint32 doc, newest first */
+};
+
+static void emerge_history_index_list_model_init (GListModelInterface *iface);
+
+G_DEFINE_TYPE_WITH_CODE (EmergeHistoryIndex, emerge_history_index, G_TYPE_OBJECT,
+                         G_IMPLEMENT_INTERFACE (G_TYPE_LIST_MODEL,
+                                                emerge_history_index_list_model_init))
+
+static GType
+emerge_history_index_get_item_type (GListModel *model G_GNUC_UNUSED)
+{
+  return EMERGE_TYPE_HISTORY_ITEM;
+}
+
+static guint
+emerge_history_index_get_n_items (GListModel *model)
+{
+  return EMERGE_HISTORY_INDEX (model)->results->len;
+}
+
+static gpointer
+emerge_history_index_get_item (GListModel *model,
+                               guint       position)
+{
+  EmergeHistoryIndex *self = EMERGE_HISTORY_INDEX (model);
+
+  if (position >= self->results->len)
+    return NULL;
+
+  return g_object_ref (g_ptr_array_index (self->docs,
+                                          g_array_index (self->results, guint32, position)));
+}
+
+static void
+emerge_history_index_list_model_init (GListModelInterface *iface)
+{
+  iface->get_item_type = emerge_history_index_get_item_type;
+  iface->get_n_items = emerge_history_index_get_n_items;
+  iface->get_item = emerge_history_index_get_item;
+}
+
+static int
+token_compare (gconstpointer a,
+               gconstpointer b,
+               gpointer      user_data G_GNUC_UNUSED)
+{
+  return strcmp (a, b);
+}
+
+static GTree *
+token_tree_new (void)
+{
+  return g_tree_new_full (token_compare, NULL, g_free, (GDestroyNotify) g_array_unref);
+}
+
+static void
+string_column_init (StringColumn *column)
+{
+  column->ids = g_hash_table_new (g_str_hash, g_str_equal);
+  column->values = g_ptr_array_new_with_free_func (g_free);
+}
+
+static void
+string_column_clear (StringColumn *column)
+{
+  g_hash_table_remove_all (column->ids);
+  g_ptr_array_set_size (column->values, 0);
+}
+
+static void
+string_column_destroy (StringColumn *column)
+{
+  g_hash_table_unref (column->ids);
+  g_ptr_array_unref (column->values);
+}
+
+static guint32
+string_column_intern (StringColumn *column,
+                      const char   *value)
+{
+  gchar *folded = g_utf8_casefold (value ? value : "", -1);
+  gpointer id;
+
+  if (g_hash_table_lookup_extended (column->ids, folded, NULL, &id)) {
+    g_free (folded);
+    return GPOINTER_TO_UINT (id);
+  }
+
+  /* The hash table borrows the key from the array */
+  g_ptr_array_add (column->values, folded);
+  g_hash_table_insert (column->ids, folded, GUINT_TO_POINTER (column->values->len - 1));
+
+  return column->values->len - 1;
+}
+
+static void
+emerge_history_index_finalize (GObject *object)
+{
+  EmergeHistoryIndex *self = EMERGE_HISTORY_INDEX (object);
+
+  g_signal_handlers_disconnect_by_data (self->history, self);
+  g_object_unref (self->history);
+
+  g_ptr_array_unref (self->docs);
+  g_tree_unref (self->prompt_tokens);
+  g_tree_unref (self->negative_tokens);
+  string_column_destroy (&self->models);
+  string_column_destroy (&self->samplers);
+  g_array_unref (self->model_col);
+  g_array_unref (self->sampler_col);
+  g_array_unref (self->seed_col);
+  g_array_unref (self->width_col);
+  g_array_unref (self->height_col);
+  g_array_unref (self->steps_col);
+  g_array_unref (self->cfg_col);
+  g_array_unref (self->created_col);
+  g_hash_table_unref (self->term_cache);
+  g_array_unref (self->results);
+  g_free (self->query);
+
+  G_OBJECT_CLASS (emerge_history_index_parent_class)->finalize (object);
+}
+
+static void
+emerge_history_index_class_init (EmergeHistoryIndexClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->finalize = emerge_history_index_finalize;
+}
+
+static void
+emerge_history_index_init (EmergeHistoryIndex *self)
+{
+  self->docs = g_ptr_array_new_with_free_func (g_object_unref);
+  self->prompt_tokens = token_tree_new ();
+  self->negative_tokens = token_tree_new ();
+  string_column_init (&self->models);
+  string_column_init (&self->samplers);
+  self->model_col = g_array_new (FALSE, FALSE, sizeof (guint32));
+  self->sampler_col = g_array_new (FALSE, FALSE, sizeof (guint32));
+  self->seed_col = g_array_new (FALSE, FALSE, sizeof (gint64));
+  self->width_col = g_array_new (FALSE, FALSE, sizeof (gint32));
+  self->height_col = g_array_new (FALSE, FALSE, sizeof (gint32));
+  self->steps_col = g_array_new (FALSE, FALSE, sizeof (gint32));
+  self->cfg_col = g_array_new (FALSE, FALSE, sizeof (float));
+  self->created_col = g_array_new (FALSE, FALSE, sizeof (gint64));
+  self->term_cache = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+  self->results = g_array_new (FALSE, FALSE, sizeof (guint32));
+}
+
+/* Calls @func for every lowercased run of letters and digits in @text.
+ * Bytes outside ASCII are kept as part of words, so non-Latin prompts are
+ * still searchable, only without case folding. */
+static void
+tokenize (const char *text,
+          void      (*func) (const char *token, gpointer user_data),
+          gpointer    user_data)
+{
+  char token[64];
+  guint len = 0;
+
+  if (text == NULL)
+    return;
+
+  for (const char *p = text; ; p++) {
+    guchar c = *p;
+
+    if (g_ascii_isalnum (c) || c >= 0x80) {
+      /* Overlong tokens are cut, which still matches them by prefix */
+      if (len < sizeof (token) - 1)
+        token[len++] = g_ascii_tolower (c);
+      continue;
+    }
+
+    if (len > 0) {
+      token[len] = '\0';
+      func (token, user_data);
+      len = 0;
+    }
+
+    if (c == '\0')
+      break;
+  }
+}
+
+typedef struct {
+  GTree   *tree;
+  guint32  doc;
+} PostingContext;
+
+static void
+add_posting (const char *token,
+             gpointer    user_data)
+{
+  PostingContext *context = user_data;
+  GArray *postings = g_tree_lookup (context->tree, token);
+
+  if (postings == NULL) {
+    postings = g_array_new (FALSE, FALSE, sizeof (guint32));
+    g_tree_insert (context->tree, g_strdup (token), postings);
+  }
+
+  /* Documents arrive in order, so a repeated token is the last entry */
+  if (postings->len == 0 ||
+      g_array_index (postings, guint32, postings->len - 1) != context->doc)
+    g_array_append_val (postings, context->doc);
+}
+
+static void
+index_add_doc (EmergeHistoryIndex *self,
+               EmergeHistoryItem  *item)
+{
+  EmergeJob *job = emerge_history_item_get_job (item);
+  PostingContext context;
+  gchar *model_name;
+  guint32 id;
+  gint32 value;
+  gint64 value64;
+  float cfg;
+
+  context.doc = self->docs->len;
+  g_ptr_array_add (self->docs, g_object_ref (item));
+
+  context.tree = self->prompt_tokens;
+  tokenize (job->prompt, add_posting, &context);
+  context.tree = self->negative_tokens;
+  tokenize (job->negative_prompt, add_posting, &context);
+
+  model_name = job->model_path ? g_path_get_basename (job->model_path) : NULL;
+  id = string_column_intern (&self->models, model_name);
+  g_array_append_val (self->model_col, id);
+  g_free (model_name);
+
+  id = string_column_intern (&self->samplers, job->sampling_method);
+  g_array_append_val (self->sampler_col, id);
+
+  g_array_append_val (self->seed_col, job->seed);
+  value = job->width;
+  g_array_append_val (self->width_col, value);
+  value = job->height;
+  g_array_append_val (self->height_col, value);
+  value = job->steps;
+  g_array_append_val (self->steps_col, value);
+  cfg = job->cfg_scale;
+  g_array_append_val (self->cfg_col, cfg);
+  value64 = emerge_history_item_get_created (item);
+  g_array_append_val (self->created_col, value64);
+}
+
+static void
+index_clear (EmergeHistoryIndex *self)
+{
+  g_ptr_array_set_size (self->docs, 0);
+  g_tree_unref (self->prompt_tokens);
+  g_tree_unref (self->negative_tokens);
+  self->prompt_tokens = token_tree_new ();
+  self->negative_tokens = token_tree_new ();
+  string_column_clear (&self->models);
+  string_column_clear (&self->samplers);
+  g_array_set_size (self->model_col, 0);
+  g_array_set_size (self->sampler_col, 0);
+  g_array_set_size (self->seed_col, 0);
+  g_array_set_size (self->width_col, 0);
+  g_array_set_size (self->height_col, 0);
+  g_array_set_size (self->steps_col, 0);
+  g_array_set_size (self->cfg_col, 0);
+  g_array_set_size (self->created_col, 0);
+}
+
+/* Union of the postings of every token starting with @prefix */
+static void
+tree_prefix_union (GTree      *tree,
+                   const char *prefix,
+                   Bitset     *bits)
+{
+  size_t len = strlen (prefix);
+
+  for (GTreeNode *node = g_tree_lower_bound (tree, prefix);
+       node != NULL;
+       node = g_tree_node_next (node)) {
+    GArray *postings = g_tree_node_value (node);
+
+    if (strncmp (g_tree_node_key (node), prefix, len) != 0)
+      break;
+
+    for (guint i = 0; i < postings->len; i++)
+      bitset_set (bits, g_array_index (postings, guint32, i));
+  }
+}
+
+typedef struct {
+  EmergeHistoryIndex *self;
+  GTree              *tree;
+  Bitset             *bits;
+  gboolean            first;
+} WordContext;
+
+static void
+match_word_token (const char *token,
+                  gpointer    user_data)
+{
+  WordContext *context = user_data;
+  Bitset *token_bits = bitset_new (context->self->docs->len);
+
+  tree_prefix_union (context->tree, token, token_bits);
+
+  if (context->first) {
+    memcpy (context->bits->words, token_bits->words, token_bits->n_words * sizeof (guint64));
+    context->first = FALSE;
+  } else {
+    bitset_and (context->bits, token_bits);
+  }
+
+  g_free (token_bits);
+}
+
+/* Every token of @word must start some token of the prompt, so a word
+ * still being typed already matches */
+static Bitset *
+eval_word (EmergeHistoryIndex *self,
+           GTree              *tree,
+           const char         *word)
+{
+  WordContext context = { self, tree, bitset_new (self->docs->len), TRUE };
+
+  tokenize (word, match_word_token, &context);
+
+  /* Nothing searchable, like a lone punctuation mark: match everything */
+  if (context.first)
+    memset (context.bits->words, 0xff, context.bits->n_words * sizeof (guint64));
+
+  return context.bits;
+}
+
+static gboolean
+parse_comparison (const char *text,
+                  CmpOp      *op,
+                  double     *value)
+{
+  char *end;
+
+  if (g_str_has_prefix (text, "<=")) {
+    *op = CMP_LE;
+    text += 2;
+  } else if (g_str_has_prefix (text, ">=")) {
+    *op = CMP_GE;
+    text += 2;
+  } else if (*text == '<') {
+    *op = CMP_LT;
+    text++;
+  } else if (*text == '>') {
+    *op = CMP_GT;
+    text++;
+  } else {
+    *op = CMP_EQ;
+    if (*text == '=')
+      text++;
+  }
+
+  *value = g_ascii_strtod (text, &end);
+
+  return end != text;
+}
+
+static inline gboolean
+compare (double a,
+         CmpOp  op,
+         double b,
+         double epsilon)
+{
+  switch (op) {
+  case CMP_EQ: return fabs (a - b) <= epsilon;
+  case CMP_LT: return a < b;
+  case CMP_LE: return a <= b + epsilon;
+  case CMP_GT: return a > b;
+  case CMP_GE: return a >= b - epsilon;
+  default:     return FALSE;
+  }
+}
+
+/* The column scans are written out per type so each is a simple loop the
+ * compiler can keep in registers */
+static Bitset *
+eval_int_column (EmergeHistoryIndex *self,
+                 GArray             *column,
+                 CmpOp               op,
+                 double              value)
+{
+  Bitset *bits = bitset_new (self->docs->len);
+  const gint32 *data = (const gint32 *) column->data;
+
+  for (guint i = 0; i < column->len; i++)
+    if (compare (data[i], op, value, 0.0))
+      bitset_set (bits, i);
+
+  return bits;
+}
+
+static Bitset *
+eval_int64_column (EmergeHistoryIndex *self,
+                   GArray             *column,
+                   gint64              low,
+                   gint64              high)
+{
+  Bitset *bits = bitset_new (self->docs->len);
+  const gint64 *data = (const gint64 *) column->data;
+
+  for (guint i = 0; i < column->len; i++)
+    if (data[i] >= low && data[i] < high)
+      bitset_set (bits, i);
+
+  return bits;
+}
+
+static Bitset *
+eval_cfg_column (EmergeHistoryIndex *self,
+                 CmpOp               op,
+                 double              value)
+{
+  Bitset *bits = bitset_new (self->docs->len);
+  const float *data = (const float *) self->cfg_col->data;
+
+  for (guint i = 0; i < self->cfg_col->len; i++)
+    if (compare (data[i], op, value, 1e-3))
+      bitset_set (bits, i);
+
+  return bits;
+}
+
+/* Substring match on the distinct values first, then one pass over the
+ * column of ids */
+static Bitset *
+eval_string_column (EmergeHistoryIndex *self,
+                    StringColumn       *strings,
+                    GArray             *column,
+                    const char         *needle)
+{
+  Bitset *bits = bitset_new (self->docs->len);
+  gchar *folded = g_utf8_casefold (needle, -1);
+  gboolean *matches = g_new (gboolean, MAX (strings->values->len, 1));
+  const guint32 *data = (const guint32 *) column->data;
+
+  for (guint i = 0; i < strings->values->len; i++)
+    matches[i] = strstr (g_ptr_array_index (strings->values, i), folded) != NULL;
+
+  for (guint i = 0; i < column->len; i++)
+    if (matches[data[i]])
+      bitset_set (bits, i);
+
+  g_free (matches);
+  g_free (folded);
+
+  return bits;
+}
+
+/* YYYY, YYYY-MM or YYYY-MM-DD in local time, or Nd for N days ago. Sets
+ * the half-open range of seconds it covers. */
+static gboolean
+parse_date_range (const char *text,
+                  gint64     *start,
+                  gint64     *end)
+{
+  GDateTime *from, *to;
+  int year = 0, month = 0, day = 0;
+  char *rest;
+
+  if (g_str_has_suffix (text, "d")) {
+    gint64 days = g_ascii_strtoll (text, &rest, 10);
+    if (rest == text || *rest != 'd')
+      return FALSE;
+
+    GDateTime *now = g_date_time_new_now_local ();
+    GDateTime *then = g_date_time_add_days (now, -days);
+    *start = g_date_time_to_unix (then);
+    *end = g_date_time_to_unix (now) + 1;
+    g_date_time_unref (then);
+    g_date_time_unref (now);
+    return TRUE;
+  }
+
+  if (sscanf (text, "%d-%d-%d", &year, &month, &day) < 1 || year < 1970)
+    return FALSE;
+
+  from = g_date_time_new_local (year, month > 0 ? month : 1, day > 0 ? day : 1, 0, 0, 0);
+  if (from == NULL)
+    return FALSE;
+
+  if (day > 0)
+    to = g_date_time_add_days (from, 1);
+  else if (month > 0)
+    to = g_date_time_add_months (from, 1);
+  else
+    to = g_date_time_add_years (from, 1);
+
+  *start = g_date_time_to_unix (from);
+  *end = g_date_time_to_unix (to);
+  g_date_time_unref (from);
+  g_date_time_unref (to);
+
+  return TRUE;
+}
+
+/* Evaluates one term of a query. Returns %NULL for a term that doesn't
+ * restrict anything yet, such as "cfg:" while it is being typed. */
+static Bitset *
+eval_term (EmergeHistoryIndex *self,
+           const char         *term)
+{
+  const char *colon = strchr (term, ':');
+  const char *value;
+  gchar *field;
+  Bitset *bits = NULL;
+  double number;
+  CmpOp op;
+  gint64 start, end;
+
+  if (colon == NULL || colon == term)
+    return eval_word (self, self->prompt_tokens, term);
+
+  field = g_ascii_strdown (term, colon - term);
+  value = colon + 1;
+
+  if (*value == '\0') {
+    bits = NULL;
+  } else if (strcmp (field, "neg") == 0 || strcmp (field, "negative") == 0) {
+    bits = eval_word (self, self->negative_tokens, value);
+  } else if (strcmp (field, "model") == 0) {
+    bits = eval_string_column (self, &self->models, self->model_col, value);
+  } else if (strcmp (field, "sampler") == 0) {
+    bits = eval_string_column (self, &self->samplers, self->sampler_col, value);
+  } else if (strcmp (field, "seed") == 0) {
+    char *rest;
+    gint64 seed = g_ascii_strtoll (value, &rest, 10);
+    if (rest != value)
+      bits = eval_int64_column (self, self->seed_col, seed, seed + 1);
+  } else if (strcmp (field, "steps") == 0) {
+    if (parse_comparison (value, &op, &number))
+      bits = eval_int_column (self, self->steps_col, op, number);
+  } else if (strcmp (field, "width") == 0) {
+    if (parse_comparison (value, &op, &number))
+      bits = eval_int_column (self, self->width_col, op, number);
+  } else if (strcmp (field, "height") == 0) {
+    if (parse_comparison (value, &op, &number))
+      bits = eval_int_column (self, self->height_col, op, number);
+  } else if (strcmp (field, "size") == 0) {
+    int width, height;
+    if (sscanf (value, "%dx%d", &width, &height) == 2) {
+      bits = eval_int_column (self, self->width_col, CMP_EQ, width);
+      Bitset *height_bits = eval_int_column (self, self->height_col, CMP_EQ, height);
+      bitset_and (bits, height_bits);
+      g_free (height_bits);
+    }
+  } else if (strcmp (field, "cfg") == 0) {
+    if (parse_comparison (value, &op, &number))
+      bits = eval_cfg_column (self, op, number);
+  } else if (strcmp (field, "date") == 0) {
+    if (parse_date_range (value, &start, &end))
+      bits = eval_int64_column (self, self->created_col, start, end);
+  } else if (strcmp (field, "after") == 0) {
+    if (parse_date_range (value, &start, &end))
+      bits = eval_int64_column (self, self->created_col, start, G_MAXINT64);
+  } else if (strcmp (field, "before") == 0) {
+    if (parse_date_range (value, &start, &end))
+      bits = eval_int64_column (self, self->created_col, G_MININT64, start);
+  } else {
+    /* Not a field we know, so probably part of the prompt, like "16:9" */
+    bits = eval_word (self, self->prompt_tokens, term);
+  }
+
+  g_free (field);
+
+  return bits;
+}
+
+/* Terms are cached so that typing only evaluates the one being changed */
+static const Bitset *
+lookup_term (EmergeHistoryIndex *self,
+             const char         *term)
+{
+  Bitset *bits;
+
+  if (g_hash_table_lookup_extended (self->term_cache, term, NULL, (gpointer *) &bits))
+    return bits;
+
+  if (g_hash_table_size (self->term_cache) >= MAX_CACHED_TERMS)
+    g_hash_table_remove_all (self->term_cache);
+
+  bits = eval_term (self, term);
+  g_hash_table_insert (self->term_cache, g_strdup (term), bits);
+
+  return bits;
+}
+
+static void
+index_run_query (EmergeHistoryIndex *self)
+{
+  guint n_docs = self->docs->len;
+  guint old_len = self->results->len;
+  gchar **terms;
+  Bitset *bits;
+
+  bits = bitset_new (n_docs);
+  memset (bits->words, 0xff, bits->n_words * sizeof (guint64));
+
+  terms = g_strsplit_set (self->query ? self->query : "", " \t\n", -1);
+  for (guint i = 0; terms[i] != NULL; i++) {
+    const char *term = terms[i];
+    gboolean exclude = FALSE;
+    const Bitset *term_bits;
+
+    if (*term == '-' && term[1] != '\0') {
+      exclude = TRUE;
+      term++;
+    }
+
+    if (*term == '\0' || (term_bits = lookup_term (self, term)) == NULL)
+      continue;
+
+    if (exclude)
+      bitset_and_not (bits, term_bits);
+    else
+      bitset_and (bits, term_bits);
+  }
+  g_strfreev (terms);
+
+  /* Walk the set from the top so the newest come first */
+  g_array_set_size (self->results, 0);
+  for (guint w = bits->n_words; w > 0; w--) {
+    guint64 word = bits->words[w - 1];
+
+    while (word != 0) {
+      guint bit = 63 - __builtin_clzll (word);
+      guint32 doc = (w - 1) * 64 + bit;
+
+      word &= ~(G_GUINT64_CONSTANT (1) << bit);
+      if (doc < n_docs)
+        g_array_append_val (self->results, doc);
+    }
+  }
+  g_free (bits);
+
+  g_list_model_items_changed (G_LIST_MODEL (self), 0, old_len, self->results->len);
+}
+
+static void
+index_rebuild (EmergeHistoryIndex *self)
+{
+  GListModel *history = G_LIST_MODEL (self->history);
+
+  index_clear (self);
+
+  /* The history lists the newest first */
+  for (guint i = g_list_model_get_n_items (history); i > 0; i--) {
+    EmergeHistoryItem *item = g_list_model_get_item (history, i - 1);
+    index_add_doc (self, item);
+    g_object_unref (item);
+  }
+}
+
+static void
+history_items_changed_cb (GListModel         *history,
+                          guint               position,
+                          guint               removed,
+                          guint               added,
+                          EmergeHistoryIndex *self)
+{
+  /* New images are the common case and only extend the index. Anything
+   * else, like older entries arriving while loading into a non-empty
+   * index, is rare enough to start over. */
+  if (removed == 0 && position == 0 &&
+      self->docs->len + added == g_list_model_get_n_items (history)) {
+    for (guint i = added; i > 0; i--) {
+      EmergeHistoryItem *item = g_list_model_get_item (history, i - 1);
+      index_add_doc (self, item);
+      g_object_unref (item);
+    }
+  } else {
+    index_rebuild (self);
+  }
+
+  g_hash_table_remove_all (self->term_cache);
+  index_run_query (self);
+}
+
+/**
+ * emerge_history_index_new:
+ * @history: the history to search
+ *
+ * Creates an index over @history that follows it as entries are added.
+ * The index is a list model of the entries matching the current query,
+ * newest first; with no query, that is every entry.
+ */
+EmergeHistoryIndex *
+emerge_history_index_new (EmergeHistory *history)
+{
+  EmergeHistoryIndex *self;
+
+  g_return_val_if_fail (EMERGE_IS_HISTORY (history), NULL);
+
+  self = g_object_new (EMERGE_TYPE_HISTORY_INDEX, NULL);
+  self->history = g_object_ref (history);
+  g_signal_connect (history, "items-changed",
+                    G_CALLBACK (history_items_changed_cb), self);
+
+  index_rebuild (self);
+  index_run_query (self);
+
+  return self;
+}
+
+/**
+ * emerge_history_index_set_query:
+ * @self: an index
+ * @query: (nullable): space separated terms that must all match
+ *
+ * Words match the start of prompt words, so a word still being typed
+ * already narrows the results. Other terms are:
+ *
+ * - `-word` excludes entries whose prompt has the word
+ * - `neg:word` matches the negative prompt
+ * - `model:text` and `sampler:text` match part of the name
+ * - `seed:N` and `size:WxH`
+ * - `steps:`, `width:`, `height:` and `cfg:` followed by a number, with an
+ *   optional `<`, `<=`, `>` or `>=`
+ * - `date:`, `after:` and `before:` followed by `YYYY`, `YYYY-MM`,
+ *   `YYYY-MM-DD` or `Nd` for N days ago
+ */
+void
+emerge_history_index_set_query (EmergeHistoryIndex *self,
+                                const char         *query)
+{
+  g_return_if_fail (EMERGE_IS_HISTORY_INDEX (self));
+
+  if (g_strcmp0 (self->query, query) == 0)
+    return;
+
+  g_free (self->query);
+  self->query = g_strdup (query);
+  index_run_query (self);
+}
+
+const char *
+emerge_history_index_get_query (EmergeHistoryIndex *self)
+{
+  g_return_val_if_fail (EMERGE_IS_HISTORY_INDEX (self), NULL);
+
+  return self->query;
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <gio/gio.h>
+
+#include "emerge-history.h"
+
+G_BEGIN_DECLS
+
+#define EMERGE_TYPE_HISTORY_INDEX (emerge_history_index_get_type())
+
+G_DECLARE_FINAL_TYPE (EmergeHistoryIndex, emerge_history_index, EMERGE, HISTORY_INDEX, GObject)
+
+EmergeHistoryIndex *emerge_history_index_new       (EmergeHistory      *history);
+void                emerge_history_index_set_query (EmergeHistoryIndex *self,
+                                                    const char         *query);
+const char         *emerge_history_index_get_query (EmergeHistoryIndex *self);
+
+G_END_DECLS
@@ -0,0 +1,1061 @@
+#include "emerge-history.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
+#include <json-glib/json-glib.h>
+
+#include "emerge-image-metrics.h"
+
+#define INDEX_NAME  "index.jsonl"
+#define IMAGES_NAME "images"
+
+struct _EmergeHistoryItem
+{
+  GObject    parent_instance;
+
+  guint64    id;
+  gint64     created;
+  gchar     *image_path;
+  EmergeJob *job;
+
+  /* Perceptual hash, filled in after the entry was added */
+  guint64    dhash;
+  guint      has_dhash : 1;
+  guint      hash_pending : 1;
+  guint      hash_failed : 1;
+};
+
+G_DEFINE_TYPE (EmergeHistoryItem, emerge_history_item, G_TYPE_OBJECT)
+
+static void
+emerge_history_item_finalize (GObject *object)
+{
+  EmergeHistoryItem *self = EMERGE_HISTORY_ITEM (object);
+
+  g_free (self->image_path);
+  g_clear_pointer (&self->job, emerge_job_unref);
+
+  G_OBJECT_CLASS (emerge_history_item_parent_class)->finalize (object);
+}
+
+static void
+emerge_history_item_class_init (EmergeHistoryItemClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->finalize = emerge_history_item_finalize;
+}
+
+static void
+emerge_history_item_init (EmergeHistoryItem *self G_GNUC_UNUSED)
+{
+}
+
+guint64
+emerge_history_item_get_id (EmergeHistoryItem *self)
+{
+  g_return_val_if_fail (EMERGE_IS_HISTORY_ITEM (self), 0);
+
+  return self->id;
+}
+
+/* Seconds since the epoch */
+gint64
+emerge_history_item_get_created (EmergeHistoryItem *self)
+{
+  g_return_val_if_fail (EMERGE_IS_HISTORY_ITEM (self), 0);
+
+  return self->created;
+}
+
+const char *
+emerge_history_item_get_image_path (EmergeHistoryItem *self)
+{
+  g_return_val_if_fail (EMERGE_IS_HISTORY_ITEM (self), NULL);
+
+  return self->image_path;
+}
+
+/* The parameters and timings of the generation; its output_path is the
+ * stored image */
+EmergeJob *
+emerge_history_item_get_job (EmergeHistoryItem *self)
+{
+  g_return_val_if_fail (EMERGE_IS_HISTORY_ITEM (self), NULL);
+
+  return self->job;
+}
+
+/**
+ * emerge_history_item_get_dhash:
+ * @self: a history entry
+ * @dhash: (out) (optional): return location for the hash
+ *
+ * Gets the perceptual hash of the image, see emerge_image_metrics_dhash().
+ *
+ * Returns: %FALSE if the image hasn't been hashed yet
+ */
+gboolean
+emerge_history_item_get_dhash (EmergeHistoryItem *self,
+                               guint64           *dhash)
+{
+  g_return_val_if_fail (EMERGE_IS_HISTORY_ITEM (self), FALSE);
+
+  if (self->has_dhash && dhash != NULL)
+    *dhash = self->dhash;
+
+  return self->has_dhash;
+}
+
+/* The history is a directory holding an append-only index, one JSON object
+ * per line, and the images it refers to. Appending never rewrites what is
+ * already there, so a crash can at worst leave a torn last line, which the
+ * loader skips. Later changes to an entry are appended as short records
+ * carrying only its id and what changed. As a list model the newest entry
+ * comes first. */
+struct _EmergeHistory
+{
+  GObject     parent_instance;
+
+  gchar      *dir;
+  gchar      *index_path;
+  gchar      *images_dir;
+  int         index_fd;
+
+  GPtrArray  *items;      /* oldest first */
+  GHashTable *by_id;
+  guint64     last_id;
+};
+
+static void emerge_history_list_model_init (GListModelInterface *iface);
+
+G_DEFINE_TYPE_WITH_CODE (EmergeHistory, emerge_history, G_TYPE_OBJECT,
+                         G_IMPLEMENT_INTERFACE (G_TYPE_LIST_MODEL,
+                                                emerge_history_list_model_init))
+
+static GType
+emerge_history_get_item_type (GListModel *model G_GNUC_UNUSED)
+{
+  return EMERGE_TYPE_HISTORY_ITEM;
+}
+
+static guint
+emerge_history_get_n_items (GListModel *model)
+{
+  return EMERGE_HISTORY (model)->items->len;
+}
+
+static gpointer
+emerge_history_get_item (GListModel *model,
+                         guint       position)
+{
+  EmergeHistory *self = EMERGE_HISTORY (model);
+
+  if (position >= self->items->len)
+    return NULL;
+
+  return g_object_ref (g_ptr_array_index (self->items, self->items->len - 1 - position));
+}
+
+static void
+emerge_history_list_model_init (GListModelInterface *iface)
+{
+  iface->get_item_type = emerge_history_get_item_type;
+  iface->get_n_items = emerge_history_get_n_items;
+  iface->get_item = emerge_history_get_item;
+}
+
+static void
+emerge_history_finalize (GObject *object)
+{
+  EmergeHistory *self = EMERGE_HISTORY (object);
+
+  if (self->index_fd >= 0)
+    close (self->index_fd);
+
+  g_hash_table_unref (self->by_id);
+  g_ptr_array_unref (self->items);
+  g_free (self->dir);
+  g_free (self->index_path);
+  g_free (self->images_dir);
+
+  G_OBJECT_CLASS (emerge_history_parent_class)->finalize (object);
+}
+
+static void
+emerge_history_class_init (EmergeHistoryClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->finalize = emerge_history_finalize;
+}
+
+static void
+emerge_history_init (EmergeHistory *self)
+{
+  self->index_fd = -1;
+  self->items = g_ptr_array_new_with_free_func (g_object_unref);
+  self->by_id = g_hash_table_new (g_int64_hash, g_int64_equal);
+}
+
+/**
+ * emerge_history_new:
+ * @dir: the directory holding the history; created on the first add
+ *
+ * Creates an empty history. Call emerge_history_load() or
+ * emerge_history_load_async() to read the entries already in @dir.
+ */
+EmergeHistory *
+emerge_history_new (const char *dir)
+{
+  EmergeHistory *self;
+
+  g_return_val_if_fail (dir != NULL, NULL);
+
+  self = g_object_new (EMERGE_TYPE_HISTORY, NULL);
+  self->dir = g_strdup (dir);
+  self->index_path = g_build_filename (dir, INDEX_NAME, NULL);
+  self->images_dir = g_build_filename (dir, IMAGES_NAME, NULL);
+
+  return self;
+}
+
+const char *
+emerge_history_get_dir (EmergeHistory *self)
+{
+  g_return_val_if_fail (EMERGE_IS_HISTORY (self), NULL);
+
+  return self->dir;
+}
+
+static double
+json_get_double (JsonObject *object,
+                 const char *name,
+                 double      fallback)
+{
+  if (!json_object_has_member (object, name))
+    return fallback;
+
+  return json_object_get_double_member (object, name);
+}
+
+static EmergeHistoryItem *
+history_item_from_json (JsonObject *object,
+                        const char *dir)
+{
+  EmergeHistoryItem *item;
+  JsonObject *job_object;
+  const char *image;
+  EmergeJob *job;
+
+  if (!json_object_has_member (object, "id") ||
+      !json_object_has_member (object, "image") ||
+      !json_object_has_member (object, "job"))
+    return NULL;
+
+  image = json_object_get_string_member (object, "image");
+  job_object = json_object_get_object_member (object, "job");
+  if (image == NULL || job_object == NULL)
+    return NULL;
+
+  job = emerge_job_new ();
+  emerge_job_apply_json (job, job_object);
+
+  /* Only finished generations are recorded */
+  job->state = EMERGE_JOB_SUCCEEDED;
+  job->wall_seconds = json_get_double (job_object, "wall_seconds", 0.0);
+  if (json_object_has_member (job_object, "peak_rss"))
+    job->peak_rss = json_object_get_int_member (job_object, "peak_rss");
+  if (json_object_has_member (job_object, "load_seconds")) {
+    job->stats = emerge_sd_stats_new ();
+    job->stats->load_seconds = json_get_double (job_object, "load_seconds", -1.0);
+    job->stats->sampling_seconds = json_get_double (job_object, "sampling_seconds", -1.0);
+    job->stats->decode_seconds = json_get_double (job_object, "decode_seconds", -1.0);
+  }
+
+  item = g_object_new (EMERGE_TYPE_HISTORY_ITEM, NULL);
+  item->id = json_object_get_int_member (object, "id");
+  item->created = json_object_has_member (object, "created")
+                  ? json_object_get_int_member (object, "created") : 0;
+  /* Image paths are relative so the history can be moved as a whole */
+  item->image_path = g_path_is_absolute (image) ? g_strdup (image)
+                                                : g_build_filename (dir, image, NULL);
+  g_free (job->output_path);
+  job->output_path = g_strdup (item->image_path);
+  item->job = job;
+
+  return item;
+}
+
+static gboolean
+parse_dhash (const char *str,
+             guint64    *dhash)
+{
+  char *end;
+
+  if (str == NULL || *str == '\0')
+    return FALSE;
+
+  *dhash = g_ascii_strtoull (str, &end, 16);
+
+  return *end == '\0';
+}
+
+/* Applies an update record to the entry it refers to. Returns FALSE if
+ * @object isn't an update record at all. */
+static gboolean
+history_apply_update (JsonObject *object,
+                      GHashTable *by_id,
+                      GHashTable *deleted)
+{
+  EmergeHistoryItem *item;
+  guint64 id;
+
+  if (!json_object_has_member (object, "id") ||
+      json_object_has_member (object, "job"))
+    return FALSE;
+
+  id = json_object_get_int_member (object, "id");
+  item = g_hash_table_lookup (by_id, &id);
+
+  if (json_object_has_member (object, "deleted")) {
+    if (item != NULL) {
+      g_hash_table_add (deleted, item);
+      g_hash_table_remove (by_id, &id);
+    }
+    return TRUE;
+  }
+
+  if (json_object_has_member (object, "dhash")) {
+    guint64 dhash;
+
+    if (!parse_dhash (json_object_get_string_member (object, "dhash"), &dhash))
+      return FALSE;
+
+    if (item != NULL) {
+      item->dhash = dhash;
+      item->has_dhash = TRUE;
+    }
+    return TRUE;
+  }
+
+  return FALSE;
+}
+
+/* Reads the whole index. Touches no instance state, so it is safe to run
+ * on a worker thread. */
+static GPtrArray *
+history_read_index (const char    *index_path,
+                    const char    *dir,
+                    GCancellable  *cancellable,
+                    GError       **error)
+{
+  GPtrArray *items = g_ptr_array_new_with_free_func (g_object_unref);
+  GHashTable *by_id, *deleted;
+  JsonParser *parser;
+  gchar *contents = NULL;
+  gsize length;
+  GError *local_error = NULL;
+  guint n_bad = 0;
+
+  if (!g_file_get_contents (index_path, &contents, &length, &local_error)) {
+    if (g_error_matches (local_error, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
+      /* Nothing generated yet */
+      g_error_free (local_error);
+      return items;
+    }
+
+    g_propagate_error (error, local_error);
+    g_ptr_array_unref (items);
+    return NULL;
+  }
+
+  parser = json_parser_new ();
+  by_id = g_hash_table_new (g_int64_hash, g_int64_equal);
+  deleted = g_hash_table_new (NULL, NULL);
+
+  for (char *line = contents, *end; line < contents + length; line = end + 1) {
+    EmergeHistoryItem *item = NULL;
+
+    end = memchr (line, '\n', contents + length - line);
+    if (end == NULL)
+      end = contents + length;
+
+    if (end == line)
+      continue;
+
+    if (g_cancellable_set_error_if_cancelled (cancellable, error)) {
+      g_hash_table_unref (deleted);
+      g_hash_table_unref (by_id);
+      g_object_unref (parser);
+      g_ptr_array_unref (items);
+      g_free (contents);
+      return NULL;
+    }
+
+    if (json_parser_load_from_data (parser, line, end - line, NULL) &&
+        JSON_NODE_HOLDS_OBJECT (json_parser_get_root (parser))) {
+      JsonObject *object = json_node_get_object (json_parser_get_root (parser));
+
+      if (history_apply_update (object, by_id, deleted))
+        continue;
+
+      item = history_item_from_json (object, dir);
+    }
+
+    if (item != NULL) {
+      g_ptr_array_add (items, item);
+      g_hash_table_insert (by_id, &item->id, item);
+    } else {
+      n_bad++;
+    }
+  }
+
+  /* Dropped in one pass rather than one search per deletion */
+  if (g_hash_table_size (deleted) > 0) {
+    guint n_kept = 0;
+
+    for (guint i = 0; i < items->len; i++) {
+      EmergeHistoryItem *item = g_ptr_array_index (items, i);
+
+      if (g_hash_table_contains (deleted, item))
+        g_object_unref (item);
+      else
+        items->pdata[n_kept++] = item;
+    }
+    items->len = n_kept;
+  }
+
+  if (n_bad > 0)
+    g_warning ("Skipped %u unreadable entries in %s", n_bad, index_path);
+
+  g_hash_table_unref (deleted);
+  g_hash_table_unref (by_id);
+  g_object_unref (parser);
+  g_free (contents);
+
+  return items;
+}
+
+/* Loaded entries are older than anything added meanwhile, so they go in
+ * front of the array, which is the end of the model */
+static void
+history_merge (EmergeHistory *self,
+               GPtrArray     *loaded)
+{
+  GPtrArray *merged;
+  guint n_before = self->items->len;
+  guint n_added = 0;
+
+  merged = g_ptr_array_new_full (loaded->len + self->items->len, g_object_unref);
+
+  for (guint i = 0; i < loaded->len; i++) {
+    EmergeHistoryItem *item = g_ptr_array_index (loaded, i);
+
+    if (g_hash_table_contains (self->by_id, &item->id))
+      continue;
+
+    g_ptr_array_add (merged, g_object_ref (item));
+    g_hash_table_insert (self->by_id, &item->id, item);
+    self->last_id = MAX (self->last_id, item->id);
+    n_added++;
+  }
+
+  for (guint i = 0; i < self->items->len; i++)
+    g_ptr_array_add (merged, g_object_ref (g_ptr_array_index (self->items, i)));
+
+  g_ptr_array_unref (self->items);
+  self->items = merged;
+
+  if (n_added > 0)
+    g_list_model_items_changed (G_LIST_MODEL (self), n_before, 0, n_added);
+}
+
+gboolean
+emerge_history_load (EmergeHistory  *self,
+                     GCancellable   *cancellable,
+                     GError        **error)
+{
+  GPtrArray *loaded;
+
+  g_return_val_if_fail (EMERGE_IS_HISTORY (self), FALSE);
+
+  loaded = history_read_index (self->index_path, self->dir, cancellable, error);
+  if (loaded == NULL)
+    return FALSE;
+
+  history_merge (self, loaded);
+  g_ptr_array_unref (loaded);
+
+  return TRUE;
+}
+
+static void
+history_load_thread (GTask        *task,
+                     gpointer      source_object,
+                     gpointer      task_data G_GNUC_UNUSED,
+                     GCancellable *cancellable)
+{
+  EmergeHistory *self = EMERGE_HISTORY (source_object);
+  GError *error = NULL;
+  GPtrArray *loaded;
+
+  /* The paths are fixed at construction, so reading them here is safe */
+  loaded = history_read_index (self->index_path, self->dir, cancellable, &error);
+  if (loaded == NULL)
+    g_task_return_error (task, error);
+  else
+    g_task_return_pointer (task, loaded, (GDestroyNotify) g_ptr_array_unref);
+}
+
+static void
+history_load_read_cb (GObject      *source_object,
+                      GAsyncResult *res,
+                      gpointer      user_data)
+{
+  EmergeHistory *self = EMERGE_HISTORY (source_object);
+  GTask *task = G_TASK (user_data);
+  GError *error = NULL;
+  GPtrArray *loaded;
+
+  loaded = g_task_propagate_pointer (G_TASK (res), &error);
+  if (loaded == NULL) {
+    g_task_return_error (task, error);
+  } else {
+    history_merge (self, loaded);
+    g_ptr_array_unref (loaded);
+    g_task_return_boolean (task, TRUE);
+  }
+
+  g_object_unref (task);
+}
+
+/* Parses the index on a worker thread; entries are added to the model on
+ * the main thread just before @callback runs */
+void
+emerge_history_load_async (EmergeHistory       *self,
+                           GCancellable        *cancellable,
+                           GAsyncReadyCallback  callback,
+                           gpointer             user_data)
+{
+  GTask *task, *read_task;
+
+  g_return_if_fail (EMERGE_IS_HISTORY (self));
+
+  task = g_task_new (self, cancellable, callback, user_data);
+  g_task_set_source_tag (task, emerge_history_load_async);
+
+  read_task = g_task_new (self, cancellable, history_load_read_cb, task);
+  g_task_run_in_thread (read_task, history_load_thread);
+  g_object_unref (read_task);
+}
+
+gboolean
+emerge_history_load_finish (EmergeHistory  *self,
+                            GAsyncResult   *result,
+                            GError        **error)
+{
+  g_return_val_if_fail (g_task_is_valid (result, self), FALSE);
+
+  return g_task_propagate_boolean (G_TASK (result), error);
+}
+
+/* Moves @src to @dest, copying when they are on different file systems,
+ * as /tmp often is */
+static gboolean
+history_move_file (const char  *src,
+                   const char  *dest,
+                   GError     **error)
+{
+  GFile *src_file, *dest_file;
+  gboolean ok;
+
+  if (g_rename (src, dest) == 0)
+    return TRUE;
+
+  if (errno != EXDEV) {
+    int saved_errno = errno;
+
+    g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (saved_errno),
+                 "Failed to move %s to %s: %s", src, dest, g_strerror (saved_errno));
+    return FALSE;
+  }
+
+  src_file = g_file_new_for_path (src);
+  dest_file = g_file_new_for_path (dest);
+  ok = g_file_copy (src_file, dest_file, G_FILE_COPY_NONE, NULL, NULL, NULL, error);
+  if (ok)
+    g_file_delete (src_file, NULL, NULL);
+  g_object_unref (src_file);
+  g_object_unref (dest_file);
+
+  return ok;
+}
+
+/* Serializes @root as one index line, newline included */
+static gchar *
+history_json_line (JsonNode *root,
+                   gsize    *length)
+{
+  JsonGenerator *generator = json_generator_new ();
+  gchar *line;
+
+  json_generator_set_root (generator, root);
+  line = json_generator_to_data (generator, length);
+  line = g_realloc (line, *length + 2);
+  line[(*length)++] = '\n';
+  line[*length] = '\0';
+  g_object_unref (generator);
+
+  return line;
+}
+
+static gboolean
+history_append_line (EmergeHistory  *self,
+                     const char     *line,
+                     gsize           length,
+                     GError        **error)
+{
+  if (self->index_fd < 0) {
+    self->index_fd = open (self->index_path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (self->index_fd < 0) {
+      int saved_errno = errno;
+
+      g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (saved_errno),
+                   "Failed to open %s: %s", self->index_path, g_strerror (saved_errno));
+      return FALSE;
+    }
+  }
+
+  /* O_APPEND puts every write at the end, even with two instances open */
+  while (length > 0) {
+    gssize written = write (self->index_fd, line, length);
+
+    if (written < 0) {
+      int saved_errno = errno;
+
+      if (saved_errno == EINTR)
+        continue;
+
+      g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (saved_errno),
+                   "Failed to write %s: %s", self->index_path, g_strerror (saved_errno));
+      return FALSE;
+    }
+
+    line += written;
+    length -= written;
+  }
+
+  return TRUE;
+}
+
+/* Stores @job's image, taken from @image if set and moved from
+ * output_path otherwise, and appends @job to the index */
+static EmergeHistoryItem *
+history_add (EmergeHistory  *self,
+             EmergeJob      *job,
+             GBytes         *image,
+             GError        **error)
+{
+  EmergeHistoryItem *item;
+  JsonBuilder *builder;
+  JsonNode *root;
+  gchar *filename, *relative, *image_path, *line;
+  gsize length;
+  guint64 id;
+  gboolean stored;
+
+  if (g_mkdir_with_parents (self->images_dir, 0755) != 0) {
+    int saved_errno = errno;
+
+    g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (saved_errno),
+                 "Failed to create %s: %s", self->images_dir, g_strerror (saved_errno));
+    return NULL;
+  }
+
+  /* Microseconds since the epoch, so ids stay unique and ordered across
+   * runs even when an entry is added before the index has been loaded */
+  id = MAX ((guint64) g_get_real_time (), self->last_id + 1);
+
+  filename = g_strdup_printf ("%" G_GUINT64_FORMAT ".png", id);
+  relative = g_build_filename (IMAGES_NAME, filename, NULL);
+  image_path = g_build_filename (self->dir, relative, NULL);
+  g_free (filename);
+
+  if (image != NULL)
+    stored = g_file_set_contents_full (image_path,
+                                       g_bytes_get_data (image, NULL),
+                                       g_bytes_get_size (image),
+                                       G_FILE_SET_CONTENTS_NONE, 0644, error);
+  else
+    stored = history_move_file (job->output_path, image_path, error);
+
+  if (!stored) {
+    g_free (relative);
+    g_free (image_path);
+    return NULL;
+  }
+
+  g_free (job->output_path);
+  job->output_path = g_strdup (image_path);
+
+  builder = json_builder_new ();
+  json_builder_begin_object (builder);
+  json_builder_set_member_name (builder, "id");
+  json_builder_add_int_value (builder, id);
+  json_builder_set_member_name (builder, "created");
+  json_builder_add_int_value (builder, id / G_USEC_PER_SEC);
+  json_builder_set_member_name (builder, "image");
+  json_builder_add_string_value (builder, relative);
+  json_builder_set_member_name (builder, "job");
+  json_builder_add_value (builder, emerge_job_to_json (job));
+  json_builder_end_object (builder);
+
+  root = json_builder_get_root (builder);
+  line = history_json_line (root, &length);
+
+  json_node_unref (root);
+  g_object_unref (builder);
+  g_free (relative);
+
+  if (!history_append_line (self, line, length, error)) {
+    /* The image stays where it is; it just won't be listed next time */
+    g_free (line);
+    g_free (image_path);
+    return NULL;
+  }
+  g_free (line);
+
+  item = g_object_new (EMERGE_TYPE_HISTORY_ITEM, NULL);
+  item->id = id;
+  item->created = id / G_USEC_PER_SEC;
+  item->image_path = image_path;
+  item->job = emerge_job_ref (job);
+
+  self->last_id = id;
+  g_ptr_array_add (self->items, item);
+  g_hash_table_insert (self->by_id, &item->id, item);
+  g_list_model_items_changed (G_LIST_MODEL (self), 0, 0, 1);
+
+  return item;
+}
+
+/**
+ * emerge_history_add:
+ * @self: a history
+ * @job: a job that has produced its image
+ * @error: return location for a #GError
+ *
+ * Moves the image at @job's output_path into the history, points
+ * output_path at its new location and appends @job to the index.
+ *
+ * Returns: (transfer none): the new entry, or %NULL on error
+ */
+EmergeHistoryItem *
+emerge_history_add (EmergeHistory  *self,
+                    EmergeJob      *job,
+                    GError        **error)
+{
+  g_return_val_if_fail (EMERGE_IS_HISTORY (self), NULL);
+  g_return_val_if_fail (job != NULL, NULL);
+
+  if (job->output_path == NULL || !g_file_test (job->output_path, G_FILE_TEST_IS_REGULAR)) {
+    g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_NOENT,
+                 "Generated image %s not found", job->output_path ? job->output_path : "");
+    return NULL;
+  }
+
+  return history_add (self, job, NULL, error);
+}
+
+/**
+ * emerge_history_add_image:
+ * @self: a history
+ * @job: a job that has produced its image
+ * @image: the PNG data of the image
+ * @error: return location for a #GError
+ *
+ * Like emerge_history_add(), for an image that was never written to disk;
+ * the history is the first place it is stored.
+ *
+ * Returns: (transfer none): the new entry, or %NULL on error
+ */
+EmergeHistoryItem *
+emerge_history_add_image (EmergeHistory  *self,
+                          EmergeJob      *job,
+                          GBytes         *image,
+                          GError        **error)
+{
+  g_return_val_if_fail (EMERGE_IS_HISTORY (self), NULL);
+  g_return_val_if_fail (job != NULL, NULL);
+  g_return_val_if_fail (image != NULL, NULL);
+
+  return history_add (self, job, image, error);
+}
+
+/* Returns: (transfer none) (nullable): the entry with @id */
+EmergeHistoryItem *
+emerge_history_lookup (EmergeHistory *self,
+                       guint64        id)
+{
+  g_return_val_if_fail (EMERGE_IS_HISTORY (self), NULL);
+
+  return g_hash_table_lookup (self->by_id, &id);
+}
+
+/* One update record: the entry's id and a single changed @member */
+static void
+history_append_update (GString    *lines,
+                       guint64     id,
+                       const char *member,
+                       JsonNode   *value)
+{
+  JsonObject *object = json_object_new ();
+  JsonNode *root = json_node_new (JSON_NODE_OBJECT);
+  gchar *line;
+  gsize length;
+
+  json_object_set_int_member (object, "id", id);
+  json_object_set_member (object, member, value);
+  json_node_take_object (root, object);
+
+  line = history_json_line (root, &length);
+  g_string_append_len (lines, line, length);
+
+  g_free (line);
+  json_node_unref (root);
+}
+
+/**
+ * emerge_history_remove:
+ * @self: a history
+ * @items: (element-type EmergeHistoryItem): entries of @self
+ * @error: return location for a #GError
+ *
+ * Removes @items from the history and deletes their images. The model
+ * changes once, however many entries are removed.
+ *
+ * Returns: %FALSE if the removal couldn't be recorded, in which case
+ *   nothing is removed
+ */
+gboolean
+emerge_history_remove (EmergeHistory  *self,
+                       GPtrArray      *items,
+                       GError        **error)
+{
+  GHashTable *removed;
+  GString *lines;
+  guint n_before, n_kept = 0;
+
+  g_return_val_if_fail (EMERGE_IS_HISTORY (self), FALSE);
+  g_return_val_if_fail (items != NULL, FALSE);
+
+  removed = g_hash_table_new (NULL, NULL);
+  lines = g_string_new (NULL);
+
+  for (guint i = 0; i < items->len; i++) {
+    EmergeHistoryItem *item = g_ptr_array_index (items, i);
+
+    if (g_hash_table_lookup (self->by_id, &item->id) != item ||
+        !g_hash_table_add (removed, item))
+      continue;
+
+    history_append_update (lines, item->id, "deleted", json_node_init_boolean (json_node_alloc (), TRUE));
+  }
+
+  if (g_hash_table_size (removed) == 0) {
+    g_string_free (lines, TRUE);
+    g_hash_table_unref (removed);
+    return TRUE;
+  }
+
+  /* Recorded first, so a failure leaves the history as it was */
+  if (!history_append_line (self, lines->str, lines->len, error)) {
+    g_string_free (lines, TRUE);
+    g_hash_table_unref (removed);
+    return FALSE;
+  }
+  g_string_free (lines, TRUE);
+
+  n_before = self->items->len;
+  for (guint i = 0; i < self->items->len; i++) {
+    EmergeHistoryItem *item = g_ptr_array_index (self->items, i);
+
+    if (!g_hash_table_contains (removed, item)) {
+      self->items->pdata[n_kept++] = item;
+      continue;
+    }
+
+    if (g_unlink (item->image_path) != 0 && errno != ENOENT)
+      g_warning ("Failed to delete %s: %s", item->image_path, g_strerror (errno));
+
+    g_hash_table_remove (self->by_id, &item->id);
+    g_object_unref (item);
+  }
+  self->items->len = n_kept;
+
+  g_hash_table_unref (removed);
+
+  g_list_model_items_changed (G_LIST_MODEL (self), 0, n_before, n_kept);
+
+  return TRUE;
+}
+
+typedef struct {
+  GPtrArray *items;     /* entries being hashed */
+  GPtrArray *paths;
+  guint64   *hashes;
+  gboolean  *hashed;
+} HashData;
+
+static void
+hash_data_free (HashData *data)
+{
+  g_ptr_array_unref (data->items);
+  g_ptr_array_unref (data->paths);
+  g_free (data->hashes);
+  g_free (data->hashed);
+  g_free (data);
+}
+
+static void
+history_hash_thread (GTask        *task,
+                     gpointer      source_object G_GNUC_UNUSED,
+                     gpointer      task_data,
+                     GCancellable *cancellable)
+{
+  HashData *data = task_data;
+
+  for (guint i = 0; i < data->paths->len; i++) {
+    const char *path = g_ptr_array_index (data->paths, i);
+    GError *error = NULL;
+
+    if (g_cancellable_is_cancelled (cancellable))
+      break;
+
+    data->hashed[i] = emerge_image_metrics_dhash_file (path, &data->hashes[i], &error);
+    if (!data->hashed[i]) {
+      g_warning ("Failed to hash %s: %s", path, error->message);
+      g_error_free (error);
+    }
+  }
+
+  g_task_return_boolean (task, TRUE);
+}
+
+/* Back on the main thread: record the hashes and hand them to the entries */
+static void
+history_hash_done_cb (GObject      *source_object,
+                      GAsyncResult *res,
+                      gpointer      user_data)
+{
+  EmergeHistory *self = EMERGE_HISTORY (source_object);
+  GTask *task = G_TASK (user_data);
+  HashData *data = g_task_get_task_data (G_TASK (res));
+  GString *lines = g_string_new (NULL);
+  GError *error = NULL;
+  guint n_hashed = 0;
+
+  for (guint i = 0; i < data->items->len; i++) {
+    EmergeHistoryItem *item = g_ptr_array_index (data->items, i);
+
+    item->hash_pending = FALSE;
+    if (!data->hashed[i]) {
+      /* Not retried until the next run */
+      item->hash_failed = !g_cancellable_is_cancelled (g_task_get_cancellable (task));
+      continue;
+    }
+
+    item->dhash = data->hashes[i];
+    item->has_dhash = TRUE;
+    n_hashed++;
+
+    /* Entries removed meanwhile have nothing left to update */
+    if (g_hash_table_lookup (self->by_id, &item->id) == item) {
+      gchar *hex = g_strdup_printf ("%016" G_GINT64_MODIFIER "x", item->dhash);
+
+      history_append_update (lines, item->id, "dhash", json_node_init_string (json_node_alloc (), hex));
+      g_free (hex);
+    }
+  }
+
+  /* The hashes stay in memory either way; they are only worked out again
+   * next time */
+  if (lines->len > 0 && !history_append_line (self, lines->str, lines->len, &error)) {
+    g_warning ("Failed to record image hashes: %s", error->message);
+    g_error_free (error);
+  }
+  g_string_free (lines, TRUE);
+
+  if (!g_task_return_error_if_cancelled (task))
+    g_task_return_int (task, n_hashed);
+  g_object_unref (task);
+}
+
+/**
+ * emerge_history_hash_async:
+ * @self: a history
+ * @cancellable: (nullable): a #GCancellable
+ * @callback: called once the hashes are known
+ * @user_data: data for @callback
+ *
+ * Computes the perceptual hash of every entry that doesn't have one yet on
+ * a worker thread, and records them in the index so each image is only
+ * hashed once. Entries already being hashed by an earlier call are left to
+ * that call.
+ */
+void
+emerge_history_hash_async (EmergeHistory       *self,
+                           GCancellable        *cancellable,
+                           GAsyncReadyCallback  callback,
+                           gpointer             user_data)
+{
+  GTask *task, *hash_task;
+  HashData *data;
+
+  g_return_if_fail (EMERGE_IS_HISTORY (self));
+
+  task = g_task_new (self, cancellable, callback, user_data);
+  g_task_set_source_tag (task, emerge_history_hash_async);
+
+  data = g_new0 (HashData, 1);
+  data->items = g_ptr_array_new_with_free_func (g_object_unref);
+  data->paths = g_ptr_array_new_with_free_func (g_free);
+
+  for (guint i = 0; i < self->items->len; i++) {
+    EmergeHistoryItem *item = g_ptr_array_index (self->items, i);
+
+    if (item->has_dhash || item->hash_pending || item->hash_failed)
+      continue;
+
+    item->hash_pending = TRUE;
+    g_ptr_array_add (data->items, g_object_ref (item));
+    g_ptr_array_add (data->paths, g_strdup (item->image_path));
+  }
+
+  data->hashes = g_new0 (guint64, data->items->len);
+  data->hashed = g_new0 (gboolean, data->items->len);
+
+  hash_task = g_task_new (self, cancellable, history_hash_done_cb, task);
+  g_task_set_task_data (hash_task, data, (GDestroyNotify) hash_data_free);
+  g_task_run_in_thread (hash_task, history_hash_thread);
+  g_object_unref (hash_task);
+}
+
+/* Returns: the number of entries hashed */
+guint
+emerge_history_hash_finish (EmergeHistory  *self,
+                            GAsyncResult   *result,
+                            GError        **error)
+{
+  gssize n_hashed;
+
+  g_return_val_if_fail (g_task_is_valid (result, self), 0);
+
+  n_hashed = g_task_propagate_int (G_TASK (result), error);
+
+  return MAX (n_hashed, 0);
+}
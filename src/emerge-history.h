@@ -0,0 +1,56 @@
+#pragma once
+
+#include <gio/gio.h>
+
+#include "emerge-job.h"
+
+G_BEGIN_DECLS
+
+#define EMERGE_TYPE_HISTORY_ITEM (emerge_history_item_get_type())
+
+G_DECLARE_FINAL_TYPE (EmergeHistoryItem, emerge_history_item, EMERGE, HISTORY_ITEM, GObject)
+
+guint64            emerge_history_item_get_id         (EmergeHistoryItem *self);
+gint64             emerge_history_item_get_created    (EmergeHistoryItem *self);
+const char        *emerge_history_item_get_image_path (EmergeHistoryItem *self);
+EmergeJob         *emerge_history_item_get_job        (EmergeHistoryItem *self);
+gboolean           emerge_history_item_get_dhash      (EmergeHistoryItem *self,
+                                                       guint64           *dhash);
+
+#define EMERGE_TYPE_HISTORY (emerge_history_get_type())
+
+G_DECLARE_FINAL_TYPE (EmergeHistory, emerge_history, EMERGE, HISTORY, GObject)
+
+EmergeHistory     *emerge_history_new                 (const char           *dir);
+const char        *emerge_history_get_dir             (EmergeHistory        *self);
+gboolean           emerge_history_load                (EmergeHistory        *self,
+                                                       GCancellable         *cancellable,
+                                                       GError              **error);
+void               emerge_history_load_async          (EmergeHistory        *self,
+                                                       GCancellable         *cancellable,
+                                                       GAsyncReadyCallback   callback,
+                                                       gpointer              user_data);
+gboolean           emerge_history_load_finish         (EmergeHistory        *self,
+                                                       GAsyncResult         *result,
+                                                       GError              **error);
+EmergeHistoryItem *emerge_history_add                 (EmergeHistory        *self,
+                                                       EmergeJob            *job,
+                                                       GError              **error);
+EmergeHistoryItem *emerge_history_add_image           (EmergeHistory        *self,
+                                                       EmergeJob            *job,
+                                                       GBytes               *image,
+                                                       GError              **error);
+EmergeHistoryItem *emerge_history_lookup              (EmergeHistory        *self,
+                                                       guint64               id);
+gboolean           emerge_history_remove              (EmergeHistory        *self,
+                                                       GPtrArray            *items,
+                                                       GError              **error);
+void               emerge_history_hash_async          (EmergeHistory        *self,
+                                                       GCancellable         *cancellable,
+                                                       GAsyncReadyCallback   callback,
+                                                       gpointer              user_data);
+guint              emerge_history_hash_finish         (EmergeHistory        *self,
+                                                       GAsyncResult         *result,
+                                                       GError              **error);
+
+G_END_DECLS
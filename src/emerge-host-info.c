@@ -0,0 +1,85 @@
+#include "emerge-host-info.h"
+
+#include <string.h>
+
+/* The first line in @path starting with @key, with the key stripped */
+static gchar *
+read_proc_field (const char *path,
+                 const char *key)
+{
+  gchar *contents = NULL;
+  gchar *value = NULL;
+
+  if (!g_file_get_contents (path, &contents, NULL, NULL))
+    return NULL;
+
+  gchar **lines = g_strsplit (contents, "\n", -1);
+  for (guint i = 0; lines[i] != NULL && value == NULL; i++) {
+    if (g_str_has_prefix (lines[i], key)) {
+      const char *colon = strchr (lines[i], ':');
+
+      if (colon != NULL)
+        value = g_strstrip (g_strdup (colon + 1));
+    }
+  }
+
+  g_strfreev (lines);
+  g_free (contents);
+
+  return value;
+}
+
+EmergeHostInfo *
+emerge_host_info_get (void)
+{
+  EmergeHostInfo *info = g_new0 (EmergeHostInfo, 1);
+  gchar *mem_total;
+
+  info->cpu = read_proc_field ("/proc/cpuinfo", "model name");
+  if (info->cpu == NULL)
+    info->cpu = g_strdup ("unknown");
+
+  info->cores = g_get_num_processors ();
+
+  mem_total = read_proc_field ("/proc/meminfo", "MemTotal");
+  if (mem_total != NULL)
+    info->memory = g_ascii_strtoull (mem_total, NULL, 10) * 1024;
+  g_free (mem_total);
+
+  return info;
+}
+
+void
+emerge_host_info_free (EmergeHostInfo *info)
+{
+  if (info == NULL)
+    return;
+
+  g_free (info->cpu);
+  g_free (info);
+}
+
+/* Adds a "host" member to the object being built */
+void
+emerge_host_info_to_json (EmergeHostInfo *info,
+                          JsonBuilder    *builder)
+{
+  json_builder_set_member_name (builder, "host");
+  json_builder_begin_object (builder);
+  json_builder_set_member_name (builder, "cpu");
+  json_builder_add_string_value (builder, info->cpu);
+  json_builder_set_member_name (builder, "cores");
+  json_builder_add_int_value (builder, info->cores);
+  json_builder_set_member_name (builder, "memory");
+  json_builder_add_int_value (builder, info->memory);
+  json_builder_end_object (builder);
+}
+
+/* One line summary, e.g. "AMD Ryzen 7 5800X, 16 cores, 31.3 GiB RAM" */
+gchar *
+emerge_host_info_describe (EmergeHostInfo *info)
+{
+  return g_strdup_printf ("%s, %u cores, %.1f GiB RAM",
+                          info->cpu, info->cores,
+                          info->memory / (1024.0 * 1024.0 * 1024.0));
+}
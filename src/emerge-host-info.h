@@ -0,0 +1,23 @@
+#pragma once
+
+#include <json-glib/json-glib.h>
+
+G_BEGIN_DECLS
+
+/* Hardware description stored with benchmark reports, so results from
+ * different machines are not compared blindly */
+typedef struct {
+  gchar   *cpu;       /* model name from /proc/cpuinfo */
+  guint    cores;
+  guint64  memory;    /* bytes, 0 if unknown */
+} EmergeHostInfo;
+
+EmergeHostInfo *emerge_host_info_get      (void);
+void            emerge_host_info_free     (EmergeHostInfo *info);
+void            emerge_host_info_to_json  (EmergeHostInfo *info,
+                                           JsonBuilder    *builder);
+gchar          *emerge_host_info_describe (EmergeHostInfo *info);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (EmergeHostInfo, emerge_host_info_free)
+
+G_END_DECLS
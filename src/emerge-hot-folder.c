@@ -0,0 +1,602 @@
+#include "emerge-hot-folder.h"
+
+#include <errno.h>
+#include <string.h>
+#include <glib/gstdio.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+/* Inputs are scaled and converted here first, named after their contents */
+#define PREPARED_DIR_NAME ".emerge-inputs"
+
+struct _EmergeHotFolder
+{
+  GObject       parent_instance;
+
+  GFile        *input_dir;
+  GFile        *output_dir;
+  gchar        *prepared_dir;
+  EmergeQueue  *queue;
+  EmergeJob    *template_job;
+
+  GFileMonitor *monitor;
+  GCancellable *cancellable;
+
+  GHashTable   *seen_paths;   /* every input noticed, so none is taken twice */
+  GHashTable   *hashes;       /* contents of the inputs taken so far */
+  GQueue        waiting;      /* paths noticed and not prepared yet */
+  GQueue        ready;        /* EmergeJob, prepared and not queued yet */
+  guint         n_preparing;
+  guint         max_preparing;
+  guint         n_submitted;
+  guint         n_skipped;
+  gboolean      pumping;
+};
+
+G_DEFINE_TYPE (EmergeHotFolder, emerge_hot_folder, G_TYPE_OBJECT)
+
+typedef struct {
+  gchar *input_path;
+  gchar *export_path;
+  gchar *prepared_dir;
+  gint   long_side;
+} PrepareData;
+
+typedef struct {
+  gchar   *hash;
+  gchar   *prepared_path;
+  gint     width;
+  gint     height;
+  gboolean already_done;
+} PrepareResult;
+
+static void hot_folder_pump (EmergeHotFolder *self);
+
+static void
+prepare_data_free (PrepareData *data)
+{
+  g_free (data->input_path);
+  g_free (data->export_path);
+  g_free (data->prepared_dir);
+  g_free (data);
+}
+
+static void
+prepare_result_free (PrepareResult *result)
+{
+  g_free (result->hash);
+  g_free (result->prepared_path);
+  g_free (result);
+}
+
+static void
+emerge_hot_folder_dispose (GObject *object)
+{
+  EmergeHotFolder *self = EMERGE_HOT_FOLDER (object);
+
+  emerge_hot_folder_stop (self);
+  if (self->queue != NULL)
+    g_signal_handlers_disconnect_by_data (self->queue, self);
+  g_clear_object (&self->queue);
+
+  G_OBJECT_CLASS (emerge_hot_folder_parent_class)->dispose (object);
+}
+
+static void
+emerge_hot_folder_finalize (GObject *object)
+{
+  EmergeHotFolder *self = EMERGE_HOT_FOLDER (object);
+
+  g_clear_object (&self->input_dir);
+  g_clear_object (&self->output_dir);
+  g_free (self->prepared_dir);
+  g_clear_pointer (&self->template_job, emerge_job_unref);
+  g_hash_table_unref (self->seen_paths);
+  g_hash_table_unref (self->hashes);
+
+  G_OBJECT_CLASS (emerge_hot_folder_parent_class)->finalize (object);
+}
+
+static void
+emerge_hot_folder_class_init (EmergeHotFolderClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->dispose = emerge_hot_folder_dispose;
+  object_class->finalize = emerge_hot_folder_finalize;
+}
+
+static void
+emerge_hot_folder_init (EmergeHotFolder *self)
+{
+  self->seen_paths = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  self->hashes = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  g_queue_init (&self->waiting);
+  g_queue_init (&self->ready);
+  self->max_preparing = CLAMP (g_get_num_processors (), 1, 4);
+}
+
+/**
+ * emerge_hot_folder_new:
+ * @input_dir: the folder to watch
+ * @output_dir: where the results are written
+ * @queue: the queue to add a job to for every new image
+ * @template_job: the parameters every image is repainted with
+ *
+ * Creates a hot folder: once started, every image that appears in
+ * @input_dir, or is there already, is queued as an img2img job based on
+ * @template_job, and the result is written to @output_dir under the
+ * input's name. Inputs with the same contents are only taken once, and an
+ * input whose result already exists is skipped, so restarting a hot
+ * folder picks up where it left off.
+ *
+ * Returns: (transfer full): a new hot folder
+ */
+EmergeHotFolder *
+emerge_hot_folder_new (GFile           *input_dir,
+                       GFile           *output_dir,
+                       EmergeQueue     *queue,
+                       const EmergeJob *template_job)
+{
+  EmergeHotFolder *self;
+  gchar *output_path;
+
+  g_return_val_if_fail (G_IS_FILE (input_dir), NULL);
+  g_return_val_if_fail (G_IS_FILE (output_dir), NULL);
+  g_return_val_if_fail (EMERGE_IS_QUEUE (queue), NULL);
+  g_return_val_if_fail (template_job != NULL, NULL);
+
+  self = g_object_new (EMERGE_TYPE_HOT_FOLDER, NULL);
+  self->input_dir = g_object_ref (input_dir);
+  self->output_dir = g_object_ref (output_dir);
+  self->queue = g_object_ref (queue);
+  self->template_job = emerge_job_copy (template_job);
+  self->template_job->img2img = TRUE;
+
+  output_path = g_file_get_path (output_dir);
+  self->prepared_dir = g_build_filename (output_path, PREPARED_DIR_NAME, NULL);
+  g_free (output_path);
+
+  /* Room in the queue is what lets more inputs through */
+  g_signal_connect_swapped (queue, "changed", G_CALLBACK (hot_folder_pump), self);
+
+  return self;
+}
+
+/* Images sd can start from; anything hidden or half-copied is left alone */
+static gboolean
+is_input_name (const char *name)
+{
+  gchar *lower;
+  gboolean ret;
+
+  if (name[0] == '.' || g_str_has_suffix (name, "~"))
+    return FALSE;
+
+  lower = g_ascii_strdown (name, -1);
+  ret = (g_str_has_suffix (lower, ".png") ||
+         g_str_has_suffix (lower, ".jpg") ||
+         g_str_has_suffix (lower, ".jpeg") ||
+         g_str_has_suffix (lower, ".webp"));
+  g_free (lower);
+
+  return ret;
+}
+
+/* Reads the input once to hash it and decode it, then writes it at the
+ * size it will be repainted at, keeping its aspect ratio */
+static void
+prepare_thread (GTask        *task,
+                gpointer      source_object G_GNUC_UNUSED,
+                gpointer      task_data,
+                GCancellable *cancellable G_GNUC_UNUSED)
+{
+  PrepareData *data = task_data;
+  PrepareResult *result;
+  GError *error = NULL;
+  gchar *contents = NULL;
+  gsize length;
+  GInputStream *stream;
+  GdkPixbuf *image;
+  double scale;
+  gchar *name;
+
+  result = g_new0 (PrepareResult, 1);
+
+  if (g_file_test (data->export_path, G_FILE_TEST_EXISTS)) {
+    result->already_done = TRUE;
+    g_task_return_pointer (task, result, (GDestroyNotify) prepare_result_free);
+    return;
+  }
+
+  if (!g_file_get_contents (data->input_path, &contents, &length, &error)) {
+    prepare_result_free (result);
+    g_task_return_error (task, error);
+    return;
+  }
+
+  result->hash = g_compute_checksum_for_data (G_CHECKSUM_SHA256, (const guchar *) contents, length);
+
+  stream = g_memory_input_stream_new_from_data (contents, length, g_free);
+  image = gdk_pixbuf_new_from_stream (stream, NULL, &error);
+  g_object_unref (stream);
+  if (image == NULL) {
+    prepare_result_free (result);
+    g_task_return_error (task, error);
+    return;
+  }
+
+  scale = (double) data->long_side / MAX (gdk_pixbuf_get_width (image),
+                                          gdk_pixbuf_get_height (image));
+  result->width = emerge_job_round_size (gdk_pixbuf_get_width (image) * scale);
+  result->height = emerge_job_round_size (gdk_pixbuf_get_height (image) * scale);
+  name = g_strconcat (result->hash, ".png", NULL);
+  result->prepared_path = g_build_filename (data->prepared_dir, name, NULL);
+  g_free (name);
+
+  /* An earlier run may have prepared the same contents already */
+  if (!g_file_test (result->prepared_path, G_FILE_TEST_EXISTS)) {
+    GdkPixbuf *scaled = gdk_pixbuf_scale_simple (image, result->width, result->height,
+                                                 GDK_INTERP_BILINEAR);
+    gchar *buffer = NULL;
+    gsize size;
+    gboolean ok;
+
+    ok = (scaled != NULL &&
+          gdk_pixbuf_save_to_buffer (scaled, &buffer, &size, "png", &error, NULL) &&
+          g_file_set_contents_full (result->prepared_path, buffer, size,
+                                    G_FILE_SET_CONTENTS_CONSISTENT, 0644, &error));
+    g_free (buffer);
+    g_clear_object (&scaled);
+
+    if (!ok) {
+      if (error == NULL)
+        error = g_error_new (G_IO_ERROR, G_IO_ERROR_FAILED,
+                             "Not enough memory to scale %s", data->input_path);
+      g_object_unref (image);
+      prepare_result_free (result);
+      g_task_return_error (task, error);
+      return;
+    }
+  }
+
+  g_object_unref (image);
+  g_task_return_pointer (task, result, (GDestroyNotify) prepare_result_free);
+}
+
+static void
+prepare_done_cb (GObject      *source_object,
+                 GAsyncResult *res,
+                 gpointer      user_data G_GNUC_UNUSED)
+{
+  EmergeHotFolder *self = EMERGE_HOT_FOLDER (source_object);
+  PrepareData *data = g_task_get_task_data (G_TASK (res));
+  PrepareResult *result;
+  GError *error = NULL;
+  EmergeJob *job;
+
+  result = g_task_propagate_pointer (G_TASK (res), &error);
+  if (result == NULL && g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+    g_error_free (error);
+    return;
+  }
+
+  self->n_preparing--;
+
+  if (result == NULL) {
+    g_warning ("Skipping %s: %s", data->input_path, error->message);
+    g_error_free (error);
+    self->n_skipped++;
+  } else if (result->already_done) {
+    self->n_skipped++;
+  } else if (g_hash_table_contains (self->hashes, result->hash)) {
+    g_print ("Skipping %s, an image with the same contents was already taken\n",
+             data->input_path);
+    self->n_skipped++;
+  } else {
+    g_hash_table_add (self->hashes, g_strdup (result->hash));
+
+    job = emerge_job_copy (self->template_job);
+    g_free (job->init_image_path);
+    job->init_image_path = g_strdup (result->prepared_path);
+    job->width = result->width;
+    job->height = result->height;
+    job->export_path = g_strdup (data->export_path);
+    if (job->seed < 0)
+      job->seed = g_random_int_range (0, G_MAXINT32);
+    g_queue_push_tail (&self->ready, job);
+  }
+
+  g_clear_pointer (&result, prepare_result_free);
+  hot_folder_pump (self);
+}
+
+static void
+hot_folder_prepare (EmergeHotFolder *self,
+                    gchar           *input_path)
+{
+  PrepareData *data = g_new0 (PrepareData, 1);
+  gchar *output_path = g_file_get_path (self->output_dir);
+  gchar *basename = g_path_get_basename (input_path);
+  char *dot = strrchr (basename, '.');
+  gchar *name;
+  GTask *task;
+
+  /* The result keeps the input's name, as a PNG */
+  if (dot != NULL)
+    *dot = '\0';
+  name = g_strconcat (basename, ".png", NULL);
+
+  data->input_path = input_path;
+  data->export_path = g_build_filename (output_path, name, NULL);
+  data->prepared_dir = g_strdup (self->prepared_dir);
+  data->long_side = MAX (self->template_job->width, self->template_job->height);
+  g_free (name);
+  g_free (basename);
+  g_free (output_path);
+
+  self->n_preparing++;
+  task = g_task_new (self, self->cancellable, prepare_done_cb, NULL);
+  g_task_set_task_data (task, data, (GDestroyNotify) prepare_data_free);
+  g_task_run_in_thread (task, prepare_thread);
+  g_object_unref (task);
+}
+
+/* Moves prepared jobs into the queue while it has room, and prepares more
+ * inputs while there is room ahead of it. Everything else waits as a path,
+ * so thousands of inputs cost little until their turn comes. */
+static void
+hot_folder_pump (EmergeHotFolder *self)
+{
+  if (self->pumping || self->cancellable == NULL)
+    return;
+
+  /* Submitting emits EmergeQueue::changed, which lands back here */
+  self->pumping = TRUE;
+
+  while (self->ready.length > 0 &&
+         emerge_queue_get_n_pending (self->queue) < EMERGE_HOT_FOLDER_MAX_QUEUED) {
+    EmergeJob *job = g_queue_pop_head (&self->ready);
+    GError *error = NULL;
+
+    if (emerge_queue_submit (self->queue, job, &error) != 0) {
+      self->n_submitted++;
+    } else {
+      g_warning ("Failed to queue %s: %s", job->export_path, error->message);
+      g_error_free (error);
+      self->n_skipped++;
+    }
+    emerge_job_unref (job);
+  }
+
+  while (self->waiting.length > 0 && self->n_preparing < self->max_preparing &&
+         self->n_preparing + self->ready.length < EMERGE_HOT_FOLDER_MAX_AHEAD)
+    hot_folder_prepare (self, g_queue_pop_head (&self->waiting));
+
+  self->pumping = FALSE;
+}
+
+static void
+hot_folder_add (EmergeHotFolder *self,
+                GFile           *file)
+{
+  gchar *basename = g_file_get_basename (file);
+  gchar *path;
+
+  if (!is_input_name (basename)) {
+    g_free (basename);
+    return;
+  }
+  g_free (basename);
+
+  path = g_file_get_path (file);
+  if (path == NULL || g_hash_table_contains (self->seen_paths, path)) {
+    g_free (path);
+    return;
+  }
+
+  g_hash_table_add (self->seen_paths, g_strdup (path));
+  g_queue_push_tail (&self->waiting, path);
+  hot_folder_pump (self);
+}
+
+/* Files are taken once they are complete: when whoever wrote them closes
+ * them, or when they are moved in whole */
+static void
+hot_folder_changed_cb (GFileMonitor      *monitor G_GNUC_UNUSED,
+                       GFile             *file,
+                       GFile             *other_file,
+                       GFileMonitorEvent  event,
+                       gpointer           user_data)
+{
+  EmergeHotFolder *self = EMERGE_HOT_FOLDER (user_data);
+
+  switch (event) {
+    case G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT:
+    case G_FILE_MONITOR_EVENT_MOVED_IN:
+      hot_folder_add (self, file);
+      break;
+    case G_FILE_MONITOR_EVENT_RENAMED:
+      hot_folder_add (self, other_file);
+      break;
+    default:
+      break;
+  }
+}
+
+static void
+scan_thread (GTask        *task,
+             gpointer      source_object,
+             gpointer      task_data G_GNUC_UNUSED,
+             GCancellable *cancellable G_GNUC_UNUSED)
+{
+  EmergeHotFolder *self = EMERGE_HOT_FOLDER (source_object);
+  gchar *input_path = g_file_get_path (self->input_dir);
+  GPtrArray *names;
+  GError *error = NULL;
+  GDir *dir;
+  const char *name;
+
+  dir = g_dir_open (input_path, 0, &error);
+  g_free (input_path);
+  if (dir == NULL) {
+    g_task_return_error (task, error);
+    return;
+  }
+
+  names = g_ptr_array_new_with_free_func (g_free);
+  while ((name = g_dir_read_name (dir)) != NULL) {
+    if (is_input_name (name))
+      g_ptr_array_add (names, g_strdup (name));
+  }
+  g_dir_close (dir);
+
+  g_ptr_array_sort_values (names, (GCompareFunc) g_strcmp0);
+  g_task_return_pointer (task, names, (GDestroyNotify) g_ptr_array_unref);
+}
+
+static void
+scan_done_cb (GObject      *source_object,
+              GAsyncResult *res,
+              gpointer      user_data G_GNUC_UNUSED)
+{
+  EmergeHotFolder *self = EMERGE_HOT_FOLDER (source_object);
+  GError *error = NULL;
+  GPtrArray *names;
+
+  names = g_task_propagate_pointer (G_TASK (res), &error);
+  if (names == NULL) {
+    if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+      g_warning ("Failed to list the hot folder: %s", error->message);
+    g_error_free (error);
+    return;
+  }
+
+  if (names->len > 0)
+    g_print ("Found %u images already in the hot folder\n", names->len);
+
+  for (guint i = 0; i < names->len; i++) {
+    GFile *file = g_file_get_child (self->input_dir, g_ptr_array_index (names, i));
+
+    hot_folder_add (self, file);
+    g_object_unref (file);
+  }
+
+  g_ptr_array_unref (names);
+}
+
+/**
+ * emerge_hot_folder_start:
+ * @self: a hot folder
+ * @error: return location for an error
+ *
+ * Starts watching, and takes the images already in the folder.
+ *
+ * Returns: %FALSE if the folders can't be watched or written
+ */
+gboolean
+emerge_hot_folder_start (EmergeHotFolder  *self,
+                         GError          **error)
+{
+  GTask *task;
+
+  g_return_val_if_fail (EMERGE_IS_HOT_FOLDER (self), FALSE);
+  g_return_val_if_fail (self->monitor == NULL, FALSE);
+
+  if (g_mkdir_with_parents (self->prepared_dir, 0755) != 0) {
+    int saved_errno = errno;
+
+    g_set_error (error, G_IO_ERROR, g_io_error_from_errno (saved_errno),
+                 "Failed to create %s: %s", self->prepared_dir, g_strerror (saved_errno));
+    return FALSE;
+  }
+
+  self->monitor = g_file_monitor_directory (self->input_dir, G_FILE_MONITOR_WATCH_MOVES,
+                                            NULL, error);
+  if (self->monitor == NULL)
+    return FALSE;
+
+  self->cancellable = g_cancellable_new ();
+  g_signal_connect (self->monitor, "changed", G_CALLBACK (hot_folder_changed_cb), self);
+
+  /* Watching starts first, so an image added meanwhile is seen either way */
+  task = g_task_new (self, self->cancellable, scan_done_cb, NULL);
+  g_task_run_in_thread (task, scan_thread);
+  g_object_unref (task);
+
+  return TRUE;
+}
+
+/* Stops taking new images. Jobs already in the queue are left there. */
+void
+emerge_hot_folder_stop (EmergeHotFolder *self)
+{
+  g_return_if_fail (EMERGE_IS_HOT_FOLDER (self));
+
+  if (self->monitor != NULL) {
+    g_signal_handlers_disconnect_by_data (self->monitor, self);
+    g_file_monitor_cancel (self->monitor);
+    g_clear_object (&self->monitor);
+  }
+
+  if (self->cancellable != NULL) {
+    g_cancellable_cancel (self->cancellable);
+    g_clear_object (&self->cancellable);
+  }
+
+  g_queue_clear_full (&self->waiting, g_free);
+  g_queue_clear_full (&self->ready, (GDestroyNotify) emerge_job_unref);
+  self->n_preparing = 0;
+}
+
+GFile *
+emerge_hot_folder_get_input_dir (EmergeHotFolder *self)
+{
+  g_return_val_if_fail (EMERGE_IS_HOT_FOLDER (self), NULL);
+
+  return self->input_dir;
+}
+
+GFile *
+emerge_hot_folder_get_output_dir (EmergeHotFolder *self)
+{
+  g_return_val_if_fail (EMERGE_IS_HOT_FOLDER (self), NULL);
+
+  return self->output_dir;
+}
+
+/* Images noticed and not yet in the queue */
+guint
+emerge_hot_folder_get_n_waiting (EmergeHotFolder *self)
+{
+  g_return_val_if_fail (EMERGE_IS_HOT_FOLDER (self), 0);
+
+  return self->waiting.length + self->n_preparing + self->ready.length;
+}
+
+guint
+emerge_hot_folder_get_n_submitted (EmergeHotFolder *self)
+{
+  g_return_val_if_fail (EMERGE_IS_HOT_FOLDER (self), 0);
+
+  return self->n_submitted;
+}
+
+/* Images passed over: duplicates, ones already done and ones that
+ * couldn't be read */
+guint
+emerge_hot_folder_get_n_skipped (EmergeHotFolder *self)
+{
+  g_return_val_if_fail (EMERGE_IS_HOT_FOLDER (self), 0);
+
+  return self->n_skipped;
+}
+
+/* The parameters every image is repainted with; the size is the most an
+ * image is scaled to */
+const EmergeJob *
+emerge_hot_folder_get_template (EmergeHotFolder *self)
+{
+  g_return_val_if_fail (EMERGE_IS_HOT_FOLDER (self), NULL);
+
+  return self->template_job;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <gio/gio.h>
+
+#include "emerge-job.h"
+#include "emerge-queue.h"
+
+G_BEGIN_DECLS
+
+/* A hot folder keeps at most this many jobs waiting in the queue, and has
+ * at most this many more prepared or being prepared */
+#define EMERGE_HOT_FOLDER_MAX_QUEUED 4
+#define EMERGE_HOT_FOLDER_MAX_AHEAD  8
+
+#define EMERGE_TYPE_HOT_FOLDER (emerge_hot_folder_get_type())
+
+G_DECLARE_FINAL_TYPE (EmergeHotFolder, emerge_hot_folder, EMERGE, HOT_FOLDER, GObject)
+
+EmergeHotFolder *emerge_hot_folder_new             (GFile            *input_dir,
+                                                    GFile            *output_dir,
+                                                    EmergeQueue      *queue,
+                                                    const EmergeJob  *template_job);
+gboolean         emerge_hot_folder_start           (EmergeHotFolder  *self,
+                                                    GError          **error);
+void             emerge_hot_folder_stop            (EmergeHotFolder  *self);
+GFile           *emerge_hot_folder_get_input_dir   (EmergeHotFolder  *self);
+GFile           *emerge_hot_folder_get_output_dir  (EmergeHotFolder  *self);
+guint            emerge_hot_folder_get_n_waiting   (EmergeHotFolder  *self);
+guint            emerge_hot_folder_get_n_submitted (EmergeHotFolder  *self);
+guint            emerge_hot_folder_get_n_skipped   (EmergeHotFolder  *self);
+const EmergeJob *emerge_hot_folder_get_template    (EmergeHotFolder  *self);
+
+G_END_DECLS
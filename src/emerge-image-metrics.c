@@ -0,0 +1,348 @@
+#include "emerge-image-metrics.h"
+
+#include <math.h>
+#include <string.h>
+#include <gio/gio.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+/* Eight floats at a time with the GCC vector extensions. The compiler maps
+ * these onto AVX or pairs of SSE/NEON registers as the target allows. */
+typedef float v8sf __attribute__ ((vector_size (32)));
+
+#define SSIM_WINDOW  8
+#define SSIM_STRIDE  4
+#define SSIM_C1      (0.01 * 255.0 * 0.01 * 255.0)
+#define SSIM_C2      (0.03 * 255.0 * 0.03 * 255.0)
+
+/* dHash compares each cell of a 9x8 grid with its right neighbour */
+#define DHASH_COLUMNS 9
+#define DHASH_ROWS    8
+
+/* Vectors are only passed by pointer, so the helpers don't depend on the
+ * vector calling convention of the target */
+static inline void
+load_v8sf (v8sf        *v,
+           const float *p)
+{
+  memcpy (v, p, sizeof *v);
+}
+
+static inline float
+hsum_v8sf (const v8sf *v)
+{
+  return (*v)[0] + (*v)[1] + (*v)[2] + (*v)[3] + (*v)[4] + (*v)[5] + (*v)[6] + (*v)[7];
+}
+
+/**
+ * emerge_image_metrics_psnr:
+ * @reference: reference samples in the 0-255 range
+ * @test: samples to compare against @reference
+ * @n_pixels: number of samples in each buffer
+ *
+ * Returns: the peak signal-to-noise ratio in dB
+ */
+double
+emerge_image_metrics_psnr (const float *reference,
+                           const float *test,
+                           gsize        n_pixels)
+{
+  /* Partial sums are flushed into a double every block so float rounding
+   * doesn't build up over megapixel images */
+  const gsize block = 4096;
+  double sse = 0.0;
+  gsize i = 0;
+
+  g_return_val_if_fail (n_pixels > 0, 0.0);
+
+  while (i + 8 <= n_pixels) {
+    v8sf acc = { 0 };
+    gsize end = MIN (n_pixels, i + block);
+
+    for (; i + 8 <= end; i += 8) {
+      v8sf a, b, d;
+
+      load_v8sf (&a, reference + i);
+      load_v8sf (&b, test + i);
+      d = a - b;
+      acc += d * d;
+    }
+
+    sse += hsum_v8sf (&acc);
+  }
+
+  for (; i < n_pixels; i++) {
+    double d = reference[i] - test[i];
+    sse += d * d;
+  }
+
+  if (sse == 0.0)
+    return G_MAXDOUBLE;
+
+  return 10.0 * log10 (255.0 * 255.0 / (sse / n_pixels));
+}
+
+/**
+ * emerge_image_metrics_ssim:
+ * @reference: reference plane in the 0-255 range
+ * @test: plane to compare against @reference
+ * @width: plane width
+ * @height: plane height
+ *
+ * Structural similarity averaged over 8x8 windows placed every 4 pixels.
+ * Each window row is exactly one vector, so the five moments of a window
+ * take eight vector loads per plane.
+ *
+ * Returns: the mean SSIM, or -1.0 if the planes are smaller than a window
+ */
+double
+emerge_image_metrics_ssim (const float *reference,
+                           const float *test,
+                           int          width,
+                           int          height)
+{
+  const double n = SSIM_WINDOW * SSIM_WINDOW;
+  double total = 0.0;
+  guint n_windows = 0;
+
+  if (width < SSIM_WINDOW || height < SSIM_WINDOW)
+    return -1.0;
+
+  for (int y = 0; y + SSIM_WINDOW <= height; y += SSIM_STRIDE) {
+    for (int x = 0; x + SSIM_WINDOW <= width; x += SSIM_STRIDE) {
+      v8sf sa = { 0 }, sb = { 0 }, saa = { 0 }, sbb = { 0 }, sab = { 0 };
+
+      for (int row = 0; row < SSIM_WINDOW; row++) {
+        gsize offset = (gsize) (y + row) * width + x;
+        v8sf a, b;
+
+        load_v8sf (&a, reference + offset);
+        load_v8sf (&b, test + offset);
+
+        sa += a;
+        sb += b;
+        saa += a * a;
+        sbb += b * b;
+        sab += a * b;
+      }
+
+      double mean_a = hsum_v8sf (&sa) / n;
+      double mean_b = hsum_v8sf (&sb) / n;
+      double var_a = hsum_v8sf (&saa) / n - mean_a * mean_a;
+      double var_b = hsum_v8sf (&sbb) / n - mean_b * mean_b;
+      double cov = hsum_v8sf (&sab) / n - mean_a * mean_b;
+
+      total += ((2.0 * mean_a * mean_b + SSIM_C1) * (2.0 * cov + SSIM_C2)) /
+               ((mean_a * mean_a + mean_b * mean_b + SSIM_C1) * (var_a + var_b + SSIM_C2));
+      n_windows++;
+    }
+  }
+
+  return total / n_windows;
+}
+
+/* Sum of @n floats */
+static inline float
+sum_floats (const float *p,
+            int          n)
+{
+  v8sf acc = { 0 };
+  float sum;
+  int i = 0;
+
+  for (; i + 8 <= n; i += 8) {
+    v8sf v;
+
+    load_v8sf (&v, p + i);
+    acc += v;
+  }
+
+  sum = hsum_v8sf (&acc);
+  for (; i < n; i++)
+    sum += p[i];
+
+  return sum;
+}
+
+/**
+ * emerge_image_metrics_dhash:
+ * @luma: a luma plane
+ * @width: plane width, at least 9
+ * @height: plane height, at least 8
+ *
+ * Box-filters the plane down to a 9x8 grid and sets one bit per cell that
+ * is darker than its right neighbour. The rows of each band of the grid
+ * are added into one row of column sums, eight pixels at a time, which is
+ * then cut into the nine cells, so the whole image is read exactly once.
+ *
+ * Returns: the hash, or 0 if the plane is too small
+ */
+guint64
+emerge_image_metrics_dhash (const float *luma,
+                            int          width,
+                            int          height)
+{
+  float cells[DHASH_ROWS][DHASH_COLUMNS];
+  float *band;
+  guint64 hash = 0;
+
+  if (width < DHASH_COLUMNS || height < DHASH_ROWS)
+    return 0;
+
+  band = g_new (float, width);
+
+  for (int r = 0; r < DHASH_ROWS; r++) {
+    int y0 = (gint64) r * height / DHASH_ROWS;
+    int y1 = (gint64) (r + 1) * height / DHASH_ROWS;
+    int x = 0;
+
+    memcpy (band, luma + (gsize) y0 * width, width * sizeof (float));
+
+    for (int y = y0 + 1; y < y1; y++) {
+      const float *row = luma + (gsize) y * width;
+
+      for (x = 0; x + 8 <= width; x += 8) {
+        v8sf a, b;
+
+        load_v8sf (&a, band + x);
+        load_v8sf (&b, row + x);
+        a += b;
+        memcpy (band + x, &a, sizeof a);
+      }
+      for (; x < width; x++)
+        band[x] += row[x];
+    }
+
+    for (int c = 0; c < DHASH_COLUMNS; c++) {
+      int x0 = (gint64) c * width / DHASH_COLUMNS;
+      int x1 = (gint64) (c + 1) * width / DHASH_COLUMNS;
+
+      cells[r][c] = sum_floats (band + x0, x1 - x0) / ((float) (x1 - x0) * (y1 - y0));
+    }
+  }
+
+  g_free (band);
+
+  for (int r = 0; r < DHASH_ROWS; r++)
+    for (int c = 0; c < DHASH_COLUMNS - 1; c++)
+      if (cells[r][c] < cells[r][c + 1])
+        hash |= G_GUINT64_CONSTANT (1) << (r * (DHASH_COLUMNS - 1) + c);
+
+  return hash;
+}
+
+/* BT.601 luma of an RGB(A) pixbuf as a packed float plane */
+static float *
+pixbuf_to_luma (GdkPixbuf *pixbuf)
+{
+  int width = gdk_pixbuf_get_width (pixbuf);
+  int height = gdk_pixbuf_get_height (pixbuf);
+  int stride = gdk_pixbuf_get_rowstride (pixbuf);
+  int channels = gdk_pixbuf_get_n_channels (pixbuf);
+  const guchar *pixels = gdk_pixbuf_read_pixels (pixbuf);
+  float *luma = g_new (float, (gsize) width * height);
+
+  for (int y = 0; y < height; y++) {
+    const guchar *p = pixels + (gsize) y * stride;
+    float *out = luma + (gsize) y * width;
+
+    for (int x = 0; x < width; x++, p += channels)
+      out[x] = 0.299f * p[0] + 0.587f * p[1] + 0.114f * p[2];
+  }
+
+  return luma;
+}
+
+/**
+ * emerge_image_metrics_compare_files:
+ * @reference_path: the baseline image
+ * @test_path: the image to score
+ * @metrics: (out): return location for the scores
+ * @error: return location for an error
+ *
+ * Computes PSNR and SSIM on the luma of two images of the same size.
+ * Safe to call from a worker thread.
+ *
+ * Returns: %TRUE on success
+ */
+gboolean
+emerge_image_metrics_compare_files (const char          *reference_path,
+                                    const char          *test_path,
+                                    EmergeImageMetrics  *metrics,
+                                    GError             **error)
+{
+  g_autoptr(GdkPixbuf) reference = NULL;
+  g_autoptr(GdkPixbuf) test = NULL;
+  g_autofree float *reference_luma = NULL;
+  g_autofree float *test_luma = NULL;
+  int width, height;
+
+  g_return_val_if_fail (metrics != NULL, FALSE);
+
+  reference = gdk_pixbuf_new_from_file (reference_path, error);
+  if (reference == NULL)
+    return FALSE;
+
+  test = gdk_pixbuf_new_from_file (test_path, error);
+  if (test == NULL)
+    return FALSE;
+
+  width = gdk_pixbuf_get_width (reference);
+  height = gdk_pixbuf_get_height (reference);
+
+  if (width != gdk_pixbuf_get_width (test) || height != gdk_pixbuf_get_height (test)) {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                 "%s is %dx%d but %s is %dx%d",
+                 reference_path, width, height, test_path,
+                 gdk_pixbuf_get_width (test), gdk_pixbuf_get_height (test));
+    return FALSE;
+  }
+
+  reference_luma = pixbuf_to_luma (reference);
+  test_luma = pixbuf_to_luma (test);
+
+  metrics->psnr = emerge_image_metrics_psnr (reference_luma, test_luma, (gsize) width * height);
+  metrics->ssim = emerge_image_metrics_ssim (reference_luma, test_luma, width, height);
+
+  return TRUE;
+}
+
+/**
+ * emerge_image_metrics_dhash_file:
+ * @path: an image file
+ * @hash: (out): return location for the hash
+ * @error: return location for an error
+ *
+ * Computes emerge_image_metrics_dhash() of the luma of @path. Safe to call
+ * from a worker thread.
+ *
+ * Returns: %TRUE on success
+ */
+gboolean
+emerge_image_metrics_dhash_file (const char  *path,
+                                 guint64     *hash,
+                                 GError     **error)
+{
+  g_autoptr(GdkPixbuf) pixbuf = NULL;
+  g_autofree float *luma = NULL;
+  int width, height;
+
+  g_return_val_if_fail (hash != NULL, FALSE);
+
+  pixbuf = gdk_pixbuf_new_from_file (path, error);
+  if (pixbuf == NULL)
+    return FALSE;
+
+  width = gdk_pixbuf_get_width (pixbuf);
+  height = gdk_pixbuf_get_height (pixbuf);
+
+  if (width < DHASH_COLUMNS || height < DHASH_ROWS) {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                 "%s is too small to hash (%dx%d)", path, width, height);
+    return FALSE;
+  }
+
+  luma = pixbuf_to_luma (pixbuf);
+  *hash = emerge_image_metrics_dhash (luma, width, height);
+
+  return TRUE;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Full-reference image similarity, used to compare generations from
+ * quantized models against an f16 baseline */
+typedef struct {
+  double psnr;    /* dB, G_MAXDOUBLE for identical images */
+  double ssim;    /* mean SSIM over 8x8 windows, 1.0 for identical images */
+} EmergeImageMetrics;
+
+double   emerge_image_metrics_psnr          (const float         *reference,
+                                             const float         *test,
+                                             gsize                n_pixels);
+double   emerge_image_metrics_ssim          (const float         *reference,
+                                             const float         *test,
+                                             int                  width,
+                                             int                  height);
+
+gboolean emerge_image_metrics_compare_files (const char          *reference_path,
+                                             const char          *test_path,
+                                             EmergeImageMetrics  *metrics,
+                                             GError             **error);
+
+/* 64-bit difference hash for spotting near-duplicates: images that look
+ * alike hash within a few bits of each other */
+guint64  emerge_image_metrics_dhash         (const float         *luma,
+                                             int                  width,
+                                             int                  height);
+gboolean emerge_image_metrics_dhash_file    (const char          *path,
+                                             guint64             *hash,
+                                             GError             **error);
+
+static inline guint
+emerge_image_metrics_hamming (guint64 a,
+                              guint64 b)
+{
+  return __builtin_popcountll (a ^ b);
+}
+
+G_END_DECLS
@@ -0,0 +1,493 @@
+#include "emerge-image-viewer.h"
+
+#include <math.h>
+
+#include "emerge-tile-pyramid.h"
+
+#define MAX_ZOOM        16.0
+#define SCROLL_ZOOM_STEP 1.1
+
+/* A zoomable, pannable view of an image too large to hand to GtkPicture
+ * whole. The image is split into a mip pyramid of tiles off the main
+ * thread; each frame only draws the tiles that are on screen, from the
+ * level closest to the zoom, so texture memory depends on the size of the
+ * view and not of the image. */
+struct _EmergeImageViewer
+{
+  GtkWidget          parent_instance;
+
+  EmergeTilePyramid *pyramid;
+  GCancellable      *cancellable;
+
+  /* Textures of the tiles drawn lately, by tile key */
+  GHashTable        *tiles;
+  guint64            frame;
+  guint              n_visible;
+
+  /* The image point at the centre of the view, in level 0 pixels, and
+   * screen pixels per image pixel */
+  double             center_x;
+  double             center_y;
+  double             scale;
+  gboolean           fit;
+
+  double             pointer_x;
+  double             pointer_y;
+  double             drag_center_x;
+  double             drag_center_y;
+  double             gesture_scale;
+};
+
+G_DEFINE_FINAL_TYPE (EmergeImageViewer, emerge_image_viewer, GTK_TYPE_WIDGET)
+
+typedef struct {
+  guint64     key;
+  GdkTexture *texture;
+  guint64     frame;
+} TileTexture;
+
+static void
+tile_texture_free (TileTexture *tile)
+{
+  g_object_unref (tile->texture);
+  g_free (tile);
+}
+
+static inline guint64
+tile_key (guint level,
+          int   column,
+          int   row)
+{
+  return (guint64) level << 48 | (guint64) row << 24 | (guint64) column;
+}
+
+static void
+image_size (EmergeImageViewer *self,
+            int               *width,
+            int               *height)
+{
+  emerge_tile_pyramid_get_size (self->pyramid, 0, width, height);
+}
+
+static double
+fit_scale (EmergeImageViewer *self)
+{
+  int width, height;
+  int view_width = gtk_widget_get_width (GTK_WIDGET (self));
+  int view_height = gtk_widget_get_height (GTK_WIDGET (self));
+
+  image_size (self, &width, &height);
+  if (view_width <= 0 || view_height <= 0)
+    return 1.0;
+
+  return MIN (1.0, MIN ((double) view_width / width, (double) view_height / height));
+}
+
+/* Keeps the zoom in range and the image from being panned out of view */
+static void
+clamp_view (EmergeImageViewer *self)
+{
+  int width, height;
+
+  image_size (self, &width, &height);
+
+  self->scale = CLAMP (self->scale, fit_scale (self) / 2, MAX_ZOOM);
+  self->center_x = CLAMP (self->center_x, 0, width);
+  self->center_y = CLAMP (self->center_y, 0, height);
+}
+
+/* Changes the zoom keeping the image point under (@x, @y) in place */
+static void
+zoom_at (EmergeImageViewer *self,
+         double             scale,
+         double             x,
+         double             y)
+{
+  double dx = x - gtk_widget_get_width (GTK_WIDGET (self)) / 2.0;
+  double dy = y - gtk_widget_get_height (GTK_WIDGET (self)) / 2.0;
+  double image_x = self->center_x + dx / self->scale;
+  double image_y = self->center_y + dy / self->scale;
+
+  self->fit = FALSE;
+  self->scale = scale;
+  clamp_view (self);
+  self->center_x = image_x - dx / self->scale;
+  self->center_y = image_y - dy / self->scale;
+  clamp_view (self);
+
+  gtk_widget_queue_draw (GTK_WIDGET (self));
+}
+
+static GdkTexture *
+get_tile_texture (EmergeImageViewer *self,
+                  guint              level,
+                  int                column,
+                  int                row)
+{
+  guint64 key = tile_key (level, column, row);
+  TileTexture *tile = g_hash_table_lookup (self->tiles, &key);
+
+  if (tile == NULL) {
+    GBytes *bytes;
+    int width, height;
+
+    /* No copy: the texture reads straight from the mapped pyramid */
+    bytes = emerge_tile_pyramid_get_tile (self->pyramid, level, column, row, &width, &height);
+
+    tile = g_new0 (TileTexture, 1);
+    tile->key = key;
+    tile->texture = gdk_memory_texture_new (width, height,
+                                            emerge_tile_pyramid_get_n_channels (self->pyramid) == 4
+                                            ? GDK_MEMORY_R8G8B8A8 : GDK_MEMORY_R8G8B8,
+                                            bytes,
+                                            (gsize) width * emerge_tile_pyramid_get_n_channels (self->pyramid));
+    g_hash_table_insert (self->tiles, &tile->key, tile);
+    g_bytes_unref (bytes);
+  }
+
+  tile->frame = self->frame;
+
+  return tile->texture;
+}
+
+/* Drops the textures of tiles that weren't drawn in the last frame, once
+ * there are more than a couple of screens' worth */
+static void
+trim_tiles (EmergeImageViewer *self)
+{
+  GHashTableIter iter;
+  TileTexture *tile;
+
+  if (g_hash_table_size (self->tiles) <= 2 * self->n_visible + 16)
+    return;
+
+  g_hash_table_iter_init (&iter, self->tiles);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &tile))
+    if (tile->frame != self->frame)
+      g_hash_table_iter_remove (&iter);
+}
+
+static void
+emerge_image_viewer_snapshot (GtkWidget   *widget,
+                              GtkSnapshot *snapshot)
+{
+  EmergeImageViewer *self = EMERGE_IMAGE_VIEWER (widget);
+  double view_width = gtk_widget_get_width (widget);
+  double view_height = gtk_widget_get_height (widget);
+  int n_columns, n_rows;
+  double factor, x0, y0, x1, y1;
+  GskScalingFilter filter;
+  guint level;
+
+  if (self->pyramid == NULL)
+    return;
+
+  if (self->fit) {
+    int width, height;
+
+    image_size (self, &width, &height);
+    self->scale = fit_scale (self);
+    self->center_x = width / 2.0;
+    self->center_y = height / 2.0;
+  }
+
+  /* The smallest level that is still at least as detailed as the screen */
+  level = (guint) CLAMP (floor (log2 (1.0 / self->scale)), 0,
+                         emerge_tile_pyramid_get_n_levels (self->pyramid) - 1);
+  factor = (double) (1 << level);
+  emerge_tile_pyramid_get_n_tiles (self->pyramid, level, &n_columns, &n_rows);
+
+  /* The visible part of the image, in pixels of the level */
+  x0 = (self->center_x - view_width / 2 / self->scale) / factor;
+  y0 = (self->center_y - view_height / 2 / self->scale) / factor;
+  x1 = (self->center_x + view_width / 2 / self->scale) / factor;
+  y1 = (self->center_y + view_height / 2 / self->scale) / factor;
+
+  /* Smooth until single pixels are big enough to be worth seeing */
+  filter = self->scale * factor < 2.0 ? GSK_SCALING_FILTER_LINEAR : GSK_SCALING_FILTER_NEAREST;
+
+  self->frame++;
+  self->n_visible = 0;
+
+  gtk_snapshot_push_clip (snapshot, &GRAPHENE_RECT_INIT (0, 0, view_width, view_height));
+
+  for (int row = MAX (0, (int) floor (y0 / EMERGE_TILE_SIZE));
+       row <= MIN (n_rows - 1, (int) floor (y1 / EMERGE_TILE_SIZE)); row++) {
+    for (int column = MAX (0, (int) floor (x0 / EMERGE_TILE_SIZE));
+         column <= MIN (n_columns - 1, (int) floor (x1 / EMERGE_TILE_SIZE)); column++) {
+      GdkTexture *texture = get_tile_texture (self, level, column, row);
+      double left, top, right, bottom;
+
+      /* Edges snapped to whole pixels and shared with the neighbours, so
+       * no seams show between tiles */
+      left = round ((column * EMERGE_TILE_SIZE * factor - self->center_x) * self->scale + view_width / 2);
+      top = round ((row * EMERGE_TILE_SIZE * factor - self->center_y) * self->scale + view_height / 2);
+      right = round (((column * EMERGE_TILE_SIZE + gdk_texture_get_width (texture)) * factor - self->center_x) * self->scale + view_width / 2);
+      bottom = round (((row * EMERGE_TILE_SIZE + gdk_texture_get_height (texture)) * factor - self->center_y) * self->scale + view_height / 2);
+
+      gtk_snapshot_append_scaled_texture (snapshot, texture, filter,
+                                          &GRAPHENE_RECT_INIT (left, top, right - left, bottom - top));
+      self->n_visible++;
+    }
+  }
+
+  gtk_snapshot_pop (snapshot);
+
+  trim_tiles (self);
+}
+
+static void
+scroll_cb (GtkEventControllerScroll *controller G_GNUC_UNUSED,
+           double                    dx G_GNUC_UNUSED,
+           double                    dy,
+           gpointer                  user_data)
+{
+  EmergeImageViewer *self = EMERGE_IMAGE_VIEWER (user_data);
+
+  if (self->pyramid == NULL)
+    return;
+
+  zoom_at (self, self->scale * pow (SCROLL_ZOOM_STEP, -dy), self->pointer_x, self->pointer_y);
+}
+
+static void
+motion_cb (GtkEventControllerMotion *controller G_GNUC_UNUSED,
+           double                    x,
+           double                    y,
+           gpointer                  user_data)
+{
+  EmergeImageViewer *self = EMERGE_IMAGE_VIEWER (user_data);
+
+  self->pointer_x = x;
+  self->pointer_y = y;
+}
+
+static void
+drag_begin_cb (GtkGestureDrag *gesture G_GNUC_UNUSED,
+               double          x G_GNUC_UNUSED,
+               double          y G_GNUC_UNUSED,
+               gpointer        user_data)
+{
+  EmergeImageViewer *self = EMERGE_IMAGE_VIEWER (user_data);
+
+  self->drag_center_x = self->center_x;
+  self->drag_center_y = self->center_y;
+}
+
+static void
+drag_update_cb (GtkGestureDrag *gesture G_GNUC_UNUSED,
+                double          offset_x,
+                double          offset_y,
+                gpointer        user_data)
+{
+  EmergeImageViewer *self = EMERGE_IMAGE_VIEWER (user_data);
+
+  if (self->pyramid == NULL || self->fit)
+    return;
+
+  self->center_x = self->drag_center_x - offset_x / self->scale;
+  self->center_y = self->drag_center_y - offset_y / self->scale;
+  clamp_view (self);
+  gtk_widget_queue_draw (GTK_WIDGET (self));
+}
+
+static void
+zoom_begin_cb (GtkGesture       *gesture G_GNUC_UNUSED,
+               GdkEventSequence *sequence G_GNUC_UNUSED,
+               gpointer          user_data)
+{
+  EmergeImageViewer *self = EMERGE_IMAGE_VIEWER (user_data);
+
+  self->gesture_scale = self->scale;
+}
+
+static void
+zoom_scale_changed_cb (GtkGestureZoom *gesture,
+                       double          scale,
+                       gpointer        user_data)
+{
+  EmergeImageViewer *self = EMERGE_IMAGE_VIEWER (user_data);
+  double x, y;
+
+  if (self->pyramid == NULL)
+    return;
+
+  gtk_gesture_get_bounding_box_center (GTK_GESTURE (gesture), &x, &y);
+  zoom_at (self, self->gesture_scale * scale, x, y);
+}
+
+/* Double click switches between the whole image and actual pixels */
+static void
+click_pressed_cb (GtkGestureClick *gesture G_GNUC_UNUSED,
+                  int              n_press,
+                  double           x,
+                  double           y,
+                  gpointer         user_data)
+{
+  EmergeImageViewer *self = EMERGE_IMAGE_VIEWER (user_data);
+
+  if (n_press != 2 || self->pyramid == NULL)
+    return;
+
+  if (self->fit)
+    zoom_at (self, 1.0, x, y);
+  else
+    emerge_image_viewer_zoom_to_fit (self);
+}
+
+static void
+emerge_image_viewer_dispose (GObject *object)
+{
+  EmergeImageViewer *self = EMERGE_IMAGE_VIEWER (object);
+
+  emerge_image_viewer_clear (self);
+
+  G_OBJECT_CLASS (emerge_image_viewer_parent_class)->dispose (object);
+}
+
+static void
+emerge_image_viewer_finalize (GObject *object)
+{
+  EmergeImageViewer *self = EMERGE_IMAGE_VIEWER (object);
+
+  g_hash_table_unref (self->tiles);
+
+  G_OBJECT_CLASS (emerge_image_viewer_parent_class)->finalize (object);
+}
+
+static void
+emerge_image_viewer_class_init (EmergeImageViewerClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+  GtkWidgetClass *widget_class = GTK_WIDGET_CLASS (klass);
+
+  object_class->dispose = emerge_image_viewer_dispose;
+  object_class->finalize = emerge_image_viewer_finalize;
+  widget_class->snapshot = emerge_image_viewer_snapshot;
+}
+
+static void
+emerge_image_viewer_init (EmergeImageViewer *self)
+{
+  GtkEventController *controller;
+  GtkGesture *gesture;
+
+  self->tiles = g_hash_table_new_full (g_int64_hash, g_int64_equal,
+                                       NULL, (GDestroyNotify) tile_texture_free);
+  self->scale = 1.0;
+  self->fit = TRUE;
+
+  gtk_widget_set_hexpand (GTK_WIDGET (self), TRUE);
+  gtk_widget_set_vexpand (GTK_WIDGET (self), TRUE);
+
+  controller = gtk_event_controller_scroll_new (GTK_EVENT_CONTROLLER_SCROLL_VERTICAL);
+  g_signal_connect (controller, "scroll", G_CALLBACK (scroll_cb), self);
+  gtk_widget_add_controller (GTK_WIDGET (self), controller);
+
+  controller = gtk_event_controller_motion_new ();
+  g_signal_connect (controller, "motion", G_CALLBACK (motion_cb), self);
+  gtk_widget_add_controller (GTK_WIDGET (self), controller);
+
+  gesture = gtk_gesture_drag_new ();
+  g_signal_connect (gesture, "drag-begin", G_CALLBACK (drag_begin_cb), self);
+  g_signal_connect (gesture, "drag-update", G_CALLBACK (drag_update_cb), self);
+  gtk_widget_add_controller (GTK_WIDGET (self), GTK_EVENT_CONTROLLER (gesture));
+
+  gesture = gtk_gesture_zoom_new ();
+  g_signal_connect (gesture, "begin", G_CALLBACK (zoom_begin_cb), self);
+  g_signal_connect (gesture, "scale-changed", G_CALLBACK (zoom_scale_changed_cb), self);
+  gtk_widget_add_controller (GTK_WIDGET (self), GTK_EVENT_CONTROLLER (gesture));
+
+  gesture = gtk_gesture_click_new ();
+  g_signal_connect (gesture, "pressed", G_CALLBACK (click_pressed_cb), self);
+  gtk_widget_add_controller (GTK_WIDGET (self), GTK_EVENT_CONTROLLER (gesture));
+}
+
+GtkWidget *
+emerge_image_viewer_new (void)
+{
+  return g_object_new (EMERGE_TYPE_IMAGE_VIEWER, NULL);
+}
+
+static void
+build_pyramid_thread (GTask        *task,
+                      gpointer      source_object G_GNUC_UNUSED,
+                      gpointer      task_data,
+                      GCancellable *cancellable)
+{
+  GError *error = NULL;
+  EmergeTilePyramid *pyramid;
+
+  pyramid = emerge_tile_pyramid_new_for_file (task_data, cancellable, &error);
+  if (pyramid == NULL)
+    g_task_return_error (task, error);
+  else
+    g_task_return_pointer (task, pyramid, (GDestroyNotify) emerge_tile_pyramid_unref);
+}
+
+static void
+pyramid_built_cb (GObject      *source_object,
+                  GAsyncResult *result,
+                  gpointer      user_data G_GNUC_UNUSED)
+{
+  EmergeImageViewer *self = EMERGE_IMAGE_VIEWER (source_object);
+  GError *error = NULL;
+  EmergeTilePyramid *pyramid;
+
+  pyramid = g_task_propagate_pointer (G_TASK (result), &error);
+  if (pyramid == NULL) {
+    /* Cancelled when another image was loaded */
+    if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+      g_warning ("Failed to tile %s: %s", (const char *) g_task_get_task_data (G_TASK (result)),
+                 error->message);
+    g_error_free (error);
+    return;
+  }
+
+  g_clear_object (&self->cancellable);
+  self->pyramid = pyramid;
+  self->fit = TRUE;
+  gtk_widget_queue_draw (GTK_WIDGET (self));
+}
+
+/* Shows @path once it has been tiled; until then the view is empty */
+void
+emerge_image_viewer_load (EmergeImageViewer *self,
+                          const char        *path)
+{
+  GTask *task;
+
+  g_return_if_fail (EMERGE_IS_IMAGE_VIEWER (self));
+  g_return_if_fail (path != NULL);
+
+  emerge_image_viewer_clear (self);
+
+  self->cancellable = g_cancellable_new ();
+  task = g_task_new (self, self->cancellable, pyramid_built_cb, NULL);
+  g_task_set_source_tag (task, emerge_image_viewer_load);
+  g_task_set_task_data (task, g_strdup (path), g_free);
+  g_task_run_in_thread (task, build_pyramid_thread);
+  g_object_unref (task);
+}
+
+/* Stops any tiling in progress and releases the image */
+void
+emerge_image_viewer_clear (EmergeImageViewer *self)
+{
+  g_return_if_fail (EMERGE_IS_IMAGE_VIEWER (self));
+
+  g_cancellable_cancel (self->cancellable);
+  g_clear_object (&self->cancellable);
+  g_hash_table_remove_all (self->tiles);
+  g_clear_pointer (&self->pyramid, emerge_tile_pyramid_unref);
+  gtk_widget_queue_draw (GTK_WIDGET (self));
+}
+
+void
+emerge_image_viewer_zoom_to_fit (EmergeImageViewer *self)
+{
+  g_return_if_fail (EMERGE_IS_IMAGE_VIEWER (self));
+
+  self->fit = TRUE;
+  gtk_widget_queue_draw (GTK_WIDGET (self));
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <gtk/gtk.h>
+
+G_BEGIN_DECLS
+
+/* Images at least this large in either dimension are worth tiling */
+#define EMERGE_IMAGE_VIEWER_MIN_SIZE 2048
+
+#define EMERGE_TYPE_IMAGE_VIEWER (emerge_image_viewer_get_type())
+
+G_DECLARE_FINAL_TYPE (EmergeImageViewer, emerge_image_viewer, EMERGE, IMAGE_VIEWER, GtkWidget)
+
+GtkWidget *emerge_image_viewer_new         (void);
+void       emerge_image_viewer_load        (EmergeImageViewer *self,
+                                            const char        *path);
+void       emerge_image_viewer_clear       (EmergeImageViewer *self);
+void       emerge_image_viewer_zoom_to_fit (EmergeImageViewer *self);
+
+G_END_DECLS
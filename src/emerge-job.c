@@ -0,0 +1,971 @@
+#define _GNU_SOURCE
+
+#include "emerge-job.h"
+#include "emerge-upscale.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+static const char * const job_state_names[] = {
+  "pending", "running", "succeeded", "failed", "cancelled",
+};
+
+G_DEFINE_BOXED_TYPE (EmergeJob, emerge_job, emerge_job_ref, emerge_job_unref)
+
+EmergeJob *
+emerge_job_new (void)
+{
+  EmergeJob *job = g_new0 (EmergeJob, 1);
+
+  job->ref_count = 1;
+  job->width = 512;
+  job->height = 512;
+  job->steps = 20;
+  job->seed = -1;
+  job->cfg_scale = 7.0;
+  job->sampling_method = g_strdup ("euler_a");
+  job->strength = 0.75;
+  job->vae_tiling = TRUE;
+  job->upscale_tile_size = EMERGE_UPSCALE_DEFAULT_TILE_SIZE;
+  job->output_fd = -1;
+
+  return job;
+}
+
+/* Copies the parameters only; the copy starts out pending, and writes to
+ * output_path even if @job writes to memory */
+EmergeJob *
+emerge_job_copy (const EmergeJob *job)
+{
+  EmergeJob *copy;
+
+  g_return_val_if_fail (job != NULL, NULL);
+
+  copy = emerge_job_new ();
+  g_free (copy->sampling_method);
+
+  copy->model_path = g_strdup (job->model_path);
+  copy->prompt = g_strdup (job->prompt);
+  copy->negative_prompt = g_strdup (job->negative_prompt);
+  copy->width = job->width;
+  copy->height = job->height;
+  copy->steps = job->steps;
+  copy->requested_steps = job->requested_steps;
+  copy->seed = job->seed;
+  copy->cfg_scale = job->cfg_scale;
+  copy->sampling_method = g_strdup (job->sampling_method);
+  copy->threads = job->threads;
+  copy->img2img = job->img2img;
+  copy->init_image_path = g_strdup (job->init_image_path);
+  copy->strength = job->strength;
+  copy->vae_tiling = job->vae_tiling;
+  copy->output_path = g_strdup (job->output_path);
+  copy->export_path = g_strdup (job->export_path);
+  copy->upscale_model_path = g_strdup (job->upscale_model_path);
+  copy->upscale_tile_size = job->upscale_tile_size;
+  copy->draft = job->draft;
+  copy->hires_width = job->hires_width;
+  copy->hires_height = job->hires_height;
+  copy->hires_steps = job->hires_steps;
+  copy->preview_interval = job->preview_interval;
+  copy->preview_path = g_strdup (job->preview_path);
+
+  return copy;
+}
+
+EmergeJob *
+emerge_job_ref (EmergeJob *job)
+{
+  g_return_val_if_fail (job != NULL, NULL);
+
+  g_atomic_int_inc (&job->ref_count);
+
+  return job;
+}
+
+void
+emerge_job_unref (EmergeJob *job)
+{
+  g_return_if_fail (job != NULL);
+
+  if (!g_atomic_int_dec_and_test (&job->ref_count))
+    return;
+
+  g_free (job->model_path);
+  g_free (job->prompt);
+  g_free (job->negative_prompt);
+  g_free (job->sampling_method);
+  g_free (job->init_image_path);
+  g_free (job->output_path);
+  if (job->output_fd >= 0)
+    close (job->output_fd);
+  g_free (job->export_path);
+  g_free (job->upscale_model_path);
+  g_free (job->preview_path);
+  g_free (job->error_message);
+  emerge_sd_stats_free (job->stats);
+  g_free (job);
+}
+
+const char *
+emerge_job_state_to_string (EmergeJobState state)
+{
+  g_return_val_if_fail (state <= EMERGE_JOB_CANCELLED, NULL);
+
+  return job_state_names[state];
+}
+
+/* The nearest size sd accepts, which is a multiple of 64 */
+gint
+emerge_job_round_size (double size)
+{
+  return MAX ((gint) (size / 64.0 + 0.5) * 64, 64);
+}
+
+/**
+ * emerge_job_new_draft:
+ * @job: the parameters wanted in the end
+ * @max_size: the longest side a draft may have
+ * @max_steps: the most steps a draft may take
+ *
+ * Makes a cheap stand-in for @job: the same prompt and seed at a smaller
+ * size with fewer steps, to be refined with emerge_job_new_refine() if it
+ * turns out to be worth it. A random seed is picked here so the refine
+ * can reuse it. Drafts are never upscaled.
+ *
+ * Returns: (transfer full): the draft job
+ */
+EmergeJob *
+emerge_job_new_draft (const EmergeJob *job,
+                      gint             max_size,
+                      gint             max_steps)
+{
+  EmergeJob *draft;
+  double scale;
+
+  g_return_val_if_fail (job != NULL, NULL);
+
+  draft = emerge_job_copy (job);
+  draft->draft = TRUE;
+  draft->hires_width = job->width;
+  draft->hires_height = job->height;
+  draft->hires_steps = job->steps;
+
+  scale = MIN (1.0, (double) max_size / MAX (job->width, job->height));
+  draft->width = MIN (emerge_job_round_size (job->width * scale), job->width);
+  draft->height = MIN (emerge_job_round_size (job->height * scale), job->height);
+  draft->steps = MIN (job->steps, max_steps);
+
+  if (draft->seed < 0)
+    draft->seed = g_random_int_range (0, G_MAXINT32);
+
+  g_clear_pointer (&draft->upscale_model_path, g_free);
+  draft->preview_interval = 0;
+
+  return draft;
+}
+
+/**
+ * emerge_job_new_refine:
+ * @draft: a draft made by emerge_job_new_draft()
+ * @init_image_path: the draft's image, at the refined size
+ * @strength: how much of the draft to repaint
+ *
+ * Makes the second pass for @draft: img2img from the draft at the full
+ * size and step count, with the same prompt and seed, so the composition
+ * picked from the drafts survives and only the detail is redone.
+ *
+ * Returns: (transfer full): the refine job
+ */
+EmergeJob *
+emerge_job_new_refine (const EmergeJob *draft,
+                       const char      *init_image_path,
+                       double           strength)
+{
+  EmergeJob *refine;
+
+  g_return_val_if_fail (draft != NULL && draft->draft, NULL);
+  g_return_val_if_fail (init_image_path != NULL, NULL);
+
+  refine = emerge_job_copy (draft);
+  refine->draft = FALSE;
+  refine->width = draft->hires_width;
+  refine->height = draft->hires_height;
+  refine->steps = draft->hires_steps;
+  refine->hires_width = 0;
+  refine->hires_height = 0;
+  refine->hires_steps = 0;
+
+  refine->img2img = TRUE;
+  g_free (refine->init_image_path);
+  refine->init_image_path = g_strdup (init_image_path);
+  refine->strength = strength;
+
+  return refine;
+}
+
+/* Scales the draft's image up to the size it is refined at, so sd starts
+ * from a smooth enlargement instead of resizing it itself */
+gboolean
+emerge_job_prepare_refine_input (const EmergeJob  *draft,
+                                 const char       *draft_image_path,
+                                 const char       *output_path,
+                                 GError          **error)
+{
+  GdkPixbuf *image, *scaled;
+  gboolean ret;
+
+  g_return_val_if_fail (draft != NULL && draft->draft, FALSE);
+
+  image = gdk_pixbuf_new_from_file (draft_image_path, error);
+  if (image == NULL)
+    return FALSE;
+
+  scaled = gdk_pixbuf_scale_simple (image, draft->hires_width, draft->hires_height,
+                                    GDK_INTERP_BILINEAR);
+  g_object_unref (image);
+  if (scaled == NULL) {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                 "Not enough memory to scale %s", draft_image_path);
+    return FALSE;
+  }
+
+  ret = gdk_pixbuf_save (scaled, output_path, "png", error, NULL);
+  g_object_unref (scaled);
+
+  return ret;
+}
+
+/**
+ * emerge_job_set_output_memory:
+ * @job: a pending job
+ * @error: return location for an error
+ *
+ * Has sd write @job's image into an anonymous in-memory file handed to it,
+ * rather than to output_path, so no temporary file is involved and nothing
+ * is shared with other instances. Read it back with
+ * emerge_job_read_output_async() once sd has exited.
+ *
+ * Returns: %TRUE on success
+ */
+gboolean
+emerge_job_set_output_memory (EmergeJob  *job,
+                              GError    **error)
+{
+  int fd;
+
+  g_return_val_if_fail (job != NULL, FALSE);
+
+  fd = memfd_create ("emerge-output", MFD_CLOEXEC);
+  if (fd < 0) {
+    int saved_errno = errno;
+
+    g_set_error (error, G_IO_ERROR, g_io_error_from_errno (saved_errno),
+                 "Failed to create an in-memory file: %s", g_strerror (saved_errno));
+    return FALSE;
+  }
+
+  if (job->output_fd >= 0)
+    close (job->output_fd);
+  job->output_fd = fd;
+
+  return TRUE;
+}
+
+static void
+job_read_output_thread (GTask        *task,
+                        gpointer      source_object G_GNUC_UNUSED,
+                        gpointer      task_data,
+                        GCancellable *cancellable G_GNUC_UNUSED)
+{
+  EmergeJob *job = task_data;
+  struct stat st;
+  guint8 *data;
+  gsize offset = 0;
+
+  if (fstat (job->output_fd, &st) != 0) {
+    int saved_errno = errno;
+
+    g_task_return_new_error (task, G_IO_ERROR, g_io_error_from_errno (saved_errno),
+                             "Failed to read the generated image: %s", g_strerror (saved_errno));
+    return;
+  }
+
+  if (st.st_size == 0) {
+    g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                             "sd didn't write an image");
+    return;
+  }
+
+  data = g_malloc (st.st_size);
+  while (offset < (gsize) st.st_size) {
+    gssize n = pread (job->output_fd, data + offset, st.st_size - offset, offset);
+
+    if (n < 0 && errno == EINTR)
+      continue;
+
+    if (n <= 0) {
+      int saved_errno = n < 0 ? errno : EIO;
+
+      g_free (data);
+      g_task_return_new_error (task, G_IO_ERROR, g_io_error_from_errno (saved_errno),
+                               "Failed to read the generated image: %s", g_strerror (saved_errno));
+      return;
+    }
+
+    offset += n;
+  }
+
+  g_task_return_pointer (task, g_bytes_new_take (data, offset), (GDestroyNotify) g_bytes_unref);
+}
+
+/* Reads back the image sd wrote to memory, off the main thread */
+void
+emerge_job_read_output_async (EmergeJob           *job,
+                              GCancellable        *cancellable,
+                              GAsyncReadyCallback  callback,
+                              gpointer             user_data)
+{
+  GTask *task;
+
+  g_return_if_fail (job != NULL);
+  g_return_if_fail (job->output_fd >= 0);
+
+  task = g_task_new (NULL, cancellable, callback, user_data);
+  g_task_set_source_tag (task, emerge_job_read_output_async);
+  g_task_set_task_data (task, emerge_job_ref (job), (GDestroyNotify) emerge_job_unref);
+  g_task_run_in_thread (task, job_read_output_thread);
+  g_object_unref (task);
+}
+
+/* Returns: (transfer full): the PNG sd wrote, or %NULL on error */
+GBytes *
+emerge_job_read_output_finish (EmergeJob     *job G_GNUC_UNUSED,
+                               GAsyncResult  *result,
+                               GError       **error)
+{
+  g_return_val_if_fail (g_task_is_valid (result, NULL), NULL);
+
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+/**
+ * emerge_job_build_argv:
+ * @job: a job
+ * @sd_path: the sd executable
+ *
+ * Builds the sd command line for @job. Every value is its own argument, so
+ * prompts containing quotes need no escaping, and numbers are formatted
+ * independently of the locale.
+ *
+ * Returns: (transfer full): a %NULL terminated argument vector
+ */
+gchar **
+emerge_job_build_argv (const EmergeJob *job,
+                       const char      *sd_path)
+{
+  GStrvBuilder *builder;
+  gchar **argv;
+  gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
+
+  g_return_val_if_fail (job != NULL, NULL);
+  g_return_val_if_fail (sd_path != NULL, NULL);
+
+  builder = g_strv_builder_new ();
+  g_strv_builder_add (builder, sd_path);
+
+  if (job->img2img)
+    g_strv_builder_add_many (builder, "--mode", "img2img", NULL);
+
+  g_strv_builder_add_many (builder,
+                           "--model", job->model_path,
+                           "--prompt", job->prompt ? job->prompt : "",
+                           "--negative-prompt", job->negative_prompt ? job->negative_prompt : "",
+                           NULL);
+
+  g_strv_builder_take (builder, g_strdup ("--width"));
+  g_strv_builder_take (builder, g_strdup_printf ("%d", job->width));
+  g_strv_builder_take (builder, g_strdup ("--height"));
+  g_strv_builder_take (builder, g_strdup_printf ("%d", job->height));
+  g_strv_builder_take (builder, g_strdup ("--steps"));
+  g_strv_builder_take (builder, g_strdup_printf ("%d", job->steps));
+  g_strv_builder_take (builder, g_strdup ("--seed"));
+  g_strv_builder_take (builder, g_strdup_printf ("%" G_GINT64_FORMAT, job->seed));
+
+  g_strv_builder_add (builder, "--cfg-scale");
+  g_strv_builder_add (builder, g_ascii_formatd (buf, sizeof buf, "%g", job->cfg_scale));
+  g_strv_builder_add_many (builder,
+                           "--sampling-method", job->sampling_method,
+                           NULL);
+
+  /* sd opens whatever path it is given, and /dev/fd/N reopens the memfd */
+  g_strv_builder_add (builder, "--output");
+  if (job->output_fd >= 0)
+    g_strv_builder_take (builder, g_strdup_printf ("/dev/fd/%d", EMERGE_PROCESS_PASSED_FD));
+  else
+    g_strv_builder_add (builder, job->output_path);
+
+  if (job->threads > 0) {
+    g_strv_builder_add (builder, "--threads");
+    g_strv_builder_take (builder, g_strdup_printf ("%d", job->threads));
+  }
+
+  if (job->img2img) {
+    g_strv_builder_add_many (builder, "--input", job->init_image_path, NULL);
+    g_strv_builder_add (builder, "--strength");
+    g_strv_builder_add (builder, g_ascii_formatd (buf, sizeof buf, "%g", job->strength));
+  }
+
+  if (job->vae_tiling)
+    g_strv_builder_add (builder, "--vae-tiling");
+
+  /* The projection straight from latent to RGB costs next to nothing,
+   * unlike running the VAE or TAESD for every preview */
+  if (job->preview_interval > 0 && job->preview_path != NULL) {
+    g_strv_builder_add_many (builder,
+                             "--preview", "proj",
+                             "--preview-path", job->preview_path,
+                             "--preview-interval", NULL);
+    g_strv_builder_take (builder, g_strdup_printf ("%d", job->preview_interval));
+  }
+
+  argv = g_strv_builder_end (builder);
+  g_strv_builder_unref (builder);
+
+  return argv;
+}
+
+/**
+ * emerge_job_get_preview_overhead:
+ * @job: a job that has run with previews
+ *
+ * Estimates how much longer sampling took because of the previews, from
+ * how much slower the steps that wrote one were than those that didn't.
+ *
+ * Returns: the extra time as a fraction of the time without previews, or
+ *   a negative value if there isn't enough to go on
+ */
+double
+emerge_job_get_preview_overhead (const EmergeJob *job)
+{
+  GArray *steps;
+  double preview_sum = 0.0, plain_sum = 0.0;
+  guint n_preview = 0, n_plain = 0;
+  double plain_mean;
+
+  g_return_val_if_fail (job != NULL, -1.0);
+
+  if (job->preview_interval <= 0 || job->stats == NULL)
+    return -1.0;
+
+  steps = job->stats->step_seconds;
+  for (guint i = 0; i < steps->len; i++) {
+    double seconds = g_array_index (steps, double, i);
+
+    if ((i + 1) % job->preview_interval == 0) {
+      preview_sum += seconds;
+      n_preview++;
+    } else {
+      plain_sum += seconds;
+      n_plain++;
+    }
+  }
+
+  if (n_preview == 0 || n_plain == 0)
+    return -1.0;
+
+  plain_mean = plain_sum / n_plain;
+  if (plain_mean <= 0.0)
+    return -1.0;
+
+  return MAX (preview_sum - n_preview * plain_mean, 0.0) / (plain_mean * steps->len);
+}
+
+/**
+ * emerge_job_hash:
+ * @job: a job
+ *
+ * Identifies the image @job produces: two jobs with the same hash make
+ * the same picture. A random seed makes every run different, so such
+ * jobs have none.
+ *
+ * Returns: (transfer full) (nullable): a SHA-256 hex digest, or %NULL
+ */
+gchar *
+emerge_job_hash (const EmergeJob *job)
+{
+  char cfg[G_ASCII_DTOSTR_BUF_SIZE], strength[G_ASCII_DTOSTR_BUF_SIZE];
+  GChecksum *checksum;
+  gchar *numbers, *hash;
+  const char *values[7];
+
+  g_return_val_if_fail (job != NULL, NULL);
+
+  if (job->seed < 0)
+    return NULL;
+
+  numbers = g_strdup_printf ("%d %d %d %" G_GINT64_FORMAT " %s %d %s %d %d",
+                             job->width, job->height, job->steps, job->seed,
+                             g_ascii_dtostr (cfg, sizeof cfg, job->cfg_scale),
+                             job->img2img,
+                             g_ascii_dtostr (strength, sizeof strength,
+                                             job->img2img ? job->strength : 0.0),
+                             job->upscale_model_path ? job->upscale_tile_size : 0,
+                             job->draft);
+  values[0] = job->model_path;
+  values[1] = job->prompt;
+  values[2] = job->negative_prompt;
+  values[3] = job->sampling_method;
+  values[4] = job->img2img ? job->init_image_path : NULL;
+  values[5] = job->upscale_model_path;
+  values[6] = numbers;
+
+  /* Each value is hashed with its terminating NUL, so no two sets of
+   * values run together into the same input */
+  checksum = g_checksum_new (G_CHECKSUM_SHA256);
+  for (guint i = 0; i < G_N_ELEMENTS (values); i++) {
+    const char *value = values[i] ? values[i] : "";
+
+    g_checksum_update (checksum, (const guchar *) value, strlen (value) + 1);
+  }
+  hash = g_strdup (g_checksum_get_string (checksum));
+  g_checksum_free (checksum);
+  g_free (numbers);
+
+  return hash;
+}
+
+static void
+job_process_output_cb (EmergeProcess *process G_GNUC_UNUSED,
+                       const char    *line,
+                       EmergeJob     *job)
+{
+  if (emerge_sd_stats_parse_line (job->stats, line))
+    return;
+
+  /* Keep the last error sd logged, it explains a failure better than the
+   * exit status does */
+  if (g_str_has_prefix (line, "[ERROR]")) {
+    g_free (job->error_message);
+    job->error_message = g_strstrip (g_strdup (line + strlen ("[ERROR]")));
+  }
+}
+
+static void
+job_process_progress_cb (EmergeProcess *process G_GNUC_UNUSED,
+                         gint           step G_GNUC_UNUSED,
+                         gint           total_steps G_GNUC_UNUSED,
+                         gdouble        seconds_per_step,
+                         EmergeJob     *job)
+{
+  emerge_sd_stats_add_step (job->stats, seconds_per_step);
+}
+
+static void
+job_process_exited_cb (EmergeProcess *process,
+                       gint           wait_status,
+                       EmergeJob     *job)
+{
+  job->wait_status = wait_status;
+  job->wall_seconds = emerge_process_get_elapsed (process);
+  job->peak_rss = emerge_process_get_peak_rss (process);
+  job->was_paused = emerge_process_was_paused (process);
+
+  if (emerge_process_was_cancelled (process)) {
+    job->state = EMERGE_JOB_CANCELLED;
+  } else if (WIFEXITED (wait_status) && WEXITSTATUS (wait_status) == 0) {
+    job->state = EMERGE_JOB_SUCCEEDED;
+  } else {
+    job->state = EMERGE_JOB_FAILED;
+    if (job->error_message == NULL)
+      job->error_message = g_strdup_printf ("sd exited with status %d", wait_status);
+  }
+}
+
+/**
+ * emerge_job_spawn:
+ * @job: a pending job
+ * @manager: the process manager to run sd under
+ * @sd_path: the sd executable
+ * @limits: (nullable): resource limits for the child
+ * @error: return location for an error
+ *
+ * Starts sd for @job. The job's timings, peak RSS and final state are
+ * filled in from the process as it runs; they are complete by the time
+ * handlers connected to "exited" after this call run.
+ *
+ * Returns: (transfer full) (nullable): the sd process, or %NULL on error
+ */
+EmergeProcess *
+emerge_job_spawn (EmergeJob                  *job,
+                  EmergeProcessManager       *manager,
+                  const char                 *sd_path,
+                  const EmergeProcessLimits  *limits,
+                  GError                    **error)
+{
+  EmergeProcess *process;
+  GError *local_error = NULL;
+  gchar **argv;
+
+  g_return_val_if_fail (job != NULL, NULL);
+  g_return_val_if_fail (job->model_path != NULL, NULL);
+  g_return_val_if_fail (job->output_path != NULL || job->output_fd >= 0, NULL);
+
+  g_clear_pointer (&job->stats, emerge_sd_stats_free);
+  g_clear_pointer (&job->error_message, g_free);
+  job->stats = emerge_sd_stats_new ();
+
+  argv = emerge_job_build_argv (job, sd_path);
+  process = emerge_process_manager_spawn_with_fd (manager, "generate",
+                                                  (const char * const *) argv,
+                                                  limits, job->output_fd, &local_error);
+  g_strfreev (argv);
+
+  if (process == NULL) {
+    job->state = EMERGE_JOB_FAILED;
+    job->error_message = g_strdup (local_error->message);
+    g_propagate_error (error, local_error);
+    return NULL;
+  }
+
+  job->state = EMERGE_JOB_RUNNING;
+
+  g_signal_connect_data (process, "output", G_CALLBACK (job_process_output_cb),
+                         emerge_job_ref (job), (GClosureNotify) emerge_job_unref, 0);
+  g_signal_connect_data (process, "progress", G_CALLBACK (job_process_progress_cb),
+                         emerge_job_ref (job), (GClosureNotify) emerge_job_unref, 0);
+  g_signal_connect_data (process, "exited", G_CALLBACK (job_process_exited_cb),
+                         emerge_job_ref (job), (GClosureNotify) emerge_job_unref, 0);
+
+  return process;
+}
+
+static const char *
+json_get_string (JsonObject *object,
+                 const char *member)
+{
+  JsonNode *node = json_object_get_member (object, member);
+
+  if (node == NULL || !JSON_NODE_HOLDS_VALUE (node))
+    return NULL;
+
+  return json_node_get_string (node);
+}
+
+typedef enum {
+  MEMBER_STRING,
+  MEMBER_NULLABLE_STRING,
+  MEMBER_INT,
+  MEMBER_POSITIVE_INT,
+  MEMBER_NON_NEGATIVE_INT,
+  MEMBER_NUMBER,
+  MEMBER_FRACTION,
+  MEMBER_BOOLEAN,
+  MEMBER_SAMPLER,
+} MemberKind;
+
+/* The members emerge_job_apply_json() reads, and what they must hold */
+static const struct {
+  const char *name;
+  MemberKind  kind;
+} job_members[] = {
+  { "model_path", MEMBER_STRING },
+  { "positive_prompt", MEMBER_STRING },
+  { "negative_prompt", MEMBER_STRING },
+  { "sampling_method", MEMBER_SAMPLER },
+  { "init_image", MEMBER_STRING },
+  { "output_path", MEMBER_STRING },
+  { "export_path", MEMBER_STRING },
+  { "upscale_model", MEMBER_NULLABLE_STRING },
+  { "width", MEMBER_POSITIVE_INT },
+  { "height", MEMBER_POSITIVE_INT },
+  { "steps", MEMBER_POSITIVE_INT },
+  { "requested_steps", MEMBER_NON_NEGATIVE_INT },
+  { "seed", MEMBER_INT },
+  { "cfg_scale", MEMBER_NUMBER },
+  { "threads", MEMBER_NON_NEGATIVE_INT },
+  { "img2img_enabled", MEMBER_BOOLEAN },
+  { "strength", MEMBER_FRACTION },
+  { "vae_tiling", MEMBER_BOOLEAN },
+  { "upscale_tile_size", MEMBER_POSITIVE_INT },
+  { "draft", MEMBER_BOOLEAN },
+  { "hires_width", MEMBER_NON_NEGATIVE_INT },
+  { "hires_height", MEMBER_NON_NEGATIVE_INT },
+  { "hires_steps", MEMBER_NON_NEGATIVE_INT },
+};
+
+static gboolean
+json_value_is (JsonNode *node,
+               GType     type)
+{
+  return JSON_NODE_HOLDS_VALUE (node) && json_node_get_value_type (node) == type;
+}
+
+/**
+ * emerge_job_validate_json:
+ * @object: parameters, as for emerge_job_apply_json()
+ * @error: return location for an error
+ *
+ * Checks that every member of @object that emerge_job_apply_json() reads
+ * has the right type and a usable value: sizes and steps above zero, a
+ * strength between 0 and 1, a sampler sd has. Other members are ignored.
+ *
+ * Returns: %TRUE if @object can be applied to a job
+ */
+gboolean
+emerge_job_validate_json (JsonObject  *object,
+                          GError     **error)
+{
+  g_return_val_if_fail (object != NULL, FALSE);
+
+  for (guint i = 0; i < G_N_ELEMENTS (job_members); i++) {
+    const char *name = job_members[i].name;
+    JsonNode *node = json_object_get_member (object, name);
+    const char *expected = NULL;
+
+    if (node == NULL)
+      continue;
+
+    switch (job_members[i].kind) {
+    case MEMBER_NULLABLE_STRING:
+      if (JSON_NODE_HOLDS_NULL (node))
+        break;
+      G_GNUC_FALLTHROUGH;
+    case MEMBER_STRING:
+      if (!json_value_is (node, G_TYPE_STRING))
+        expected = "a string";
+      break;
+    case MEMBER_INT:
+      if (!json_value_is (node, G_TYPE_INT64))
+        expected = "an integer";
+      break;
+    case MEMBER_POSITIVE_INT:
+      if (!json_value_is (node, G_TYPE_INT64) || json_node_get_int (node) <= 0 ||
+          json_node_get_int (node) > G_MAXINT)
+        expected = "a positive integer";
+      break;
+    case MEMBER_NON_NEGATIVE_INT:
+      if (!json_value_is (node, G_TYPE_INT64) || json_node_get_int (node) < 0 ||
+          json_node_get_int (node) > G_MAXINT)
+        expected = "an integer no less than 0";
+      break;
+    case MEMBER_NUMBER:
+      if (!json_value_is (node, G_TYPE_INT64) && !json_value_is (node, G_TYPE_DOUBLE))
+        expected = "a number";
+      break;
+    case MEMBER_FRACTION:
+      if ((!json_value_is (node, G_TYPE_INT64) && !json_value_is (node, G_TYPE_DOUBLE)) ||
+          !(json_node_get_double (node) >= 0.0 && json_node_get_double (node) <= 1.0))
+        expected = "a number from 0 to 1";
+      break;
+    case MEMBER_BOOLEAN:
+      if (!json_value_is (node, G_TYPE_BOOLEAN))
+        expected = "true or false";
+      break;
+    case MEMBER_SAMPLER:
+      if (!json_value_is (node, G_TYPE_STRING) ||
+          !g_strv_contains (emerge_sd_sampling_methods, json_node_get_string (node)))
+        expected = "a sampling method sd knows";
+      break;
+    }
+
+    if (expected != NULL) {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                   "\"%s\" should be %s", name, expected);
+      return FALSE;
+    }
+  }
+
+  return TRUE;
+}
+
+/**
+ * emerge_job_apply_json:
+ * @job: a job
+ * @object: parameters, using the same member names as saved templates
+ *
+ * Overrides the parameters of @job with those present in @object. Members
+ * that are missing leave the current value alone; a null "upscale_model"
+ * turns upscaling off.
+ */
+void
+emerge_job_apply_json (EmergeJob  *job,
+                       JsonObject *object)
+{
+  const char *str;
+
+  g_return_if_fail (job != NULL);
+  g_return_if_fail (object != NULL);
+
+  if ((str = json_get_string (object, "model_path")) != NULL) {
+    g_free (job->model_path);
+    job->model_path = g_strdup (str);
+  }
+  if ((str = json_get_string (object, "positive_prompt")) != NULL) {
+    g_free (job->prompt);
+    job->prompt = g_strdup (str);
+  }
+  if ((str = json_get_string (object, "negative_prompt")) != NULL) {
+    g_free (job->negative_prompt);
+    job->negative_prompt = g_strdup (str);
+  }
+  if ((str = json_get_string (object, "sampling_method")) != NULL) {
+    g_free (job->sampling_method);
+    job->sampling_method = g_strdup (str);
+  }
+  if ((str = json_get_string (object, "init_image")) != NULL) {
+    g_free (job->init_image_path);
+    job->init_image_path = g_strdup (str);
+  }
+  if ((str = json_get_string (object, "output_path")) != NULL) {
+    g_free (job->output_path);
+    job->output_path = g_strdup (str);
+  }
+  if ((str = json_get_string (object, "export_path")) != NULL) {
+    g_free (job->export_path);
+    job->export_path = g_strdup (str);
+  }
+  if (json_object_has_member (object, "upscale_model")) {
+    g_free (job->upscale_model_path);
+    job->upscale_model_path = g_strdup (json_get_string (object, "upscale_model"));
+  }
+
+  if (json_object_has_member (object, "width"))
+    job->width = json_object_get_int_member (object, "width");
+  if (json_object_has_member (object, "height"))
+    job->height = json_object_get_int_member (object, "height");
+  if (json_object_has_member (object, "steps"))
+    job->steps = json_object_get_int_member (object, "steps");
+  if (json_object_has_member (object, "requested_steps"))
+    job->requested_steps = json_object_get_int_member (object, "requested_steps");
+  if (json_object_has_member (object, "seed"))
+    job->seed = json_object_get_int_member (object, "seed");
+  if (json_object_has_member (object, "cfg_scale"))
+    job->cfg_scale = json_object_get_double_member (object, "cfg_scale");
+  if (json_object_has_member (object, "threads"))
+    job->threads = json_object_get_int_member (object, "threads");
+  if (json_object_has_member (object, "img2img_enabled"))
+    job->img2img = json_object_get_boolean_member (object, "img2img_enabled");
+  if (json_object_has_member (object, "strength"))
+    job->strength = json_object_get_double_member (object, "strength");
+  if (json_object_has_member (object, "vae_tiling"))
+    job->vae_tiling = json_object_get_boolean_member (object, "vae_tiling");
+  if (json_object_has_member (object, "upscale_tile_size"))
+    job->upscale_tile_size = json_object_get_int_member (object, "upscale_tile_size");
+  if (json_object_has_member (object, "draft"))
+    job->draft = json_object_get_boolean_member (object, "draft");
+  if (json_object_has_member (object, "hires_width"))
+    job->hires_width = json_object_get_int_member (object, "hires_width");
+  if (json_object_has_member (object, "hires_height"))
+    job->hires_height = json_object_get_int_member (object, "hires_height");
+  if (json_object_has_member (object, "hires_steps"))
+    job->hires_steps = json_object_get_int_member (object, "hires_steps");
+}
+
+/* Parameters, and the results once the job has run, as a JSON object */
+JsonNode *
+emerge_job_to_json (const EmergeJob *job)
+{
+  JsonBuilder *builder;
+  JsonNode *root;
+
+  g_return_val_if_fail (job != NULL, NULL);
+
+  builder = json_builder_new ();
+  json_builder_begin_object (builder);
+
+  json_builder_set_member_name (builder, "id");
+  json_builder_add_int_value (builder, job->id);
+  json_builder_set_member_name (builder, "model_path");
+  json_builder_add_string_value (builder, job->model_path);
+  json_builder_set_member_name (builder, "positive_prompt");
+  json_builder_add_string_value (builder, job->prompt ? job->prompt : "");
+  json_builder_set_member_name (builder, "negative_prompt");
+  json_builder_add_string_value (builder, job->negative_prompt ? job->negative_prompt : "");
+  json_builder_set_member_name (builder, "width");
+  json_builder_add_int_value (builder, job->width);
+  json_builder_set_member_name (builder, "height");
+  json_builder_add_int_value (builder, job->height);
+  json_builder_set_member_name (builder, "steps");
+  json_builder_add_int_value (builder, job->steps);
+  if (job->requested_steps > 0) {
+    json_builder_set_member_name (builder, "requested_steps");
+    json_builder_add_int_value (builder, job->requested_steps);
+  }
+  json_builder_set_member_name (builder, "seed");
+  json_builder_add_int_value (builder, job->seed);
+  json_builder_set_member_name (builder, "cfg_scale");
+  json_builder_add_double_value (builder, job->cfg_scale);
+  json_builder_set_member_name (builder, "sampling_method");
+  json_builder_add_string_value (builder, job->sampling_method);
+  json_builder_set_member_name (builder, "threads");
+  json_builder_add_int_value (builder, job->threads);
+  json_builder_set_member_name (builder, "img2img_enabled");
+  json_builder_add_boolean_value (builder, job->img2img);
+  if (job->init_image_path) {
+    json_builder_set_member_name (builder, "init_image");
+    json_builder_add_string_value (builder, job->init_image_path);
+  }
+  json_builder_set_member_name (builder, "strength");
+  json_builder_add_double_value (builder, job->strength);
+  json_builder_set_member_name (builder, "vae_tiling");
+  json_builder_add_boolean_value (builder, job->vae_tiling);
+  json_builder_set_member_name (builder, "output_path");
+  json_builder_add_string_value (builder, job->output_path);
+  if (job->export_path) {
+    json_builder_set_member_name (builder, "export_path");
+    json_builder_add_string_value (builder, job->export_path);
+  }
+  if (job->upscale_model_path) {
+    json_builder_set_member_name (builder, "upscale_model");
+    json_builder_add_string_value (builder, job->upscale_model_path);
+    json_builder_set_member_name (builder, "upscale_tile_size");
+    json_builder_add_int_value (builder, job->upscale_tile_size);
+  }
+  if (job->draft) {
+    json_builder_set_member_name (builder, "draft");
+    json_builder_add_boolean_value (builder, TRUE);
+    json_builder_set_member_name (builder, "hires_width");
+    json_builder_add_int_value (builder, job->hires_width);
+    json_builder_set_member_name (builder, "hires_height");
+    json_builder_add_int_value (builder, job->hires_height);
+    json_builder_set_member_name (builder, "hires_steps");
+    json_builder_add_int_value (builder, job->hires_steps);
+  }
+
+  if (job->state != EMERGE_JOB_PENDING) {
+    json_builder_set_member_name (builder, "state");
+    json_builder_add_string_value (builder, emerge_job_state_to_string (job->state));
+    json_builder_set_member_name (builder, "wall_seconds");
+    json_builder_add_double_value (builder, job->wall_seconds);
+    json_builder_set_member_name (builder, "peak_rss");
+    json_builder_add_int_value (builder, job->peak_rss);
+
+    if (job->stats) {
+      json_builder_set_member_name (builder, "load_seconds");
+      json_builder_add_double_value (builder, job->stats->load_seconds);
+      json_builder_set_member_name (builder, "sampling_seconds");
+      json_builder_add_double_value (builder, job->stats->sampling_seconds);
+      json_builder_set_member_name (builder, "decode_seconds");
+      json_builder_add_double_value (builder, job->stats->decode_seconds);
+      json_builder_set_member_name (builder, "seconds_per_step");
+      json_builder_add_double_value (builder, emerge_sd_stats_get_mean_step (job->stats));
+    }
+
+    if (job->error_message) {
+      json_builder_set_member_name (builder, "error");
+      json_builder_add_string_value (builder, job->error_message);
+    }
+  }
+
+  json_builder_end_object (builder);
+  root = json_builder_get_root (builder);
+  g_object_unref (builder);
+
+  return root;
+}
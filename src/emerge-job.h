@@ -0,0 +1,126 @@
+#pragma once
+
+#include <json-glib/json-glib.h>
+
+#include "emerge-process-manager.h"
+#include "emerge-sd.h"
+
+G_BEGIN_DECLS
+
+typedef enum {
+  EMERGE_JOB_PENDING,
+  EMERGE_JOB_RUNNING,
+  EMERGE_JOB_SUCCEEDED,
+  EMERGE_JOB_FAILED,
+  EMERGE_JOB_CANCELLED,
+} EmergeJobState;
+
+/* One image generation: the parameters passed to sd, plus the results the
+ * queue fills in once the job has run. Jobs are reference counted. */
+typedef struct {
+  guint64         id;
+
+  /* Parameters */
+  gchar          *model_path;
+  gchar          *prompt;
+  gchar          *negative_prompt;
+  gint            width;
+  gint            height;
+  gint            steps;
+  gint            requested_steps;  /* steps asked for if early stopping cut them, or 0 */
+  gint64          seed;
+  double          cfg_scale;
+  gchar          *sampling_method;
+  gint            threads;          /* 0 lets sd pick */
+  gboolean        img2img;
+  gchar          *init_image_path;
+  double          strength;
+  gboolean        vae_tiling;
+  gchar          *output_path;
+  gint            output_fd;        /* memfd sd writes to instead, or -1 */
+  gchar          *export_path;      /* where a copy of the result goes, or NULL */
+
+  /* Post-processing */
+  gchar          *upscale_model_path;   /* NULL to skip upscaling */
+  gint            upscale_tile_size;
+
+  /* Two-pass generation: a draft is a cheap low-resolution run that
+   * remembers the size and steps to refine it at */
+  gboolean        draft;
+  gint            hires_width;
+  gint            hires_height;
+  gint            hires_steps;
+
+  /* Pictures of the image as it forms, written by sd every so many steps */
+  gint            preview_interval;   /* 0 for none */
+  gchar          *preview_path;
+
+  /* Results */
+  EmergeJobState  state;
+  gint            wait_status;
+  double          wall_seconds;
+  gboolean        was_paused;       /* stopped for a while, which the timings include */
+  guint64         peak_rss;
+  EmergeSdStats  *stats;
+  gchar          *error_message;
+
+  /*< private >*/
+  gint            ref_count;
+} EmergeJob;
+
+/* Drafts are at most this big on their long side, and this many steps */
+#define EMERGE_JOB_DRAFT_SIZE     384
+#define EMERGE_JOB_DRAFT_STEPS    8
+
+#define EMERGE_TYPE_JOB (emerge_job_get_type())
+
+GType       emerge_job_get_type        (void) G_GNUC_CONST;
+
+EmergeJob  *emerge_job_new             (void);
+EmergeJob  *emerge_job_copy            (const EmergeJob *job);
+EmergeJob  *emerge_job_ref             (EmergeJob       *job);
+void        emerge_job_unref           (EmergeJob       *job);
+
+const char *emerge_job_state_to_string (EmergeJobState   state);
+gint        emerge_job_round_size      (double           size);
+
+EmergeJob  *emerge_job_new_draft       (const EmergeJob *job,
+                                        gint             max_size,
+                                        gint             max_steps);
+EmergeJob  *emerge_job_new_refine      (const EmergeJob *draft,
+                                        const char      *init_image_path,
+                                        double           strength);
+gboolean    emerge_job_prepare_refine_input (const EmergeJob  *draft,
+                                             const char       *draft_image_path,
+                                             const char       *output_path,
+                                             GError          **error);
+
+gboolean    emerge_job_set_output_memory (EmergeJob     *job,
+                                          GError       **error);
+void        emerge_job_read_output_async (EmergeJob           *job,
+                                          GCancellable        *cancellable,
+                                          GAsyncReadyCallback  callback,
+                                          gpointer             user_data);
+GBytes     *emerge_job_read_output_finish (EmergeJob     *job,
+                                           GAsyncResult  *result,
+                                           GError       **error);
+
+gchar     **emerge_job_build_argv      (const EmergeJob *job,
+                                        const char      *sd_path);
+double      emerge_job_get_preview_overhead (const EmergeJob *job);
+gchar      *emerge_job_hash            (const EmergeJob *job);
+EmergeProcess *emerge_job_spawn        (EmergeJob                  *job,
+                                        EmergeProcessManager       *manager,
+                                        const char                 *sd_path,
+                                        const EmergeProcessLimits  *limits,
+                                        GError                    **error);
+
+gboolean    emerge_job_validate_json   (JsonObject      *object,
+                                        GError         **error);
+void        emerge_job_apply_json      (EmergeJob       *job,
+                                        JsonObject      *object);
+JsonNode   *emerge_job_to_json         (const EmergeJob *job);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (EmergeJob, emerge_job_unref)
+
+G_END_DECLS
@@ -0,0 +1,417 @@
+#include "emerge-png-writer.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
+
+/* Compressed data is cut into IDAT chunks of this size */
+#define IDAT_SIZE (64 * 1024)
+
+#define BYTES_PER_PIXEL 3
+
+enum {
+  FILTER_NONE,
+  FILTER_SUB,
+  FILTER_UP,
+  FILTER_AVERAGE,
+  FILTER_PAETH,
+  N_FILTERS
+};
+
+struct _EmergePngWriter
+{
+  gchar      *path;
+  gchar      *part_path;
+  int         fd;
+  guint       width;
+  guint       height;
+  guint       n_rows_written;
+  gsize       row_bytes;
+  guint8     *previous;   /* the last row, unfiltered; zero before the first */
+  guint8     *filtered;   /* the current row under each filter, with its type byte */
+  GConverter *compressor;
+  guint8     *idat;
+  gsize       idat_length;
+};
+
+static const guint8 png_signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+
+static guint32 crc_table[256];
+
+static void
+crc_table_init (void)
+{
+  static gsize initialized = 0;
+
+  if (!g_once_init_enter (&initialized))
+    return;
+
+  for (guint32 n = 0; n < 256; n++) {
+    guint32 c = n;
+
+    for (int k = 0; k < 8; k++)
+      c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+    crc_table[n] = c;
+  }
+
+  g_once_init_leave (&initialized, 1);
+}
+
+static guint32
+crc_update (guint32       crc,
+            const guint8 *data,
+            gsize         length)
+{
+  for (gsize i = 0; i < length; i++)
+    crc = crc_table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+
+  return crc;
+}
+
+static gboolean
+write_all (EmergePngWriter  *self,
+           const guint8     *data,
+           gsize             length,
+           GError          **error)
+{
+  while (length > 0) {
+    gssize written = write (self->fd, data, length);
+
+    if (written < 0) {
+      int saved_errno = errno;
+
+      if (saved_errno == EINTR)
+        continue;
+
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (saved_errno),
+                   "Failed to write %s: %s", self->path, g_strerror (saved_errno));
+      return FALSE;
+    }
+
+    data += written;
+    length -= written;
+  }
+
+  return TRUE;
+}
+
+static gboolean
+write_chunk (EmergePngWriter  *self,
+             const char       *type,
+             const guint8     *data,
+             gsize             length,
+             GError          **error)
+{
+  guint8 header[8];
+  guint8 trailer[4];
+  guint32 crc;
+
+  header[0] = length >> 24;
+  header[1] = length >> 16;
+  header[2] = length >> 8;
+  header[3] = length;
+  memcpy (header + 4, type, 4);
+
+  crc = crc_update (0xffffffffu, header + 4, 4);
+  crc = crc_update (crc, data, length) ^ 0xffffffffu;
+  trailer[0] = crc >> 24;
+  trailer[1] = crc >> 16;
+  trailer[2] = crc >> 8;
+  trailer[3] = crc;
+
+  return write_all (self, header, sizeof header, error) &&
+         write_all (self, data, length, error) &&
+         write_all (self, trailer, sizeof trailer, error);
+}
+
+static gboolean
+flush_idat (EmergePngWriter  *self,
+            GError          **error)
+{
+  if (self->idat_length == 0)
+    return TRUE;
+
+  if (!write_chunk (self, "IDAT", self->idat, self->idat_length, error))
+    return FALSE;
+
+  self->idat_length = 0;
+  return TRUE;
+}
+
+/* Feeds @data to the compressor, writing out IDAT chunks as they fill up.
+ * With G_CONVERTER_INPUT_AT_END the stream is finished off as well. */
+static gboolean
+write_compressed (EmergePngWriter  *self,
+                  const guint8     *data,
+                  gsize             length,
+                  GConverterFlags   flags,
+                  GError          **error)
+{
+  GConverterResult result = G_CONVERTER_CONVERTED;
+
+  do {
+    GError *local_error = NULL;
+    gsize bytes_read = 0, bytes_written = 0;
+
+    result = g_converter_convert (self->compressor, data, length,
+                                  self->idat + self->idat_length,
+                                  IDAT_SIZE - self->idat_length,
+                                  flags, &bytes_read, &bytes_written, &local_error);
+    if (result == G_CONVERTER_ERROR) {
+      if (g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_NO_SPACE) &&
+          self->idat_length > 0) {
+        g_clear_error (&local_error);
+        if (!flush_idat (self, error))
+          return FALSE;
+        continue;
+      }
+
+      g_propagate_error (error, local_error);
+      return FALSE;
+    }
+
+    data += bytes_read;
+    length -= bytes_read;
+    self->idat_length += bytes_written;
+
+    if (self->idat_length == IDAT_SIZE && !flush_idat (self, error))
+      return FALSE;
+  } while (length > 0 ||
+           ((flags & G_CONVERTER_INPUT_AT_END) && result != G_CONVERTER_FINISHED));
+
+  return TRUE;
+}
+
+static inline guint8
+paeth (guint8 a,
+       guint8 b,
+       guint8 c)
+{
+  int p = a + b - c;
+  int pa = ABS (p - a);
+  int pb = ABS (p - b);
+  int pc = ABS (p - c);
+
+  if (pa <= pb && pa <= pc)
+    return a;
+  return pb <= pc ? b : c;
+}
+
+/* Filters @row every way PNG allows and returns the one whose bytes have
+ * the smallest sum as signed values, the usual heuristic for what will
+ * compress best */
+static const guint8 *
+filter_row (EmergePngWriter *self,
+            const guint8    *row)
+{
+  const guint8 *up = self->previous;
+  gsize stride = self->row_bytes + 1;
+  guint64 best_sum = G_MAXUINT64;
+  const guint8 *best = NULL;
+
+  for (int filter = 0; filter < N_FILTERS; filter++) {
+    guint8 *out = self->filtered + filter * stride;
+    guint64 sum = 0;
+
+    out[0] = filter;
+    out++;
+
+    for (gsize i = 0; i < self->row_bytes; i++) {
+      guint8 left = i >= BYTES_PER_PIXEL ? row[i - BYTES_PER_PIXEL] : 0;
+      guint8 upper_left = i >= BYTES_PER_PIXEL ? up[i - BYTES_PER_PIXEL] : 0;
+      guint8 predicted;
+
+      switch (filter) {
+      case FILTER_SUB:
+        predicted = left;
+        break;
+      case FILTER_UP:
+        predicted = up[i];
+        break;
+      case FILTER_AVERAGE:
+        predicted = (left + up[i]) / 2;
+        break;
+      case FILTER_PAETH:
+        predicted = paeth (left, up[i], upper_left);
+        break;
+      default:
+        predicted = 0;
+        break;
+      }
+
+      out[i] = row[i] - predicted;
+      sum += ABS ((gint8) out[i]);
+    }
+
+    if (sum < best_sum) {
+      best_sum = sum;
+      best = out - 1;
+    }
+  }
+
+  return best;
+}
+
+/**
+ * emerge_png_writer_new:
+ * @path: where the image will be written
+ * @width: width in pixels
+ * @height: height in pixels
+ * @error: return location for an error
+ *
+ * Starts writing a @width × @height RGB image. Rows are written to a
+ * temporary file next to @path, which replaces @path when the writer is
+ * closed, or is removed if the writer is freed without being closed.
+ *
+ * Returns: (transfer full) (nullable): a writer, or %NULL on error
+ */
+EmergePngWriter *
+emerge_png_writer_new (const char  *path,
+                       guint        width,
+                       guint        height,
+                       GError     **error)
+{
+  EmergePngWriter *self;
+  guint8 ihdr[13];
+
+  g_return_val_if_fail (path != NULL, NULL);
+  g_return_val_if_fail (width > 0 && height > 0, NULL);
+
+  crc_table_init ();
+
+  self = g_new0 (EmergePngWriter, 1);
+  self->path = g_strdup (path);
+  self->part_path = g_strconcat (path, ".part", NULL);
+  self->width = width;
+  self->height = height;
+  self->row_bytes = (gsize) width * BYTES_PER_PIXEL;
+
+  self->fd = g_open (self->part_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (self->fd < 0) {
+    int saved_errno = errno;
+
+    g_set_error (error, G_IO_ERROR, g_io_error_from_errno (saved_errno),
+                 "Failed to create %s: %s", self->part_path, g_strerror (saved_errno));
+    emerge_png_writer_free (self);
+    return NULL;
+  }
+
+  self->previous = g_malloc0 (self->row_bytes);
+  self->filtered = g_malloc ((self->row_bytes + 1) * N_FILTERS);
+  self->idat = g_malloc (IDAT_SIZE);
+  self->compressor = G_CONVERTER (g_zlib_compressor_new (G_ZLIB_COMPRESSOR_FORMAT_ZLIB, 6));
+
+  ihdr[0] = width >> 24;
+  ihdr[1] = width >> 16;
+  ihdr[2] = width >> 8;
+  ihdr[3] = width;
+  ihdr[4] = height >> 24;
+  ihdr[5] = height >> 16;
+  ihdr[6] = height >> 8;
+  ihdr[7] = height;
+  ihdr[8] = 8;      /* bit depth */
+  ihdr[9] = 2;      /* truecolour */
+  ihdr[10] = 0;     /* deflate */
+  ihdr[11] = 0;     /* adaptive filtering */
+  ihdr[12] = 0;     /* not interlaced */
+
+  if (!write_all (self, png_signature, sizeof png_signature, error) ||
+      !write_chunk (self, "IHDR", ihdr, sizeof ihdr, error)) {
+    emerge_png_writer_free (self);
+    return NULL;
+  }
+
+  return self;
+}
+
+/* Appends @n_rows rows of packed RGB pixels, @rowstride bytes apart */
+gboolean
+emerge_png_writer_write_rows (EmergePngWriter  *self,
+                              const guint8     *pixels,
+                              gsize             rowstride,
+                              guint             n_rows,
+                              GError          **error)
+{
+  g_return_val_if_fail (self != NULL, FALSE);
+  g_return_val_if_fail (self->fd >= 0, FALSE);
+  g_return_val_if_fail (self->n_rows_written + n_rows <= self->height, FALSE);
+
+  for (guint y = 0; y < n_rows; y++) {
+    const guint8 *row = pixels + y * rowstride;
+    const guint8 *filtered = filter_row (self, row);
+
+    if (!write_compressed (self, filtered, self->row_bytes + 1, G_CONVERTER_NO_FLAGS, error))
+      return FALSE;
+
+    memcpy (self->previous, row, self->row_bytes);
+    self->n_rows_written++;
+  }
+
+  return TRUE;
+}
+
+/* Finishes the image and moves it into place. Every row must have been
+ * written. The writer still has to be freed afterwards. */
+gboolean
+emerge_png_writer_close (EmergePngWriter  *self,
+                         GError          **error)
+{
+  int fd;
+
+  g_return_val_if_fail (self != NULL, FALSE);
+  g_return_val_if_fail (self->fd >= 0, FALSE);
+
+  if (self->n_rows_written != self->height) {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_PARTIAL_INPUT,
+                 "Only %u of %u rows were written to %s",
+                 self->n_rows_written, self->height, self->path);
+    return FALSE;
+  }
+
+  if (!write_compressed (self, (const guint8 *) "", 0, G_CONVERTER_INPUT_AT_END, error) ||
+      !flush_idat (self, error) ||
+      !write_chunk (self, "IEND", NULL, 0, error))
+    return FALSE;
+
+  fd = self->fd;
+  self->fd = -1;
+
+  if (!g_close (fd, error)) {
+    g_unlink (self->part_path);
+    return FALSE;
+  }
+
+  if (g_rename (self->part_path, self->path) != 0) {
+    int saved_errno = errno;
+
+    g_set_error (error, G_IO_ERROR, g_io_error_from_errno (saved_errno),
+                 "Failed to move %s into place: %s", self->path, g_strerror (saved_errno));
+    g_unlink (self->part_path);
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+void
+emerge_png_writer_free (EmergePngWriter *self)
+{
+  if (self == NULL)
+    return;
+
+  /* Never closed, so what was written is incomplete */
+  if (self->fd >= 0) {
+    close (self->fd);
+    g_unlink (self->part_path);
+  }
+
+  g_clear_object (&self->compressor);
+  g_free (self->idat);
+  g_free (self->filtered);
+  g_free (self->previous);
+  g_free (self->part_path);
+  g_free (self->path);
+  g_free (self);
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+/* Writes an 8-bit RGB PNG a few rows at a time, so an image can be encoded
+ * while it is still being produced without ever being whole in memory. The
+ * file appears at its path only once it has been closed successfully. */
+typedef struct _EmergePngWriter EmergePngWriter;
+
+EmergePngWriter *emerge_png_writer_new        (const char       *path,
+                                               guint             width,
+                                               guint             height,
+                                               GError          **error);
+gboolean         emerge_png_writer_write_rows (EmergePngWriter  *writer,
+                                               const guint8     *pixels,
+                                               gsize             rowstride,
+                                               guint             n_rows,
+                                               GError          **error);
+gboolean         emerge_png_writer_close      (EmergePngWriter  *writer,
+                                               GError          **error);
+void             emerge_png_writer_free       (EmergePngWriter  *writer);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (EmergePngWriter, emerge_png_writer_free)
+
+G_END_DECLS
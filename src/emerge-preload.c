@@ -0,0 +1,438 @@
+#define _GNU_SOURCE
+
+#include "emerge-preload.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <gio/gio.h>
+
+/* Size of each readahead request; small enough to check for cancellation
+ * and apply the rate limit often, big enough to keep the disk busy. */
+#define PRELOAD_CHUNK_SIZE (8 * 1024 * 1024)
+
+/* How often progress is reported on the main context, in milliseconds */
+#define PRELOAD_PROGRESS_INTERVAL 100
+
+struct _EmergePreload
+{
+  gint                       ref_count;
+  gchar                     *path;
+  guint64                    rate_limit;
+  GCancellable              *cancellable;
+
+  /* Shared with the worker thread, protected by mutex */
+  GMutex                     mutex;
+  guint64                    total_bytes;
+  guint64                    done_bytes;
+  guint64                    resident_before;
+  gint64                     read_time;
+  gint64                     start_time;
+  gint64                     end_time;
+  gboolean                   finished;
+
+  /* Main context only */
+  guint                      progress_source_id;
+  EmergePreloadProgressFunc  progress_func;
+  EmergePreloadDoneFunc      done_func;
+  gpointer                   user_data;
+};
+
+EmergePreload *
+emerge_preload_ref (EmergePreload *preload)
+{
+  g_return_val_if_fail (preload != NULL, NULL);
+
+  g_atomic_int_inc (&preload->ref_count);
+  return preload;
+}
+
+void
+emerge_preload_unref (EmergePreload *preload)
+{
+  g_return_if_fail (preload != NULL);
+
+  if (!g_atomic_int_dec_and_test (&preload->ref_count))
+    return;
+
+  g_clear_handle_id (&preload->progress_source_id, g_source_remove);
+  g_mutex_clear (&preload->mutex);
+  g_object_unref (preload->cancellable);
+  g_free (preload->path);
+  g_free (preload);
+}
+
+/* Count how many bytes of a range of the mapped file are already in the
+ * page cache, so we can tell how much I/O the preload actually took off the
+ * critical path. @offset must be page aligned. */
+static guint64
+count_resident_bytes (guint8 *map, guint64 offset, guint64 len)
+{
+  long page_size = sysconf (_SC_PAGESIZE);
+  guint64 n_pages;
+  guint64 resident = 0;
+  unsigned char *vec;
+
+  if (map == NULL || len == 0 || page_size <= 0)
+    return 0;
+
+  n_pages = (len + page_size - 1) / page_size;
+  vec = g_malloc (n_pages);
+
+  if (mincore (map + offset, len, vec) == 0) {
+    for (guint64 i = 0; i < n_pages; i++) {
+      if (vec[i] & 1)
+        resident += page_size;
+    }
+  }
+
+  g_free (vec);
+
+  return MIN (resident, len);
+}
+
+static gboolean
+preload_done_idle (gpointer user_data)
+{
+  EmergePreload *preload = user_data;
+  gboolean completed;
+
+  g_clear_handle_id (&preload->progress_source_id, g_source_remove);
+
+  g_mutex_lock (&preload->mutex);
+  completed = preload->finished && !g_cancellable_is_cancelled (preload->cancellable);
+  g_mutex_unlock (&preload->mutex);
+
+  if (completed && preload->progress_func)
+    preload->progress_func (preload, preload->total_bytes, preload->total_bytes,
+                            preload->user_data);
+
+  if (preload->done_func)
+    preload->done_func (preload, completed, preload->user_data);
+
+  return G_SOURCE_REMOVE;
+}
+
+static gboolean
+preload_progress_timeout (gpointer user_data)
+{
+  EmergePreload *preload = user_data;
+  guint64 done, total;
+
+  g_mutex_lock (&preload->mutex);
+  done = preload->done_bytes;
+  total = preload->total_bytes;
+  g_mutex_unlock (&preload->mutex);
+
+  if (preload->progress_func && total > 0)
+    preload->progress_func (preload, done, total, preload->user_data);
+
+  return G_SOURCE_CONTINUE;
+}
+
+static gpointer
+preload_thread_func (gpointer user_data)
+{
+  EmergePreload *preload = user_data;
+  struct stat st;
+  guint64 offset = 0;
+  guint64 resident;
+  guint8 *map = NULL;
+  int fd;
+
+  fd = open (preload->path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    g_debug ("Preload: failed to open %s: %s", preload->path, g_strerror (errno));
+    goto out;
+  }
+
+  if (fstat (fd, &st) != 0 || !S_ISREG (st.st_mode)) {
+    close (fd);
+    goto out;
+  }
+
+  g_mutex_lock (&preload->mutex);
+  preload->total_bytes = st.st_size;
+  g_mutex_unlock (&preload->mutex);
+
+  /* Only used to ask which pages are cached, never read through */
+  if (st.st_size > 0) {
+    map = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+      map = NULL;
+  }
+
+  resident = count_resident_bytes (map, 0, st.st_size);
+
+  g_mutex_lock (&preload->mutex);
+  preload->resident_before = resident;
+  g_mutex_unlock (&preload->mutex);
+
+  /* Tell the kernel we are going to stream through the whole file */
+  posix_fadvise (fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+  while (offset < (guint64) st.st_size) {
+    guint64 len = MIN ((guint64) PRELOAD_CHUNK_SIZE, (guint64) st.st_size - offset);
+    gint64 read_time = 0;
+
+    if (g_cancellable_is_cancelled (preload->cancellable))
+      break;
+
+    /* Chunks that are already cached cost a load nothing, so they are
+     * neither read again nor counted as time taken off it */
+    if (map == NULL || count_resident_bytes (map, offset, len) < len) {
+      gint64 read_start = g_get_monotonic_time ();
+
+#ifdef __linux__
+      /* readahead() blocks until the range is in the page cache, which is
+       * what makes progress reporting and rate limiting meaningful. */
+      if (readahead (fd, offset, len) != 0)
+        posix_fadvise (fd, offset, len, POSIX_FADV_WILLNEED);
+#else
+      posix_fadvise (fd, offset, len, POSIX_FADV_WILLNEED);
+#endif
+
+      read_time = g_get_monotonic_time () - read_start;
+    }
+
+    offset += len;
+
+    g_mutex_lock (&preload->mutex);
+    preload->done_bytes = offset;
+    preload->read_time += read_time;
+    g_mutex_unlock (&preload->mutex);
+
+    /* Rate limit: sleep until we are back under the configured throughput */
+    if (preload->rate_limit > 0) {
+      gint64 elapsed = g_get_monotonic_time () - preload->start_time;
+      gint64 expected = (gint64) (offset * G_USEC_PER_SEC / preload->rate_limit);
+
+      if (expected > elapsed)
+        g_usleep (expected - elapsed);
+    }
+  }
+
+  if (map != NULL)
+    munmap (map, st.st_size);
+  close (fd);
+
+  g_mutex_lock (&preload->mutex);
+  preload->finished = offset >= (guint64) st.st_size;
+  preload->end_time = g_get_monotonic_time ();
+  g_mutex_unlock (&preload->mutex);
+
+out:
+  g_idle_add_full (G_PRIORITY_DEFAULT_IDLE,
+                   preload_done_idle,
+                   preload,
+                   (GDestroyNotify) emerge_preload_unref);
+
+  return NULL;
+}
+
+/**
+ * emerge_preload_start:
+ * @path: model file to warm
+ * @rate_limit: maximum readahead throughput in bytes per second, or 0
+ * @progress_func: (nullable): called periodically on the main context
+ * @done_func: (nullable): called once on the main context when the preload
+ *   completes, fails or is cancelled
+ * @user_data: data passed to the callbacks
+ *
+ * Starts reading @path into the page cache on a worker thread.
+ *
+ * Returns: (transfer full): a new preload handle
+ */
+EmergePreload *
+emerge_preload_start (const char                *path,
+                      guint64                    rate_limit,
+                      EmergePreloadProgressFunc  progress_func,
+                      EmergePreloadDoneFunc      done_func,
+                      gpointer                   user_data)
+{
+  EmergePreload *preload;
+  GThread *thread;
+
+  g_return_val_if_fail (path != NULL, NULL);
+
+  preload = g_new0 (EmergePreload, 1);
+  preload->ref_count = 1;
+  preload->path = g_strdup (path);
+  preload->rate_limit = rate_limit;
+  preload->cancellable = g_cancellable_new ();
+  preload->progress_func = progress_func;
+  preload->done_func = done_func;
+  preload->user_data = user_data;
+  preload->start_time = g_get_monotonic_time ();
+  g_mutex_init (&preload->mutex);
+
+  preload->progress_source_id = g_timeout_add (PRELOAD_PROGRESS_INTERVAL,
+                                               preload_progress_timeout,
+                                               preload);
+
+  thread = g_thread_new ("emerge-preload", preload_thread_func,
+                         emerge_preload_ref (preload));
+  g_thread_unref (thread);
+
+  return preload;
+}
+
+/**
+ * emerge_preload_cancel:
+ * @preload: a preload
+ *
+ * Stops the readahead at the next chunk boundary. No callbacks are invoked
+ * after this returns, so the caller may drop its user data immediately.
+ * Must be called on the main context.
+ */
+void
+emerge_preload_cancel (EmergePreload *preload)
+{
+  g_return_if_fail (preload != NULL);
+
+  preload->progress_func = NULL;
+  preload->done_func = NULL;
+  preload->user_data = NULL;
+  g_clear_handle_id (&preload->progress_source_id, g_source_remove);
+  g_cancellable_cancel (preload->cancellable);
+}
+
+const char *
+emerge_preload_get_path (EmergePreload *preload)
+{
+  g_return_val_if_fail (preload != NULL, NULL);
+
+  return preload->path;
+}
+
+gboolean
+emerge_preload_is_finished (EmergePreload *preload)
+{
+  gboolean finished;
+
+  g_return_val_if_fail (preload != NULL, FALSE);
+
+  g_mutex_lock (&preload->mutex);
+  finished = preload->finished;
+  g_mutex_unlock (&preload->mutex);
+
+  return finished;
+}
+
+guint64
+emerge_preload_get_total_bytes (EmergePreload *preload)
+{
+  guint64 total;
+
+  g_return_val_if_fail (preload != NULL, 0);
+
+  g_mutex_lock (&preload->mutex);
+  total = preload->total_bytes;
+  g_mutex_unlock (&preload->mutex);
+
+  return total;
+}
+
+guint64
+emerge_preload_get_done_bytes (EmergePreload *preload)
+{
+  guint64 done;
+
+  g_return_val_if_fail (preload != NULL, 0);
+
+  g_mutex_lock (&preload->mutex);
+  done = preload->done_bytes;
+  g_mutex_unlock (&preload->mutex);
+
+  return done;
+}
+
+/* Fraction of the file that was already cached before the preload started */
+double
+emerge_preload_get_resident_fraction (EmergePreload *preload)
+{
+  double fraction = 0.0;
+
+  g_return_val_if_fail (preload != NULL, 0.0);
+
+  g_mutex_lock (&preload->mutex);
+  if (preload->total_bytes > 0)
+    fraction = (double) preload->resident_before / preload->total_bytes;
+  g_mutex_unlock (&preload->mutex);
+
+  return fraction;
+}
+
+/* Seconds spent warming so far, or in total once finished */
+double
+emerge_preload_get_elapsed (EmergePreload *preload)
+{
+  gint64 end;
+
+  g_return_val_if_fail (preload != NULL, 0.0);
+
+  g_mutex_lock (&preload->mutex);
+  end = preload->end_time ? preload->end_time : g_get_monotonic_time ();
+  g_mutex_unlock (&preload->mutex);
+
+  return (double) (end - preload->start_time) / G_USEC_PER_SEC;
+}
+
+/* Seconds spent in readahead() on chunks that weren't already cached, that
+ * is, the disk reads a model load would otherwise have waited for. Time
+ * spent rate limiting is left out. */
+double
+emerge_preload_get_read_seconds (EmergePreload *preload)
+{
+  gint64 read_time;
+
+  g_return_val_if_fail (preload != NULL, 0.0);
+
+  g_mutex_lock (&preload->mutex);
+  read_time = preload->read_time;
+  g_mutex_unlock (&preload->mutex);
+
+  return (double) read_time / G_USEC_PER_SEC;
+}
+
+/**
+ * emerge_preload_evict:
+ * @path: file to drop from the page cache
+ * @error: return location for an error
+ *
+ * Asks the kernel to drop the cached pages of @path, so the next read of
+ * it comes from disk. Used to measure cold model loads. Pages that are
+ * dirty or mapped by another process may stay resident.
+ *
+ * Returns: %TRUE on success
+ */
+gboolean
+emerge_preload_evict (const char  *path,
+                      GError     **error)
+{
+  int fd, res;
+
+  g_return_val_if_fail (path != NULL, FALSE);
+
+  fd = open (path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    int saved_errno = errno;
+
+    g_set_error (error, G_IO_ERROR, g_io_error_from_errno (saved_errno),
+                 "Failed to open %s: %s", path, g_strerror (saved_errno));
+    return FALSE;
+  }
+
+  res = posix_fadvise (fd, 0, 0, POSIX_FADV_DONTNEED);
+  close (fd);
+
+  if (res != 0) {
+    g_set_error (error, G_IO_ERROR, g_io_error_from_errno (res),
+                 "Failed to evict %s: %s", path, g_strerror (res));
+    return FALSE;
+  }
+
+  return TRUE;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Background page-cache warming for model files.
+ *
+ * A preload reads the model file into the page cache on a worker thread,
+ * in chunks, optionally rate limited so it does not starve the rest of the
+ * desktop of I/O. Progress and completion are reported on the main context.
+ */
+
+/* Default readahead rate limit in bytes per second (0 means unlimited) */
+#define EMERGE_PRELOAD_DEFAULT_RATE (512 * 1024 * 1024)
+
+typedef struct _EmergePreload EmergePreload;
+
+typedef void (*EmergePreloadProgressFunc) (EmergePreload *preload,
+                                           guint64        done_bytes,
+                                           guint64        total_bytes,
+                                           gpointer       user_data);
+
+typedef void (*EmergePreloadDoneFunc) (EmergePreload *preload,
+                                       gboolean       completed,
+                                       gpointer       user_data);
+
+EmergePreload *emerge_preload_start          (const char                *path,
+                                              guint64                    rate_limit,
+                                              EmergePreloadProgressFunc  progress_func,
+                                              EmergePreloadDoneFunc      done_func,
+                                              gpointer                   user_data);
+void           emerge_preload_cancel         (EmergePreload *preload);
+EmergePreload *emerge_preload_ref            (EmergePreload *preload);
+void           emerge_preload_unref          (EmergePreload *preload);
+
+const char    *emerge_preload_get_path       (EmergePreload *preload);
+gboolean       emerge_preload_is_finished    (EmergePreload *preload);
+guint64        emerge_preload_get_total_bytes (EmergePreload *preload);
+guint64        emerge_preload_get_done_bytes  (EmergePreload *preload);
+double         emerge_preload_get_resident_fraction (EmergePreload *preload);
+double         emerge_preload_get_elapsed     (EmergePreload *preload);
+double         emerge_preload_get_read_seconds (EmergePreload *preload);
+
+gboolean       emerge_preload_evict           (const char  *path,
+                                               GError     **error);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (EmergePreload, emerge_preload_unref)
+
+G_END_DECLS
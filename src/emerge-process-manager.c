@@ -0,0 +1,789 @@
+#define _GNU_SOURCE
+
+#include "emerge-process-manager.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+/* How often the child's high-water RSS mark is sampled */
+#define RSS_POLL_INTERVAL_MS  250
+
+/* How long a cancelled child gets to exit on SIGTERM before it is killed */
+#define KILL_TIMEOUT_MS       5000
+
+/* ioprio_set() has no glibc wrapper */
+#define IOPRIO_CLASS_IDLE     3
+#define IOPRIO_CLASS_SHIFT    13
+#define IOPRIO_WHO_PROCESS    1
+
+struct _EmergeProcess
+{
+  GObject              parent_instance;
+
+  gchar               *label;
+  GPid                 pid;
+  EmergeProcessLimits  limits;
+  GCancellable        *cancellable;
+
+  guint                child_watch_id;
+  GIOChannel          *stdout_channel;
+  GIOChannel          *stderr_channel;
+  guint                stdout_watch_id;
+  guint                stderr_watch_id;
+  GString             *stdout_buf;
+  GString             *stderr_buf;
+
+  gint64               start_time;
+  gint64               end_time;
+  gint                 step;
+  gint                 total_steps;
+  guint64              peak_rss;
+  guint                rss_poll_id;
+  guint                kill_timeout_id;
+
+  /* Time spent stopped is left out of the elapsed time */
+  gint64               pause_time;
+  gint64               paused_total;
+
+  gboolean             running;
+  gboolean             paused;
+  gboolean             was_paused;
+  gboolean             child_exited;
+  gint                 wait_status;
+};
+
+G_DEFINE_TYPE (EmergeProcess, emerge_process, G_TYPE_OBJECT)
+
+enum {
+  SIGNAL_OUTPUT,
+  SIGNAL_PROGRESS,
+  SIGNAL_EXITED,
+  N_SIGNALS
+};
+
+static guint process_signals[N_SIGNALS];
+
+static void
+emerge_process_finalize (GObject *object)
+{
+  EmergeProcess *self = EMERGE_PROCESS (object);
+
+  g_clear_handle_id (&self->child_watch_id, g_source_remove);
+  g_clear_handle_id (&self->rss_poll_id, g_source_remove);
+  g_clear_handle_id (&self->kill_timeout_id, g_source_remove);
+  g_clear_handle_id (&self->stdout_watch_id, g_source_remove);
+  g_clear_handle_id (&self->stderr_watch_id, g_source_remove);
+  g_clear_pointer (&self->stdout_channel, g_io_channel_unref);
+  g_clear_pointer (&self->stderr_channel, g_io_channel_unref);
+
+  if (self->pid != 0 && !self->child_exited)
+    g_spawn_close_pid (self->pid);
+
+  g_string_free (self->stdout_buf, TRUE);
+  g_string_free (self->stderr_buf, TRUE);
+  g_clear_object (&self->cancellable);
+  g_free (self->label);
+
+  G_OBJECT_CLASS (emerge_process_parent_class)->finalize (object);
+}
+
+static void
+emerge_process_class_init (EmergeProcessClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->finalize = emerge_process_finalize;
+
+  /* A complete line of output from stdout or stderr, without the newline.
+   * Carriage-return separated progress updates are split into lines too. */
+  process_signals[SIGNAL_OUTPUT] =
+    g_signal_new ("output",
+                  G_TYPE_FROM_CLASS (klass),
+                  G_SIGNAL_RUN_LAST,
+                  0, NULL, NULL, NULL,
+                  G_TYPE_NONE, 1, G_TYPE_STRING);
+
+  /* Emitted for every sampling progress bar update printed by sd */
+  process_signals[SIGNAL_PROGRESS] =
+    g_signal_new ("progress",
+                  G_TYPE_FROM_CLASS (klass),
+                  G_SIGNAL_RUN_LAST,
+                  0, NULL, NULL, NULL,
+                  G_TYPE_NONE, 3, G_TYPE_INT, G_TYPE_INT, G_TYPE_DOUBLE);
+
+  /* Emitted once, after the child has exited and all its output has been
+   * read. The argument is the raw wait status. */
+  process_signals[SIGNAL_EXITED] =
+    g_signal_new ("exited",
+                  G_TYPE_FROM_CLASS (klass),
+                  G_SIGNAL_RUN_LAST,
+                  0, NULL, NULL, NULL,
+                  G_TYPE_NONE, 1, G_TYPE_INT);
+}
+
+static void
+emerge_process_init (EmergeProcess *self)
+{
+  self->cancellable = g_cancellable_new ();
+  self->stdout_buf = g_string_new (NULL);
+  self->stderr_buf = g_string_new (NULL);
+}
+
+/* Runs in the child between fork and exec, so only async-signal-safe calls */
+static void
+process_child_setup (gpointer user_data)
+{
+  const EmergeProcessLimits *limits = user_data;
+
+  if (limits->nice != 0)
+    setpriority (PRIO_PROCESS, 0, limits->nice);
+
+#ifdef SYS_ioprio_set
+  if (limits->idle_io)
+    syscall (SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0,
+             IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT);
+#endif
+
+  if (limits->max_memory > 0) {
+    struct rlimit rl;
+
+    rl.rlim_cur = limits->max_memory;
+    rl.rlim_max = limits->max_memory;
+    setrlimit (RLIMIT_AS, &rl);
+  }
+}
+
+/* Parse the progress bar sd prints while sampling, e.g.
+ *   |==========>            | 8/20 - 1.52s/it
+ * Returns TRUE if @line was a progress update. */
+static gboolean
+parse_progress_line (const char *line,
+                     gint       *step,
+                     gint       *total_steps,
+                     double     *seconds_per_step)
+{
+  const char *bar_end = strrchr (line, '|');
+  double rate;
+  char unit[8];
+
+  if (bar_end == NULL || bar_end == line)
+    return FALSE;
+
+  if (sscanf (bar_end + 1, " %d/%d - %lf%7s", step, total_steps, &rate, unit) != 4)
+    return FALSE;
+
+  if (g_str_has_prefix (unit, "it/s"))
+    *seconds_per_step = rate > 0.0 ? 1.0 / rate : 0.0;
+  else
+    *seconds_per_step = rate;
+
+  return TRUE;
+}
+
+static void
+process_emit_line (EmergeProcess *self,
+                   char          *line)
+{
+  gint step, total_steps;
+  double seconds_per_step;
+  char *esc;
+
+  /* Drop the "erase to end of line" escape sd appends to progress bars */
+  while ((esc = strstr (line, "\033[K")) != NULL)
+    memmove (esc, esc + 3, strlen (esc + 3) + 1);
+
+  g_strchomp (line);
+  if (*line == '\0')
+    return;
+
+  if (parse_progress_line (line, &step, &total_steps, &seconds_per_step)) {
+    self->step = step;
+    self->total_steps = total_steps;
+    g_signal_emit (self, process_signals[SIGNAL_PROGRESS], 0,
+                   step, total_steps, seconds_per_step);
+  }
+
+  g_signal_emit (self, process_signals[SIGNAL_OUTPUT], 0, line);
+}
+
+static void
+process_flush_lines (EmergeProcess *self,
+                     GString       *buf,
+                     gboolean       eof)
+{
+  gsize start = 0;
+
+  for (gsize i = 0; i < buf->len; i++) {
+    if (buf->str[i] == '\n' || buf->str[i] == '\r') {
+      buf->str[i] = '\0';
+      process_emit_line (self, buf->str + start);
+      start = i + 1;
+    }
+  }
+
+  if (eof && start < buf->len) {
+    process_emit_line (self, buf->str + start);
+    start = buf->len;
+  }
+
+  g_string_erase (buf, 0, start);
+}
+
+/* VmHWM from /proc/<pid>/status, in bytes. The kernel keeps the high-water
+ * mark itself, so sampling it now and then still catches short peaks. */
+static guint64
+read_peak_rss (GPid pid)
+{
+  gchar *path = g_strdup_printf ("/proc/%d/status", (int) pid);
+  gchar *contents = NULL;
+  guint64 peak = 0;
+
+  if (g_file_get_contents (path, &contents, NULL, NULL)) {
+    const char *line = strstr (contents, "VmHWM:");
+
+    if (line != NULL)
+      peak = g_ascii_strtoull (line + strlen ("VmHWM:"), NULL, 10) * 1024;
+  }
+
+  g_free (contents);
+  g_free (path);
+
+  return peak;
+}
+
+static gboolean
+process_rss_poll_cb (gpointer user_data)
+{
+  EmergeProcess *self = EMERGE_PROCESS (user_data);
+
+  self->peak_rss = MAX (self->peak_rss, read_peak_rss (self->pid));
+
+  return G_SOURCE_CONTINUE;
+}
+
+static void
+process_maybe_finish (EmergeProcess *self)
+{
+  if (!self->running || !self->child_exited ||
+      self->stdout_watch_id != 0 || self->stderr_watch_id != 0)
+    return;
+
+  self->running = FALSE;
+  g_signal_emit (self, process_signals[SIGNAL_EXITED], 0, self->wait_status);
+}
+
+static gboolean
+process_channel_cb (GIOChannel   *channel,
+                    GIOCondition  condition,
+                    gpointer      user_data)
+{
+  EmergeProcess *self = EMERGE_PROCESS (user_data);
+  gboolean is_stdout = channel == self->stdout_channel;
+  GString *buf = is_stdout ? self->stdout_buf : self->stderr_buf;
+  gboolean keep_watching = FALSE;
+
+  g_object_ref (self);
+
+  if (condition & G_IO_IN) {
+    gchar chunk[4096];
+    gsize n_read = 0;
+    GIOStatus status;
+
+    status = g_io_channel_read_chars (channel, chunk, sizeof chunk, &n_read, NULL);
+    if (n_read > 0) {
+      g_string_append_len (buf, chunk, n_read);
+      process_flush_lines (self, buf, FALSE);
+    }
+
+    keep_watching = status == G_IO_STATUS_NORMAL || status == G_IO_STATUS_AGAIN;
+  }
+
+  if (!keep_watching) {
+    process_flush_lines (self, buf, TRUE);
+
+    if (is_stdout)
+      self->stdout_watch_id = 0;
+    else
+      self->stderr_watch_id = 0;
+
+    process_maybe_finish (self);
+  }
+
+  g_object_unref (self);
+
+  return keep_watching ? G_SOURCE_CONTINUE : G_SOURCE_REMOVE;
+}
+
+static void
+process_child_watch_cb (GPid     pid,
+                        gint     wait_status,
+                        gpointer user_data)
+{
+  EmergeProcess *self = EMERGE_PROCESS (user_data);
+
+  g_object_ref (self);
+
+  /* A zombie no longer reports VmHWM, so the last poll is the final word */
+  g_clear_handle_id (&self->rss_poll_id, g_source_remove);
+  g_clear_handle_id (&self->kill_timeout_id, g_source_remove);
+
+  self->child_watch_id = 0;
+  self->child_exited = TRUE;
+  self->wait_status = wait_status;
+  self->end_time = g_get_monotonic_time ();
+  if (self->paused) {
+    self->paused = FALSE;
+    self->paused_total += self->end_time - self->pause_time;
+  }
+  g_spawn_close_pid (pid);
+
+  process_maybe_finish (self);
+
+  g_object_unref (self);
+}
+
+static GIOChannel *
+process_watch_fd (EmergeProcess *self,
+                  int            fd,
+                  guint         *watch_id)
+{
+  GIOChannel *channel = g_io_channel_unix_new (fd);
+
+  g_io_channel_set_encoding (channel, NULL, NULL);
+  g_io_channel_set_buffered (channel, FALSE);
+  g_io_channel_set_flags (channel, G_IO_FLAG_NONBLOCK, NULL);
+  g_io_channel_set_close_on_unref (channel, TRUE);
+
+  *watch_id = g_io_add_watch (channel, G_IO_IN | G_IO_HUP | G_IO_ERR,
+                              process_channel_cb, self);
+
+  return channel;
+}
+
+const char *
+emerge_process_get_label (EmergeProcess *self)
+{
+  g_return_val_if_fail (EMERGE_IS_PROCESS (self), NULL);
+
+  return self->label;
+}
+
+GPid
+emerge_process_get_pid (EmergeProcess *self)
+{
+  g_return_val_if_fail (EMERGE_IS_PROCESS (self), 0);
+
+  return self->pid;
+}
+
+gboolean
+emerge_process_is_running (EmergeProcess *self)
+{
+  g_return_val_if_fail (EMERGE_IS_PROCESS (self), FALSE);
+
+  return self->running;
+}
+
+gboolean
+emerge_process_was_cancelled (EmergeProcess *self)
+{
+  g_return_val_if_fail (EMERGE_IS_PROCESS (self), FALSE);
+
+  return g_cancellable_is_cancelled (self->cancellable);
+}
+
+gint
+emerge_process_get_wait_status (EmergeProcess *self)
+{
+  g_return_val_if_fail (EMERGE_IS_PROCESS (self), -1);
+
+  return self->wait_status;
+}
+
+/* Returns FALSE until the child has reported sampling progress */
+gboolean
+emerge_process_get_progress (EmergeProcess *self,
+                             gint          *step,
+                             gint          *total_steps)
+{
+  g_return_val_if_fail (EMERGE_IS_PROCESS (self), FALSE);
+
+  if (step)
+    *step = self->step;
+  if (total_steps)
+    *total_steps = self->total_steps;
+
+  return self->total_steps > 0;
+}
+
+/* Highest resident set size seen for the child so far, in bytes */
+guint64
+emerge_process_get_peak_rss (EmergeProcess *self)
+{
+  g_return_val_if_fail (EMERGE_IS_PROCESS (self), 0);
+
+  return self->peak_rss;
+}
+
+/* Wall time the child has been running, not counting time paused */
+double
+emerge_process_get_elapsed (EmergeProcess *self)
+{
+  gint64 end, paused;
+
+  g_return_val_if_fail (EMERGE_IS_PROCESS (self), 0.0);
+
+  end = self->end_time ? self->end_time : g_get_monotonic_time ();
+  paused = self->paused_total + (self->paused ? end - self->pause_time : 0);
+  return (double) (end - self->start_time - paused) / G_USEC_PER_SEC;
+}
+
+gboolean
+emerge_process_is_paused (EmergeProcess *self)
+{
+  g_return_val_if_fail (EMERGE_IS_PROCESS (self), FALSE);
+
+  return self->paused;
+}
+
+/* Whether the child has been stopped at any point. Timings it reports about
+ * itself, such as sd's sampling time, then include the time it was. */
+gboolean
+emerge_process_was_paused (EmergeProcess *self)
+{
+  g_return_val_if_fail (EMERGE_IS_PROCESS (self), FALSE);
+
+  return self->was_paused;
+}
+
+/**
+ * emerge_process_pause:
+ * @self: a process
+ *
+ * Stops the child where it is with SIGSTOP. Everything it has in memory,
+ * the loaded model and the latents of a half-finished image included,
+ * is kept, so emerge_process_resume() carries on from the same step.
+ */
+void
+emerge_process_pause (EmergeProcess *self)
+{
+  g_return_if_fail (EMERGE_IS_PROCESS (self));
+
+  if (!self->running || self->child_exited || self->paused)
+    return;
+
+  if (kill (self->pid, SIGSTOP) == 0) {
+    self->paused = TRUE;
+    self->was_paused = TRUE;
+    self->pause_time = g_get_monotonic_time ();
+  }
+}
+
+void
+emerge_process_resume (EmergeProcess *self)
+{
+  g_return_if_fail (EMERGE_IS_PROCESS (self));
+
+  if (!self->paused)
+    return;
+
+  self->paused = FALSE;
+  self->paused_total += g_get_monotonic_time () - self->pause_time;
+
+  if (self->running && !self->child_exited)
+    kill (self->pid, SIGCONT);
+}
+
+static gboolean
+process_kill_timeout_cb (gpointer user_data)
+{
+  EmergeProcess *self = EMERGE_PROCESS (user_data);
+
+  self->kill_timeout_id = 0;
+  g_warning ("%s did not exit on SIGTERM, killing it", self->label);
+  kill (self->pid, SIGKILL);
+
+  return G_SOURCE_REMOVE;
+}
+
+/**
+ * emerge_process_cancel:
+ * @self: a process
+ *
+ * Marks the process as cancelled and asks it to terminate, following up
+ * with SIGKILL if it is still there a few seconds later. A paused process
+ * is woken so it can handle the request. Only this process is signalled;
+ * other children of the manager are unaffected. The "exited" signal is
+ * still emitted once the child is gone.
+ */
+void
+emerge_process_cancel (EmergeProcess *self)
+{
+  g_return_if_fail (EMERGE_IS_PROCESS (self));
+
+  g_cancellable_cancel (self->cancellable);
+
+  if (!self->running || self->child_exited || self->kill_timeout_id != 0)
+    return;
+
+  kill (self->pid, SIGTERM);
+  emerge_process_resume (self);
+  self->kill_timeout_id = g_timeout_add (KILL_TIMEOUT_MS, process_kill_timeout_cb, self);
+}
+
+/* Terminates the child and waits for it on the spot, for when there is no
+ * main loop left to see it exit. No "exited" signal is emitted. */
+static void
+process_reap (EmergeProcess *self,
+              gint64         deadline)
+{
+  int status = 0;
+
+  if (!self->running || self->child_exited)
+    return;
+
+  /* The child is reaped here, so GLib mustn't try as well */
+  g_clear_handle_id (&self->child_watch_id, g_source_remove);
+  g_clear_handle_id (&self->kill_timeout_id, g_source_remove);
+  g_clear_handle_id (&self->rss_poll_id, g_source_remove);
+
+  kill (self->pid, SIGTERM);
+  if (self->paused)
+    kill (self->pid, SIGCONT);
+
+  while (waitpid (self->pid, &status, WNOHANG) == 0) {
+    if (g_get_monotonic_time () >= deadline) {
+      kill (self->pid, SIGKILL);
+      while (waitpid (self->pid, &status, 0) < 0 && errno == EINTR)
+        ;
+      break;
+    }
+    g_usleep (10 * 1000);
+  }
+
+  g_cancellable_cancel (self->cancellable);
+  self->child_exited = TRUE;
+  self->running = FALSE;
+  self->paused = FALSE;
+  self->wait_status = status;
+  self->end_time = g_get_monotonic_time ();
+  g_spawn_close_pid (self->pid);
+}
+
+struct _EmergeProcessManager
+{
+  GObject    parent_instance;
+
+  /* Running processes, each holding a reference until it has exited */
+  GPtrArray *processes;
+};
+
+G_DEFINE_TYPE (EmergeProcessManager, emerge_process_manager, G_TYPE_OBJECT)
+
+static void
+emerge_process_manager_finalize (GObject *object)
+{
+  EmergeProcessManager *self = EMERGE_PROCESS_MANAGER (object);
+
+  for (guint i = 0; i < self->processes->len; i++)
+    g_signal_handlers_disconnect_by_data (g_ptr_array_index (self->processes, i), self);
+
+  g_ptr_array_unref (self->processes);
+
+  G_OBJECT_CLASS (emerge_process_manager_parent_class)->finalize (object);
+}
+
+static void
+emerge_process_manager_class_init (EmergeProcessManagerClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->finalize = emerge_process_manager_finalize;
+}
+
+static void
+emerge_process_manager_init (EmergeProcessManager *self)
+{
+  self->processes = g_ptr_array_new_with_free_func (g_object_unref);
+}
+
+EmergeProcessManager *
+emerge_process_manager_new (void)
+{
+  return g_object_new (EMERGE_TYPE_PROCESS_MANAGER, NULL);
+}
+
+static void
+manager_process_exited_cb (EmergeProcess        *process,
+                           gint                  wait_status G_GNUC_UNUSED,
+                           EmergeProcessManager *self)
+{
+  g_signal_handlers_disconnect_by_data (process, self);
+  g_ptr_array_remove (self->processes, process);
+}
+
+/**
+ * emerge_process_manager_spawn:
+ * @self: a process manager
+ * @label: human readable name for logging
+ * @argv: command to run
+ * @limits: (nullable): resource limits for the child
+ * @error: return location for an error
+ *
+ * Starts @argv with its stdout and stderr captured. Each child gets its own
+ * cancellable, progress tracking and limits, so several can run at once.
+ *
+ * Returns: (transfer full) (nullable): the new process, or %NULL on error
+ */
+EmergeProcess *
+emerge_process_manager_spawn (EmergeProcessManager       *self,
+                              const char                 *label,
+                              const char * const         *argv,
+                              const EmergeProcessLimits  *limits,
+                              GError                    **error)
+{
+  return emerge_process_manager_spawn_with_fd (self, label, argv, limits, -1, error);
+}
+
+/**
+ * emerge_process_manager_spawn_with_fd:
+ * @self: a process manager
+ * @label: human readable name for logging
+ * @argv: command to run
+ * @limits: (nullable): resource limits for the child
+ * @fd: a descriptor to hand to the child, or -1
+ * @error: return location for an error
+ *
+ * Like emerge_process_manager_spawn(), but the child also gets @fd as
+ * %EMERGE_PROCESS_PASSED_FD. @fd stays open in the parent.
+ *
+ * Returns: (transfer full) (nullable): the new process, or %NULL on error
+ */
+EmergeProcess *
+emerge_process_manager_spawn_with_fd (EmergeProcessManager       *self,
+                                      const char                 *label,
+                                      const char * const         *argv,
+                                      const EmergeProcessLimits  *limits,
+                                      int                         fd,
+                                      GError                    **error)
+{
+  EmergeProcess *process;
+  gint stdout_fd, stderr_fd;
+  gint target_fd = EMERGE_PROCESS_PASSED_FD;
+
+  g_return_val_if_fail (EMERGE_IS_PROCESS_MANAGER (self), NULL);
+  g_return_val_if_fail (argv != NULL && argv[0] != NULL, NULL);
+
+  process = g_object_new (EMERGE_TYPE_PROCESS, NULL);
+  process->label = g_strdup (label);
+  if (limits)
+    process->limits = *limits;
+
+  if (!g_spawn_async_with_pipes_and_fds (NULL, argv, NULL,
+                                         G_SPAWN_SEARCH_PATH | G_SPAWN_DO_NOT_REAP_CHILD,
+                                         process_child_setup, &process->limits,
+                                         -1, -1, -1,
+                                         fd >= 0 ? &fd : NULL,
+                                         fd >= 0 ? &target_fd : NULL,
+                                         fd >= 0 ? 1 : 0,
+                                         &process->pid,
+                                         NULL, &stdout_fd, &stderr_fd, error)) {
+    g_object_unref (process);
+    return NULL;
+  }
+
+  process->running = TRUE;
+  process->start_time = g_get_monotonic_time ();
+  process->stdout_channel = process_watch_fd (process, stdout_fd, &process->stdout_watch_id);
+  process->stderr_channel = process_watch_fd (process, stderr_fd, &process->stderr_watch_id);
+  process->child_watch_id = g_child_watch_add (process->pid, process_child_watch_cb, process);
+  process->rss_poll_id = g_timeout_add (RSS_POLL_INTERVAL_MS, process_rss_poll_cb, process);
+
+  /* Drop our reference after everyone else has seen the exit */
+  g_ptr_array_add (self->processes, g_object_ref (process));
+  g_signal_connect_after (process, "exited",
+                          G_CALLBACK (manager_process_exited_cb), self);
+
+  return process;
+}
+
+guint
+emerge_process_manager_get_n_running (EmergeProcessManager *self)
+{
+  g_return_val_if_fail (EMERGE_IS_PROCESS_MANAGER (self), 0);
+
+  return self->processes->len;
+}
+
+void
+emerge_process_manager_cancel_all (EmergeProcessManager *self)
+{
+  g_return_if_fail (EMERGE_IS_PROCESS_MANAGER (self));
+
+  for (guint i = 0; i < self->processes->len; i++)
+    emerge_process_cancel (g_ptr_array_index (self->processes, i));
+}
+
+/* Pauses every running child that was started at a lower priority (with a
+ * positive nice increment) and returns the ones that weren't already, so
+ * exactly those can be resumed later. Children started at normal priority,
+ * such as generations and benchmark runs, are left alone. */
+GPtrArray *
+emerge_process_manager_pause_background (EmergeProcessManager *self)
+{
+  GPtrArray *paused;
+
+  g_return_val_if_fail (EMERGE_IS_PROCESS_MANAGER (self), NULL);
+
+  paused = g_ptr_array_new_with_free_func (g_object_unref);
+  for (guint i = 0; i < self->processes->len; i++) {
+    EmergeProcess *process = g_ptr_array_index (self->processes, i);
+
+    if (process->limits.nice <= 0 ||
+        emerge_process_is_paused (process) || emerge_process_was_cancelled (process))
+      continue;
+
+    emerge_process_pause (process);
+    if (emerge_process_is_paused (process))
+      g_ptr_array_add (paused, g_object_ref (process));
+  }
+
+  return paused;
+}
+
+/**
+ * emerge_process_manager_shutdown:
+ * @self: a process manager
+ * @timeout_ms: how long children get to exit before they are killed
+ *
+ * Terminates every child and waits until all of them are gone, so none is
+ * left as a zombie or still writing files once this returns. Meant for
+ * when the application is going away; no "exited" signals are emitted.
+ */
+void
+emerge_process_manager_shutdown (EmergeProcessManager *self,
+                                 guint                 timeout_ms)
+{
+  gint64 deadline;
+
+  g_return_if_fail (EMERGE_IS_PROCESS_MANAGER (self));
+
+  deadline = g_get_monotonic_time () + (gint64) timeout_ms * 1000;
+
+  /* Ask them all first, so they wind down in parallel */
+  for (guint i = 0; i < self->processes->len; i++) {
+    EmergeProcess *process = g_ptr_array_index (self->processes, i);
+
+    if (process->running && !process->child_exited)
+      kill (process->pid, SIGTERM);
+  }
+
+  for (guint i = 0; i < self->processes->len; i++)
+    process_reap (g_ptr_array_index (self->processes, i), deadline);
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+/* Resource limits applied to a child process before it execs */
+typedef struct {
+  int      nice;          /* niceness increment, 0 to inherit */
+  gboolean idle_io;       /* put the child in the idle I/O scheduling class */
+  guint64  max_memory;    /* address space limit in bytes, 0 for unlimited */
+} EmergeProcessLimits;
+
+/* The descriptor number a file handed to a child shows up as */
+#define EMERGE_PROCESS_PASSED_FD 3
+
+#define EMERGE_TYPE_PROCESS (emerge_process_get_type())
+
+G_DECLARE_FINAL_TYPE (EmergeProcess, emerge_process, EMERGE, PROCESS, GObject)
+
+const char   *emerge_process_get_label            (EmergeProcess *self);
+GPid          emerge_process_get_pid              (EmergeProcess *self);
+gboolean      emerge_process_is_running           (EmergeProcess *self);
+gboolean      emerge_process_was_cancelled        (EmergeProcess *self);
+gint          emerge_process_get_wait_status      (EmergeProcess *self);
+gboolean      emerge_process_get_progress         (EmergeProcess *self,
+                                                   gint          *step,
+                                                   gint          *total_steps);
+guint64       emerge_process_get_peak_rss         (EmergeProcess *self);
+double        emerge_process_get_elapsed          (EmergeProcess *self);
+gboolean      emerge_process_is_paused            (EmergeProcess *self);
+gboolean      emerge_process_was_paused           (EmergeProcess *self);
+void          emerge_process_pause                (EmergeProcess *self);
+void          emerge_process_resume               (EmergeProcess *self);
+void          emerge_process_cancel               (EmergeProcess *self);
+
+#define EMERGE_TYPE_PROCESS_MANAGER (emerge_process_manager_get_type())
+
+G_DECLARE_FINAL_TYPE (EmergeProcessManager, emerge_process_manager, EMERGE, PROCESS_MANAGER, GObject)
+
+EmergeProcessManager *emerge_process_manager_new           (void);
+EmergeProcess        *emerge_process_manager_spawn         (EmergeProcessManager       *self,
+                                                            const char                 *label,
+                                                            const char * const         *argv,
+                                                            const EmergeProcessLimits  *limits,
+                                                            GError                    **error);
+EmergeProcess        *emerge_process_manager_spawn_with_fd (EmergeProcessManager       *self,
+                                                            const char                 *label,
+                                                            const char * const         *argv,
+                                                            const EmergeProcessLimits  *limits,
+                                                            int                         fd,
+                                                            GError                    **error);
+guint                 emerge_process_manager_get_n_running (EmergeProcessManager *self);
+void                  emerge_process_manager_cancel_all    (EmergeProcessManager *self);
+GPtrArray            *emerge_process_manager_pause_background (EmergeProcessManager *self);
+void                  emerge_process_manager_shutdown      (EmergeProcessManager *self,
+                                                            guint                 timeout_ms);
+
+G_END_DECLS
@@ -0,0 +1,764 @@
+#include "emerge-quant-bench.h"
+#include "emerge-batch-convert.h"
+#include "emerge-host-info.h"
+#include "emerge-image-metrics.h"
+
+#include <math.h>
+#include <string.h>
+#include <glib/gstdio.h>
+#include <json-glib/json-glib.h>
+
+/* Every quant type is scored against images from this one */
+#define BASELINE_TYPE "f16"
+
+/* PSNR of identical images is infinite; report it as this instead */
+#define PSNR_CAP 100.0
+
+/* A fixed workload so reports from different machines can be compared */
+static const char * const bench_prompts[] = {
+  "a photograph of an astronaut riding a horse on the moon",
+  "a watercolor painting of a lighthouse on a cliff at sunset",
+  "close-up portrait of an old fisherman, detailed skin texture, studio lighting",
+  NULL
+};
+
+static const char bench_negative_prompt[] = "blurry, low quality, watermark";
+
+static const gint64 bench_seeds[] = { 42, 1234 };
+
+typedef struct {
+  gchar     *quant_type;
+  gchar     *model_path;
+  guint64    file_size;
+  GPtrArray *jobs;        /* EmergeJob, one per prompt and seed */
+  GArray    *metrics;     /* EmergeImageMetrics, parallel to jobs */
+} QuantResult;
+
+struct _EmergeQuantBench
+{
+  GObject               parent_instance;
+
+  EmergeProcessManager *manager;
+  gchar                *sd_path;
+  gchar                *model_path;
+  gchar                *models_dir;
+  gchar                *work_dir;
+  EmergeJob            *template;
+
+  /* The baseline is always first */
+  GPtrArray            *results;
+
+  EmergeBatchConvert   *convert;
+  EmergeProcess        *process;
+  guint                 result_index;
+  guint                 job_index;
+  guint                 n_done;
+  guint                 n_total;
+
+  GCancellable         *cancellable;
+  gboolean              running;
+};
+
+G_DEFINE_TYPE (EmergeQuantBench, emerge_quant_bench, G_TYPE_OBJECT)
+
+enum {
+  SIGNAL_PROGRESS,
+  SIGNAL_FINISHED,
+  N_SIGNALS
+};
+
+static guint bench_signals[N_SIGNALS];
+
+static void bench_run_next (EmergeQuantBench *self);
+
+static void
+quant_result_free (gpointer data)
+{
+  QuantResult *result = data;
+
+  g_free (result->quant_type);
+  g_free (result->model_path);
+  g_ptr_array_unref (result->jobs);
+  g_array_unref (result->metrics);
+  g_free (result);
+}
+
+static void
+emerge_quant_bench_dispose (GObject *object)
+{
+  EmergeQuantBench *self = EMERGE_QUANT_BENCH (object);
+
+  if (self->convert) {
+    g_signal_handlers_disconnect_by_data (self->convert, self);
+    emerge_batch_convert_cancel (self->convert);
+    g_clear_object (&self->convert);
+  }
+
+  if (self->process) {
+    g_signal_handlers_disconnect_by_data (self->process, self);
+    emerge_process_cancel (self->process);
+    g_clear_object (&self->process);
+  }
+
+  G_OBJECT_CLASS (emerge_quant_bench_parent_class)->dispose (object);
+}
+
+static void
+emerge_quant_bench_finalize (GObject *object)
+{
+  EmergeQuantBench *self = EMERGE_QUANT_BENCH (object);
+
+  g_ptr_array_unref (self->results);
+  g_clear_pointer (&self->template, emerge_job_unref);
+  g_object_unref (self->cancellable);
+  g_object_unref (self->manager);
+  g_free (self->sd_path);
+  g_free (self->model_path);
+  g_free (self->models_dir);
+  g_free (self->work_dir);
+
+  G_OBJECT_CLASS (emerge_quant_bench_parent_class)->finalize (object);
+}
+
+static void
+emerge_quant_bench_class_init (EmergeQuantBenchClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->dispose = emerge_quant_bench_dispose;
+  object_class->finalize = emerge_quant_bench_finalize;
+
+  /* (stage, done, total); stage is "convert", "generate" or "compare" */
+  bench_signals[SIGNAL_PROGRESS] =
+    g_signal_new ("progress",
+                  G_TYPE_FROM_CLASS (klass),
+                  G_SIGNAL_RUN_LAST,
+                  0, NULL, NULL, NULL,
+                  G_TYPE_NONE, 3, G_TYPE_STRING, G_TYPE_UINT, G_TYPE_UINT);
+
+  /* Emitted once; the argument is FALSE if the run was cancelled */
+  bench_signals[SIGNAL_FINISHED] =
+    g_signal_new ("finished",
+                  G_TYPE_FROM_CLASS (klass),
+                  G_SIGNAL_RUN_LAST,
+                  0, NULL, NULL, NULL,
+                  G_TYPE_NONE, 1, G_TYPE_BOOLEAN);
+}
+
+static void
+emerge_quant_bench_init (EmergeQuantBench *self)
+{
+  self->results = g_ptr_array_new_with_free_func (quant_result_free);
+  self->cancellable = g_cancellable_new ();
+  self->template = emerge_job_new ();
+}
+
+/**
+ * emerge_quant_bench_new:
+ * @manager: process manager to run sd under
+ * @sd_path: the sd executable
+ * @model_path: the unquantized model to benchmark
+ * @models_dir: where conversions are written, and reused from
+ * @work_dir: where generated images and the report go
+ *
+ * Returns: (transfer full): a new benchmark comparing f16 with nothing
+ *   else until types are added
+ */
+EmergeQuantBench *
+emerge_quant_bench_new (EmergeProcessManager *manager,
+                        const char           *sd_path,
+                        const char           *model_path,
+                        const char           *models_dir,
+                        const char           *work_dir)
+{
+  EmergeQuantBench *self;
+
+  g_return_val_if_fail (EMERGE_IS_PROCESS_MANAGER (manager), NULL);
+  g_return_val_if_fail (sd_path != NULL && model_path != NULL, NULL);
+  g_return_val_if_fail (models_dir != NULL && work_dir != NULL, NULL);
+
+  self = g_object_new (EMERGE_TYPE_QUANT_BENCH, NULL);
+  self->manager = g_object_ref (manager);
+  self->sd_path = g_strdup (sd_path);
+  self->model_path = g_strdup (model_path);
+  self->models_dir = g_strdup (models_dir);
+  self->work_dir = g_strdup (work_dir);
+
+  emerge_quant_bench_add_quant_type (self, BASELINE_TYPE);
+
+  return self;
+}
+
+/* Size, steps, sampler and CFG scale are taken from @job */
+void
+emerge_quant_bench_set_template (EmergeQuantBench *self,
+                                 const EmergeJob  *job)
+{
+  g_return_if_fail (EMERGE_IS_QUANT_BENCH (self));
+  g_return_if_fail (!self->running);
+
+  g_clear_pointer (&self->template, emerge_job_unref);
+  self->template = emerge_job_copy (job);
+}
+
+void
+emerge_quant_bench_add_quant_type (EmergeQuantBench *self,
+                                   const char       *quant_type)
+{
+  QuantResult *result;
+
+  g_return_if_fail (EMERGE_IS_QUANT_BENCH (self));
+  g_return_if_fail (!self->running);
+
+  for (guint i = 0; i < self->results->len; i++) {
+    result = g_ptr_array_index (self->results, i);
+    if (g_strcmp0 (result->quant_type, quant_type) == 0)
+      return;
+  }
+
+  gchar *name = emerge_batch_convert_output_name (self->model_path, quant_type);
+
+  result = g_new0 (QuantResult, 1);
+  result->quant_type = g_strdup (quant_type);
+  result->model_path = g_build_filename (self->models_dir, name, NULL);
+  result->jobs = g_ptr_array_new_with_free_func ((GDestroyNotify) emerge_job_unref);
+  result->metrics = g_array_new (FALSE, TRUE, sizeof (EmergeImageMetrics));
+  g_ptr_array_add (self->results, result);
+
+  g_free (name);
+}
+
+static void
+bench_finish (EmergeQuantBench *self,
+              gboolean          completed)
+{
+  if (!self->running)
+    return;
+
+  /* Handlers commonly drop their reference to us */
+  g_object_ref (self);
+  self->running = FALSE;
+  g_signal_emit (self, bench_signals[SIGNAL_FINISHED], 0, completed);
+  g_object_unref (self);
+}
+
+/* Runs on a worker thread. The main thread leaves the results alone until
+ * the task completes, so the metrics arrays are written without locking. */
+static void
+bench_compare_thread (GTask        *task,
+                      gpointer      source_object,
+                      gpointer      task_data G_GNUC_UNUSED,
+                      GCancellable *cancellable)
+{
+  EmergeQuantBench *self = EMERGE_QUANT_BENCH (source_object);
+  QuantResult *baseline = g_ptr_array_index (self->results, 0);
+
+  for (guint i = 1; i < self->results->len; i++) {
+    QuantResult *result = g_ptr_array_index (self->results, i);
+
+    /* Nothing to compare against if either conversion is missing */
+    if (result->jobs->len != baseline->jobs->len)
+      continue;
+
+    for (guint j = 0; j < result->jobs->len; j++) {
+      EmergeJob *reference = g_ptr_array_index (baseline->jobs, j);
+      EmergeJob *test = g_ptr_array_index (result->jobs, j);
+      EmergeImageMetrics *metrics = &g_array_index (result->metrics, EmergeImageMetrics, j);
+      GError *error = NULL;
+
+      if (g_cancellable_is_cancelled (cancellable))
+        break;
+
+      if (reference->state != EMERGE_JOB_SUCCEEDED || test->state != EMERGE_JOB_SUCCEEDED)
+        continue;
+
+      if (!emerge_image_metrics_compare_files (reference->output_path, test->output_path,
+                                               metrics, &error)) {
+        g_warning ("Failed to compare %s: %s", test->output_path, error->message);
+        g_error_free (error);
+        metrics->psnr = NAN;
+        metrics->ssim = NAN;
+      }
+    }
+  }
+
+  g_task_return_boolean (task, !g_cancellable_is_cancelled (cancellable));
+}
+
+static void
+bench_compare_done_cb (GObject      *source_object,
+                       GAsyncResult *res,
+                       gpointer      user_data G_GNUC_UNUSED)
+{
+  EmergeQuantBench *self = EMERGE_QUANT_BENCH (source_object);
+  gboolean completed = g_task_propagate_boolean (G_TASK (res), NULL);
+
+  g_signal_emit (self, bench_signals[SIGNAL_PROGRESS], 0, "compare", 1, 1);
+  bench_finish (self, completed);
+}
+
+static void
+bench_start_compare (EmergeQuantBench *self)
+{
+  GTask *task;
+
+  for (guint i = 0; i < self->results->len; i++) {
+    QuantResult *result = g_ptr_array_index (self->results, i);
+    EmergeImageMetrics none = { NAN, NAN };
+
+    g_array_set_size (result->metrics, 0);
+    for (guint j = 0; j < result->jobs->len; j++)
+      g_array_append_val (result->metrics, none);
+  }
+
+  g_signal_emit (self, bench_signals[SIGNAL_PROGRESS], 0, "compare", 0, 1);
+
+  task = g_task_new (self, self->cancellable, bench_compare_done_cb, NULL);
+  g_task_run_in_thread (task, bench_compare_thread);
+  g_object_unref (task);
+}
+
+static void
+bench_job_exited_cb (EmergeProcess    *process,
+                     gint              wait_status G_GNUC_UNUSED,
+                     EmergeQuantBench *self)
+{
+  g_signal_handlers_disconnect_by_data (process, self);
+  g_clear_object (&self->process);
+
+  self->n_done++;
+  g_signal_emit (self, bench_signals[SIGNAL_PROGRESS], 0,
+                 "generate", self->n_done, self->n_total);
+
+  if (g_cancellable_is_cancelled (self->cancellable))
+    bench_finish (self, FALSE);
+  else
+    bench_run_next (self);
+}
+
+/* Generations run one at a time so they don't skew each other's timings */
+static void
+bench_run_next (EmergeQuantBench *self)
+{
+  while (self->result_index < self->results->len) {
+    QuantResult *result = g_ptr_array_index (self->results, self->result_index);
+
+    if (self->job_index >= result->jobs->len) {
+      self->result_index++;
+      self->job_index = 0;
+      continue;
+    }
+
+    EmergeJob *job = g_ptr_array_index (result->jobs, self->job_index++);
+    GError *error = NULL;
+
+    self->process = emerge_job_spawn (job, self->manager, self->sd_path, NULL, &error);
+    if (self->process == NULL) {
+      g_warning ("Failed to start benchmark generation: %s", error->message);
+      g_error_free (error);
+      self->n_done++;
+      continue;
+    }
+
+    g_signal_connect (self->process, "exited",
+                      G_CALLBACK (bench_job_exited_cb), self);
+    return;
+  }
+
+  bench_start_compare (self);
+}
+
+static void
+bench_queue_jobs (EmergeQuantBench *self)
+{
+  self->n_total = 0;
+
+  for (guint i = 0; i < self->results->len; i++) {
+    QuantResult *result = g_ptr_array_index (self->results, i);
+    GStatBuf st;
+
+    g_ptr_array_set_size (result->jobs, 0);
+
+    if (g_stat (result->model_path, &st) != 0 || st.st_size == 0) {
+      g_warning ("No %s conversion of %s, skipping it", result->quant_type, self->model_path);
+      continue;
+    }
+    result->file_size = st.st_size;
+
+    for (guint p = 0; bench_prompts[p] != NULL; p++) {
+      for (guint s = 0; s < G_N_ELEMENTS (bench_seeds); s++) {
+        EmergeJob *job = emerge_job_copy (self->template);
+        gchar *name = g_strdup_printf ("%s-p%u-s%" G_GINT64_FORMAT ".png",
+                                       result->quant_type, p, bench_seeds[s]);
+
+        g_free (job->model_path);
+        job->model_path = g_strdup (result->model_path);
+        g_free (job->prompt);
+        job->prompt = g_strdup (bench_prompts[p]);
+        g_free (job->negative_prompt);
+        job->negative_prompt = g_strdup (bench_negative_prompt);
+        job->seed = bench_seeds[s];
+        job->img2img = FALSE;
+        g_free (job->output_path);
+        job->output_path = g_build_filename (self->work_dir, name, NULL);
+        g_ptr_array_add (result->jobs, job);
+
+        g_free (name);
+        self->n_total++;
+      }
+    }
+  }
+}
+
+static void
+bench_convert_progress_cb (EmergeBatchConvert *convert G_GNUC_UNUSED,
+                           guint               n_done,
+                           guint               n_items,
+                           EmergeQuantBench   *self)
+{
+  g_signal_emit (self, bench_signals[SIGNAL_PROGRESS], 0, "convert", n_done, n_items);
+}
+
+static void
+bench_convert_finished_cb (EmergeBatchConvert *convert,
+                           EmergeQuantBench   *self)
+{
+  g_signal_handlers_disconnect_by_data (convert, self);
+  g_clear_object (&self->convert);
+
+  if (g_cancellable_is_cancelled (self->cancellable)) {
+    bench_finish (self, FALSE);
+    return;
+  }
+
+  bench_queue_jobs (self);
+  self->result_index = 0;
+  self->job_index = 0;
+  self->n_done = 0;
+  bench_run_next (self);
+}
+
+/**
+ * emerge_quant_bench_start:
+ * @self: a benchmark
+ *
+ * Converts the model to every type, reusing up to date conversions, then
+ * renders the fixed prompts and seeds with each and scores the images
+ * against the f16 ones. "finished" is emitted at the end.
+ */
+void
+emerge_quant_bench_start (EmergeQuantBench *self)
+{
+  g_return_if_fail (EMERGE_IS_QUANT_BENCH (self));
+  g_return_if_fail (!self->running);
+
+  g_mkdir_with_parents (self->work_dir, 0755);
+
+  self->running = TRUE;
+  self->convert = emerge_batch_convert_new (self->manager, self->sd_path);
+
+  for (guint i = 0; i < self->results->len; i++) {
+    QuantResult *result = g_ptr_array_index (self->results, i);
+
+    emerge_batch_convert_add (self->convert, self->model_path,
+                              result->quant_type, self->models_dir);
+  }
+
+  g_signal_connect (self->convert, "progress",
+                    G_CALLBACK (bench_convert_progress_cb), self);
+  g_signal_connect (self->convert, "finished",
+                    G_CALLBACK (bench_convert_finished_cb), self);
+
+  g_object_ref (self);
+  emerge_batch_convert_start (self->convert);
+  g_object_unref (self);
+}
+
+void
+emerge_quant_bench_cancel (EmergeQuantBench *self)
+{
+  g_return_if_fail (EMERGE_IS_QUANT_BENCH (self));
+
+  g_object_ref (self);
+
+  g_cancellable_cancel (self->cancellable);
+
+  if (self->convert)
+    emerge_batch_convert_cancel (self->convert);
+
+  if (self->process)
+    emerge_process_cancel (self->process);
+
+  g_object_unref (self);
+}
+
+gboolean
+emerge_quant_bench_is_running (EmergeQuantBench *self)
+{
+  g_return_val_if_fail (EMERGE_IS_QUANT_BENCH (self), FALSE);
+
+  return self->running;
+}
+
+typedef struct {
+  guint   n_images;
+  guint   n_failed;
+  double  load_seconds;
+  double  seconds_per_step;
+  guint64 peak_rss;
+  double  psnr;
+  double  ssim;
+  double  ssim_min;
+} QuantSummary;
+
+static double
+mean_or_nan (double sum,
+             guint  n)
+{
+  return n > 0 ? sum / n : NAN;
+}
+
+static void
+quant_result_summarize (QuantResult  *result,
+                        QuantSummary *summary)
+{
+  double load_sum = 0.0, step_sum = 0.0, psnr_sum = 0.0, ssim_sum = 0.0;
+  guint n_load = 0, n_step = 0, n_metrics = 0;
+
+  memset (summary, 0, sizeof *summary);
+  summary->ssim_min = NAN;
+
+  for (guint j = 0; j < result->jobs->len; j++) {
+    EmergeJob *job = g_ptr_array_index (result->jobs, j);
+
+    if (job->state != EMERGE_JOB_SUCCEEDED) {
+      summary->n_failed++;
+      continue;
+    }
+
+    summary->n_images++;
+    summary->peak_rss = MAX (summary->peak_rss, job->peak_rss);
+
+    if (job->stats && job->stats->load_seconds >= 0.0) {
+      load_sum += job->stats->load_seconds;
+      n_load++;
+    }
+
+    double step = job->stats ? emerge_sd_stats_get_mean_step (job->stats) : -1.0;
+    if (step > 0.0) {
+      step_sum += step;
+      n_step++;
+    }
+
+    if (j < result->metrics->len) {
+      EmergeImageMetrics *metrics = &g_array_index (result->metrics, EmergeImageMetrics, j);
+
+      if (!isnan (metrics->ssim)) {
+        psnr_sum += MIN (metrics->psnr, PSNR_CAP);
+        ssim_sum += metrics->ssim;
+        if (isnan (summary->ssim_min) || metrics->ssim < summary->ssim_min)
+          summary->ssim_min = metrics->ssim;
+        n_metrics++;
+      }
+    }
+  }
+
+  summary->load_seconds = mean_or_nan (load_sum, n_load);
+  summary->seconds_per_step = mean_or_nan (step_sum, n_step);
+  summary->psnr = mean_or_nan (psnr_sum, n_metrics);
+  summary->ssim = mean_or_nan (ssim_sum, n_metrics);
+}
+
+/* JSON has no NaN, so unmeasured values are written as null */
+static void
+add_double_or_null (JsonBuilder *builder,
+                    const char  *member,
+                    double       value)
+{
+  json_builder_set_member_name (builder, member);
+  if (isnan (value))
+    json_builder_add_null_value (builder);
+  else
+    json_builder_add_double_value (builder, value);
+}
+
+static void
+append_table_value (GString    *table,
+                    const char *format,
+                    double      value)
+{
+  if (isnan (value))
+    g_string_append_printf (table, "%10s", "-");
+  else
+    g_string_append_printf (table, format, value);
+}
+
+/**
+ * emerge_quant_bench_write_report:
+ * @self: a finished benchmark
+ * @json_path: where to write the machine readable report
+ * @text_path: (nullable): where to write a plain text table
+ * @error: return location for an error
+ *
+ * The report records the host, the workload and, per quant type, file
+ * size, model load time, sampling speed, peak RSS and mean PSNR/SSIM
+ * against the f16 images, so runs on different hardware can be compared.
+ *
+ * Returns: %TRUE on success
+ */
+gboolean
+emerge_quant_bench_write_report (EmergeQuantBench  *self,
+                                 const char        *json_path,
+                                 const char        *text_path,
+                                 GError           **error)
+{
+  g_autoptr(EmergeHostInfo) host = emerge_host_info_get ();
+  g_autofree gchar *host_description = emerge_host_info_describe (host);
+  JsonBuilder *builder;
+  JsonGenerator *generator;
+  JsonNode *root;
+  GString *table;
+  double baseline_step = NAN;
+  gboolean ok;
+
+  g_return_val_if_fail (EMERGE_IS_QUANT_BENCH (self), FALSE);
+
+  builder = json_builder_new ();
+  json_builder_begin_object (builder);
+
+  json_builder_set_member_name (builder, "model");
+  json_builder_add_string_value (builder, self->model_path);
+
+  emerge_host_info_to_json (host, builder);
+
+  json_builder_set_member_name (builder, "width");
+  json_builder_add_int_value (builder, self->template->width);
+  json_builder_set_member_name (builder, "height");
+  json_builder_add_int_value (builder, self->template->height);
+  json_builder_set_member_name (builder, "steps");
+  json_builder_add_int_value (builder, self->template->steps);
+  json_builder_set_member_name (builder, "sampling_method");
+  json_builder_add_string_value (builder, self->template->sampling_method);
+  json_builder_set_member_name (builder, "cfg_scale");
+  json_builder_add_double_value (builder, self->template->cfg_scale);
+
+  json_builder_set_member_name (builder, "prompts");
+  json_builder_begin_array (builder);
+  for (guint p = 0; bench_prompts[p] != NULL; p++)
+    json_builder_add_string_value (builder, bench_prompts[p]);
+  json_builder_end_array (builder);
+
+  json_builder_set_member_name (builder, "negative_prompt");
+  json_builder_add_string_value (builder, bench_negative_prompt);
+
+  json_builder_set_member_name (builder, "seeds");
+  json_builder_begin_array (builder);
+  for (guint s = 0; s < G_N_ELEMENTS (bench_seeds); s++)
+    json_builder_add_int_value (builder, bench_seeds[s]);
+  json_builder_end_array (builder);
+
+  table = g_string_new (NULL);
+  g_string_append_printf (table, "Model:    %s\n", self->model_path);
+  g_string_append_printf (table, "Host:     %s\n", host_description);
+  g_string_append_printf (table, "Workload: %dx%d, %d steps, %s, %u prompts x %u seeds\n\n",
+                          self->template->width, self->template->height,
+                          self->template->steps, self->template->sampling_method,
+                          g_strv_length ((gchar **) bench_prompts),
+                          (guint) G_N_ELEMENTS (bench_seeds));
+  g_string_append_printf (table, "%-6s %10s %10s %10s %10s %10s %10s %10s %10s\n",
+                          "type", "size", "load s", "it/s", "speedup",
+                          "peak RSS", "PSNR dB", "SSIM", "SSIM min");
+
+  json_builder_set_member_name (builder, "results");
+  json_builder_begin_array (builder);
+
+  for (guint i = 0; i < self->results->len; i++) {
+    QuantResult *result = g_ptr_array_index (self->results, i);
+    QuantSummary summary;
+    double speedup;
+
+    quant_result_summarize (result, &summary);
+
+    g_autofree gchar *size = g_format_size (result->file_size);
+    g_autofree gchar *rss = g_format_size (summary.peak_rss);
+
+    if (i == 0)
+      baseline_step = summary.seconds_per_step;
+    speedup = baseline_step / summary.seconds_per_step;
+
+    json_builder_begin_object (builder);
+    json_builder_set_member_name (builder, "type");
+    json_builder_add_string_value (builder, result->quant_type);
+    json_builder_set_member_name (builder, "model_path");
+    json_builder_add_string_value (builder, result->model_path);
+    json_builder_set_member_name (builder, "file_size");
+    json_builder_add_int_value (builder, result->file_size);
+    json_builder_set_member_name (builder, "images");
+    json_builder_add_int_value (builder, summary.n_images);
+    json_builder_set_member_name (builder, "failed");
+    json_builder_add_int_value (builder, summary.n_failed);
+    add_double_or_null (builder, "load_seconds", summary.load_seconds);
+    add_double_or_null (builder, "seconds_per_step", summary.seconds_per_step);
+    add_double_or_null (builder, "it_per_s", 1.0 / summary.seconds_per_step);
+    add_double_or_null (builder, "speedup", speedup);
+    json_builder_set_member_name (builder, "peak_rss");
+    json_builder_add_int_value (builder, summary.peak_rss);
+    add_double_or_null (builder, "psnr", summary.psnr);
+    add_double_or_null (builder, "ssim", summary.ssim);
+    add_double_or_null (builder, "ssim_min", summary.ssim_min);
+
+    json_builder_set_member_name (builder, "jobs");
+    json_builder_begin_array (builder);
+    for (guint j = 0; j < result->jobs->len; j++) {
+      EmergeJob *job = g_ptr_array_index (result->jobs, j);
+      JsonNode *node = emerge_job_to_json (job);
+
+      if (j < result->metrics->len) {
+        EmergeImageMetrics *metrics = &g_array_index (result->metrics, EmergeImageMetrics, j);
+        JsonObject *object = json_node_get_object (node);
+
+        if (!isnan (metrics->ssim)) {
+          json_object_set_double_member (object, "psnr", MIN (metrics->psnr, PSNR_CAP));
+          json_object_set_double_member (object, "ssim", metrics->ssim);
+        }
+      }
+
+      json_builder_add_value (builder, node);
+    }
+    json_builder_end_array (builder);
+
+    json_builder_end_object (builder);
+
+    g_string_append_printf (table, "%-6s %10s", result->quant_type, size);
+    append_table_value (table, " %9.2fs", summary.load_seconds);
+    append_table_value (table, " %10.3f", 1.0 / summary.seconds_per_step);
+    append_table_value (table, " %9.2fx", speedup);
+    g_string_append_printf (table, " %10s", rss);
+    append_table_value (table, " %10.2f", i == 0 ? NAN : summary.psnr);
+    append_table_value (table, " %10.4f", i == 0 ? NAN : summary.ssim);
+    append_table_value (table, " %10.4f", i == 0 ? NAN : summary.ssim_min);
+    if (summary.n_failed > 0)
+      g_string_append_printf (table, "  (%u failed)", summary.n_failed);
+    g_string_append_c (table, '\n');
+  }
+
+  json_builder_end_array (builder);
+  json_builder_end_object (builder);
+
+  root = json_builder_get_root (builder);
+  generator = json_generator_new ();
+  json_generator_set_root (generator, root);
+  json_generator_set_pretty (generator, TRUE);
+
+  ok = json_generator_to_file (generator, json_path, error);
+
+  if (ok && text_path != NULL)
+    ok = g_file_set_contents (text_path, table->str, table->len, error);
+
+  g_string_free (table, TRUE);
+  json_node_free (root);
+  g_object_unref (generator);
+  g_object_unref (builder);
+
+  return ok;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <gio/gio.h>
+
+#include "emerge-job.h"
+#include "emerge-process-manager.h"
+
+G_BEGIN_DECLS
+
+#define EMERGE_TYPE_QUANT_BENCH (emerge_quant_bench_get_type())
+
+G_DECLARE_FINAL_TYPE (EmergeQuantBench, emerge_quant_bench, EMERGE, QUANT_BENCH, GObject)
+
+EmergeQuantBench *emerge_quant_bench_new             (EmergeProcessManager *manager,
+                                                      const char           *sd_path,
+                                                      const char           *model_path,
+                                                      const char           *models_dir,
+                                                      const char           *work_dir);
+void              emerge_quant_bench_set_template    (EmergeQuantBench     *self,
+                                                      const EmergeJob      *job);
+void              emerge_quant_bench_add_quant_type  (EmergeQuantBench     *self,
+                                                      const char           *quant_type);
+void              emerge_quant_bench_start           (EmergeQuantBench     *self);
+void              emerge_quant_bench_cancel          (EmergeQuantBench     *self);
+gboolean          emerge_quant_bench_is_running      (EmergeQuantBench     *self);
+gboolean          emerge_quant_bench_write_report    (EmergeQuantBench     *self,
+                                                      const char           *json_path,
+                                                      const char           *text_path,
+                                                      GError              **error);
+
+G_END_DECLS
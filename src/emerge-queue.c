@@ -0,0 +1,934 @@
+#include "emerge-queue.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <json-glib/json-glib.h>
+
+/* The journal is rewritten with only what is still pending once it has
+ * this many records and most of them are about finished jobs */
+#define COMPACT_MIN_RECORDS 1024
+
+/* Progress within a job is recorded at most this often */
+#define CHECKPOINT_INTERVAL_US (2 * G_USEC_PER_SEC)
+
+typedef struct {
+  EmergeJob *job;         /* as submitted */
+  gchar     *hash;        /* NULL if the job's image isn't reproducible */
+  gboolean   started;
+  gint       last_step;
+  gboolean   finished;
+} QueueEntry;
+
+/* Something for the writer thread to put in the journal */
+typedef struct {
+  GBytes   *data;
+  gboolean  sync;       /* make sure it is on disk before going on */
+  gboolean  replace;    /* the whole journal, rather than lines to append */
+} JournalWrite;
+
+struct _EmergeQueue
+{
+  GObject      parent_instance;
+
+  gchar       *journal_path;
+  guint        n_records;
+
+  /* Records made since the writer was last handed some, so everything one
+   * action records is written, and synced, at once */
+  GString     *unwritten;
+  gboolean     unwritten_sync;
+  guint        flush_id;
+
+  /* A single writer thread, so records land in the order they were made.
+   * The journal descriptor is only used from it. */
+  GThreadPool *writer;
+  int          journal_fd;
+  GMutex       mutex;
+  GCond        cond;
+  guint        n_queued;      /* writes not done yet */
+  GError      *write_error;   /* why the last write failed, or NULL */
+
+  GPtrArray   *pending;     /* QueueEntry, in the order they were submitted */
+  GHashTable  *done;        /* hashes of the images finished this batch */
+  guint        n_finished;
+  guint64      last_id;
+  gint64       last_checkpoint_time;
+};
+
+G_DEFINE_TYPE (EmergeQueue, emerge_queue, G_TYPE_OBJECT)
+
+enum {
+  CHANGED,
+  N_SIGNALS
+};
+
+static guint signals[N_SIGNALS];
+
+static void
+queue_entry_free (gpointer data)
+{
+  QueueEntry *entry = data;
+
+  emerge_job_unref (entry->job);
+  g_free (entry->hash);
+  g_free (entry);
+}
+
+static void queue_flush (EmergeQueue *self);
+
+static void
+emerge_queue_finalize (GObject *object)
+{
+  EmergeQueue *self = EMERGE_QUEUE (object);
+
+  /* Whatever was recorded still goes into the journal */
+  queue_flush (self);
+  g_thread_pool_free (self->writer, FALSE, TRUE);
+  g_string_free (self->unwritten, TRUE);
+  g_clear_error (&self->write_error);
+  g_mutex_clear (&self->mutex);
+  g_cond_clear (&self->cond);
+
+  if (self->journal_fd >= 0)
+    close (self->journal_fd);
+  g_free (self->journal_path);
+  g_ptr_array_unref (self->pending);
+  g_hash_table_unref (self->done);
+
+  G_OBJECT_CLASS (emerge_queue_parent_class)->finalize (object);
+}
+
+static void
+emerge_queue_class_init (EmergeQueueClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->finalize = emerge_queue_finalize;
+
+  /**
+   * EmergeQueue::changed:
+   *
+   * Emitted when jobs are added, or one is started or finished.
+   */
+  signals[CHANGED] = g_signal_new ("changed",
+                                   G_TYPE_FROM_CLASS (klass),
+                                   G_SIGNAL_RUN_LAST,
+                                   0, NULL, NULL, NULL,
+                                   G_TYPE_NONE, 0);
+}
+
+static void queue_write_thread (gpointer data, gpointer user_data);
+
+static void
+emerge_queue_init (EmergeQueue *self)
+{
+  self->journal_fd = -1;
+  self->unwritten = g_string_new (NULL);
+  self->writer = g_thread_pool_new (queue_write_thread, self, 1, FALSE, NULL);
+  g_mutex_init (&self->mutex);
+  g_cond_init (&self->cond);
+  self->pending = g_ptr_array_new_with_free_func (queue_entry_free);
+  self->done = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+}
+
+/**
+ * emerge_queue_new:
+ * @journal_path: where the queue is recorded
+ *
+ * Creates a queue of jobs to run one after another. Every change is
+ * appended to the journal at @journal_path, so after a crash
+ * emerge_queue_load() brings back every job that hadn't finished. The
+ * journal is written on a thread of its own, so recording a change never
+ * waits on the disk; the records one action makes are written together
+ * once the main loop is idle, and synced once if any of them has to be.
+ *
+ * Returns: (transfer full): a new queue
+ */
+EmergeQueue *
+emerge_queue_new (const char *journal_path)
+{
+  EmergeQueue *self;
+
+  g_return_val_if_fail (journal_path != NULL, NULL);
+
+  self = g_object_new (EMERGE_TYPE_QUEUE, NULL);
+  self->journal_path = g_strdup (journal_path);
+
+  return self;
+}
+
+static QueueEntry *
+queue_find (EmergeQueue *self,
+            guint64      id)
+{
+  for (guint i = 0; i < self->pending->len; i++) {
+    QueueEntry *entry = g_ptr_array_index (self->pending, i);
+
+    if (entry->job->id == id)
+      return entry;
+  }
+
+  return NULL;
+}
+
+/* Writer thread only */
+static gboolean
+queue_append (EmergeQueue  *self,
+              GBytes       *bytes,
+              gboolean      sync,
+              GError      **error)
+{
+  gsize length;
+  const char *data = g_bytes_get_data (bytes, &length);
+
+  if (self->journal_fd < 0) {
+    gchar *dir = g_path_get_dirname (self->journal_path);
+
+    g_mkdir_with_parents (dir, 0755);
+    g_free (dir);
+
+    self->journal_fd = open (self->journal_path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (self->journal_fd < 0) {
+      int saved_errno = errno;
+
+      g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (saved_errno),
+                   "Failed to open %s: %s", self->journal_path, g_strerror (saved_errno));
+      return FALSE;
+    }
+  }
+
+  while (length > 0) {
+    gssize written = write (self->journal_fd, data, length);
+
+    if (written < 0) {
+      int saved_errno = errno;
+
+      if (saved_errno == EINTR)
+        continue;
+
+      g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (saved_errno),
+                   "Failed to write %s: %s", self->journal_path, g_strerror (saved_errno));
+      return FALSE;
+    }
+
+    data += written;
+    length -= written;
+  }
+
+  if (sync && fdatasync (self->journal_fd) < 0) {
+    int saved_errno = errno;
+
+    g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (saved_errno),
+                 "Failed to sync %s: %s", self->journal_path, g_strerror (saved_errno));
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* Serializes the object @builder holds as one journal line onto @lines */
+static void
+queue_add_line (GString     *lines,
+                JsonBuilder *builder)
+{
+  JsonGenerator *generator = json_generator_new ();
+  JsonNode *root = json_builder_get_root (builder);
+  gchar *line;
+  gsize length;
+
+  json_generator_set_root (generator, root);
+  line = json_generator_to_data (generator, &length);
+  g_string_append_len (lines, line, length);
+  g_string_append_c (lines, '\n');
+
+  g_free (line);
+  json_node_unref (root);
+  g_object_unref (generator);
+}
+
+static void
+queue_add_record (GString    *lines,
+                  const char *op,
+                  guint64     id,
+                  const char *member,
+                  JsonNode   *value)
+{
+  JsonBuilder *builder = json_builder_new ();
+
+  json_builder_begin_object (builder);
+  json_builder_set_member_name (builder, "op");
+  json_builder_add_string_value (builder, op);
+  if (id != 0) {
+    json_builder_set_member_name (builder, "id");
+    json_builder_add_int_value (builder, id);
+  }
+  if (member != NULL) {
+    json_builder_set_member_name (builder, member);
+    json_builder_add_value (builder, value);
+  }
+  json_builder_end_object (builder);
+
+  queue_add_line (lines, builder);
+  g_object_unref (builder);
+}
+
+static void
+queue_add_submit_record (GString    *lines,
+                         QueueEntry *entry)
+{
+  JsonBuilder *builder = json_builder_new ();
+
+  json_builder_begin_object (builder);
+  json_builder_set_member_name (builder, "op");
+  json_builder_add_string_value (builder, "submit");
+  json_builder_set_member_name (builder, "id");
+  json_builder_add_int_value (builder, entry->job->id);
+  if (entry->hash != NULL) {
+    json_builder_set_member_name (builder, "hash");
+    json_builder_add_string_value (builder, entry->hash);
+  }
+  json_builder_set_member_name (builder, "job");
+  json_builder_add_value (builder, emerge_job_to_json (entry->job));
+  json_builder_end_object (builder);
+
+  queue_add_line (lines, builder);
+  g_object_unref (builder);
+}
+
+/* Writer thread only. The new journal is complete before it takes the
+ * old one's place, so a crash during compaction loses nothing. */
+static gboolean
+queue_replace (EmergeQueue  *self,
+               GBytes       *bytes,
+               GError      **error)
+{
+  gsize length;
+  const char *data = g_bytes_get_data (bytes, &length);
+
+  if (!g_file_set_contents_full (self->journal_path, data, length,
+                                 G_FILE_SET_CONTENTS_CONSISTENT, 0644, error))
+    return FALSE;
+
+  if (self->journal_fd >= 0) {
+    close (self->journal_fd);
+    self->journal_fd = -1;
+  }
+
+  return TRUE;
+}
+
+static void
+queue_write_thread (gpointer data,
+                    gpointer user_data)
+{
+  JournalWrite *write = data;
+  EmergeQueue *self = user_data;
+  GError *error = NULL;
+
+  /* The queue goes on in memory; it just won't survive a crash */
+  if (write->replace ? !queue_replace (self, write->data, &error)
+                     : !queue_append (self, write->data, write->sync, &error))
+    g_warning ("Failed to %s the queue: %s",
+               write->replace ? "compact" : "record", error->message);
+
+  g_bytes_unref (write->data);
+  g_free (write);
+
+  g_mutex_lock (&self->mutex);
+  g_clear_error (&self->write_error);
+  self->write_error = error;
+  self->n_queued--;
+  g_cond_broadcast (&self->cond);
+  g_mutex_unlock (&self->mutex);
+}
+
+static void
+queue_push_write (EmergeQueue *self,
+                  GString     *lines,
+                  gboolean     sync,
+                  gboolean     replace)
+{
+  JournalWrite *write = g_new0 (JournalWrite, 1);
+
+  write->data = g_string_free_to_bytes (lines);
+  write->sync = sync;
+  write->replace = replace;
+
+  g_mutex_lock (&self->mutex);
+  self->n_queued++;
+  g_mutex_unlock (&self->mutex);
+
+  g_thread_pool_push (self->writer, write, NULL);
+}
+
+/* Hands the records made so far to the writer thread */
+static void
+queue_submit_unwritten (EmergeQueue *self)
+{
+  g_clear_handle_id (&self->flush_id, g_source_remove);
+
+  if (self->unwritten->len == 0)
+    return;
+
+  queue_push_write (self, self->unwritten, self->unwritten_sync, FALSE);
+  self->unwritten = g_string_new (NULL);
+  self->unwritten_sync = FALSE;
+}
+
+static gboolean
+queue_flush_cb (gpointer user_data)
+{
+  EmergeQueue *self = user_data;
+
+  self->flush_id = 0;
+  queue_submit_unwritten (self);
+
+  return G_SOURCE_REMOVE;
+}
+
+/* Writes out everything recorded and waits until it is in the journal */
+static void
+queue_flush (EmergeQueue *self)
+{
+  queue_submit_unwritten (self);
+
+  g_mutex_lock (&self->mutex);
+  while (self->n_queued > 0)
+    g_cond_wait (&self->cond, &self->mutex);
+  g_mutex_unlock (&self->mutex);
+}
+
+/* Records @n_lines journal @lines. Submissions and results have to survive
+ * a session crash or power loss, so they are written with @sync; progress
+ * records can go missing. */
+static void
+queue_write (EmergeQueue *self,
+             GString     *lines,
+             guint        n_lines,
+             gboolean     sync)
+{
+  g_string_append_len (self->unwritten, lines->str, lines->len);
+  self->unwritten_sync |= sync;
+  self->n_records += n_lines;
+
+  if (self->flush_id == 0)
+    self->flush_id = g_idle_add_full (G_PRIORITY_HIGH_IDLE, queue_flush_cb, self, NULL);
+}
+
+/* Replaces the journal with one that only describes what is still
+ * pending. It stands for every record made so far, so those not written
+ * yet are dropped. */
+static void
+queue_compact (EmergeQueue *self)
+{
+  GString *lines = g_string_new (NULL);
+  GHashTableIter iter;
+  gpointer hash;
+  guint n_lines = 0;
+
+  /* Finished images only matter while jobs that may repeat them remain */
+  if (self->pending->len == 0) {
+    g_hash_table_remove_all (self->done);
+    self->n_finished = 0;
+  }
+
+  /* Ids aren't reused, or a client holding an old one would reach a new job */
+  queue_add_record (lines, "ids", 0, "last_id", json_node_init_int (json_node_alloc (), self->last_id));
+  n_lines++;
+
+  g_hash_table_iter_init (&iter, self->done);
+  while (g_hash_table_iter_next (&iter, &hash, NULL)) {
+    queue_add_record (lines, "done", 0, "hash", json_node_init_string (json_node_alloc (), hash));
+    n_lines++;
+  }
+
+  for (guint i = 0; i < self->pending->len; i++) {
+    queue_add_submit_record (lines, g_ptr_array_index (self->pending, i));
+    n_lines++;
+  }
+
+  g_clear_handle_id (&self->flush_id, g_source_remove);
+  g_string_truncate (self->unwritten, 0);
+  self->unwritten_sync = FALSE;
+
+  queue_push_write (self, lines, FALSE, TRUE);
+  self->n_records = n_lines;
+}
+
+static void
+queue_maybe_compact (EmergeQueue *self)
+{
+  guint n_live = self->pending->len + g_hash_table_size (self->done);
+
+  if (self->pending->len == 0 ||
+      (self->n_records >= COMPACT_MIN_RECORDS && self->n_records > 2 * n_live))
+    queue_compact (self);
+}
+
+/**
+ * emerge_queue_load:
+ * @self: a queue
+ * @error: return location for an error
+ *
+ * Replays the journal. Jobs that were submitted and never finished are
+ * pending again, in their original order; one that was interrupted while
+ * running starts over. A journal cut short by a crash loses at most the
+ * record being written.
+ *
+ * Returns: %FALSE if the journal exists but couldn't be read
+ */
+gboolean
+emerge_queue_load (EmergeQueue  *self,
+                   GError      **error)
+{
+  JsonParser *parser;
+  GHashTable *by_id;
+  gchar *contents = NULL;
+  gsize length;
+  GError *local_error = NULL;
+  guint n_bad = 0, n_kept = 0;
+
+  g_return_val_if_fail (EMERGE_IS_QUEUE (self), FALSE);
+
+  if (!g_file_get_contents (self->journal_path, &contents, &length, &local_error)) {
+    if (g_error_matches (local_error, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
+      g_error_free (local_error);
+      return TRUE;
+    }
+
+    g_propagate_error (error, local_error);
+    return FALSE;
+  }
+
+  parser = json_parser_new ();
+  by_id = g_hash_table_new (g_int64_hash, g_int64_equal);
+  g_ptr_array_set_size (self->pending, 0);
+  g_hash_table_remove_all (self->done);
+  self->n_records = 0;
+
+  for (char *line = contents, *end; line < contents + length; line = end + 1) {
+    JsonObject *object;
+    QueueEntry *entry = NULL;
+    const char *op;
+
+    end = memchr (line, '\n', contents + length - line);
+    if (end == NULL)
+      end = contents + length;
+
+    if (end == line)
+      continue;
+
+    self->n_records++;
+
+    if (!json_parser_load_from_data (parser, line, end - line, NULL) ||
+        !JSON_NODE_HOLDS_OBJECT (json_parser_get_root (parser))) {
+      n_bad++;
+      continue;
+    }
+
+    object = json_node_get_object (json_parser_get_root (parser));
+    op = json_object_get_string_member_with_default (object, "op", "");
+
+    if (g_str_equal (op, "done")) {
+      const char *hash = json_object_get_string_member_with_default (object, "hash", NULL);
+
+      if (hash != NULL)
+        g_hash_table_add (self->done, g_strdup (hash));
+      continue;
+    }
+
+    if (g_str_equal (op, "ids")) {
+      self->last_id = MAX (self->last_id,
+                           (guint64) json_object_get_int_member_with_default (object, "last_id", 0));
+      continue;
+    }
+
+    if (json_object_has_member (object, "id")) {
+      guint64 id = json_object_get_int_member (object, "id");
+
+      self->last_id = MAX (self->last_id, id);
+      if (!g_str_equal (op, "submit"))
+        entry = g_hash_table_lookup (by_id, &id);
+    }
+
+    if (g_str_equal (op, "submit") && json_object_has_member (object, "id") &&
+        json_object_get_member (object, "job") != NULL &&
+        JSON_NODE_HOLDS_OBJECT (json_object_get_member (object, "job"))) {
+      entry = g_new0 (QueueEntry, 1);
+      entry->job = emerge_job_new ();
+      emerge_job_apply_json (entry->job, json_object_get_object_member (object, "job"));
+      entry->job->id = json_object_get_int_member (object, "id");
+      entry->hash = g_strdup (json_object_get_string_member_with_default (object, "hash", NULL));
+      g_ptr_array_add (self->pending, entry);
+      g_hash_table_insert (by_id, &entry->job->id, entry);
+    } else if (entry == NULL) {
+      n_bad++;
+    } else if (g_str_equal (op, "start")) {
+      entry->started = TRUE;
+    } else if (g_str_equal (op, "step")) {
+      entry->last_step = json_object_get_int_member_with_default (object, "step", 0);
+    } else if (g_str_equal (op, "finish")) {
+      const char *state = json_object_get_string_member_with_default (object, "state", "");
+
+      entry->finished = TRUE;
+      if (entry->hash != NULL &&
+          (g_str_equal (state, "succeeded") || g_str_equal (state, "skipped")))
+        g_hash_table_add (self->done, g_strdup (entry->hash));
+      self->n_finished++;
+    } else {
+      n_bad++;
+    }
+  }
+
+  if (n_bad > 0)
+    g_warning ("Skipped %u unreadable records in %s", n_bad, self->journal_path);
+
+  /* Dropped in one pass rather than one search per finished job */
+  for (guint i = 0; i < self->pending->len; i++) {
+    QueueEntry *entry = g_ptr_array_index (self->pending, i);
+
+    if (entry->finished) {
+      queue_entry_free (entry);
+      continue;
+    }
+
+    if (entry->started) {
+      g_print ("Queued job %" G_GUINT64_FORMAT " was interrupted at step %d of %d; running it again\n",
+               entry->job->id, entry->last_step, entry->job->steps);
+      entry->started = FALSE;
+    }
+
+    self->pending->pdata[n_kept++] = entry;
+  }
+  self->pending->len = n_kept;
+
+  g_hash_table_unref (by_id);
+  g_object_unref (parser);
+  g_free (contents);
+
+  queue_maybe_compact (self);
+  g_signal_emit (self, signals[CHANGED], 0);
+
+  return TRUE;
+}
+
+/**
+ * emerge_queue_submit:
+ * @self: a queue
+ * @job: the job to add
+ * @error: return location for an error
+ *
+ * Adds a copy of @job to the end of the queue. Fails if the last write
+ * to the journal did, since the job couldn't be brought back after a
+ * crash either.
+ *
+ * Returns: the id the job was given, or 0 if it couldn't be recorded
+ */
+guint64
+emerge_queue_submit (EmergeQueue      *self,
+                     const EmergeJob  *job,
+                     GError          **error)
+{
+  QueueEntry *entry;
+  GString *lines;
+  gboolean ok = TRUE;
+
+  g_return_val_if_fail (EMERGE_IS_QUEUE (self), 0);
+  g_return_val_if_fail (job != NULL, 0);
+
+  g_mutex_lock (&self->mutex);
+  if (self->write_error != NULL) {
+    g_set_error_literal (error, self->write_error->domain, self->write_error->code,
+                         self->write_error->message);
+    ok = FALSE;
+  }
+  g_mutex_unlock (&self->mutex);
+
+  if (!ok)
+    return 0;
+
+  entry = g_new0 (QueueEntry, 1);
+  entry->job = emerge_job_copy (job);
+  entry->job->id = ++self->last_id;
+  entry->hash = emerge_job_hash (job);
+
+  lines = g_string_new (NULL);
+  queue_add_submit_record (lines, entry);
+  queue_write (self, lines, 1, TRUE);
+  g_string_free (lines, TRUE);
+
+  g_ptr_array_add (self->pending, entry);
+  g_signal_emit (self, signals[CHANGED], 0);
+
+  return entry->job->id;
+}
+
+/**
+ * emerge_queue_start_next:
+ * @self: a queue
+ *
+ * Takes the first job that hasn't been started. Jobs whose image was
+ * already made by an earlier job in the batch are skipped.
+ *
+ * Returns: (transfer full) (nullable): a copy of the job to run, with its
+ *   id, or %NULL if there is nothing left to start
+ */
+EmergeJob *
+emerge_queue_start_next (EmergeQueue *self)
+{
+  GString *lines;
+  EmergeJob *job = NULL;
+  gboolean any_finished = FALSE;
+  guint n_lines = 0;
+  guint i = 0;
+
+  g_return_val_if_fail (EMERGE_IS_QUEUE (self), NULL);
+
+  lines = g_string_new (NULL);
+
+  while (i < self->pending->len) {
+    QueueEntry *entry = g_ptr_array_index (self->pending, i);
+
+    if (entry->started) {
+      i++;
+      continue;
+    }
+
+    if (entry->hash != NULL && g_hash_table_contains (self->done, entry->hash)) {
+      g_print ("Skipping queued job %" G_GUINT64_FORMAT ", its image was already made\n",
+               entry->job->id);
+      queue_add_record (lines, "finish", entry->job->id, "state",
+                        json_node_init_string (json_node_alloc (), "skipped"));
+      n_lines++;
+      any_finished = TRUE;
+      self->n_finished++;
+      g_ptr_array_remove_index (self->pending, i);
+      continue;
+    }
+
+    entry->started = TRUE;
+    entry->last_step = 0;
+    queue_add_record (lines, "start", entry->job->id, NULL, NULL);
+    n_lines++;
+
+    job = emerge_job_copy (entry->job);
+    job->id = entry->job->id;
+    break;
+  }
+
+  if (n_lines > 0) {
+    queue_write (self, lines, n_lines, any_finished);
+    self->last_checkpoint_time = g_get_monotonic_time ();
+    queue_maybe_compact (self);
+    g_signal_emit (self, signals[CHANGED], 0);
+  }
+  g_string_free (lines, TRUE);
+
+  return job;
+}
+
+/* Notes how far the running job @id has got. sd can't pick a run up
+ * halfway, so this is for reporting where an interrupted batch stopped. */
+void
+emerge_queue_checkpoint (EmergeQueue *self,
+                         guint64      id,
+                         gint         step)
+{
+  QueueEntry *entry;
+  GString *lines;
+  gint64 now = g_get_monotonic_time ();
+
+  g_return_if_fail (EMERGE_IS_QUEUE (self));
+
+  entry = queue_find (self, id);
+  if (entry == NULL || step <= entry->last_step)
+    return;
+
+  entry->last_step = step;
+  if (now - self->last_checkpoint_time < CHECKPOINT_INTERVAL_US)
+    return;
+  self->last_checkpoint_time = now;
+
+  lines = g_string_new (NULL);
+  queue_add_record (lines, "step", id, "step", json_node_init_int (json_node_alloc (), step));
+  queue_write (self, lines, 1, FALSE);
+  g_string_free (lines, TRUE);
+}
+
+/* Records that job @id, as started by emerge_queue_start_next(), is done
+ * with, whatever @state it ended in */
+void
+emerge_queue_finish (EmergeQueue    *self,
+                     guint64         id,
+                     EmergeJobState  state)
+{
+  QueueEntry *entry;
+  GString *lines;
+
+  g_return_if_fail (EMERGE_IS_QUEUE (self));
+
+  entry = queue_find (self, id);
+  if (entry == NULL)
+    return;
+
+  lines = g_string_new (NULL);
+  queue_add_record (lines, "finish", id, "state",
+                    json_node_init_string (json_node_alloc (), emerge_job_state_to_string (state)));
+  queue_write (self, lines, 1, TRUE);
+  g_string_free (lines, TRUE);
+
+  /* Only an image that was actually made stands in for later duplicates */
+  if (entry->hash != NULL && state == EMERGE_JOB_SUCCEEDED)
+    g_hash_table_add (self->done, g_strdup (entry->hash));
+  self->n_finished++;
+  g_ptr_array_remove (self->pending, entry);
+
+  queue_maybe_compact (self);
+  g_signal_emit (self, signals[CHANGED], 0);
+}
+
+/**
+ * emerge_queue_cancel:
+ * @self: a queue
+ * @id: a job that hasn't been started
+ *
+ * Drops job @id from the queue. A job that is already running has to be
+ * stopped by whoever runs it, which then calls emerge_queue_finish().
+ *
+ * Returns: %TRUE if @id was waiting and has been dropped
+ */
+gboolean
+emerge_queue_cancel (EmergeQueue *self,
+                     guint64      id)
+{
+  QueueEntry *entry;
+
+  g_return_val_if_fail (EMERGE_IS_QUEUE (self), FALSE);
+
+  entry = queue_find (self, id);
+  if (entry == NULL || entry->started)
+    return FALSE;
+
+  emerge_queue_finish (self, id, EMERGE_JOB_CANCELLED);
+
+  return TRUE;
+}
+
+/**
+ * emerge_queue_get_status:
+ * @self: a queue
+ *
+ * Describes the queue as
+ *   {"pending": 2, "finished": 5,
+ *    "jobs": [{"id": 7, "state": "running", "step": 12, "steps": 20,
+ *              "prompt": "..."}, ...]}
+ * with the jobs in the order they will run.
+ *
+ * Returns: (transfer full): a JSON object
+ */
+JsonNode *
+emerge_queue_get_status (EmergeQueue *self)
+{
+  JsonBuilder *builder;
+  JsonNode *status;
+
+  g_return_val_if_fail (EMERGE_IS_QUEUE (self), NULL);
+
+  builder = json_builder_new ();
+  json_builder_begin_object (builder);
+  json_builder_set_member_name (builder, "pending");
+  json_builder_add_int_value (builder, self->pending->len);
+  json_builder_set_member_name (builder, "finished");
+  json_builder_add_int_value (builder, self->n_finished);
+
+  json_builder_set_member_name (builder, "jobs");
+  json_builder_begin_array (builder);
+  for (guint i = 0; i < self->pending->len; i++) {
+    QueueEntry *entry = g_ptr_array_index (self->pending, i);
+
+    json_builder_begin_object (builder);
+    json_builder_set_member_name (builder, "id");
+    json_builder_add_int_value (builder, entry->job->id);
+    json_builder_set_member_name (builder, "state");
+    json_builder_add_string_value (builder,
+                                   emerge_job_state_to_string (entry->started ? EMERGE_JOB_RUNNING
+                                                                              : EMERGE_JOB_PENDING));
+    json_builder_set_member_name (builder, "step");
+    json_builder_add_int_value (builder, entry->last_step);
+    json_builder_set_member_name (builder, "steps");
+    json_builder_add_int_value (builder, entry->job->steps);
+    json_builder_set_member_name (builder, "prompt");
+    json_builder_add_string_value (builder, entry->job->prompt);
+    json_builder_end_object (builder);
+  }
+  json_builder_end_array (builder);
+
+  json_builder_end_object (builder);
+  status = json_builder_get_root (builder);
+  g_object_unref (builder);
+
+  return status;
+}
+
+/**
+ * emerge_queue_get_jobs:
+ * @self: a queue
+ *
+ * Returns: (transfer full) (element-type EmergeJob): the jobs waiting or
+ *   running, in the order they run
+ */
+GPtrArray *
+emerge_queue_get_jobs (EmergeQueue *self)
+{
+  GPtrArray *jobs;
+
+  g_return_val_if_fail (EMERGE_IS_QUEUE (self), NULL);
+
+  jobs = g_ptr_array_new_full (self->pending->len, (GDestroyNotify) emerge_job_unref);
+  for (guint i = 0; i < self->pending->len; i++) {
+    QueueEntry *entry = g_ptr_array_index (self->pending, i);
+
+    g_ptr_array_add (jobs, emerge_job_ref (entry->job));
+  }
+
+  return jobs;
+}
+
+/* Whether job @id is waiting or running */
+gboolean
+emerge_queue_has_job (EmergeQueue *self,
+                      guint64      id)
+{
+  g_return_val_if_fail (EMERGE_IS_QUEUE (self), FALSE);
+
+  return queue_find (self, id) != NULL;
+}
+
+/* Jobs submitted and not finished, including a running one */
+guint
+emerge_queue_get_n_pending (EmergeQueue *self)
+{
+  g_return_val_if_fail (EMERGE_IS_QUEUE (self), 0);
+
+  return self->pending->len;
+}
+
+/* Jobs finished since the queue last ran dry */
+guint
+emerge_queue_get_n_finished (EmergeQueue *self)
+{
+  g_return_val_if_fail (EMERGE_IS_QUEUE (self), 0);
+
+  return self->n_finished;
+}
+
+/* Lines in the journal, for seeing that it gets compacted */
+guint
+emerge_queue_get_n_records (EmergeQueue *self)
+{
+  g_return_val_if_fail (EMERGE_IS_QUEUE (self), 0);
+
+  return self->n_records;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <gio/gio.h>
+
+#include "emerge-job.h"
+
+G_BEGIN_DECLS
+
+#define EMERGE_TYPE_QUEUE (emerge_queue_get_type())
+
+G_DECLARE_FINAL_TYPE (EmergeQueue, emerge_queue, EMERGE, QUEUE, GObject)
+
+EmergeQueue *emerge_queue_new            (const char      *journal_path);
+gboolean     emerge_queue_load           (EmergeQueue     *self,
+                                          GError         **error);
+guint64      emerge_queue_submit         (EmergeQueue     *self,
+                                          const EmergeJob *job,
+                                          GError         **error);
+EmergeJob   *emerge_queue_start_next     (EmergeQueue     *self);
+void         emerge_queue_checkpoint     (EmergeQueue     *self,
+                                          guint64          id,
+                                          gint             step);
+void         emerge_queue_finish         (EmergeQueue     *self,
+                                          guint64          id,
+                                          EmergeJobState   state);
+gboolean     emerge_queue_cancel         (EmergeQueue     *self,
+                                          guint64          id);
+JsonNode    *emerge_queue_get_status     (EmergeQueue     *self);
+gboolean     emerge_queue_has_job        (EmergeQueue     *self,
+                                          guint64          id);
+GPtrArray   *emerge_queue_get_jobs       (EmergeQueue     *self);
+guint        emerge_queue_get_n_pending  (EmergeQueue     *self);
+guint        emerge_queue_get_n_finished (EmergeQueue     *self);
+guint        emerge_queue_get_n_records  (EmergeQueue     *self);
+
+G_END_DECLS
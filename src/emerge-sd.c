@@ -0,0 +1,404 @@
+#include "emerge-sd.h"
+
+#include <string.h>
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+
+const char * const emerge_sd_quant_types[] = {
+  "f16", "f32", "q8_0", "q5_0", "q5_1", "q4_0", "q4_1", NULL
+};
+
+const char * const emerge_sd_sampling_methods[] = {
+  "euler", "euler_a", "heun", "dpm2", "dpm++2s_a", "dpm++2m", "dpm++2mv2", "lcm", NULL
+};
+
+/* The last sd found, and its mtime then, so later lookups are one stat */
+static struct {
+  gchar  *override;
+  gchar  *path;
+  gint64  mtime;
+} sd_cache;
+G_LOCK_DEFINE_STATIC (sd_cache);
+
+static gchar *
+sd_search_executable (void)
+{
+  gchar *sd_path;
+  const gchar *override;
+  
+  // An explicit path wins; the tests point this at a mock sd
+  override = g_getenv("EMERGE_SD_PATH");
+  if (override != NULL && *override != '\0') {
+    if (g_file_test(override, G_FILE_TEST_IS_EXECUTABLE))
+      return g_strdup(override);
+    g_warning("EMERGE_SD_PATH is set to %s, which is not executable", override);
+  }
+  
+  // First try to find 'sd' in PATH (this will work for AppImage)
+  sd_path = g_find_program_in_path("sd");
+  if (sd_path != NULL) {
+    return sd_path;
+  }
+  
+  // If not found in PATH, try in the bin directory relative to the executable
+  gchar *exe_dir = NULL;
+  gchar *bin_sd_path = NULL;
+  
+  // Get the directory where our executable is located
+  GFile *exe_file = g_file_new_for_path("/proc/self/exe");
+  GFile *exe_dir_file = NULL;
+  
+  if (exe_file) {
+    GFileInfo *info = g_file_query_info(exe_file, G_FILE_ATTRIBUTE_STANDARD_SYMLINK_TARGET,
+                                       G_FILE_QUERY_INFO_NONE, NULL, NULL);
+    if (info) {
+      const char *target = g_file_info_get_attribute_byte_string(info, 
+                                                              G_FILE_ATTRIBUTE_STANDARD_SYMLINK_TARGET);
+      if (target) {
+        GFile *target_file = g_file_new_for_path(target);
+        if (target_file) {
+          exe_dir_file = g_file_get_parent(target_file);
+          g_object_unref(target_file);
+        }
+      }
+      g_object_unref(info);
+    }
+    
+    if (exe_dir_file == NULL) {
+      // Fallback if we couldn't read the symlink target
+      exe_dir_file = g_file_get_parent(exe_file);
+    }
+    g_object_unref(exe_file);
+  }
+  
+  // Initialize paths to try
+  GQueue *paths_to_try = g_queue_new();
+  
+  // Add the current directory
+  g_queue_push_tail(paths_to_try, g_strdup("."));
+  
+  if (exe_dir_file) {
+    exe_dir = g_file_get_path(exe_dir_file);
+    g_object_unref(exe_dir_file);
+    
+    if (exe_dir) {
+      // Add executable directory
+      g_queue_push_tail(paths_to_try, g_strdup(exe_dir));
+      
+      // Also try one level up from executable directory
+      GFile *parent_dir_file = g_file_new_for_path(exe_dir);
+      GFile *project_dir_file = g_file_get_parent(parent_dir_file);
+      g_object_unref(parent_dir_file);
+      
+      if (project_dir_file) {
+        gchar *project_dir = g_file_get_path(project_dir_file);
+        g_object_unref(project_dir_file);
+        
+        if (project_dir) {
+          // Add parent directory
+          g_queue_push_tail(paths_to_try, g_strdup(project_dir));
+          
+          // For build directory scenarios, try two and three levels up
+          // This handles cases like build/src/emerge where we need to go up to find project root
+          GFile *build_dir_file = g_file_new_for_path(project_dir);
+          GFile *root_dir_file = g_file_get_parent(build_dir_file);
+          g_object_unref(build_dir_file);
+          
+          if (root_dir_file) {
+            gchar *root_dir = g_file_get_path(root_dir_file);
+            g_queue_push_tail(paths_to_try, g_strdup(root_dir));
+            
+            // Try one more level up
+            GFile *root_parent_file = g_file_get_parent(root_dir_file);
+            g_object_unref(root_dir_file);
+            
+            if (root_parent_file) {
+              gchar *root_parent = g_file_get_path(root_parent_file);
+              g_queue_push_tail(paths_to_try, g_strdup(root_parent));
+              g_object_unref(root_parent_file);
+              g_free(root_parent);
+            }
+            
+            g_free(root_dir);
+          }
+          
+          g_free(project_dir);
+        }
+      }
+      
+      g_free(exe_dir);
+    }
+  }
+  
+  // Try each path to see if bin/sd exists there
+  while (!g_queue_is_empty(paths_to_try)) {
+    gchar *base_path = g_queue_pop_head(paths_to_try);
+    
+    // Try bin/sd in this location
+    bin_sd_path = g_build_filename(base_path, "bin", "sd", NULL);
+    g_debug("Checking for sd at: %s", bin_sd_path);
+    
+    if (g_file_test(bin_sd_path, G_FILE_TEST_IS_EXECUTABLE)) {
+      // Free remaining paths
+      while (!g_queue_is_empty(paths_to_try)) {
+        g_free(g_queue_pop_head(paths_to_try));
+      }
+      g_queue_free(paths_to_try);
+      g_free(base_path);
+      return bin_sd_path;
+    }
+    
+    g_free(bin_sd_path);
+    
+    // Try just 'sd' in this location (for development builds)
+    bin_sd_path = g_build_filename(base_path, "sd", NULL);
+    g_debug("Checking for sd at: %s", bin_sd_path);
+    
+    if (g_file_test(bin_sd_path, G_FILE_TEST_IS_EXECUTABLE)) {
+      // Free remaining paths
+      while (!g_queue_is_empty(paths_to_try)) {
+        g_free(g_queue_pop_head(paths_to_try));
+      }
+      g_queue_free(paths_to_try);
+      g_free(base_path);
+      return bin_sd_path;
+    }
+    g_free(bin_sd_path);
+    
+    g_free(base_path);
+  }
+  
+  g_queue_free(paths_to_try);
+  return NULL;
+}
+
+/* Modification time of an executable @path in microseconds, or -1 if it is
+ * gone or no longer executable */
+static gint64
+sd_get_mtime (const char *path)
+{
+  GStatBuf buf;
+
+  if (g_stat (path, &buf) != 0 || !S_ISREG (buf.st_mode) ||
+      !g_file_test (path, G_FILE_TEST_IS_EXECUTABLE))
+    return -1;
+
+  return (gint64) buf.st_mtim.tv_sec * G_USEC_PER_SEC + buf.st_mtim.tv_nsec / 1000;
+}
+
+/**
+ * emerge_sd_find_executable:
+ *
+ * Looks for sd in EMERGE_SD_PATH, PATH and next to the emerge executable.
+ * The answer is remembered; it is searched for again only if
+ * EMERGE_SD_PATH changes or the file found last time is replaced,
+ * touched or removed.
+ *
+ * Returns: (transfer full) (nullable): the path to sd
+ */
+gchar *
+emerge_sd_find_executable (void)
+{
+  const char *override = g_getenv ("EMERGE_SD_PATH");
+  gchar *sd_path = NULL;
+
+  G_LOCK (sd_cache);
+
+  if (sd_cache.path != NULL && g_strcmp0 (override, sd_cache.override) == 0 &&
+      sd_get_mtime (sd_cache.path) == sd_cache.mtime)
+    sd_path = g_strdup (sd_cache.path);
+
+  if (sd_path == NULL) {
+    g_clear_pointer (&sd_cache.path, g_free);
+    g_clear_pointer (&sd_cache.override, g_free);
+
+    sd_path = sd_search_executable ();
+    if (sd_path != NULL) {
+      g_print ("Using sd at %s\n", sd_path);
+      sd_cache.path = g_strdup (sd_path);
+      sd_cache.override = g_strdup (override);
+      sd_cache.mtime = sd_get_mtime (sd_path);
+    }
+  }
+
+  G_UNLOCK (sd_cache);
+
+  return sd_path;
+}
+
+/* Human readable list of the locations emerge_sd_find_executable() tried */
+gchar *
+emerge_sd_format_not_found_message (void)
+{
+  GString *error_msg = g_string_new("Failed to find 'sd' executable. Install paths checked:\n");
+  
+  // Add current directory to the error message
+  gchar *cwd = g_get_current_dir();
+  g_string_append_printf(error_msg, "- %s/bin/sd\n", cwd);
+  g_string_append_printf(error_msg, "- %s/sd\n", cwd);
+  g_free(cwd);
+  
+  // Add paths relative to executable
+  gchar *exe_path = NULL;
+  GFile *exe_file = g_file_new_for_path("/proc/self/exe");
+  if (exe_file) {
+    exe_path = g_file_get_path(exe_file);
+    g_object_unref(exe_file);
+    if (exe_path) {
+      gchar *exe_dir = g_path_get_dirname(exe_path);
+      g_string_append_printf(error_msg, "- %s/bin/sd\n", exe_dir);
+      g_string_append_printf(error_msg, "- %s/sd\n", exe_dir);
+      
+      gchar *parent_dir = g_path_get_dirname(exe_dir);
+      g_string_append_printf(error_msg, "- %s/bin/sd\n", parent_dir);
+      g_string_append_printf(error_msg, "- %s/sd\n", parent_dir);
+      
+      gchar *root_dir = g_path_get_dirname(parent_dir);
+      g_string_append_printf(error_msg, "- %s/bin/sd\n", root_dir);
+      g_string_append_printf(error_msg, "- %s/sd\n", root_dir);
+      
+      g_free(root_dir);
+      g_free(parent_dir);
+      g_free(exe_dir);
+      g_free(exe_path);
+    }
+  }
+  
+  g_string_append(error_msg, "Make sure the 'sd' executable is in one of these locations or in PATH.");
+
+  return g_string_free (error_msg, FALSE);
+}
+
+/* Build the argv for `sd -M convert`. Arguments are passed verbatim, so
+ * paths with quotes or spaces need no escaping. */
+gchar **
+emerge_sd_build_convert_argv (const char *sd_path,
+                              const char *model_path,
+                              const char *output_path,
+                              const char *quant_type)
+{
+  GStrvBuilder *builder = g_strv_builder_new ();
+  gchar **argv;
+
+  g_strv_builder_add_many (builder,
+                           sd_path,
+                           "-M", "convert",
+                           "-m", model_path,
+                           "-o", output_path,
+                           "-v",
+                           "--type", quant_type,
+                           NULL);
+
+  argv = g_strv_builder_end (builder);
+  g_strv_builder_unref (builder);
+
+  return argv;
+}
+
+EmergeSdStats *
+emerge_sd_stats_new (void)
+{
+  EmergeSdStats *stats = g_new0 (EmergeSdStats, 1);
+
+  stats->load_seconds = -1.0;
+  stats->sampling_seconds = -1.0;
+  stats->decode_seconds = -1.0;
+  stats->total_seconds = -1.0;
+  stats->step_seconds = g_array_new (FALSE, FALSE, sizeof (double));
+
+  return stats;
+}
+
+void
+emerge_sd_stats_free (EmergeSdStats *stats)
+{
+  if (stats == NULL)
+    return;
+
+  g_array_unref (stats->step_seconds);
+  g_free (stats);
+}
+
+/* Pull the number out of "..., taking 1.23s" or "... completed in 1.23s" */
+static gboolean
+parse_trailing_seconds (const char *line,
+                        const char *marker,
+                        double     *seconds)
+{
+  const char *p = strstr (line, marker);
+  char *end;
+  double value;
+
+  if (p == NULL)
+    return FALSE;
+
+  p += strlen (marker);
+  value = g_ascii_strtod (p, &end);
+  if (end == p)
+    return FALSE;
+
+  *seconds = value;
+  return TRUE;
+}
+
+/**
+ * emerge_sd_stats_parse_line:
+ * @stats: stats to update
+ * @line: one line of sd output
+ *
+ * Recognises the timing lines sd logs, e.g.
+ *   loading model from '...' completed, taking 3.41s
+ *   sampling completed, taking 30.12s
+ *   decode_first_stage completed, taking 2.05s
+ *   txt2img completed in 35.80s
+ *
+ * Returns: %TRUE if @line carried a timing
+ */
+gboolean
+emerge_sd_stats_parse_line (EmergeSdStats *stats,
+                            const char    *line)
+{
+  g_return_val_if_fail (stats != NULL, FALSE);
+  g_return_val_if_fail (line != NULL, FALSE);
+
+  if (strstr (line, "loading model from") != NULL)
+    return parse_trailing_seconds (line, "taking ", &stats->load_seconds);
+
+  if (strstr (line, "sampling completed") != NULL)
+    return parse_trailing_seconds (line, "taking ", &stats->sampling_seconds);
+
+  if (strstr (line, "decode_first_stage completed") != NULL)
+    return parse_trailing_seconds (line, "taking ", &stats->decode_seconds);
+
+  if (strstr (line, "txt2img completed") != NULL ||
+      strstr (line, "img2img completed") != NULL)
+    return parse_trailing_seconds (line, "completed in ", &stats->total_seconds);
+
+  return FALSE;
+}
+
+void
+emerge_sd_stats_add_step (EmergeSdStats *stats,
+                          double         seconds_per_step)
+{
+  g_return_if_fail (stats != NULL);
+
+  g_array_append_val (stats->step_seconds, seconds_per_step);
+}
+
+/* Mean seconds per sampling step, or a negative value if none were seen */
+double
+emerge_sd_stats_get_mean_step (EmergeSdStats *stats)
+{
+  double sum = 0.0;
+
+  g_return_val_if_fail (stats != NULL, -1.0);
+
+  if (stats->step_seconds->len == 0)
+    return -1.0;
+
+  for (guint i = 0; i < stats->step_seconds->len; i++)
+    sum += g_array_index (stats->step_seconds, double, i);
+
+  return sum / stats->step_seconds->len;
+}
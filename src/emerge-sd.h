@@ -0,0 +1,43 @@
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Helpers for driving the stable-diffusion.cpp `sd` command line tool */
+
+/* GGUF weight types offered for conversion, NULL terminated */
+extern const char * const emerge_sd_quant_types[];
+
+/* Values accepted by --sampling-method, NULL terminated */
+extern const char * const emerge_sd_sampling_methods[];
+
+gchar  *emerge_sd_find_executable          (void);
+gchar  *emerge_sd_format_not_found_message (void);
+
+gchar **emerge_sd_build_convert_argv       (const char *sd_path,
+                                            const char *model_path,
+                                            const char *output_path,
+                                            const char *quant_type);
+
+/* Timings scraped from the log sd prints during a generation. Any value
+ * sd didn't report is left negative. */
+typedef struct {
+  double  load_seconds;
+  double  sampling_seconds;
+  double  decode_seconds;
+  double  total_seconds;
+  GArray *step_seconds;   /* double, seconds per step as reported */
+} EmergeSdStats;
+
+EmergeSdStats *emerge_sd_stats_new        (void);
+void           emerge_sd_stats_free       (EmergeSdStats *stats);
+gboolean       emerge_sd_stats_parse_line (EmergeSdStats *stats,
+                                           const char    *line);
+void           emerge_sd_stats_add_step   (EmergeSdStats *stats,
+                                           double         seconds_per_step);
+double         emerge_sd_stats_get_mean_step (EmergeSdStats *stats);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (EmergeSdStats, emerge_sd_stats_free)
+
+G_END_DECLS
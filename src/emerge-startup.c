@@ -0,0 +1,87 @@
+#include "emerge-startup.h"
+
+typedef struct {
+  const char *phase;
+  gint64      time;
+} StartupMark;
+
+static gint64   startup_begin_time;
+static gboolean startup_enabled;
+static GArray  *startup_marks;   /* StartupMark */
+
+/* Called first thing in main(); everything is timed from here */
+void
+emerge_startup_begin (void)
+{
+  startup_begin_time = g_get_monotonic_time ();
+}
+
+void
+emerge_startup_enable (void)
+{
+  if (startup_enabled)
+    return;
+
+  startup_enabled = TRUE;
+  startup_marks = g_array_new (FALSE, FALSE, sizeof (StartupMark));
+}
+
+gboolean
+emerge_startup_is_enabled (void)
+{
+  return startup_enabled;
+}
+
+/* Notes that @phase, a static string, has just finished */
+void
+emerge_startup_mark (const char *phase)
+{
+  StartupMark mark;
+
+  if (!startup_enabled)
+    return;
+
+  mark.phase = phase;
+  mark.time = g_get_monotonic_time ();
+  g_array_append_val (startup_marks, mark);
+}
+
+/**
+ * emerge_startup_report:
+ * @interactive_phase: the mark after which the window can be used
+ *
+ * Prints how long each phase took and whether @interactive_phase came
+ * within %EMERGE_STARTUP_BUDGET_MS, then stops profiling.
+ */
+void
+emerge_startup_report (const char *interactive_phase)
+{
+  gint64 last = startup_begin_time;
+
+  if (!startup_enabled)
+    return;
+
+  g_print ("Startup profile (ms since main):\n");
+  g_print ("  %-24s %8s %8s\n", "phase", "took", "at");
+
+  for (guint i = 0; i < startup_marks->len; i++) {
+    StartupMark *mark = &g_array_index (startup_marks, StartupMark, i);
+    double took = (mark->time - last) / 1000.0;
+    double at = (mark->time - startup_begin_time) / 1000.0;
+
+    g_print ("  %-24s %8.1f %8.1f\n", mark->phase, took, at);
+    last = mark->time;
+
+    if (g_strcmp0 (mark->phase, interactive_phase) == 0) {
+      if (at > EMERGE_STARTUP_BUDGET_MS)
+        g_print ("  Interactive after %.1f ms, over the %d ms budget\n",
+                 at, EMERGE_STARTUP_BUDGET_MS);
+      else
+        g_print ("  Interactive after %.1f ms, within the %d ms budget\n",
+                 at, EMERGE_STARTUP_BUDGET_MS);
+    }
+  }
+
+  g_clear_pointer (&startup_marks, g_array_unref);
+  startup_enabled = FALSE;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* How long after main() the window may take to become usable */
+#define EMERGE_STARTUP_BUDGET_MS 200
+
+/* Timing of the phases of a launch, printed with --profile-startup.
+ * Marks are only kept once profiling is enabled; until then they cost a
+ * branch. Main thread only. */
+void     emerge_startup_begin      (void);
+void     emerge_startup_enable     (void);
+gboolean emerge_startup_is_enabled (void);
+void     emerge_startup_mark       (const char *phase);
+void     emerge_startup_report     (const char *interactive_phase);
+
+G_END_DECLS
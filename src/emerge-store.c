@@ -0,0 +1,174 @@
+#include "emerge-store.h"
+
+#include <glib/gstdio.h>
+
+struct _EmergeStore
+{
+  guint        delay_ms;
+  guint        timeout_id;
+  GHashTable  *pending;     /* path → contents, waiting out the delay */
+
+  /* A single writer thread, so batches land in the order they were made */
+  GThreadPool *pool;
+  GMutex       mutex;
+  GCond        cond;
+  guint        n_queued;    /* batches not written yet */
+  guint        n_writes;
+};
+
+static GHashTable *
+store_new_batch (void)
+{
+  return g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                (GDestroyNotify) g_bytes_unref);
+}
+
+static void
+store_write_thread (gpointer data,
+                    gpointer user_data)
+{
+  GHashTable *batch = data;
+  EmergeStore *self = user_data;
+  GHashTableIter iter;
+  gpointer path, contents;
+  guint n_written = 0;
+
+  g_hash_table_iter_init (&iter, batch);
+  while (g_hash_table_iter_next (&iter, &path, &contents)) {
+    GError *error = NULL;
+    gchar *dir = g_path_get_dirname (path);
+
+    g_mkdir_with_parents (dir, 0755);
+    g_free (dir);
+
+    if (g_file_set_contents_full (path,
+                                  g_bytes_get_data (contents, NULL),
+                                  g_bytes_get_size (contents),
+                                  G_FILE_SET_CONTENTS_CONSISTENT, 0644, &error)) {
+      n_written++;
+    } else {
+      g_warning ("Failed to save %s: %s", (const char *) path, error->message);
+      g_error_free (error);
+    }
+  }
+
+  g_hash_table_unref (batch);
+
+  g_mutex_lock (&self->mutex);
+  self->n_queued--;
+  self->n_writes += n_written;
+  g_cond_broadcast (&self->cond);
+  g_mutex_unlock (&self->mutex);
+}
+
+/* Hands everything pending to the writer thread */
+static void
+store_submit (EmergeStore *self)
+{
+  GHashTable *batch;
+
+  g_clear_handle_id (&self->timeout_id, g_source_remove);
+
+  if (g_hash_table_size (self->pending) == 0)
+    return;
+
+  batch = self->pending;
+  self->pending = store_new_batch ();
+
+  g_mutex_lock (&self->mutex);
+  self->n_queued++;
+  g_mutex_unlock (&self->mutex);
+
+  g_thread_pool_push (self->pool, batch, NULL);
+}
+
+static gboolean
+store_timeout_cb (gpointer user_data)
+{
+  EmergeStore *self = user_data;
+
+  self->timeout_id = 0;
+  store_submit (self);
+
+  return G_SOURCE_REMOVE;
+}
+
+/**
+ * emerge_store_new:
+ * @delay_ms: how long to wait for further changes before writing
+ *
+ * Returns: (transfer full): a new store, used from the main thread
+ */
+EmergeStore *
+emerge_store_new (guint delay_ms)
+{
+  EmergeStore *self = g_new0 (EmergeStore, 1);
+
+  self->delay_ms = delay_ms;
+  self->pending = store_new_batch ();
+  self->pool = g_thread_pool_new (store_write_thread, self, 1, FALSE, NULL);
+  g_mutex_init (&self->mutex);
+  g_cond_init (&self->cond);
+
+  return self;
+}
+
+/* Writes out whatever is still pending before going away */
+void
+emerge_store_free (EmergeStore *self)
+{
+  if (self == NULL)
+    return;
+
+  emerge_store_flush (self);
+  g_thread_pool_free (self->pool, FALSE, TRUE);
+  g_hash_table_unref (self->pending);
+  g_mutex_clear (&self->mutex);
+  g_cond_clear (&self->cond);
+  g_free (self);
+}
+
+/* Schedules @path to be replaced with @contents. Returns right away; an
+ * earlier write to @path that hasn't started yet is dropped. */
+void
+emerge_store_write (EmergeStore *self,
+                    const char  *path,
+                    GBytes      *contents)
+{
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (path != NULL && contents != NULL);
+
+  g_hash_table_replace (self->pending, g_strdup (path), g_bytes_ref (contents));
+
+  if (self->timeout_id == 0)
+    self->timeout_id = g_timeout_add (self->delay_ms, store_timeout_cb, self);
+}
+
+/* Writes everything pending now and waits until it is on disk */
+void
+emerge_store_flush (EmergeStore *self)
+{
+  g_return_if_fail (self != NULL);
+
+  store_submit (self);
+
+  g_mutex_lock (&self->mutex);
+  while (self->n_queued > 0)
+    g_cond_wait (&self->cond, &self->mutex);
+  g_mutex_unlock (&self->mutex);
+}
+
+/* How many files have been written so far */
+guint
+emerge_store_get_n_writes (EmergeStore *self)
+{
+  guint n_writes;
+
+  g_return_val_if_fail (self != NULL, 0);
+
+  g_mutex_lock (&self->mutex);
+  n_writes = self->n_writes;
+  g_mutex_unlock (&self->mutex);
+
+  return n_writes;
+}
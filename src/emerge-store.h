@@ -0,0 +1,27 @@
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* How long writes are held back so later changes can replace them */
+#define EMERGE_STORE_DEFAULT_DELAY_MS 500
+
+/* Saves small state files without making the caller wait on the disk.
+ * Every write replaces a whole file. Writes to the same file within the
+ * delay collapse into the last one, and whatever is due is written in one
+ * batch on a worker thread, each file through a temporary file and a
+ * rename, so a crash leaves either the old contents or the new ones. */
+typedef struct _EmergeStore EmergeStore;
+
+EmergeStore *emerge_store_new          (guint        delay_ms);
+void         emerge_store_free         (EmergeStore *store);
+void         emerge_store_write        (EmergeStore *store,
+                                        const char  *path,
+                                        GBytes      *contents);
+void         emerge_store_flush        (EmergeStore *store);
+guint        emerge_store_get_n_writes (EmergeStore *store);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (EmergeStore, emerge_store_free)
+
+G_END_DECLS
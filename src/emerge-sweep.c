@@ -0,0 +1,335 @@
+#include "emerge-sweep.h"
+
+#include <math.h>
+#include <gio/gio.h>
+
+typedef struct {
+  gchar     *name;
+  JsonArray *values;      /* a list, or NULL for a range */
+  gboolean   is_double;
+  double     from;
+  double     step;
+  guint64    n_values;
+} SweepAxis;
+
+struct _EmergeSweep
+{
+  JsonObject *fixed;      /* members with a single value */
+  GArray     *axes;       /* SweepAxis, in template order */
+  guint64     n_jobs;
+  guint64     position;
+};
+
+static void
+sweep_axis_clear (gpointer data)
+{
+  SweepAxis *axis = data;
+
+  g_free (axis->name);
+  g_clear_pointer (&axis->values, json_array_unref);
+}
+
+static gboolean
+node_is_number (JsonNode *node)
+{
+  GType type;
+
+  if (!JSON_NODE_HOLDS_VALUE (node))
+    return FALSE;
+
+  type = json_node_get_value_type (node);
+  return type == G_TYPE_INT64 || type == G_TYPE_DOUBLE;
+}
+
+static gboolean
+sweep_axis_init_range (SweepAxis   *axis,
+                       JsonObject  *range,
+                       GError     **error)
+{
+  JsonNode *from = json_object_get_member (range, "from");
+  JsonNode *to = json_object_get_member (range, "to");
+  JsonNode *step = json_object_get_member (range, "step");
+  double last, span;
+
+  if (from == NULL || to == NULL || !node_is_number (from) || !node_is_number (to) ||
+      (step != NULL && !node_is_number (step))) {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                 "\"%s\" should be a list or a range with numeric \"from\", \"to\" and \"step\"",
+                 axis->name);
+    return FALSE;
+  }
+
+  axis->is_double = (json_node_get_value_type (from) == G_TYPE_DOUBLE ||
+                     json_node_get_value_type (to) == G_TYPE_DOUBLE ||
+                     (step != NULL && json_node_get_value_type (step) == G_TYPE_DOUBLE));
+  axis->from = json_node_get_double (from);
+  last = json_node_get_double (to);
+  axis->step = step != NULL ? json_node_get_double (step) : 1.0;
+
+  if (!(axis->step > 0.0) || last < axis->from) {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                 "The range of \"%s\" needs \"to\" no less than \"from\" and a positive \"step\"",
+                 axis->name);
+    return FALSE;
+  }
+
+  /* With a little slack, so 0.1 steps reach the end despite rounding */
+  span = floor ((last - axis->from) / axis->step + 1e-9);
+  if (span >= (double) G_MAXUINT32) {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                 "The range of \"%s\" has too many values", axis->name);
+    return FALSE;
+  }
+  axis->n_values = (guint64) span + 1;
+
+  return TRUE;
+}
+
+/* Sets the member of @axis in @values to its value number @digit */
+static void
+sweep_axis_set_value (SweepAxis  *axis,
+                      guint64     digit,
+                      JsonObject *values)
+{
+  if (axis->values != NULL)
+    json_object_set_member (values, axis->name,
+                            json_node_copy (json_array_get_element (axis->values, digit)));
+  else if (axis->is_double)
+    json_object_set_double_member (values, axis->name, axis->from + digit * axis->step);
+  else
+    json_object_set_int_member (values, axis->name,
+                                (gint64) axis->from + (gint64) digit * (gint64) axis->step);
+}
+
+/* Whether every value of @axis suits a job; a range only needs its ends
+ * checked */
+static gboolean
+sweep_axis_validate (SweepAxis  *axis,
+                     GError    **error)
+{
+  guint64 last = axis->n_values - 1;
+
+  for (guint64 digit = 0; digit <= last; digit++) {
+    JsonObject *values = json_object_new ();
+    gboolean valid;
+
+    if (axis->values == NULL && digit > 0)
+      digit = last;
+
+    sweep_axis_set_value (axis, digit, values);
+    valid = emerge_job_validate_json (values, error);
+    json_object_unref (values);
+
+    if (!valid)
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+/**
+ * emerge_sweep_new:
+ * @template: a template, possibly with lists and ranges
+ * @error: return location for an error
+ *
+ * Returns: (transfer full) (nullable): a sweep over @template, which has
+ *   a single job if @template has neither lists nor ranges
+ */
+EmergeSweep *
+emerge_sweep_new (JsonObject  *template,
+                  GError     **error)
+{
+  EmergeSweep *self;
+  JsonObjectIter iter;
+  const char *name;
+  JsonNode *node;
+
+  g_return_val_if_fail (template != NULL, NULL);
+
+  self = g_new0 (EmergeSweep, 1);
+  self->fixed = json_object_new ();
+  self->axes = g_array_new (FALSE, TRUE, sizeof (SweepAxis));
+  g_array_set_clear_func (self->axes, sweep_axis_clear);
+  self->n_jobs = 1;
+
+  json_object_iter_init_ordered (&iter, template);
+  while (json_object_iter_next_ordered (&iter, &name, &node)) {
+    SweepAxis axis = { 0 };
+
+    if (JSON_NODE_HOLDS_VALUE (node) || JSON_NODE_HOLDS_NULL (node)) {
+      json_object_set_member (self->fixed, name, json_node_copy (node));
+      continue;
+    }
+
+    axis.name = g_strdup (name);
+
+    if (JSON_NODE_HOLDS_ARRAY (node)) {
+      JsonArray *values = json_node_get_array (node);
+
+      for (guint i = 0; i < json_array_get_length (values); i++) {
+        JsonNode *value = json_array_get_element (values, i);
+
+        if (!JSON_NODE_HOLDS_VALUE (value) && !JSON_NODE_HOLDS_NULL (value)) {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                       "The values listed for \"%s\" must be plain values", name);
+          sweep_axis_clear (&axis);
+          emerge_sweep_free (self);
+          return NULL;
+        }
+      }
+
+      axis.values = json_array_ref (values);
+      axis.n_values = json_array_get_length (values);
+      if (axis.n_values == 0) {
+        g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                     "\"%s\" lists no values", name);
+        sweep_axis_clear (&axis);
+        emerge_sweep_free (self);
+        return NULL;
+      }
+    } else if (!sweep_axis_init_range (&axis, json_node_get_object (node), error)) {
+      sweep_axis_clear (&axis);
+      emerge_sweep_free (self);
+      return NULL;
+    }
+
+    if (!sweep_axis_validate (&axis, error)) {
+      sweep_axis_clear (&axis);
+      emerge_sweep_free (self);
+      return NULL;
+    }
+
+    if (axis.n_values > G_MAXUINT64 / self->n_jobs) {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                           "The template makes too many combinations");
+      sweep_axis_clear (&axis);
+      emerge_sweep_free (self);
+      return NULL;
+    }
+
+    self->n_jobs *= axis.n_values;
+    g_array_append_val (self->axes, axis);
+  }
+
+  if (!emerge_job_validate_json (self->fixed, error)) {
+    emerge_sweep_free (self);
+    return NULL;
+  }
+
+  return self;
+}
+
+void
+emerge_sweep_free (EmergeSweep *self)
+{
+  if (self == NULL)
+    return;
+
+  json_object_unref (self->fixed);
+  g_array_unref (self->axes);
+  g_free (self);
+}
+
+/* How many jobs the sweep makes in all */
+guint64
+emerge_sweep_get_n_jobs (EmergeSweep *self)
+{
+  g_return_val_if_fail (self != NULL, 0);
+
+  return self->n_jobs;
+}
+
+/* How many jobs emerge_sweep_next() has made so far */
+guint64
+emerge_sweep_get_position (EmergeSweep *self)
+{
+  g_return_val_if_fail (self != NULL, 0);
+
+  return self->position;
+}
+
+/**
+ * emerge_sweep_get_values:
+ * @self: a sweep
+ * @index: which combination, below emerge_sweep_get_n_jobs()
+ *
+ * Returns: (transfer full): the template with every list and range
+ *   replaced by its value in combination @index
+ */
+JsonObject *
+emerge_sweep_get_values (EmergeSweep *self,
+                         guint64      index)
+{
+  JsonObject *values;
+  JsonObjectIter iter;
+  const char *name;
+  JsonNode *node;
+
+  g_return_val_if_fail (self != NULL, NULL);
+  g_return_val_if_fail (index < self->n_jobs, NULL);
+
+  values = json_object_new ();
+  json_object_iter_init (&iter, self->fixed);
+  while (json_object_iter_next (&iter, &name, &node))
+    json_object_set_member (values, name, json_node_copy (node));
+
+  /* The index in mixed radix, one digit per axis, the last one lowest */
+  for (guint i = self->axes->len; i > 0; i--) {
+    SweepAxis *axis = &g_array_index (self->axes, SweepAxis, i - 1);
+    guint64 digit = index % axis->n_values;
+
+    index /= axis->n_values;
+    sweep_axis_set_value (axis, digit, values);
+  }
+
+  return values;
+}
+
+/**
+ * emerge_sweep_get_job:
+ * @self: a sweep
+ * @index: which combination, below emerge_sweep_get_n_jobs()
+ * @base: the parameters the template doesn't set
+ *
+ * Returns: (transfer full): a copy of @base with combination @index
+ *   applied
+ */
+EmergeJob *
+emerge_sweep_get_job (EmergeSweep     *self,
+                      guint64          index,
+                      const EmergeJob *base)
+{
+  JsonObject *values;
+  EmergeJob *job;
+
+  g_return_val_if_fail (self != NULL, NULL);
+  g_return_val_if_fail (base != NULL, NULL);
+
+  values = emerge_sweep_get_values (self, index);
+  job = emerge_job_copy (base);
+  emerge_job_apply_json (job, values);
+  json_object_unref (values);
+
+  return job;
+}
+
+/**
+ * emerge_sweep_next:
+ * @self: a sweep
+ * @base: the parameters the template doesn't set
+ *
+ * Returns: (transfer full) (nullable): a copy of @base with the next
+ *   combination applied, or %NULL once every one has been made
+ */
+EmergeJob *
+emerge_sweep_next (EmergeSweep     *self,
+                   const EmergeJob *base)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+  g_return_val_if_fail (base != NULL, NULL);
+
+  if (self->position >= self->n_jobs)
+    return NULL;
+
+  return emerge_sweep_get_job (self, self->position++, base);
+}
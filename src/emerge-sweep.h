@@ -0,0 +1,37 @@
+#pragma once
+
+#include <json-glib/json-glib.h>
+
+#include "emerge-job.h"
+
+G_BEGIN_DECLS
+
+/* A sweep keeps at most this many of its jobs waiting in the queue */
+#define EMERGE_SWEEP_MAX_QUEUED 4
+
+/* A template in which some members list several values, e.g.
+ *   "sampling_method": ["euler", "dpm++2m"]
+ * or give a range, e.g.
+ *   "seed": {"from": 1, "to": 100}
+ *   "cfg_scale": {"from": 3, "to": 7, "step": 0.5}
+ * stands for one job per combination, the last such member changing
+ * fastest. Combinations are made one at a time from their index, so a
+ * sweep takes the same memory however many jobs it has. */
+typedef struct _EmergeSweep EmergeSweep;
+
+EmergeSweep *emerge_sweep_new          (JsonObject   *template,
+                                        GError      **error);
+void         emerge_sweep_free         (EmergeSweep  *sweep);
+guint64      emerge_sweep_get_n_jobs   (EmergeSweep  *sweep);
+guint64      emerge_sweep_get_position (EmergeSweep  *sweep);
+JsonObject  *emerge_sweep_get_values   (EmergeSweep  *sweep,
+                                        guint64       index);
+EmergeJob   *emerge_sweep_get_job      (EmergeSweep  *sweep,
+                                        guint64       index,
+                                        const EmergeJob *base);
+EmergeJob   *emerge_sweep_next         (EmergeSweep  *sweep,
+                                        const EmergeJob *base);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (EmergeSweep, emerge_sweep_free)
+
+G_END_DECLS
@@ -0,0 +1,409 @@
+#include "emerge-texture-cache.h"
+
+/* Decoded full-size images, most recently used first, evicted from the
+ * back once their total size goes over the budget. Images next to the one
+ * on display are decoded ahead of time on a small pool of our own, so
+ * stepping through results finds them already in the cache. Requests for
+ * an image to show go ahead of prefetches in the queue. Images too big to
+ * decode whole are turned away by the workers, from their header. */
+struct _EmergeTextureCache
+{
+  GObject      parent_instance;
+
+  GHashTable  *entries;     /* path -> CacheEntry */
+  GQueue       lru;         /* of CacheEntry, most recent first */
+  gsize        size;
+  gsize        budget;
+  gint         max_size;
+  GHashTable  *too_large;   /* paths found to be at least max_size */
+
+  GHashTable  *loads;       /* path -> PendingLoad */
+  GThreadPool *pool;
+  guint64      sequence;
+};
+
+G_DEFINE_TYPE (EmergeTextureCache, emerge_texture_cache, G_TYPE_OBJECT)
+
+typedef struct {
+  GList       link;
+  gchar      *path;
+  GdkTexture *texture;
+  gsize       size;
+} CacheEntry;
+
+/* One decode, shared by everyone who asks for the same path meanwhile */
+typedef struct {
+  gchar        *path;
+  gint          max_size;
+  GCancellable *cancellable;
+  GPtrArray    *waiters;    /* GTasks of load_async() calls */
+  gboolean      prefetch;   /* only wanted ahead of time */
+  guint64       sequence;
+} PendingLoad;
+
+static void
+cache_entry_free (CacheEntry *entry)
+{
+  g_object_unref (entry->texture);
+  g_free (entry->path);
+  g_free (entry);
+}
+
+static void
+pending_load_free (PendingLoad *load)
+{
+  g_ptr_array_unref (load->waiters);
+  g_object_unref (load->cancellable);
+  g_free (load->path);
+  g_free (load);
+}
+
+static void
+emerge_texture_cache_finalize (GObject *object)
+{
+  EmergeTextureCache *self = EMERGE_TEXTURE_CACHE (object);
+
+  /* Queued decodes hold a reference through their task, so the queue is
+   * empty here */
+  g_thread_pool_free (self->pool, FALSE, FALSE);
+  g_hash_table_unref (self->loads);
+  g_hash_table_unref (self->too_large);
+  g_queue_clear (&self->lru);
+  g_hash_table_unref (self->entries);
+
+  G_OBJECT_CLASS (emerge_texture_cache_parent_class)->finalize (object);
+}
+
+static void
+emerge_texture_cache_class_init (EmergeTextureCacheClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->finalize = emerge_texture_cache_finalize;
+}
+
+static void
+emerge_texture_cache_worker (gpointer data,
+                             gpointer user_data G_GNUC_UNUSED)
+{
+  GTask *task = data;
+  PendingLoad *load = g_task_get_task_data (task);
+  GError *error = NULL;
+  GdkTexture *texture;
+  int width = 0, height = 0;
+
+  if (g_task_return_error_if_cancelled (task)) {
+    g_object_unref (task);
+    return;
+  }
+
+  /* Upscaled and tiled outputs; only their header is read */
+  gdk_pixbuf_get_file_info (load->path, &width, &height);
+  if (MAX (width, height) >= load->max_size) {
+    g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_MESSAGE_TOO_LARGE,
+                             "%s is %dx%d, too large to decode whole",
+                             load->path, width, height);
+    g_object_unref (task);
+    return;
+  }
+
+  /* Safe off the main thread, and it uploads nothing yet */
+  texture = gdk_texture_new_from_filename (load->path, &error);
+  if (texture != NULL)
+    g_task_return_pointer (task, texture, g_object_unref);
+  else
+    g_task_return_error (task, error);
+
+  g_object_unref (task);
+}
+
+static gint
+pending_load_compare (gconstpointer a,
+                      gconstpointer b,
+                      gpointer      user_data G_GNUC_UNUSED)
+{
+  const PendingLoad *la = g_task_get_task_data ((GTask *) a);
+  const PendingLoad *lb = g_task_get_task_data ((GTask *) b);
+
+  /* What is to be shown first, then the newest request */
+  if (la->prefetch != lb->prefetch)
+    return la->prefetch ? 1 : -1;
+
+  return (la->sequence < lb->sequence) - (la->sequence > lb->sequence);
+}
+
+static void
+emerge_texture_cache_init (EmergeTextureCache *self)
+{
+  self->entries = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+                                         (GDestroyNotify) cache_entry_free);
+  self->loads = g_hash_table_new (g_str_hash, g_str_equal);
+  self->too_large = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  g_queue_init (&self->lru);
+
+  self->pool = g_thread_pool_new (emerge_texture_cache_worker, NULL, 2, FALSE, NULL);
+  g_thread_pool_set_sort_function (self->pool, pending_load_compare, NULL);
+}
+
+/**
+ * emerge_texture_cache_new:
+ * @budget: the most bytes of decoded pixels to keep
+ * @max_size: images with a side this long or longer aren't decoded; loading
+ *   one fails with %G_IO_ERROR_MESSAGE_TOO_LARGE
+ */
+EmergeTextureCache *
+emerge_texture_cache_new (gsize budget,
+                          gint  max_size)
+{
+  EmergeTextureCache *self = g_object_new (EMERGE_TYPE_TEXTURE_CACHE, NULL);
+
+  self->budget = budget;
+  self->max_size = max_size;
+
+  return self;
+}
+
+static void
+cache_drop_entry (EmergeTextureCache *self,
+                  CacheEntry         *entry)
+{
+  g_queue_unlink (&self->lru, &entry->link);
+  self->size -= entry->size;
+  g_hash_table_remove (self->entries, entry->path);
+}
+
+/* The entry just inserted is never evicted, even if it alone is over
+ * budget, so the image on display is always kept */
+static void
+cache_insert (EmergeTextureCache *self,
+              const char         *path,
+              GdkTexture         *texture)
+{
+  CacheEntry *entry = g_hash_table_lookup (self->entries, path);
+
+  if (entry != NULL)
+    cache_drop_entry (self, entry);
+
+  entry = g_new0 (CacheEntry, 1);
+  entry->link.data = entry;
+  entry->path = g_strdup (path);
+  entry->texture = g_object_ref (texture);
+  entry->size = (gsize) gdk_texture_get_width (texture) * gdk_texture_get_height (texture) * 4;
+
+  g_hash_table_insert (self->entries, entry->path, entry);
+  g_queue_push_head_link (&self->lru, &entry->link);
+  self->size += entry->size;
+
+  while (self->size > self->budget && self->lru.length > 1)
+    cache_drop_entry (self, self->lru.tail->data);
+}
+
+/**
+ * emerge_texture_cache_lookup:
+ * @self: a cache
+ * @path: an image file
+ *
+ * Returns: (transfer full) (nullable): the decoded image, if it is cached
+ */
+GdkTexture *
+emerge_texture_cache_lookup (EmergeTextureCache *self,
+                             const char         *path)
+{
+  CacheEntry *entry;
+
+  g_return_val_if_fail (EMERGE_IS_TEXTURE_CACHE (self), NULL);
+  g_return_val_if_fail (path != NULL, NULL);
+
+  entry = g_hash_table_lookup (self->entries, path);
+  if (entry == NULL)
+    return NULL;
+
+  g_queue_unlink (&self->lru, &entry->link);
+  g_queue_push_head_link (&self->lru, &entry->link);
+
+  return g_object_ref (entry->texture);
+}
+
+static void
+pending_load_done_cb (GObject      *source_object,
+                      GAsyncResult *result,
+                      gpointer      user_data)
+{
+  EmergeTextureCache *self = EMERGE_TEXTURE_CACHE (source_object);
+  PendingLoad *load = user_data;
+  GError *error = NULL;
+  GdkTexture *texture;
+
+  texture = g_task_propagate_pointer (G_TASK (result), &error);
+
+  /* Unless removed meanwhile, in which case the image may be gone too */
+  if (g_hash_table_lookup (self->loads, load->path) == load) {
+    g_hash_table_remove (self->loads, load->path);
+    if (texture != NULL)
+      cache_insert (self, load->path, texture);
+    else if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_MESSAGE_TOO_LARGE))
+      g_hash_table_add (self->too_large, g_strdup (load->path));
+  }
+
+  for (guint i = 0; i < load->waiters->len; i++) {
+    GTask *waiter = g_ptr_array_index (load->waiters, i);
+
+    if (texture != NULL)
+      g_task_return_pointer (waiter, g_object_ref (texture), g_object_unref);
+    else
+      g_task_return_error (waiter, g_error_copy (error));
+  }
+
+  g_clear_object (&texture);
+  g_clear_error (&error);
+}
+
+static PendingLoad *
+cache_start_load (EmergeTextureCache *self,
+                  const char         *path,
+                  gboolean            prefetch)
+{
+  PendingLoad *load;
+  GTask *task;
+
+  load = g_new0 (PendingLoad, 1);
+  load->path = g_strdup (path);
+  load->max_size = self->max_size;
+  load->cancellable = g_cancellable_new ();
+  load->waiters = g_ptr_array_new_with_free_func (g_object_unref);
+  load->prefetch = prefetch;
+  load->sequence = ++self->sequence;
+  g_hash_table_insert (self->loads, load->path, load);
+
+  /* The task owns the load; the table only points at it while pending */
+  task = g_task_new (self, load->cancellable, pending_load_done_cb, load);
+  g_task_set_source_tag (task, cache_start_load);
+  g_task_set_task_data (task, load, (GDestroyNotify) pending_load_free);
+  g_thread_pool_push (self->pool, task, NULL);
+
+  return load;
+}
+
+/**
+ * emerge_texture_cache_load_async:
+ * @self: a cache
+ * @path: an image file
+ * @cancellable: (nullable): cancels this request only; the decode carries
+ *   on to fill the cache
+ *
+ * Gets the decoded image at @path, decoding it on a worker thread if it
+ * isn't cached. A pending prefetch of @path is reused rather than
+ * started again.
+ */
+void
+emerge_texture_cache_load_async (EmergeTextureCache  *self,
+                                 const char          *path,
+                                 GCancellable        *cancellable,
+                                 GAsyncReadyCallback  callback,
+                                 gpointer             user_data)
+{
+  PendingLoad *load;
+  GdkTexture *texture;
+  GTask *task;
+
+  g_return_if_fail (EMERGE_IS_TEXTURE_CACHE (self));
+  g_return_if_fail (path != NULL);
+
+  task = g_task_new (self, cancellable, callback, user_data);
+  g_task_set_source_tag (task, emerge_texture_cache_load_async);
+
+  texture = emerge_texture_cache_lookup (self, path);
+  if (texture != NULL) {
+    g_task_return_pointer (task, texture, g_object_unref);
+    g_object_unref (task);
+    return;
+  }
+
+  if (g_hash_table_contains (self->too_large, path)) {
+    g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_MESSAGE_TOO_LARGE,
+                             "%s is too large to decode whole", path);
+    g_object_unref (task);
+    return;
+  }
+
+  load = g_hash_table_lookup (self->loads, path);
+  if (load == NULL)
+    load = cache_start_load (self, path, FALSE);
+
+  /* Wanted now; it also keeps the next prefetch() from dropping it */
+  load->prefetch = FALSE;
+  g_ptr_array_add (load->waiters, task);
+}
+
+GdkTexture *
+emerge_texture_cache_load_finish (EmergeTextureCache  *self,
+                                  GAsyncResult        *result,
+                                  GError             **error)
+{
+  g_return_val_if_fail (g_task_is_valid (result, self), NULL);
+
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+/**
+ * emerge_texture_cache_prefetch:
+ * @self: a cache
+ * @paths: (array zero-terminated=1): images likely to be wanted next, most
+ *   likely first
+ *
+ * Decodes @paths in the background. Prefetches from an earlier call that
+ * haven't been decoded yet and aren't in @paths are dropped, so browsing
+ * quickly doesn't pile up work for images already passed. Cached images in
+ * @paths are marked as recently used, so they stay while the ones further
+ * away are evicted.
+ */
+void
+emerge_texture_cache_prefetch (EmergeTextureCache *self,
+                               const char * const *paths)
+{
+  GHashTableIter iter;
+  PendingLoad *load;
+
+  g_return_if_fail (EMERGE_IS_TEXTURE_CACHE (self));
+  g_return_if_fail (paths != NULL);
+
+  g_hash_table_iter_init (&iter, self->loads);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &load)) {
+    if (load->prefetch && !g_strv_contains (paths, load->path)) {
+      g_cancellable_cancel (load->cancellable);
+      g_hash_table_iter_remove (&iter);
+    }
+  }
+
+  /* Backwards, so the most likely ends up most recently used */
+  for (gssize i = (gssize) g_strv_length ((gchar **) paths) - 1; i >= 0; i--) {
+    CacheEntry *entry = g_hash_table_lookup (self->entries, paths[i]);
+
+    if (entry != NULL) {
+      g_queue_unlink (&self->lru, &entry->link);
+      g_queue_push_head_link (&self->lru, &entry->link);
+    } else if (!g_hash_table_contains (self->loads, paths[i]) &&
+               !g_hash_table_contains (self->too_large, paths[i])) {
+      cache_start_load (self, paths[i], TRUE);
+    }
+  }
+}
+
+/* Forgets @path, for an image that was deleted or rewritten */
+void
+emerge_texture_cache_remove (EmergeTextureCache *self,
+                             const char         *path)
+{
+  CacheEntry *entry;
+
+  g_return_if_fail (EMERGE_IS_TEXTURE_CACHE (self));
+  g_return_if_fail (path != NULL);
+
+  entry = g_hash_table_lookup (self->entries, path);
+  if (entry != NULL)
+    cache_drop_entry (self, entry);
+  g_hash_table_remove (self->too_large, path);
+
+  /* Finishes for whoever waits on it, but isn't cached */
+  g_hash_table_remove (self->loads, path);
+}
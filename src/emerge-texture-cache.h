@@ -0,0 +1,31 @@
+#pragma once
+
+#include <gtk/gtk.h>
+
+G_BEGIN_DECLS
+
+/* Enough for a few dozen 1024x1024 results */
+#define EMERGE_TEXTURE_CACHE_DEFAULT_BUDGET (256 * 1024 * 1024)
+
+#define EMERGE_TYPE_TEXTURE_CACHE (emerge_texture_cache_get_type())
+
+G_DECLARE_FINAL_TYPE (EmergeTextureCache, emerge_texture_cache, EMERGE, TEXTURE_CACHE, GObject)
+
+EmergeTextureCache *emerge_texture_cache_new         (gsize                 budget,
+                                                      gint                  max_size);
+GdkTexture         *emerge_texture_cache_lookup      (EmergeTextureCache   *self,
+                                                      const char           *path);
+void                emerge_texture_cache_load_async  (EmergeTextureCache   *self,
+                                                      const char           *path,
+                                                      GCancellable         *cancellable,
+                                                      GAsyncReadyCallback   callback,
+                                                      gpointer              user_data);
+GdkTexture         *emerge_texture_cache_load_finish (EmergeTextureCache   *self,
+                                                      GAsyncResult         *result,
+                                                      GError              **error);
+void                emerge_texture_cache_prefetch    (EmergeTextureCache   *self,
+                                                      const char * const   *paths);
+void                emerge_texture_cache_remove      (EmergeTextureCache   *self,
+                                                      const char           *path);
+
+G_END_DECLS
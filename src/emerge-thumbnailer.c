@@ -0,0 +1,323 @@
+#include "emerge-thumbnailer.h"
+
+#include <errno.h>
+#include <glib/gstdio.h>
+
+/* Decoding is done on a small pool of our own rather than the shared GTask
+ * pool, so a gallery full of thumbnails can't starve other background work.
+ * The queue is served newest first: when scrolling quickly the rows that
+ * just came into view matter, and the ones scrolled past have usually been
+ * cancelled by the time a worker gets to them. */
+struct _EmergeThumbnailer
+{
+  GObject      parent_instance;
+
+  gchar       *cache_dir;
+  GThreadPool *pool;
+  guint64      sequence;
+};
+
+G_DEFINE_TYPE (EmergeThumbnailer, emerge_thumbnailer, G_TYPE_OBJECT)
+
+typedef struct {
+  GTask   *task;
+  gchar   *image_path;
+  gchar   *small_path;
+  gchar   *large_path;
+  guint    size;
+  guint64  sequence;
+} ThumbnailRequest;
+
+static void
+thumbnail_request_free (ThumbnailRequest *request)
+{
+  g_object_unref (request->task);
+  g_free (request->image_path);
+  g_free (request->small_path);
+  g_free (request->large_path);
+  g_free (request);
+}
+
+static void
+emerge_thumbnailer_finalize (GObject *object)
+{
+  EmergeThumbnailer *self = EMERGE_THUMBNAILER (object);
+
+  /* Every queued request holds a reference through its task, so the queue
+   * is empty here. The last reference may be dropped by a worker, which
+   * must not wait for itself. */
+  g_thread_pool_free (self->pool, FALSE, FALSE);
+  g_free (self->cache_dir);
+
+  G_OBJECT_CLASS (emerge_thumbnailer_parent_class)->finalize (object);
+}
+
+static void
+emerge_thumbnailer_class_init (EmergeThumbnailerClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->finalize = emerge_thumbnailer_finalize;
+}
+
+static void
+emerge_thumbnailer_init (EmergeThumbnailer *self G_GNUC_UNUSED)
+{
+}
+
+static gint64
+file_mtime (const char *path)
+{
+  GStatBuf st;
+
+  if (g_stat (path, &st) != 0)
+    return -1;
+
+  return st.st_mtime;
+}
+
+/* Writes to a temporary name first so another worker never reads a
+ * half-written thumbnail */
+static gboolean
+save_thumbnail (GdkPixbuf   *pixbuf,
+                const char  *path,
+                GError     **error)
+{
+  gchar *dir = g_path_get_dirname (path);
+  gchar *tmp_path = g_strdup_printf ("%s.%p.tmp", path, (void *) g_thread_self ());
+  gboolean ok = FALSE;
+
+  if (g_mkdir_with_parents (dir, 0755) != 0) {
+    int saved_errno = errno;
+
+    g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (saved_errno),
+                 "Failed to create %s: %s", dir, g_strerror (saved_errno));
+  } else if (gdk_pixbuf_save (pixbuf, tmp_path, "png", error, NULL)) {
+    ok = g_rename (tmp_path, path) == 0;
+    if (!ok) {
+      int saved_errno = errno;
+
+      g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (saved_errno),
+                   "Failed to write %s: %s", path, g_strerror (saved_errno));
+      g_unlink (tmp_path);
+    }
+  }
+
+  g_free (tmp_path);
+  g_free (dir);
+
+  return ok;
+}
+
+/* Decodes the source once, at the large size, and derives the small one
+ * from that rather than decoding again */
+static GdkPixbuf *
+generate_thumbnails (ThumbnailRequest  *request,
+                     GError           **error)
+{
+  GdkPixbuf *large, *small;
+  GError *save_error = NULL;
+  int width, height;
+
+  if (gdk_pixbuf_get_file_info (request->image_path, &width, &height) == NULL) {
+    g_set_error (error, GDK_PIXBUF_ERROR, GDK_PIXBUF_ERROR_UNKNOWN_TYPE,
+                 "Unrecognized image %s", request->image_path);
+    return NULL;
+  }
+
+  /* Never scale up */
+  large = gdk_pixbuf_new_from_file_at_scale (request->image_path,
+                                             MIN (width, EMERGE_THUMBNAIL_LARGE),
+                                             MIN (height, EMERGE_THUMBNAIL_LARGE),
+                                             TRUE, error);
+  if (large == NULL)
+    return NULL;
+
+  double scale = (double) EMERGE_THUMBNAIL_SMALL / MAX (gdk_pixbuf_get_width (large),
+                                                        gdk_pixbuf_get_height (large));
+  if (scale < 1.0)
+    small = gdk_pixbuf_scale_simple (large,
+                                     MAX (1, (int) (gdk_pixbuf_get_width (large) * scale + 0.5)),
+                                     MAX (1, (int) (gdk_pixbuf_get_height (large) * scale + 0.5)),
+                                     GDK_INTERP_BILINEAR);
+  else
+    small = g_object_ref (large);
+
+  /* A cache that can't be written only costs the next decode */
+  if (!save_thumbnail (large, request->large_path, &save_error) ||
+      !save_thumbnail (small, request->small_path, &save_error)) {
+    g_warning ("Failed to cache thumbnail: %s", save_error->message);
+    g_error_free (save_error);
+  }
+
+  if (request->size > EMERGE_THUMBNAIL_SMALL) {
+    g_object_unref (small);
+    return large;
+  }
+
+  g_object_unref (large);
+  return small;
+}
+
+static void
+thumbnailer_worker (gpointer data,
+                    gpointer user_data G_GNUC_UNUSED)
+{
+  ThumbnailRequest *request = data;
+  GCancellable *cancellable = g_task_get_cancellable (request->task);
+  const char *path;
+  GdkPixbuf *pixbuf = NULL;
+  GError *error = NULL;
+  gint64 source_mtime;
+
+  if (g_task_return_error_if_cancelled (request->task)) {
+    thumbnail_request_free (request);
+    return;
+  }
+
+  path = request->size > EMERGE_THUMBNAIL_SMALL ? request->large_path : request->small_path;
+  source_mtime = file_mtime (request->image_path);
+
+  if (source_mtime >= 0 && file_mtime (path) >= source_mtime)
+    pixbuf = gdk_pixbuf_new_from_file (path, NULL);
+
+  if (pixbuf == NULL && !g_cancellable_is_cancelled (cancellable))
+    pixbuf = generate_thumbnails (request, &error);
+
+  if (pixbuf != NULL)
+    g_task_return_pointer (request->task, pixbuf, g_object_unref);
+  else if (error != NULL)
+    g_task_return_error (request->task, error);
+  else
+    g_task_return_error_if_cancelled (request->task);
+
+  thumbnail_request_free (request);
+}
+
+static gint
+thumbnail_request_compare (gconstpointer a,
+                           gconstpointer b,
+                           gpointer      user_data G_GNUC_UNUSED)
+{
+  const ThumbnailRequest *ra = a;
+  const ThumbnailRequest *rb = b;
+
+  /* Newest first */
+  return (ra->sequence < rb->sequence) - (ra->sequence > rb->sequence);
+}
+
+/**
+ * emerge_thumbnailer_new:
+ * @cache_dir: where thumbnails are kept, one subdirectory per size
+ * @max_threads: the number of decoding threads, or 0 for a default
+ *   based on the number of processors
+ */
+EmergeThumbnailer *
+emerge_thumbnailer_new (const char *cache_dir,
+                        guint       max_threads)
+{
+  EmergeThumbnailer *self;
+
+  g_return_val_if_fail (cache_dir != NULL, NULL);
+
+  if (max_threads == 0)
+    max_threads = CLAMP (g_get_num_processors () / 2, 1, 4);
+
+  self = g_object_new (EMERGE_TYPE_THUMBNAILER, NULL);
+  self->cache_dir = g_strdup (cache_dir);
+  self->pool = g_thread_pool_new (thumbnailer_worker, NULL, max_threads, FALSE, NULL);
+  g_thread_pool_set_sort_function (self->pool, thumbnail_request_compare, NULL);
+
+  return self;
+}
+
+/* The cached thumbnail of @key at @size, which need not exist yet */
+gchar *
+emerge_thumbnailer_get_path (EmergeThumbnailer *self,
+                             const char        *key,
+                             guint              size)
+{
+  gchar *dir_name, *filename, *path;
+
+  g_return_val_if_fail (EMERGE_IS_THUMBNAILER (self), NULL);
+  g_return_val_if_fail (key != NULL, NULL);
+
+  dir_name = g_strdup_printf ("%u", size > EMERGE_THUMBNAIL_SMALL ? EMERGE_THUMBNAIL_LARGE
+                                                                   : EMERGE_THUMBNAIL_SMALL);
+  filename = g_strconcat (key, ".png", NULL);
+  path = g_build_filename (self->cache_dir, dir_name, filename, NULL);
+  g_free (filename);
+  g_free (dir_name);
+
+  return path;
+}
+
+/* Deletes the cached thumbnails of @key, at every size */
+void
+emerge_thumbnailer_remove (EmergeThumbnailer *self,
+                           const char        *key)
+{
+  static const guint sizes[] = { EMERGE_THUMBNAIL_SMALL, EMERGE_THUMBNAIL_LARGE };
+
+  g_return_if_fail (EMERGE_IS_THUMBNAILER (self));
+  g_return_if_fail (key != NULL);
+
+  for (guint i = 0; i < G_N_ELEMENTS (sizes); i++) {
+    gchar *path = emerge_thumbnailer_get_path (self, key, sizes[i]);
+
+    g_unlink (path);
+    g_free (path);
+  }
+}
+
+/**
+ * emerge_thumbnailer_load_async:
+ * @self: a thumbnailer
+ * @image_path: the full-size image
+ * @key: a file name safe identifier for @image_path
+ * @size: the largest dimension wanted; the result may be smaller for
+ *   small images, and never exceeds %EMERGE_THUMBNAIL_LARGE
+ * @cancellable: (nullable): cancel this to drop the request if it hasn't
+ *   been decoded yet
+ *
+ * Loads a cached thumbnail of @image_path, generating every cached size
+ * if the cache is missing or older than the image. Pass a %NULL @callback
+ * to only warm the cache.
+ */
+void
+emerge_thumbnailer_load_async (EmergeThumbnailer   *self,
+                               const char          *image_path,
+                               const char          *key,
+                               guint                size,
+                               GCancellable        *cancellable,
+                               GAsyncReadyCallback  callback,
+                               gpointer             user_data)
+{
+  ThumbnailRequest *request;
+
+  g_return_if_fail (EMERGE_IS_THUMBNAILER (self));
+  g_return_if_fail (image_path != NULL);
+  g_return_if_fail (key != NULL);
+
+  request = g_new0 (ThumbnailRequest, 1);
+  request->task = g_task_new (self, cancellable, callback, user_data);
+  g_task_set_source_tag (request->task, emerge_thumbnailer_load_async);
+  request->image_path = g_strdup (image_path);
+  request->small_path = emerge_thumbnailer_get_path (self, key, EMERGE_THUMBNAIL_SMALL);
+  request->large_path = emerge_thumbnailer_get_path (self, key, EMERGE_THUMBNAIL_LARGE);
+  request->size = size;
+  request->sequence = ++self->sequence;
+
+  g_thread_pool_push (self->pool, request, NULL);
+}
+
+/* Returns: (transfer full): the thumbnail, or %NULL on error */
+GdkPixbuf *
+emerge_thumbnailer_load_finish (EmergeThumbnailer  *self,
+                                GAsyncResult       *result,
+                                GError            **error)
+{
+  g_return_val_if_fail (g_task_is_valid (result, self), NULL);
+
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
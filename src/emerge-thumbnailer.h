@@ -0,0 +1,35 @@
+#pragma once
+
+#include <gio/gio.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+G_BEGIN_DECLS
+
+/* Thumbnails are cached at these sizes; requests are served from the
+ * smallest one that is at least as large as asked for */
+#define EMERGE_THUMBNAIL_SMALL 128
+#define EMERGE_THUMBNAIL_LARGE 256
+
+#define EMERGE_TYPE_THUMBNAILER (emerge_thumbnailer_get_type())
+
+G_DECLARE_FINAL_TYPE (EmergeThumbnailer, emerge_thumbnailer, EMERGE, THUMBNAILER, GObject)
+
+EmergeThumbnailer *emerge_thumbnailer_new         (const char           *cache_dir,
+                                                   guint                 max_threads);
+gchar             *emerge_thumbnailer_get_path    (EmergeThumbnailer    *self,
+                                                   const char           *key,
+                                                   guint                 size);
+void               emerge_thumbnailer_remove      (EmergeThumbnailer    *self,
+                                                   const char           *key);
+void               emerge_thumbnailer_load_async  (EmergeThumbnailer    *self,
+                                                   const char           *image_path,
+                                                   const char           *key,
+                                                   guint                 size,
+                                                   GCancellable         *cancellable,
+                                                   GAsyncReadyCallback   callback,
+                                                   gpointer              user_data);
+GdkPixbuf         *emerge_thumbnailer_load_finish (EmergeThumbnailer    *self,
+                                                   GAsyncResult         *result,
+                                                   GError              **error);
+
+G_END_DECLS
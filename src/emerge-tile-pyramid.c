@@ -0,0 +1,351 @@
+#include "emerge-tile-pyramid.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+typedef struct {
+  int    width;
+  int    height;
+  int    n_columns;
+  int    n_rows;
+  gsize *offsets;   /* of each tile in the file, row by row */
+} PyramidLevel;
+
+struct _EmergeTilePyramid
+{
+  gint          ref_count;
+  guint         n_channels;
+  guint         n_levels;
+  PyramidLevel *levels;
+  GMappedFile  *mapped;
+  GBytes       *bytes;
+};
+
+EmergeTilePyramid *
+emerge_tile_pyramid_ref (EmergeTilePyramid *pyramid)
+{
+  g_return_val_if_fail (pyramid != NULL, NULL);
+
+  g_atomic_int_inc (&pyramid->ref_count);
+  return pyramid;
+}
+
+void
+emerge_tile_pyramid_unref (EmergeTilePyramid *pyramid)
+{
+  g_return_if_fail (pyramid != NULL);
+
+  if (!g_atomic_int_dec_and_test (&pyramid->ref_count))
+    return;
+
+  for (guint i = 0; i < pyramid->n_levels; i++)
+    g_free (pyramid->levels[i].offsets);
+  g_free (pyramid->levels);
+  g_clear_pointer (&pyramid->bytes, g_bytes_unref);
+  g_clear_pointer (&pyramid->mapped, g_mapped_file_unref);
+  g_free (pyramid);
+}
+
+static gboolean
+write_all (int            fd,
+           const guint8  *data,
+           gsize          length,
+           GError       **error)
+{
+  while (length > 0) {
+    gssize written = write (fd, data, length);
+
+    if (written < 0) {
+      int saved_errno = errno;
+
+      if (saved_errno == EINTR)
+        continue;
+
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (saved_errno),
+                   "Failed to write tiles: %s", g_strerror (saved_errno));
+      return FALSE;
+    }
+
+    data += written;
+    length -= written;
+  }
+
+  return TRUE;
+}
+
+/* Cuts one level into tiles, appending them to @fd at @offset */
+static gboolean
+write_level (int            fd,
+             PyramidLevel  *level,
+             const guint8  *pixels,
+             gsize          rowstride,
+             guint          n_channels,
+             gsize         *offset,
+             guint8        *tile,
+             GCancellable  *cancellable,
+             GError       **error)
+{
+  level->n_columns = (level->width + EMERGE_TILE_SIZE - 1) / EMERGE_TILE_SIZE;
+  level->n_rows = (level->height + EMERGE_TILE_SIZE - 1) / EMERGE_TILE_SIZE;
+  level->offsets = g_new (gsize, (gsize) level->n_columns * level->n_rows);
+
+  for (int row = 0; row < level->n_rows; row++) {
+    int y0 = row * EMERGE_TILE_SIZE;
+    int tile_height = MIN (EMERGE_TILE_SIZE, level->height - y0);
+
+    if (g_cancellable_set_error_if_cancelled (cancellable, error))
+      return FALSE;
+
+    for (int column = 0; column < level->n_columns; column++) {
+      int x0 = column * EMERGE_TILE_SIZE;
+      int tile_width = MIN (EMERGE_TILE_SIZE, level->width - x0);
+      gsize tile_stride = (gsize) tile_width * n_channels;
+      gsize tile_size = tile_stride * tile_height;
+
+      for (int y = 0; y < tile_height; y++)
+        memcpy (tile + y * tile_stride,
+                pixels + (gsize) (y0 + y) * rowstride + (gsize) x0 * n_channels,
+                tile_stride);
+
+      if (!write_all (fd, tile, tile_size, error))
+        return FALSE;
+
+      level->offsets[(gsize) row * level->n_columns + column] = *offset;
+      *offset += tile_size;
+    }
+  }
+
+  return TRUE;
+}
+
+/* Halves @src with a 2x2 box filter; an odd last row or column is
+ * averaged with itself */
+static guint8 *
+downsample (const guint8 *src,
+            gsize         src_stride,
+            int           src_width,
+            int           src_height,
+            guint         n_channels,
+            int          *dest_width,
+            int          *dest_height)
+{
+  int width = (src_width + 1) / 2;
+  int height = (src_height + 1) / 2;
+  gsize dest_stride = (gsize) width * n_channels;
+  guint8 *dest = g_malloc (dest_stride * height);
+
+  for (int y = 0; y < height; y++) {
+    const guint8 *row0 = src + (gsize) (2 * y) * src_stride;
+    const guint8 *row1 = src + (gsize) MIN (2 * y + 1, src_height - 1) * src_stride;
+    guint8 *out = dest + (gsize) y * dest_stride;
+
+    for (int x = 0; x < width; x++) {
+      gsize a = (gsize) (2 * x) * n_channels;
+      gsize b = (gsize) MIN (2 * x + 1, src_width - 1) * n_channels;
+
+      for (guint c = 0; c < n_channels; c++)
+        out[x * n_channels + c] = (row0[a + c] + row0[b + c] + row1[a + c] + row1[b + c] + 2) / 4;
+    }
+  }
+
+  *dest_width = width;
+  *dest_height = height;
+
+  return dest;
+}
+
+/**
+ * emerge_tile_pyramid_new_for_file:
+ * @path: an image file
+ * @cancellable: (nullable): a #GCancellable
+ * @error: return location for a #GError
+ *
+ * Decodes @path and builds its pyramid. Blocks, so call it from a worker
+ * thread. Only the decoded image and one level at a time are held in
+ * memory while building.
+ *
+ * Returns: (transfer full) (nullable): the pyramid
+ */
+EmergeTilePyramid *
+emerge_tile_pyramid_new_for_file (const char    *path,
+                                  GCancellable  *cancellable,
+                                  GError       **error)
+{
+  EmergeTilePyramid *pyramid;
+  GdkPixbuf *pixbuf;
+  GArray *levels;
+  guint8 *level_pixels = NULL, *tile;
+  gchar *tmp_path = NULL;
+  gsize offset = 0;
+  gboolean ok = TRUE;
+  int fd;
+
+  g_return_val_if_fail (path != NULL, NULL);
+
+  pixbuf = gdk_pixbuf_new_from_file (path, error);
+  if (pixbuf == NULL)
+    return NULL;
+
+  if (gdk_pixbuf_get_bits_per_sample (pixbuf) != 8) {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                 "%s: only 8-bit images can be tiled", path);
+    g_object_unref (pixbuf);
+    return NULL;
+  }
+
+  fd = g_file_open_tmp ("emerge-tiles-XXXXXX", &tmp_path, error);
+  if (fd < 0) {
+    g_object_unref (pixbuf);
+    return NULL;
+  }
+  /* Only the descriptor and the mapping keep it, so it is gone once the
+   * pyramid is, even after a crash */
+  g_unlink (tmp_path);
+  g_free (tmp_path);
+
+  pyramid = g_new0 (EmergeTilePyramid, 1);
+  pyramid->ref_count = 1;
+  pyramid->n_channels = gdk_pixbuf_get_n_channels (pixbuf);
+
+  levels = g_array_new (FALSE, TRUE, sizeof (PyramidLevel));
+  tile = g_malloc ((gsize) EMERGE_TILE_SIZE * EMERGE_TILE_SIZE * pyramid->n_channels);
+
+  {
+    PyramidLevel level = { 0 };
+    const guint8 *pixels = gdk_pixbuf_read_pixels (pixbuf);
+    gsize rowstride = gdk_pixbuf_get_rowstride (pixbuf);
+
+    level.width = gdk_pixbuf_get_width (pixbuf);
+    level.height = gdk_pixbuf_get_height (pixbuf);
+
+    for (;;) {
+      ok = write_level (fd, &level, pixels, rowstride, pyramid->n_channels,
+                        &offset, tile, cancellable, error);
+      g_array_append_val (levels, level);
+      if (!ok || (level.width <= EMERGE_TILE_SIZE && level.height <= EMERGE_TILE_SIZE))
+        break;
+
+      guint8 *next = downsample (pixels, rowstride, level.width, level.height,
+                                 pyramid->n_channels, &level.width, &level.height);
+      g_free (level_pixels);
+      pixels = level_pixels = next;
+      rowstride = (gsize) level.width * pyramid->n_channels;
+      level.offsets = NULL;
+
+      /* The full-size image is in the file now */
+      g_clear_object (&pixbuf);
+    }
+  }
+
+  g_free (level_pixels);
+  g_free (tile);
+  g_clear_object (&pixbuf);
+
+  pyramid->n_levels = levels->len;
+  pyramid->levels = (PyramidLevel *) g_array_free (levels, FALSE);
+
+  if (ok) {
+    pyramid->mapped = g_mapped_file_new_from_fd (fd, FALSE, error);
+    ok = pyramid->mapped != NULL;
+  }
+  close (fd);
+
+  if (!ok) {
+    emerge_tile_pyramid_unref (pyramid);
+    return NULL;
+  }
+
+  pyramid->bytes = g_mapped_file_get_bytes (pyramid->mapped);
+
+  return pyramid;
+}
+
+guint
+emerge_tile_pyramid_get_n_levels (EmergeTilePyramid *pyramid)
+{
+  g_return_val_if_fail (pyramid != NULL, 0);
+
+  return pyramid->n_levels;
+}
+
+/* The size of @level, in its own pixels */
+void
+emerge_tile_pyramid_get_size (EmergeTilePyramid *pyramid,
+                              guint              level,
+                              int               *width,
+                              int               *height)
+{
+  g_return_if_fail (pyramid != NULL);
+  g_return_if_fail (level < pyramid->n_levels);
+
+  if (width != NULL)
+    *width = pyramid->levels[level].width;
+  if (height != NULL)
+    *height = pyramid->levels[level].height;
+}
+
+void
+emerge_tile_pyramid_get_n_tiles (EmergeTilePyramid *pyramid,
+                                 guint              level,
+                                 int               *n_columns,
+                                 int               *n_rows)
+{
+  g_return_if_fail (pyramid != NULL);
+  g_return_if_fail (level < pyramid->n_levels);
+
+  if (n_columns != NULL)
+    *n_columns = pyramid->levels[level].n_columns;
+  if (n_rows != NULL)
+    *n_rows = pyramid->levels[level].n_rows;
+}
+
+/* 3 for RGB, 4 for non-premultiplied RGBA */
+guint
+emerge_tile_pyramid_get_n_channels (EmergeTilePyramid *pyramid)
+{
+  g_return_val_if_fail (pyramid != NULL, 0);
+
+  return pyramid->n_channels;
+}
+
+/**
+ * emerge_tile_pyramid_get_tile:
+ * @pyramid: a pyramid
+ * @level: a level
+ * @column: the tile column
+ * @row: the tile row
+ * @width: (out): the width of the tile
+ * @height: (out): the height of the tile
+ *
+ * Tiles on the right and bottom edge may be smaller than
+ * %EMERGE_TILE_SIZE. Their rows are tightly packed.
+ *
+ * Returns: (transfer full): the tile pixels, pointing into the mapping
+ */
+GBytes *
+emerge_tile_pyramid_get_tile (EmergeTilePyramid *pyramid,
+                              guint              level,
+                              int                column,
+                              int                row,
+                              int               *width,
+                              int               *height)
+{
+  PyramidLevel *l;
+
+  g_return_val_if_fail (pyramid != NULL, NULL);
+  g_return_val_if_fail (level < pyramid->n_levels, NULL);
+
+  l = &pyramid->levels[level];
+  g_return_val_if_fail (column >= 0 && column < l->n_columns, NULL);
+  g_return_val_if_fail (row >= 0 && row < l->n_rows, NULL);
+
+  *width = MIN (EMERGE_TILE_SIZE, l->width - column * EMERGE_TILE_SIZE);
+  *height = MIN (EMERGE_TILE_SIZE, l->height - row * EMERGE_TILE_SIZE);
+
+  return g_bytes_new_from_bytes (pyramid->bytes,
+                                 l->offsets[(gsize) row * l->n_columns + column],
+                                 (gsize) *width * *height * pyramid->n_channels);
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+/* Edge length of a tile, in pixels of its level */
+#define EMERGE_TILE_SIZE 256
+
+/* A mip pyramid of an image cut into tiles. Level 0 is the image itself
+ * and each level above is half the size of the one below, down to the
+ * first that fits in one tile. The tiles live in an unlinked temporary
+ * file that is mapped into memory, so the kernel can drop pages of tiles
+ * that aren't being looked at instead of the pyramid counting against the
+ * process. */
+typedef struct _EmergeTilePyramid EmergeTilePyramid;
+
+EmergeTilePyramid *emerge_tile_pyramid_new_for_file  (const char         *path,
+                                                      GCancellable       *cancellable,
+                                                      GError            **error);
+EmergeTilePyramid *emerge_tile_pyramid_ref           (EmergeTilePyramid  *pyramid);
+void               emerge_tile_pyramid_unref         (EmergeTilePyramid  *pyramid);
+
+guint              emerge_tile_pyramid_get_n_levels  (EmergeTilePyramid  *pyramid);
+void               emerge_tile_pyramid_get_size      (EmergeTilePyramid  *pyramid,
+                                                      guint               level,
+                                                      int                *width,
+                                                      int                *height);
+void               emerge_tile_pyramid_get_n_tiles   (EmergeTilePyramid  *pyramid,
+                                                      guint               level,
+                                                      int                *n_columns,
+                                                      int                *n_rows);
+guint              emerge_tile_pyramid_get_n_channels (EmergeTilePyramid *pyramid);
+GBytes            *emerge_tile_pyramid_get_tile      (EmergeTilePyramid  *pyramid,
+                                                      guint               level,
+                                                      int                 column,
+                                                      int                 row,
+                                                      int                *width,
+                                                      int                *height);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (EmergeTilePyramid, emerge_tile_pyramid_unref)
+
+G_END_DECLS
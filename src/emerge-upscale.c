@@ -0,0 +1,839 @@
+#include "emerge-upscale.h"
+#include "emerge-png-writer.h"
+
+#include <string.h>
+#include <glib/gstdio.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+/* Upscales an image with sd's ESRGAN support, cutting it into overlapping
+ * tiles that run as separate sd processes side by side. Finished tiles are
+ * cross-faded into a band one row of tiles high, and each band is handed
+ * to the PNG encoder as soon as the next row of tiles has covered its
+ * overlap, so the full-size output never exists in memory. */
+
+typedef enum {
+  TILE_PENDING,
+  TILE_RUNNING,
+  TILE_UPSCALED,
+  TILE_BLENDING,
+  TILE_BLENDED,
+  TILE_FAILED,
+} TileStatus;
+
+typedef struct {
+  EmergeUpscale *upscale;
+  guint          index;
+  guint          column;
+  guint          row;
+  guint          x;        /* in input pixels */
+  guint          y;
+  guint          width;
+  guint          height;
+  gchar         *input_path;
+  gchar         *output_path;
+  TileStatus     status;
+  EmergeProcess *process;
+  gchar         *sd_error;
+  GError        *blend_error;
+} UpscaleTile;
+
+/* Only touched by the blend thread until every blend has come back */
+typedef struct {
+  gchar           *output_path;
+  EmergePngWriter *writer;
+  guint            scale;
+  guint            width;       /* of the output */
+  guint            height;
+  float           *band;        /* weighted RGB sums and total weight per pixel */
+  guint            band_y;      /* output row of the top of the band */
+  guint            band_rows;
+  guint8          *row;
+  gboolean         failed;
+} Assembly;
+
+struct _EmergeUpscale
+{
+  GObject               parent_instance;
+
+  EmergeProcessManager *manager;
+  gchar                *sd_path;
+  gchar                *model_path;
+  guint                 tile_size;
+  guint                 overlap;
+  guint                 max_parallel;
+
+  gchar                *work_dir;
+  guint                 input_width;
+  guint                 input_height;
+  guint                *row_starts;
+  GPtrArray            *tiles;
+  Assembly              assembly;
+  GThreadPool          *blend_pool;
+  GMainContext         *context;
+
+  guint                 n_running;
+  guint                 n_blending;
+  guint                 next_blend;
+  guint                 n_done;
+  gboolean              running;
+  gint                  cancelled;
+  GError               *error;
+};
+
+G_DEFINE_TYPE (EmergeUpscale, emerge_upscale, G_TYPE_OBJECT)
+
+enum {
+  SIGNAL_PROGRESS,
+  SIGNAL_FINISHED,
+  N_SIGNALS
+};
+
+static guint upscale_signals[N_SIGNALS];
+
+static void upscale_schedule (EmergeUpscale *self);
+static void upscale_abort    (EmergeUpscale *self);
+
+static void
+upscale_tile_free (gpointer data)
+{
+  UpscaleTile *tile = data;
+
+  if (tile->process) {
+    g_signal_handlers_disconnect_by_data (tile->process, tile);
+    emerge_process_cancel (tile->process);
+    g_object_unref (tile->process);
+  }
+
+  g_free (tile->input_path);
+  g_free (tile->output_path);
+  g_free (tile->sd_error);
+  g_clear_error (&tile->blend_error);
+  g_free (tile);
+}
+
+static void
+assembly_clear (Assembly *assembly)
+{
+  /* Removes the partial output if it was never closed */
+  g_clear_pointer (&assembly->writer, emerge_png_writer_free);
+  g_clear_pointer (&assembly->output_path, g_free);
+  g_clear_pointer (&assembly->band, g_free);
+  g_clear_pointer (&assembly->row, g_free);
+  assembly->scale = 0;
+  assembly->band_y = 0;
+  assembly->failed = FALSE;
+}
+
+static void
+upscale_remove_work_dir (EmergeUpscale *self)
+{
+  if (self->work_dir == NULL)
+    return;
+
+  for (guint i = 0; self->tiles != NULL && i < self->tiles->len; i++) {
+    UpscaleTile *tile = g_ptr_array_index (self->tiles, i);
+
+    g_unlink (tile->input_path);
+    g_unlink (tile->output_path);
+  }
+
+  g_rmdir (self->work_dir);
+  g_clear_pointer (&self->work_dir, g_free);
+}
+
+static void
+emerge_upscale_finalize (GObject *object)
+{
+  EmergeUpscale *self = EMERGE_UPSCALE (object);
+
+  /* Every blend holds a reference, so the pool is idle by now */
+  g_clear_pointer (&self->blend_pool, (GDestroyNotify) g_thread_pool_free);
+  upscale_remove_work_dir (self);
+  g_clear_pointer (&self->tiles, g_ptr_array_unref);
+  assembly_clear (&self->assembly);
+  g_free (self->row_starts);
+  g_clear_pointer (&self->context, g_main_context_unref);
+  g_clear_error (&self->error);
+  g_object_unref (self->manager);
+  g_free (self->sd_path);
+  g_free (self->model_path);
+
+  G_OBJECT_CLASS (emerge_upscale_parent_class)->finalize (object);
+}
+
+static void
+emerge_upscale_class_init (EmergeUpscaleClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->finalize = emerge_upscale_finalize;
+
+  /* (n_done, n_tiles) whenever a tile has been blended into the output */
+  upscale_signals[SIGNAL_PROGRESS] =
+    g_signal_new ("progress",
+                  G_TYPE_FROM_CLASS (klass),
+                  G_SIGNAL_RUN_LAST,
+                  0, NULL, NULL, NULL,
+                  G_TYPE_NONE, 2, G_TYPE_UINT, G_TYPE_UINT);
+
+  /* Emitted once the output is written, or on failure or cancellation;
+   * emerge_upscale_get_error() tells which */
+  upscale_signals[SIGNAL_FINISHED] =
+    g_signal_new ("finished",
+                  G_TYPE_FROM_CLASS (klass),
+                  G_SIGNAL_RUN_LAST,
+                  0, NULL, NULL, NULL,
+                  G_TYPE_NONE, 0);
+}
+
+static void
+emerge_upscale_init (EmergeUpscale *self)
+{
+  self->tile_size = EMERGE_UPSCALE_DEFAULT_TILE_SIZE;
+  self->overlap = EMERGE_UPSCALE_DEFAULT_OVERLAP;
+
+  /* ESRGAN is compute bound, so a few processes with a share of the
+   * cores each keep them all busy without thrashing the caches */
+  self->max_parallel = CLAMP (g_get_num_processors () / 4, 1, 4);
+}
+
+EmergeUpscale *
+emerge_upscale_new (EmergeProcessManager *manager,
+                    const char           *sd_path,
+                    const char           *model_path)
+{
+  EmergeUpscale *self;
+
+  g_return_val_if_fail (EMERGE_IS_PROCESS_MANAGER (manager), NULL);
+  g_return_val_if_fail (sd_path != NULL, NULL);
+  g_return_val_if_fail (model_path != NULL, NULL);
+
+  self = g_object_new (EMERGE_TYPE_UPSCALE, NULL);
+  self->manager = g_object_ref (manager);
+  self->sd_path = g_strdup (sd_path);
+  self->model_path = g_strdup (model_path);
+
+  return self;
+}
+
+void
+emerge_upscale_set_tile_size (EmergeUpscale *self,
+                              guint          tile_size)
+{
+  g_return_if_fail (EMERGE_IS_UPSCALE (self));
+  g_return_if_fail (!self->running);
+
+  self->tile_size = MAX (tile_size, 16);
+}
+
+void
+emerge_upscale_set_overlap (EmergeUpscale *self,
+                            guint          overlap)
+{
+  g_return_if_fail (EMERGE_IS_UPSCALE (self));
+  g_return_if_fail (!self->running);
+
+  self->overlap = overlap;
+}
+
+void
+emerge_upscale_set_max_parallel (EmergeUpscale *self,
+                                 guint          max_parallel)
+{
+  g_return_if_fail (EMERGE_IS_UPSCALE (self));
+
+  self->max_parallel = MAX (max_parallel, 1);
+}
+
+/**
+ * emerge_upscale_split:
+ * @length: the width or height of the image
+ * @tile_size: the largest tile wanted
+ * @overlap: the least overlap wanted between neighbouring tiles
+ * @n_tiles: (out): return location for the number of tiles
+ *
+ * Cuts @length into as few tiles of @tile_size (or @length, if smaller) as
+ * cover it with at least @overlap between neighbours, spread evenly so no
+ * tile is left as a thin sliver at the end. @overlap is capped at half a
+ * tile.
+ *
+ * Returns: (transfer full): the start of each tile
+ */
+guint *
+emerge_upscale_split (guint  length,
+                      guint  tile_size,
+                      guint  overlap,
+                      guint *n_tiles)
+{
+  guint *starts;
+  guint step, n;
+
+  g_return_val_if_fail (length > 0 && tile_size > 0, NULL);
+  g_return_val_if_fail (n_tiles != NULL, NULL);
+
+  overlap = MIN (overlap, tile_size / 2);
+  step = tile_size - overlap;
+
+  n = length <= tile_size ? 1 : (length - tile_size + step - 1) / step + 1;
+  starts = g_new (guint, n);
+
+  for (guint i = 0; i < n; i++)
+    starts[i] = n > 1 ? ((guint64) i * (length - tile_size) + (n - 1) / 2) / (n - 1) : 0;
+
+  *n_tiles = n;
+  return starts;
+}
+
+/* Weights across a tile: 1 in the middle, falling off over @fade pixels
+ * towards edges shared with a neighbour so overlapping tiles cross-fade.
+ * Edges on the border of the image keep full weight. */
+static float *
+upscale_ramp (guint    length,
+              guint    fade,
+              gboolean fade_start,
+              gboolean fade_end)
+{
+  float *weights = g_new (float, length);
+
+  for (guint i = 0; i < length; i++) {
+    float weight = 1.0f;
+
+    if (fade > 0 && fade_start)
+      weight = MIN (weight, (i + 0.5f) / fade);
+    if (fade > 0 && fade_end)
+      weight = MIN (weight, (length - i - 0.5f) / fade);
+
+    weights[i] = weight;
+  }
+
+  return weights;
+}
+
+/* Encodes the top @n_rows of the band, which no tile still to come covers */
+static gboolean
+assembly_write_rows (Assembly  *assembly,
+                     guint      n_rows,
+                     GError   **error)
+{
+  for (guint y = 0; y < n_rows; y++) {
+    const float *src = assembly->band + (gsize) y * assembly->width * 4;
+
+    for (guint x = 0; x < assembly->width; x++, src += 4) {
+      float weight = src[3] > 0.0f ? src[3] : 1.0f;
+
+      for (int c = 0; c < 3; c++)
+        assembly->row[x * 3 + c] = (guint8) CLAMP (src[c] / weight + 0.5f, 0.0f, 255.0f);
+    }
+
+    if (!emerge_png_writer_write_rows (assembly->writer, assembly->row, 0, 1, error))
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* Writes out everything above output row @y and moves the band down */
+static gboolean
+assembly_advance (Assembly  *assembly,
+                  guint      y,
+                  GError   **error)
+{
+  gsize row_floats = (gsize) assembly->width * 4;
+  guint n_final = y - assembly->band_y;
+  guint n_kept = assembly->band_rows - n_final;
+
+  if (!assembly_write_rows (assembly, n_final, error))
+    return FALSE;
+
+  memmove (assembly->band, assembly->band + n_final * row_floats,
+           n_kept * row_floats * sizeof (float));
+  memset (assembly->band + n_kept * row_floats, 0, n_final * row_floats * sizeof (float));
+  assembly->band_y = y;
+
+  return TRUE;
+}
+
+static gboolean
+assembly_add_tile (EmergeUpscale  *self,
+                   UpscaleTile    *tile,
+                   GError        **error)
+{
+  Assembly *assembly = &self->assembly;
+  GdkPixbuf *pixbuf;
+  const guint8 *pixels;
+  float *column_weights, *row_weights;
+  guint width, height, n_channels, fade;
+  gsize rowstride;
+
+  pixbuf = gdk_pixbuf_new_from_file (tile->output_path, error);
+  if (pixbuf == NULL)
+    return FALSE;
+
+  width = gdk_pixbuf_get_width (pixbuf);
+  height = gdk_pixbuf_get_height (pixbuf);
+
+  /* The first tile tells how much the model scales by */
+  if (assembly->scale == 0 && width % tile->width == 0 && width >= tile->width) {
+    assembly->scale = width / tile->width;
+    assembly->width = self->input_width * assembly->scale;
+    assembly->height = self->input_height * assembly->scale;
+    assembly->band_rows = tile->height * assembly->scale;
+    assembly->band = g_new0 (float, (gsize) assembly->width * assembly->band_rows * 4);
+    assembly->row = g_malloc ((gsize) assembly->width * 3);
+    assembly->writer = emerge_png_writer_new (assembly->output_path,
+                                              assembly->width, assembly->height, error);
+    if (assembly->writer == NULL) {
+      g_object_unref (pixbuf);
+      return FALSE;
+    }
+  }
+
+  if (assembly->scale == 0 ||
+      width != tile->width * assembly->scale ||
+      height != tile->height * assembly->scale) {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                 "The upscaler turned a %u×%u tile into %u×%u, which isn't a whole multiple",
+                 tile->width, tile->height, width, height);
+    g_object_unref (pixbuf);
+    return FALSE;
+  }
+
+  /* Tiles arrive row by row, so the first of a row finalises everything
+   * above the row's top edge */
+  if (tile->column == 0 && tile->row > 0 &&
+      !assembly_advance (assembly, self->row_starts[tile->row] * assembly->scale, error)) {
+    g_object_unref (pixbuf);
+    return FALSE;
+  }
+
+  fade = self->overlap * assembly->scale;
+  column_weights = upscale_ramp (width, fade,
+                                 tile->x > 0,
+                                 tile->x + tile->width < self->input_width);
+  row_weights = upscale_ramp (height, fade,
+                              tile->y > 0,
+                              tile->y + tile->height < self->input_height);
+
+  pixels = gdk_pixbuf_read_pixels (pixbuf);
+  rowstride = gdk_pixbuf_get_rowstride (pixbuf);
+  n_channels = gdk_pixbuf_get_n_channels (pixbuf);
+
+  for (guint j = 0; j < height; j++) {
+    const guint8 *src = pixels + j * rowstride;
+    float *dst = assembly->band +
+                 ((gsize) (tile->y * assembly->scale + j - assembly->band_y) * assembly->width +
+                  tile->x * assembly->scale) * 4;
+
+    for (guint i = 0; i < width; i++, src += n_channels, dst += 4) {
+      float weight = column_weights[i] * row_weights[j];
+
+      dst[0] += weight * src[0];
+      dst[1] += weight * src[1];
+      dst[2] += weight * src[2];
+      dst[3] += weight;
+    }
+  }
+
+  g_free (column_weights);
+  g_free (row_weights);
+  g_object_unref (pixbuf);
+
+  return TRUE;
+}
+
+static gboolean
+assembly_finish (Assembly  *assembly,
+                 GError   **error)
+{
+  return assembly_write_rows (assembly, assembly->height - assembly->band_y, error) &&
+         emerge_png_writer_close (assembly->writer, error);
+}
+
+static gboolean
+upscale_tile_blended_cb (gpointer data)
+{
+  UpscaleTile *tile = data;
+  EmergeUpscale *self = tile->upscale;
+
+  self->n_blending--;
+  g_unlink (tile->output_path);
+
+  if (tile->blend_error != NULL) {
+    tile->status = TILE_FAILED;
+    if (self->error == NULL)
+      self->error = g_error_copy (tile->blend_error);
+    upscale_abort (self);
+  } else if (tile->status == TILE_BLENDING && !self->cancelled) {
+    tile->status = TILE_BLENDED;
+    self->n_done++;
+    g_signal_emit (self, upscale_signals[SIGNAL_PROGRESS], 0,
+                   self->n_done, self->tiles->len);
+  }
+
+  upscale_schedule (self);
+  g_object_unref (self);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+upscale_blend_thread (gpointer data,
+                      gpointer user_data)
+{
+  UpscaleTile *tile = data;
+  EmergeUpscale *self = user_data;
+  Assembly *assembly = &self->assembly;
+  GSource *source;
+
+  if (!assembly->failed && !g_atomic_int_get (&self->cancelled)) {
+    if (!assembly_add_tile (self, tile, &tile->blend_error) ||
+        (tile->index == self->tiles->len - 1 && !assembly_finish (assembly, &tile->blend_error)))
+      assembly->failed = TRUE;
+  }
+
+  source = g_idle_source_new ();
+  g_source_set_callback (source, upscale_tile_blended_cb, tile, NULL);
+  g_source_attach (source, self->context);
+  g_source_unref (source);
+}
+
+static void
+upscale_tile_output_cb (EmergeProcess *process G_GNUC_UNUSED,
+                        const char    *line,
+                        UpscaleTile   *tile)
+{
+  if (g_str_has_prefix (line, "[ERROR]")) {
+    g_free (tile->sd_error);
+    tile->sd_error = g_strstrip (g_strdup (line + strlen ("[ERROR]")));
+  }
+}
+
+static void
+upscale_tile_exited_cb (EmergeProcess *process,
+                        gint           wait_status,
+                        UpscaleTile   *tile)
+{
+  EmergeUpscale *self = tile->upscale;
+
+  g_object_ref (self);
+
+  self->n_running--;
+
+  if (emerge_process_was_cancelled (process)) {
+    tile->status = TILE_FAILED;
+  } else if (wait_status == 0 && g_file_test (tile->output_path, G_FILE_TEST_IS_REGULAR)) {
+    tile->status = TILE_UPSCALED;
+  } else {
+    tile->status = TILE_FAILED;
+    if (self->error == NULL)
+      self->error = g_error_new (G_IO_ERROR, G_IO_ERROR_FAILED,
+                                 "Upscaling tile %u,%u failed: %s",
+                                 tile->column, tile->row,
+                                 tile->sd_error ? tile->sd_error : "sd exited with an error");
+    upscale_abort (self);
+  }
+
+  g_signal_handlers_disconnect_by_data (process, tile);
+  g_clear_object (&tile->process);
+
+  upscale_schedule (self);
+
+  g_object_unref (self);
+}
+
+static gboolean
+upscale_tile_spawn (UpscaleTile  *tile,
+                    GError      **error)
+{
+  EmergeUpscale *self = tile->upscale;
+  GStrvBuilder *builder = g_strv_builder_new ();
+  gchar **argv;
+
+  g_strv_builder_add_many (builder,
+                           self->sd_path,
+                           "--mode", "upscale",
+                           "--upscale-model", self->model_path,
+                           "--input", tile->input_path,
+                           "--output", tile->output_path,
+                           "--threads", NULL);
+  g_strv_builder_take (builder, g_strdup_printf ("%u", MAX (g_get_num_processors () / self->max_parallel, 1)));
+  argv = g_strv_builder_end (builder);
+  g_strv_builder_unref (builder);
+
+  tile->process = emerge_process_manager_spawn (self->manager, "upscale",
+                                                (const char * const *) argv,
+                                                NULL, error);
+  g_strfreev (argv);
+
+  if (tile->process == NULL)
+    return FALSE;
+
+  tile->status = TILE_RUNNING;
+  self->n_running++;
+
+  g_signal_connect (tile->process, "output",
+                    G_CALLBACK (upscale_tile_output_cb), tile);
+  g_signal_connect (tile->process, "exited",
+                    G_CALLBACK (upscale_tile_exited_cb), tile);
+
+  return TRUE;
+}
+
+static void
+upscale_maybe_finish (EmergeUpscale *self)
+{
+  if (!self->running || self->n_running > 0 || self->n_blending > 0)
+    return;
+
+  if (self->error == NULL && !self->cancelled && self->n_done < self->tiles->len)
+    return;
+
+  self->running = FALSE;
+
+  if (self->error == NULL && self->cancelled)
+    self->error = g_error_new_literal (G_IO_ERROR, G_IO_ERROR_CANCELLED,
+                                       "Upscaling was cancelled");
+
+  assembly_clear (&self->assembly);
+  upscale_remove_work_dir (self);
+
+  g_signal_emit (self, upscale_signals[SIGNAL_FINISHED], 0);
+}
+
+/* Keeps max_parallel tiles upscaling and hands finished tiles to the blend
+ * thread strictly in order, since the band only ever moves down */
+static void
+upscale_schedule (EmergeUpscale *self)
+{
+  for (guint i = 0; i < self->tiles->len && !self->cancelled; i++) {
+    UpscaleTile *tile = g_ptr_array_index (self->tiles, i);
+    GError *error = NULL;
+
+    if (tile->status != TILE_PENDING)
+      continue;
+
+    if (self->n_running >= self->max_parallel)
+      break;
+
+    if (!upscale_tile_spawn (tile, &error)) {
+      tile->status = TILE_FAILED;
+      if (self->error == NULL)
+        self->error = error;
+      else
+        g_error_free (error);
+      upscale_abort (self);
+      break;
+    }
+  }
+
+  while (!self->cancelled && self->next_blend < self->tiles->len) {
+    UpscaleTile *tile = g_ptr_array_index (self->tiles, self->next_blend);
+
+    if (tile->status != TILE_UPSCALED)
+      break;
+
+    tile->status = TILE_BLENDING;
+    self->next_blend++;
+    self->n_blending++;
+    g_object_ref (self);
+    g_thread_pool_push (self->blend_pool, tile, NULL);
+  }
+
+  upscale_maybe_finish (self);
+}
+
+/**
+ * emerge_upscale_start:
+ * @self: an upscaler
+ * @input_path: the image to upscale
+ * @output_path: where to write the result
+ * @error: return location for an error
+ *
+ * Cuts @input_path into tiles and starts upscaling them. "progress" is
+ * emitted as tiles are blended into the output and "finished" once
+ * @output_path has been written or the upscale has failed.
+ *
+ * Returns: %TRUE if the upscale was started, %FALSE if it failed right away
+ */
+gboolean
+emerge_upscale_start (EmergeUpscale  *self,
+                      const char     *input_path,
+                      const char     *output_path,
+                      GError        **error)
+{
+  GdkPixbuf *input;
+  gboolean ret;
+
+  g_return_val_if_fail (EMERGE_IS_UPSCALE (self), FALSE);
+  g_return_val_if_fail (input_path != NULL, FALSE);
+
+  input = gdk_pixbuf_new_from_file (input_path, error);
+  if (input == NULL)
+    return FALSE;
+
+  ret = emerge_upscale_start_for_pixbuf (self, input, output_path, error);
+  g_object_unref (input);
+
+  return ret;
+}
+
+/* Like emerge_upscale_start(), for an image that is already decoded */
+gboolean
+emerge_upscale_start_for_pixbuf (EmergeUpscale  *self,
+                                 GdkPixbuf      *input,
+                                 const char     *output_path,
+                                 GError        **error)
+{
+  guint *column_starts;
+  guint n_columns, n_rows, tile_width, tile_height;
+
+  g_return_val_if_fail (EMERGE_IS_UPSCALE (self), FALSE);
+  g_return_val_if_fail (!self->running, FALSE);
+  g_return_val_if_fail (GDK_IS_PIXBUF (input) && output_path != NULL, FALSE);
+
+  self->work_dir = g_dir_make_tmp ("emerge-upscale-XXXXXX", error);
+  if (self->work_dir == NULL)
+    return FALSE;
+
+  g_clear_error (&self->error);
+  g_clear_pointer (&self->tiles, g_ptr_array_unref);
+  g_clear_pointer (&self->row_starts, g_free);
+  self->tiles = g_ptr_array_new_with_free_func (upscale_tile_free);
+  self->input_width = gdk_pixbuf_get_width (input);
+  self->input_height = gdk_pixbuf_get_height (input);
+  self->overlap = MIN (self->overlap, self->tile_size / 2);
+  self->n_running = 0;
+  self->n_blending = 0;
+  self->next_blend = 0;
+  self->n_done = 0;
+  self->cancelled = FALSE;
+
+  column_starts = emerge_upscale_split (self->input_width, self->tile_size,
+                                        self->overlap, &n_columns);
+  self->row_starts = emerge_upscale_split (self->input_height, self->tile_size,
+                                           self->overlap, &n_rows);
+  tile_width = MIN (self->tile_size, self->input_width);
+  tile_height = MIN (self->tile_size, self->input_height);
+
+  /* The input is small next to the output, so every tile is cut up front
+   * and the input let go of */
+  for (guint row = 0; row < n_rows; row++) {
+    for (guint column = 0; column < n_columns; column++) {
+      UpscaleTile *tile = g_new0 (UpscaleTile, 1);
+      GdkPixbuf *crop;
+      gchar *name;
+
+      tile->upscale = self;
+      tile->index = self->tiles->len;
+      tile->column = column;
+      tile->row = row;
+      tile->x = column_starts[column];
+      tile->y = self->row_starts[row];
+      tile->width = tile_width;
+      tile->height = tile_height;
+      tile->status = TILE_PENDING;
+
+      name = g_strdup_printf ("tile-%u-%u.png", row, column);
+      tile->input_path = g_build_filename (self->work_dir, name, NULL);
+      g_free (name);
+      name = g_strdup_printf ("tile-%u-%u-upscaled.png", row, column);
+      tile->output_path = g_build_filename (self->work_dir, name, NULL);
+      g_free (name);
+
+      g_ptr_array_add (self->tiles, tile);
+
+      crop = gdk_pixbuf_new_subpixbuf (input, tile->x, tile->y, tile->width, tile->height);
+      if (!gdk_pixbuf_save (crop, tile->input_path, "png", error, NULL)) {
+        g_object_unref (crop);
+        g_free (column_starts);
+        upscale_remove_work_dir (self);
+        return FALSE;
+      }
+      g_object_unref (crop);
+    }
+  }
+
+  g_free (column_starts);
+
+  assembly_clear (&self->assembly);
+  self->assembly.output_path = g_strdup (output_path);
+
+  /* A single blend thread keeps tiles in order */
+  if (self->blend_pool == NULL)
+    self->blend_pool = g_thread_pool_new (upscale_blend_thread, self, 1, FALSE, NULL);
+  if (self->context == NULL)
+    self->context = g_main_context_ref_thread_default ();
+
+  self->running = TRUE;
+  upscale_schedule (self);
+
+  /* Not even the first tile could be started */
+  if (!self->running) {
+    g_propagate_error (error, g_error_copy (self->error));
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* Stops starting and blending tiles and kills the running ones. The upscale
+ * finishes once the last of them has exited. */
+static void
+upscale_abort (EmergeUpscale *self)
+{
+  if (!self->running || self->cancelled)
+    return;
+
+  g_atomic_int_set (&self->cancelled, TRUE);
+
+  for (guint i = 0; i < self->tiles->len; i++) {
+    UpscaleTile *tile = g_ptr_array_index (self->tiles, i);
+
+    if (tile->process != NULL)
+      emerge_process_cancel (tile->process);
+  }
+}
+
+void
+emerge_upscale_cancel (EmergeUpscale *self)
+{
+  g_return_if_fail (EMERGE_IS_UPSCALE (self));
+
+  g_object_ref (self);
+  upscale_abort (self);
+  upscale_schedule (self);
+  g_object_unref (self);
+}
+
+gboolean
+emerge_upscale_is_running (EmergeUpscale *self)
+{
+  g_return_val_if_fail (EMERGE_IS_UPSCALE (self), FALSE);
+
+  return self->running;
+}
+
+guint
+emerge_upscale_get_n_tiles (EmergeUpscale *self)
+{
+  g_return_val_if_fail (EMERGE_IS_UPSCALE (self), 0);
+
+  return self->tiles != NULL ? self->tiles->len : 0;
+}
+
+guint
+emerge_upscale_get_n_done (EmergeUpscale *self)
+{
+  g_return_val_if_fail (EMERGE_IS_UPSCALE (self), 0);
+
+  return self->n_done;
+}
+
+/* Why the last upscale didn't produce an output, or %NULL if it did */
+const GError *
+emerge_upscale_get_error (EmergeUpscale *self)
+{
+  g_return_val_if_fail (EMERGE_IS_UPSCALE (self), NULL);
+
+  return self->error;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <gio/gio.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+#include "emerge-process-manager.h"
+
+G_BEGIN_DECLS
+
+/* Edge length of the tiles the input is cut into, in input pixels, and how
+ * far neighbouring tiles overlap so their seams can be blended */
+#define EMERGE_UPSCALE_DEFAULT_TILE_SIZE 256
+#define EMERGE_UPSCALE_DEFAULT_OVERLAP   32
+
+#define EMERGE_TYPE_UPSCALE (emerge_upscale_get_type())
+
+G_DECLARE_FINAL_TYPE (EmergeUpscale, emerge_upscale, EMERGE, UPSCALE, GObject)
+
+EmergeUpscale *emerge_upscale_new              (EmergeProcessManager  *manager,
+                                                const char            *sd_path,
+                                                const char            *model_path);
+void           emerge_upscale_set_tile_size    (EmergeUpscale         *self,
+                                                guint                  tile_size);
+void           emerge_upscale_set_overlap      (EmergeUpscale         *self,
+                                                guint                  overlap);
+void           emerge_upscale_set_max_parallel (EmergeUpscale         *self,
+                                                guint                  max_parallel);
+gboolean       emerge_upscale_start            (EmergeUpscale         *self,
+                                                const char            *input_path,
+                                                const char            *output_path,
+                                                GError               **error);
+gboolean       emerge_upscale_start_for_pixbuf (EmergeUpscale         *self,
+                                                GdkPixbuf             *input,
+                                                const char            *output_path,
+                                                GError               **error);
+void           emerge_upscale_cancel           (EmergeUpscale         *self);
+gboolean       emerge_upscale_is_running       (EmergeUpscale         *self);
+guint          emerge_upscale_get_n_tiles      (EmergeUpscale         *self);
+guint          emerge_upscale_get_n_done       (EmergeUpscale         *self);
+const GError  *emerge_upscale_get_error        (EmergeUpscale         *self);
+
+guint         *emerge_upscale_split            (guint                  length,
+                                                guint                  tile_size,
+                                                guint                  overlap,
+                                                guint                 *n_tiles);
+
+G_END_DECLS
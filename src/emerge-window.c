@@ -1,9 +1,32 @@
 #include "emerge-window.h"
+#include "emerge-preload.h"
+#include "emerge-process-manager.h"
+#include "emerge-sd.h"
+#include "emerge-batch-convert.h"
+#include "emerge-job.h"
+#include "emerge-quant-bench.h"
+#include "emerge-benchmark.h"
+#include "emerge-history.h"
+#include "emerge-history-index.h"
+#include "emerge-thumbnailer.h"
+#include "emerge-dedupe.h"
+#include "emerge-texture-cache.h"
+#include "emerge-image-viewer.h"
+#include "emerge-upscale.h"
+#include "emerge-convergence.h"
+#include "emerge-store.h"
+#include "emerge-queue.h"
+#include "emerge-startup.h"
+#include "emerge-hot-folder.h"
+#include "emerge-sweep.h"
+#include "emerge-cost-model.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <math.h>
 #include <signal.h>
 #include <time.h>
 #include <glib/gspawn.h>
+#include <glib/gstdio.h>
 #include <sys/stat.h>
 #include <json-glib/json-glib.h>
 
@@ -14,8 +37,18 @@ struct _EmergeWindow
   /* Template widgets */
   GtkHeaderBar        *header_bar;
   GtkPicture          *output_image;
+  GtkWidget           *image_view;
+  GtkStack            *image_stack;
+  EmergeImageViewer   *tiled_viewer;
+  GtkStack            *output_stack;
+  GtkGridView         *gallery_view;
+  GtkSearchEntry      *gallery_search;
+  GtkToggleButton     *history_button;
+  GtkToggleButton     *collapse_button;
+  GtkButton           *dedupe_button;
   GtkEntry            *prompt_entry;
   GtkEntry            *negative_prompt_entry;
+  AdwSwitchRow        *live_toggle;
   GtkSpinButton       *width_spin;
   GtkSpinButton       *height_spin;
   GtkSpinButton       *steps_spin;
@@ -23,7 +56,12 @@ struct _EmergeWindow
   GtkSpinButton       *cfg_scale_spin;
   GtkDropDown         *sampling_method_dropdown;
   GtkButton           *generate_button;
+  GtkButton           *draft_button;
+  GtkSpinButton       *batch_count_spin;
+  GtkButton           *queue_button;
+  AdwButtonContent    *queue_button_content;
   GtkButton           *stop_button;
+  GtkButton           *pause_button;
   GtkButton           *save_button;
   GtkSpinner          *spinner;
   AdwToastOverlay     *toast_overlay;
@@ -33,6 +71,14 @@ struct _EmergeWindow
   GtkButton           *initial_image_chooser;
   AdwSwitchRow        *img2img_toggle;
   GtkSpinButton       *strength_spin;
+  AdwSwitchRow        *preview_toggle;
+  GtkWidget           *preview_interval_row;
+  GtkSpinButton       *preview_interval_spin;
+  AdwSwitchRow        *early_stop_toggle;
+  AdwSwitchRow        *upscale_toggle;
+  GtkButton           *upscale_model_chooser;
+  GtkWidget           *upscale_tile_row;
+  GtkSpinButton       *upscale_tile_spin;
   GtkLabel            *status_label;
   GtkButton           *convert_model_button;
   GtkDropDown         *quantization_dropdown;
@@ -40,17 +86,103 @@ struct _EmergeWindow
   GtkMenuButton       *template_menu_button;
   GtkDropDown         *model_dropdown;
   GtkButton           *model_dir_button;
+  GtkButton           *batch_convert_button;
+  GtkButton           *quant_bench_button;
+  GtkButton           *benchmark_button;
+  AdwActionRow        *conversion_row;
+  GtkProgressBar      *conversion_progress;
 
-  /* Config */
+  /* Config, saved in the background */
   EmergeConfig        config;
+  EmergeStore        *store;
 
-  /* Generation state */
-  GPid                child_pid;
-  guint               child_watch_id;
-  GCancellable       *cancellable;
+  /* Child processes; generation and conversion run independently */
+  EmergeProcessManager *process_manager;
+  EmergeProcess      *generate_process;
+  EmergeProcess      *convert_process;
+  EmergeBatchConvert *batch_convert;
+  EmergeQuantBench   *quant_bench;
+  EmergeBenchmark    *benchmark;
+  EmergeJob          *generate_job;
+  EmergeUpscale      *upscale;
+  EmergeProcess      *live_process;
+  GPtrArray          *preempted;
+  gchar              *upscale_output_path;
+  gboolean            stop_requested;
+  
+  /* Jobs waiting their turn, recorded so a batch outlives a crash. The
+   * queue is held after a stop or a failure to start until more is added. */
+  EmergeQueue        *queue;
+  guint64             queue_job_id;
+  gboolean            queue_held;
+  guint               queue_idle_id;
+  
+  /* How long past jobs took on this machine, to tell how long the queue will */
+  EmergeCostModel    *cost_model;
+  gint                generate_step;
+  
+  /* Images dropped into a watched folder, repainted through the queue */
+  EmergeHotFolder    *hot_folder;
+  GFile              *hot_folder_input;    /* while its template is picked */
+  
+  /* A template sweep, fed to the queue a few jobs at a time */
+  EmergeSweep        *sweep;               /* NULL once every job is queued */
+  EmergeJob          *sweep_base;
+  GHashTable         *sweep_ids;           /* its jobs in the queue, as guint64 */
+  guint64             sweep_total;
+  guint64             sweep_finished;
+  gint64              sweep_start_time;
+  gboolean            sweep_feeding;
+  double              sweep_rest_seconds;  /* for the unqueued part, or -1 */
+  guint64             sweep_rest_position; /* what that was estimated at */
+  guint               sweep_rest_n_runs;
+  
+  /* Pictures of the generation in progress; the interval is raised if
+   * they turn out to slow sampling down too much */
+  GCancellable       *preview_cancellable;
+  gint64              preview_mtime;
+  gint                preview_min_interval;
+  gint                preview_step;
+  
+  /* Early stopping: the step each model, sampler and size was seen to settle
+   * at, learned from the previews of a full run and used for later ones */
+  EmergeConvergence  *convergence;
+  GHashTable         *converged_steps;
+  
+  /* Live preview; edits are debounced before a preview is started */
+  guint               live_timeout_id;
+  gboolean            live_pending;
+  gint64              live_edit_time;
+  gchar              *live_output_path;
+  
+  /* Every finished image, kept across runs */
+  EmergeHistory      *history;
+  EmergeHistoryIndex *history_index;
+  EmergeThumbnailer  *thumbnailer;
+  GCancellable       *history_cancellable;
+  
+  /* Near-duplicates hidden from the gallery while collapsed */
+  GtkCustomFilter    *gallery_filter;
+  EmergeDuplicates   *gallery_duplicates;
+  guint               duplicates_idle_id;
+  GHashTable         *gallery_cells;
+  
+  /* Decoded results, for stepping through the gallery from the viewer */
+  EmergeTextureCache *texture_cache;
+  GCancellable       *show_cancellable;
+  gchar              *show_path;
+  EmergeHistoryItem  *viewed_item;
+  guint               viewed_position;
+  gboolean            viewed_backwards;
+  
+  /* Generation state. A new image arrives from sd in memory and only gets
+   * a path once the history has stored it. */
   gchar              *output_path;
+  GBytes             *output_bytes;
+  gchar              *temp_dir;
   gchar              *model_path;
   gchar              *initial_image_path;
+  gchar              *upscale_model_path;
   gboolean            is_generating;
   guint               image_counter;
   gchar              *last_saved_dir;
@@ -59,10 +191,38 @@ struct _EmergeWindow
   /* Model selection */
   GtkStringList      *model_list;
   GFile              *models_directory;
+  
+  /* Work left until the first frame is on screen: listing the models and
+   * resuming the queue */
+  guint               startup_idle_id;
+
+  /* Speculative page-cache warming of the selected model */
+  EmergePreload      *preload;
+  gint64              generate_start_time;
+  double              preload_hidden_seconds;
+  double              preload_warm_fraction;
 };
 
 G_DEFINE_TYPE (EmergeWindow, emerge_window, ADW_TYPE_APPLICATION_WINDOW)
 
+/* Live previews wait for typing to pause this long, then draw at most this
+ * big on the long side with this many steps (fewer for lcm, which is made
+ * for it) */
+#define EMERGE_WINDOW_LIVE_DEBOUNCE_MS  300
+#define EMERGE_WINDOW_LIVE_SIZE         256
+#define EMERGE_WINDOW_LIVE_STEPS        8
+#define EMERGE_WINDOW_LIVE_LCM_STEPS    4
+
+/* The most sampling may be slowed down by previews */
+#define EMERGE_WINDOW_PREVIEW_MAX_OVERHEAD 0.05
+
+/* How long children get to exit when the window closes before being killed */
+#define EMERGE_WINDOW_SHUTDOWN_TIMEOUT_MS 2000
+
+/* How many of the combinations a sweep has yet to queue are timed to
+ * estimate them all */
+#define EMERGE_WINDOW_SWEEP_SAMPLES 32
+
 // Forward declarations for template functions
 static void on_save_template_clicked (EmergeWindow *self);
 static void on_load_template_clicked (EmergeWindow *self);
@@ -72,1627 +232,4760 @@ static void populate_model_dropdown (EmergeWindow *self);
 static void emerge_window_finalize (GObject *object);
 
 static void
-process_finished_cb (GPid pid, gint status, gpointer user_data)
+preload_progress_cb (EmergePreload *preload G_GNUC_UNUSED,
+                     guint64        done_bytes,
+                     guint64        total_bytes,
+                     gpointer       user_data)
 {
   EmergeWindow *self = EMERGE_WINDOW (user_data);
+
+  /* Don't clobber the status of a running generation */
+  if (self->is_generating)
+    return;
+
+  gchar *text = g_strdup_printf ("Preloading model... %d%%",
+                                 (int) (done_bytes * 100 / total_bytes));
+  gtk_label_set_text (self->status_label, text);
+  g_free (text);
+}
+
+static void
+preload_done_cb (EmergePreload *preload,
+                 gboolean       completed,
+                 gpointer       user_data)
+{
+  EmergeWindow *self = EMERGE_WINDOW (user_data);
+
+  g_debug ("Preload of %s %s after %.2fs (%.0f%% was already cached)",
+           emerge_preload_get_path (preload),
+           completed ? "finished" : "stopped",
+           emerge_preload_get_elapsed (preload),
+           emerge_preload_get_resident_fraction (preload) * 100.0);
+
+  if (self->is_generating)
+    return;
+
+  gtk_label_set_text (self->status_label, completed ? "Model ready" : "Ready");
+}
+
+/* Start warming the page cache for the selected model so the first
+ * generation doesn't pay for reading several GB from disk. Any preload of
+ * a previously selected model is cancelled. */
+static void
+emerge_window_preload_model (EmergeWindow *self)
+{
+  if (self->preload) {
+    if (g_strcmp0 (emerge_preload_get_path (self->preload), self->model_path) == 0)
+      return;
+
+    emerge_preload_cancel (self->preload);
+    g_clear_pointer (&self->preload, emerge_preload_unref);
+  }
+
+  if (self->model_path == NULL ||
+      !g_file_test (self->model_path, G_FILE_TEST_IS_REGULAR))
+    return;
+
+  self->preload = emerge_preload_start (self->model_path,
+                                        EMERGE_PRELOAD_DEFAULT_RATE,
+                                        preload_progress_cb,
+                                        preload_done_cb,
+                                        self);
+}
+
+/* Remember how much of the model load the preload has taken off the
+ * critical path at the moment the user asked for an image. */
+static void
+emerge_window_record_preload_state (EmergeWindow *self)
+{
+  self->generate_start_time = g_get_monotonic_time ();
+  self->preload_hidden_seconds = 0.0;
+  self->preload_warm_fraction = 0.0;
+
+  if (self->preload == NULL ||
+      g_strcmp0 (emerge_preload_get_path (self->preload), self->model_path) != 0)
+    return;
+
+  guint64 total = emerge_preload_get_total_bytes (self->preload);
+  if (total == 0)
+    return;
+
+  self->preload_warm_fraction = (double) emerge_preload_get_done_bytes (self->preload) / total;
+  self->preload_hidden_seconds = emerge_preload_get_read_seconds (self->preload);
+}
+
+static void
+show_image_loaded_cb (GObject      *source_object,
+                      GAsyncResult *result,
+                      gpointer      user_data)
+{
+  EmergeWindow *self;
+  GError *error = NULL;
+  GdkTexture *texture;
   
-  /* Re-enable UI */
-  self->is_generating = FALSE;
-  gtk_widget_set_sensitive (GTK_WIDGET (self->generate_button), TRUE);
-  gtk_widget_set_sensitive (GTK_WIDGET (self->model_chooser), TRUE);
-  gtk_widget_set_sensitive (GTK_WIDGET (self->model_dropdown), TRUE);
-  gtk_widget_set_sensitive (GTK_WIDGET (self->model_dir_button), TRUE);
-  gtk_widget_set_sensitive (GTK_WIDGET (self->initial_image_chooser), TRUE);
-  gtk_widget_set_visible (GTK_WIDGET (self->stop_button), FALSE);
-  gtk_spinner_stop (self->spinner);
-  gtk_widget_set_visible (GTK_WIDGET (self->spinner), FALSE);
-  
-  if (g_cancellable_is_cancelled (self->cancellable)) {
-    gtk_label_set_text (self->status_label, "Cancelled");
-    adw_toast_overlay_add_toast (self->toast_overlay,
-                               adw_toast_new ("Generation cancelled"));
-  } else if (status == 0) {
-    /* Load the generated image - with refresh to prevent caching issues */
-    
-    // Print debug info
-    g_print("Loading image from: %s\n", self->output_path);
-    g_print("File exists: %s\n", g_file_test(self->output_path, G_FILE_TEST_EXISTS) ? "YES" : "NO");
-    
-    GFile *file = g_file_new_for_path (self->output_path);
+  texture = emerge_texture_cache_load_finish (EMERGE_TEXTURE_CACHE (source_object), result, &error);
+  if (texture == NULL) {
+    /* Cancelled when another image was asked for or the window closed */
+    if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+      g_error_free (error);
+      return;
+    }
     
-    /* Clear the current picture first */
-    gtk_picture_set_file (self->output_image, NULL);
+    self = EMERGE_WINDOW (user_data);
+    gtk_picture_set_paintable (self->output_image, NULL);
     
-    /* Load the new image */
-    GError *load_error = NULL;
-    GdkTexture *texture = gdk_texture_new_from_file(file, &load_error);
-    if (texture) {
-      gtk_picture_set_paintable(self->output_image, GDK_PAINTABLE(texture));
-      g_object_unref(texture);
-      g_print("Image loaded successfully\n");
+    /* Large images go to the tiled viewer instead */
+    if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_MESSAGE_TOO_LARGE)) {
+      emerge_image_viewer_load (self->tiled_viewer, self->show_path);
+      gtk_stack_set_visible_child_name (self->image_stack, "tiled");
     } else {
-      g_print("Failed to load texture: %s\n", load_error ? load_error->message : "unknown error");
-      if (load_error) g_error_free(load_error);
-      
-      // Fall back to regular file loading
-      gtk_picture_set_file(self->output_image, file);
-      g_print("Attempted fallback to gtk_picture_set_file\n");
+      g_print ("Failed to load texture: %s\n", error->message);
     }
-    
-    g_object_unref (file);
-    
-    /* Show the save button since we have an image now */
-    gtk_widget_set_visible (GTK_WIDGET (self->save_button), TRUE);
-    
-    gtk_label_set_text (self->status_label, "Done");
-    adw_toast_overlay_add_toast (self->toast_overlay,
-                               adw_toast_new ("Image generated successfully"));
-  } else {
-    gtk_label_set_text (self->status_label, "Failed");
-    adw_toast_overlay_add_toast (self->toast_overlay,
-                               adw_toast_new ("Generation failed"));
+    g_error_free (error);
+    return;
   }
   
-  g_spawn_close_pid (pid);
-  g_object_unref (self->cancellable);
-  self->cancellable = NULL;
-  self->child_pid = 0;
-  self->child_watch_id = 0;
+  gtk_picture_set_paintable (EMERGE_WINDOW (user_data)->output_image, GDK_PAINTABLE (texture));
+  g_object_unref (texture);
 }
 
+/* Show an image file in the output area. Every image has a path of its
+ * own, so a cached decode is never stale. Large images go to the tiled
+ * viewer instead of being decoded into one texture; the texture cache
+ * tells them apart off the main thread. */
 static void
-model_open_response (GObject *source_object,
-                   GAsyncResult *result,
-                   gpointer user_data)
+emerge_window_show_image (EmergeWindow *self,
+                          const char   *path)
 {
-  EmergeWindow *self = EMERGE_WINDOW (user_data);
-  GtkFileDialog *dialog = GTK_FILE_DIALOG (source_object);
-  GFile *file;
-  GError *error = NULL;
+  GdkTexture *texture;
   
-  file = gtk_file_dialog_open_finish (dialog, result, &error);
-  if (file == NULL) {
-    if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
-      g_warning ("Failed to open file: %s", error->message);
-    g_error_free (error);
+  g_cancellable_cancel (self->show_cancellable);
+  g_clear_object (&self->show_cancellable);
+  g_free (self->show_path);
+  self->show_path = g_strdup (path);
+  
+  emerge_image_viewer_clear (self->tiled_viewer);
+  gtk_stack_set_visible_child_name (self->image_stack, "picture");
+  
+  texture = emerge_texture_cache_lookup (self->texture_cache, path);
+  if (texture != NULL) {
+    gtk_picture_set_paintable (self->output_image, GDK_PAINTABLE (texture));
+    g_object_unref (texture);
     return;
   }
   
-  g_free (self->model_path);
-  self->model_path = g_file_get_path (file);
-  
-  /* Update the button label to show filename */
-  char *basename = g_file_get_basename (file);
-  char *button_text = g_strdup_printf ("Model: %s", basename);
-  gtk_button_set_label (self->model_chooser, button_text);
-  g_free (button_text);
-  g_free (basename);
+  /* The previous image stays up until this one is decoded */
+  self->show_cancellable = g_cancellable_new ();
+  emerge_texture_cache_load_async (self->texture_cache, path, self->show_cancellable,
+                                   show_image_loaded_cb, self);
+}
+
+static GListModel *
+emerge_window_get_gallery_model (EmergeWindow *self)
+{
+  return G_LIST_MODEL (gtk_grid_view_get_model (self->gallery_view));
+}
+
+/* Where the image on display is among the gallery results, or G_MAXUINT
+ * if it isn't one of them. Searching or removing images moves it, so the
+ * remembered position is only a hint. */
+static guint
+emerge_window_find_viewed (EmergeWindow *self)
+{
+  GListModel *model = emerge_window_get_gallery_model (self);
+  EmergeHistoryItem *item;
+  guint n_items;
+  
+  if (self->viewed_item == NULL)
+    return G_MAXUINT;
+  
+  item = g_list_model_get_item (model, self->viewed_position);
+  if (item != NULL) {
+    g_object_unref (item);
+    if (item == self->viewed_item)
+      return self->viewed_position;
+  }
   
-  /* Enable convert button and show quantization dropdown if it's a safetensors file */
-  if (g_str_has_suffix (self->model_path, ".safetensors")) {
-    gtk_widget_set_sensitive (GTK_WIDGET (self->convert_model_button), TRUE);
-    gtk_widget_set_visible (GTK_WIDGET (self->quantization_dropdown), TRUE);
-    gtk_widget_set_visible (GTK_WIDGET (self->quantization_label), TRUE);
-  } else {
-    gtk_widget_set_sensitive (GTK_WIDGET (self->convert_model_button), FALSE);
-    gtk_widget_set_visible (GTK_WIDGET (self->quantization_dropdown), FALSE);
-    gtk_widget_set_visible (GTK_WIDGET (self->quantization_label), FALSE);
+  n_items = g_list_model_get_n_items (model);
+  for (guint i = 0; i < n_items; i++) {
+    item = g_list_model_get_item (model, i);
+    g_object_unref (item);
+    if (item == self->viewed_item) {
+      self->viewed_position = i;
+      return i;
+    }
   }
   
-  g_object_unref (file);
+  return G_MAXUINT;
 }
 
 static void
-on_model_file_select (GtkButton *button G_GNUC_UNUSED,
-                     gpointer   user_data)
+emerge_window_update_navigation (EmergeWindow *self)
 {
-  EmergeWindow *self = EMERGE_WINDOW (user_data);
-  GtkFileDialog *dialog;
-  GtkFileFilter *filter;
-  GListStore *filters;
+  guint position = emerge_window_find_viewed (self);
+  guint n_items = g_list_model_get_n_items (emerge_window_get_gallery_model (self));
+  GAction *previous = g_action_map_lookup_action (G_ACTION_MAP (self), "previous-image");
+  GAction *next = g_action_map_lookup_action (G_ACTION_MAP (self), "next-image");
+  GAction *refine = g_action_map_lookup_action (G_ACTION_MAP (self), "refine-image");
+  
+  g_simple_action_set_enabled (G_SIMPLE_ACTION (previous),
+                               position != G_MAXUINT && position > 0);
+  g_simple_action_set_enabled (G_SIMPLE_ACTION (next),
+                               position != G_MAXUINT && position + 1 < n_items);
+  g_simple_action_set_enabled (G_SIMPLE_ACTION (refine),
+                               !self->is_generating && self->viewed_item != NULL &&
+                               emerge_history_item_get_job (self->viewed_item)->draft);
+}
+
+typedef struct {
+  gchar     *path;
+  gint64     mtime;
+  gint       step;
+  GdkPixbuf *pixbuf;
+} PreviewLoad;
+
+static void
+preview_load_free (PreviewLoad *load)
+{
+  g_clear_object (&load->pixbuf);
+  g_free (load->path);
+  g_free (load);
+}
+
+/* What a learned convergence step applies to. The step count asked for is
+ * part of it, since the schedule and so where a run settles depend on it;
+ * a run early stopping cut short is known by its uncut count. */
+static gchar *
+convergence_key (const EmergeJob *job)
+{
+  return g_strdup_printf ("%s\n%s\n%dx%d\n%d", job->model_path, job->sampling_method,
+                          job->width, job->height,
+                          job->requested_steps > 0 ? job->requested_steps : job->steps);
+}
+
+/* The previews stopped changing at @step; later runs like this one end there */
+static void
+emerge_window_record_convergence (EmergeWindow *self,
+                                  gint          step)
+{
+  gchar *text;
   
-  dialog = gtk_file_dialog_new ();
-  gtk_file_dialog_set_title (dialog, "Select Stable Diffusion Model");
+  if (self->generate_job == NULL || step >= self->generate_job->steps)
+    return;
   
-  filter = gtk_file_filter_new ();
-  gtk_file_filter_set_name (filter, "Stable Diffusion Models");
-  gtk_file_filter_add_pattern (filter, "*.ckpt");
-  gtk_file_filter_add_pattern (filter, "*.safetensors");
-  gtk_file_filter_add_pattern (filter, "*.gguf");
+  g_hash_table_insert (self->converged_steps, convergence_key (self->generate_job),
+                       GINT_TO_POINTER (step));
   
-  filters = g_list_store_new (GTK_TYPE_FILE_FILTER);
-  g_list_store_append (filters, filter);
-  gtk_file_dialog_set_filters (dialog, G_LIST_MODEL (filters));
+  text = g_strdup_printf ("Converged at step %d of %d", step, self->generate_job->steps);
+  g_print ("%s; later %d-step runs with %s at %dx%d will run %d steps instead\n", text,
+           self->generate_job->steps, self->generate_job->sampling_method,
+           self->generate_job->width, self->generate_job->height, step);
+  adw_toast_overlay_add_toast (self->toast_overlay, adw_toast_new (text));
+  g_free (text);
+}
+
+/* Decodes the preview sd last wrote, unless it is the one already shown.
+ * sd may be halfway through rewriting it, so failing is nothing unusual. */
+static void
+preview_load_thread (GTask        *task,
+                     gpointer      source_object G_GNUC_UNUSED,
+                     gpointer      task_data,
+                     GCancellable *cancellable G_GNUC_UNUSED)
+{
+  PreviewLoad *load = task_data;
+  GdkTexture *texture;
+  GStatBuf st;
   
-  gtk_file_dialog_open (dialog,
-                       GTK_WINDOW (self),
-                       NULL,  /* cancellable */
-                       model_open_response,
-                       self);
+  if (g_stat (load->path, &st) != 0 ||
+      (gint64) st.st_mtim.tv_sec * G_USEC_PER_SEC + st.st_mtim.tv_nsec / 1000 == load->mtime) {
+    g_task_return_pointer (task, NULL, NULL);
+    return;
+  }
   
-  g_object_unref (dialog);
-  g_object_unref (filter);
-  g_object_unref (filters);
+  load->mtime = (gint64) st.st_mtim.tv_sec * G_USEC_PER_SEC + st.st_mtim.tv_nsec / 1000;
+  
+  /* The pixels are kept for the convergence check as well */
+  load->pixbuf = gdk_pixbuf_new_from_file (load->path, NULL);
+  if (load->pixbuf == NULL) {
+    g_task_return_pointer (task, NULL, NULL);
+    return;
+  }
+  
+  texture = gdk_texture_new_for_pixbuf (load->pixbuf);
+  g_task_return_pointer (task, texture, g_object_unref);
 }
 
 static void
-image_open_response (GObject *source_object,
+preview_loaded_cb (GObject      *source_object G_GNUC_UNUSED,
                    GAsyncResult *result,
-                   gpointer user_data)
+                   gpointer      user_data)
 {
-  EmergeWindow *self = EMERGE_WINDOW (user_data);
-  GtkFileDialog *dialog = GTK_FILE_DIALOG (source_object);
-  GFile *file;
+  EmergeWindow *self;
+  PreviewLoad *load = g_task_get_task_data (G_TASK (result));
+  GdkTexture *texture;
   GError *error = NULL;
   
-  file = gtk_file_dialog_open_finish (dialog, result, &error);
-  if (file == NULL) {
-    if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
-      g_warning ("Failed to open file: %s", error->message);
+  texture = g_task_propagate_pointer (G_TASK (result), &error);
+  if (error != NULL) {
+    /* The window may be gone */
     g_error_free (error);
     return;
   }
   
-  g_free (self->initial_image_path);
-  self->initial_image_path = g_file_get_path (file);
+  self = EMERGE_WINDOW (user_data);
+  g_clear_object (&self->preview_cancellable);
+  if (texture == NULL)
+    return;
   
-  /* Update the button label to show filename */
-  char *basename = g_file_get_basename (file);
-  char *button_text = g_strdup_printf ("Image: %s", basename);
-  gtk_button_set_label (self->initial_image_chooser, button_text);
-  g_free (button_text);
-  g_free (basename);
+  self->preview_mtime = load->mtime;
+  
+  if (self->convergence != NULL &&
+      emerge_convergence_add (self->convergence, load->step,
+                              gdk_pixbuf_get_pixels (load->pixbuf),
+                              gdk_pixbuf_get_width (load->pixbuf),
+                              gdk_pixbuf_get_height (load->pixbuf),
+                              gdk_pixbuf_get_rowstride (load->pixbuf),
+                              gdk_pixbuf_get_n_channels (load->pixbuf)))
+    emerge_window_record_convergence (self, load->step);
+  
+  /* Shown instead of whatever was up, but it isn't a result yet */
+  g_cancellable_cancel (self->show_cancellable);
+  g_clear_object (&self->viewed_item);
+  emerge_image_viewer_clear (self->tiled_viewer);
+  gtk_stack_set_visible_child_name (self->image_stack, "picture");
+  gtk_picture_set_paintable (self->output_image, GDK_PAINTABLE (texture));
+  gtk_widget_set_visible (GTK_WIDGET (self->save_button), FALSE);
+  emerge_window_update_navigation (self);
+  g_object_unref (texture);
+}
+
+/* Pick up a new preview, if sd has written one; at most one is decoded at
+ * a time, off the main thread */
+static void
+emerge_window_load_preview (EmergeWindow *self)
+{
+  PreviewLoad *load;
+  GTask *task;
   
-  /* Show the initial image with improved loading method */
-  gtk_picture_set_file (self->output_image, NULL);
+  if (self->preview_cancellable != NULL)
+    return;
   
-  GdkTexture *texture = gdk_texture_new_from_file(file, NULL);
-  if (texture) {
-    gtk_picture_set_paintable(self->output_image, GDK_PAINTABLE(texture));
-    g_object_unref(texture);
-  } else {
-    gtk_picture_set_file(self->output_image, file);
-  }
+  load = g_new0 (PreviewLoad, 1);
+  load->path = g_strdup (self->generate_job->preview_path);
+  load->mtime = self->preview_mtime;
+  load->step = self->preview_step;
   
-  g_object_unref (file);
+  self->preview_cancellable = g_cancellable_new ();
+  task = g_task_new (NULL, self->preview_cancellable, preview_loaded_cb, self);
+  g_task_set_task_data (task, load, (GDestroyNotify) preview_load_free);
+  g_task_run_in_thread (task, preview_load_thread);
+  g_object_unref (task);
 }
 
+static void emerge_window_update_queue_eta (EmergeWindow *self);
+static gchar *emerge_window_describe_queue_eta (EmergeWindow *self);
+
 static void
-on_initial_image_file_select (GtkButton *button G_GNUC_UNUSED,
-                             gpointer   user_data)
+generate_process_progress_cb (EmergeProcess *process G_GNUC_UNUSED,
+                              gint           step,
+                              gint           total_steps,
+                              gdouble        seconds_per_step G_GNUC_UNUSED,
+                              gpointer       user_data)
 {
   EmergeWindow *self = EMERGE_WINDOW (user_data);
-  GtkFileDialog *dialog;
-  GtkFileFilter *filter;
-  GListStore *filters;
+  gchar *text = g_strdup_printf ("Generating... step %d/%d", step, total_steps);
   
-  dialog = gtk_file_dialog_new ();
-  gtk_file_dialog_set_title (dialog, "Select Input Image");
+  gtk_label_set_text (self->status_label, text);
+  g_free (text);
   
-  filter = gtk_file_filter_new ();
-  gtk_file_filter_set_name (filter, "Images");
-  gtk_file_filter_add_mime_type (filter, "image/png");
-  gtk_file_filter_add_mime_type (filter, "image/jpeg");
+  self->generate_step = step;
+  if (self->queue_job_id != 0) {
+    emerge_queue_checkpoint (self->queue, self->queue_job_id, step);
+    emerge_window_update_queue_eta (self);
+  }
   
-  filters = g_list_store_new (GTK_TYPE_FILE_FILTER);
-  g_list_store_append (filters, filter);
-  gtk_file_dialog_set_filters (dialog, G_LIST_MODEL (filters));
+  self->preview_step = step;
+  if (self->generate_job != NULL && self->generate_job->preview_interval > 0)
+    emerge_window_load_preview (self);
+}
+
+/* Decode the images either side of @position, the way the user is going
+ * first, so the next step is a cache hit */
+static void
+emerge_window_prefetch_neighbours (EmergeWindow *self,
+                                   guint         position)
+{
+  static const int forwards[] = { 1, 2, -1 };
+  static const int backwards[] = { -1, -2, 1 };
+  const int *steps = self->viewed_backwards ? backwards : forwards;
+  GListModel *model = emerge_window_get_gallery_model (self);
+  guint n_items = g_list_model_get_n_items (model);
+  GPtrArray *paths = g_ptr_array_new_with_free_func (g_free);
+  
+  for (guint i = 0; i < G_N_ELEMENTS (forwards); i++) {
+    gint64 neighbour = (gint64) position + steps[i];
+    EmergeHistoryItem *item;
+    
+    if (neighbour < 0 || neighbour >= n_items)
+      continue;
+    
+    item = g_list_model_get_item (model, neighbour);
+    g_ptr_array_add (paths, g_strdup (emerge_history_item_get_image_path (item)));
+    g_object_unref (item);
+  }
+  g_ptr_array_add (paths, NULL);
   
-  gtk_file_dialog_open (dialog,
-                       GTK_WINDOW (self),
-                       NULL,  /* cancellable */
-                       image_open_response,
-                       self);
+  emerge_texture_cache_prefetch (self->texture_cache, (const char * const *) paths->pdata);
+  g_ptr_array_unref (paths);
+}
+
+/* Shows a history entry and makes it the one stepped from; @position is
+ * where it is expected in the gallery */
+static void
+emerge_window_view_item (EmergeWindow      *self,
+                         EmergeHistoryItem *item,
+                         guint              position)
+{
+  g_set_object (&self->viewed_item, item);
+  self->viewed_position = position;
   
-  g_object_unref (dialog);
-  g_object_unref (filter);
-  g_object_unref (filters);
+  g_free (self->output_path);
+  self->output_path = g_strdup (emerge_history_item_get_image_path (item));
+  emerge_window_show_image (self, self->output_path);
+  gtk_widget_set_visible (GTK_WIDGET (self->save_button), TRUE);
+  
+  emerge_window_update_navigation (self);
+  position = emerge_window_find_viewed (self);
+  if (position != G_MAXUINT)
+    emerge_window_prefetch_neighbours (self, position);
 }
 
 static void
-save_image_response (GObject *source_object,
-                    GAsyncResult *result,
-                    gpointer user_data)
+emerge_window_step (EmergeWindow *self,
+                    int           direction)
 {
-  EmergeWindow *self = EMERGE_WINDOW (user_data);
-  GtkFileDialog *dialog = GTK_FILE_DIALOG (source_object);
-  GFile *file;
-  GError *error = NULL;
+  GListModel *model = emerge_window_get_gallery_model (self);
+  guint position = emerge_window_find_viewed (self);
+  EmergeHistoryItem *item;
   
-  file = gtk_file_dialog_save_finish (dialog, result, &error);
-  if (file == NULL) {
-    if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
-      g_warning ("Failed to save file: %s", error->message);
-    g_error_free (error);
+  if (position == G_MAXUINT ||
+      (direction < 0 && position == 0) ||
+      (direction > 0 && position + 1 >= g_list_model_get_n_items (model)))
     return;
-  }
-  
-  // Get the directory for future saves
-  GFile *parent = g_file_get_parent(file);
-  if (parent) {
-    g_free(self->last_saved_dir);
-    self->last_saved_dir = g_file_get_path(parent);
-    g_object_unref(parent);
-  }
   
-  // Save current image to the selected location
-  GFile *src_file = g_file_new_for_path(self->output_path);
-  if (src_file) {
-    g_file_copy(src_file, file, G_FILE_COPY_OVERWRITE, NULL, NULL, NULL, &error);
-    g_object_unref(src_file);
-    
-    if (error) {
-      adw_toast_overlay_add_toast(self->toast_overlay,
-                                adw_toast_new ("Failed to save image"));
-      g_error_free(error);
-    } else {
-      adw_toast_overlay_add_toast(self->toast_overlay,
-                                adw_toast_new ("Image saved successfully"));
-    }
-  }
-  
-  g_object_unref(file);
+  item = g_list_model_get_item (model, position + direction);
+  self->viewed_backwards = direction < 0;
+  emerge_window_view_item (self, item, position + direction);
+  g_object_unref (item);
 }
 
 static void
-on_save_clicked (GtkButton *button G_GNUC_UNUSED,
-                gpointer   user_data)
+on_previous_image (EmergeWindow *self)
 {
-  EmergeWindow *self = EMERGE_WINDOW (user_data);
-  GtkFileDialog *dialog;
-  GtkFileFilter *filter;
-  GListStore *filters;
-  GFile *current_folder = NULL;
+  emerge_window_step (self, -1);
+}
+
+static void
+on_next_image (EmergeWindow *self)
+{
+  emerge_window_step (self, 1);
+}
+
+static void
+gallery_model_changed_cb (GListModel *model G_GNUC_UNUSED,
+                          guint       position G_GNUC_UNUSED,
+                          guint       removed G_GNUC_UNUSED,
+                          guint       added G_GNUC_UNUSED,
+                          gpointer    user_data)
+{
+  emerge_window_update_navigation (EMERGE_WINDOW (user_data));
+}
+
+static gchar *
+history_item_thumbnail_key (EmergeHistoryItem *item)
+{
+  return g_strdup_printf ("%" G_GUINT64_FORMAT, emerge_history_item_get_id (item));
+}
+
+static void history_hashed_cb (GObject *source_object, GAsyncResult *result, gpointer user_data);
+
+/* Store the finished image in the history, straight from memory unless it
+ * went through a stage that works on files */
+static EmergeHistoryItem *
+emerge_window_record_history (EmergeWindow *self)
+{
+  EmergeHistoryItem *item;
+  GError *error = NULL;
   
-  // If there's no image to save, don't open dialog
-  if (self->output_path == NULL) {
-    adw_toast_overlay_add_toast(self->toast_overlay,
-                              adw_toast_new ("No image to save"));
-    return;
+  if (self->generate_job == NULL)
+    return NULL;
+  
+  if (self->output_bytes != NULL)
+    item = emerge_history_add_image (self->history, self->generate_job,
+                                     self->output_bytes, &error);
+  else
+    item = emerge_history_add (self->history, self->generate_job, &error);
+  if (item == NULL) {
+    g_warning ("Failed to add image to history: %s", error->message);
+    g_error_free (error);
+    return NULL;
   }
   
-  dialog = gtk_file_dialog_new();
-  gtk_file_dialog_set_title(dialog, "Save Image");
+  g_free (self->output_path);
+  self->output_path = g_strdup (emerge_history_item_get_image_path (item));
+  g_clear_pointer (&self->output_bytes, g_bytes_unref);
   
-  // Set default name
-  gchar *filename = g_strdup_printf("stable-diffusion-%04d.png", self->image_counter - 1);
-  gtk_file_dialog_set_initial_name(dialog, filename);
-  g_free(filename);
+  /* Have the thumbnails ready before the gallery is opened */
+  gchar *key = history_item_thumbnail_key (item);
+  emerge_thumbnailer_load_async (self->thumbnailer, self->output_path, key,
+                                 EMERGE_THUMBNAIL_SMALL, NULL, NULL, NULL);
+  g_free (key);
   
-  // Set initial folder if we have saved before
-  if (self->last_saved_dir) {
-    current_folder = g_file_new_for_path(self->last_saved_dir);
-  } else {
-    // Default to Pictures directory if no previous save location
-    const gchar *home_dir = g_get_home_dir();
-    gchar *pictures_dir = g_build_filename(home_dir, "Pictures", NULL);
-    current_folder = g_file_new_for_path(pictures_dir);
-    g_free(pictures_dir);
-  }
+  /* And its hash, for spotting near-duplicates */
+  emerge_history_hash_async (self->history, self->history_cancellable,
+                             history_hashed_cb, self);
   
-  if (current_folder) {
-    gtk_file_dialog_set_initial_folder(dialog, current_folder);
+  return item;
+}
+
+/* Re-enable the controls that were disabled while generating */
+static void
+emerge_window_end_generation (EmergeWindow *self)
+{
+  self->is_generating = FALSE;
+  gtk_widget_set_sensitive (GTK_WIDGET (self->generate_button), TRUE);
+  gtk_widget_set_sensitive (GTK_WIDGET (self->draft_button), TRUE);
+  gtk_widget_set_sensitive (GTK_WIDGET (self->model_chooser), TRUE);
+  gtk_widget_set_sensitive (GTK_WIDGET (self->model_dropdown), TRUE);
+  gtk_widget_set_sensitive (GTK_WIDGET (self->model_dir_button), TRUE);
+  gtk_widget_set_sensitive (GTK_WIDGET (self->initial_image_chooser), TRUE);
+  gtk_widget_set_visible (GTK_WIDGET (self->stop_button), FALSE);
+  gtk_widget_set_visible (GTK_WIDGET (self->pause_button), FALSE);
+  gtk_spinner_stop (self->spinner);
+  gtk_widget_set_visible (GTK_WIDGET (self->spinner), FALSE);
+  emerge_window_update_navigation (self);
+  
+  /* A preview decoded now would cover up the result */
+  g_cancellable_cancel (self->preview_cancellable);
+  g_clear_object (&self->preview_cancellable);
+  g_clear_pointer (&self->convergence, emerge_convergence_free);
+  
+  /* Let whatever was paused to make way carry on */
+  if (self->preempted != NULL) {
+    for (guint i = 0; i < self->preempted->len; i++)
+      emerge_process_resume (g_ptr_array_index (self->preempted, i));
+    g_clear_pointer (&self->preempted, g_ptr_array_unref);
   }
+}
+
+/* Leave a copy of the finished image where its job asked for one. It is
+ * written whole or not at all, since a hot folder takes an existing
+ * result to mean its input is done. */
+static void
+emerge_window_export_result (EmergeWindow *self)
+{
+  const char *export_path = self->generate_job->export_path;
+  GBytes *bytes = NULL;
+  GError *error = NULL;
+  gchar *dir;
   
-  filter = gtk_file_filter_new();
-  gtk_file_filter_set_name(filter, "PNG Images");
-  gtk_file_filter_add_mime_type(filter, "image/png");
-  
-  filters = g_list_store_new(GTK_TYPE_FILE_FILTER);
-  g_list_store_append(filters, filter);
-  gtk_file_dialog_set_filters(dialog, G_LIST_MODEL(filters));
+  if (self->output_bytes != NULL) {
+    bytes = g_bytes_ref (self->output_bytes);
+  } else if (self->output_path != NULL) {
+    gchar *contents;
+    gsize length;
+    
+    if (g_file_get_contents (self->output_path, &contents, &length, &error))
+      bytes = g_bytes_new_take (contents, length);
+  }
   
-  gtk_file_dialog_save(dialog,
-                      GTK_WINDOW(self),
-                      NULL,  /* cancellable */
-                      save_image_response,
-                      self);
+  dir = g_path_get_dirname (export_path);
+  g_mkdir_with_parents (dir, 0755);
+  g_free (dir);
+  
+  if (bytes == NULL ||
+      !g_file_set_contents_full (export_path,
+                                 g_bytes_get_data (bytes, NULL), g_bytes_get_size (bytes),
+                                 G_FILE_SET_CONTENTS_CONSISTENT, 0644, &error)) {
+    g_warning ("Failed to write %s: %s", export_path,
+               error ? error->message : "no image");
+    g_clear_error (&error);
+  } else {
+    g_print ("Wrote %s\n", export_path);
+  }
   
-  if (current_folder)
-    g_object_unref(current_folder);
-  g_object_unref(dialog);
-  g_object_unref(filter);
-  g_object_unref(filters);
+  g_clear_pointer (&bytes, g_bytes_unref);
 }
 
-static gboolean
-ensure_directory_exists(const gchar *dir_path)
+/* Put the finished image into the history and show it */
+static void
+emerge_window_show_result (EmergeWindow *self)
 {
-  if (g_file_test(dir_path, G_FILE_TEST_IS_DIR)) {
-    return TRUE;
+  EmergeHistoryItem *item = emerge_window_record_history (self);
+  
+  if (self->generate_job != NULL && self->generate_job->export_path != NULL)
+    emerge_window_export_result (self);
+  
+  /* The newest image comes first in the gallery, unless a search hides it */
+  g_print("Loading image from: %s\n", self->output_path);
+  if (item != NULL) {
+    emerge_window_view_item (self, item, 0);
+  } else if (self->output_bytes != NULL) {
+    /* Not stored anywhere, but it can still be looked at and saved */
+    GdkTexture *texture = gdk_texture_new_from_bytes (self->output_bytes, NULL);
+    
+    g_clear_object (&self->viewed_item);
+    g_cancellable_cancel (self->show_cancellable);
+    emerge_image_viewer_clear (self->tiled_viewer);
+    gtk_stack_set_visible_child_name (self->image_stack, "picture");
+    gtk_picture_set_paintable (self->output_image, GDK_PAINTABLE (texture));
+    g_clear_object (&texture);
+    emerge_window_update_navigation (self);
+  } else {
+    g_clear_object (&self->viewed_item);
+    emerge_window_show_image (self, self->output_path);
+    emerge_window_update_navigation (self);
   }
+  gtk_toggle_button_set_active (self->history_button, FALSE);
   
-  // Create directory with permissive permissions so files can be read
-  gint result = g_mkdir_with_parents(dir_path, 0755);
+  /* Show the save button since we have an image now */
+  gtk_widget_set_visible (GTK_WIDGET (self->save_button), TRUE);
   
-  return (result == 0);
+  gtk_label_set_text (self->status_label, "Done");
+  adw_toast_overlay_add_toast (self->toast_overlay,
+                             adw_toast_new ("Image generated successfully"));
 }
 
-static gchar*
-find_sd_executable(void)
+static void emerge_window_run_job (EmergeWindow *self, EmergeJob *job);
+
+/* A benchmark times sd runs one at a time, so nothing else may generate
+ * while it is going, and it is never paused to make way either */
+static gboolean
+emerge_window_is_benchmarking (EmergeWindow *self)
 {
-  gchar *sd_path;
+  return self->benchmark != NULL || self->quant_bench != NULL;
+}
+
+/* Start the next queued job, unless something is generating already */
+static void
+emerge_window_run_queue (EmergeWindow *self)
+{
+  EmergeJob *job;
+  guint64 id;
   
-  // First try to find 'sd' in PATH (this will work for AppImage)
-  sd_path = g_find_program_in_path("sd");
-  if (sd_path != NULL) {
-    return sd_path;
-  }
-  
-  // If not found in PATH, try in the bin directory relative to the executable
-  gchar *exe_dir = NULL;
-  gchar *bin_sd_path = NULL;
-  
-  // Get the directory where our executable is located
-  GFile *exe_file = g_file_new_for_path("/proc/self/exe");
-  GFile *exe_dir_file = NULL;
-  
-  if (exe_file) {
-    GFileInfo *info = g_file_query_info(exe_file, G_FILE_ATTRIBUTE_STANDARD_SYMLINK_TARGET,
-                                       G_FILE_QUERY_INFO_NONE, NULL, NULL);
-    if (info) {
-      const char *target = g_file_info_get_attribute_byte_string(info, 
-                                                              G_FILE_ATTRIBUTE_STANDARD_SYMLINK_TARGET);
-      if (target) {
-        GFile *target_file = g_file_new_for_path(target);
-        if (target_file) {
-          exe_dir_file = g_file_get_parent(target_file);
-          g_object_unref(target_file);
-        }
-      }
-      g_object_unref(info);
-    }
-    
-    if (exe_dir_file == NULL) {
-      // Fallback if we couldn't read the symlink target
-      exe_dir_file = g_file_get_parent(exe_file);
-    }
-    g_object_unref(exe_file);
+  if (self->is_generating || self->queue_held || emerge_window_is_benchmarking (self))
+    return;
+  
+  job = emerge_queue_start_next (self->queue);
+  if (job == NULL)
+    return;
+  
+  id = job->id;
+  self->queue_job_id = id;
+  emerge_window_run_job (self, job);
+  
+  /* It couldn't even start, and neither will the rest for the same reason */
+  if (!self->is_generating) {
+    emerge_queue_finish (self->queue, id, EMERGE_JOB_FAILED);
+    self->queue_job_id = 0;
+    self->queue_held = TRUE;
   }
+}
+
+static gboolean
+queue_idle_cb (gpointer user_data)
+{
+  EmergeWindow *self = EMERGE_WINDOW (user_data);
   
-  // Initialize paths to try
-  GQueue *paths_to_try = g_queue_new();
+  self->queue_idle_id = 0;
+  emerge_window_run_queue (self);
   
-  // Add the current directory
-  g_queue_push_tail(paths_to_try, g_strdup("."));
+  return G_SOURCE_REMOVE;
+}
+
+/* Go on with the queue once a benchmark no longer holds it up */
+static void
+emerge_window_resume_queue (EmergeWindow *self)
+{
+  if (!self->queue_held && self->queue_idle_id == 0 &&
+      emerge_queue_get_n_pending (self->queue) > 0)
+    self->queue_idle_id = g_idle_add (queue_idle_cb, self);
+}
+
+/* Let go of the job that just ran, recording how it went if it came from
+ * the queue, and go on with the next one */
+static void
+emerge_window_release_job (EmergeWindow *self)
+{
+  EmergeJob *job = self->generate_job;
   
-  if (exe_dir_file) {
-    exe_dir = g_file_get_path(exe_dir_file);
-    g_object_unref(exe_dir_file);
+  if (job != NULL && job->state == EMERGE_JOB_SUCCEEDED && job->stats != NULL) {
+    double predicted = emerge_cost_model_predict (self->cost_model, job);
+    GError *error = NULL;
     
-    if (exe_dir) {
-      // Add executable directory
-      g_queue_push_tail(paths_to_try, g_strdup(exe_dir));
-      
-      // Also try one level up from executable directory
-      GFile *parent_dir_file = g_file_new_for_path(exe_dir);
-      GFile *project_dir_file = g_file_get_parent(parent_dir_file);
-      g_object_unref(parent_dir_file);
-      
-      if (project_dir_file) {
-        gchar *project_dir = g_file_get_path(project_dir_file);
-        g_object_unref(project_dir_file);
-        
-        if (project_dir) {
-          // Add parent directory
-          g_queue_push_tail(paths_to_try, g_strdup(project_dir));
-          
-          // For build directory scenarios, try two and three levels up
-          // This handles cases like build/src/emerge where we need to go up to find project root
-          GFile *build_dir_file = g_file_new_for_path(project_dir);
-          GFile *root_dir_file = g_file_get_parent(build_dir_file);
-          g_object_unref(build_dir_file);
-          
-          if (root_dir_file) {
-            gchar *root_dir = g_file_get_path(root_dir_file);
-            g_queue_push_tail(paths_to_try, g_strdup(root_dir));
-            
-            // Try one more level up
-            GFile *root_parent_file = g_file_get_parent(root_dir_file);
-            g_object_unref(root_dir_file);
-            
-            if (root_parent_file) {
-              gchar *root_parent = g_file_get_path(root_parent_file);
-              g_queue_push_tail(paths_to_try, g_strdup(root_parent));
-              g_object_unref(root_parent_file);
-              g_free(root_parent);
-            }
-            
-            g_free(root_dir);
-          }
-          
-          g_free(project_dir);
-        }
-      }
-      
-      g_free(exe_dir);
+    if (predicted >= 0.0)
+      g_print ("sd took %.1fs, %.1fs was predicted\n", job->wall_seconds, predicted);
+    if (!emerge_cost_model_record (self->cost_model, job, &error)) {
+      g_warning ("Failed to record job timings: %s", error->message);
+      g_error_free (error);
     }
   }
   
-  // Try each path to see if bin/sd exists there
-  while (!g_queue_is_empty(paths_to_try)) {
-    gchar *base_path = g_queue_pop_head(paths_to_try);
-    
-    // Try bin/sd in this location
-    bin_sd_path = g_build_filename(base_path, "bin", "sd", NULL);
-    g_print("Checking for sd at: %s\n", bin_sd_path);
-    
-    if (g_file_test(bin_sd_path, G_FILE_TEST_IS_EXECUTABLE)) {
-      // Free remaining paths
-      while (!g_queue_is_empty(paths_to_try)) {
-        g_free(g_queue_pop_head(paths_to_try));
-      }
-      g_queue_free(paths_to_try);
-      g_free(base_path);
-      return bin_sd_path;
-    }
+  if (job != NULL && self->queue_job_id != 0 && job->id == self->queue_job_id) {
+    gchar *eta;
+    guint n_left;
     
-    g_free(bin_sd_path);
+    emerge_queue_finish (self->queue, job->id,
+                         self->stop_requested ? EMERGE_JOB_CANCELLED : job->state);
+    self->queue_job_id = 0;
     
-    // Try just 'sd' in this location (for development builds)
-    bin_sd_path = g_build_filename(base_path, "sd", NULL);
-    g_print("Checking for sd at: %s\n", bin_sd_path);
+    eta = emerge_window_describe_queue_eta (self);
+    if (eta != NULL)
+      g_print ("Queue: %s\n", eta);
+    g_free (eta);
     
-    if (g_file_test(bin_sd_path, G_FILE_TEST_IS_EXECUTABLE)) {
-      // Free remaining paths
-      while (!g_queue_is_empty(paths_to_try)) {
-        g_free(g_queue_pop_head(paths_to_try));
-      }
-      g_queue_free(paths_to_try);
-      g_free(base_path);
-      return bin_sd_path;
+    n_left = emerge_queue_get_n_pending (self->queue);
+    if (self->stop_requested && n_left > 0) {
+      gchar *text = g_strdup_printf ("Queue stopped with %u jobs left", n_left);
+      
+      self->queue_held = TRUE;
+      adw_toast_overlay_add_toast (self->toast_overlay, adw_toast_new (text));
+      g_free (text);
     }
-    g_free(bin_sd_path);
-    
-    g_free(base_path);
   }
   
-  g_queue_free(paths_to_try);
-  return NULL;
+  g_clear_pointer (&self->generate_job, emerge_job_unref);
+  self->stop_requested = FALSE;
+  
+  /* From idle, so whatever finished this job is done with it first */
+  if (!self->queue_held && self->queue_idle_id == 0 &&
+      emerge_queue_get_n_pending (self->queue) > 0)
+    self->queue_idle_id = g_idle_add (queue_idle_cb, self);
 }
 
 static void
-on_generate_clicked (GtkButton *button G_GNUC_UNUSED,
-                     gpointer   user_data)
+upscale_progress_cb (EmergeUpscale *upscale G_GNUC_UNUSED,
+                     guint          n_done,
+                     guint          n_tiles,
+                     gpointer       user_data)
 {
   EmergeWindow *self = EMERGE_WINDOW (user_data);
-  gchar *command_line;
-  gchar **argv = NULL;
-  GError *error = NULL;
-  gint argc;
-  gchar *sd_path;
-  
-  if (self->is_generating)
-    return;
+  gchar *text = g_strdup_printf ("Upscaling... tile %u/%u", n_done, n_tiles);
   
-  if (self->model_path == NULL) {
+  gtk_label_set_text (self->status_label, text);
+  g_free (text);
+}
+
+static void
+upscale_finished_cb (EmergeUpscale *upscale,
+                     gpointer       user_data)
+{
+  EmergeWindow *self = EMERGE_WINDOW (user_data);
+  const GError *error = emerge_upscale_get_error (upscale);
+  EmergeJob *job = self->generate_job;
+  
+  emerge_window_end_generation (self);
+  
+  if (error == NULL) {
+    /* Only the upscaled image is kept */
+    g_clear_pointer (&self->output_bytes, g_bytes_unref);
+    g_free (job->output_path);
+    job->output_path = g_steal_pointer (&self->upscale_output_path);
+    emerge_window_show_result (self);
+  } else if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+    gtk_label_set_text (self->status_label, "Cancelled");
     adw_toast_overlay_add_toast (self->toast_overlay,
-                               adw_toast_new ("Please select a model file"));
-    return;
+                               adw_toast_new ("Generation cancelled"));
+  } else {
+    /* The image itself is fine, so keep it at its original size */
+    g_warning ("Upscaling failed: %s", error->message);
+    g_clear_pointer (&job->upscale_model_path, g_free);
+    emerge_window_show_result (self);
+    adw_toast_overlay_add_toast (self->toast_overlay,
+                               adw_toast_new ("Upscaling failed, kept the image at its original size"));
   }
   
-  // Free previous output path if it exists
-  g_free(self->output_path);
+  g_signal_handlers_disconnect_by_data (upscale, self);
+  g_clear_object (&self->upscale);
+  g_clear_pointer (&self->upscale_output_path, g_free);
+  emerge_window_release_job (self);
+}
+
+static gchar *emerge_window_new_temp_path (EmergeWindow *self, const char *prefix);
+
+/* Upscale the image the current job just produced into the temporary
+ * directory, which is where the history picks it up from */
+static gboolean
+emerge_window_start_upscale (EmergeWindow *self)
+{
+  EmergeJob *job = self->generate_job;
+  GError *error = NULL;
+  GInputStream *stream;
+  GdkPixbuf *input;
+  gchar *sd_path;
   
-  // Get system temp directory and create a unique subdirectory for emerge
-  const gchar *temp_dir = g_get_tmp_dir();
-  gchar *emerge_temp_dir = g_build_filename(temp_dir, "emerge-temp", NULL);
+  sd_path = emerge_sd_find_executable ();
+  if (sd_path == NULL)
+    return FALSE;
   
-  // Ensure the directory exists with proper permissions
-  if (!ensure_directory_exists(emerge_temp_dir)) {
-    adw_toast_overlay_add_toast (self->toast_overlay,
-                               adw_toast_new ("Failed to create temporary directory"));
-    g_free(emerge_temp_dir);
-    return;
+  self->upscale_output_path = emerge_window_new_temp_path (self, "emerge-upscaled");
+  if (self->upscale_output_path == NULL) {
+    g_free (sd_path);
+    return FALSE;
   }
   
-  // Create sequentially numbered output path in the temp directory
-  gchar *filename = g_strdup_printf("emerge-output-%04d.png", self->image_counter++);
-  self->output_path = g_build_filename(emerge_temp_dir, filename, NULL);
-  g_free(filename);
-  
-  // Make sure permissions are correct on the temp directory for writing
-  chmod(emerge_temp_dir, 0755);
-  g_free(emerge_temp_dir);
-  
-  g_print("Will save output to: %s\n", self->output_path);
+  self->upscale = emerge_upscale_new (self->process_manager, sd_path, job->upscale_model_path);
+  emerge_upscale_set_tile_size (self->upscale, job->upscale_tile_size);
+  g_free (sd_path);
   
-  /* Find the sd binary in PATH or in bin directory */
-  sd_path = find_sd_executable();
+  stream = g_memory_input_stream_new_from_bytes (self->output_bytes);
+  input = gdk_pixbuf_new_from_stream (stream, NULL, &error);
+  g_object_unref (stream);
   
-  if (sd_path == NULL) {
-    // Create a more detailed error message
-    GString *error_msg = g_string_new("Failed to find 'sd' executable. Install paths checked:\n");
-    
-    // Add current directory to the error message
-    gchar *cwd = g_get_current_dir();
-    g_string_append_printf(error_msg, "- %s/bin/sd\n", cwd);
-    g_string_append_printf(error_msg, "- %s/sd\n", cwd);
-    g_free(cwd);
-    
-    // Add paths relative to executable
-    gchar *exe_path = NULL;
-    GFile *exe_file = g_file_new_for_path("/proc/self/exe");
-    if (exe_file) {
-      exe_path = g_file_get_path(exe_file);
-      g_object_unref(exe_file);
-      if (exe_path) {
-        gchar *exe_dir = g_path_get_dirname(exe_path);
-        g_string_append_printf(error_msg, "- %s/bin/sd\n", exe_dir);
-        g_string_append_printf(error_msg, "- %s/sd\n", exe_dir);
-        
-        gchar *parent_dir = g_path_get_dirname(exe_dir);
-        g_string_append_printf(error_msg, "- %s/bin/sd\n", parent_dir);
-        g_string_append_printf(error_msg, "- %s/sd\n", parent_dir);
-        
-        gchar *root_dir = g_path_get_dirname(parent_dir);
-        g_string_append_printf(error_msg, "- %s/bin/sd\n", root_dir);
-        g_string_append_printf(error_msg, "- %s/sd\n", root_dir);
-        
-        g_free(root_dir);
-        g_free(parent_dir);
-        g_free(exe_dir);
-        g_free(exe_path);
-      }
-    }
-    
-    g_string_append(error_msg, "Make sure the 'sd' executable is in one of these locations or in PATH.");
-    
-    gtk_label_set_text (self->status_label, "Failed to find sd");
-    adw_toast_overlay_add_toast (self->toast_overlay,
-                               adw_toast_new (error_msg->str));
-    g_string_free(error_msg, TRUE);
-    
-    // Re-enable relevant UI elements if needed, similar to other error paths
-    self->is_generating = FALSE;
-    gtk_widget_set_sensitive (GTK_WIDGET (self->generate_button), TRUE);
-    gtk_widget_set_sensitive (GTK_WIDGET (self->model_chooser), TRUE);
-    gtk_widget_set_sensitive (GTK_WIDGET (self->model_dropdown), TRUE);
-    gtk_widget_set_sensitive (GTK_WIDGET (self->model_dir_button), TRUE);
-    // etc. for other UI elements if they were disabled before this check
-    return;
+  if (input == NULL ||
+      !emerge_upscale_start_for_pixbuf (self->upscale, input,
+                                        self->upscale_output_path, &error)) {
+    g_warning ("Failed to start upscaling: %s", error->message);
+    g_error_free (error);
+    g_clear_object (&input);
+    g_clear_object (&self->upscale);
+    g_clear_pointer (&self->upscale_output_path, g_free);
+    g_clear_pointer (&job->upscale_model_path, g_free);
+    return FALSE;
   }
+  g_object_unref (input);
   
-  /* Prepare the command line */
-  if (adw_switch_row_get_active (self->img2img_toggle)) {
-    if (self->initial_image_path == NULL) {
-      adw_toast_overlay_add_toast (self->toast_overlay,
-                                 adw_toast_new ("Please select an initial image for img2img"));
-      g_free(sd_path);
-      return;
-    }
-    
-    command_line = g_strdup_printf ("\"%s\" --mode img2img --model \"%s\" --prompt \"%s\" --negative-prompt \"%s\" --width %d --height %d --steps %d --seed %ld --cfg-scale %.1f --sampling-method %s --output \"%s\" --input \"%s\" --strength %.2f --vae-tiling",
-                                    sd_path,
-                                    self->model_path,
-                                    gtk_editable_get_text (GTK_EDITABLE (self->prompt_entry)),
-                                    gtk_editable_get_text (GTK_EDITABLE (self->negative_prompt_entry)),
-                                    (int) gtk_spin_button_get_value (self->width_spin),
-                                    (int) gtk_spin_button_get_value (self->height_spin),
-                                    (int) gtk_spin_button_get_value (self->steps_spin),
-                                    (long) gtk_spin_button_get_value (self->seed_spin),
-                                    gtk_spin_button_get_value (self->cfg_scale_spin),
-                                    gtk_string_object_get_string (GTK_STRING_OBJECT (
-                                      gtk_drop_down_get_selected_item (self->sampling_method_dropdown))),
-                                    self->output_path,
-                                    self->initial_image_path,
-                                    gtk_spin_button_get_value (self->strength_spin));
-  } else {
-    command_line = g_strdup_printf ("\"%s\" --model \"%s\" --prompt \"%s\" --negative-prompt \"%s\" --width %d --height %d --steps %d --seed %ld --cfg-scale %.1f --sampling-method %s --output \"%s\" --vae-tiling",
-                                    sd_path,
-                                    self->model_path,
-                                    gtk_editable_get_text (GTK_EDITABLE (self->prompt_entry)),
-                                    gtk_editable_get_text (GTK_EDITABLE (self->negative_prompt_entry)),
-                                    (int) gtk_spin_button_get_value (self->width_spin),
-                                    (int) gtk_spin_button_get_value (self->height_spin),
-                                    (int) gtk_spin_button_get_value (self->steps_spin),
-                                    (long) gtk_spin_button_get_value (self->seed_spin),
-                                    gtk_spin_button_get_value (self->cfg_scale_spin),
-                                    gtk_string_object_get_string (GTK_STRING_OBJECT (
-                                      gtk_drop_down_get_selected_item (self->sampling_method_dropdown))),
-                                    self->output_path);
-  }
+  gtk_label_set_text (self->status_label, "Upscaling...");
+  gtk_widget_set_visible (GTK_WIDGET (self->pause_button), FALSE);
+  g_signal_connect (self->upscale, "progress",
+                    G_CALLBACK (upscale_progress_cb), self);
+  g_signal_connect (self->upscale, "finished",
+                    G_CALLBACK (upscale_finished_cb), self);
   
-  g_free(sd_path);
+  return TRUE;
+}
+
+/* Previews come out of the sampling time, so if they cost more than they
+ * should, space the next ones out */
+static void
+emerge_window_check_preview_overhead (EmergeWindow *self)
+{
+  EmergeJob *job = self->generate_job;
+  double overhead = emerge_job_get_preview_overhead (job);
   
-  /* Disable UI while generating */
-  self->is_generating = TRUE;
-  gtk_widget_set_sensitive (GTK_WIDGET (self->generate_button), FALSE);
-  gtk_widget_set_sensitive (GTK_WIDGET (self->model_chooser), FALSE);
-  gtk_widget_set_sensitive (GTK_WIDGET (self->model_dropdown), FALSE);
-  gtk_widget_set_sensitive (GTK_WIDGET (self->model_dir_button), FALSE);
-  gtk_widget_set_sensitive (GTK_WIDGET (self->initial_image_chooser), FALSE);
-  gtk_widget_set_visible (GTK_WIDGET (self->stop_button), TRUE);
-  gtk_spinner_start (self->spinner);
-  gtk_widget_set_visible (GTK_WIDGET (self->spinner), TRUE);
-  gtk_label_set_text (self->status_label, "Generating...");
+  if (overhead < 0.0)
+    return;
   
-  /* Save config for persistence */
-  emerge_window_save_config (self);
+  g_print ("Previews every %d steps added %.1f%% to sampling\n",
+           job->preview_interval, overhead * 100.0);
   
-  /* Start the process */
-  self->cancellable = g_cancellable_new ();
+  if (overhead > EMERGE_WINDOW_PREVIEW_MAX_OVERHEAD) {
+    self->preview_min_interval = (gint) ceil (job->preview_interval * overhead /
+                                              EMERGE_WINDOW_PREVIEW_MAX_OVERHEAD);
+    g_print ("Previewing at most every %d steps from now on\n", self->preview_min_interval);
+  }
+}
+
+static void
+generate_output_read_cb (GObject      *source_object G_GNUC_UNUSED,
+                         GAsyncResult *result,
+                         gpointer      user_data)
+{
+  EmergeWindow *self;
+  EmergeJob *job = g_task_get_task_data (G_TASK (result));
+  GError *error = NULL;
+  GBytes *bytes;
   
-  // Parse command_line into argv
-  if (!g_shell_parse_argv (command_line, &argc, &argv, &error)) {
-    adw_toast_overlay_add_toast (self->toast_overlay,
-                               adw_toast_new_format ("Error parsing command line: %s", error->message));
+  bytes = emerge_job_read_output_finish (job, result, &error);
+  if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+    /* The window is gone */
     g_error_free (error);
-    g_free (command_line);
-    // Re-enable UI (copied from existing error handling)
-    self->is_generating = FALSE;
-    gtk_widget_set_sensitive (GTK_WIDGET (self->generate_button), TRUE);
-    gtk_widget_set_sensitive (GTK_WIDGET (self->model_chooser), TRUE);
-    gtk_widget_set_sensitive (GTK_WIDGET (self->model_dropdown), TRUE);
-    gtk_widget_set_sensitive (GTK_WIDGET (self->model_dir_button), TRUE);
-    gtk_widget_set_sensitive (GTK_WIDGET (self->initial_image_chooser), TRUE);
-    gtk_widget_set_visible (GTK_WIDGET (self->stop_button), FALSE);
-    gtk_spinner_stop (self->spinner);
-    gtk_widget_set_visible (GTK_WIDGET (self->spinner), FALSE);
-    gtk_label_set_text (self->status_label, "Ready");
-    g_object_unref(self->cancellable); // also unref cancellable here
-    self->cancellable = NULL;
     return;
   }
   
-  if (!g_spawn_async_with_pipes (NULL, argv, NULL, 
-                                G_SPAWN_SEARCH_PATH | G_SPAWN_DO_NOT_REAP_CHILD,
-                                NULL, NULL, &self->child_pid, 
-                                NULL, NULL, NULL, &error)) {
-    adw_toast_overlay_add_toast (self->toast_overlay,
-                               adw_toast_new (error->message));
+  self = EMERGE_WINDOW (user_data);
+  
+  if (bytes == NULL) {
+    g_warning ("%s", error->message);
     g_error_free (error);
-    g_free (command_line);
-    g_strfreev (argv);
-    
-    /* Re-enable UI */
-    self->is_generating = FALSE;
-    gtk_widget_set_sensitive (GTK_WIDGET (self->generate_button), TRUE);
-    gtk_widget_set_sensitive (GTK_WIDGET (self->model_chooser), TRUE);
-    gtk_widget_set_sensitive (GTK_WIDGET (self->model_dropdown), TRUE);
-    gtk_widget_set_sensitive (GTK_WIDGET (self->model_dir_button), TRUE);
-    gtk_widget_set_sensitive (GTK_WIDGET (self->initial_image_chooser), TRUE);
-    gtk_widget_set_visible (GTK_WIDGET (self->stop_button), FALSE);
-    gtk_spinner_stop (self->spinner);
-    gtk_widget_set_visible (GTK_WIDGET (self->spinner), FALSE);
-    gtk_label_set_text (self->status_label, "Ready");
-    
+    emerge_window_end_generation (self);
+    gtk_label_set_text (self->status_label, "Failed");
+    adw_toast_overlay_add_toast (self->toast_overlay,
+                               adw_toast_new ("Generation failed"));
+    self->generate_job->state = EMERGE_JOB_FAILED;
+    emerge_window_release_job (self);
     return;
   }
   
-  g_free (command_line);
-  g_strfreev (argv);
-  
-  /* Monitor the process */
-  self->child_watch_id = g_child_watch_add (self->child_pid, 
-                                          process_finished_cb, self);
-}
-
-static void
-on_stop_clicked (GtkButton *button G_GNUC_UNUSED,
-                 gpointer   user_data)
-{
-  EmergeWindow *self = EMERGE_WINDOW (user_data);
+  g_clear_pointer (&self->output_bytes, g_bytes_unref);
+  self->output_bytes = bytes;
   
-  if (self->child_pid != 0) {
-    g_cancellable_cancel (self->cancellable);
-    kill (self->child_pid, SIGTERM);
+  /* Upscaling keeps the controls disabled until it finishes */
+  if (self->generate_job->upscale_model_path == NULL ||
+      !emerge_window_start_upscale (self)) {
+    emerge_window_end_generation (self);
+    emerge_window_show_result (self);
   }
+  
+  if (self->upscale == NULL)
+    emerge_window_release_job (self);
 }
 
 static void
-on_img2img_toggled (AdwSwitchRow *button,
-                    gpointer         user_data)
+generate_process_exited_cb (EmergeProcess *process,
+                            gint           status,
+                            gpointer       user_data)
 {
   EmergeWindow *self = EMERGE_WINDOW (user_data);
-  gboolean active = adw_switch_row_get_active (button);
   
-  gtk_widget_set_visible (GTK_WIDGET (self->initial_image_chooser), active);
-  gtk_widget_set_visible (GTK_WIDGET (self->strength_spin), active);
-  gtk_widget_set_sensitive (GTK_WIDGET (self->strength_spin), active);
+  if (emerge_process_was_cancelled (process)) {
+    emerge_window_end_generation (self);
+    gtk_label_set_text (self->status_label, "Cancelled");
+    adw_toast_overlay_add_toast (self->toast_overlay,
+                               adw_toast_new ("Generation cancelled"));
+  } else if (status == 0) {
+    double load_seconds = self->generate_job->stats ? self->generate_job->stats->load_seconds : -1.0;
+    
+    g_print("Generation took %.2fs (model %.0f%% preloaded, %.2fs of disk reads done ahead of time",
+            (double) (g_get_monotonic_time () - self->generate_start_time) / G_USEC_PER_SEC,
+            self->preload_warm_fraction * 100.0,
+            self->preload_hidden_seconds);
+    if (load_seconds >= 0.0)
+      g_print(", model load took %.2fs", load_seconds);
+    g_print(")\n");
+    if (self->generate_job->requested_steps > 0)
+      g_print("Ran %d steps instead of %d; a benchmark's ssim_vs_full shows how close "
+              "such runs come to the full ones\n",
+              self->generate_job->steps, self->generate_job->requested_steps);
+    
+    emerge_window_check_preview_overhead (self);
+    
+    /* The controls stay disabled until the image is read back and stored;
+     * the job is let go of once it has been */
+    emerge_job_read_output_async (self->generate_job, self->history_cancellable,
+                                  generate_output_read_cb, self);
+    g_signal_handlers_disconnect_by_data (process, self);
+    g_clear_object (&self->generate_process);
+    return;
+  } else {
+    emerge_window_end_generation (self);
+    gtk_label_set_text (self->status_label, "Failed");
+    adw_toast_overlay_add_toast (self->toast_overlay,
+                               adw_toast_new ("Generation failed"));
+  }
+  
+  g_signal_handlers_disconnect_by_data (process, self);
+  g_clear_object (&self->generate_process);
+  if (self->upscale == NULL)
+    emerge_window_release_job (self);
+}
+
+static void
+model_open_response (GObject *source_object,
+                   GAsyncResult *result,
+                   gpointer user_data)
+{
+  EmergeWindow *self = EMERGE_WINDOW (user_data);
+  GtkFileDialog *dialog = GTK_FILE_DIALOG (source_object);
+  GFile *file;
+  GError *error = NULL;
+  
+  file = gtk_file_dialog_open_finish (dialog, result, &error);
+  if (file == NULL) {
+    if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+      g_warning ("Failed to open file: %s", error->message);
+    g_error_free (error);
+    return;
+  }
+  
+  g_free (self->model_path);
+  self->model_path = g_file_get_path (file);
+  
+  /* Update the button label to show filename */
+  char *basename = g_file_get_basename (file);
+  char *button_text = g_strdup_printf ("Model: %s", basename);
+  gtk_button_set_label (self->model_chooser, button_text);
+  g_free (button_text);
+  g_free (basename);
+  
+  /* Enable convert button and show quantization dropdown if it's a safetensors file */
+  if (g_str_has_suffix (self->model_path, ".safetensors")) {
+    gtk_widget_set_sensitive (GTK_WIDGET (self->convert_model_button), TRUE);
+    gtk_widget_set_visible (GTK_WIDGET (self->quantization_dropdown), TRUE);
+    gtk_widget_set_visible (GTK_WIDGET (self->quantization_label), TRUE);
+  } else {
+    gtk_widget_set_sensitive (GTK_WIDGET (self->convert_model_button), FALSE);
+    gtk_widget_set_visible (GTK_WIDGET (self->quantization_dropdown), FALSE);
+    gtk_widget_set_visible (GTK_WIDGET (self->quantization_label), FALSE);
+  }
+  
+  /* Start pulling the model into the page cache right away */
+  emerge_window_preload_model (self);
+  
+  g_object_unref (file);
+}
+
+static void
+on_model_file_select (GtkButton *button G_GNUC_UNUSED,
+                     gpointer   user_data)
+{
+  EmergeWindow *self = EMERGE_WINDOW (user_data);
+  GtkFileDialog *dialog;
+  GtkFileFilter *filter;
+  GListStore *filters;
+  
+  dialog = gtk_file_dialog_new ();
+  gtk_file_dialog_set_title (dialog, "Select Stable Diffusion Model");
+  
+  filter = gtk_file_filter_new ();
+  gtk_file_filter_set_name (filter, "Stable Diffusion Models");
+  gtk_file_filter_add_pattern (filter, "*.ckpt");
+  gtk_file_filter_add_pattern (filter, "*.safetensors");
+  gtk_file_filter_add_pattern (filter, "*.gguf");
+  
+  filters = g_list_store_new (GTK_TYPE_FILE_FILTER);
+  g_list_store_append (filters, filter);
+  gtk_file_dialog_set_filters (dialog, G_LIST_MODEL (filters));
+  
+  gtk_file_dialog_open (dialog,
+                       GTK_WINDOW (self),
+                       NULL,  /* cancellable */
+                       model_open_response,
+                       self);
+  
+  g_object_unref (dialog);
+  g_object_unref (filter);
+  g_object_unref (filters);
+}
+
+static void
+image_open_response (GObject *source_object,
+                   GAsyncResult *result,
+                   gpointer user_data)
+{
+  EmergeWindow *self = EMERGE_WINDOW (user_data);
+  GtkFileDialog *dialog = GTK_FILE_DIALOG (source_object);
+  GFile *file;
+  GError *error = NULL;
+  
+  file = gtk_file_dialog_open_finish (dialog, result, &error);
+  if (file == NULL) {
+    if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+      g_warning ("Failed to open file: %s", error->message);
+    g_error_free (error);
+    return;
+  }
+  
+  g_free (self->initial_image_path);
+  self->initial_image_path = g_file_get_path (file);
+  
+  /* Update the button label to show filename */
+  char *basename = g_file_get_basename (file);
+  char *button_text = g_strdup_printf ("Image: %s", basename);
+  gtk_button_set_label (self->initial_image_chooser, button_text);
+  g_free (button_text);
+  g_free (basename);
+  
+  /* Show the initial image with improved loading method */
+  gtk_picture_set_file (self->output_image, NULL);
+  
+  GdkTexture *texture = gdk_texture_new_from_file(file, NULL);
+  if (texture) {
+    gtk_picture_set_paintable(self->output_image, GDK_PAINTABLE(texture));
+    g_object_unref(texture);
+  } else {
+    gtk_picture_set_file(self->output_image, file);
+  }
+  
+  g_object_unref (file);
+}
+
+static void
+on_initial_image_file_select (GtkButton *button G_GNUC_UNUSED,
+                             gpointer   user_data)
+{
+  EmergeWindow *self = EMERGE_WINDOW (user_data);
+  GtkFileDialog *dialog;
+  GtkFileFilter *filter;
+  GListStore *filters;
+  
+  dialog = gtk_file_dialog_new ();
+  gtk_file_dialog_set_title (dialog, "Select Input Image");
+  
+  filter = gtk_file_filter_new ();
+  gtk_file_filter_set_name (filter, "Images");
+  gtk_file_filter_add_mime_type (filter, "image/png");
+  gtk_file_filter_add_mime_type (filter, "image/jpeg");
+  
+  filters = g_list_store_new (GTK_TYPE_FILE_FILTER);
+  g_list_store_append (filters, filter);
+  gtk_file_dialog_set_filters (dialog, G_LIST_MODEL (filters));
+  
+  gtk_file_dialog_open (dialog,
+                       GTK_WINDOW (self),
+                       NULL,  /* cancellable */
+                       image_open_response,
+                       self);
+  
+  g_object_unref (dialog);
+  g_object_unref (filter);
+  g_object_unref (filters);
+}
+
+static void
+save_image_response (GObject *source_object,
+                    GAsyncResult *result,
+                    gpointer user_data)
+{
+  EmergeWindow *self = EMERGE_WINDOW (user_data);
+  GtkFileDialog *dialog = GTK_FILE_DIALOG (source_object);
+  GFile *file;
+  GError *error = NULL;
+  
+  file = gtk_file_dialog_save_finish (dialog, result, &error);
+  if (file == NULL) {
+    if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+      g_warning ("Failed to save file: %s", error->message);
+    g_error_free (error);
+    return;
+  }
+  
+  // Get the directory for future saves
+  GFile *parent = g_file_get_parent(file);
+  if (parent) {
+    g_free(self->last_saved_dir);
+    self->last_saved_dir = g_file_get_path(parent);
+    g_object_unref(parent);
+  }
+  
+  // Save current image to the selected location; one that couldn't be
+  // stored in the history is still in memory
+  if (self->output_path == NULL && self->output_bytes != NULL) {
+    g_file_replace_contents (file, g_bytes_get_data (self->output_bytes, NULL),
+                             g_bytes_get_size (self->output_bytes), NULL, FALSE,
+                             G_FILE_CREATE_NONE, NULL, NULL, &error);
+    if (error) {
+      adw_toast_overlay_add_toast(self->toast_overlay,
+                                adw_toast_new ("Failed to save image"));
+      g_error_free(error);
+    } else {
+      adw_toast_overlay_add_toast(self->toast_overlay,
+                                adw_toast_new ("Image saved successfully"));
+    }
+  } else if (self->output_path != NULL) {
+    GFile *src_file = g_file_new_for_path(self->output_path);
+    
+    g_file_copy(src_file, file, G_FILE_COPY_OVERWRITE, NULL, NULL, NULL, &error);
+    g_object_unref(src_file);
+    
+    if (error) {
+      adw_toast_overlay_add_toast(self->toast_overlay,
+                                adw_toast_new ("Failed to save image"));
+      g_error_free(error);
+    } else {
+      adw_toast_overlay_add_toast(self->toast_overlay,
+                                adw_toast_new ("Image saved successfully"));
+    }
+  }
+  
+  g_object_unref(file);
+}
+
+static void
+on_save_clicked (GtkButton *button G_GNUC_UNUSED,
+                gpointer   user_data)
+{
+  EmergeWindow *self = EMERGE_WINDOW (user_data);
+  GtkFileDialog *dialog;
+  GtkFileFilter *filter;
+  GListStore *filters;
+  GFile *current_folder = NULL;
+  
+  // If there's no image to save, don't open dialog
+  if (self->output_path == NULL && self->output_bytes == NULL) {
+    adw_toast_overlay_add_toast(self->toast_overlay,
+                              adw_toast_new ("No image to save"));
+    return;
+  }
+  
+  dialog = gtk_file_dialog_new();
+  gtk_file_dialog_set_title(dialog, "Save Image");
+  
+  // Set default name
+  gchar *filename = g_strdup_printf("stable-diffusion-%04d.png", self->image_counter - 1);
+  gtk_file_dialog_set_initial_name(dialog, filename);
+  g_free(filename);
+  
+  // Set initial folder if we have saved before
+  if (self->last_saved_dir) {
+    current_folder = g_file_new_for_path(self->last_saved_dir);
+  } else {
+    // Default to Pictures directory if no previous save location
+    const gchar *home_dir = g_get_home_dir();
+    gchar *pictures_dir = g_build_filename(home_dir, "Pictures", NULL);
+    current_folder = g_file_new_for_path(pictures_dir);
+    g_free(pictures_dir);
+  }
+  
+  if (current_folder) {
+    gtk_file_dialog_set_initial_folder(dialog, current_folder);
+  }
+  
+  filter = gtk_file_filter_new();
+  gtk_file_filter_set_name(filter, "PNG Images");
+  gtk_file_filter_add_mime_type(filter, "image/png");
+  
+  filters = g_list_store_new(GTK_TYPE_FILE_FILTER);
+  g_list_store_append(filters, filter);
+  gtk_file_dialog_set_filters(dialog, G_LIST_MODEL(filters));
+  
+  gtk_file_dialog_save(dialog,
+                      GTK_WINDOW(self),
+                      NULL,  /* cancellable */
+                      save_image_response,
+                      self);
+  
+  if (current_folder)
+    g_object_unref(current_folder);
+  g_object_unref(dialog);
+  g_object_unref(filter);
+  g_object_unref(filters);
+}
+
+/* Snapshot the generation parameters currently shown in the UI */
+static EmergeJob *
+emerge_window_build_job (EmergeWindow *self)
+{
+  EmergeJob *job = emerge_job_new ();
+  
+  job->model_path = g_strdup (self->model_path);
+  job->prompt = g_strdup (gtk_editable_get_text (GTK_EDITABLE (self->prompt_entry)));
+  job->negative_prompt = g_strdup (gtk_editable_get_text (GTK_EDITABLE (self->negative_prompt_entry)));
+  job->width = (int) gtk_spin_button_get_value (self->width_spin);
+  job->height = (int) gtk_spin_button_get_value (self->height_spin);
+  job->steps = (int) gtk_spin_button_get_value (self->steps_spin);
+  job->seed = (gint64) gtk_spin_button_get_value (self->seed_spin);
+  job->cfg_scale = gtk_spin_button_get_value (self->cfg_scale_spin);
+  g_free (job->sampling_method);
+  job->sampling_method = g_strdup (gtk_string_object_get_string (GTK_STRING_OBJECT (
+                                     gtk_drop_down_get_selected_item (self->sampling_method_dropdown))));
+  job->img2img = adw_switch_row_get_active (self->img2img_toggle);
+  job->init_image_path = g_strdup (self->initial_image_path);
+  job->strength = gtk_spin_button_get_value (self->strength_spin);
+  job->output_path = g_strdup (self->output_path);
+  
+  if (adw_switch_row_get_active (self->upscale_toggle)) {
+    job->upscale_model_path = g_strdup (self->upscale_model_path);
+    job->upscale_tile_size = (int) gtk_spin_button_get_value (self->upscale_tile_spin);
+  }
+  
+  if (adw_switch_row_get_active (self->preview_toggle))
+    job->preview_interval = MAX ((int) gtk_spin_button_get_value (self->preview_interval_spin),
+                                 self->preview_min_interval);
+  
+  return job;
+}
+
+/* This window's own directory for the files sd still needs on disk, such
+ * as previews and upscale results; created on demand, private to the user
+ * and never shared with other instances */
+static gchar *
+emerge_window_get_temp_dir (EmergeWindow *self)
+{
+  if (self->temp_dir == NULL) {
+    GError *error = NULL;
+    
+    self->temp_dir = g_dir_make_tmp ("emerge-XXXXXX", &error);
+    if (self->temp_dir == NULL) {
+      g_warning ("Failed to create temporary directory: %s", error->message);
+      g_error_free (error);
+      adw_toast_overlay_add_toast (self->toast_overlay,
+                                 adw_toast_new ("Failed to create temporary directory"));
+      return NULL;
+    }
+  }
+  
+  return g_strdup (self->temp_dir);
+}
+
+/* Pick a fresh numbered file in the temporary directory for the next image */
+static gchar *
+emerge_window_new_temp_path (EmergeWindow *self,
+                             const char   *prefix)
+{
+  gchar *emerge_temp_dir = emerge_window_get_temp_dir (self);
+  
+  if (emerge_temp_dir == NULL)
+    return NULL;
+  
+  // Create sequentially numbered output path in the temp directory
+  gchar *filename = g_strdup_printf("%s-%04d.png", prefix, self->image_counter++);
+  gchar *path = g_build_filename(emerge_temp_dir, filename, NULL);
+  g_free(filename);
+  g_free(emerge_temp_dir);
+  
+  return path;
+}
+
+/* Live preview: while it is on, every edit to the prompts, CFG scale or
+ * seed redraws a small, few-step version of the image once typing pauses.
+ * Only the newest parameters matter, so an edit kills any preview still
+ * running for older ones. */
+static void emerge_window_start_live (EmergeWindow *self);
+
+static void
+live_process_exited_cb (EmergeProcess *process,
+                        gint           status,
+                        gpointer       user_data)
+{
+  EmergeWindow *self = EMERGE_WINDOW (user_data);
+  
+  if (!emerge_process_was_cancelled (process) && status == 0 && !self->is_generating) {
+    GError *error = NULL;
+    GdkTexture *texture = gdk_texture_new_from_filename (self->live_output_path, &error);
+    
+    if (texture != NULL) {
+      double latency = (double) (g_get_monotonic_time () - self->live_edit_time) / G_USEC_PER_SEC;
+      gchar *text = g_strdup_printf ("Live preview (%.2fs)", latency);
+      
+      g_print ("Live preview took %.2fs from the last edit\n", latency);
+      
+      /* A preview isn't a result, so it replaces whatever is on display
+       * without going near the history */
+      g_cancellable_cancel (self->show_cancellable);
+      g_clear_object (&self->viewed_item);
+      emerge_image_viewer_clear (self->tiled_viewer);
+      gtk_stack_set_visible_child_name (self->image_stack, "picture");
+      gtk_picture_set_paintable (self->output_image, GDK_PAINTABLE (texture));
+      gtk_widget_set_visible (GTK_WIDGET (self->save_button), FALSE);
+      emerge_window_update_navigation (self);
+      gtk_label_set_text (self->status_label, text);
+      g_free (text);
+      g_object_unref (texture);
+    } else {
+      g_warning ("Failed to load live preview: %s", error->message);
+      g_error_free (error);
+    }
+  } else if (!emerge_process_was_cancelled (process) && status != 0) {
+    gtk_label_set_text (self->status_label, "Live preview failed");
+  } else if (!self->is_generating && !self->live_pending && self->live_timeout_id == 0) {
+    gtk_label_set_text (self->status_label, "Ready");
+  }
+  
+  g_signal_handlers_disconnect_by_data (process, self);
+  g_clear_object (&self->live_process);
+  
+  /* Parameters changed while the stale preview was shutting down */
+  if (self->live_pending) {
+    self->live_pending = FALSE;
+    emerge_window_start_live (self);
+  }
+}
+
+static void
+emerge_window_start_live (EmergeWindow *self)
+{
+  GError *error = NULL;
+  EmergeJob *job, *live;
+  gchar *sd_path;
+  
+  if (!adw_switch_row_get_active (self->live_toggle) ||
+      self->is_generating || self->model_path == NULL ||
+      emerge_window_is_benchmarking (self))
+    return;
+  
+  /* Only one preview at a time; the running one has already been told to
+   * stop, so go again once it has */
+  if (self->live_process != NULL) {
+    self->live_pending = TRUE;
+    return;
+  }
+  
+  if (self->live_output_path == NULL) {
+    gchar *temp_dir = emerge_window_get_temp_dir (self);
+    
+    if (temp_dir == NULL)
+      return;
+    self->live_output_path = g_build_filename (temp_dir, "emerge-live.png", NULL);
+    g_free (temp_dir);
+  }
+  
+  sd_path = emerge_sd_find_executable ();
+  if (sd_path == NULL)
+    return;
+  
+  job = emerge_window_build_job (self);
+  live = emerge_job_new_draft (job, EMERGE_WINDOW_LIVE_SIZE,
+                               g_strcmp0 (job->sampling_method, "lcm") == 0 ?
+                               EMERGE_WINDOW_LIVE_LCM_STEPS : EMERGE_WINDOW_LIVE_STEPS);
+  emerge_job_unref (job);
+  g_free (live->output_path);
+  live->output_path = g_strdup (self->live_output_path);
+  
+  self->live_process = emerge_job_spawn (live, self->process_manager, sd_path, NULL, &error);
+  g_free (sd_path);
+  emerge_job_unref (live);
+  
+  if (self->live_process == NULL) {
+    g_warning ("Failed to start live preview: %s", error->message);
+    g_error_free (error);
+    return;
+  }
+  
+  gtk_label_set_text (self->status_label, "Updating preview...");
+  g_signal_connect (self->live_process, "exited",
+                    G_CALLBACK (live_process_exited_cb), self);
+}
+
+static gboolean
+live_timeout_cb (gpointer user_data)
+{
+  EmergeWindow *self = EMERGE_WINDOW (user_data);
+  
+  self->live_timeout_id = 0;
+  emerge_window_start_live (self);
+  
+  return G_SOURCE_REMOVE;
+}
+
+/* Drop any preview in flight or about to start */
+static void
+emerge_window_stop_live (EmergeWindow *self)
+{
+  g_clear_handle_id (&self->live_timeout_id, g_source_remove);
+  self->live_pending = FALSE;
+  if (self->live_process != NULL)
+    emerge_process_cancel (self->live_process);
+}
+
+static void
+on_live_param_changed (EmergeWindow *self)
+{
+  if (!adw_switch_row_get_active (self->live_toggle))
+    return;
+  
+  /* Whatever is running now is for parameters that are gone */
+  emerge_window_stop_live (self);
+  self->live_edit_time = g_get_monotonic_time ();
+  self->live_timeout_id = g_timeout_add (EMERGE_WINDOW_LIVE_DEBOUNCE_MS, live_timeout_cb, self);
+}
+
+static void
+on_live_toggled (AdwSwitchRow *row,
+                 gpointer      user_data)
+{
+  EmergeWindow *self = EMERGE_WINDOW (user_data);
+  
+  if (adw_switch_row_get_active (row)) {
+    self->live_edit_time = g_get_monotonic_time ();
+    emerge_window_start_live (self);
+  } else {
+    emerge_window_stop_live (self);
+  }
+}
+
+/* Start sd for @job, which the window takes over */
+static void
+emerge_window_run_job (EmergeWindow *self,
+                       EmergeJob    *job)
+{
+  GError *error = NULL;
+  gchar *sd_path;
+  
+  /* The image comes back in memory, so nothing is written to disk until
+   * the history stores it */
+  if (!emerge_job_set_output_memory (job, &error)) {
+    g_warning ("%s", error->message);
+    g_error_free (error);
+    adw_toast_overlay_add_toast (self->toast_overlay,
+                               adw_toast_new ("Failed to start generation"));
+    emerge_job_unref (job);
+    return;
+  }
+  
+  g_clear_pointer (&self->output_path, g_free);
+  g_clear_pointer (&self->output_bytes, g_bytes_unref);
+  g_clear_pointer (&job->output_path, g_free);
+  self->image_counter++;
+  
+  /* sd overwrites one preview file as it goes; start without a stale one */
+  if (job->preview_interval > 0) {
+    gchar *temp_dir = emerge_window_get_temp_dir (self);
+    
+    if (temp_dir == NULL) {
+      emerge_job_unref (job);
+      return;
+    }
+    
+    g_free (job->preview_path);
+    job->preview_path = g_build_filename (temp_dir, "emerge-preview.png", NULL);
+    g_unlink (job->preview_path);
+    self->preview_mtime = 0;
+    self->preview_step = 0;
+    g_free (temp_dir);
+  }
+  
+  /* Learn where this kind of run settles, unless that is already known or
+   * this run was cut short on the strength of it */
+  g_clear_pointer (&self->convergence, emerge_convergence_free);
+  if (job->preview_interval > 0 && !job->draft && job->requested_steps == 0 &&
+      adw_switch_row_get_active (self->early_stop_toggle)) {
+    gchar *key = convergence_key (job);
+    
+    if (!g_hash_table_contains (self->converged_steps, key))
+      self->convergence = emerge_convergence_new (EMERGE_CONVERGENCE_DEFAULT_THRESHOLD,
+                                                  EMERGE_CONVERGENCE_DEFAULT_PATIENCE);
+    g_free (key);
+  }
+  
+  /* Find the sd binary in PATH or in bin directory */
+  sd_path = emerge_sd_find_executable ();
+  
+  if (sd_path == NULL) {
+    gchar *error_msg = emerge_sd_format_not_found_message ();
+    
+    gtk_label_set_text (self->status_label, "Failed to find sd");
+    adw_toast_overlay_add_toast (self->toast_overlay,
+                               adw_toast_new (error_msg));
+    g_free (error_msg);
+    emerge_job_unref (job);
+    return;
+  }
+  
+  /* A full generation makes any preview moot, and would compete with it */
+  emerge_window_stop_live (self);
+  
+  /* An image the user asked for here and now preempts low-priority
+   * background conversions. They are paused rather than cancelled, so they
+   * pick up where they were once it is done. Queued jobs don't preempt
+   * anything; they run alongside. */
+  if (self->preempted == NULL && self->queue_job_id == 0) {
+    self->preempted = emerge_process_manager_pause_background (self->process_manager);
+    if (self->preempted->len > 0)
+      g_print ("Paused %u background process(es) for the generation\n", self->preempted->len);
+  }
+  
+  /* Disable UI while generating */
+  self->is_generating = TRUE;
+  self->generate_step = 0;
+  gtk_widget_set_sensitive (GTK_WIDGET (self->generate_button), FALSE);
+  gtk_widget_set_sensitive (GTK_WIDGET (self->draft_button), FALSE);
+  gtk_widget_set_sensitive (GTK_WIDGET (self->model_chooser), FALSE);
+  gtk_widget_set_sensitive (GTK_WIDGET (self->model_dropdown), FALSE);
+  gtk_widget_set_sensitive (GTK_WIDGET (self->model_dir_button), FALSE);
+  gtk_widget_set_sensitive (GTK_WIDGET (self->initial_image_chooser), FALSE);
+  gtk_widget_set_visible (GTK_WIDGET (self->stop_button), TRUE);
+  gtk_widget_set_visible (GTK_WIDGET (self->pause_button), TRUE);
+  gtk_button_set_icon_name (self->pause_button, "media-playback-pause-symbolic");
+  gtk_widget_set_tooltip_text (GTK_WIDGET (self->pause_button), "Pause");
+  gtk_spinner_start (self->spinner);
+  gtk_widget_set_visible (GTK_WIDGET (self->spinner), TRUE);
+  gtk_label_set_text (self->status_label, job->draft ? "Drafting..." : "Generating...");
+  emerge_window_record_preload_state (self);
+  emerge_window_update_navigation (self);
+  
+  /* Save config for persistence */
+  emerge_window_save_config (self);
+  
+  /* Start the process */
+  self->generate_process = emerge_job_spawn (job, self->process_manager,
+                                             sd_path, NULL, &error);
+  g_free (sd_path);
+  
+  if (self->generate_process == NULL) {
+    adw_toast_overlay_add_toast (self->toast_overlay,
+                               adw_toast_new (error->message));
+    g_error_free (error);
+    emerge_job_unref (job);
+    
+    /* Re-enable UI */
+    emerge_window_end_generation (self);
+    gtk_label_set_text (self->status_label, "Ready");
+    
+    return;
+  }
+  
+  /* Kept until the process exits so the result can go into the history */
+  self->generate_job = job;
+  
+  /* Monitor the process */
+  g_signal_connect (self->generate_process, "progress",
+                    G_CALLBACK (generate_process_progress_cb), self);
+  g_signal_connect (self->generate_process, "exited",
+                    G_CALLBACK (generate_process_exited_cb), self);
+}
+
+/* Checks shared by everything that generates from the current settings */
+static gboolean
+emerge_window_can_generate (EmergeWindow *self)
+{
+  if (self->is_generating)
+    return FALSE;
+  
+  if (emerge_window_is_benchmarking (self)) {
+    adw_toast_overlay_add_toast (self->toast_overlay,
+                               adw_toast_new ("Wait for the benchmark to finish"));
+    return FALSE;
+  }
+  
+  if (self->model_path == NULL) {
+    adw_toast_overlay_add_toast (self->toast_overlay,
+                               adw_toast_new ("Please select a model file"));
+    return FALSE;
+  }
+  
+  if (adw_switch_row_get_active (self->img2img_toggle) && self->initial_image_path == NULL) {
+    adw_toast_overlay_add_toast (self->toast_overlay,
+                               adw_toast_new ("Please select an initial image for img2img"));
+    return FALSE;
+  }
+  
+  return TRUE;
+}
+
+/* The step runs like @job were seen to converge at, when early stopping
+ * is on and that comes before its last step, or else 0 */
+static gint
+emerge_window_get_early_stop (EmergeWindow    *self,
+                              const EmergeJob *job)
+{
+  gchar *key;
+  gint step;
+  
+  if (!adw_switch_row_get_active (self->preview_toggle) ||
+      !adw_switch_row_get_active (self->early_stop_toggle))
+    return 0;
+  
+  key = convergence_key (job);
+  step = GPOINTER_TO_INT (g_hash_table_lookup (self->converged_steps, key));
+  g_free (key);
+  
+  return step > 0 && step < job->steps ? step : 0;
+}
+
+/* sd has no way to stop a schedule partway, so a cut job runs a shorter
+ * schedule of its own. The steps asked for are kept, since that is what
+ * the job is known by. */
+static void
+emerge_window_cut_steps (EmergeJob *job,
+                         gint       step)
+{
+  job->requested_steps = job->steps;
+  job->steps = step;
+}
+
+/* Run @job for as many steps as runs like it were seen to converge in,
+ * when early stopping is on. Takes @job and returns it. */
+static EmergeJob *
+emerge_window_apply_early_stop (EmergeWindow *self,
+                                EmergeJob    *job)
+{
+  gint step = emerge_window_get_early_stop (self, job);
+  
+  if (step > 0) {
+    gchar *text = g_strdup_printf ("Running %d steps instead of %d", step, job->steps);
+    
+    adw_toast_overlay_add_toast (self->toast_overlay, adw_toast_new (text));
+    g_free (text);
+    emerge_window_cut_steps (job, step);
+  }
+  
+  return job;
+}
+
+static void
+on_generate_clicked (GtkButton *button G_GNUC_UNUSED,
+                     gpointer   user_data)
+{
+  EmergeWindow *self = EMERGE_WINDOW (user_data);
+  
+  if (!emerge_window_can_generate (self))
+    return;
+  
+  if (adw_switch_row_get_active (self->upscale_toggle) && self->upscale_model_path == NULL) {
+    adw_toast_overlay_add_toast (self->toast_overlay,
+                               adw_toast_new ("Please select an upscale model"));
+    return;
+  }
+  
+  emerge_window_run_job (self, emerge_window_apply_early_stop (self, emerge_window_build_job (self)));
+}
+
+/* A quick low-resolution take on the current settings, to be refined
+ * later if it is any good */
+static void
+on_draft_clicked (GtkButton *button G_GNUC_UNUSED,
+                  gpointer   user_data)
+{
+  EmergeWindow *self = EMERGE_WINDOW (user_data);
+  EmergeJob *job;
+  
+  if (!emerge_window_can_generate (self))
+    return;
+  
+  job = emerge_window_build_job (self);
+  emerge_window_run_job (self, emerge_job_new_draft (job, EMERGE_JOB_DRAFT_SIZE,
+                                                     EMERGE_JOB_DRAFT_STEPS));
+  emerge_job_unref (job);
+}
+
+/* "2 h 5 min", "12 min" or "40 s" */
+static gchar *
+format_duration (double seconds)
+{
+  gint64 s = (gint64) (seconds + 0.5);
+  
+  if (s >= 3600)
+    return g_strdup_printf ("%" G_GINT64_FORMAT " h %" G_GINT64_FORMAT " min",
+                            s / 3600, (s % 3600) / 60);
+  if (s >= 60)
+    return g_strdup_printf ("%" G_GINT64_FORMAT " min", (s + 30) / 60);
+  return g_strdup_printf ("%" G_GINT64_FORMAT " s", s);
+}
+
+/* Seconds job @job of the queue has yet to take, or -1 if there is no
+ * telling */
+static double
+emerge_window_predict_job (EmergeWindow *self,
+                           EmergeJob    *job)
+{
+  if (job->id == self->queue_job_id && self->generate_job != NULL) {
+    double elapsed = (g_get_monotonic_time () - self->generate_start_time) / (double) G_USEC_PER_SEC;
+    
+    return emerge_cost_model_predict_remaining (self->cost_model, self->generate_job,
+                                                self->generate_step, elapsed);
+  }
+  
+  return emerge_cost_model_predict (self->cost_model, job);
+}
+
+/* Seconds the combinations the sweep has yet to queue should take, from
+ * a sample of them, or -1 if none can be timed. Kept until the sweep
+ * moves on or the cost model learns from another run. */
+static double
+emerge_window_predict_sweep_rest (EmergeWindow *self)
+{
+  guint64 position, n_rest, n_samples;
+  guint n_runs = emerge_cost_model_get_n_runs (self->cost_model);
+  double seconds = 0.0;
+  guint n_known = 0;
+  
+  position = emerge_sweep_get_position (self->sweep);
+  if (position == self->sweep_rest_position && n_runs == self->sweep_rest_n_runs)
+    return self->sweep_rest_seconds;
+  
+  n_rest = emerge_sweep_get_n_jobs (self->sweep) - position;
+  n_samples = MIN (n_rest, EMERGE_WINDOW_SWEEP_SAMPLES);
+  for (guint64 i = 0; i < n_samples; i++) {
+    guint64 index = position + (guint64) ((double) i * n_rest / n_samples);
+    EmergeJob *job = emerge_sweep_get_job (self->sweep, index, self->sweep_base);
+    gint step = emerge_window_get_early_stop (self, job);
+    double job_seconds;
+    
+    if (step > 0)
+      emerge_window_cut_steps (job, step);
+    job_seconds = emerge_cost_model_predict (self->cost_model, job);
+    emerge_job_unref (job);
+    
+    if (job_seconds >= 0.0) {
+      seconds += job_seconds;
+      n_known++;
+    }
+  }
+  
+  self->sweep_rest_position = position;
+  self->sweep_rest_n_runs = n_runs;
+  self->sweep_rest_seconds = n_known > 0 ? seconds / n_known * n_rest : -1.0;
+  
+  return self->sweep_rest_seconds;
+}
+
+/* What is left to run, as far as the cost model can tell */
+typedef struct {
+  guint64 n_jobs;          /* queued, in a sweep or in a watched folder */
+  guint64 n_unknown;       /* of those, ones nothing like any past run */
+  double  seconds;         /* for the others */
+  guint64 sweep_n_unknown;
+  double  sweep_seconds;   /* for the sweep's jobs, queued or not */
+} QueueEstimate;
+
+/* Fills in @estimate, and with @entries, the "jobs" of the queue's status,
+ * gives each of them an "eta_seconds" */
+static void
+emerge_window_estimate_queue (EmergeWindow  *self,
+                              QueueEstimate *estimate,
+                              JsonArray     *entries)
+{
+  GPtrArray *jobs = emerge_queue_get_jobs (self->queue);
+  
+  *estimate = (QueueEstimate) { 0 };
+  estimate->n_jobs = jobs->len;
+  
+  for (guint i = 0; i < jobs->len; i++) {
+    EmergeJob *job = g_ptr_array_index (jobs, i);
+    double job_seconds = emerge_window_predict_job (self, job);
+    gboolean in_sweep = self->sweep_ids != NULL &&
+                        g_hash_table_contains (self->sweep_ids, &job->id);
+    
+    if (entries != NULL && i < json_array_get_length (entries)) {
+      JsonObject *entry = json_array_get_object_element (entries, i);
+      
+      if (job_seconds >= 0.0)
+        json_object_set_double_member (entry, "eta_seconds", job_seconds);
+      else
+        json_object_set_null_member (entry, "eta_seconds");
+    }
+    
+    if (job_seconds < 0.0) {
+      estimate->n_unknown++;
+      if (in_sweep)
+        estimate->sweep_n_unknown++;
+      continue;
+    }
+    
+    estimate->seconds += job_seconds;
+    if (in_sweep)
+      estimate->sweep_seconds += job_seconds;
+  }
+  g_ptr_array_unref (jobs);
+  
+  /* Sweeps and watched folders only queue a few jobs at a time */
+  if (self->sweep != NULL) {
+    guint64 n_rest = emerge_sweep_get_n_jobs (self->sweep) - emerge_sweep_get_position (self->sweep);
+    double rest_seconds = emerge_window_predict_sweep_rest (self);
+    
+    estimate->n_jobs += n_rest;
+    if (rest_seconds < 0.0) {
+      estimate->n_unknown += n_rest;
+      estimate->sweep_n_unknown += n_rest;
+    } else {
+      estimate->seconds += rest_seconds;
+      estimate->sweep_seconds += rest_seconds;
+    }
+  }
+  
+  if (self->hot_folder != NULL) {
+    guint n_waiting = emerge_hot_folder_get_n_waiting (self->hot_folder);
+    double job_seconds;
+    
+    /* At the template's size, the most an image is scaled to */
+    job_seconds = n_waiting > 0
+      ? emerge_cost_model_predict (self->cost_model, emerge_hot_folder_get_template (self->hot_folder))
+      : 0.0;
+    estimate->n_jobs += n_waiting;
+    if (job_seconds < 0.0)
+      estimate->n_unknown += n_waiting;
+    else
+      estimate->seconds += job_seconds * n_waiting;
+  }
+}
+
+/* "About 1 h 5 min for 6 jobs, done around 03:40", and how a sweep is
+ * getting on, or NULL if there is nothing to run */
+static gchar *
+emerge_window_describe_queue_eta (EmergeWindow *self)
+{
+  QueueEstimate estimate;
+  GString *text;
+  
+  emerge_window_estimate_queue (self, &estimate, NULL);
+  if (estimate.n_jobs == 0)
+    return NULL;
+  
+  text = g_string_new (NULL);
+  
+  if (estimate.n_unknown == estimate.n_jobs) {
+    g_string_printf (text, "%" G_GUINT64_FORMAT " jobs, no past runs to time them by",
+                     estimate.n_jobs);
+  } else {
+    GDateTime *now = g_date_time_new_now_local ();
+    GDateTime *done = g_date_time_add_seconds (now, estimate.seconds);
+    gchar *clock = g_date_time_format (done, estimate.seconds < 20 * 3600 ? "%H:%M" : "%a %H:%M");
+    gchar *eta = format_duration (estimate.seconds);
+    
+    g_string_printf (text, "About %s for %" G_GUINT64_FORMAT " jobs, done around %s",
+                     eta, estimate.n_jobs, clock);
+    if (estimate.n_unknown > 0)
+      g_string_append_printf (text, ", not counting %" G_GUINT64_FORMAT " never run before",
+                              estimate.n_unknown);
+    
+    g_free (eta);
+    g_free (clock);
+    g_date_time_unref (done);
+    g_date_time_unref (now);
+  }
+  
+  if (self->sweep_ids != NULL) {
+    g_string_append_printf (text, "\nSweep: %" G_GUINT64_FORMAT " of %" G_GUINT64_FORMAT " done",
+                            self->sweep_finished, self->sweep_total);
+    if (estimate.sweep_n_unknown < self->sweep_total - self->sweep_finished) {
+      gchar *eta = format_duration (estimate.sweep_seconds);
+      
+      g_string_append_printf (text, ", about %s left", eta);
+      g_free (eta);
+    }
+  }
+  
+  return g_string_free (text, FALSE);
+}
+
+static void
+emerge_window_update_queue_eta (EmergeWindow *self)
+{
+  gchar *text = emerge_window_describe_queue_eta (self);
+  
+  gtk_widget_set_tooltip_text (GTK_WIDGET (self->queue_button), text);
+  g_free (text);
+}
+
+static void
+emerge_window_clear_sweep (EmergeWindow *self)
+{
+  g_clear_pointer (&self->sweep, emerge_sweep_free);
+  g_clear_pointer (&self->sweep_base, emerge_job_unref);
+  g_clear_pointer (&self->sweep_ids, g_hash_table_unref);
+  self->sweep_total = 0;
+  self->sweep_finished = 0;
+  self->sweep_rest_position = G_MAXUINT64;
+}
+
+/* Counts the sweep's jobs that have left the queue, whether they ran,
+ * were skipped or were cancelled, and tops the queue up from the sweep */
+static void
+emerge_window_update_sweep (EmergeWindow *self)
+{
+  GHashTableIter iter;
+  gpointer key;
+  guint n_left_queue = 0;
+  
+  if (self->sweep_ids == NULL || self->sweep_feeding)
+    return;
+  
+  g_hash_table_iter_init (&iter, self->sweep_ids);
+  while (g_hash_table_iter_next (&iter, &key, NULL)) {
+    if (!emerge_queue_has_job (self->queue, *(guint64 *) key)) {
+      g_hash_table_iter_remove (&iter);
+      n_left_queue++;
+    }
+  }
+  
+  if (n_left_queue > 0) {
+    self->sweep_finished += n_left_queue;
+    
+    if (self->sweep_finished == self->sweep_total) {
+      double elapsed = (g_get_monotonic_time () - self->sweep_start_time) / (double) G_USEC_PER_SEC;
+      gchar *eta, *text;
+      
+      eta = format_duration (elapsed);
+      text = g_strdup_printf ("Sweep of %" G_GUINT64_FORMAT " images done in %s",
+                              self->sweep_total, eta);
+      g_print ("%s\n", text);
+      adw_toast_overlay_add_toast (self->toast_overlay, adw_toast_new (text));
+      g_free (text);
+      g_free (eta);
+      emerge_window_clear_sweep (self);
+      return;
+    }
+  }
+  
+  /* Submitting emits EmergeQueue::changed, which lands back here */
+  self->sweep_feeding = TRUE;
+  while (self->sweep != NULL &&
+         g_hash_table_size (self->sweep_ids) < EMERGE_SWEEP_MAX_QUEUED) {
+    EmergeJob *job = emerge_sweep_next (self->sweep, self->sweep_base);
+    GError *error = NULL;
+    guint64 id;
+    gint step;
+    
+    if (job == NULL) {
+      g_clear_pointer (&self->sweep, emerge_sweep_free);
+      break;
+    }
+    
+    if (job->seed < 0)
+      job->seed = g_random_int_range (0, G_MAXINT32);
+    
+    /* Per combination, since it may change the model, sampler or size;
+     * quietly, as a toast per job would bury the others */
+    step = emerge_window_get_early_stop (self, job);
+    if (step > 0)
+      emerge_window_cut_steps (job, step);
+    
+    id = emerge_queue_submit (self->queue, job, &error);
+    emerge_job_unref (job);
+    
+    if (id == 0) {
+      g_warning ("Failed to queue sweep job: %s", error->message);
+      g_error_free (error);
+      adw_toast_overlay_add_toast (self->toast_overlay,
+                                 adw_toast_new ("Failed to queue the rest of the sweep"));
+      self->sweep_total -= emerge_sweep_get_n_jobs (self->sweep) -
+                           emerge_sweep_get_position (self->sweep) + 1;
+      g_clear_pointer (&self->sweep, emerge_sweep_free);
+      break;
+    }
+    
+    g_hash_table_add (self->sweep_ids, g_memdup2 (&id, sizeof id));
+  }
+  self->sweep_feeding = FALSE;
+  
+  if (self->sweep == NULL && g_hash_table_size (self->sweep_ids) == 0)
+    emerge_window_clear_sweep (self);
+}
+
+/* Gives up on the part of the sweep that isn't queued yet */
+static void
+emerge_window_stop_sweep (EmergeWindow *self)
+{
+  guint64 n_dropped;
+  
+  if (self->sweep == NULL)
+    return;
+  
+  n_dropped = emerge_sweep_get_n_jobs (self->sweep) - emerge_sweep_get_position (self->sweep);
+  g_print ("Sweep stopped, %" G_GUINT64_FORMAT " images not queued\n", n_dropped);
+  self->sweep_total -= n_dropped;
+  g_clear_pointer (&self->sweep, emerge_sweep_free);
+  
+  if (g_hash_table_size (self->sweep_ids) == 0)
+    emerge_window_clear_sweep (self);
+}
+
+static void
+sweep_template_response (GObject      *source_object,
+                         GAsyncResult *result,
+                         gpointer      user_data)
+{
+  EmergeWindow *self = EMERGE_WINDOW (user_data);
+  GFile *file;
+  GError *error = NULL;
+  JsonParser *parser;
+  JsonNode *root;
+  EmergeSweep *sweep;
+  gchar *path, *text;
+  
+  file = gtk_file_dialog_open_finish (GTK_FILE_DIALOG (source_object), result, &error);
+  if (file == NULL) {
+    if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+      g_warning ("Failed to open template: %s", error->message);
+    g_error_free (error);
+    return;
+  }
+  
+  path = g_file_get_path (file);
+  g_object_unref (file);
+  parser = json_parser_new ();
+  if (!json_parser_load_from_file (parser, path, &error) ||
+      (root = json_parser_get_root (parser)) == NULL || !JSON_NODE_HOLDS_OBJECT (root)) {
+    g_warning ("Failed to read template %s: %s", path,
+               error != NULL ? error->message : "root is not an object");
+    g_clear_error (&error);
+    adw_toast_overlay_add_toast (self->toast_overlay,
+                               adw_toast_new ("Failed to read the template"));
+    g_object_unref (parser);
+    g_free (path);
+    return;
+  }
+  g_free (path);
+  
+  sweep = emerge_sweep_new (json_node_get_object (root), &error);
+  g_object_unref (parser);
+  if (sweep == NULL) {
+    adw_toast_overlay_add_toast (self->toast_overlay, adw_toast_new (error->message));
+    g_error_free (error);
+    return;
+  }
+  
+  if (self->model_path == NULL) {
+    JsonObject *values = emerge_sweep_get_values (sweep, 0);
+    gboolean has_model = json_object_has_member (values, "model_path");
+    
+    json_object_unref (values);
+    if (!has_model) {
+      adw_toast_overlay_add_toast (self->toast_overlay,
+                                 adw_toast_new ("Please select a model file"));
+      emerge_sweep_free (sweep);
+      return;
+    }
+  }
+  
+  /* One sweep at a time; the jobs an earlier one queued still count */
+  emerge_window_stop_sweep (self);
+  if (self->sweep_ids == NULL) {
+    self->sweep_ids = g_hash_table_new_full (g_int64_hash, g_int64_equal, g_free, NULL);
+    self->sweep_start_time = g_get_monotonic_time ();
+  }
+  
+  self->sweep = sweep;
+  self->sweep_total += emerge_sweep_get_n_jobs (sweep);
+  self->sweep_rest_position = G_MAXUINT64;
+  g_clear_pointer (&self->sweep_base, emerge_job_unref);
+  self->sweep_base = emerge_window_build_job (self);
+  g_clear_pointer (&self->sweep_base->output_path, g_free);
+  
+  text = g_strdup_printf ("Sweeping %" G_GUINT64_FORMAT " images", emerge_sweep_get_n_jobs (sweep));
+  g_print ("%s\n", text);
+  adw_toast_overlay_add_toast (self->toast_overlay, adw_toast_new (text));
+  g_free (text);
+  
+  self->queue_held = FALSE;
+  emerge_window_update_sweep (self);
+  emerge_window_run_queue (self);
+}
+
+static void
+on_queue_sweep (EmergeWindow *self)
+{
+  GtkFileDialog *dialog = gtk_file_dialog_new ();
+  GtkFileFilter *filter = gtk_file_filter_new ();
+  GListStore *filters = g_list_store_new (GTK_TYPE_FILE_FILTER);
+  
+  gtk_file_dialog_set_title (dialog, "Queue Sweep");
+  if (self->last_template_dir) {
+    GFile *folder = g_file_new_for_path (self->last_template_dir);
+    
+    gtk_file_dialog_set_initial_folder (dialog, folder);
+    g_object_unref (folder);
+  }
+  
+  gtk_file_filter_set_name (filter, "JSON Files");
+  gtk_file_filter_add_pattern (filter, "*.json");
+  g_list_store_append (filters, filter);
+  gtk_file_dialog_set_filters (dialog, G_LIST_MODEL (filters));
+  
+  gtk_file_dialog_open (dialog, GTK_WINDOW (self), NULL, sweep_template_response, self);
+  
+  g_object_unref (filters);
+  g_object_unref (filter);
+  g_object_unref (dialog);
+}
+
+/* Queue the current settings as many times as asked for, each with the
+ * next seed. A random seed is fixed first, so every queued image can be
+ * made again and recognized if a resumed batch comes across it twice. */
+static void
+on_queue_clicked (GtkButton *button G_GNUC_UNUSED,
+                  gpointer   user_data)
+{
+  EmergeWindow *self = EMERGE_WINDOW (user_data);
+  GError *error = NULL;
+  EmergeJob *job;
+  gint64 first_seed;
+  guint count, n_queued = 0;
+  gchar *text;
+  
+  if (self->model_path == NULL) {
+    adw_toast_overlay_add_toast (self->toast_overlay,
+                               adw_toast_new ("Please select a model file"));
+    return;
+  }
+  
+  count = (guint) gtk_spin_button_get_value (self->batch_count_spin);
+  job = emerge_window_apply_early_stop (self, emerge_window_build_job (self));
+  g_clear_pointer (&job->output_path, g_free);
+  
+  first_seed = job->seed >= 0 ? job->seed : g_random_int_range (0, G_MAXINT32);
+  for (guint i = 0; i < count; i++) {
+    job->seed = (first_seed + i) % G_MAXINT32;
+    if (emerge_queue_submit (self->queue, job, &error) == 0)
+      break;
+    n_queued++;
+  }
+  emerge_job_unref (job);
+  
+  if (error != NULL) {
+    g_warning ("Failed to queue job: %s", error->message);
+    g_error_free (error);
+    adw_toast_overlay_add_toast (self->toast_overlay,
+                               adw_toast_new ("Failed to queue all images"));
+  }
+  
+  text = g_strdup_printf ("Queued %u image(s)", n_queued);
+  adw_toast_overlay_add_toast (self->toast_overlay, adw_toast_new (text));
+  g_free (text);
+  
+  self->queue_held = FALSE;
+  emerge_window_run_queue (self);
+}
+
+static void
+queue_changed_cb (EmergeQueue *queue,
+                  gpointer     user_data)
+{
+  EmergeWindow *self = EMERGE_WINDOW (user_data);
+  guint64 n_pending = emerge_queue_get_n_pending (queue);
+  gchar *label;
+  
+  /* Jobs can come from elsewhere, such as a hot folder; start them when
+   * nothing else is running */
+  if (n_pending > 0 && !self->is_generating && !self->queue_held &&
+      self->queue_idle_id == 0)
+    self->queue_idle_id = g_idle_add (queue_idle_cb, self);
+  
+  /* The label counts what a sweep has yet to queue as well */
+  emerge_window_update_sweep (self);
+  n_pending = emerge_queue_get_n_pending (queue);
+  if (self->sweep != NULL)
+    n_pending += emerge_sweep_get_n_jobs (self->sweep) - emerge_sweep_get_position (self->sweep);
+  
+  emerge_window_update_queue_eta (self);
+  
+  if (n_pending == 0) {
+    adw_button_content_set_label (self->queue_button_content, "Queue");
+    return;
+  }
+  
+  label = g_strdup_printf ("Queue (%" G_GUINT64_FORMAT ")", n_pending);
+  adw_button_content_set_label (self->queue_button_content, label);
+  g_free (label);
+}
+
+/**
+ * emerge_window_enqueue_json:
+ * @self: a window
+ * @template_json: parameters in the format of a saved template
+ * @error: return location for an error
+ *
+ * Queues one image, made with the window's current settings overridden by
+ * whatever @template_json sets. This is how other programs hand work to
+ * a running emerge.
+ *
+ * Returns: the id of the queued job, or 0 on error, which is
+ *   %G_DBUS_ERROR_INVALID_ARGS if the template is unusable
+ */
+guint64
+emerge_window_enqueue_json (EmergeWindow  *self,
+                            const char    *template_json,
+                            GError       **error)
+{
+  JsonParser *parser;
+  JsonNode *root;
+  EmergeJob *job;
+  GError *local_error = NULL;
+  guint64 id;
+  
+  g_return_val_if_fail (EMERGE_IS_WINDOW (self), 0);
+  g_return_val_if_fail (template_json != NULL, 0);
+  
+  /* Whatever is wrong with the template is the caller's to fix */
+  parser = json_parser_new ();
+  if (!json_parser_load_from_data (parser, template_json, -1, &local_error)) {
+    g_set_error_literal (error, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS, local_error->message);
+    g_error_free (local_error);
+    g_object_unref (parser);
+    return 0;
+  }
+  
+  root = json_parser_get_root (parser);
+  if (root == NULL || !JSON_NODE_HOLDS_OBJECT (root)) {
+    g_set_error_literal (error, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS,
+                         "The template is not a JSON object");
+    g_object_unref (parser);
+    return 0;
+  }
+  
+  if (!emerge_job_validate_json (json_node_get_object (root), &local_error)) {
+    g_set_error_literal (error, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS, local_error->message);
+    g_error_free (local_error);
+    g_object_unref (parser);
+    return 0;
+  }
+  
+  job = emerge_window_build_job (self);
+  emerge_job_apply_json (job, json_node_get_object (root));
+  g_object_unref (parser);
+  
+  if (job->model_path == NULL) {
+    g_set_error_literal (error, G_DBUS_ERROR, G_DBUS_ERROR_INVALID_ARGS,
+                         "The template has no model_path and no model is selected");
+    emerge_job_unref (job);
+    return 0;
+  }
+  
+  job = emerge_window_apply_early_stop (self, job);
+  g_clear_pointer (&job->output_path, g_free);
+  if (job->seed < 0)
+    job->seed = g_random_int_range (0, G_MAXINT32);
+  
+  id = emerge_queue_submit (self->queue, job, error);
+  emerge_job_unref (job);
+  if (id == 0)
+    return 0;
+  
+  g_print ("Queued job %" G_GUINT64_FORMAT " for another program\n", id);
+  self->queue_held = FALSE;
+  emerge_window_run_queue (self);
+  
+  return id;
+}
+
+/* Drops queued job @id, or stops it if it is the one running. Unlike the
+ * stop button, this leaves the rest of the queue going. Returns %FALSE
+ * if there is no such job. */
+gboolean
+emerge_window_cancel_job (EmergeWindow *self,
+                          guint64       id)
+{
+  g_return_val_if_fail (EMERGE_IS_WINDOW (self), FALSE);
+  
+  if (id != 0 && id == self->queue_job_id) {
+    if (self->generate_process != NULL)
+      emerge_process_cancel (self->generate_process);
+    if (self->upscale != NULL)
+      emerge_upscale_cancel (self->upscale);
+    return TRUE;
+  }
+  
+  return emerge_queue_cancel (self->queue, id);
+}
+
+/* The queue as JSON, see emerge_queue_get_status(), with "eta_seconds"
+ * for each job and for everything left to run, "unqueued" for the jobs a
+ * sweep or watched folder has yet to queue, and a "sweep" object with its
+ * "total", "finished" and "eta_seconds". Jobs nothing like any past run
+ * have null, and are counted in "unpredicted". */
+gchar *
+emerge_window_get_queue_status (EmergeWindow *self)
+{
+  JsonNode *status;
+  JsonObject *object;
+  QueueEstimate estimate;
+  gchar *text;
+  
+  g_return_val_if_fail (EMERGE_IS_WINDOW (self), NULL);
+  
+  status = emerge_queue_get_status (self->queue);
+  
+  /* With what the cost model expects of each job, in the same order,
+   * and of the jobs a sweep or watched folder has yet to queue */
+  object = json_node_get_object (status);
+  emerge_window_estimate_queue (self, &estimate,
+                                json_object_get_array_member (object, "jobs"));
+  if (estimate.n_jobs > 0 && estimate.n_unknown == estimate.n_jobs)
+    json_object_set_null_member (object, "eta_seconds");
+  else
+    json_object_set_double_member (object, "eta_seconds", estimate.seconds);
+  json_object_set_int_member (object, "unpredicted", estimate.n_unknown);
+  json_object_set_int_member (object, "unqueued",
+                              estimate.n_jobs - emerge_queue_get_n_pending (self->queue));
+  
+  if (self->sweep_ids != NULL) {
+    JsonObject *sweep = json_object_new ();
+    
+    json_object_set_int_member (sweep, "total", self->sweep_total);
+    json_object_set_int_member (sweep, "finished", self->sweep_finished);
+    if (estimate.sweep_n_unknown < self->sweep_total - self->sweep_finished)
+      json_object_set_double_member (sweep, "eta_seconds", estimate.sweep_seconds);
+    else
+      json_object_set_null_member (sweep, "eta_seconds");
+    json_object_set_object_member (object, "sweep", sweep);
+  }
+  
+  text = json_to_string (status, FALSE);
+  json_node_unref (status);
+  
+  return text;
+}
+
+/* Redo the draft on display at full size, keeping its composition */
+static void
+on_refine_image (EmergeWindow *self)
+{
+  EmergeJob *draft;
+  EmergeJob *refine;
+  GError *error = NULL;
+  gchar *init_path;
+  
+  if (self->is_generating || self->viewed_item == NULL)
+    return;
+  
+  draft = emerge_history_item_get_job (self->viewed_item);
+  if (!draft->draft)
+    return;
+  
+  init_path = emerge_window_new_temp_path (self, "emerge-refine");
+  if (init_path == NULL)
+    return;
+  
+  if (!emerge_job_prepare_refine_input (draft, emerge_history_item_get_image_path (self->viewed_item),
+                                        init_path, &error)) {
+    g_warning ("Failed to prepare draft for refining: %s", error->message);
+    adw_toast_overlay_add_toast (self->toast_overlay,
+                               adw_toast_new ("Could not read the draft"));
+    g_error_free (error);
+    g_free (init_path);
+    return;
+  }
+  
+  refine = emerge_job_new_refine (draft, init_path,
+                                  gtk_spin_button_get_value (self->strength_spin));
+  g_free (init_path);
+  
+  /* Upscaling follows the current settings rather than the draft's */
+  if (adw_switch_row_get_active (self->upscale_toggle) && self->upscale_model_path != NULL) {
+    refine->upscale_model_path = g_strdup (self->upscale_model_path);
+    refine->upscale_tile_size = (int) gtk_spin_button_get_value (self->upscale_tile_spin);
+  }
+  
+  emerge_window_run_job (self, refine);
+}
+
+static void
+on_stop_clicked (GtkButton *button G_GNUC_UNUSED,
+                 gpointer   user_data)
+{
+  EmergeWindow *self = EMERGE_WINDOW (user_data);
+  
+  /* Only the generation is stopped; a running conversion is left alone */
+  self->stop_requested = self->is_generating;
+  emerge_window_stop_sweep (self);
+  if (self->generate_process != NULL)
+    emerge_process_cancel (self->generate_process);
+  if (self->upscale != NULL)
+    emerge_upscale_cancel (self->upscale);
+}
+
+/* Stop sd where it is, keeping the loaded model and the half-sampled
+ * image, or let it carry on from there */
+static void
+on_pause_clicked (GtkButton *button G_GNUC_UNUSED,
+                  gpointer   user_data)
+{
+  EmergeWindow *self = EMERGE_WINDOW (user_data);
+  gint step, total_steps;
+  
+  if (self->generate_process == NULL)
+    return;
+  
+  if (emerge_process_is_paused (self->generate_process)) {
+    emerge_process_resume (self->generate_process);
+    gtk_button_set_icon_name (self->pause_button, "media-playback-pause-symbolic");
+    gtk_widget_set_tooltip_text (GTK_WIDGET (self->pause_button), "Pause");
+    gtk_spinner_start (self->spinner);
+    gtk_label_set_text (self->status_label, "Generating...");
+    return;
+  }
+  
+  emerge_process_pause (self->generate_process);
+  if (!emerge_process_is_paused (self->generate_process))
+    return;
+  
+  gtk_button_set_icon_name (self->pause_button, "media-playback-start-symbolic");
+  gtk_widget_set_tooltip_text (GTK_WIDGET (self->pause_button), "Resume");
+  gtk_spinner_stop (self->spinner);
+  
+  if (emerge_process_get_progress (self->generate_process, &step, &total_steps)) {
+    gchar *text = g_strdup_printf ("Paused at step %d/%d", step, total_steps);
+    gtk_label_set_text (self->status_label, text);
+    g_free (text);
+  } else {
+    gtk_label_set_text (self->status_label, "Paused");
+  }
+}
+
+static void
+on_img2img_toggled (AdwSwitchRow *button,
+                    gpointer         user_data)
+{
+  EmergeWindow *self = EMERGE_WINDOW (user_data);
+  gboolean active = adw_switch_row_get_active (button);
+  
+  gtk_widget_set_visible (GTK_WIDGET (self->initial_image_chooser), active);
+  gtk_widget_set_visible (GTK_WIDGET (self->strength_spin), active);
+  gtk_widget_set_sensitive (GTK_WIDGET (self->strength_spin), active);
+}
+
+static void
+on_preview_toggled (AdwSwitchRow *button,
+                    gpointer      user_data)
+{
+  EmergeWindow *self = EMERGE_WINDOW (user_data);
+  
+  gtk_widget_set_visible (self->preview_interval_row, adw_switch_row_get_active (button));
+  gtk_widget_set_visible (GTK_WIDGET (self->early_stop_toggle), adw_switch_row_get_active (button));
+}
+
+static void
+on_upscale_toggled (AdwSwitchRow *button,
+                    gpointer      user_data)
+{
+  EmergeWindow *self = EMERGE_WINDOW (user_data);
+  gboolean active = adw_switch_row_get_active (button);
+  
+  gtk_widget_set_visible (GTK_WIDGET (self->upscale_model_chooser), active);
+  gtk_widget_set_visible (self->upscale_tile_row, active);
+}
+
+static void
+emerge_window_set_upscale_model (EmergeWindow *self,
+                                 const char   *path)
+{
+  g_free (self->upscale_model_path);
+  self->upscale_model_path = g_strdup (path);
+  
+  if (path != NULL) {
+    gchar *basename = g_path_get_basename (path);
+    gchar *button_text = g_strdup_printf ("Upscaler: %s", basename);
+    
+    gtk_button_set_label (self->upscale_model_chooser, button_text);
+    g_free (button_text);
+    g_free (basename);
+  } else {
+    gtk_button_set_label (self->upscale_model_chooser, "Select Upscale Model");
+  }
+}
+
+static void
+upscale_model_open_response (GObject      *source_object,
+                             GAsyncResult *result,
+                             gpointer      user_data)
+{
+  EmergeWindow *self = EMERGE_WINDOW (user_data);
+  GError *error = NULL;
+  GFile *file;
+  
+  file = gtk_file_dialog_open_finish (GTK_FILE_DIALOG (source_object), result, &error);
+  if (file == NULL) {
+    if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+      g_warning ("Failed to open file: %s", error->message);
+    g_error_free (error);
+    return;
+  }
+  
+  gchar *path = g_file_get_path (file);
+  emerge_window_set_upscale_model (self, path);
+  g_free (path);
+  g_object_unref (file);
+}
+
+static void
+on_upscale_model_select (GtkButton *button G_GNUC_UNUSED,
+                         gpointer   user_data)
+{
+  EmergeWindow *self = EMERGE_WINDOW (user_data);
+  GtkFileDialog *dialog;
+  GtkFileFilter *filter;
+  GListStore *filters;
+  
+  dialog = gtk_file_dialog_new ();
+  gtk_file_dialog_set_title (dialog, "Select Upscale Model");
+  
+  /* ESRGAN weights, as sd's --upscale-model takes them */
+  filter = gtk_file_filter_new ();
+  gtk_file_filter_set_name (filter, "Upscale Models");
+  gtk_file_filter_add_pattern (filter, "*.pth");
+  gtk_file_filter_add_pattern (filter, "*.safetensors");
+  gtk_file_filter_add_pattern (filter, "*.gguf");
+  
+  filters = g_list_store_new (GTK_TYPE_FILE_FILTER);
+  g_list_store_append (filters, filter);
+  gtk_file_dialog_set_filters (dialog, G_LIST_MODEL (filters));
+  
+  gtk_file_dialog_open (dialog, GTK_WINDOW (self), NULL,
+                        upscale_model_open_response, self);
+  
+  g_object_unref (dialog);
+  g_object_unref (filter);
+  g_object_unref (filters);
+}
+
+static void
+on_advanced_settings_toggled (GtkToggleButton *button,
+                             gpointer         user_data)
+{
+  EmergeWindow *self = EMERGE_WINDOW (user_data);
+  gboolean active = gtk_toggle_button_get_active (button);
+  
+  gtk_widget_set_visible (GTK_WIDGET (self->advanced_settings_box), active);
+}
+
+static void
+convert_process_progress_cb (EmergeProcess *process G_GNUC_UNUSED,
+                             gint           step,
+                             gint           total_steps,
+                             gdouble        seconds_per_step G_GNUC_UNUSED,
+                             gpointer       user_data)
+{
+  EmergeWindow *self = EMERGE_WINDOW (user_data);
+  
+  if (total_steps > 0)
+    gtk_progress_bar_set_fraction (self->conversion_progress, (double) step / total_steps);
+}
+
+static void
+convert_process_output_cb (EmergeProcess *process,
+                           const char    *line G_GNUC_UNUSED,
+                           gpointer       user_data)
+{
+  EmergeWindow *self = EMERGE_WINDOW (user_data);
+  
+  /* Keep the bar moving while sd prints log lines without a progress bar */
+  if (!emerge_process_get_progress (process, NULL, NULL))
+    gtk_progress_bar_pulse (self->conversion_progress);
+}
+
+static void
+convert_process_exited_cb (EmergeProcess *process,
+                           gint           status,
+                           gpointer       user_data)
+{
+  EmergeWindow *self = EMERGE_WINDOW (user_data);
+  
+  /* Re-enable UI */
+  gtk_widget_set_sensitive (GTK_WIDGET (self->convert_model_button), TRUE);
+  gtk_widget_set_visible (GTK_WIDGET (self->conversion_row), FALSE);
+  
+  if (emerge_process_was_cancelled (process)) {
+    adw_toast_overlay_add_toast (self->toast_overlay,
+                               adw_toast_new ("Conversion cancelled"));
+  } else if (status == 0) {
+    adw_toast_overlay_add_toast (self->toast_overlay,
+                               adw_toast_new ("Model converted successfully"));
+    
+    // Refresh the model dropdown in case a new GGUF file was added
+    populate_model_dropdown (self);
+  } else {
+    adw_toast_overlay_add_toast (self->toast_overlay,
+                               adw_toast_new ("Model conversion failed"));
+  }
+  
+  g_signal_handlers_disconnect_by_data (process, self);
+  g_clear_object (&self->convert_process);
+}
+
+static void
+on_conversion_cancel_clicked (GtkButton *button G_GNUC_UNUSED,
+                              gpointer   user_data)
+{
+  EmergeWindow *self = EMERGE_WINDOW (user_data);
+  
+  if (self->convert_process != NULL)
+    emerge_process_cancel (self->convert_process);
+  
+  if (self->batch_convert != NULL)
+    emerge_batch_convert_cancel (self->batch_convert);
+  
+  if (self->quant_bench != NULL)
+    emerge_quant_bench_cancel (self->quant_bench);
+  
+  if (self->benchmark != NULL)
+    emerge_benchmark_cancel (self->benchmark);
+}
+
+void
+load_template_from_file (EmergeWindow *self, const char *filepath)
+{
+  JsonParser *parser = json_parser_new ();
+  GError *error = NULL;
+  
+  // Parse the file
+  if (!json_parser_load_from_file (parser, filepath, &error)) {
+    g_warning ("Error loading template: %s", error->message);
+    adw_toast_overlay_add_toast (self->toast_overlay,
+                             adw_toast_new (g_strdup_printf ("Error loading template: %s", error->message)));
+    g_error_free (error);
+    g_object_unref (parser);
+    return;
+  }
+  
+  // Get the root object
+  JsonNode *root = json_parser_get_root (parser);
+  if (json_node_get_node_type (root) != JSON_NODE_OBJECT) {
+    g_warning ("Invalid template format: root is not an object");
+    adw_toast_overlay_add_toast (self->toast_overlay,
+                             adw_toast_new ("Invalid template format"));
+    g_object_unref (parser);
+    return;
+  }
+  
+  /* A sweep shows its first combination; Queue Sweep runs them all */
+  EmergeSweep *sweep = emerge_sweep_new (json_node_get_object (root), &error);
+  if (sweep == NULL) {
+    g_warning ("Invalid template: %s", error->message);
+    adw_toast_overlay_add_toast (self->toast_overlay, adw_toast_new (error->message));
+    g_error_free (error);
+    g_object_unref (parser);
+    return;
+  }
+  guint64 n_combinations = emerge_sweep_get_n_jobs (sweep);
+  JsonObject *object = emerge_sweep_get_values (sweep, 0);
+  emerge_sweep_free (sweep);
+  
+  // Load prompts
+  if (json_object_has_member (object, "positive_prompt")) {
+    const char *positive_prompt = json_object_get_string_member (object, "positive_prompt");
+    gtk_editable_set_text (GTK_EDITABLE (self->prompt_entry), positive_prompt);
+  }
+  
+  if (json_object_has_member (object, "negative_prompt")) {
+    const char *negative_prompt = json_object_get_string_member (object, "negative_prompt");
+    gtk_editable_set_text (GTK_EDITABLE (self->negative_prompt_entry), negative_prompt);
+  }
+  
+  // Load image size
+  if (json_object_has_member (object, "width")) {
+    int width = json_object_get_int_member (object, "width");
+    gtk_spin_button_set_value (self->width_spin, width);
+  }
+  
+  if (json_object_has_member (object, "height")) {
+    int height = json_object_get_int_member (object, "height");
+    gtk_spin_button_set_value (self->height_spin, height);
+  }
+  
+  // Load advanced settings
+  if (json_object_has_member (object, "steps")) {
+    int steps = json_object_get_int_member (object, "steps");
+    gtk_spin_button_set_value (self->steps_spin, steps);
+  }
+  
+  if (json_object_has_member (object, "seed")) {
+    long seed = json_object_get_int_member (object, "seed");
+    gtk_spin_button_set_value (self->seed_spin, seed);
+  }
+  
+  if (json_object_has_member (object, "cfg_scale")) {
+    double cfg_scale = json_object_get_double_member (object, "cfg_scale");
+    gtk_spin_button_set_value (self->cfg_scale_spin, cfg_scale);
+  }
+  
+  if (json_object_has_member (object, "sampling_method")) {
+    const char *sampling_method = json_object_get_string_member (object, "sampling_method");
+    // Find the index of the sampling method in the dropdown
+    GtkStringList *sampling_methods = GTK_STRING_LIST (gtk_drop_down_get_model (self->sampling_method_dropdown));
+    guint n_items = g_list_model_get_n_items (G_LIST_MODEL (sampling_methods));
+    
+    for (guint i = 0; i < n_items; i++) {
+      GtkStringObject *item = GTK_STRING_OBJECT (g_list_model_get_item (G_LIST_MODEL (sampling_methods), i));
+      if (g_strcmp0 (gtk_string_object_get_string (item), sampling_method) == 0) {
+        gtk_drop_down_set_selected (self->sampling_method_dropdown, i);
+        g_object_unref (item);
+        break;
+      }
+      g_object_unref (item);
+    }
+  }
+  
+  // Load img2img settings
+  if (json_object_has_member (object, "img2img_enabled")) {
+    gboolean img2img_enabled = json_object_get_boolean_member (object, "img2img_enabled");
+    adw_switch_row_set_active (self->img2img_toggle, img2img_enabled);
+  }
+  
+  if (json_object_has_member (object, "strength")) {
+    double strength = json_object_get_double_member (object, "strength");
+    gtk_spin_button_set_value (self->strength_spin, strength);
+  }
+  
+  // Load upscaling settings; a null model turns it off
+  if (json_object_has_member (object, "upscale_model")) {
+    JsonNode *node = json_object_get_member (object, "upscale_model");
+    const char *upscale_model = JSON_NODE_HOLDS_VALUE (node) ? json_node_get_string (node) : NULL;
+    
+    if (upscale_model != NULL)
+      emerge_window_set_upscale_model (self, upscale_model);
+    adw_switch_row_set_active (self->upscale_toggle, upscale_model != NULL);
+  }
+  
+  if (json_object_has_member (object, "upscale_tile_size")) {
+    int tile_size = json_object_get_int_member (object, "upscale_tile_size");
+    gtk_spin_button_set_value (self->upscale_tile_spin, tile_size);
+  }
+  
+  // Cleanup
+  json_object_unref (object);
+  g_object_unref (parser);
+  
+  if (n_combinations > 1) {
+    gchar *text = g_strdup_printf ("Loaded the first of %" G_GUINT64_FORMAT " combinations",
+                                   n_combinations);
+    
+    adw_toast_overlay_add_toast (self->toast_overlay, adw_toast_new (text));
+    g_free (text);
+    return;
+  }
+  
+  adw_toast_overlay_add_toast (self->toast_overlay,
+                           adw_toast_new ("Template loaded successfully"));
+}
+
+static void
+save_template_response (GObject *source_object,
+                       GAsyncResult *result,
+                       gpointer user_data)
+{
+  EmergeWindow *self = EMERGE_WINDOW (user_data);
+  GtkFileDialog *dialog = GTK_FILE_DIALOG (source_object);
+  GFile *file;
+  GError *error = NULL;
+  
+  file = gtk_file_dialog_save_finish (dialog, result, &error);
+  if (file == NULL) {
+    if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+      g_warning ("Failed to save template: %s", error->message);
+    g_error_free (error);
+    return;
+  }
+  
+  // Get the path and save the template
+  gchar *path = g_file_get_path (file);
+  save_template_to_file (self, path);
+  
+  // Save the directory for next time
+  g_free (self->last_template_dir);
+  gchar *parent_path = g_path_get_dirname (path);
+  self->last_template_dir = g_strdup (parent_path);
+  g_free (parent_path);
+  
+  g_free (path);
+  g_object_unref (file);
+}
+
+static void
+on_save_template_clicked (EmergeWindow *self)
+{
+  GtkFileDialog *dialog;
+  GtkFileFilter *filter;
+  GListStore *filters;
+  GFile *current_folder = NULL;
+  
+  dialog = gtk_file_dialog_new ();
+  gtk_file_dialog_set_title (dialog, "Save Template");
+  
+  // Set default name
+  gtk_file_dialog_set_initial_name (dialog, "template.json");
+  
+  // Set initial folder if we have saved before
+  if (self->last_template_dir) {
+    current_folder = g_file_new_for_path (self->last_template_dir);
+  } else {
+    // Default to home directory if no previous save location
+    const gchar *home_dir = g_get_home_dir ();
+    current_folder = g_file_new_for_path (home_dir);
+  }
+  
+  if (current_folder) {
+    gtk_file_dialog_set_initial_folder (dialog, current_folder);
+  }
+  
+  filter = gtk_file_filter_new ();
+  gtk_file_filter_set_name (filter, "JSON Files");
+  gtk_file_filter_add_pattern (filter, "*.json");
+  
+  filters = g_list_store_new (GTK_TYPE_FILE_FILTER);
+  g_list_store_append (filters, filter);
+  gtk_file_dialog_set_filters (dialog, G_LIST_MODEL(filters));
+  
+  gtk_file_dialog_save (dialog,
+                       GTK_WINDOW(self),
+                       NULL,  // cancellable
+                       save_template_response,
+                       self);
+  
+  if (current_folder)
+    g_object_unref (current_folder);
+  g_object_unref(dialog);
+  g_object_unref(filter);
+  g_object_unref(filters);
+}
+
+static void
+load_template_response (GObject *source_object,
+                        GAsyncResult *result,
+                        gpointer user_data)
+{
+  EmergeWindow *self = EMERGE_WINDOW (user_data);
+  GtkFileDialog *dialog = GTK_FILE_DIALOG (source_object);
+  GFile *file;
+  GError *error = NULL;
+  
+  file = gtk_file_dialog_open_finish (dialog, result, &error);
+  if (file == NULL) {
+    if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+      g_warning ("Failed to open template: %s", error->message);
+    g_error_free (error);
+    return;
+  }
+  
+  // Get the path and load the template
+  gchar *path = g_file_get_path (file);
+  load_template_from_file (self, path);
+  
+  // Save the directory for next time
+  g_free (self->last_template_dir);
+  gchar *parent_path = g_path_get_dirname (path);
+  self->last_template_dir = g_strdup (parent_path);
+  g_free (parent_path);
+  
+  g_free (path);
+  g_object_unref (file);
+}
+
+static void
+on_load_template_clicked (EmergeWindow *self)
+{
+  GtkFileDialog *dialog;
+  GtkFileFilter *filter;
+  GListStore *filters;
+  GFile *current_folder = NULL;
+  
+  dialog = gtk_file_dialog_new ();
+  gtk_file_dialog_set_title (dialog, "Load Template");
+  
+  // Set initial folder if we have saved before
+  if (self->last_template_dir) {
+    current_folder = g_file_new_for_path (self->last_template_dir);
+  } else {
+    // Default to home directory if no previous save location
+    const gchar *home_dir = g_get_home_dir ();
+    current_folder = g_file_new_for_path (home_dir);
+  }
+  
+  if (current_folder) {
+    gtk_file_dialog_set_initial_folder (dialog, current_folder);
+  }
+  
+  filter = gtk_file_filter_new ();
+  gtk_file_filter_set_name (filter, "JSON Files");
+  gtk_file_filter_add_pattern (filter, "*.json");
+  
+  filters = g_list_store_new (GTK_TYPE_FILE_FILTER);
+  g_list_store_append (filters, filter);
+  gtk_file_dialog_set_filters (dialog, G_LIST_MODEL (filters));
+  
+  gtk_file_dialog_open (dialog,
+                       GTK_WINDOW (self),
+                       NULL,  // cancellable
+                       load_template_response,
+                       self);
+  
+  if (current_folder)
+    g_object_unref (current_folder);
+  g_object_unref (dialog);
+  g_object_unref (filter);
+  g_object_unref (filters);
+}
+
+/* Configuration file management */
+static gchar *
+get_config_dir_path(void)
+{
+  const gchar *home_dir = g_get_home_dir();
+  return g_build_filename(home_dir, ".local", "share", "emerge", NULL);
+}
+
+static gchar *
+get_config_file_path(void)
+{
+  gchar *config_dir = get_config_dir_path();
+  gchar *config_file = g_build_filename(config_dir, "config.json", NULL);
+  g_free(config_dir);
+  return config_file;
+}
+
+/* Serializes the config and leaves writing it to the store, which skips
+ * ahead to the newest version if it is saved again shortly */
+void
+emerge_window_save_config(EmergeWindow *self)
+{
+  JsonBuilder *builder = json_builder_new();
+  gchar *config_file = get_config_file_path();
+  gchar *data;
+  gsize length;
+  
+  // Build JSON object with config
+  json_builder_begin_object(builder);
+  
+  // Save models directory
+  if (self->config.models_directory) {
+    json_builder_set_member_name(builder, "models_directory");
+    json_builder_add_string_value(builder, self->config.models_directory);
+  }
+  
+  // Save last model path
+  if (self->model_path) {
+    json_builder_set_member_name(builder, "last_model_path");
+    json_builder_add_string_value(builder, self->model_path);
+  }
+  
+  // Save last save directory
+  if (self->last_saved_dir) {
+    json_builder_set_member_name(builder, "last_save_directory");
+    json_builder_add_string_value(builder, self->last_saved_dir);
+  }
+  
+  // Save last template directory
+  if (self->last_template_dir) {
+    json_builder_set_member_name(builder, "last_template_directory");
+    json_builder_add_string_value(builder, self->last_template_dir);
+  }
+  
+  json_builder_end_object(builder);
+  
+  // Generate JSON data
+  JsonGenerator *generator = json_generator_new();
+  JsonNode *root = json_builder_get_root(builder);
+  json_generator_set_root(generator, root);
+  json_generator_set_pretty(generator, TRUE);
+  
+  // Queue the write
+  data = json_generator_to_data(generator, &length);
+  GBytes *bytes = g_bytes_new_take(data, length);
+  emerge_store_write(self->store, config_file, bytes);
+  g_bytes_unref(bytes);
+  
+  // Cleanup
+  json_node_free(root);
+  g_object_unref(generator);
+  g_object_unref(builder);
+  g_free(config_file);
+}
+
+void
+emerge_window_load_config(EmergeWindow *self)
+{
+  JsonParser *parser = json_parser_new();
+  GError *error = NULL;
+  gchar *config_file = get_config_file_path();
+  
+  // Clear existing config
+  g_free(self->config.models_directory);
+  g_free(self->config.last_model_path);
+  g_free(self->config.last_save_directory);
+  g_free(self->config.last_template_directory);
+  
+  self->config.models_directory = NULL;
+  self->config.last_model_path = NULL;
+  self->config.last_save_directory = NULL;
+  self->config.last_template_directory = NULL;
+  
+  // Check if config file exists
+  if (!g_file_test(config_file, G_FILE_TEST_EXISTS)) {
+    g_free(config_file);
+    return;
+  }
+  
+  // Parse the file
+  if (!json_parser_load_from_file(parser, config_file, &error)) {
+    g_warning("Error loading config: %s", error->message);
+    adw_toast_overlay_add_toast (self->toast_overlay,
+                             adw_toast_new (g_strdup_printf ("Error loading config: %s", error->message)));
+    g_error_free (error);
+    g_object_unref(parser);
+    g_free(config_file);
+    return;
+  }
+  
+  // Get the root object
+  JsonNode *root = json_parser_get_root(parser);
+  if (json_node_get_node_type(root) != JSON_NODE_OBJECT) {
+    g_warning("Invalid config format: root is not an object");
+    adw_toast_overlay_add_toast (self->toast_overlay,
+                             adw_toast_new ("Invalid config format"));
+    g_object_unref (parser);
+    g_free(config_file);
+    return;
+  }
+  
+  JsonObject *object = json_node_get_object(root);
+  
+  // Load models directory
+  if (json_object_has_member(object, "models_directory")) {
+    self->config.models_directory = g_strdup(json_object_get_string_member(object, "models_directory"));
+  }
+  
+  // Load last model path
+  if (json_object_has_member(object, "last_model_path")) {
+    self->config.last_model_path = g_strdup(json_object_get_string_member(object, "last_model_path"));
+  }
+  
+  // Load last save directory
+  if (json_object_has_member(object, "last_save_directory")) {
+    self->config.last_save_directory = g_strdup(json_object_get_string_member(object, "last_save_directory"));
+    self->last_saved_dir = g_strdup(self->config.last_save_directory);
+  }
+  
+  // Load last template directory
+  if (json_object_has_member(object, "last_template_directory")) {
+    self->config.last_template_directory = g_strdup(json_object_get_string_member(object, "last_template_directory"));
+    self->last_template_dir = g_strdup(self->config.last_template_directory);
+  }
+  
+  // Cleanup
+  g_object_unref (parser);
+  
+  adw_toast_overlay_add_toast (self->toast_overlay,
+                           adw_toast_new ("Template loaded successfully"));
 }
 
+/* Hot folder: every image dropped into a folder is repainted with a saved
+ * template, and the results are written to a folder next to it */
 static void
-on_advanced_settings_toggled (GtkToggleButton *button,
-                             gpointer         user_data)
+emerge_window_set_watching (EmergeWindow *self,
+                            gboolean      watching)
+{
+  GAction *stop = g_action_map_lookup_action (G_ACTION_MAP (self), "stop-watching");
+  
+  g_simple_action_set_enabled (G_SIMPLE_ACTION (stop), watching);
+}
+
+static void
+on_stop_watching (EmergeWindow *self)
+{
+  gchar *text;
+  
+  if (self->hot_folder == NULL)
+    return;
+  
+  emerge_hot_folder_stop (self->hot_folder);
+  text = g_strdup_printf ("Stopped watching; %u images queued, %u skipped",
+                          emerge_hot_folder_get_n_submitted (self->hot_folder),
+                          emerge_hot_folder_get_n_skipped (self->hot_folder));
+  g_print ("%s\n", text);
+  adw_toast_overlay_add_toast (self->toast_overlay, adw_toast_new (text));
+  g_free (text);
+  
+  g_clear_object (&self->hot_folder);
+  emerge_window_set_watching (self, FALSE);
+}
+
+static void
+watch_template_response (GObject      *source_object,
+                         GAsyncResult *result,
+                         gpointer      user_data)
 {
   EmergeWindow *self = EMERGE_WINDOW (user_data);
-  gboolean active = gtk_toggle_button_get_active (button);
+  GFile *file, *output_dir;
+  GError *error = NULL;
+  JsonParser *parser;
+  JsonNode *root;
+  EmergeJob *job;
+  gchar *path, *input_path, *output_path, *text;
   
-  gtk_widget_set_visible (GTK_WIDGET (self->advanced_settings_box), active);
+  file = gtk_file_dialog_open_finish (GTK_FILE_DIALOG (source_object), result, &error);
+  if (file == NULL) {
+    if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+      g_warning ("Failed to open template: %s", error->message);
+    g_error_free (error);
+    g_clear_object (&self->hot_folder_input);
+    return;
+  }
+  
+  path = g_file_get_path (file);
+  g_object_unref (file);
+  parser = json_parser_new ();
+  if (!json_parser_load_from_file (parser, path, &error) ||
+      (root = json_parser_get_root (parser)) == NULL || !JSON_NODE_HOLDS_OBJECT (root)) {
+    g_warning ("Failed to read template %s: %s", path, error ? error->message : "not an object");
+    g_clear_error (&error);
+    adw_toast_overlay_add_toast (self->toast_overlay,
+                               adw_toast_new ("Failed to read the template"));
+    g_object_unref (parser);
+    g_free (path);
+    g_clear_object (&self->hot_folder_input);
+    return;
+  }
+  g_free (path);
+  
+  job = emerge_window_build_job (self);
+  emerge_job_apply_json (job, json_node_get_object (root));
+  g_clear_pointer (&job->output_path, g_free);
+  g_object_unref (parser);
+  
+  if (job->model_path == NULL) {
+    adw_toast_overlay_add_toast (self->toast_overlay,
+                               adw_toast_new ("Please select a model file"));
+    emerge_job_unref (job);
+    g_clear_object (&self->hot_folder_input);
+    return;
+  }
+  
+  on_stop_watching (self);
+  
+  /* Next to the input folder, so results are never mistaken for inputs */
+  input_path = g_file_get_path (self->hot_folder_input);
+  output_path = g_strconcat (input_path, "-output", NULL);
+  output_dir = g_file_new_for_path (output_path);
+  
+  self->hot_folder = emerge_hot_folder_new (self->hot_folder_input, output_dir,
+                                            self->queue, job);
+  emerge_job_unref (job);
+  g_clear_object (&self->hot_folder_input);
+  g_object_unref (output_dir);
+  
+  if (!emerge_hot_folder_start (self->hot_folder, &error)) {
+    g_warning ("Failed to watch %s: %s", input_path, error->message);
+    g_error_free (error);
+    adw_toast_overlay_add_toast (self->toast_overlay,
+                               adw_toast_new ("Failed to watch the folder"));
+    g_clear_object (&self->hot_folder);
+  } else {
+    text = g_strdup_printf ("Watching %s", input_path);
+    g_print ("%s, results go to %s\n", text, output_path);
+    adw_toast_overlay_add_toast (self->toast_overlay, adw_toast_new (text));
+    g_free (text);
+    emerge_window_set_watching (self, TRUE);
+    self->queue_held = FALSE;
+  }
+  
+  g_free (output_path);
+  g_free (input_path);
+}
+
+static void
+watch_folder_response (GObject      *source_object,
+                       GAsyncResult *result,
+                       gpointer      user_data)
+{
+  EmergeWindow *self = EMERGE_WINDOW (user_data);
+  GtkFileDialog *dialog;
+  GtkFileFilter *filter;
+  GListStore *filters;
+  GError *error = NULL;
+  
+  g_clear_object (&self->hot_folder_input);
+  self->hot_folder_input = gtk_file_dialog_select_folder_finish (GTK_FILE_DIALOG (source_object),
+                                                                 result, &error);
+  if (self->hot_folder_input == NULL) {
+    if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+      g_warning ("Failed to select folder: %s", error->message);
+    g_error_free (error);
+    return;
+  }
+  
+  /* Then what to do with the images that arrive there */
+  dialog = gtk_file_dialog_new ();
+  gtk_file_dialog_set_title (dialog, "Template for the Watched Folder");
+  if (self->last_template_dir) {
+    GFile *folder = g_file_new_for_path (self->last_template_dir);
+    
+    gtk_file_dialog_set_initial_folder (dialog, folder);
+    g_object_unref (folder);
+  }
+  
+  filter = gtk_file_filter_new ();
+  gtk_file_filter_set_name (filter, "JSON Files");
+  gtk_file_filter_add_pattern (filter, "*.json");
+  filters = g_list_store_new (GTK_TYPE_FILE_FILTER);
+  g_list_store_append (filters, filter);
+  gtk_file_dialog_set_filters (dialog, G_LIST_MODEL (filters));
+  
+  gtk_file_dialog_open (dialog, GTK_WINDOW (self), NULL, watch_template_response, self);
+  
+  g_object_unref (filters);
+  g_object_unref (filter);
+  g_object_unref (dialog);
+}
+
+static void
+on_watch_folder (EmergeWindow *self)
+{
+  GtkFileDialog *dialog = gtk_file_dialog_new ();
+  
+  gtk_file_dialog_set_title (dialog, "Folder to Watch");
+  gtk_file_dialog_select_folder (dialog, GTK_WINDOW (self), NULL, watch_folder_response, self);
+  g_object_unref (dialog);
+}
+
+/* Model directory and dropdown management */
+static void
+on_model_dir_selected (GObject *source_object,
+                      GAsyncResult *result,
+                      gpointer user_data)
+{
+  EmergeWindow *self = EMERGE_WINDOW (user_data);
+  GtkFileDialog *dialog = GTK_FILE_DIALOG (source_object);
+  GFile *file;
+  GError *error = NULL;
+  
+  file = gtk_file_dialog_select_folder_finish (dialog, result, &error);
+  if (file == NULL) {
+    if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+      g_warning ("Failed to select model directory: %s", error->message);
+    g_error_free (error);
+    return;
+  }
+  
+  // Store models directory
+  if (self->models_directory) {
+    g_object_unref (self->models_directory);
+  }
+  self->models_directory = file;  // Transfer ownership
+  
+  // Update config
+  g_free (self->config.models_directory);
+  self->config.models_directory = g_file_get_path (file);
+  
+  // Update button text
+  char *path = g_file_get_path (file);
+  char *button_text = g_strdup_printf ("Models folder: %s", path);
+  gtk_button_set_label (self->model_dir_button, button_text);
+  g_free (button_text);
+  g_free (path);
+  
+  // Save config for persistence
+  emerge_window_save_config (self);
+  
+  // Populate model dropdown
+  populate_model_dropdown (self);
 }
 
 static void
-convert_process_finished_cb (GPid pid, gint status, gpointer user_data)
+on_model_dir_button_clicked (GtkButton *button G_GNUC_UNUSED,
+                            gpointer   user_data)
 {
   EmergeWindow *self = EMERGE_WINDOW (user_data);
+  GtkFileDialog *dialog;
   
-  /* Re-enable UI */
-  gtk_widget_set_sensitive (GTK_WIDGET (self->convert_model_button), TRUE);
-  gtk_widget_set_sensitive (GTK_WIDGET (self->model_chooser), TRUE);
-  gtk_widget_set_sensitive (GTK_WIDGET (self->model_dropdown), TRUE);
-  gtk_widget_set_sensitive (GTK_WIDGET (self->model_dir_button), TRUE);
-  gtk_spinner_stop (self->spinner);
-  gtk_widget_set_visible (GTK_WIDGET (self->spinner), FALSE);
+  dialog = gtk_file_dialog_new ();
+  gtk_file_dialog_set_title (dialog, "Select Models Directory");
   
-  if (g_cancellable_is_cancelled (self->cancellable)) {
-    gtk_label_set_text (self->status_label, "Cancelled");
-    adw_toast_overlay_add_toast (self->toast_overlay,
-                               adw_toast_new ("Conversion cancelled"));
-  } else if (status == 0) {
-    gtk_label_set_text (self->status_label, "Done");
-    adw_toast_overlay_add_toast (self->toast_overlay,
-                               adw_toast_new ("Model converted successfully"));
-    
-    // Refresh the model dropdown in case a new GGUF file was added
-    populate_model_dropdown (self);
-  } else {
-    gtk_label_set_text (self->status_label, "Failed");
-    adw_toast_overlay_add_toast (self->toast_overlay,
-                               adw_toast_new ("Model conversion failed"));
+  // Set initial folder if we have one configured
+  if (self->models_directory) {
+    gtk_file_dialog_set_initial_folder (dialog, self->models_directory);
   }
   
-  g_spawn_close_pid (pid);
-  g_object_unref (self->cancellable);
-  self->cancellable = NULL;
-  self->child_pid = 0;
-  self->child_watch_id = 0;
+  gtk_file_dialog_select_folder (dialog,
+                                GTK_WINDOW (self),
+                                NULL,  /* cancellable */
+                                on_model_dir_selected,
+                                self);
+  
+  g_object_unref (dialog);
 }
 
-void
-load_template_from_file (EmergeWindow *self, const char *filepath)
+static gboolean
+is_model_file (const char *filename)
+{
+  return (g_str_has_suffix (filename, ".ckpt") ||
+         g_str_has_suffix (filename, ".safetensors") ||
+         g_str_has_suffix (filename, ".gguf"));
+}
+
+static void
+populate_model_dropdown (EmergeWindow *self)
 {
-  JsonParser *parser = json_parser_new ();
   GError *error = NULL;
+  GFileEnumerator *enumerator;
+  GFileInfo *info;
   
-  // Parse the file
-  if (!json_parser_load_from_file (parser, filepath, &error)) {
-    g_warning ("Error loading template: %s", error->message);
-    adw_toast_overlay_add_toast (self->toast_overlay,
-                             adw_toast_new (g_strdup_printf ("Error loading template: %s", error->message)));
-    g_error_free (error);
-    g_object_unref (parser);
-    return;
+  // Clear the existing model list
+  if (self->model_list) {
+    g_object_unref (self->model_list);
   }
+  self->model_list = gtk_string_list_new (NULL);
   
-  // Get the root object
-  JsonNode *root = json_parser_get_root (parser);
-  if (json_node_get_node_type (root) != JSON_NODE_OBJECT) {
-    g_warning ("Invalid template format: root is not an object");
-    adw_toast_overlay_add_toast (self->toast_overlay,
-                             adw_toast_new ("Invalid template format"));
-    g_object_unref (parser);
+  // If no models directory is set, return early
+  if (!self->models_directory) {
+    gtk_drop_down_set_model (self->model_dropdown, G_LIST_MODEL (self->model_list));
     return;
   }
   
-  JsonObject *object = json_node_get_object (root);
-  
-  // Load prompts
-  if (json_object_has_member (object, "positive_prompt")) {
-    const char *positive_prompt = json_object_get_string_member (object, "positive_prompt");
-    gtk_editable_set_text (GTK_EDITABLE (self->prompt_entry), positive_prompt);
-  }
-  
-  if (json_object_has_member (object, "negative_prompt")) {
-    const char *negative_prompt = json_object_get_string_member (object, "negative_prompt");
-    gtk_editable_set_text (GTK_EDITABLE (self->negative_prompt_entry), negative_prompt);
-  }
+  // Enumerate files in the directory
+  enumerator = g_file_enumerate_children (self->models_directory,
+                                        G_FILE_ATTRIBUTE_STANDARD_NAME,
+                                        G_FILE_QUERY_INFO_NONE,
+                                        NULL,
+                                        &error);
   
-  // Load image size
-  if (json_object_has_member (object, "width")) {
-    int width = json_object_get_int_member (object, "width");
-    gtk_spin_button_set_value (self->width_spin, width);
+  if (!enumerator) {
+    g_warning ("Failed to enumerate models directory: %s", error->message);
+    g_error_free (error);
+    gtk_drop_down_set_model (self->model_dropdown, G_LIST_MODEL (self->model_list));
+    return;
   }
   
-  if (json_object_has_member (object, "height")) {
-    int height = json_object_get_int_member (object, "height");
-    gtk_spin_button_set_value (self->height_spin, height);
+  // Add model files to the list
+  while ((info = g_file_enumerator_next_file (enumerator, NULL, &error)) != NULL) {
+    const char *filename = g_file_info_get_name (info);
+    
+    if (is_model_file (filename)) {
+      gtk_string_list_append (self->model_list, filename);
+    }
+    
+    g_object_unref (info);
   }
   
-  // Load advanced settings
-  if (json_object_has_member (object, "steps")) {
-    int steps = json_object_get_int_member (object, "steps");
-    gtk_spin_button_set_value (self->steps_spin, steps);
+  if (error) {
+    g_warning ("Error while enumerating models: %s", error->message);
+    g_error_free (error);
   }
   
-  if (json_object_has_member (object, "seed")) {
-    long seed = json_object_get_int_member (object, "seed");
-    gtk_spin_button_set_value (self->seed_spin, seed);
-  }
+  g_object_unref (enumerator);
   
-  if (json_object_has_member (object, "cfg_scale")) {
-    double cfg_scale = json_object_get_double_member (object, "cfg_scale");
-    gtk_spin_button_set_value (self->cfg_scale_spin, cfg_scale);
-  }
+  // Set the dropdown model
+  gtk_drop_down_set_model (self->model_dropdown, G_LIST_MODEL (self->model_list));
   
-  if (json_object_has_member (object, "sampling_method")) {
-    const char *sampling_method = json_object_get_string_member (object, "sampling_method");
-    // Find the index of the sampling method in the dropdown
-    GtkStringList *sampling_methods = GTK_STRING_LIST (gtk_drop_down_get_model (self->sampling_method_dropdown));
-    guint n_items = g_list_model_get_n_items (G_LIST_MODEL (sampling_methods));
+  // Find and select the last used model if it exists
+  if (self->config.last_model_path) {
+    GFile *last_model_file = g_file_new_for_path (self->config.last_model_path);
+    char *basename = g_file_get_basename (last_model_file);
+    
+    // Try to find and select the model in the dropdown
+    GtkStringObject *item;
+    guint n_items = g_list_model_get_n_items (G_LIST_MODEL (self->model_list));
     
     for (guint i = 0; i < n_items; i++) {
-      GtkStringObject *item = GTK_STRING_OBJECT (g_list_model_get_item (G_LIST_MODEL (sampling_methods), i));
-      if (g_strcmp0 (gtk_string_object_get_string (item), sampling_method) == 0) {
-        gtk_drop_down_set_selected (self->sampling_method_dropdown, i);
+      item = g_list_model_get_item (G_LIST_MODEL (self->model_list), i);
+      const char *model_name = gtk_string_object_get_string (item);
+      
+      if (g_strcmp0 (model_name, basename) == 0) {
+        gtk_drop_down_set_selected (self->model_dropdown, i);
         g_object_unref (item);
         break;
       }
+      
       g_object_unref (item);
     }
+    
+    g_free (basename);
+    g_object_unref (last_model_file);
   }
+}
+
+static void
+on_model_selected (GtkDropDown *dropdown,
+                  GParamSpec *pspec G_GNUC_UNUSED,
+                  gpointer user_data)
+{
+  EmergeWindow *self = EMERGE_WINDOW (user_data);
+  GtkStringObject *selected;
+  const char *model_name;
+  char *model_path;
   
-  // Load img2img settings
-  if (json_object_has_member (object, "img2img_enabled")) {
-    gboolean img2img_enabled = json_object_get_boolean_member (object, "img2img_enabled");
-    adw_switch_row_set_active (self->img2img_toggle, img2img_enabled);
+  // Get the selected model
+  selected = gtk_drop_down_get_selected_item (dropdown);
+  if (!selected) {
+    return;
   }
   
-  if (json_object_has_member (object, "strength")) {
-    double strength = json_object_get_double_member (object, "strength");
-    gtk_spin_button_set_value (self->strength_spin, strength);
-  }
+  model_name = gtk_string_object_get_string (selected);
   
-  // Cleanup
-  g_object_unref (parser);
+  // Construct full path
+  model_path = g_build_filename (self->config.models_directory, model_name, NULL);
   
-  adw_toast_overlay_add_toast (self->toast_overlay,
-                           adw_toast_new ("Template loaded successfully"));
+  // Update the model path
+  g_free (self->model_path);
+  self->model_path = model_path;
+  
+  // Update UI state based on model type
+  gboolean is_safetensors = g_str_has_suffix (model_path, ".safetensors");
+  gtk_widget_set_sensitive (GTK_WIDGET (self->convert_model_button), is_safetensors);
+  gtk_widget_set_visible (GTK_WIDGET (self->quantization_dropdown), is_safetensors);
+  gtk_widget_set_visible (GTK_WIDGET (self->quantization_label), is_safetensors);
+  
+  // Start pulling the model into the page cache right away
+  emerge_window_preload_model (self);
+  
+  // Save the config
+  emerge_window_save_config (self);
 }
 
 static void
-save_template_response (GObject *source_object,
-                       GAsyncResult *result,
-                       gpointer user_data)
+convert_model_save_response (GObject *source_object,
+                           GAsyncResult *result,
+                           gpointer user_data)
 {
   EmergeWindow *self = EMERGE_WINDOW (user_data);
   GtkFileDialog *dialog = GTK_FILE_DIALOG (source_object);
   GFile *file;
   GError *error = NULL;
+  gchar *output_path;
+  const char *quant_type;
+  gchar **argv = NULL;
+  gchar *sd_path;
   
   file = gtk_file_dialog_save_finish (dialog, result, &error);
   if (file == NULL) {
     if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
-      g_warning ("Failed to save template: %s", error->message);
+      g_warning ("Failed to save file: %s", error->message);
     g_error_free (error);
     return;
   }
   
-  // Get the path and save the template
-  gchar *path = g_file_get_path (file);
-  save_template_to_file (self, path);
+  output_path = g_file_get_path (file);
   
-  // Save the directory for next time
-  g_free (self->last_template_dir);
-  gchar *parent_path = g_path_get_dirname (path);
-  self->last_template_dir = g_strdup (parent_path);
-  g_free (parent_path);
+  /* Get quantization type from dropdown */
+  GtkStringObject *selected = gtk_drop_down_get_selected_item (self->quantization_dropdown);
+  quant_type = "q8_0"; /* Default to q8_0 */
+  if (selected) {
+    quant_type = gtk_string_object_get_string (selected);
+  }
+  
+  /* Set up UI for conversion; generation stays available meanwhile */
+  gtk_widget_set_sensitive (GTK_WIDGET (self->convert_model_button), FALSE);
+  
+  /* Find the sd binary in PATH or bin directory */
+  sd_path = emerge_sd_find_executable ();
+  
+  if (sd_path == NULL) {
+    gchar *error_msg = emerge_sd_format_not_found_message ();
+    
+    gtk_label_set_text (self->status_label, "Failed to find sd");
+    adw_toast_overlay_add_toast (self->toast_overlay,
+                               adw_toast_new (error_msg));
+    g_free (error_msg);
+    
+    g_free (output_path);
+    g_object_unref (file);
+    // Reset UI (copied from existing error handling)
+    gtk_widget_set_sensitive (GTK_WIDGET (self->convert_model_button), TRUE);
+    return;
+  }
+  
+  /* Prepare the command line */
+  argv = emerge_sd_build_convert_argv (sd_path, self->model_path, output_path, quant_type);
+  g_free(sd_path);
+  
+  /* Start the process at low CPU and I/O priority so a long conversion
+   * doesn't slow down generations running alongside it */
+  const EmergeProcessLimits convert_limits = {
+    .nice = 10,
+    .idle_io = TRUE,
+    .max_memory = 0,
+  };
+  
+  self->convert_process = emerge_process_manager_spawn (self->process_manager,
+                                                        "convert",
+                                                        (const char * const *) argv,
+                                                        &convert_limits,
+                                                        &error);
+  if (self->convert_process == NULL) {
+    adw_toast_overlay_add_toast (self->toast_overlay,
+                               adw_toast_new (error->message));
+    g_error_free (error);
+    g_strfreev (argv);
+    g_free (output_path);
+    g_object_unref (file);
+    
+    /* Reset UI */
+    gtk_widget_set_sensitive (GTK_WIDGET (self->convert_model_button), TRUE);
+    
+    return;
+  }
   
-  g_free (path);
+  /* Show conversion progress in its own row */
+  gchar *basename = g_path_get_basename (output_path);
+  adw_action_row_set_subtitle (self->conversion_row, basename);
+  g_free (basename);
+  gtk_progress_bar_set_fraction (self->conversion_progress, 0.0);
+  gtk_widget_set_visible (GTK_WIDGET (self->conversion_row), TRUE);
+  
+  g_strfreev (argv);
+  g_free (output_path);
   g_object_unref (file);
+  
+  /* Monitor the process */
+  g_signal_connect (self->convert_process, "progress",
+                    G_CALLBACK (convert_process_progress_cb), self);
+  g_signal_connect (self->convert_process, "output",
+                    G_CALLBACK (convert_process_output_cb), self);
+  g_signal_connect (self->convert_process, "exited",
+                    G_CALLBACK (convert_process_exited_cb), self);
 }
 
 static void
-on_save_template_clicked (EmergeWindow *self)
+on_convert_model_clicked (GtkButton *button G_GNUC_UNUSED,
+                        gpointer   user_data)
 {
+  EmergeWindow *self = EMERGE_WINDOW (user_data);
   GtkFileDialog *dialog;
   GtkFileFilter *filter;
   GListStore *filters;
-  GFile *current_folder = NULL;
-  
-  dialog = gtk_file_dialog_new ();
-  gtk_file_dialog_set_title (dialog, "Save Template");
+  gchar *suggested_filename;
   
-  // Set default name
-  gtk_file_dialog_set_initial_name (dialog, "template.json");
+  /* Check if a model has been selected */
+  if (self->model_path == NULL) {
+    adw_toast_overlay_add_toast (self->toast_overlay,
+                               adw_toast_new ("Please select a model file first"));
+    return;
+  }
   
-  // Set initial folder if we have saved before
-  if (self->last_template_dir) {
-    current_folder = g_file_new_for_path (self->last_template_dir);
-  } else {
-    // Default to home directory if no previous save location
-    const gchar *home_dir = g_get_home_dir ();
-    current_folder = g_file_new_for_path (home_dir);
+  /* Check if it's a safetensors file */
+  if (!g_str_has_suffix (self->model_path, ".safetensors")) {
+    adw_toast_overlay_add_toast (self->toast_overlay,
+                               adw_toast_new ("Only .safetensors files can be converted"));
+    return;
   }
   
-  if (current_folder) {
-    gtk_file_dialog_set_initial_folder (dialog, current_folder);
+  /* Get quantization type for suggested filename */
+  GtkStringObject *selected = gtk_drop_down_get_selected_item (self->quantization_dropdown);
+  const char *quant_type = "q8_0"; /* Default to q8_0 */
+  if (selected) {
+    quant_type = gtk_string_object_get_string (selected);
   }
   
-  filter = gtk_file_filter_new ();
-  gtk_file_filter_set_name (filter, "JSON Files");
-  gtk_file_filter_add_pattern (filter, "*.json");
+  /* Create file save dialog */
+  dialog = gtk_file_dialog_new();
+  gtk_file_dialog_set_title(dialog, "Save Converted Model");
   
-  filters = g_list_store_new (GTK_TYPE_FILE_FILTER);
-  g_list_store_append (filters, filter);
-  gtk_file_dialog_set_filters (dialog, G_LIST_MODEL(filters));
+  /* Get base filename without the extension */
+  gchar *basename = g_path_get_basename(self->model_path);
+  gchar *base_without_ext = g_strndup(basename, strlen(basename) - strlen(".safetensors"));
   
-  gtk_file_dialog_save (dialog,
-                       GTK_WINDOW(self),
-                       NULL,  // cancellable
-                       save_template_response,
-                       self);
+  /* Set default name */
+  suggested_filename = g_strdup_printf("%s.%s.gguf", base_without_ext, quant_type);
+  gtk_file_dialog_set_initial_name(dialog, suggested_filename);
+  g_free(suggested_filename);
+  g_free(base_without_ext);
+  g_free(basename);
+  
+  /* Set initial folder to same directory as source model */
+  gchar *dir_path = g_path_get_dirname(self->model_path);
+  GFile *initial_folder = g_file_new_for_path(dir_path);
+  gtk_file_dialog_set_initial_folder(dialog, initial_folder);
+  g_object_unref(initial_folder);
+  g_free(dir_path);
+  
+  /* Set up filter for GGUF files */
+  filter = gtk_file_filter_new();
+  gtk_file_filter_set_name(filter, "GGUF Model Files");
+  gtk_file_filter_add_pattern(filter, "*.gguf");
+  
+  filters = g_list_store_new(GTK_TYPE_FILE_FILTER);
+  g_list_store_append(filters, filter);
+  gtk_file_dialog_set_filters(dialog, G_LIST_MODEL(filters));
+  
+  /* Show the save dialog */
+  gtk_file_dialog_save(dialog,
+                      GTK_WINDOW(self),
+                      NULL,  /* cancellable */
+                      convert_model_save_response,
+                      self);
   
-  if (current_folder)
-    g_object_unref (current_folder);
   g_object_unref(dialog);
   g_object_unref(filter);
   g_object_unref(filters);
 }
 
 static void
-load_template_response (GObject *source_object,
-                        GAsyncResult *result,
-                        gpointer user_data)
+batch_convert_progress_cb (EmergeBatchConvert *batch G_GNUC_UNUSED,
+                           guint               n_done,
+                           guint               n_items,
+                           gpointer            user_data)
+{
+  EmergeWindow *self = EMERGE_WINDOW (user_data);
+  gchar *subtitle = g_strdup_printf ("Batch: %u of %u done", n_done, n_items);
+  
+  adw_action_row_set_subtitle (self->conversion_row, subtitle);
+  gtk_progress_bar_set_fraction (self->conversion_progress,
+                                 n_items > 0 ? (double) n_done / n_items : 1.0);
+  g_free (subtitle);
+}
+
+static void
+batch_convert_finished_cb (EmergeBatchConvert *batch,
+                           gpointer            user_data)
 {
   EmergeWindow *self = EMERGE_WINDOW (user_data);
-  GtkFileDialog *dialog = GTK_FILE_DIALOG (source_object);
-  GFile *file;
   GError *error = NULL;
   
-  file = gtk_file_dialog_open_finish (dialog, result, &error);
-  if (file == NULL) {
-    if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
-      g_warning ("Failed to open template: %s", error->message);
+  gchar *report_path = g_build_filename (self->config.models_directory,
+                                         "conversion-report.json", NULL);
+  if (!emerge_batch_convert_write_report (batch, report_path, &error)) {
+    g_warning ("Failed to write conversion report: %s", error->message);
     g_error_free (error);
-    return;
   }
+  g_free (report_path);
   
-  // Get the path and load the template
-  gchar *path = g_file_get_path (file);
-  load_template_from_file (self, path);
+  guint n_failed = emerge_batch_convert_get_n_failed (batch);
+  if (n_failed > 0)
+    adw_toast_overlay_add_toast (self->toast_overlay,
+                               adw_toast_new_format ("Batch conversion finished, %u failed", n_failed));
+  else
+    adw_toast_overlay_add_toast (self->toast_overlay,
+                               adw_toast_new ("Batch conversion finished"));
   
-  // Save the directory for next time
-  g_free (self->last_template_dir);
-  gchar *parent_path = g_path_get_dirname (path);
-  self->last_template_dir = g_strdup (parent_path);
-  g_free (parent_path);
+  gtk_widget_set_visible (GTK_WIDGET (self->conversion_row), FALSE);
+  gtk_widget_set_sensitive (GTK_WIDGET (self->batch_convert_button), TRUE);
   
-  g_free (path);
-  g_object_unref (file);
+  g_signal_handlers_disconnect_by_data (batch, self);
+  g_clear_object (&self->batch_convert);
+  
+  // Pick up the new GGUF files
+  populate_model_dropdown (self);
 }
 
 static void
-on_load_template_clicked (EmergeWindow *self)
+batch_convert_dialog_response_cb (AdwAlertDialog *dialog,
+                                  const char     *response,
+                                  gpointer        user_data)
 {
-  GtkFileDialog *dialog;
-  GtkFileFilter *filter;
-  GListStore *filters;
-  GFile *current_folder = NULL;
+  EmergeWindow *self = EMERGE_WINDOW (user_data);
+  GPtrArray *model_checks = g_object_get_data (G_OBJECT (dialog), "model-checks");
+  GPtrArray *type_checks = g_object_get_data (G_OBJECT (dialog), "type-checks");
   
-  dialog = gtk_file_dialog_new ();
-  gtk_file_dialog_set_title (dialog, "Load Template");
+  if (g_strcmp0 (response, "convert") != 0 || self->batch_convert != NULL)
+    return;
   
-  // Set initial folder if we have saved before
-  if (self->last_template_dir) {
-    current_folder = g_file_new_for_path (self->last_template_dir);
-  } else {
-    // Default to home directory if no previous save location
-    const gchar *home_dir = g_get_home_dir ();
-    current_folder = g_file_new_for_path (home_dir);
+  gchar *sd_path = emerge_sd_find_executable ();
+  if (sd_path == NULL) {
+    gchar *error_msg = emerge_sd_format_not_found_message ();
+    adw_toast_overlay_add_toast (self->toast_overlay, adw_toast_new (error_msg));
+    g_free (error_msg);
+    return;
   }
   
-  if (current_folder) {
-    gtk_file_dialog_set_initial_folder (dialog, current_folder);
+  self->batch_convert = emerge_batch_convert_new (self->process_manager, sd_path);
+  g_free (sd_path);
+  
+  for (guint i = 0; i < model_checks->len; i++) {
+    GtkCheckButton *model_check = g_ptr_array_index (model_checks, i);
+    
+    if (!gtk_check_button_get_active (model_check))
+      continue;
+    
+    gchar *model_path = g_build_filename (self->config.models_directory,
+                                          gtk_check_button_get_label (model_check),
+                                          NULL);
+    
+    for (guint j = 0; j < type_checks->len; j++) {
+      GtkCheckButton *type_check = g_ptr_array_index (type_checks, j);
+      
+      if (gtk_check_button_get_active (type_check))
+        emerge_batch_convert_add (self->batch_convert, model_path,
+                                  gtk_check_button_get_label (type_check),
+                                  self->config.models_directory);
+    }
+    
+    g_free (model_path);
   }
   
-  filter = gtk_file_filter_new ();
-  gtk_file_filter_set_name (filter, "JSON Files");
-  gtk_file_filter_add_pattern (filter, "*.json");
+  if (emerge_batch_convert_get_n_items (self->batch_convert) == 0) {
+    adw_toast_overlay_add_toast (self->toast_overlay,
+                               adw_toast_new ("Select at least one model and one type"));
+    g_clear_object (&self->batch_convert);
+    return;
+  }
   
-  filters = g_list_store_new (GTK_TYPE_FILE_FILTER);
-  g_list_store_append (filters, filter);
-  gtk_file_dialog_set_filters (dialog, G_LIST_MODEL (filters));
+  adw_action_row_set_subtitle (self->conversion_row, "Batch: starting");
+  gtk_progress_bar_set_fraction (self->conversion_progress, 0.0);
+  gtk_widget_set_visible (GTK_WIDGET (self->conversion_row), TRUE);
+  gtk_widget_set_sensitive (GTK_WIDGET (self->batch_convert_button), FALSE);
   
-  gtk_file_dialog_open (dialog,
-                       GTK_WINDOW (self),
-                       NULL,  // cancellable
-                       load_template_response,
-                       self);
+  g_signal_connect (self->batch_convert, "progress",
+                    G_CALLBACK (batch_convert_progress_cb), self);
+  g_signal_connect (self->batch_convert, "finished",
+                    G_CALLBACK (batch_convert_finished_cb), self);
   
-  if (current_folder)
-    g_object_unref (current_folder);
-  g_object_unref (dialog);
-  g_object_unref (filter);
-  g_object_unref (filters);
+  emerge_batch_convert_start (self->batch_convert);
 }
 
-/* Configuration file management */
-static gchar *
-get_config_dir_path(void)
+static void
+on_batch_convert_clicked (GtkButton *button G_GNUC_UNUSED,
+                          gpointer   user_data)
 {
-  const gchar *home_dir = g_get_home_dir();
-  return g_build_filename(home_dir, ".local", "share", "emerge", NULL);
+  EmergeWindow *self = EMERGE_WINDOW (user_data);
+  AdwDialog *dialog;
+  GtkWidget *box, *list, *scrolled, *types_box;
+  GPtrArray *model_checks, *type_checks;
+  
+  if (self->model_list == NULL || self->config.models_directory == NULL) {
+    adw_toast_overlay_add_toast (self->toast_overlay,
+                               adw_toast_new ("Please select a models folder first"));
+    return;
+  }
+  
+  dialog = adw_alert_dialog_new ("Batch Convert Models",
+                                 "Each selected model is converted to every selected type. "
+                                 "Outputs that are already up to date are skipped.");
+  
+  box = gtk_box_new (GTK_ORIENTATION_VERTICAL, 12);
+  
+  /* One check per convertible model in the models folder */
+  list = gtk_box_new (GTK_ORIENTATION_VERTICAL, 0);
+  model_checks = g_ptr_array_new ();
+  guint n_models = g_list_model_get_n_items (G_LIST_MODEL (self->model_list));
+  for (guint i = 0; i < n_models; i++) {
+    const char *name = gtk_string_list_get_string (self->model_list, i);
+    
+    if (!g_str_has_suffix (name, ".safetensors") && !g_str_has_suffix (name, ".ckpt"))
+      continue;
+    
+    GtkWidget *check = gtk_check_button_new_with_label (name);
+    gtk_box_append (GTK_BOX (list), check);
+    g_ptr_array_add (model_checks, check);
+  }
+  
+  scrolled = gtk_scrolled_window_new ();
+  gtk_scrolled_window_set_child (GTK_SCROLLED_WINDOW (scrolled), list);
+  gtk_scrolled_window_set_propagate_natural_height (GTK_SCROLLED_WINDOW (scrolled), TRUE);
+  gtk_scrolled_window_set_max_content_height (GTK_SCROLLED_WINDOW (scrolled), 240);
+  gtk_box_append (GTK_BOX (box), scrolled);
+  
+  /* And one per quantization type */
+  types_box = gtk_flow_box_new ();
+  gtk_flow_box_set_selection_mode (GTK_FLOW_BOX (types_box), GTK_SELECTION_NONE);
+  type_checks = g_ptr_array_new ();
+  for (int i = 0; emerge_sd_quant_types[i] != NULL; i++) {
+    GtkWidget *check = gtk_check_button_new_with_label (emerge_sd_quant_types[i]);
+    gtk_flow_box_append (GTK_FLOW_BOX (types_box), check);
+    g_ptr_array_add (type_checks, check);
+  }
+  gtk_box_append (GTK_BOX (box), types_box);
+  
+  if (model_checks->len == 0) {
+    gtk_box_append (GTK_BOX (list),
+                    gtk_label_new ("No .safetensors or .ckpt models in the models folder"));
+  }
+  
+  g_object_set_data_full (G_OBJECT (dialog), "model-checks", model_checks,
+                          (GDestroyNotify) g_ptr_array_unref);
+  g_object_set_data_full (G_OBJECT (dialog), "type-checks", type_checks,
+                          (GDestroyNotify) g_ptr_array_unref);
+  
+  adw_alert_dialog_set_extra_child (ADW_ALERT_DIALOG (dialog), box);
+  adw_alert_dialog_add_responses (ADW_ALERT_DIALOG (dialog),
+                                  "cancel", "_Cancel",
+                                  "convert", "_Convert",
+                                  NULL);
+  adw_alert_dialog_set_response_appearance (ADW_ALERT_DIALOG (dialog),
+                                            "convert", ADW_RESPONSE_SUGGESTED);
+  adw_alert_dialog_set_default_response (ADW_ALERT_DIALOG (dialog), "convert");
+  adw_alert_dialog_set_close_response (ADW_ALERT_DIALOG (dialog), "cancel");
+  
+  g_signal_connect (dialog, "response",
+                    G_CALLBACK (batch_convert_dialog_response_cb), self);
+  
+  adw_dialog_present (dialog, GTK_WIDGET (self));
 }
 
-static gchar *
-get_config_file_path(void)
+static void
+quant_bench_progress_cb (EmergeQuantBench *bench G_GNUC_UNUSED,
+                         const char       *stage,
+                         guint             n_done,
+                         guint             n_total,
+                         gpointer          user_data)
 {
-  gchar *config_dir = get_config_dir_path();
-  gchar *config_file = g_build_filename(config_dir, "config.json", NULL);
-  g_free(config_dir);
-  return config_file;
+  EmergeWindow *self = EMERGE_WINDOW (user_data);
+  gchar *subtitle;
+  
+  if (g_strcmp0 (stage, "convert") == 0)
+    subtitle = g_strdup_printf ("Benchmark: converting %u of %u", n_done, n_total);
+  else if (g_strcmp0 (stage, "generate") == 0)
+    subtitle = g_strdup_printf ("Benchmark: image %u of %u", n_done, n_total);
+  else
+    subtitle = g_strdup ("Benchmark: comparing images");
+  
+  adw_action_row_set_subtitle (self->conversion_row, subtitle);
+  gtk_progress_bar_set_fraction (self->conversion_progress,
+                                 n_total > 0 ? (double) n_done / n_total : 1.0);
+  g_free (subtitle);
 }
 
 static void
-ensure_config_dir_exists(void)
+quant_bench_finished_cb (EmergeQuantBench *bench,
+                         gboolean          completed,
+                         gpointer          user_data)
 {
-  gchar *config_dir = get_config_dir_path();
+  EmergeWindow *self = EMERGE_WINDOW (user_data);
+  gchar *work_dir = g_object_steal_data (G_OBJECT (bench), "work-dir");
   
-  if (!g_file_test(config_dir, G_FILE_TEST_IS_DIR)) {
-    g_mkdir_with_parents(config_dir, 0755);
+  if (completed) {
+    GError *error = NULL;
+    gchar *json_path = g_build_filename (work_dir, "report.json", NULL);
+    gchar *text_path = g_build_filename (work_dir, "report.txt", NULL);
+    
+    if (emerge_quant_bench_write_report (bench, json_path, text_path, &error)) {
+      g_print ("Quantization benchmark report written to %s\n", text_path);
+      adw_toast_overlay_add_toast (self->toast_overlay,
+                                 adw_toast_new_format ("Benchmark report saved to %s", work_dir));
+    } else {
+      adw_toast_overlay_add_toast (self->toast_overlay,
+                                 adw_toast_new_format ("Failed to write benchmark report: %s",
+                                                       error->message));
+      g_error_free (error);
+    }
+    
+    g_free (json_path);
+    g_free (text_path);
+  } else {
+    adw_toast_overlay_add_toast (self->toast_overlay,
+                               adw_toast_new ("Benchmark cancelled"));
   }
   
-  g_free(config_dir);
+  gtk_widget_set_visible (GTK_WIDGET (self->conversion_row), FALSE);
+  gtk_widget_set_sensitive (GTK_WIDGET (self->quant_bench_button), TRUE);
+  gtk_widget_set_sensitive (GTK_WIDGET (self->batch_convert_button), TRUE);
+  
+  g_signal_handlers_disconnect_by_data (bench, self);
+  g_clear_object (&self->quant_bench);
+  g_free (work_dir);
+  emerge_window_resume_queue (self);
+  
+  // Conversions made along the way show up as models
+  populate_model_dropdown (self);
 }
 
-void
-emerge_window_save_config(EmergeWindow *self)
+static void
+quant_bench_dialog_response_cb (AdwAlertDialog *dialog,
+                                const char     *response,
+                                gpointer        user_data)
 {
-  JsonBuilder *builder = json_builder_new();
-  GError *error = NULL;
-  gchar *config_file = get_config_file_path();
+  EmergeWindow *self = EMERGE_WINDOW (user_data);
+  GPtrArray *type_checks = g_object_get_data (G_OBJECT (dialog), "type-checks");
   
-  // Ensure directory exists
-  ensure_config_dir_exists();
+  if (g_strcmp0 (response, "benchmark") != 0 || self->quant_bench != NULL)
+    return;
   
-  // Build JSON object with config
-  json_builder_begin_object(builder);
+  gchar *sd_path = emerge_sd_find_executable ();
+  if (sd_path == NULL) {
+    gchar *error_msg = emerge_sd_format_not_found_message ();
+    adw_toast_overlay_add_toast (self->toast_overlay, adw_toast_new (error_msg));
+    g_free (error_msg);
+    return;
+  }
   
-  // Save models directory
-  if (self->config.models_directory) {
-    json_builder_set_member_name(builder, "models_directory");
-    json_builder_add_string_value(builder, self->config.models_directory);
+  /* Conversions go next to the model so they are reused by later runs and
+   * by batch conversion; images and the report get a folder of their own */
+  gchar *models_dir = self->config.models_directory
+                      ? g_strdup (self->config.models_directory)
+                      : g_path_get_dirname (self->model_path);
+  gchar *basename = g_path_get_basename (self->model_path);
+  gchar *work_dir = g_build_filename (models_dir, "quant-bench", basename, NULL);
+  
+  self->quant_bench = emerge_quant_bench_new (self->process_manager, sd_path,
+                                              self->model_path, models_dir, work_dir);
+  g_object_set_data_full (G_OBJECT (self->quant_bench), "work-dir", work_dir, g_free);
+  g_free (basename);
+  g_free (models_dir);
+  g_free (sd_path);
+  
+  EmergeJob *template = emerge_window_build_job (self);
+  emerge_quant_bench_set_template (self->quant_bench, template);
+  emerge_job_unref (template);
+  
+  for (guint i = 0; i < type_checks->len; i++) {
+    GtkCheckButton *type_check = g_ptr_array_index (type_checks, i);
+    
+    if (gtk_check_button_get_active (type_check))
+      emerge_quant_bench_add_quant_type (self->quant_bench,
+                                         gtk_check_button_get_label (type_check));
   }
   
-  // Save last model path
-  if (self->model_path) {
-    json_builder_set_member_name(builder, "last_model_path");
-    json_builder_add_string_value(builder, self->model_path);
+  adw_action_row_set_subtitle (self->conversion_row, "Benchmark: starting");
+  gtk_progress_bar_set_fraction (self->conversion_progress, 0.0);
+  gtk_widget_set_visible (GTK_WIDGET (self->conversion_row), TRUE);
+  gtk_widget_set_sensitive (GTK_WIDGET (self->quant_bench_button), FALSE);
+  gtk_widget_set_sensitive (GTK_WIDGET (self->batch_convert_button), FALSE);
+  
+  g_signal_connect (self->quant_bench, "progress",
+                    G_CALLBACK (quant_bench_progress_cb), self);
+  g_signal_connect (self->quant_bench, "finished",
+                    G_CALLBACK (quant_bench_finished_cb), self);
+  
+  emerge_quant_bench_start (self->quant_bench);
+}
+
+static void
+on_quant_bench_clicked (GtkButton *button G_GNUC_UNUSED,
+                        gpointer   user_data)
+{
+  EmergeWindow *self = EMERGE_WINDOW (user_data);
+  AdwDialog *dialog;
+  GtkWidget *types_box;
+  GPtrArray *type_checks;
+  
+  if (self->model_path == NULL ||
+      (!g_str_has_suffix (self->model_path, ".safetensors") &&
+       !g_str_has_suffix (self->model_path, ".ckpt"))) {
+    adw_toast_overlay_add_toast (self->toast_overlay,
+                               adw_toast_new ("Select a .safetensors or .ckpt model to benchmark"));
+    return;
   }
   
-  // Save last save directory
-  if (self->last_saved_dir) {
-    json_builder_set_member_name(builder, "last_save_directory");
-    json_builder_add_string_value(builder, self->last_saved_dir);
+  dialog = adw_alert_dialog_new ("Benchmark Quantizations",
+                                 "The selected model is converted to each type, reusing existing "
+                                 "conversions, and a fixed set of prompts and seeds is rendered "
+                                 "with the current size, steps and sampler. Images are scored "
+                                 "against f16 and a report is saved with them.");
+  
+  /* f16 is the baseline and is always included */
+  types_box = gtk_flow_box_new ();
+  gtk_flow_box_set_selection_mode (GTK_FLOW_BOX (types_box), GTK_SELECTION_NONE);
+  type_checks = g_ptr_array_new ();
+  for (int i = 0; emerge_sd_quant_types[i] != NULL; i++) {
+    GtkWidget *check = gtk_check_button_new_with_label (emerge_sd_quant_types[i]);
+    
+    if (g_strcmp0 (emerge_sd_quant_types[i], "f16") == 0) {
+      gtk_check_button_set_active (GTK_CHECK_BUTTON (check), TRUE);
+      gtk_widget_set_sensitive (check, FALSE);
+    } else if (g_strcmp0 (emerge_sd_quant_types[i], "f32") != 0) {
+      gtk_check_button_set_active (GTK_CHECK_BUTTON (check), TRUE);
+    }
+    
+    gtk_flow_box_append (GTK_FLOW_BOX (types_box), check);
+    g_ptr_array_add (type_checks, check);
   }
   
-  // Save last template directory
-  if (self->last_template_dir) {
-    json_builder_set_member_name(builder, "last_template_directory");
-    json_builder_add_string_value(builder, self->last_template_dir);
-  }
+  g_object_set_data_full (G_OBJECT (dialog), "type-checks", type_checks,
+                          (GDestroyNotify) g_ptr_array_unref);
   
-  json_builder_end_object(builder);
+  adw_alert_dialog_set_extra_child (ADW_ALERT_DIALOG (dialog), types_box);
+  adw_alert_dialog_add_responses (ADW_ALERT_DIALOG (dialog),
+                                  "cancel", "_Cancel",
+                                  "benchmark", "_Benchmark",
+                                  NULL);
+  adw_alert_dialog_set_response_appearance (ADW_ALERT_DIALOG (dialog),
+                                            "benchmark", ADW_RESPONSE_SUGGESTED);
+  adw_alert_dialog_set_default_response (ADW_ALERT_DIALOG (dialog), "benchmark");
+  adw_alert_dialog_set_close_response (ADW_ALERT_DIALOG (dialog), "cancel");
   
-  // Generate JSON data
-  JsonGenerator *generator = json_generator_new();
-  JsonNode *root = json_builder_get_root(builder);
-  json_generator_set_root(generator, root);
-  json_generator_set_pretty(generator, TRUE);
+  g_signal_connect (dialog, "response",
+                    G_CALLBACK (quant_bench_dialog_response_cb), self);
   
-  // Save to file
-  if (!json_generator_to_file(generator, config_file, &error)) {
-    g_warning("Error saving config: %s", error->message);
-    g_error_free(error);
-  }
+  adw_dialog_present (dialog, GTK_WIDGET (self));
+}
+
+static void
+benchmark_progress_cb (EmergeBenchmark *benchmark G_GNUC_UNUSED,
+                       guint            n_done,
+                       guint            n_total,
+                       gpointer         user_data)
+{
+  EmergeWindow *self = EMERGE_WINDOW (user_data);
+  gchar *subtitle = g_strdup_printf ("Benchmark: run %u of %u", MIN (n_done + 1, n_total), n_total);
   
-  // Cleanup
-  json_node_free(root);
-  g_object_unref(generator);
-  g_object_unref(builder);
-  g_free(config_file);
+  adw_action_row_set_subtitle (self->conversion_row, subtitle);
+  gtk_progress_bar_set_fraction (self->conversion_progress,
+                                 n_total > 0 ? (double) n_done / n_total : 1.0);
+  g_free (subtitle);
 }
 
-void
-emerge_window_load_config(EmergeWindow *self)
+static void
+benchmark_result_response_cb (AdwAlertDialog *dialog,
+                              const char     *response,
+                              gpointer        user_data)
 {
-  JsonParser *parser = json_parser_new();
+  EmergeWindow *self = EMERGE_WINDOW (user_data);
+  const char *report_path = g_object_get_data (G_OBJECT (dialog), "report-path");
   GError *error = NULL;
-  gchar *config_file = get_config_file_path();
-  
-  // Clear existing config
-  g_free(self->config.models_directory);
-  g_free(self->config.last_model_path);
-  g_free(self->config.last_save_directory);
-  g_free(self->config.last_template_directory);
-  
-  self->config.models_directory = NULL;
-  self->config.last_model_path = NULL;
-  self->config.last_save_directory = NULL;
-  self->config.last_template_directory = NULL;
   
-  // Check if config file exists
-  if (!g_file_test(config_file, G_FILE_TEST_EXISTS)) {
-    g_free(config_file);
+  if (g_strcmp0 (response, "baseline") != 0)
     return;
-  }
   
-  // Parse the file
-  if (!json_parser_load_from_file(parser, config_file, &error)) {
-    g_warning("Error loading config: %s", error->message);
+  gchar *dir = g_path_get_dirname (report_path);
+  gchar *baseline_path = g_build_filename (dir, "baseline.json", NULL);
+  gchar *contents = NULL;
+  gsize length;
+  
+  if (g_file_get_contents (report_path, &contents, &length, &error) &&
+      g_file_set_contents (baseline_path, contents, length, &error)) {
     adw_toast_overlay_add_toast (self->toast_overlay,
-                             adw_toast_new (g_strdup_printf ("Error loading config: %s", error->message)));
+                               adw_toast_new ("Saved as the benchmark baseline"));
+  } else {
+    adw_toast_overlay_add_toast (self->toast_overlay,
+                               adw_toast_new_format ("Failed to save baseline: %s", error->message));
     g_error_free (error);
-    g_object_unref(parser);
-    g_free(config_file);
-    return;
   }
   
-  // Get the root object
-  JsonNode *root = json_parser_get_root(parser);
-  if (json_node_get_node_type(root) != JSON_NODE_OBJECT) {
-    g_warning("Invalid config format: root is not an object");
+  g_free (contents);
+  g_free (baseline_path);
+  g_free (dir);
+}
+
+static void
+benchmark_finished_cb (EmergeBenchmark *benchmark,
+                       gboolean         completed,
+                       gpointer         user_data)
+{
+  EmergeWindow *self = EMERGE_WINDOW (user_data);
+  JsonNode *report = emerge_benchmark_get_report (benchmark);
+  
+  gtk_widget_set_visible (GTK_WIDGET (self->conversion_row), FALSE);
+  gtk_widget_set_sensitive (GTK_WIDGET (self->benchmark_button), TRUE);
+  gtk_widget_set_sensitive (GTK_WIDGET (self->generate_button), TRUE);
+  
+  if (!completed || report == NULL) {
     adw_toast_overlay_add_toast (self->toast_overlay,
-                             adw_toast_new ("Invalid config format"));
-    g_object_unref (parser);
-    g_free(config_file);
+                               adw_toast_new ("Benchmark cancelled"));
+    g_signal_handlers_disconnect_by_data (benchmark, self);
+    g_clear_object (&self->benchmark);
+    emerge_window_resume_queue (self);
     return;
   }
   
-  JsonObject *object = json_node_get_object(root);
+  /* Reports are kept next to the config, with the baseline to compare to */
+  gchar *config_dir = get_config_dir_path ();
+  gchar *bench_dir = g_build_filename (config_dir, "benchmarks", NULL);
+  GDateTime *now = g_date_time_new_now_local ();
+  gchar *stamp = g_date_time_format (now, "%Y%m%d-%H%M%S");
+  gchar *filename = g_strdup_printf ("benchmark-%s.json", stamp);
+  gchar *report_path = g_build_filename (bench_dir, filename, NULL);
+  gchar *baseline_path = g_build_filename (bench_dir, "baseline.json", NULL);
+  GError *error = NULL;
   
-  // Load models directory
-  if (json_object_has_member(object, "models_directory")) {
-    self->config.models_directory = g_strdup(json_object_get_string_member(object, "models_directory"));
-  }
+  g_mkdir_with_parents (bench_dir, 0755);
   
-  // Load last model path
-  if (json_object_has_member(object, "last_model_path")) {
-    self->config.last_model_path = g_strdup(json_object_get_string_member(object, "last_model_path"));
+  JsonGenerator *generator = json_generator_new ();
+  json_generator_set_root (generator, report);
+  json_generator_set_pretty (generator, TRUE);
+  if (!json_generator_to_file (generator, report_path, &error)) {
+    g_warning ("Failed to write benchmark report: %s", error->message);
+    g_clear_error (&error);
   }
+  g_object_unref (generator);
   
-  // Load last save directory
-  if (json_object_has_member(object, "last_save_directory")) {
-    self->config.last_save_directory = g_strdup(json_object_get_string_member(object, "last_save_directory"));
-    self->last_saved_dir = g_strdup(self->config.last_save_directory);
-  }
+  GString *text = g_string_new (NULL);
+  gchar *table = emerge_benchmark_format_report (json_node_get_object (report));
+  g_string_append (text, table);
+  g_free (table);
   
-  // Load last template directory
-  if (json_object_has_member(object, "last_template_directory")) {
-    self->config.last_template_directory = g_strdup(json_object_get_string_member(object, "last_template_directory"));
-    self->last_template_dir = g_strdup(self->config.last_template_directory);
+  JsonParser *parser = json_parser_new ();
+  if (json_parser_load_from_file (parser, baseline_path, NULL) &&
+      JSON_NODE_HOLDS_OBJECT (json_parser_get_root (parser))) {
+    g_string_append_c (text, '\n');
+    emerge_benchmark_compare (json_node_get_object (report),
+                              json_node_get_object (json_parser_get_root (parser)),
+                              0.05, text);
   }
-  
-  // Cleanup
   g_object_unref (parser);
   
-  adw_toast_overlay_add_toast (self->toast_overlay,
-                           adw_toast_new ("Template loaded successfully"));
+  g_print ("%s", text->str);
+  
+  AdwDialog *dialog = adw_alert_dialog_new ("Benchmark Results", NULL);
+  GtkWidget *label = gtk_label_new (text->str);
+  GtkWidget *scrolled = gtk_scrolled_window_new ();
+  
+  gtk_label_set_selectable (GTK_LABEL (label), TRUE);
+  gtk_label_set_xalign (GTK_LABEL (label), 0.0);
+  gtk_widget_add_css_class (label, "monospace");
+  gtk_scrolled_window_set_child (GTK_SCROLLED_WINDOW (scrolled), label);
+  gtk_scrolled_window_set_propagate_natural_height (GTK_SCROLLED_WINDOW (scrolled), TRUE);
+  gtk_scrolled_window_set_propagate_natural_width (GTK_SCROLLED_WINDOW (scrolled), TRUE);
+  gtk_scrolled_window_set_max_content_height (GTK_SCROLLED_WINDOW (scrolled), 400);
+  adw_alert_dialog_set_extra_child (ADW_ALERT_DIALOG (dialog), scrolled);
+  
+  adw_alert_dialog_add_responses (ADW_ALERT_DIALOG (dialog),
+                                  "baseline", "Save as _Baseline",
+                                  "close", "_Close",
+                                  NULL);
+  adw_alert_dialog_set_close_response (ADW_ALERT_DIALOG (dialog), "close");
+  g_object_set_data_full (G_OBJECT (dialog), "report-path", g_strdup (report_path), g_free);
+  g_signal_connect (dialog, "response",
+                    G_CALLBACK (benchmark_result_response_cb), self);
+  adw_dialog_present (dialog, GTK_WIDGET (self));
+  
+  g_string_free (text, TRUE);
+  g_free (baseline_path);
+  g_free (report_path);
+  g_free (filename);
+  g_free (stamp);
+  g_date_time_unref (now);
+  g_free (bench_dir);
+  g_free (config_dir);
+  
+  g_signal_handlers_disconnect_by_data (benchmark, self);
+  g_clear_object (&self->benchmark);
+  emerge_window_resume_queue (self);
 }
 
-/* Model directory and dropdown management */
 static void
-on_model_dir_selected (GObject *source_object,
-                      GAsyncResult *result,
-                      gpointer user_data)
+benchmark_dialog_response_cb (AdwAlertDialog *dialog,
+                              const char     *response,
+                              gpointer        user_data)
 {
   EmergeWindow *self = EMERGE_WINDOW (user_data);
-  GtkFileDialog *dialog = GTK_FILE_DIALOG (source_object);
-  GFile *file;
+  GPtrArray *sampler_checks = g_object_get_data (G_OBJECT (dialog), "sampler-checks");
+  GtkEditable *steps_entry = g_object_get_data (G_OBJECT (dialog), "steps-entry");
+  GtkEditable *sizes_entry = g_object_get_data (G_OBJECT (dialog), "sizes-entry");
+  GtkEditable *threads_entry = g_object_get_data (G_OBJECT (dialog), "threads-entry");
   GError *error = NULL;
   
-  file = gtk_file_dialog_select_folder_finish (dialog, result, &error);
-  if (file == NULL) {
-    if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
-      g_warning ("Failed to select model directory: %s", error->message);
-    g_error_free (error);
+  if (g_strcmp0 (response, "run") != 0 || self->benchmark != NULL)
+    return;
+  
+  gchar *sd_path = emerge_sd_find_executable ();
+  if (sd_path == NULL) {
+    gchar *error_msg = emerge_sd_format_not_found_message ();
+    adw_toast_overlay_add_toast (self->toast_overlay, adw_toast_new (error_msg));
+    g_free (error_msg);
     return;
   }
   
-  // Store models directory
-  if (self->models_directory) {
-    g_object_unref (self->models_directory);
+  GString *samplers = g_string_new (NULL);
+  for (guint i = 0; i < sampler_checks->len; i++) {
+    GtkCheckButton *check = g_ptr_array_index (sampler_checks, i);
+    
+    if (!gtk_check_button_get_active (check))
+      continue;
+    if (samplers->len > 0)
+      g_string_append_c (samplers, ',');
+    g_string_append (samplers, gtk_check_button_get_label (check));
   }
-  self->models_directory = file;  // Transfer ownership
   
-  // Update config
-  g_free (self->config.models_directory);
-  self->config.models_directory = g_file_get_path (file);
+  self->benchmark = emerge_benchmark_new (self->process_manager, sd_path, self->model_path);
+  g_free (sd_path);
   
-  // Update button text
-  char *path = g_file_get_path (file);
-  char *button_text = g_strdup_printf ("Models folder: %s", path);
-  gtk_button_set_label (self->model_dir_button, button_text);
-  g_free (button_text);
-  g_free (path);
+  if (!emerge_benchmark_set_matrix (self->benchmark,
+                                    samplers->len > 0 ? samplers->str : NULL,
+                                    gtk_editable_get_text (steps_entry),
+                                    gtk_editable_get_text (sizes_entry),
+                                    gtk_editable_get_text (threads_entry),
+                                    &error)) {
+    adw_toast_overlay_add_toast (self->toast_overlay, adw_toast_new (error->message));
+    g_error_free (error);
+    g_string_free (samplers, TRUE);
+    g_clear_object (&self->benchmark);
+    return;
+  }
+  g_string_free (samplers, TRUE);
   
-  // Save config for persistence
-  emerge_window_save_config (self);
+  adw_action_row_set_subtitle (self->conversion_row, "Benchmark: starting");
+  gtk_progress_bar_set_fraction (self->conversion_progress, 0.0);
+  gtk_widget_set_visible (GTK_WIDGET (self->conversion_row), TRUE);
+  gtk_widget_set_sensitive (GTK_WIDGET (self->benchmark_button), FALSE);
+  /* A generation running alongside would skew the timings */
+  gtk_widget_set_sensitive (GTK_WIDGET (self->generate_button), FALSE);
   
-  // Populate model dropdown
-  populate_model_dropdown (self);
+  g_signal_connect (self->benchmark, "progress",
+                    G_CALLBACK (benchmark_progress_cb), self);
+  g_signal_connect (self->benchmark, "finished",
+                    G_CALLBACK (benchmark_finished_cb), self);
+  
+  emerge_benchmark_start (self->benchmark);
+}
+
+static GtkWidget *
+benchmark_entry_row (GtkWidget  *box,
+                     const char *title,
+                     const char *text)
+{
+  GtkWidget *row = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 6);
+  GtkWidget *label = gtk_label_new (title);
+  GtkWidget *entry = gtk_entry_new ();
+  
+  gtk_label_set_xalign (GTK_LABEL (label), 0.0);
+  gtk_widget_set_hexpand (label, TRUE);
+  gtk_editable_set_text (GTK_EDITABLE (entry), text);
+  gtk_box_append (GTK_BOX (row), label);
+  gtk_box_append (GTK_BOX (row), entry);
+  gtk_box_append (GTK_BOX (box), row);
+  
+  return entry;
 }
 
 static void
-on_model_dir_button_clicked (GtkButton *button G_GNUC_UNUSED,
-                            gpointer   user_data)
+on_benchmark_clicked (GtkButton *button G_GNUC_UNUSED,
+                      gpointer   user_data)
 {
   EmergeWindow *self = EMERGE_WINDOW (user_data);
-  GtkFileDialog *dialog;
+  AdwDialog *dialog;
+  GtkWidget *box, *samplers_box, *entry;
+  GPtrArray *sampler_checks;
   
-  dialog = gtk_file_dialog_new ();
-  gtk_file_dialog_set_title (dialog, "Select Models Directory");
+  if (self->model_path == NULL) {
+    adw_toast_overlay_add_toast (self->toast_overlay,
+                               adw_toast_new ("Please select a model file"));
+    return;
+  }
   
-  // Set initial folder if we have one configured
-  if (self->models_directory) {
-    gtk_file_dialog_set_initial_folder (dialog, self->models_directory);
+  if (self->is_generating) {
+    adw_toast_overlay_add_toast (self->toast_overlay,
+                               adw_toast_new ("Wait for the current generation to finish"));
+    return;
   }
   
-  gtk_file_dialog_select_folder (dialog,
-                                GTK_WINDOW (self),
-                                NULL,  /* cancellable */
-                                on_model_dir_selected,
-                                self);
+  dialog = adw_alert_dialog_new ("Run Benchmark",
+                                 "Every combination below is generated with a fixed prompt "
+                                 "and seed. The first run starts with the model evicted from "
+                                 "memory to measure a cold load.");
   
-  g_object_unref (dialog);
+  box = gtk_box_new (GTK_ORIENTATION_VERTICAL, 6);
+  
+  samplers_box = gtk_flow_box_new ();
+  gtk_flow_box_set_selection_mode (GTK_FLOW_BOX (samplers_box), GTK_SELECTION_NONE);
+  sampler_checks = g_ptr_array_new ();
+  const char *current = gtk_string_object_get_string (GTK_STRING_OBJECT (
+                          gtk_drop_down_get_selected_item (self->sampling_method_dropdown)));
+  for (int i = 0; emerge_sd_sampling_methods[i] != NULL; i++) {
+    GtkWidget *check = gtk_check_button_new_with_label (emerge_sd_sampling_methods[i]);
+    
+    gtk_check_button_set_active (GTK_CHECK_BUTTON (check),
+                                 g_strcmp0 (emerge_sd_sampling_methods[i], current) == 0);
+    gtk_flow_box_append (GTK_FLOW_BOX (samplers_box), check);
+    g_ptr_array_add (sampler_checks, check);
+  }
+  gtk_box_append (GTK_BOX (box), samplers_box);
+  g_object_set_data_full (G_OBJECT (dialog), "sampler-checks", sampler_checks,
+                          (GDestroyNotify) g_ptr_array_unref);
+  
+  /* Default to the current settings so a single case runs */
+  gchar *text = g_strdup_printf ("%d", (int) gtk_spin_button_get_value (self->steps_spin));
+  entry = benchmark_entry_row (box, "Steps", text);
+  g_object_set_data (G_OBJECT (dialog), "steps-entry", entry);
+  g_free (text);
+  
+  text = g_strdup_printf ("%dx%d",
+                          (int) gtk_spin_button_get_value (self->width_spin),
+                          (int) gtk_spin_button_get_value (self->height_spin));
+  entry = benchmark_entry_row (box, "Resolutions", text);
+  g_object_set_data (G_OBJECT (dialog), "sizes-entry", entry);
+  g_free (text);
+  
+  entry = benchmark_entry_row (box, "Threads (0 = default)", "0");
+  g_object_set_data (G_OBJECT (dialog), "threads-entry", entry);
+  
+  adw_alert_dialog_set_extra_child (ADW_ALERT_DIALOG (dialog), box);
+  adw_alert_dialog_add_responses (ADW_ALERT_DIALOG (dialog),
+                                  "cancel", "_Cancel",
+                                  "run", "_Run",
+                                  NULL);
+  adw_alert_dialog_set_response_appearance (ADW_ALERT_DIALOG (dialog),
+                                            "run", ADW_RESPONSE_SUGGESTED);
+  adw_alert_dialog_set_default_response (ADW_ALERT_DIALOG (dialog), "run");
+  adw_alert_dialog_set_close_response (ADW_ALERT_DIALOG (dialog), "cancel");
+  
+  g_signal_connect (dialog, "response",
+                    G_CALLBACK (benchmark_dialog_response_cb), self);
+  
+  adw_dialog_present (dialog, GTK_WIDGET (self));
 }
 
-static gboolean
-is_model_file (const char *filename)
+static GdkTexture *
+texture_new_for_pixbuf (GdkPixbuf *pixbuf)
 {
-  return (g_str_has_suffix (filename, ".ckpt") ||
-         g_str_has_suffix (filename, ".safetensors") ||
-         g_str_has_suffix (filename, ".gguf"));
+  GBytes *bytes = gdk_pixbuf_read_pixel_bytes (pixbuf);
+  GdkTexture *texture;
+  
+  texture = gdk_memory_texture_new (gdk_pixbuf_get_width (pixbuf),
+                                    gdk_pixbuf_get_height (pixbuf),
+                                    gdk_pixbuf_get_has_alpha (pixbuf) ? GDK_MEMORY_R8G8B8A8
+                                                                      : GDK_MEMORY_R8G8B8,
+                                    bytes,
+                                    gdk_pixbuf_get_rowstride (pixbuf));
+  g_bytes_unref (bytes);
+  
+  return texture;
+}
+
+static GtkPicture *
+gallery_cell_get_picture (GtkListItem *list_item)
+{
+  return GTK_PICTURE (gtk_overlay_get_child (GTK_OVERLAY (gtk_list_item_get_child (list_item))));
 }
 
 static void
-populate_model_dropdown (EmergeWindow *self)
+gallery_setup_cb (GtkSignalListItemFactory *factory G_GNUC_UNUSED,
+                  GtkListItem              *list_item,
+                  gpointer                  user_data G_GNUC_UNUSED)
 {
-  GError *error = NULL;
-  GFileEnumerator *enumerator;
-  GFileInfo *info;
+  GtkWidget *overlay = gtk_overlay_new ();
+  GtkWidget *picture = gtk_picture_new ();
+  GtkWidget *badge = gtk_label_new (NULL);
+  
+  gtk_picture_set_content_fit (GTK_PICTURE (picture), GTK_CONTENT_FIT_COVER);
+  gtk_widget_set_size_request (picture, EMERGE_THUMBNAIL_SMALL, EMERGE_THUMBNAIL_SMALL);
+  gtk_overlay_set_child (GTK_OVERLAY (overlay), picture);
+  
+  /* How many near-duplicates a collapsed cell stands for */
+  gtk_widget_add_css_class (badge, "osd");
+  gtk_widget_add_css_class (badge, "caption");
+  gtk_widget_set_halign (badge, GTK_ALIGN_END);
+  gtk_widget_set_valign (badge, GTK_ALIGN_START);
+  gtk_widget_set_margin_top (badge, 4);
+  gtk_widget_set_margin_end (badge, 4);
+  gtk_widget_set_visible (badge, FALSE);
+  gtk_overlay_add_overlay (GTK_OVERLAY (overlay), badge);
+  g_object_set_data (G_OBJECT (list_item), "duplicates-badge", badge);
+  
+  gtk_list_item_set_child (list_item, overlay);
+}
+
+static void
+gallery_cell_update_badge (EmergeWindow *self,
+                           GtkListItem  *list_item)
+{
+  GtkWidget *badge = g_object_get_data (G_OBJECT (list_item), "duplicates-badge");
+  EmergeHistoryItem *item = gtk_list_item_get_item (list_item);
+  guint n_duplicates = 0;
   
-  // Clear the existing model list
-  if (self->model_list) {
-    g_object_unref (self->model_list);
-  }
-  self->model_list = gtk_string_list_new (NULL);
+  if (self->gallery_duplicates != NULL && item != NULL)
+    n_duplicates = emerge_duplicates_get_n_duplicates (self->gallery_duplicates, item);
   
-  // If no models directory is set, return early
-  if (!self->models_directory) {
-    gtk_drop_down_set_model (self->model_dropdown, G_LIST_MODEL (self->model_list));
-    return;
+  if (n_duplicates > 0) {
+    gchar *text = g_strdup_printf ("+%u", n_duplicates);
+    gtk_label_set_text (GTK_LABEL (badge), text);
+    g_free (text);
   }
+  gtk_widget_set_visible (badge, n_duplicates > 0);
+}
+
+static void
+gallery_thumbnail_loaded_cb (GObject      *source_object,
+                             GAsyncResult *result,
+                             gpointer      user_data)
+{
+  GtkListItem *list_item = GTK_LIST_ITEM (user_data);
+  GError *error = NULL;
+  GdkPixbuf *pixbuf;
   
-  // Enumerate files in the directory
-  enumerator = g_file_enumerate_children (self->models_directory,
-                                        G_FILE_ATTRIBUTE_STANDARD_NAME,
-                                        G_FILE_QUERY_INFO_NONE,
-                                        NULL,
-                                        &error);
-  
-  if (!enumerator) {
-    g_warning ("Failed to enumerate models directory: %s", error->message);
+  /* Fails with G_IO_ERROR_CANCELLED once the cell has been recycled */
+  pixbuf = emerge_thumbnailer_load_finish (EMERGE_THUMBNAILER (source_object), result, &error);
+  if (pixbuf == NULL) {
+    if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+      g_warning ("Failed to load thumbnail: %s", error->message);
     g_error_free (error);
-    gtk_drop_down_set_model (self->model_dropdown, G_LIST_MODEL (self->model_list));
+    g_object_unref (list_item);
     return;
   }
   
-  // Add model files to the list
-  while ((info = g_file_enumerator_next_file (enumerator, NULL, &error)) != NULL) {
-    const char *filename = g_file_info_get_name (info);
-    
-    if (is_model_file (filename)) {
-      gtk_string_list_append (self->model_list, filename);
-    }
-    
-    g_object_unref (info);
-  }
-  
-  if (error) {
-    g_warning ("Error while enumerating models: %s", error->message);
-    g_error_free (error);
-  }
-  
-  g_object_unref (enumerator);
-  
-  // Set the dropdown model
-  gtk_drop_down_set_model (self->model_dropdown, G_LIST_MODEL (self->model_list));
+  GdkTexture *texture = texture_new_for_pixbuf (pixbuf);
+  gtk_picture_set_paintable (gallery_cell_get_picture (list_item), GDK_PAINTABLE (texture));
+  g_object_unref (texture);
+  g_object_unref (pixbuf);
+  g_object_unref (list_item);
+}
+
+/* Only cells on screen are bound, so only visible thumbnails are decoded */
+static void
+gallery_bind_cb (GtkSignalListItemFactory *factory G_GNUC_UNUSED,
+                 GtkListItem              *list_item,
+                 gpointer                  user_data)
+{
+  EmergeWindow *self = EMERGE_WINDOW (user_data);
+  EmergeHistoryItem *item = gtk_list_item_get_item (list_item);
+  GtkWidget *picture = GTK_WIDGET (gallery_cell_get_picture (list_item));
+  GCancellable *cancellable = g_cancellable_new ();
+  gchar *key = history_item_thumbnail_key (item);
+  
+  gtk_widget_set_tooltip_text (picture, emerge_history_item_get_job (item)->prompt);
+  g_object_set_data_full (G_OBJECT (list_item), "thumbnail-cancellable",
+                          cancellable, g_object_unref);
+  
+  g_hash_table_add (self->gallery_cells, list_item);
+  gallery_cell_update_badge (self, list_item);
+  
+  emerge_thumbnailer_load_async (self->thumbnailer,
+                                 emerge_history_item_get_image_path (item),
+                                 key,
+                                 EMERGE_THUMBNAIL_SMALL * gtk_widget_get_scale_factor (picture),
+                                 cancellable,
+                                 gallery_thumbnail_loaded_cb,
+                                 g_object_ref (list_item));
+  g_free (key);
+}
+
+/* Drop the texture as soon as a cell scrolls away so memory use doesn't
+ * grow with the number of images looked at */
+static void
+gallery_unbind_cb (GtkSignalListItemFactory *factory G_GNUC_UNUSED,
+                   GtkListItem              *list_item,
+                   gpointer                  user_data)
+{
+  EmergeWindow *self = EMERGE_WINDOW (user_data);
+  GCancellable *cancellable = g_object_get_data (G_OBJECT (list_item), "thumbnail-cancellable");
   
-  // Find and select the last used model if it exists
-  if (self->config.last_model_path) {
-    GFile *last_model_file = g_file_new_for_path (self->config.last_model_path);
-    char *basename = g_file_get_basename (last_model_file);
-    
-    // Try to find and select the model in the dropdown
-    GtkStringObject *item;
-    guint n_items = g_list_model_get_n_items (G_LIST_MODEL (self->model_list));
-    
-    for (guint i = 0; i < n_items; i++) {
-      item = g_list_model_get_item (G_LIST_MODEL (self->model_list), i);
-      const char *model_name = gtk_string_object_get_string (item);
-      
-      if (g_strcmp0 (model_name, basename) == 0) {
-        gtk_drop_down_set_selected (self->model_dropdown, i);
-        g_object_unref (item);
-        break;
-      }
-      
-      g_object_unref (item);
-    }
-    
-    g_free (basename);
-    g_object_unref (last_model_file);
-  }
+  if (cancellable != NULL)
+    g_cancellable_cancel (cancellable);
+  g_object_set_data (G_OBJECT (list_item), "thumbnail-cancellable", NULL);
+  
+  g_hash_table_remove (self->gallery_cells, list_item);
+  gtk_picture_set_paintable (gallery_cell_get_picture (list_item), NULL);
 }
 
-static void
-on_model_selected (GtkDropDown *dropdown,
-                  GParamSpec *pspec G_GNUC_UNUSED,
-                  gpointer user_data)
+static gboolean
+gallery_filter_func (gpointer item,
+                     gpointer user_data)
 {
   EmergeWindow *self = EMERGE_WINDOW (user_data);
-  GtkStringObject *selected;
-  const char *model_name;
-  char *model_path;
   
-  // Get the selected model
-  selected = gtk_drop_down_get_selected_item (dropdown);
-  if (!selected) {
+  return self->gallery_duplicates == NULL ||
+         !emerge_duplicates_is_duplicate (self->gallery_duplicates, item);
+}
+
+/* Regroups the search results; the grouping follows the results, so
+ * searching for one prompt collapses just that sweep */
+static void
+emerge_window_update_duplicates (EmergeWindow *self)
+{
+  GHashTableIter iter;
+  gpointer list_item;
+  
+  g_clear_handle_id (&self->duplicates_idle_id, g_source_remove);
+  
+  if (self->gallery_duplicates == NULL &&
+      !gtk_toggle_button_get_active (self->collapse_button))
     return;
-  }
   
-  model_name = gtk_string_object_get_string (selected);
+  g_clear_pointer (&self->gallery_duplicates, emerge_duplicates_free);
+  if (gtk_toggle_button_get_active (self->collapse_button))
+    self->gallery_duplicates = emerge_duplicates_find (G_LIST_MODEL (self->history_index),
+                                                       EMERGE_DEDUPE_DEFAULT_DISTANCE);
   
-  // Construct full path
-  model_path = g_build_filename (self->config.models_directory, model_name, NULL);
+  gtk_filter_changed (GTK_FILTER (self->gallery_filter), GTK_FILTER_CHANGE_DIFFERENT);
   
-  // Update the model path
-  g_free (self->model_path);
-  self->model_path = model_path;
+  /* Cells whose entry is still shown aren't rebound */
+  g_hash_table_iter_init (&iter, self->gallery_cells);
+  while (g_hash_table_iter_next (&iter, &list_item, NULL))
+    gallery_cell_update_badge (self, list_item);
+}
+
+static gboolean
+duplicates_idle_cb (gpointer user_data)
+{
+  EmergeWindow *self = EMERGE_WINDOW (user_data);
   
-  // Update UI state based on model type
-  gboolean is_safetensors = g_str_has_suffix (model_path, ".safetensors");
-  gtk_widget_set_sensitive (GTK_WIDGET (self->convert_model_button), is_safetensors);
-  gtk_widget_set_visible (GTK_WIDGET (self->quantization_dropdown), is_safetensors);
-  gtk_widget_set_visible (GTK_WIDGET (self->quantization_label), is_safetensors);
+  self->duplicates_idle_id = 0;
+  emerge_window_update_duplicates (self);
   
-  // Save the config
-  emerge_window_save_config (self);
+  return G_SOURCE_REMOVE;
 }
 
+/* Regrouping goes over the whole index, so a burst of changes, such as
+ * typing a search, gets one pass once the results have been drawn */
 static void
-convert_model_save_response (GObject *source_object,
-                           GAsyncResult *result,
-                           gpointer user_data)
+emerge_window_queue_update_duplicates (EmergeWindow *self)
+{
+  if (self->duplicates_idle_id == 0 &&
+      (self->gallery_duplicates != NULL ||
+       gtk_toggle_button_get_active (self->collapse_button)))
+    self->duplicates_idle_id = g_idle_add (duplicates_idle_cb, self);
+}
+
+static void
+history_index_changed_cb (GListModel *model G_GNUC_UNUSED,
+                          guint       position G_GNUC_UNUSED,
+                          guint       removed G_GNUC_UNUSED,
+                          guint       added G_GNUC_UNUSED,
+                          gpointer    user_data)
+{
+  emerge_window_queue_update_duplicates (EMERGE_WINDOW (user_data));
+}
+
+static void
+on_collapse_toggled (GtkToggleButton *button G_GNUC_UNUSED,
+                     gpointer         user_data)
+{
+  emerge_window_update_duplicates (EMERGE_WINDOW (user_data));
+}
+
+static void
+history_hashed_cb (GObject      *source_object,
+                   GAsyncResult *result,
+                   gpointer      user_data)
 {
-  EmergeWindow *self = EMERGE_WINDOW (user_data);
-  GtkFileDialog *dialog = GTK_FILE_DIALOG (source_object);
-  GFile *file;
   GError *error = NULL;
-  gchar *output_path;
-  const char *quant_type;
-  gchar *command_line;
-  gchar **argv = NULL;
-  gint argc;
-  gchar *sd_path;
+  guint n_hashed;
   
-  file = gtk_file_dialog_save_finish (dialog, result, &error);
-  if (file == NULL) {
+  n_hashed = emerge_history_hash_finish (EMERGE_HISTORY (source_object), result, &error);
+  if (error != NULL) {
+    /* Cancelled when the window goes away */
     if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
-      g_warning ("Failed to save file: %s", error->message);
+      g_warning ("Failed to hash images: %s", error->message);
     g_error_free (error);
     return;
   }
   
-  output_path = g_file_get_path (file);
-  
-  /* Get quantization type from dropdown */
-  GtkStringObject *selected = gtk_drop_down_get_selected_item (self->quantization_dropdown);
-  quant_type = "q8_0"; /* Default to q8_0 */
-  if (selected) {
-    quant_type = gtk_string_object_get_string (selected);
-  }
-  
-  /* Set up UI for conversion */
-  gtk_spinner_start (self->spinner);
-  gtk_widget_set_visible (GTK_WIDGET (self->spinner), TRUE);
-  gtk_label_set_text (self->status_label, "Converting model...");
-  gtk_widget_set_sensitive (GTK_WIDGET (self->convert_model_button), FALSE);
-  gtk_widget_set_sensitive (GTK_WIDGET (self->model_chooser), FALSE);
-  gtk_widget_set_sensitive (GTK_WIDGET (self->model_dropdown), FALSE);
-  gtk_widget_set_sensitive (GTK_WIDGET (self->model_dir_button), FALSE);
+  if (n_hashed > 0)
+    emerge_window_queue_update_duplicates (EMERGE_WINDOW (user_data));
+}
+
+static void
+dedupe_dialog_response_cb (AdwAlertDialog *dialog,
+                           const char     *response,
+                           gpointer        user_data)
+{
+  EmergeWindow *self = EMERGE_WINDOW (user_data);
+  EmergeDuplicates *duplicates = g_object_get_data (G_OBJECT (dialog), "duplicates");
+  GPtrArray *items = emerge_duplicates_get_items (duplicates);
+  GError *error = NULL;
   
-  /* Find the sd binary in PATH or bin directory */
-  sd_path = find_sd_executable();
+  if (g_strcmp0 (response, "remove") != 0)
+    return;
   
-  if (sd_path == NULL) {
-    // Create a more detailed error message
-    GString *error_msg = g_string_new("Failed to find 'sd' executable. Install paths checked:\n");
-    
-    // Add current directory to the error message
-    gchar *cwd = g_get_current_dir();
-    g_string_append_printf(error_msg, "- %s/bin/sd\n", cwd);
-    g_string_append_printf(error_msg, "- %s/sd\n", cwd);
-    g_free(cwd);
-    
-    // Add paths relative to executable
-    gchar *exe_path = NULL;
-    GFile *exe_file = g_file_new_for_path("/proc/self/exe");
-    if (exe_file) {
-      exe_path = g_file_get_path(exe_file);
-      g_object_unref(exe_file);
-      if (exe_path) {
-        gchar *exe_dir = g_path_get_dirname(exe_path);
-        g_string_append_printf(error_msg, "- %s/bin/sd\n", exe_dir);
-        g_string_append_printf(error_msg, "- %s/sd\n", exe_dir);
-        
-        gchar *parent_dir = g_path_get_dirname(exe_dir);
-        g_string_append_printf(error_msg, "- %s/bin/sd\n", parent_dir);
-        g_string_append_printf(error_msg, "- %s/sd\n", parent_dir);
-        
-        gchar *root_dir = g_path_get_dirname(parent_dir);
-        g_string_append_printf(error_msg, "- %s/bin/sd\n", root_dir);
-        g_string_append_printf(error_msg, "- %s/sd\n", root_dir);
-        
-        g_free(root_dir);
-        g_free(parent_dir);
-        g_free(exe_dir);
-        g_free(exe_path);
-      }
-    }
-    
-    g_string_append(error_msg, "Make sure the 'sd' executable is in one of these locations or in PATH.");
-    
-    gtk_label_set_text (self->status_label, "Failed to find sd");
+  if (!emerge_history_remove (self->history, items, &error)) {
     adw_toast_overlay_add_toast (self->toast_overlay,
-                               adw_toast_new (error_msg->str));
-    g_string_free(error_msg, TRUE);
-    
-    g_free (output_path);
-    g_object_unref (file);
-    // Reset UI (copied from existing error handling)
-    gtk_widget_set_sensitive (GTK_WIDGET (self->convert_model_button), TRUE);
-    gtk_widget_set_sensitive (GTK_WIDGET (self->model_chooser), TRUE);
-    gtk_widget_set_sensitive (GTK_WIDGET (self->model_dropdown), TRUE);
-    gtk_widget_set_sensitive (GTK_WIDGET (self->model_dir_button), TRUE);
-    gtk_spinner_stop (self->spinner);
-    gtk_widget_set_visible (GTK_WIDGET (self->spinner), FALSE);
-    gtk_label_set_text (self->status_label, "Ready");
+                               adw_toast_new_format ("Failed to remove images: %s", error->message));
+    g_error_free (error);
     return;
   }
   
-  /* Prepare the command line */
-  command_line = g_strdup_printf ("\"%s\" -M convert -m \"%s\" -o \"%s\" -v --type %s",
-                                 sd_path,
-                                 self->model_path,
-                                 output_path,
-                                 quant_type);
-  
-  g_free(sd_path);
-  
-  /* Parse the command line */
-  if (!g_shell_parse_argv (command_line, &argc, &argv, &error)) {
-    adw_toast_overlay_add_toast (self->toast_overlay,
-                               adw_toast_new (error->message));
-    g_error_free (error);
-    g_free (command_line);
-    g_strfreev (argv);
-    g_free (output_path);
-    g_object_unref (file);
+  for (guint i = 0; i < items->len; i++) {
+    EmergeHistoryItem *item = g_ptr_array_index (items, i);
+    gchar *key = history_item_thumbnail_key (item);
     
-    /* Reset UI */
-    gtk_widget_set_sensitive (GTK_WIDGET (self->convert_model_button), TRUE);
-    gtk_widget_set_sensitive (GTK_WIDGET (self->model_chooser), TRUE);
-    gtk_widget_set_sensitive (GTK_WIDGET (self->model_dropdown), TRUE);
-    gtk_widget_set_sensitive (GTK_WIDGET (self->model_dir_button), TRUE);
-    gtk_spinner_stop (self->spinner);
-    gtk_widget_set_visible (GTK_WIDGET (self->spinner), FALSE);
-    gtk_label_set_text (self->status_label, "Ready");
+    emerge_thumbnailer_remove (self->thumbnailer, key);
+    emerge_texture_cache_remove (self->texture_cache, emerge_history_item_get_image_path (item));
+    g_free (key);
     
-    return;
+    /* The image on display may have been one of them */
+    if (g_strcmp0 (self->output_path, emerge_history_item_get_image_path (item)) == 0) {
+      g_clear_pointer (&self->output_path, g_free);
+      g_clear_object (&self->viewed_item);
+      gtk_picture_set_paintable (self->output_image, NULL);
+      emerge_image_viewer_clear (self->tiled_viewer);
+      gtk_widget_set_visible (GTK_WIDGET (self->save_button), FALSE);
+    }
   }
   
-  /* Start the process */
-  self->cancellable = g_cancellable_new ();
+  adw_toast_overlay_add_toast (self->toast_overlay,
+                             adw_toast_new_format ("Removed %u near-duplicate images", items->len));
+}
+
+/* Deletes every shown image that is a near-duplicate of a newer shown one;
+ * search first to limit it to one batch */
+static void
+on_dedupe_clicked (GtkButton *button G_GNUC_UNUSED,
+                   gpointer   user_data)
+{
+  EmergeWindow *self = EMERGE_WINDOW (user_data);
+  EmergeDuplicates *duplicates;
+  AdwDialog *dialog;
+  guint n_duplicates, n_shown;
+  gchar *body;
+  
+  duplicates = emerge_duplicates_find (G_LIST_MODEL (self->history_index),
+                                       EMERGE_DEDUPE_DEFAULT_DISTANCE);
+  n_duplicates = emerge_duplicates_get_items (duplicates)->len;
+  n_shown = g_list_model_get_n_items (G_LIST_MODEL (self->history_index));
   
-  if (!g_spawn_async_with_pipes (NULL, argv, NULL, 
-                                G_SPAWN_SEARCH_PATH | G_SPAWN_DO_NOT_REAP_CHILD,
-                                NULL, NULL, &self->child_pid, 
-                                NULL, NULL, NULL, &error)) {
+  if (n_duplicates == 0) {
     adw_toast_overlay_add_toast (self->toast_overlay,
-                               adw_toast_new (error->message));
-    g_error_free (error);
-    g_free (command_line);
-    g_strfreev (argv);
-    g_free (output_path);
-    g_object_unref (file);
-    
-    /* Reset UI */
-    gtk_widget_set_sensitive (GTK_WIDGET (self->convert_model_button), TRUE);
-    gtk_widget_set_sensitive (GTK_WIDGET (self->model_chooser), TRUE);
-    gtk_widget_set_sensitive (GTK_WIDGET (self->model_dropdown), TRUE);
-    gtk_widget_set_sensitive (GTK_WIDGET (self->model_dir_button), TRUE);
-    gtk_spinner_stop (self->spinner);
-    gtk_widget_set_visible (GTK_WIDGET (self->spinner), FALSE);
-    gtk_label_set_text (self->status_label, "Ready");
-    
+                               adw_toast_new ("No near-duplicates among these images"));
+    emerge_duplicates_free (duplicates);
     return;
   }
   
-  g_free (command_line);
-  g_strfreev (argv);
-  g_free (output_path);
-  g_object_unref (file);
+  body = g_strdup_printf ("%u of the %u images shown are near-duplicates of a newer one. "
+                          "The newest image of each group is kept.",
+                          n_duplicates, n_shown);
+  dialog = adw_alert_dialog_new ("Remove Duplicates?", body);
+  g_free (body);
   
-  /* Monitor the process */
-  self->child_watch_id = g_child_watch_add (self->child_pid, 
-                                          convert_process_finished_cb, self);
+  g_object_set_data_full (G_OBJECT (dialog), "duplicates", duplicates,
+                          (GDestroyNotify) emerge_duplicates_free);
+  
+  adw_alert_dialog_add_responses (ADW_ALERT_DIALOG (dialog),
+                                  "cancel", "_Cancel",
+                                  "remove", "_Remove",
+                                  NULL);
+  adw_alert_dialog_set_response_appearance (ADW_ALERT_DIALOG (dialog),
+                                            "remove", ADW_RESPONSE_DESTRUCTIVE);
+  adw_alert_dialog_set_default_response (ADW_ALERT_DIALOG (dialog), "cancel");
+  adw_alert_dialog_set_close_response (ADW_ALERT_DIALOG (dialog), "cancel");
+  
+  g_signal_connect (dialog, "response",
+                    G_CALLBACK (dedupe_dialog_response_cb), self);
+  
+  adw_dialog_present (dialog, GTK_WIDGET (self));
 }
 
 static void
-on_convert_model_clicked (GtkButton *button G_GNUC_UNUSED,
-                        gpointer   user_data)
+on_gallery_activate (GtkGridView *view,
+                     guint        position,
+                     gpointer     user_data)
 {
   EmergeWindow *self = EMERGE_WINDOW (user_data);
-  GtkFileDialog *dialog;
-  GtkFileFilter *filter;
-  GListStore *filters;
-  gchar *suggested_filename;
+  EmergeHistoryItem *item;
   
-  /* Check if a model has been selected */
-  if (self->model_path == NULL) {
-    adw_toast_overlay_add_toast (self->toast_overlay,
-                               adw_toast_new ("Please select a model file first"));
+  item = g_list_model_get_item (G_LIST_MODEL (gtk_grid_view_get_model (view)), position);
+  if (item == NULL)
     return;
-  }
   
-  /* Check if it's a safetensors file */
-  if (!g_str_has_suffix (self->model_path, ".safetensors")) {
-    adw_toast_overlay_add_toast (self->toast_overlay,
-                               adw_toast_new ("Only .safetensors files can be converted"));
+  self->viewed_backwards = FALSE;
+  emerge_window_view_item (self, item, position);
+  gtk_toggle_button_set_active (self->history_button, FALSE);
+  
+  g_object_unref (item);
+}
+
+static void
+on_gallery_search_changed (GtkSearchEntry *entry,
+                           gpointer        user_data)
+{
+  EmergeWindow *self = EMERGE_WINDOW (user_data);
+  
+  emerge_history_index_set_query (self->history_index,
+                                  gtk_editable_get_text (GTK_EDITABLE (entry)));
+}
+
+static void
+on_history_toggled (GtkToggleButton *button,
+                    gpointer         user_data)
+{
+  EmergeWindow *self = EMERGE_WINDOW (user_data);
+  
+  gtk_stack_set_visible_child_name (self->output_stack,
+                                    gtk_toggle_button_get_active (button) ? "gallery" : "image");
+}
+
+static void
+history_loaded_cb (GObject      *source_object,
+                   GAsyncResult *result,
+                   gpointer      user_data)
+{
+  EmergeHistory *history = EMERGE_HISTORY (source_object);
+  GError *error = NULL;
+  
+  if (!emerge_history_load_finish (history, result, &error)) {
+    if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+      g_warning ("Failed to load history: %s", error->message);
+    g_error_free (error);
     return;
   }
   
-  /* Get quantization type for suggested filename */
-  GtkStringObject *selected = gtk_drop_down_get_selected_item (self->quantization_dropdown);
-  const char *quant_type = "q8_0"; /* Default to q8_0 */
-  if (selected) {
-    quant_type = gtk_string_object_get_string (selected);
-  }
+  g_print ("Loaded %u past images\n", g_list_model_get_n_items (G_LIST_MODEL (history)));
   
-  /* Create file save dialog */
-  dialog = gtk_file_dialog_new();
-  gtk_file_dialog_set_title(dialog, "Save Converted Model");
+  /* Hash whatever was added before hashing existed, or before a crash */
+  emerge_history_hash_async (history, EMERGE_WINDOW (user_data)->history_cancellable,
+                             history_hashed_cb, user_data);
+}
+
+/* Runs once the window has been drawn, so none of it delays the first
+ * frame */
+static gboolean
+startup_idle_cb (gpointer user_data)
+{
+  EmergeWindow *self = EMERGE_WINDOW (user_data);
+  GError *error = NULL;
   
-  /* Get base filename without the extension */
-  gchar *basename = g_path_get_basename(self->model_path);
-  gchar *base_without_ext = g_strndup(basename, strlen(basename) - strlen(".safetensors"));
+  self->startup_idle_id = 0;
   
-  /* Set default name */
-  suggested_filename = g_strdup_printf("%s.%s.gguf", base_without_ext, quant_type);
-  gtk_file_dialog_set_initial_name(dialog, suggested_filename);
-  g_free(suggested_filename);
-  g_free(base_without_ext);
-  g_free(basename);
+  populate_model_dropdown (self);
+  emerge_startup_mark ("models listed");
   
-  /* Set initial folder to same directory as source model */
-  gchar *dir_path = g_path_get_dirname(self->model_path);
-  GFile *initial_folder = g_file_new_for_path(dir_path);
-  gtk_file_dialog_set_initial_folder(dialog, initial_folder);
-  g_object_unref(initial_folder);
-  g_free(dir_path);
+  /* Found now so the first generation doesn't go looking for it */
+  g_free (emerge_sd_find_executable ());
+  emerge_startup_mark ("sd found");
   
-  /* Set up filter for GGUF files */
-  filter = gtk_file_filter_new();
-  gtk_file_filter_set_name(filter, "GGUF Model Files");
-  gtk_file_filter_add_pattern(filter, "*.gguf");
+  if (!emerge_cost_model_load (self->cost_model, &error)) {
+    g_warning ("Failed to load job timings: %s", error->message);
+    g_error_free (error);
+  } else {
+    g_print ("Predicting job times from %u past runs\n",
+             emerge_cost_model_get_n_runs (self->cost_model));
+  }
+  emerge_window_update_queue_eta (self);
+  emerge_startup_mark ("timings loaded");
   
-  filters = g_list_store_new(GTK_TYPE_FILE_FILTER);
-  g_list_store_append(filters, filter);
-  gtk_file_dialog_set_filters(dialog, G_LIST_MODEL(filters));
+  self->queue_held = FALSE;
+  emerge_window_run_queue (self);
   
-  /* Show the save dialog */
-  gtk_file_dialog_save(dialog,
-                      GTK_WINDOW(self),
-                      NULL,  /* cancellable */
-                      convert_model_save_response,
-                      self);
+  emerge_startup_report ("first frame");
   
-  g_object_unref(dialog);
-  g_object_unref(filter);
-  g_object_unref(filters);
+  return G_SOURCE_REMOVE;
+}
+
+static void
+first_frame_cb (GdkFrameClock *frame_clock,
+                gpointer       user_data)
+{
+  EmergeWindow *self = EMERGE_WINDOW (user_data);
+  
+  g_signal_handlers_disconnect_by_func (frame_clock, first_frame_cb, self);
+  emerge_startup_mark ("first frame");
+  
+  self->startup_idle_id = g_idle_add (startup_idle_cb, self);
+}
+
+static void
+window_map_cb (GtkWidget *widget,
+               gpointer   user_data G_GNUC_UNUSED)
+{
+  g_signal_handlers_disconnect_by_func (widget, window_map_cb, NULL);
+  g_signal_connect_object (gtk_widget_get_frame_clock (widget), "after-paint",
+                           G_CALLBACK (first_frame_cb), widget, 0);
 }
 
 static void
@@ -1702,13 +4995,28 @@ emerge_window_init (EmergeWindow *self)
   GtkStringList *quant_types;
   GSimpleAction *save_template_action;
   GSimpleAction *load_template_action;
+  GSimpleAction *watch_folder_action;
+  GSimpleAction *queue_sweep_action;
+  GSimpleAction *stop_watching_action;
+  GSimpleAction *previous_image_action;
+  GSimpleAction *next_image_action;
+  GSimpleAction *refine_image_action;
+  GtkShortcutController *image_shortcuts;
+  GtkListItemFactory *gallery_factory;
+  GtkSelectionModel *gallery_model;
+  GtkFilterListModel *gallery_filtered;
   
   gtk_widget_init_template (GTK_WIDGET (self));
+  emerge_startup_mark ("template built");
   
   self->is_generating = FALSE;
-  self->child_pid = 0;
-  self->child_watch_id = 0;
-  self->cancellable = NULL;
+  self->process_manager = emerge_process_manager_new ();
+  self->generate_process = NULL;
+  self->convert_process = NULL;
+  self->batch_convert = NULL;
+  self->quant_bench = NULL;
+  self->benchmark = NULL;
+  self->generate_job = NULL;
   self->output_path = NULL;
   self->model_path = NULL;
   self->initial_image_path = NULL;
@@ -1717,6 +5025,7 @@ emerge_window_init (EmergeWindow *self)
   self->last_template_dir = NULL;
   self->models_directory = NULL;
   self->model_list = NULL;
+  self->preload = NULL;
   
   // Initialize config structure
   self->config.models_directory = NULL;
@@ -1725,7 +5034,9 @@ emerge_window_init (EmergeWindow *self)
   self->config.last_template_directory = NULL;
   
   // Load configuration
+  self->store = emerge_store_new (EMERGE_STORE_DEFAULT_DELAY_MS);
   emerge_window_load_config (self);
+  emerge_startup_mark ("config loaded");
   
   // Setup models directory if we have one
   if (self->config.models_directory) {
@@ -1741,12 +5052,87 @@ emerge_window_init (EmergeWindow *self)
   g_signal_connect (self->model_dir_button, "clicked",
                   G_CALLBACK (on_model_dir_button_clicked), self);
   
+  // Edits that redraw the live preview
+  g_signal_connect_swapped (self->prompt_entry, "changed",
+                            G_CALLBACK (on_live_param_changed), self);
+  g_signal_connect_swapped (self->negative_prompt_entry, "changed",
+                            G_CALLBACK (on_live_param_changed), self);
+  g_signal_connect_swapped (self->cfg_scale_spin, "value-changed",
+                            G_CALLBACK (on_live_param_changed), self);
+  g_signal_connect_swapped (self->seed_spin, "value-changed",
+                            G_CALLBACK (on_live_param_changed), self);
+  
   // Connect model dropdown selection change
   g_signal_connect (self->model_dropdown, "notify::selected-item",
                   G_CALLBACK (on_model_selected), self);
   
-  // Populate model dropdown
-  populate_model_dropdown (self);
+  /* The models folder may be large or on a slow disk, so it is only
+   * listed once the window is up */
+  g_signal_connect (self, "map", G_CALLBACK (window_map_cb), NULL);
+  
+  /* Past images live next to the config; the index is read in the background */
+  gchar *config_dir = get_config_dir_path ();
+  gchar *history_dir = g_build_filename (config_dir, "history", NULL);
+  gchar *thumbnails_dir = g_build_filename (history_dir, "thumbnails", NULL);
+  self->history = emerge_history_new (history_dir);
+  self->thumbnailer = emerge_thumbnailer_new (thumbnails_dir, 0);
+  self->texture_cache = emerge_texture_cache_new (EMERGE_TEXTURE_CACHE_DEFAULT_BUDGET,
+                                                  EMERGE_IMAGE_VIEWER_MIN_SIZE);
+  self->history_index = emerge_history_index_new (self->history);
+  self->history_cancellable = g_cancellable_new ();
+  emerge_history_load_async (self->history, self->history_cancellable,
+                             history_loaded_cb, self);
+  g_free (thumbnails_dir);
+  g_free (history_dir);
+  
+  /* Past job timings too, though only once the window is up */
+  gchar *timings_path = g_build_filename (config_dir, "timings.jsonl", NULL);
+  self->cost_model = emerge_cost_model_new (timings_path, NULL);
+  g_free (timings_path);
+  
+  /* So is the queue; whatever a crash or logout interrupted picks up
+   * where it was once the window is up */
+  gchar *journal_path = g_build_filename (config_dir, "queue.journal", NULL);
+  GError *queue_error = NULL;
+  self->queue = emerge_queue_new (journal_path);
+  self->queue_held = TRUE;
+  g_signal_connect (self->queue, "changed", G_CALLBACK (queue_changed_cb), self);
+  if (!emerge_queue_load (self->queue, &queue_error)) {
+    g_warning ("Failed to load the queue: %s", queue_error->message);
+    g_error_free (queue_error);
+  } else if (emerge_queue_get_n_pending (self->queue) > 0) {
+    gchar *text = g_strdup_printf ("Resuming %u queued jobs (%u already done)",
+                                   emerge_queue_get_n_pending (self->queue),
+                                   emerge_queue_get_n_finished (self->queue));
+    
+    g_print ("%s\n", text);
+    adw_toast_overlay_add_toast (self->toast_overlay, adw_toast_new (text));
+    g_free (text);
+  }
+  g_free (journal_path);
+  g_free (config_dir);
+  emerge_startup_mark ("history and queue set up");
+  
+  gallery_factory = gtk_signal_list_item_factory_new ();
+  g_signal_connect (gallery_factory, "setup", G_CALLBACK (gallery_setup_cb), self);
+  g_signal_connect (gallery_factory, "bind", G_CALLBACK (gallery_bind_cb), self);
+  g_signal_connect (gallery_factory, "unbind", G_CALLBACK (gallery_unbind_cb), self);
+  self->gallery_cells = g_hash_table_new (NULL, NULL);
+  self->converged_steps = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  self->gallery_filter = gtk_custom_filter_new (gallery_filter_func, self, NULL);
+  gallery_filtered = gtk_filter_list_model_new (g_object_ref (G_LIST_MODEL (self->history_index)),
+                                                GTK_FILTER (g_object_ref (self->gallery_filter)));
+  /* Connected after the filter model, so it has seen the change when the
+   * groups are redone */
+  g_signal_connect (self->history_index, "items-changed",
+                    G_CALLBACK (history_index_changed_cb), self);
+  gallery_model = GTK_SELECTION_MODEL (gtk_no_selection_new (G_LIST_MODEL (gallery_filtered)));
+  gtk_grid_view_set_factory (self->gallery_view, gallery_factory);
+  gtk_grid_view_set_model (self->gallery_view, gallery_model);
+  g_signal_connect (gallery_model, "items-changed",
+                    G_CALLBACK (gallery_model_changed_cb), self);
+  g_object_unref (gallery_factory);
+  g_object_unref (gallery_model);
   
   /* Initialize UI values */
   gtk_spin_button_set_value (self->width_spin, 512);
@@ -1757,16 +5143,7 @@ emerge_window_init (EmergeWindow *self)
   gtk_spin_button_set_value (self->strength_spin, 0.75);
   
   /* Set up the sampling method dropdown */
-  sampling_methods = gtk_string_list_new (NULL);
-  
-  gtk_string_list_append (sampling_methods, "euler");
-  gtk_string_list_append (sampling_methods, "euler_a");
-  gtk_string_list_append (sampling_methods, "heun");
-  gtk_string_list_append (sampling_methods, "dpm2");
-  gtk_string_list_append (sampling_methods, "dpm++2s_a");
-  gtk_string_list_append (sampling_methods, "dpm++2m");
-  gtk_string_list_append (sampling_methods, "dpm++2mv2");
-  gtk_string_list_append (sampling_methods, "lcm");
+  sampling_methods = gtk_string_list_new (emerge_sd_sampling_methods);
   
   gtk_drop_down_set_model (self->sampling_method_dropdown, G_LIST_MODEL (sampling_methods));
   gtk_drop_down_set_selected (self->sampling_method_dropdown, 1); /* Default to euler_a */
@@ -1778,8 +5155,15 @@ emerge_window_init (EmergeWindow *self)
   gtk_widget_set_visible (GTK_WIDGET (self->initial_image_chooser), FALSE);
   gtk_widget_set_visible (GTK_WIDGET (self->strength_spin), FALSE);
   
-  /* Hide stop button and spinner by default */
+  /* And the preview and upscaler ones */
+  gtk_widget_set_visible (self->preview_interval_row, FALSE);
+  gtk_widget_set_visible (GTK_WIDGET (self->early_stop_toggle), FALSE);
+  gtk_widget_set_visible (GTK_WIDGET (self->upscale_model_chooser), FALSE);
+  gtk_widget_set_visible (self->upscale_tile_row, FALSE);
+  
+  /* Hide stop and pause buttons and spinner by default */
   gtk_widget_set_visible (GTK_WIDGET (self->stop_button), FALSE);
+  gtk_widget_set_visible (GTK_WIDGET (self->pause_button), FALSE);
   gtk_widget_set_visible (GTK_WIDGET (self->spinner), FALSE);
   
   /* Hide save button by default (until we have an image) */
@@ -1794,11 +5178,8 @@ emerge_window_init (EmergeWindow *self)
   
   /* Set up quantization options for GGUF conversion */
   quant_types = gtk_string_list_new (NULL);
-  const char * const quant_type_names[] = {
-    "f16", "f32", "q8_0", "q5_0", "q5_1", "q4_0", "q4_1", NULL
-  };
-  for (int i = 0; quant_type_names[i] != NULL; i++) {
-    gtk_string_list_append (quant_types, quant_type_names[i]);
+  for (int i = 0; emerge_sd_quant_types[i] != NULL; i++) {
+    gtk_string_list_append (quant_types, emerge_sd_quant_types[i]);
   }
   gtk_drop_down_set_model (self->quantization_dropdown, G_LIST_MODEL (quant_types));
   /* Default to q8_0 (index 2) */
@@ -1813,6 +5194,56 @@ emerge_window_init (EmergeWindow *self)
   load_template_action = g_simple_action_new ("load-template", NULL);
   g_signal_connect_swapped (load_template_action, "activate", G_CALLBACK (on_load_template_clicked), self);
   g_action_map_add_action (G_ACTION_MAP (self), G_ACTION (load_template_action));
+  
+  watch_folder_action = g_simple_action_new ("watch-folder", NULL);
+  g_signal_connect_swapped (watch_folder_action, "activate", G_CALLBACK (on_watch_folder), self);
+  g_action_map_add_action (G_ACTION_MAP (self), G_ACTION (watch_folder_action));
+  g_object_unref (watch_folder_action);
+  
+  queue_sweep_action = g_simple_action_new ("queue-sweep", NULL);
+  g_signal_connect_swapped (queue_sweep_action, "activate", G_CALLBACK (on_queue_sweep), self);
+  g_action_map_add_action (G_ACTION_MAP (self), G_ACTION (queue_sweep_action));
+  g_object_unref (queue_sweep_action);
+  
+  stop_watching_action = g_simple_action_new ("stop-watching", NULL);
+  g_signal_connect_swapped (stop_watching_action, "activate", G_CALLBACK (on_stop_watching), self);
+  g_simple_action_set_enabled (stop_watching_action, FALSE);
+  g_action_map_add_action (G_ACTION_MAP (self), G_ACTION (stop_watching_action));
+  g_object_unref (stop_watching_action);
+  
+  /* Stepping through the gallery results from the image view */
+  previous_image_action = g_simple_action_new ("previous-image", NULL);
+  g_signal_connect_swapped (previous_image_action, "activate", G_CALLBACK (on_previous_image), self);
+  g_simple_action_set_enabled (previous_image_action, FALSE);
+  g_action_map_add_action (G_ACTION_MAP (self), G_ACTION (previous_image_action));
+  g_object_unref (previous_image_action);
+  
+  next_image_action = g_simple_action_new ("next-image", NULL);
+  g_signal_connect_swapped (next_image_action, "activate", G_CALLBACK (on_next_image), self);
+  g_simple_action_set_enabled (next_image_action, FALSE);
+  g_action_map_add_action (G_ACTION_MAP (self), G_ACTION (next_image_action));
+  g_object_unref (next_image_action);
+  
+  /* Second pass over a draft; only enabled while one is shown */
+  refine_image_action = g_simple_action_new ("refine-image", NULL);
+  g_signal_connect_swapped (refine_image_action, "activate", G_CALLBACK (on_refine_image), self);
+  g_simple_action_set_enabled (refine_image_action, FALSE);
+  g_action_map_add_action (G_ACTION_MAP (self), G_ACTION (refine_image_action));
+  g_object_unref (refine_image_action);
+  
+  /* The arrow keys work whenever the image is shown and nothing focused,
+   * such as a text entry, uses them itself */
+  image_shortcuts = GTK_SHORTCUT_CONTROLLER (gtk_shortcut_controller_new ());
+  gtk_shortcut_controller_set_scope (image_shortcuts, GTK_SHORTCUT_SCOPE_MANAGED);
+  gtk_shortcut_controller_add_shortcut (image_shortcuts,
+                                        gtk_shortcut_new (gtk_keyval_trigger_new (GDK_KEY_Left, 0),
+                                                          gtk_named_action_new ("win.previous-image")));
+  gtk_shortcut_controller_add_shortcut (image_shortcuts,
+                                        gtk_shortcut_new (gtk_keyval_trigger_new (GDK_KEY_Right, 0),
+                                                          gtk_named_action_new ("win.next-image")));
+  gtk_widget_add_controller (self->image_view, GTK_EVENT_CONTROLLER (image_shortcuts));
+  
+  emerge_startup_mark ("window built");
 }
 
 static void
@@ -1894,6 +5325,16 @@ save_template_to_file (EmergeWindow *self, const char *filepath)
   json_builder_set_member_name (builder, "strength");
   json_builder_add_double_value (builder, gtk_spin_button_get_value (self->strength_spin));
   
+  // Add upscaling settings
+  json_builder_set_member_name (builder, "upscale_model");
+  if (adw_switch_row_get_active (self->upscale_toggle) && self->upscale_model_path != NULL)
+    json_builder_add_string_value (builder, self->upscale_model_path);
+  else
+    json_builder_add_null_value (builder);
+  
+  json_builder_set_member_name (builder, "upscale_tile_size");
+  json_builder_add_int_value (builder, (int) gtk_spin_button_get_value (self->upscale_tile_spin));
+  
   json_builder_end_object(builder);
   
   // Generate JSON data
@@ -1927,12 +5368,23 @@ emerge_window_class_init (EmergeWindowClass *klass)
   
   object_class->finalize = emerge_window_finalize;
   
+  g_type_ensure (EMERGE_TYPE_IMAGE_VIEWER);
   gtk_widget_class_set_template_from_resource (widget_class, "/com/github/emerge/window.ui");
   
   gtk_widget_class_bind_template_child (widget_class, EmergeWindow, header_bar);
   gtk_widget_class_bind_template_child (widget_class, EmergeWindow, output_image);
+  gtk_widget_class_bind_template_child (widget_class, EmergeWindow, output_stack);
+  gtk_widget_class_bind_template_child (widget_class, EmergeWindow, image_view);
+  gtk_widget_class_bind_template_child (widget_class, EmergeWindow, image_stack);
+  gtk_widget_class_bind_template_child (widget_class, EmergeWindow, tiled_viewer);
+  gtk_widget_class_bind_template_child (widget_class, EmergeWindow, gallery_view);
+  gtk_widget_class_bind_template_child (widget_class, EmergeWindow, gallery_search);
+  gtk_widget_class_bind_template_child (widget_class, EmergeWindow, history_button);
+  gtk_widget_class_bind_template_child (widget_class, EmergeWindow, collapse_button);
+  gtk_widget_class_bind_template_child (widget_class, EmergeWindow, dedupe_button);
   gtk_widget_class_bind_template_child (widget_class, EmergeWindow, prompt_entry);
   gtk_widget_class_bind_template_child (widget_class, EmergeWindow, negative_prompt_entry);
+  gtk_widget_class_bind_template_child (widget_class, EmergeWindow, live_toggle);
   gtk_widget_class_bind_template_child (widget_class, EmergeWindow, width_spin);
   gtk_widget_class_bind_template_child (widget_class, EmergeWindow, height_spin);
   gtk_widget_class_bind_template_child (widget_class, EmergeWindow, steps_spin);
@@ -1940,7 +5392,12 @@ emerge_window_class_init (EmergeWindowClass *klass)
   gtk_widget_class_bind_template_child (widget_class, EmergeWindow, cfg_scale_spin);
   gtk_widget_class_bind_template_child (widget_class, EmergeWindow, sampling_method_dropdown);
   gtk_widget_class_bind_template_child (widget_class, EmergeWindow, generate_button);
+  gtk_widget_class_bind_template_child (widget_class, EmergeWindow, draft_button);
+  gtk_widget_class_bind_template_child (widget_class, EmergeWindow, batch_count_spin);
+  gtk_widget_class_bind_template_child (widget_class, EmergeWindow, queue_button);
+  gtk_widget_class_bind_template_child (widget_class, EmergeWindow, queue_button_content);
   gtk_widget_class_bind_template_child (widget_class, EmergeWindow, stop_button);
+  gtk_widget_class_bind_template_child (widget_class, EmergeWindow, pause_button);
   gtk_widget_class_bind_template_child (widget_class, EmergeWindow, save_button);
   gtk_widget_class_bind_template_child (widget_class, EmergeWindow, spinner);
   gtk_widget_class_bind_template_child (widget_class, EmergeWindow, toast_overlay);
@@ -1950,6 +5407,14 @@ emerge_window_class_init (EmergeWindowClass *klass)
   gtk_widget_class_bind_template_child (widget_class, EmergeWindow, initial_image_chooser);
   gtk_widget_class_bind_template_child (widget_class, EmergeWindow, img2img_toggle);
   gtk_widget_class_bind_template_child (widget_class, EmergeWindow, strength_spin);
+  gtk_widget_class_bind_template_child (widget_class, EmergeWindow, preview_toggle);
+  gtk_widget_class_bind_template_child (widget_class, EmergeWindow, preview_interval_row);
+  gtk_widget_class_bind_template_child (widget_class, EmergeWindow, preview_interval_spin);
+  gtk_widget_class_bind_template_child (widget_class, EmergeWindow, early_stop_toggle);
+  gtk_widget_class_bind_template_child (widget_class, EmergeWindow, upscale_toggle);
+  gtk_widget_class_bind_template_child (widget_class, EmergeWindow, upscale_model_chooser);
+  gtk_widget_class_bind_template_child (widget_class, EmergeWindow, upscale_tile_row);
+  gtk_widget_class_bind_template_child (widget_class, EmergeWindow, upscale_tile_spin);
   gtk_widget_class_bind_template_child (widget_class, EmergeWindow, status_label);
   gtk_widget_class_bind_template_child (widget_class, EmergeWindow, convert_model_button);
   gtk_widget_class_bind_template_child (widget_class, EmergeWindow, quantization_dropdown);
@@ -1957,16 +5422,37 @@ emerge_window_class_init (EmergeWindowClass *klass)
   gtk_widget_class_bind_template_child (widget_class, EmergeWindow, template_menu_button);
   gtk_widget_class_bind_template_child (widget_class, EmergeWindow, model_dropdown);
   gtk_widget_class_bind_template_child (widget_class, EmergeWindow, model_dir_button);
+  gtk_widget_class_bind_template_child (widget_class, EmergeWindow, batch_convert_button);
+  gtk_widget_class_bind_template_child (widget_class, EmergeWindow, quant_bench_button);
+  gtk_widget_class_bind_template_child (widget_class, EmergeWindow, benchmark_button);
+  gtk_widget_class_bind_template_child (widget_class, EmergeWindow, conversion_row);
+  gtk_widget_class_bind_template_child (widget_class, EmergeWindow, conversion_progress);
   
   gtk_widget_class_bind_template_callback (widget_class, on_generate_clicked);
+  gtk_widget_class_bind_template_callback (widget_class, on_draft_clicked);
+  gtk_widget_class_bind_template_callback (widget_class, on_queue_clicked);
   gtk_widget_class_bind_template_callback (widget_class, on_stop_clicked);
+  gtk_widget_class_bind_template_callback (widget_class, on_pause_clicked);
   gtk_widget_class_bind_template_callback (widget_class, on_save_clicked);
   gtk_widget_class_bind_template_callback (widget_class, on_model_file_select);
   gtk_widget_class_bind_template_callback (widget_class, on_initial_image_file_select);
   gtk_widget_class_bind_template_callback (widget_class, on_img2img_toggled);
+  gtk_widget_class_bind_template_callback (widget_class, on_preview_toggled);
+  gtk_widget_class_bind_template_callback (widget_class, on_upscale_toggled);
+  gtk_widget_class_bind_template_callback (widget_class, on_live_toggled);
+  gtk_widget_class_bind_template_callback (widget_class, on_upscale_model_select);
   gtk_widget_class_bind_template_callback (widget_class, on_advanced_settings_toggled);
   gtk_widget_class_bind_template_callback (widget_class, on_convert_model_clicked);
   gtk_widget_class_bind_template_callback (widget_class, on_model_dir_button_clicked);
+  gtk_widget_class_bind_template_callback (widget_class, on_conversion_cancel_clicked);
+  gtk_widget_class_bind_template_callback (widget_class, on_batch_convert_clicked);
+  gtk_widget_class_bind_template_callback (widget_class, on_quant_bench_clicked);
+  gtk_widget_class_bind_template_callback (widget_class, on_benchmark_clicked);
+  gtk_widget_class_bind_template_callback (widget_class, on_history_toggled);
+  gtk_widget_class_bind_template_callback (widget_class, on_gallery_activate);
+  gtk_widget_class_bind_template_callback (widget_class, on_gallery_search_changed);
+  gtk_widget_class_bind_template_callback (widget_class, on_collapse_toggled);
+  gtk_widget_class_bind_template_callback (widget_class, on_dedupe_clicked);
 }
 
 static void
@@ -1974,27 +5460,94 @@ emerge_window_finalize (GObject *object)
 {
   EmergeWindow *self = EMERGE_WINDOW (object);
   
-  if (self->child_pid != 0) {
-    kill (self->child_pid, SIGTERM);
-    g_spawn_close_pid (self->child_pid);
-    g_source_remove (self->child_watch_id);
+  /* Stop every child we started, not just the current generation */
+  if (self->generate_process)
+    g_signal_handlers_disconnect_by_data (self->generate_process, self);
+  if (self->convert_process)
+    g_signal_handlers_disconnect_by_data (self->convert_process, self);
+  g_clear_object (&self->generate_process);
+  g_clear_object (&self->convert_process);
+  if (self->batch_convert) {
+    g_signal_handlers_disconnect_by_data (self->batch_convert, self);
+    emerge_batch_convert_cancel (self->batch_convert);
+    g_clear_object (&self->batch_convert);
   }
-  
-  // Clean up temporary directory
-  const gchar *temp_dir = g_get_tmp_dir();
-  gchar *emerge_temp_dir = g_build_filename(temp_dir, "emerge-temp", NULL);
-  
-  // Remove contents of directory
-  if (g_file_test(emerge_temp_dir, G_FILE_TEST_IS_DIR)) {
-    remove_directory_contents(emerge_temp_dir);
-    // Try to remove the directory itself
-    rmdir(emerge_temp_dir);
+  if (self->quant_bench) {
+    g_signal_handlers_disconnect_by_data (self->quant_bench, self);
+    emerge_quant_bench_cancel (self->quant_bench);
+    g_clear_object (&self->quant_bench);
+  }
+  if (self->benchmark) {
+    g_signal_handlers_disconnect_by_data (self->benchmark, self);
+    emerge_benchmark_cancel (self->benchmark);
+    g_clear_object (&self->benchmark);
+  }
+  if (self->upscale) {
+    g_signal_handlers_disconnect_by_data (self->upscale, self);
+    emerge_upscale_cancel (self->upscale);
+    g_clear_object (&self->upscale);
+  }
+  g_free (self->upscale_output_path);
+  g_clear_handle_id (&self->live_timeout_id, g_source_remove);
+  if (self->live_process)
+    g_signal_handlers_disconnect_by_data (self->live_process, self);
+  g_clear_object (&self->live_process);
+  g_free (self->live_output_path);
+  g_clear_pointer (&self->preempted, g_ptr_array_unref);
+  
+  /* Wait for them too, so none is left behind as a zombie or still writing
+   * into the temporary directory as it is removed below */
+  emerge_process_manager_shutdown (self->process_manager, EMERGE_WINDOW_SHUTDOWN_TIMEOUT_MS);
+  g_clear_object (&self->process_manager);
+  
+  /* Settings changed in the last moments still make it to disk */
+  g_clear_pointer (&self->store, emerge_store_free);
+  
+  /* A job cut off here is still in the journal and runs again next time */
+  if (self->hot_folder != NULL)
+    emerge_hot_folder_stop (self->hot_folder);
+  g_clear_object (&self->hot_folder);
+  g_clear_object (&self->hot_folder_input);
+  emerge_window_clear_sweep (self);
+  g_clear_handle_id (&self->startup_idle_id, g_source_remove);
+  g_clear_handle_id (&self->queue_idle_id, g_source_remove);
+  if (self->queue != NULL)
+    g_signal_handlers_disconnect_by_data (self->queue, self);
+  g_clear_object (&self->queue);
+  g_clear_pointer (&self->cost_model, emerge_cost_model_free);
+  g_clear_pointer (&self->generate_job, emerge_job_unref);
+  g_cancellable_cancel (self->history_cancellable);
+  g_clear_object (&self->history_cancellable);
+  g_cancellable_cancel (self->show_cancellable);
+  g_clear_object (&self->show_cancellable);
+  g_clear_pointer (&self->show_path, g_free);
+  g_cancellable_cancel (self->preview_cancellable);
+  g_clear_object (&self->preview_cancellable);
+  g_clear_pointer (&self->convergence, emerge_convergence_free);
+  g_clear_pointer (&self->converged_steps, g_hash_table_unref);
+  g_clear_object (&self->viewed_item);
+  g_clear_object (&self->texture_cache);
+  g_signal_handlers_disconnect_by_data (self->history_index, self);
+  g_clear_handle_id (&self->duplicates_idle_id, g_source_remove);
+  g_clear_pointer (&self->gallery_duplicates, emerge_duplicates_free);
+  g_clear_pointer (&self->gallery_cells, g_hash_table_unref);
+  g_clear_object (&self->gallery_filter);
+  g_clear_object (&self->history_index);
+  g_clear_object (&self->history);
+  g_clear_object (&self->thumbnailer);
+  
+  // Finished images are in the history; clear what was left behind
+  if (self->temp_dir != NULL) {
+    remove_directory_contents (self->temp_dir);
+    rmdir (self->temp_dir);
+    g_free (self->temp_dir);
   }
   
-  g_free(emerge_temp_dir);
+  g_clear_pointer (&self->output_bytes, g_bytes_unref);
   g_free (self->output_path);
   g_free (self->model_path);
   g_free (self->initial_image_path);
+  g_free (self->upscale_model_path);
   g_free (self->last_saved_dir);
   g_free (self->last_template_dir);
   
@@ -2010,8 +5563,10 @@ emerge_window_finalize (GObject *object)
   if (self->model_list)
     g_object_unref(self->model_list);
   
-  if (self->cancellable != NULL)
-    g_object_unref (self->cancellable);
+  if (self->preload) {
+    emerge_preload_cancel (self->preload);
+    emerge_preload_unref (self->preload);
+  }
   
   G_OBJECT_CLASS (emerge_window_parent_class)->finalize (object);
 } 
\ No newline at end of file
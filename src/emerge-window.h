@@ -23,4 +23,9 @@ void emerge_window_load_config(EmergeWindow *self);
 void save_template_to_file(EmergeWindow *self, const char *filepath);
 void load_template_from_file(EmergeWindow *self, const char *filepath);
 
+// Queue control, exported over D-Bus by the application
+guint64   emerge_window_enqueue_json(EmergeWindow *self, const char *template_json, GError **error);
+gboolean  emerge_window_cancel_job(EmergeWindow *self, guint64 id);
+gchar    *emerge_window_get_queue_status(EmergeWindow *self);
+
 G_END_DECLS 
\ No newline at end of file
@@ -2,6 +2,7 @@
 #include <libintl.h>
 
 #include "emerge-application.h"
+#include "emerge-startup.h"
 
 #define GETTEXT_PACKAGE "emerge"
 #define LOCALEDIR "/usr/local/share/locale"
@@ -12,6 +13,8 @@ main (int argc, char *argv[])
   g_autoptr (EmergeApplication) app = NULL;
   int ret;
 
+  emerge_startup_begin ();
+
   /* Set up gettext translations */
   bindtextdomain (GETTEXT_PACKAGE, LOCALEDIR);
   bind_textdomain_codeset (GETTEXT_PACKAGE, "UTF-8");
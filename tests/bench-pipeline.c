@@ -0,0 +1,227 @@
+/* Measures emerge's own overhead around sd, using the mock so the numbers
+ * are not drowned out by the model:
+ *
+ *   spawn-to-start     emerge_job_spawn() until sd's first line is read
+ *   finish-to-pixels   "exited" until the image is decoded into a texture
+ *   throughput         back to back jobs per second
+ *   memory growth      RSS of this process across the whole run
+ *
+ * EMERGE_BENCH_JOBS overrides the number of jobs (default 1000). The run
+ * fails if RSS grows by more than EMERGE_BENCH_MAX_GROWTH_KB (default 8 MiB)
+ * after warm-up, which would point at a per-job leak.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <glib/gstdio.h>
+#include <gtk/gtk.h>
+
+#include "emerge-job.h"
+#include "emerge-process-manager.h"
+#include "emerge-sd.h"
+
+#define WARMUP_JOBS 50
+
+typedef struct {
+  EmergeProcessManager *manager;
+  gchar                *sd_path;
+  gchar                *tmp_dir;
+  GMainLoop            *loop;
+
+  guint                 n_jobs;
+  guint                 n_started;
+  guint                 n_failed;
+  EmergeJob            *job;
+  gint64                spawn_time;
+  gboolean              saw_output;
+
+  GArray               *start_latency;    /* double, ms */
+  GArray               *pixels_latency;   /* double, ms */
+  guint64               rss_after_warmup;
+} Bench;
+
+static void run_next (Bench *bench);
+
+static guint64
+read_rss (void)
+{
+  gchar *contents = NULL;
+  guint64 rss = 0;
+
+  if (g_file_get_contents ("/proc/self/status", &contents, NULL, NULL)) {
+    const char *line = strstr (contents, "VmRSS:");
+
+    if (line != NULL)
+      rss = g_ascii_strtoull (line + strlen ("VmRSS:"), NULL, 10) * 1024;
+  }
+
+  g_free (contents);
+  return rss;
+}
+
+static void
+output_cb (EmergeProcess *process G_GNUC_UNUSED,
+           const char    *line G_GNUC_UNUSED,
+           Bench         *bench)
+{
+  double ms;
+
+  if (bench->saw_output)
+    return;
+
+  bench->saw_output = TRUE;
+  ms = (g_get_monotonic_time () - bench->spawn_time) / 1000.0;
+  g_array_append_val (bench->start_latency, ms);
+}
+
+static void
+exited_cb (EmergeProcess *process,
+           gint           wait_status G_GNUC_UNUSED,
+           Bench         *bench)
+{
+  gint64 exited = g_get_monotonic_time ();
+
+  if (bench->job->state == EMERGE_JOB_SUCCEEDED) {
+    /* The same path the window takes to get the result on screen */
+    GFile *file = g_file_new_for_path (bench->job->output_path);
+    GdkTexture *texture = gdk_texture_new_from_file (file, NULL);
+    double ms = (g_get_monotonic_time () - exited) / 1000.0;
+
+    if (texture != NULL) {
+      g_array_append_val (bench->pixels_latency, ms);
+      g_object_unref (texture);
+    } else {
+      bench->n_failed++;
+    }
+
+    g_object_unref (file);
+    g_unlink (bench->job->output_path);
+  } else {
+    bench->n_failed++;
+  }
+
+  g_signal_handlers_disconnect_by_data (process, bench);
+  g_object_unref (process);
+  g_clear_pointer (&bench->job, emerge_job_unref);
+
+  if (bench->n_started == WARMUP_JOBS)
+    bench->rss_after_warmup = read_rss ();
+
+  run_next (bench);
+}
+
+static void
+run_next (Bench *bench)
+{
+  EmergeProcess *process;
+  GError *error = NULL;
+
+  if (bench->n_started == bench->n_jobs) {
+    g_main_loop_quit (bench->loop);
+    return;
+  }
+
+  bench->job = emerge_job_new ();
+  bench->job->model_path = g_strdup ("mock-model.gguf");
+  bench->job->prompt = g_strdup ("benchmark");
+  bench->job->width = 64;
+  bench->job->height = 64;
+  bench->job->steps = 4;
+  bench->job->seed = bench->n_started;
+  bench->job->output_path = g_build_filename (bench->tmp_dir, "out.png", NULL);
+
+  bench->n_started++;
+  bench->saw_output = FALSE;
+  bench->spawn_time = g_get_monotonic_time ();
+
+  process = emerge_job_spawn (bench->job, bench->manager, bench->sd_path, NULL, &error);
+  if (process == NULL) {
+    g_printerr ("spawn failed: %s\n", error->message);
+    exit (1);
+  }
+
+  g_signal_connect (process, "output", G_CALLBACK (output_cb), bench);
+  g_signal_connect (process, "exited", G_CALLBACK (exited_cb), bench);
+}
+
+static gint
+compare_doubles (gconstpointer a,
+                 gconstpointer b)
+{
+  double x = *(const double *) a;
+  double y = *(const double *) b;
+
+  return (x > y) - (x < y);
+}
+
+static void
+report_latency (const char *name,
+                GArray     *samples)
+{
+  if (samples->len == 0) {
+    g_print ("%-18s no samples\n", name);
+    return;
+  }
+
+  g_array_sort (samples, compare_doubles);
+  g_print ("%-18s p50 %8.3f ms   p95 %8.3f ms   max %8.3f ms\n", name,
+           g_array_index (samples, double, samples->len / 2),
+           g_array_index (samples, double, samples->len * 95 / 100),
+           g_array_index (samples, double, samples->len - 1));
+}
+
+int
+main (void)
+{
+  Bench bench = { 0 };
+  const char *env;
+  gint64 start;
+  double seconds;
+  gint64 growth;
+  gint64 max_growth = 8 * 1024 * 1024;
+
+  bench.n_jobs = 1000;
+  if ((env = g_getenv ("EMERGE_BENCH_JOBS")) != NULL)
+    bench.n_jobs = MAX (atoi (env), WARMUP_JOBS + 1);
+  if ((env = g_getenv ("EMERGE_BENCH_MAX_GROWTH_KB")) != NULL)
+    max_growth = g_ascii_strtoll (env, NULL, 10) * 1024;
+
+  bench.sd_path = emerge_sd_find_executable ();
+  if (bench.sd_path == NULL) {
+    g_printerr ("No sd found; set EMERGE_SD_PATH to the mock\n");
+    return 1;
+  }
+
+  bench.manager = emerge_process_manager_new ();
+  bench.tmp_dir = g_dir_make_tmp ("emerge-bench-XXXXXX", NULL);
+  bench.loop = g_main_loop_new (NULL, FALSE);
+  bench.start_latency = g_array_new (FALSE, FALSE, sizeof (double));
+  bench.pixels_latency = g_array_new (FALSE, FALSE, sizeof (double));
+
+  start = g_get_monotonic_time ();
+  run_next (&bench);
+  g_main_loop_run (bench.loop);
+  seconds = (g_get_monotonic_time () - start) / (double) G_USEC_PER_SEC;
+
+  growth = (gint64) read_rss () - (gint64) bench.rss_after_warmup;
+
+  g_print ("jobs               %u (%u failed)\n", bench.n_jobs, bench.n_failed);
+  report_latency ("spawn-to-start", bench.start_latency);
+  report_latency ("finish-to-pixels", bench.pixels_latency);
+  g_print ("%-18s %.1f jobs/s\n", "throughput", bench.n_jobs / seconds);
+  g_print ("%-18s %+.1f KiB over %u jobs after warm-up\n", "memory growth",
+           growth / 1024.0, bench.n_jobs - WARMUP_JOBS);
+
+  g_rmdir (bench.tmp_dir);
+  g_array_unref (bench.start_latency);
+  g_array_unref (bench.pixels_latency);
+  g_main_loop_unref (bench.loop);
+  g_object_unref (bench.manager);
+  g_free (bench.tmp_dir);
+  g_free (bench.sd_path);
+
+  if (bench.n_failed > 0 || growth > max_growth)
+    return 1;
+
+  return 0;
+}
@@ -0,0 +1,372 @@
+/* A stand-in for the stable-diffusion.cpp `sd` binary.
+ *
+ * It accepts the command line emerge passes, prints log and progress lines
+ * in the same format as the real tool and writes a deterministic image, so
+ * emerge's own pipeline can be tested and timed without a model. In
+ * upscale mode it scales the input up 4× by pixel replication.
+ *
+ * Behaviour is controlled through the environment:
+ *   MOCK_SD_LOAD_MS      time spent "loading the model" (default 0)
+ *   MOCK_SD_STEP_MS      time per sampling step (default 0)
+ *   MOCK_SD_DECODE_MS    time spent decoding (default 0)
+ *   MOCK_SD_PREVIEW_MS   extra time taken by steps that write a preview
+ *   MOCK_SD_FAIL_AT      fail after this many steps, 0 fails during load
+ *   MOCK_SD_EXIT_CODE    exit status used when failing (default 1)
+ *   MOCK_SD_CRASH        if set, abort() instead of exiting on failure
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+typedef struct {
+  const char *mode;
+  const char *model;
+  const char *output;
+  const char *prompt;
+  const char *type;
+  const char *input;
+  const char *upscale_model;
+  const char *preview_path;
+  int         preview_interval;
+  int         width;
+  int         height;
+  int         steps;
+  gint64      seed;
+} MockArgs;
+
+static int
+env_int (const char *name,
+         int         fallback)
+{
+  const char *value = g_getenv (name);
+
+  return value != NULL ? atoi (value) : fallback;
+}
+
+static void
+sleep_ms (int ms)
+{
+  if (ms > 0)
+    g_usleep ((gulong) ms * 1000);
+}
+
+static void
+fail (int steps_done)
+{
+  fprintf (stderr, "[ERROR] mock-sd: simulated failure after %d steps\n", steps_done);
+  fflush (stderr);
+
+  if (g_getenv ("MOCK_SD_CRASH") != NULL)
+    abort ();
+
+  exit (env_int ("MOCK_SD_EXIT_CODE", 1));
+}
+
+/* Options that take a value; anything else is a flag */
+static const char * const valued_options[] = {
+  "-M", "--mode", "-m", "--model", "-o", "--output", "-p", "--prompt",
+  "-n", "--negative-prompt", "-W", "--width", "-H", "--height",
+  "--steps", "-s", "--seed", "--cfg-scale", "--sampling-method",
+  "-i", "--input", "--strength", "-t", "--threads", "--type",
+  "--upscale-model", "--preview", "--preview-path", "--preview-interval",
+  NULL
+};
+
+static gboolean
+parse_args (int       argc,
+            char    **argv,
+            MockArgs *args)
+{
+  args->mode = "txt2img";
+  args->width = 512;
+  args->height = 512;
+  args->steps = 20;
+  args->seed = 42;
+
+  for (int i = 1; i < argc; i++) {
+    const char *opt = argv[i];
+    const char *value;
+
+    if (!g_strv_contains (valued_options, opt))
+      continue;
+
+    if (i + 1 >= argc) {
+      fprintf (stderr, "error: missing value for %s\n", opt);
+      return FALSE;
+    }
+    value = argv[++i];
+
+    if (g_str_equal (opt, "-M") || g_str_equal (opt, "--mode"))
+      args->mode = value;
+    else if (g_str_equal (opt, "-m") || g_str_equal (opt, "--model"))
+      args->model = value;
+    else if (g_str_equal (opt, "-o") || g_str_equal (opt, "--output"))
+      args->output = value;
+    else if (g_str_equal (opt, "-p") || g_str_equal (opt, "--prompt"))
+      args->prompt = value;
+    else if (g_str_equal (opt, "--type"))
+      args->type = value;
+    else if (g_str_equal (opt, "-i") || g_str_equal (opt, "--input"))
+      args->input = value;
+    else if (g_str_equal (opt, "--upscale-model"))
+      args->upscale_model = value;
+    else if (g_str_equal (opt, "--preview-path"))
+      args->preview_path = value;
+    else if (g_str_equal (opt, "--preview-interval"))
+      args->preview_interval = atoi (value);
+    else if (g_str_equal (opt, "-W") || g_str_equal (opt, "--width"))
+      args->width = atoi (value);
+    else if (g_str_equal (opt, "-H") || g_str_equal (opt, "--height"))
+      args->height = atoi (value);
+    else if (g_str_equal (opt, "--steps"))
+      args->steps = atoi (value);
+    else if (g_str_equal (opt, "-s") || g_str_equal (opt, "--seed"))
+      args->seed = g_ascii_strtoll (value, NULL, 10);
+  }
+
+  if (g_str_equal (args->mode, "upscale")) {
+    if (args->upscale_model == NULL || args->input == NULL) {
+      fprintf (stderr, "error: upscale mode needs --upscale-model and --input\n");
+      return FALSE;
+    }
+    return TRUE;
+  }
+
+  if (args->model == NULL) {
+    fprintf (stderr, "error: the following arguments are required: model_path\n");
+    return FALSE;
+  }
+
+  if (args->width <= 0 || args->height <= 0 || args->steps <= 0) {
+    fprintf (stderr, "error: invalid size or step count\n");
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+static void
+print_progress (int    step,
+                int    steps,
+                double seconds_per_step)
+{
+  const int width = 50;
+  int filled = step * width / steps;
+  char bar[64];
+
+  memset (bar, ' ', width);
+  memset (bar, '=', filled);
+  if (filled < width)
+    bar[filled] = '>';
+  bar[width] = '\0';
+
+  if (seconds_per_step >= 1.0 || seconds_per_step == 0.0)
+    printf ("  |%s| %d/%d - %.2fs/it\033[K\r", bar, step, steps, seconds_per_step);
+  else
+    printf ("  |%s| %d/%d - %.2fit/s\033[K\r", bar, step, steps, 1.0 / seconds_per_step);
+  fflush (stdout);
+}
+
+/* The image only depends on the seed and size, like a real fixed-seed run.
+ * Previews carry noise of up to @noise levels on top, which shrinks as
+ * sampling goes on. */
+static gboolean
+write_image (const MockArgs  *args,
+             const char      *path,
+             int              noise,
+             GError         **error)
+{
+  GdkPixbuf *pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, FALSE, 8, args->width, args->height);
+  int stride = gdk_pixbuf_get_rowstride (pixbuf);
+  guchar *pixels = gdk_pixbuf_get_pixels (pixbuf);
+  guint32 state = (guint32) args->seed * 2654435761u + 1;
+  gboolean ok;
+
+  for (int y = 0; y < args->height; y++) {
+    guchar *p = pixels + (gsize) y * stride;
+
+    for (int x = 0; x < args->width; x++, p += 3) {
+      state = state * 1664525u + 1013904223u;
+      p[0] = (x * 255 / args->width + (state >> 28)) & 0xff;
+      p[1] = (y * 255 / args->height + (state >> 24)) & 0xff;
+      p[2] = (guchar) (args->seed & 0xff);
+      if (noise > 0)
+        p[2] = CLAMP (p[2] + (int) ((x * 7 + y * 13) % (2 * noise + 1)) - noise, 0, 255);
+    }
+  }
+
+  ok = gdk_pixbuf_save (pixbuf, path, "png", error, NULL);
+  g_object_unref (pixbuf);
+
+  return ok;
+}
+
+static int
+run_generate (const MockArgs *args)
+{
+  int load_ms = env_int ("MOCK_SD_LOAD_MS", 0);
+  int step_ms = env_int ("MOCK_SD_STEP_MS", 0);
+  int decode_ms = env_int ("MOCK_SD_DECODE_MS", 0);
+  int fail_at = env_int ("MOCK_SD_FAIL_AT", -1);
+  int preview_ms = env_int ("MOCK_SD_PREVIEW_MS", 0);
+  gint64 start = g_get_monotonic_time ();
+  gint64 sampling_start;
+  GError *error = NULL;
+
+  printf ("[INFO ] mock-sd: loading model from '%s'\n", args->model);
+  fflush (stdout);
+  sleep_ms (load_ms);
+  if (fail_at == 0)
+    fail (0);
+  printf ("[INFO ] mock-sd: loading model from '%s' completed, taking %.2fs\n",
+          args->model, load_ms / 1000.0);
+
+  sampling_start = g_get_monotonic_time ();
+  for (int step = 1; step <= args->steps; step++) {
+    gboolean preview = args->preview_path != NULL && args->preview_interval > 0 &&
+                       step % args->preview_interval == 0;
+
+    sleep_ms (step_ms);
+    if (preview) {
+      sleep_ms (preview_ms);
+      int remaining = args->steps - step;
+
+      if (!write_image (args, args->preview_path,
+                        64 * remaining * remaining / (args->steps * args->steps), &error)) {
+        fprintf (stderr, "[ERROR] mock-sd: failed to save %s: %s\n", args->preview_path, error->message);
+        g_clear_error (&error);
+      }
+    }
+    print_progress (step, args->steps, (step_ms + (preview ? preview_ms : 0)) / 1000.0);
+    if (step == fail_at) {
+      printf ("\n");
+      fail (step);
+    }
+  }
+  printf ("\n[INFO ] mock-sd: sampling completed, taking %.2fs\n",
+          (g_get_monotonic_time () - sampling_start) / (double) G_USEC_PER_SEC);
+
+  sleep_ms (decode_ms);
+  printf ("[INFO ] mock-sd: decode_first_stage completed, taking %.2fs\n", decode_ms / 1000.0);
+
+  if (!write_image (args, args->output, 0, &error)) {
+    fprintf (stderr, "[ERROR] mock-sd: failed to save %s: %s\n", args->output, error->message);
+    g_error_free (error);
+    return 1;
+  }
+
+  printf ("[INFO ] mock-sd: %s completed in %.2fs\n", args->mode,
+          (g_get_monotonic_time () - start) / (double) G_USEC_PER_SEC);
+  printf ("save result image to '%s'\n", args->output);
+
+  return 0;
+}
+
+static int
+run_convert (const MockArgs *args)
+{
+  int step_ms = env_int ("MOCK_SD_STEP_MS", 0);
+  int fail_at = env_int ("MOCK_SD_FAIL_AT", -1);
+  const int tensors = 16;
+  GString *contents;
+  GError *error = NULL;
+
+  printf ("[INFO ] mock-sd: converting '%s' to %s\n", args->model, args->type ? args->type : "f16");
+  for (int i = 1; i <= tensors; i++) {
+    sleep_ms (step_ms);
+    print_progress (i, tensors, step_ms / 1000.0);
+    if (i == fail_at) {
+      printf ("\n");
+      fail (i);
+    }
+  }
+  printf ("\n");
+
+  contents = g_string_new ("GGUF");
+  g_string_append_printf (contents, "mock %s %s\n", args->model, args->type ? args->type : "f16");
+  if (!g_file_set_contents (args->output, contents->str, contents->len, &error)) {
+    fprintf (stderr, "[ERROR] mock-sd: failed to write %s: %s\n", args->output, error->message);
+    g_error_free (error);
+    g_string_free (contents, TRUE);
+    return 1;
+  }
+  g_string_free (contents, TRUE);
+
+  printf ("convert '%s' to '%s' success\n", args->model, args->output);
+  return 0;
+}
+
+static int
+run_upscale (const MockArgs *args)
+{
+  const int scale = 4;
+  int step_ms = env_int ("MOCK_SD_STEP_MS", 0);
+  GdkPixbuf *input, *output;
+  const guchar *src;
+  guchar *dst;
+  int width, height, n_channels, src_stride, dst_stride;
+  GError *error = NULL;
+  gboolean ok;
+
+  printf ("[INFO ] mock-sd: loading upscale model from '%s'\n", args->upscale_model);
+  if (env_int ("MOCK_SD_FAIL_AT", -1) == 0)
+    fail (0);
+
+  input = gdk_pixbuf_new_from_file (args->input, &error);
+  if (input == NULL) {
+    fprintf (stderr, "[ERROR] mock-sd: failed to load %s: %s\n", args->input, error->message);
+    g_error_free (error);
+    return 1;
+  }
+
+  width = gdk_pixbuf_get_width (input);
+  height = gdk_pixbuf_get_height (input);
+  n_channels = gdk_pixbuf_get_n_channels (input);
+  src_stride = gdk_pixbuf_get_rowstride (input);
+  src = gdk_pixbuf_read_pixels (input);
+
+  output = gdk_pixbuf_new (GDK_COLORSPACE_RGB, FALSE, 8, width * scale, height * scale);
+  dst_stride = gdk_pixbuf_get_rowstride (output);
+  dst = gdk_pixbuf_get_pixels (output);
+
+  sleep_ms (step_ms);
+  for (int y = 0; y < height * scale; y++)
+    for (int x = 0; x < width * scale; x++)
+      memcpy (dst + y * dst_stride + x * 3,
+              src + (y / scale) * src_stride + (x / scale) * n_channels, 3);
+
+  ok = gdk_pixbuf_save (output, args->output, "png", &error, NULL);
+  g_object_unref (output);
+  g_object_unref (input);
+
+  if (!ok) {
+    fprintf (stderr, "[ERROR] mock-sd: failed to save %s: %s\n", args->output, error->message);
+    g_error_free (error);
+    return 1;
+  }
+
+  printf ("upscale '%s' to '%s' success\n", args->input, args->output);
+  return 0;
+}
+
+int
+main (int argc, char *argv[])
+{
+  MockArgs args = { 0 };
+
+  if (!parse_args (argc, argv, &args))
+    return 1;
+
+  if (args.output == NULL)
+    args.output = "output.png";
+
+  if (g_str_equal (args.mode, "convert"))
+    return run_convert (&args);
+
+  if (g_str_equal (args.mode, "upscale"))
+    return run_upscale (&args);
+
+  return run_generate (&args);
+}
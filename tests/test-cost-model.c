@@ -0,0 +1,113 @@
+#include <glib/gstdio.h>
+
+#include "emerge-cost-model.h"
+
+static EmergeJob *
+make_run (const char *model_path,
+          gint        size,
+          gint        steps,
+          double      load_seconds,
+          double      sampling_seconds,
+          double      decode_seconds,
+          double      wall_seconds)
+{
+  EmergeJob *job = emerge_job_new ();
+
+  job->model_path = g_strdup (model_path);
+  job->width = size;
+  job->height = size;
+  job->steps = steps;
+  job->state = EMERGE_JOB_SUCCEEDED;
+  job->wall_seconds = wall_seconds;
+  job->stats = emerge_sd_stats_new ();
+  job->stats->load_seconds = load_seconds;
+  job->stats->sampling_seconds = sampling_seconds;
+  job->stats->decode_seconds = decode_seconds;
+
+  return job;
+}
+
+static void
+test_predict (void)
+{
+  g_autofree gchar *dir = g_dir_make_tmp ("emerge-test-XXXXXX", NULL);
+  g_autofree gchar *path = g_build_filename (dir, "timings.jsonl", NULL);
+  EmergeCostModel *model = emerge_cost_model_new (path, "test-host");
+  EmergeJob *job;
+
+  g_assert_true (emerge_cost_model_load (model, NULL));
+
+  job = make_run ("/models/sd15.q8_0.gguf", 512, 20, 2.0, 20.0, 1.0, 24.0);
+  g_assert_cmpfloat (emerge_cost_model_predict (model, job), <, 0.0);
+  g_assert_true (emerge_cost_model_record (model, job, NULL));
+  emerge_job_unref (job);
+
+  job = make_run ("/models/sd15.q8_0.gguf", 1024, 20, 2.0, 60.0, 4.0, 67.0);
+  g_assert_true (emerge_cost_model_record (model, job, NULL));
+  emerge_job_unref (job);
+  g_assert_cmpuint (emerge_cost_model_get_n_runs (model), ==, 2);
+
+  /* A run that was paused took longer than it says, so it doesn't count */
+  job = make_run ("/models/sd15.q8_0.gguf", 768, 30, 2.0, 500.0, 2.0, 600.0);
+  job->was_paused = TRUE;
+  g_assert_true (emerge_cost_model_record (model, job, NULL));
+  emerge_job_unref (job);
+  g_assert_cmpuint (emerge_cost_model_get_n_runs (model), ==, 2);
+
+  /* Steps and decoding cost in line with megapixels, between the two */
+  job = make_run ("/models/sd15.q8_0.gguf", 768, 30, -1.0, -1.0, -1.0, 0.0);
+  g_assert_cmpfloat_with_epsilon (emerge_cost_model_predict (model, job), 60.25, 0.01);
+  g_assert_cmpfloat_with_epsilon (emerge_cost_model_predict_remaining (model, job, 15, 40.0),
+                                  30.75, 0.01);
+
+  /* Heun evaluates the model twice a step */
+  g_free (job->sampling_method);
+  job->sampling_method = g_strdup ("heun");
+  g_assert_cmpfloat_with_epsilon (emerge_cost_model_predict (model, job), 115.25, 0.01);
+  emerge_job_unref (job);
+
+  /* A model never run falls back to everything run on the host */
+  job = make_run ("/models/other.q4_0.gguf", 768, 30, -1.0, -1.0, -1.0, 0.0);
+  g_assert_cmpfloat_with_epsilon (emerge_cost_model_predict (model, job), 60.25, 0.01);
+
+  /* The runs are kept, and only count for the host they were made on */
+  emerge_cost_model_free (model);
+  model = emerge_cost_model_new (path, "test-host");
+  g_assert_true (emerge_cost_model_load (model, NULL));
+  g_assert_cmpuint (emerge_cost_model_get_n_runs (model), ==, 2);
+  g_assert_cmpfloat_with_epsilon (emerge_cost_model_predict (model, job), 60.25, 0.01);
+  emerge_cost_model_free (model);
+
+  model = emerge_cost_model_new (path, "other-host");
+  g_assert_true (emerge_cost_model_load (model, NULL));
+  g_assert_cmpuint (emerge_cost_model_get_n_runs (model), ==, 0);
+  g_assert_cmpfloat (emerge_cost_model_predict (model, job), <, 0.0);
+  emerge_cost_model_free (model);
+  emerge_job_unref (job);
+
+  g_unlink (path);
+  g_rmdir (dir);
+}
+
+static void
+test_quant (void)
+{
+  g_autofree gchar *q8 = emerge_cost_model_get_quant ("/models/sd15.q8_0.gguf");
+  g_autofree gchar *safetensors = emerge_cost_model_get_quant ("/models/sd15.safetensors");
+  g_autofree gchar *gguf = emerge_cost_model_get_quant ("/models/sd1.5.gguf");
+
+  g_assert_cmpstr (q8, ==, "q8_0");
+  g_assert_cmpstr (safetensors, ==, "safetensors");
+  g_assert_cmpstr (gguf, ==, "gguf");
+}
+
+int
+main (int argc, char *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/cost-model/predict", test_predict);
+  g_test_add_func ("/cost-model/quant", test_quant);
+
+  return g_test_run ();
+}
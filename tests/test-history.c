@@ -0,0 +1,523 @@
+#include <stdio.h>
+#include <string.h>
+#include <glib/gstdio.h>
+
+#include "emerge-history.h"
+#include "emerge-history-index.h"
+#include "emerge-thumbnailer.h"
+#include "emerge-dedupe.h"
+#include "emerge-image-metrics.h"
+
+typedef struct {
+  gchar *tmp_dir;
+  gchar *history_dir;
+} Fixture;
+
+static void
+fixture_set_up (Fixture       *fixture,
+                gconstpointer  data G_GNUC_UNUSED)
+{
+  fixture->tmp_dir = g_dir_make_tmp ("emerge-test-XXXXXX", NULL);
+  g_assert_nonnull (fixture->tmp_dir);
+  fixture->history_dir = g_build_filename (fixture->tmp_dir, "history", NULL);
+}
+
+static void
+remove_tree (const char *path)
+{
+  GDir *dir = g_dir_open (path, 0, NULL);
+  const char *name;
+
+  if (dir == NULL) {
+    g_unlink (path);
+    return;
+  }
+
+  while ((name = g_dir_read_name (dir)) != NULL) {
+    gchar *child = g_build_filename (path, name, NULL);
+    remove_tree (child);
+    g_free (child);
+  }
+  g_dir_close (dir);
+  g_rmdir (path);
+}
+
+static void
+fixture_tear_down (Fixture       *fixture,
+                   gconstpointer  data G_GNUC_UNUSED)
+{
+  remove_tree (fixture->tmp_dir);
+  g_free (fixture->history_dir);
+  g_free (fixture->tmp_dir);
+}
+
+/* A job whose image has just been written, as sd would leave it */
+static EmergeJob *
+new_finished_job (Fixture    *fixture,
+                  const char *prompt,
+                  int         width,
+                  int         height)
+{
+  EmergeJob *job = emerge_job_new ();
+  GdkPixbuf *pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, FALSE, 8, width, height);
+  gchar *name = g_strdup_printf ("%s.png", prompt);
+
+  gdk_pixbuf_fill (pixbuf, 0x336699ff);
+  job->prompt = g_strdup (prompt);
+  job->width = width;
+  job->height = height;
+  job->output_path = g_build_filename (fixture->tmp_dir, name, NULL);
+  job->state = EMERGE_JOB_SUCCEEDED;
+  job->wall_seconds = 12.5;
+  g_assert_true (gdk_pixbuf_save (pixbuf, job->output_path, "png", NULL, NULL));
+
+  g_object_unref (pixbuf);
+  g_free (name);
+
+  return job;
+}
+
+static void
+test_history_add_and_reload (Fixture       *fixture,
+                             gconstpointer  data G_GNUC_UNUSED)
+{
+  EmergeHistory *history = emerge_history_new (fixture->history_dir);
+  EmergeHistoryItem *item;
+  GError *error = NULL;
+
+  g_assert_true (emerge_history_load (history, NULL, &error));
+  g_assert_no_error (error);
+  g_assert_cmpuint (g_list_model_get_n_items (G_LIST_MODEL (history)), ==, 0);
+
+  for (int i = 0; i < 3; i++) {
+    gchar *prompt = g_strdup_printf ("prompt-%d", i);
+    EmergeJob *job = new_finished_job (fixture, prompt, 64, 64);
+    gchar *temp_path = g_strdup (job->output_path);
+
+    item = emerge_history_add (history, job, &error);
+    g_assert_no_error (error);
+    g_assert_nonnull (item);
+
+    /* The image moved out of the temporary location */
+    g_assert_false (g_file_test (temp_path, G_FILE_TEST_EXISTS));
+    g_assert_true (g_str_has_prefix (job->output_path, fixture->history_dir));
+    g_assert_true (g_file_test (emerge_history_item_get_image_path (item), G_FILE_TEST_IS_REGULAR));
+
+    g_free (temp_path);
+    g_free (prompt);
+    emerge_job_unref (job);
+  }
+
+  /* Newest first */
+  item = g_list_model_get_item (G_LIST_MODEL (history), 0);
+  g_assert_cmpstr (emerge_history_item_get_job (item)->prompt, ==, "prompt-2");
+  g_object_unref (item);
+  g_object_unref (history);
+
+  /* A torn line from a crash mid-append is skipped */
+  gchar *index_path = g_build_filename (fixture->history_dir, "index.jsonl", NULL);
+  FILE *index = fopen (index_path, "a");
+  fputs ("{\"id\": 1, \"ima", index);
+  fclose (index);
+
+  history = emerge_history_new (fixture->history_dir);
+  g_test_expect_message (NULL, G_LOG_LEVEL_WARNING, "Skipped 1 unreadable entries*");
+  g_assert_true (emerge_history_load (history, NULL, &error));
+  g_test_assert_expected_messages ();
+  g_assert_no_error (error);
+  g_assert_cmpuint (g_list_model_get_n_items (G_LIST_MODEL (history)), ==, 3);
+
+  item = g_list_model_get_item (G_LIST_MODEL (history), 2);
+  g_assert_cmpstr (emerge_history_item_get_job (item)->prompt, ==, "prompt-0");
+  g_assert_cmpfloat (emerge_history_item_get_job (item)->wall_seconds, ==, 12.5);
+  g_assert_true (emerge_history_lookup (history, emerge_history_item_get_id (item)) == item);
+  g_object_unref (item);
+
+  g_object_unref (history);
+  g_free (index_path);
+}
+
+static void
+thumbnail_loaded_cb (GObject      *source_object,
+                     GAsyncResult *result,
+                     gpointer      user_data)
+{
+  GdkPixbuf **pixbuf = user_data;
+  GError *error = NULL;
+
+  *pixbuf = emerge_thumbnailer_load_finish (EMERGE_THUMBNAILER (source_object), result, &error);
+  g_assert_no_error (error);
+}
+
+static void
+test_thumbnailer_sizes (Fixture       *fixture,
+                        gconstpointer  data G_GNUC_UNUSED)
+{
+  gchar *cache_dir = g_build_filename (fixture->tmp_dir, "thumbnails", NULL);
+  EmergeThumbnailer *thumbnailer = emerge_thumbnailer_new (cache_dir, 2);
+  EmergeJob *job = new_finished_job (fixture, "large", 1024, 512);
+  GdkPixbuf *pixbuf = NULL;
+
+  emerge_thumbnailer_load_async (thumbnailer, job->output_path, "1",
+                                 EMERGE_THUMBNAIL_SMALL, NULL, thumbnail_loaded_cb, &pixbuf);
+  while (pixbuf == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_assert_cmpint (gdk_pixbuf_get_width (pixbuf), ==, 128);
+  g_assert_cmpint (gdk_pixbuf_get_height (pixbuf), ==, 64);
+  g_clear_object (&pixbuf);
+
+  /* Both sizes came from the one decode */
+  for (guint size = EMERGE_THUMBNAIL_SMALL; size <= EMERGE_THUMBNAIL_LARGE; size *= 2) {
+    gchar *path = emerge_thumbnailer_get_path (thumbnailer, "1", size);
+    g_assert_true (g_file_test (path, G_FILE_TEST_IS_REGULAR));
+    g_free (path);
+  }
+
+  emerge_thumbnailer_load_async (thumbnailer, job->output_path, "1",
+                                 EMERGE_THUMBNAIL_LARGE * 2, NULL, thumbnail_loaded_cb, &pixbuf);
+  while (pixbuf == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_assert_cmpint (gdk_pixbuf_get_width (pixbuf), ==, EMERGE_THUMBNAIL_LARGE);
+  g_clear_object (&pixbuf);
+
+  /* Small images are not scaled up */
+  EmergeJob *small = new_finished_job (fixture, "small", 40, 30);
+  emerge_thumbnailer_load_async (thumbnailer, small->output_path, "2",
+                                 EMERGE_THUMBNAIL_SMALL, NULL, thumbnail_loaded_cb, &pixbuf);
+  while (pixbuf == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_assert_cmpint (gdk_pixbuf_get_width (pixbuf), ==, 40);
+  g_clear_object (&pixbuf);
+
+  emerge_job_unref (small);
+  emerge_job_unref (job);
+  g_object_unref (thumbnailer);
+  g_free (cache_dir);
+}
+
+static const char * const search_words[] = {
+  "cyberpunk", "city", "neon", "portrait", "forest", "castle", "cat", "dragon",
+  "sunset", "ocean", "robot", "watercolor", "oil", "painting", "photo", "night",
+};
+
+/* Writes an index of @n_entries directly, as a long-used history would
+ * have; the images don't need to exist to be searched */
+static void
+write_search_history (Fixture *fixture,
+                      guint    n_entries)
+{
+  GString *contents = g_string_new (NULL);
+  gchar *index_path = g_build_filename (fixture->history_dir, "index.jsonl", NULL);
+  GDateTime *base = g_date_time_new_local (2026, 1, 1, 12, 0, 0);
+  gint64 base_time = g_date_time_to_unix (base);
+
+  for (guint i = 0; i < n_entries; i++) {
+    const char *sampler = i % 3 == 0 ? "euler_a" : "dpm++2m";
+    double cfg = i % 4 == 0 ? 4.5 : 7.0;
+
+    g_string_append_printf (contents,
+                            "{\"id\": %u, \"created\": %" G_GINT64_FORMAT ", \"image\": \"images/%u.png\", "
+                            "\"job\": {\"model_path\": \"/models/%s.gguf\", "
+                            "\"positive_prompt\": \"%s %s, %s\", \"negative_prompt\": \"%s\", "
+                            "\"width\": %d, \"height\": 512, \"steps\": %u, \"seed\": %u, "
+                            "\"cfg_scale\": %.1f, \"sampling_method\": \"%s\"}}\n",
+                            i + 1, base_time + (gint64) i * 3600, i + 1,
+                            i % 2 == 0 ? "sd-v1-5.q8_0" : "sdxl.q4_0",
+                            search_words[i % G_N_ELEMENTS (search_words)],
+                            search_words[(i / 16) % G_N_ELEMENTS (search_words)],
+                            search_words[(i * 7) % G_N_ELEMENTS (search_words)],
+                            i % 5 == 0 ? "blurry" : "lowres",
+                            i % 2 == 0 ? 512 : 768, 20 + i % 10, i, cfg, sampler);
+  }
+
+  g_assert_cmpint (g_mkdir_with_parents (fixture->history_dir, 0755), ==, 0);
+  g_assert_true (g_file_set_contents (index_path, contents->str, contents->len, NULL));
+
+  g_date_time_unref (base);
+  g_string_free (contents, TRUE);
+  g_free (index_path);
+}
+
+static guint
+count_matches (EmergeHistoryIndex *index,
+               const char         *query)
+{
+  emerge_history_index_set_query (index, query);
+
+  return g_list_model_get_n_items (G_LIST_MODEL (index));
+}
+
+static void
+test_history_search (Fixture       *fixture,
+                     gconstpointer  data G_GNUC_UNUSED)
+{
+  EmergeHistory *history;
+  EmergeHistoryIndex *index;
+  EmergeHistoryItem *item;
+  GError *error = NULL;
+
+  write_search_history (fixture, 160);
+  history = emerge_history_new (fixture->history_dir);
+  index = emerge_history_index_new (history);
+  g_assert_true (emerge_history_load (history, NULL, &error));
+  g_assert_no_error (error);
+
+  g_assert_cmpuint (count_matches (index, NULL), ==, 160);
+
+  /* Newest first, like the history */
+  item = g_list_model_get_item (G_LIST_MODEL (index), 0);
+  g_assert_cmpuint (emerge_history_item_get_id (item), ==, 160);
+  g_object_unref (item);
+
+  /* Words match as they are typed */
+  guint n_full = count_matches (index, "cyberpunk");
+  g_assert_cmpuint (n_full, >, 0);
+  g_assert_cmpuint (count_matches (index, "cyb"), ==, n_full);
+  g_assert_cmpuint (count_matches (index, "CYBERPUNK"), ==, n_full);
+  g_assert_cmpuint (count_matches (index, "cyberpunk -cyberpunk"), ==, 0);
+  g_assert_cmpuint (count_matches (index, "nomatch"), ==, 0);
+
+  g_assert_cmpuint (count_matches (index, "neg:blurry"), ==, 32);
+  g_assert_cmpuint (count_matches (index, "model:sdxl"), ==, 80);
+  g_assert_cmpuint (count_matches (index, "sampler:euler"), ==, 54);
+  g_assert_cmpuint (count_matches (index, "seed:42"), ==, 1);
+  g_assert_cmpuint (count_matches (index, "cfg:4.5"), ==, 40);
+  g_assert_cmpuint (count_matches (index, "cfg:>5"), ==, 120);
+  g_assert_cmpuint (count_matches (index, "size:768x512"), ==, 80);
+  g_assert_cmpuint (count_matches (index, "steps:>=25"), ==, 80);
+  g_assert_cmpuint (count_matches (index, "model:sdxl cfg:4.5"), ==, 0);
+  g_assert_cmpuint (count_matches (index, "model:sd-v1 cfg:4.5"), ==, 40);
+
+  /* One image an hour from January 1st: 160 hours reach into the 7th */
+  g_assert_cmpuint (count_matches (index, "date:2026-01"), ==, 160);
+  g_assert_cmpuint (count_matches (index, "date:2026-01-02"), ==, 24);
+  g_assert_cmpuint (count_matches (index, "before:2026-01-02"), ==, 12);
+  g_assert_cmpuint (count_matches (index, "date:2025"), ==, 0);
+
+  /* Incomplete filters don't narrow anything yet */
+  g_assert_cmpuint (count_matches (index, "cfg:"), ==, 160);
+
+  /* New images are picked up by the current query */
+  emerge_history_index_set_query (index, "cyberpunk");
+  EmergeJob *job = new_finished_job (fixture, "cyberpunk alley", 64, 64);
+  g_assert_nonnull (emerge_history_add (history, job, &error));
+  g_assert_no_error (error);
+  g_assert_cmpuint (g_list_model_get_n_items (G_LIST_MODEL (index)), ==, n_full + 1);
+  item = g_list_model_get_item (G_LIST_MODEL (index), 0);
+  g_assert_cmpstr (emerge_history_item_get_job (item)->prompt, ==, "cyberpunk alley");
+  g_object_unref (item);
+  emerge_job_unref (job);
+
+  g_object_unref (index);
+  g_object_unref (history);
+}
+
+static void
+test_history_search_speed (Fixture       *fixture,
+                           gconstpointer  data G_GNUC_UNUSED)
+{
+  const char *typed = "cyberpunk city cfg:4.5 model:sdxl";
+  EmergeHistory *history;
+  EmergeHistoryIndex *index;
+  double slowest = 0.0;
+
+  if (!g_test_perf ()) {
+    g_test_skip ("Run with -m perf");
+    return;
+  }
+
+  write_search_history (fixture, 100000);
+  history = emerge_history_new (fixture->history_dir);
+  g_test_timer_start ();
+  g_assert_true (emerge_history_load (history, NULL, NULL));
+  index = emerge_history_index_new (history);
+  g_test_minimized_result (g_test_timer_elapsed (), "load and index 100k entries: %.3fs",
+                           g_test_timer_elapsed ());
+
+  /* One query per keystroke, as the search entry sends them */
+  for (size_t len = 1; len <= strlen (typed); len++) {
+    gchar *query = g_strndup (typed, len);
+
+    g_test_timer_start ();
+    emerge_history_index_set_query (index, query);
+    slowest = MAX (slowest, g_test_timer_elapsed ());
+    g_free (query);
+  }
+
+  g_test_maximized_result (slowest, "slowest keystroke: %.2fms", slowest * 1000);
+  g_assert_cmpfloat (slowest, <, 0.010);
+
+  g_object_unref (index);
+  g_object_unref (history);
+}
+
+/* Replaces the image of @job with a horizontal gradient */
+static void
+write_gradient (EmergeJob *job,
+                gboolean   reversed)
+{
+  GdkPixbuf *pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, FALSE, 8, 64, 64);
+  guchar *pixels = gdk_pixbuf_get_pixels (pixbuf);
+  int rowstride = gdk_pixbuf_get_rowstride (pixbuf);
+
+  for (int y = 0; y < 64; y++) {
+    for (int x = 0; x < 64; x++) {
+      guchar v = (reversed ? 63 - x : x) * 4;
+
+      pixels[y * rowstride + x * 3] = v;
+      pixels[y * rowstride + x * 3 + 1] = v;
+      pixels[y * rowstride + x * 3 + 2] = v;
+    }
+  }
+
+  g_assert_true (gdk_pixbuf_save (pixbuf, job->output_path, "png", NULL, NULL));
+  g_object_unref (pixbuf);
+}
+
+static void
+hashed_cb (GObject      *source_object,
+           GAsyncResult *result,
+           gpointer      user_data)
+{
+  guint *n_hashed = user_data;
+  GError *error = NULL;
+
+  *n_hashed = emerge_history_hash_finish (EMERGE_HISTORY (source_object), result, &error);
+  g_assert_no_error (error);
+}
+
+static void
+test_history_duplicates (Fixture       *fixture,
+                         gconstpointer  data G_GNUC_UNUSED)
+{
+  EmergeHistory *history = emerge_history_new (fixture->history_dir);
+  EmergeHistoryItem *items[3];
+  EmergeDuplicates *duplicates;
+  GPtrArray *removed;
+  GError *error = NULL;
+  guint n_hashed = 0;
+  guint64 dhash;
+
+  /* Two of the same picture and one mirrored */
+  for (int i = 0; i < 3; i++) {
+    gchar *prompt = g_strdup_printf ("sweep-%d", i);
+    EmergeJob *job = new_finished_job (fixture, prompt, 64, 64);
+
+    write_gradient (job, i == 1);
+    items[i] = emerge_history_add (history, job, &error);
+    g_assert_no_error (error);
+
+    emerge_job_unref (job);
+    g_free (prompt);
+  }
+
+  g_assert_false (emerge_history_item_get_dhash (items[0], NULL));
+
+  emerge_history_hash_async (history, NULL, hashed_cb, &n_hashed);
+  while (n_hashed == 0)
+    g_main_context_iteration (NULL, TRUE);
+  g_assert_cmpuint (n_hashed, ==, 3);
+
+  /* Only the older copy is redundant */
+  duplicates = emerge_duplicates_find (G_LIST_MODEL (history), EMERGE_DEDUPE_DEFAULT_DISTANCE);
+  g_assert_cmpuint (emerge_duplicates_get_items (duplicates)->len, ==, 1);
+  g_assert_true (emerge_duplicates_is_duplicate (duplicates, items[0]));
+  g_assert_false (emerge_duplicates_is_duplicate (duplicates, items[1]));
+  g_assert_cmpuint (emerge_duplicates_get_n_duplicates (duplicates, items[2]), ==, 1);
+
+  gchar *removed_path = g_strdup (emerge_history_item_get_image_path (items[0]));
+  removed = g_ptr_array_ref (emerge_duplicates_get_items (duplicates));
+  emerge_duplicates_free (duplicates);
+  g_assert_true (emerge_history_remove (history, removed, &error));
+  g_assert_no_error (error);
+  g_ptr_array_unref (removed);
+
+  g_assert_cmpuint (g_list_model_get_n_items (G_LIST_MODEL (history)), ==, 2);
+  g_assert_false (g_file_test (removed_path, G_FILE_TEST_EXISTS));
+  g_object_unref (history);
+
+  /* Both the removal and the hashes survive a reload */
+  history = emerge_history_new (fixture->history_dir);
+  g_assert_true (emerge_history_load (history, NULL, &error));
+  g_assert_no_error (error);
+  g_assert_cmpuint (g_list_model_get_n_items (G_LIST_MODEL (history)), ==, 2);
+
+  for (guint i = 0; i < 2; i++) {
+    EmergeHistoryItem *item = g_list_model_get_item (G_LIST_MODEL (history), i);
+
+    g_assert_true (emerge_history_item_get_dhash (item, &dhash));
+    g_assert_cmpuint (dhash, ==, i == 0 ? G_MAXUINT64 : 0);
+    g_object_unref (item);
+  }
+
+  g_object_unref (history);
+  g_free (removed_path);
+}
+
+/* Nearest-neighbour lookups must agree with a linear scan */
+static void
+test_bk_tree (void)
+{
+  g_autoptr(EmergeBkTree) tree = emerge_bk_tree_new ();
+  GRand *rand = g_rand_new_with_seed (34);
+  guint64 hashes[2000];
+
+  for (guint i = 0; i < G_N_ELEMENTS (hashes); i++) {
+    /* Clustered, like the hashes of a seed sweep */
+    hashes[i] = i % 50 == 0 ? ((guint64) g_rand_int (rand) << 32 | g_rand_int (rand))
+                                        : hashes[i - 1] ^ (G_GUINT64_CONSTANT (1) << g_rand_int_range (rand, 0, 64));
+    emerge_bk_tree_insert (tree, hashes[i], GUINT_TO_POINTER (i + 1));
+  }
+  g_assert_cmpuint (emerge_bk_tree_get_size (tree), ==, G_N_ELEMENTS (hashes));
+
+  for (guint n = 0; n < 200; n++) {
+    guint64 query = hashes[g_rand_int_range (rand, 0, G_N_ELEMENTS (hashes))] ^
+                    (G_GUINT64_CONSTANT (1) << g_rand_int_range (rand, 0, 64)) ^
+                    (G_GUINT64_CONSTANT (1) << g_rand_int_range (rand, 0, 64));
+    guint best = G_MAXUINT, best_distance = 7, distance = G_MAXUINT;
+    gpointer found;
+
+    for (guint i = 0; i < G_N_ELEMENTS (hashes); i++) {
+      guint d = emerge_image_metrics_hamming (query, hashes[i]);
+
+      if (d < best_distance) {
+        best = i;
+        best_distance = d;
+      }
+    }
+
+    found = emerge_bk_tree_find_nearest (tree, query, 6, &distance);
+    if (best == G_MAXUINT) {
+      g_assert_null (found);
+    } else {
+      g_assert_nonnull (found);
+      g_assert_cmpuint (distance, ==, best_distance);
+    }
+  }
+
+  g_rand_free (rand);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add ("/history/add-and-reload", Fixture, NULL,
+              fixture_set_up, test_history_add_and_reload, fixture_tear_down);
+  g_test_add ("/history/search", Fixture, NULL,
+              fixture_set_up, test_history_search, fixture_tear_down);
+  g_test_add ("/history/search-speed", Fixture, NULL,
+              fixture_set_up, test_history_search_speed, fixture_tear_down);
+  g_test_add ("/history/thumbnailer-sizes", Fixture, NULL,
+              fixture_set_up, test_thumbnailer_sizes, fixture_tear_down);
+  g_test_add ("/history/duplicates", Fixture, NULL,
+              fixture_set_up, test_history_duplicates, fixture_tear_down);
+  g_test_add_func ("/history/bk-tree", test_bk_tree);
+
+  return g_test_run ();
+}
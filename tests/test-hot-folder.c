@@ -0,0 +1,118 @@
+#include <glib/gstdio.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+#include "emerge-hot-folder.h"
+
+static void
+write_image (const char *dir,
+             const char *name,
+             guint32     color)
+{
+  g_autoptr(GdkPixbuf) image = gdk_pixbuf_new (GDK_COLORSPACE_RGB, FALSE, 8, 100, 50);
+  g_autofree gchar *path = g_build_filename (dir, name, NULL);
+
+  gdk_pixbuf_fill (image, color);
+  g_assert_true (gdk_pixbuf_save (image, path, "png", NULL, NULL));
+}
+
+static void
+remove_tree (const char *path)
+{
+  GDir *dir = g_dir_open (path, 0, NULL);
+  const char *name;
+
+  if (dir != NULL) {
+    while ((name = g_dir_read_name (dir)) != NULL) {
+      g_autofree gchar *child = g_build_filename (path, name, NULL);
+
+      remove_tree (child);
+    }
+    g_dir_close (dir);
+  }
+
+  g_remove (path);
+}
+
+static void
+test_backpressure (void)
+{
+  g_autofree gchar *dir = g_dir_make_tmp ("emerge-test-XXXXXX", NULL);
+  g_autofree gchar *input_path = g_build_filename (dir, "in", NULL);
+  g_autofree gchar *output_path = g_build_filename (dir, "in-output", NULL);
+  g_autofree gchar *journal_path = g_build_filename (dir, "queue.journal", NULL);
+  g_autofree gchar *notes_path = g_build_filename (input_path, "notes.txt", NULL);
+  g_autofree gchar *export_dir = NULL;
+  g_autoptr(GFile) input_dir = g_file_new_for_path (input_path);
+  g_autoptr(GFile) output_dir = g_file_new_for_path (output_path);
+  EmergeQueue *queue = emerge_queue_new (journal_path);
+  EmergeJob *template_job = emerge_job_new ();
+  EmergeHotFolder *hot_folder;
+  EmergeJob *job;
+  gint64 deadline;
+
+  g_mkdir (input_path, 0755);
+  for (guint i = 0; i < 6; i++) {
+    g_autofree gchar *name = g_strdup_printf ("image-%u.png", i);
+
+    write_image (input_path, name, 0x10203000 + i);
+  }
+  write_image (input_path, "copy-of-image-0.png", 0x10203000);
+  g_assert_true (g_file_set_contents (notes_path, "not an image", -1, NULL));
+
+  template_job->model_path = g_strdup ("/models/test.safetensors");
+  template_job->prompt = g_strdup ("a watercolor");
+  template_job->width = 512;
+  template_job->height = 512;
+  template_job->seed = 5;
+  template_job->strength = 0.5;
+
+  hot_folder = emerge_hot_folder_new (input_dir, output_dir, queue, template_job);
+  emerge_job_unref (template_job);
+  g_assert_true (emerge_hot_folder_start (hot_folder, NULL));
+
+  /* Every image gets prepared, but only a few are let into the queue */
+  deadline = g_get_monotonic_time () + 10 * G_USEC_PER_SEC;
+  while (emerge_hot_folder_get_n_skipped (hot_folder) < 1 ||
+         emerge_hot_folder_get_n_submitted (hot_folder) < EMERGE_HOT_FOLDER_MAX_QUEUED) {
+    g_assert_cmpint (g_get_monotonic_time (), <, deadline);
+    g_main_context_iteration (NULL, TRUE);
+  }
+  g_assert_cmpuint (emerge_queue_get_n_pending (queue), ==, EMERGE_HOT_FOLDER_MAX_QUEUED);
+  g_assert_cmpuint (emerge_hot_folder_get_n_skipped (hot_folder), ==, 1);
+  g_assert_cmpuint (emerge_hot_folder_get_n_waiting (hot_folder), ==, 2);
+
+  job = emerge_queue_start_next (queue);
+  g_assert_true (job->img2img);
+  g_assert_cmpint (job->width, ==, 512);
+  g_assert_cmpint (job->height, ==, 256);
+  g_assert_true (g_file_test (job->init_image_path, G_FILE_TEST_IS_REGULAR));
+  export_dir = g_path_get_dirname (job->export_path);
+  g_assert_cmpstr (export_dir, ==, output_path);
+
+  /* Finishing one makes room for the next */
+  emerge_queue_finish (queue, job->id, EMERGE_JOB_SUCCEEDED);
+  emerge_job_unref (job);
+  deadline = g_get_monotonic_time () + 10 * G_USEC_PER_SEC;
+  while (emerge_hot_folder_get_n_submitted (hot_folder) < EMERGE_HOT_FOLDER_MAX_QUEUED + 1) {
+    g_assert_cmpint (g_get_monotonic_time (), <, deadline);
+    g_main_context_iteration (NULL, TRUE);
+  }
+  g_assert_cmpuint (emerge_hot_folder_get_n_submitted (hot_folder), ==,
+                    EMERGE_HOT_FOLDER_MAX_QUEUED + 1);
+  g_assert_cmpuint (emerge_queue_get_n_pending (queue), ==, EMERGE_HOT_FOLDER_MAX_QUEUED);
+
+  emerge_hot_folder_stop (hot_folder);
+  g_object_unref (hot_folder);
+  g_object_unref (queue);
+  remove_tree (dir);
+}
+
+int
+main (int argc, char *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/hot-folder/backpressure", test_backpressure);
+
+  return g_test_run ();
+}
@@ -0,0 +1,134 @@
+#include <math.h>
+#include <string.h>
+
+#include "emerge-convergence.h"
+#include "emerge-image-metrics.h"
+
+#define W 64
+#define H 48
+
+static void
+fill_pattern (float *plane,
+              int    seed)
+{
+  for (int i = 0; i < W * H; i++)
+    plane[i] = (float) ((i * 37 + seed * 11) % 256);
+}
+
+static void
+test_identical (void)
+{
+  float a[W * H];
+
+  fill_pattern (a, 1);
+
+  g_assert_cmpfloat (emerge_image_metrics_psnr (a, a, W * H), ==, G_MAXDOUBLE);
+  g_assert_cmpfloat_with_epsilon (emerge_image_metrics_ssim (a, a, W, H), 1.0, 1e-6);
+}
+
+static void
+test_noise_lowers_scores (void)
+{
+  float a[W * H], small[W * H], large[W * H];
+
+  fill_pattern (a, 1);
+  for (int i = 0; i < W * H; i++) {
+    small[i] = a[i] + ((i % 3) - 1) * 2.0f;
+    large[i] = a[i] + ((i % 3) - 1) * 20.0f;
+  }
+
+  double psnr_small = emerge_image_metrics_psnr (a, small, W * H);
+  double psnr_large = emerge_image_metrics_psnr (a, large, W * H);
+  double ssim_small = emerge_image_metrics_ssim (a, small, W, H);
+  double ssim_large = emerge_image_metrics_ssim (a, large, W, H);
+
+  g_assert_cmpfloat (psnr_small, >, psnr_large);
+  g_assert_cmpfloat (ssim_small, >, ssim_large);
+  g_assert_cmpfloat (ssim_small, <, 1.0);
+}
+
+/* The vector loop handles multiples of 8; the tail must be counted too */
+static void
+test_psnr_tail (void)
+{
+  float a[19] = { 0 }, b[19] = { 0 };
+
+  b[18] = 255.0f;
+
+  g_assert_cmpfloat_with_epsilon (emerge_image_metrics_psnr (a, b, 19),
+                                  10.0 * log10 (19.0), 1e-6);
+}
+
+static void
+test_too_small_for_ssim (void)
+{
+  float a[4 * 4] = { 0 };
+
+  g_assert_cmpfloat (emerge_image_metrics_ssim (a, a, 4, 4), <, 0.0);
+}
+
+/* An odd size, so neither the rows nor the grid cells line up with the
+ * vector width */
+#define HASH_W 61
+#define HASH_H 45
+
+static void
+test_dhash (void)
+{
+  float a[HASH_W * HASH_H], noisy[HASH_W * HASH_H], mirrored[HASH_W * HASH_H];
+
+  for (int y = 0; y < HASH_H; y++) {
+    for (int x = 0; x < HASH_W; x++) {
+      int i = y * HASH_W + x;
+
+      a[i] = x * 4.0f + y;
+      noisy[i] = a[i] + ((i % 3) - 1) * 1.5f;
+      mirrored[y * HASH_W + (HASH_W - 1 - x)] = a[i];
+    }
+  }
+
+  guint64 hash = emerge_image_metrics_dhash (a, HASH_W, HASH_H);
+
+  /* Brighter to the right in every cell */
+  g_assert_cmpuint (hash, ==, G_MAXUINT64);
+  g_assert_cmpuint (emerge_image_metrics_hamming (hash, emerge_image_metrics_dhash (noisy, HASH_W, HASH_H)), <=, 2);
+  g_assert_cmpuint (emerge_image_metrics_hamming (hash, emerge_image_metrics_dhash (mirrored, HASH_W, HASH_H)), ==, 64);
+  g_assert_cmpuint (emerge_image_metrics_dhash (a, 8, 8), ==, 0);
+}
+
+static void
+test_convergence (void)
+{
+  g_autoptr(EmergeConvergence) convergence = emerge_convergence_new (0.015, 3);
+  guint8 pixels[8 * 8 * 3];
+  gint converged_at = 0;
+
+  /* Changes of 100, 33, 16, 10, 7, 5, then 3, 3, 2 levels per step */
+  for (gint step = 1; step <= 12; step++) {
+    memset (pixels, 200 / step, sizeof pixels);
+    if (emerge_convergence_add (convergence, step, pixels, 8, 8, 8 * 3, 3)) {
+      g_assert_cmpint (converged_at, ==, 0);
+      converged_at = step;
+    }
+  }
+
+  g_assert_cmpint (converged_at, ==, 10);
+  g_assert_cmpint (emerge_convergence_get_converged_step (convergence), ==, 10);
+  g_assert_true (isnan (emerge_convergence_get_delta (convergence, 1)));
+  g_assert_cmpfloat_with_epsilon (emerge_convergence_get_delta (convergence, 2), 100 / 255.0, 1e-9);
+}
+
+int
+main (int argc, char *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/image-metrics/identical", test_identical);
+  g_test_add_func ("/image-metrics/noise-lowers-scores", test_noise_lowers_scores);
+  g_test_add_func ("/image-metrics/psnr-tail", test_psnr_tail);
+  g_test_add_func ("/image-metrics/too-small-for-ssim", test_too_small_for_ssim);
+  g_test_add_func ("/image-metrics/dhash", test_dhash);
+  g_test_add_func ("/image-metrics/convergence", test_convergence);
+
+  return g_test_run ();
+}
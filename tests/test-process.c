@@ -0,0 +1,655 @@
+#include <string.h>
+#include <glib/gstdio.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+#include "emerge-batch-convert.h"
+#include "emerge-job.h"
+#include "emerge-process-manager.h"
+#include "emerge-sd.h"
+#include "emerge-upscale.h"
+
+typedef struct {
+  EmergeProcessManager *manager;
+  gchar                *sd_path;
+  gchar                *tmp_dir;
+} Fixture;
+
+static void
+fixture_set_up (Fixture       *fixture,
+                gconstpointer  data G_GNUC_UNUSED)
+{
+  fixture->manager = emerge_process_manager_new ();
+  fixture->sd_path = emerge_sd_find_executable ();
+  g_assert_nonnull (fixture->sd_path);
+  fixture->tmp_dir = g_dir_make_tmp ("emerge-test-XXXXXX", NULL);
+  g_assert_nonnull (fixture->tmp_dir);
+
+  g_unsetenv ("MOCK_SD_FAIL_AT");
+  g_unsetenv ("MOCK_SD_STEP_MS");
+  g_unsetenv ("MOCK_SD_PREVIEW_MS");
+}
+
+static void
+fixture_tear_down (Fixture       *fixture,
+                   gconstpointer  data G_GNUC_UNUSED)
+{
+  GDir *dir = g_dir_open (fixture->tmp_dir, 0, NULL);
+  const char *name;
+
+  while ((name = g_dir_read_name (dir)) != NULL) {
+    gchar *path = g_build_filename (fixture->tmp_dir, name, NULL);
+    g_unlink (path);
+    g_free (path);
+  }
+  g_dir_close (dir);
+  g_rmdir (fixture->tmp_dir);
+
+  g_assert_cmpuint (emerge_process_manager_get_n_running (fixture->manager), ==, 0);
+  g_clear_object (&fixture->manager);
+  g_free (fixture->sd_path);
+  g_free (fixture->tmp_dir);
+}
+
+static EmergeJob *
+new_job (Fixture    *fixture,
+         const char *name)
+{
+  EmergeJob *job = emerge_job_new ();
+
+  job->model_path = g_strdup ("mock-model.safetensors");
+  job->prompt = g_strdup ("a \"quoted\" prompt; with $(shell) characters");
+  job->width = 64;
+  job->height = 64;
+  job->steps = 5;
+  job->seed = 7;
+  job->output_path = g_build_filename (fixture->tmp_dir, name, NULL);
+
+  return job;
+}
+
+static void
+count_progress_cb (EmergeProcess *process G_GNUC_UNUSED,
+                   gint           step G_GNUC_UNUSED,
+                   gint           total_steps G_GNUC_UNUSED,
+                   gdouble        seconds_per_step G_GNUC_UNUSED,
+                   guint         *n_progress)
+{
+  (*n_progress)++;
+}
+
+static void
+quit_loop_cb (EmergeProcess *process G_GNUC_UNUSED,
+              gint           wait_status G_GNUC_UNUSED,
+              GMainLoop     *loop)
+{
+  g_main_loop_quit (loop);
+}
+
+static void
+run_until_exited (EmergeProcess *process)
+{
+  GMainLoop *loop = g_main_loop_new (NULL, FALSE);
+
+  g_signal_connect (process, "exited", G_CALLBACK (quit_loop_cb), loop);
+  g_main_loop_run (loop);
+  g_signal_handlers_disconnect_by_data (process, loop);
+  g_main_loop_unref (loop);
+}
+
+static void
+test_job_succeeds (Fixture       *fixture,
+                   gconstpointer  data G_GNUC_UNUSED)
+{
+  g_autoptr(EmergeJob) job = new_job (fixture, "ok.png");
+  g_autoptr(GError) error = NULL;
+  EmergeProcess *process;
+  guint n_progress = 0;
+
+  process = emerge_job_spawn (job, fixture->manager, fixture->sd_path, NULL, &error);
+  g_assert_no_error (error);
+  g_signal_connect (process, "progress", G_CALLBACK (count_progress_cb), &n_progress);
+  run_until_exited (process);
+
+  g_assert_cmpint (job->state, ==, EMERGE_JOB_SUCCEEDED);
+  g_assert_cmpuint (n_progress, ==, 5);
+  g_assert_cmpuint (job->stats->step_seconds->len, ==, 5);
+  g_assert_cmpfloat (job->stats->load_seconds, >=, 0.0);
+  g_assert_cmpfloat (job->stats->decode_seconds, >=, 0.0);
+  g_assert_cmpfloat (job->stats->total_seconds, >=, 0.0);
+  g_assert_true (g_file_test (job->output_path, G_FILE_TEST_IS_REGULAR));
+  g_assert_false (emerge_process_is_running (process));
+
+  g_object_unref (process);
+}
+
+static void
+read_output_cb (GObject      *source_object G_GNUC_UNUSED,
+                GAsyncResult *result,
+                gpointer      user_data)
+{
+  GAsyncResult **out = user_data;
+
+  *out = g_object_ref (result);
+}
+
+static void
+test_job_memory_output (Fixture       *fixture,
+                        gconstpointer  data G_GNUC_UNUSED)
+{
+  g_autoptr(EmergeJob) job = new_job (fixture, "unused.png");
+  g_autoptr(GError) error = NULL;
+  g_autoptr(GAsyncResult) result = NULL;
+  g_autoptr(GBytes) bytes = NULL;
+  g_autoptr(GInputStream) stream = NULL;
+  g_autoptr(GdkPixbuf) pixbuf = NULL;
+  EmergeProcess *process;
+
+  g_clear_pointer (&job->output_path, g_free);
+  g_assert_true (emerge_job_set_output_memory (job, &error));
+  g_assert_no_error (error);
+
+  process = emerge_job_spawn (job, fixture->manager, fixture->sd_path, NULL, &error);
+  g_assert_no_error (error);
+  run_until_exited (process);
+  g_assert_cmpint (job->state, ==, EMERGE_JOB_SUCCEEDED);
+
+  emerge_job_read_output_async (job, NULL, read_output_cb, &result);
+  while (result == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  bytes = emerge_job_read_output_finish (job, result, &error);
+  g_assert_no_error (error);
+  stream = g_memory_input_stream_new_from_bytes (bytes);
+  pixbuf = gdk_pixbuf_new_from_stream (stream, NULL, &error);
+  g_assert_no_error (error);
+  g_assert_cmpint (gdk_pixbuf_get_width (pixbuf), ==, 64);
+
+  g_object_unref (process);
+}
+
+static void
+test_job_fails (Fixture       *fixture,
+                gconstpointer  data G_GNUC_UNUSED)
+{
+  g_autoptr(EmergeJob) job = new_job (fixture, "fail.png");
+  g_autoptr(GError) error = NULL;
+  EmergeProcess *process;
+
+  g_setenv ("MOCK_SD_FAIL_AT", "2", TRUE);
+  process = emerge_job_spawn (job, fixture->manager, fixture->sd_path, NULL, &error);
+  g_assert_no_error (error);
+  run_until_exited (process);
+
+  g_assert_cmpint (job->state, ==, EMERGE_JOB_FAILED);
+  g_assert_nonnull (strstr (job->error_message, "simulated failure"));
+  g_assert_false (g_file_test (job->output_path, G_FILE_TEST_EXISTS));
+
+  g_object_unref (process);
+}
+
+static void
+cancel_on_progress_cb (EmergeProcess *process,
+                       gint           step G_GNUC_UNUSED,
+                       gint           total_steps G_GNUC_UNUSED,
+                       gdouble        seconds_per_step G_GNUC_UNUSED,
+                       gpointer       user_data G_GNUC_UNUSED)
+{
+  emerge_process_cancel (process);
+}
+
+static void
+test_job_cancelled (Fixture       *fixture,
+                    gconstpointer  data G_GNUC_UNUSED)
+{
+  g_autoptr(EmergeJob) job = new_job (fixture, "cancel.png");
+  g_autoptr(GError) error = NULL;
+  EmergeProcess *process;
+
+  g_setenv ("MOCK_SD_STEP_MS", "100", TRUE);
+  job->steps = 100;
+  process = emerge_job_spawn (job, fixture->manager, fixture->sd_path, NULL, &error);
+  g_assert_no_error (error);
+  g_signal_connect (process, "progress", G_CALLBACK (cancel_on_progress_cb), NULL);
+  run_until_exited (process);
+
+  g_assert_cmpint (job->state, ==, EMERGE_JOB_CANCELLED);
+  g_assert_true (emerge_process_was_cancelled (process));
+  /* Cancelled long before the 10s the run would otherwise take */
+  g_assert_cmpfloat (job->wall_seconds, <, 5.0);
+
+  g_object_unref (process);
+}
+
+static void
+test_job_previews (Fixture       *fixture,
+                   gconstpointer  data G_GNUC_UNUSED)
+{
+  g_autoptr(EmergeJob) job = new_job (fixture, "previews.png");
+  g_autoptr(GError) error = NULL;
+  EmergeProcess *process;
+
+  /* Every other step writes a preview and takes twice as long */
+  g_setenv ("MOCK_SD_STEP_MS", "20", TRUE);
+  g_setenv ("MOCK_SD_PREVIEW_MS", "20", TRUE);
+  job->steps = 6;
+  job->preview_interval = 2;
+  job->preview_path = g_build_filename (fixture->tmp_dir, "preview.png", NULL);
+
+  process = emerge_job_spawn (job, fixture->manager, fixture->sd_path, NULL, &error);
+  g_assert_no_error (error);
+  run_until_exited (process);
+
+  g_assert_cmpint (job->state, ==, EMERGE_JOB_SUCCEEDED);
+  g_assert_true (g_file_test (job->preview_path, G_FILE_TEST_IS_REGULAR));
+  /* Three extra step times on top of six */
+  g_assert_cmpfloat_with_epsilon (emerge_job_get_preview_overhead (job), 0.5, 0.05);
+
+  g_object_unref (process);
+}
+
+typedef struct {
+  gint step_at_pause;
+  gint step_at_resume;
+} PauseState;
+
+static void
+pause_on_progress_cb (EmergeProcess *process,
+                      gint           step,
+                      gint           total_steps G_GNUC_UNUSED,
+                      gdouble        seconds_per_step G_GNUC_UNUSED,
+                      PauseState    *state)
+{
+  if (state->step_at_pause == 0) {
+    state->step_at_pause = step;
+    emerge_process_pause (process);
+  }
+}
+
+static gboolean
+resume_cb (gpointer user_data)
+{
+  EmergeProcess *process = user_data;
+  PauseState *state = g_object_get_data (G_OBJECT (process), "pause-state");
+
+  emerge_process_get_progress (process, &state->step_at_resume, NULL);
+  emerge_process_resume (process);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+test_job_paused (Fixture       *fixture,
+                 gconstpointer  data G_GNUC_UNUSED)
+{
+  g_autoptr(EmergeJob) job = new_job (fixture, "pause.png");
+  g_autoptr(GError) error = NULL;
+  PauseState state = { 0, 0 };
+  EmergeProcess *process;
+
+  g_setenv ("MOCK_SD_STEP_MS", "20", TRUE);
+  job->steps = 10;
+  process = emerge_job_spawn (job, fixture->manager, fixture->sd_path, NULL, &error);
+  g_assert_no_error (error);
+  g_object_set_data (G_OBJECT (process), "pause-state", &state);
+  g_signal_connect (process, "progress", G_CALLBACK (pause_on_progress_cb), &state);
+  g_timeout_add (500, resume_cb, process);
+  run_until_exited (process);
+
+  /* Stopped where it was paused, then finished from there */
+  g_assert_cmpint (state.step_at_pause, >, 0);
+  g_assert_cmpint (state.step_at_resume, <=, state.step_at_pause + 2);
+  g_assert_cmpint (job->state, ==, EMERGE_JOB_SUCCEEDED);
+  g_assert_false (emerge_process_is_paused (process));
+  /* The half second spent paused isn't counted */
+  g_assert_cmpfloat (job->wall_seconds, <, 0.5);
+
+  g_object_unref (process);
+}
+
+static void
+test_job_argv (void)
+{
+  g_autoptr(EmergeJob) job = emerge_job_new ();
+  g_auto(GStrv) argv = NULL;
+
+  job->model_path = g_strdup ("/models/a b.gguf");
+  job->prompt = g_strdup ("it's \"quoted\"");
+  job->output_path = g_strdup ("/tmp/out.png");
+  job->cfg_scale = 7.5;
+  job->threads = 4;
+
+  argv = emerge_job_build_argv (job, "/usr/bin/sd");
+
+  g_assert_cmpstr (argv[0], ==, "/usr/bin/sd");
+  g_assert_true (g_strv_contains ((const char * const *) argv, "/models/a b.gguf"));
+  g_assert_true (g_strv_contains ((const char * const *) argv, "it's \"quoted\""));
+  g_assert_true (g_strv_contains ((const char * const *) argv, "7.5"));
+  g_assert_true (g_strv_contains ((const char * const *) argv, "--threads"));
+  g_assert_false (g_strv_contains ((const char * const *) argv, "img2img"));
+}
+
+static void
+test_job_draft_refine (void)
+{
+  g_autoptr(EmergeJob) job = emerge_job_new ();
+  g_autoptr(EmergeJob) draft = NULL;
+  g_autoptr(EmergeJob) refine = NULL;
+
+  job->width = 1024;
+  job->height = 768;
+  job->steps = 30;
+  job->seed = -1;
+  job->upscale_model_path = g_strdup ("/models/esrgan.pth");
+
+  draft = emerge_job_new_draft (job, 384, 8);
+  g_assert_true (draft->draft);
+  g_assert_cmpint (draft->width, ==, 384);
+  g_assert_cmpint (draft->height, ==, 320);
+  g_assert_cmpint (draft->steps, ==, 8);
+  g_assert_cmpint (draft->seed, >=, 0);
+  g_assert_null (draft->upscale_model_path);
+
+  refine = emerge_job_new_refine (draft, "/tmp/init.png", 0.4);
+  g_assert_false (refine->draft);
+  g_assert_true (refine->img2img);
+  g_assert_cmpstr (refine->init_image_path, ==, "/tmp/init.png");
+  g_assert_cmpint (refine->width, ==, 1024);
+  g_assert_cmpint (refine->height, ==, 768);
+  g_assert_cmpint (refine->steps, ==, 30);
+  g_assert_cmpint (refine->seed, ==, draft->seed);
+}
+
+static gboolean
+validate (const char  *json,
+          GError     **error)
+{
+  g_autoptr(JsonParser) parser = json_parser_new ();
+
+  g_assert_true (json_parser_load_from_data (parser, json, -1, NULL));
+
+  return emerge_job_validate_json (json_node_get_object (json_parser_get_root (parser)),
+                                   error);
+}
+
+static void
+test_job_validate_json (void)
+{
+  const char *invalid[] = {
+    /* Wrong types */
+    "{\"cfg_scale\": [3, 5]}",
+    "{\"width\": {}}",
+    "{\"width\": \"512\"}",
+    "{\"seed\": 1.5}",
+    "{\"vae_tiling\": 1}",
+    "{\"positive_prompt\": 3}",
+    /* Zero or negative steps and sizes */
+    "{\"steps\": 0}",
+    "{\"steps\": -5}",
+    "{\"width\": 0}",
+    "{\"height\": -64}",
+    /* Strength outside [0, 1] */
+    "{\"strength\": 1.5}",
+    "{\"strength\": -0.1}",
+    /* A sampler sd doesn't have */
+    "{\"sampling_method\": \"euler_b\"}",
+    "{\"sampling_method\": 2}",
+    /* Null where a value is needed */
+    "{\"steps\": null}",
+    "{\"model_path\": null}",
+    "{\"strength\": null}",
+  };
+
+  g_assert_true (validate ("{\"width\": 512, \"height\": 768, \"steps\": 20,"
+                           " \"strength\": 0.5, \"sampling_method\": \"heun\","
+                           " \"upscale_model\": null, \"cfg_scale\": 7,"
+                           " \"unknown\": [1, 2]}", NULL));
+
+  for (guint i = 0; i < G_N_ELEMENTS (invalid); i++) {
+    GError *error = NULL;
+
+    g_assert_false (validate (invalid[i], &error));
+    g_assert_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA);
+    g_error_free (error);
+  }
+}
+
+static void
+test_sd_stats (void)
+{
+  g_autoptr(EmergeSdStats) stats = emerge_sd_stats_new ();
+
+  g_assert_true (emerge_sd_stats_parse_line (stats,
+    "[INFO ] stable-diffusion.cpp:1234 - loading model from 'x.gguf' completed, taking 3.41s"));
+  g_assert_true (emerge_sd_stats_parse_line (stats, "[INFO ] sampling completed, taking 30.12s"));
+  g_assert_true (emerge_sd_stats_parse_line (stats, "[INFO ] decode_first_stage completed, taking 2.05s"));
+  g_assert_true (emerge_sd_stats_parse_line (stats, "[INFO ] txt2img completed in 35.80s"));
+  g_assert_false (emerge_sd_stats_parse_line (stats, "[INFO ] loading model from 'x.gguf'"));
+
+  g_assert_cmpfloat_with_epsilon (stats->load_seconds, 3.41, 1e-9);
+  g_assert_cmpfloat_with_epsilon (stats->sampling_seconds, 30.12, 1e-9);
+  g_assert_cmpfloat_with_epsilon (stats->decode_seconds, 2.05, 1e-9);
+  g_assert_cmpfloat_with_epsilon (stats->total_seconds, 35.80, 1e-9);
+
+  emerge_sd_stats_add_step (stats, 1.0);
+  emerge_sd_stats_add_step (stats, 2.0);
+  g_assert_cmpfloat_with_epsilon (emerge_sd_stats_get_mean_step (stats), 1.5, 1e-9);
+}
+
+static void
+quit_batch_cb (EmergeBatchConvert *batch G_GNUC_UNUSED,
+               GMainLoop          *loop)
+{
+  g_main_loop_quit (loop);
+}
+
+static void
+run_batch (EmergeBatchConvert *batch)
+{
+  GMainLoop *loop = g_main_loop_new (NULL, FALSE);
+
+  g_signal_connect (batch, "finished", G_CALLBACK (quit_batch_cb), loop);
+  emerge_batch_convert_start (batch);
+  if (emerge_batch_convert_is_running (batch))
+    g_main_loop_run (loop);
+  g_signal_handlers_disconnect_by_data (batch, loop);
+  g_main_loop_unref (loop);
+}
+
+static void
+test_batch_convert_skips_up_to_date (Fixture       *fixture,
+                                     gconstpointer  data G_GNUC_UNUSED)
+{
+  g_autofree gchar *model = g_build_filename (fixture->tmp_dir, "model.safetensors", NULL);
+  g_autoptr(EmergeBatchConvert) first = NULL;
+  g_autoptr(EmergeBatchConvert) second = NULL;
+  g_autofree gchar *output_name = NULL;
+  g_autofree gchar *output = NULL;
+  g_autofree gchar *contents = NULL;
+
+  g_assert_true (g_file_set_contents (model, "weights", -1, NULL));
+
+  first = emerge_batch_convert_new (fixture->manager, fixture->sd_path);
+  emerge_batch_convert_add (first, model, "q8_0", fixture->tmp_dir);
+  emerge_batch_convert_add (first, model, "q4_0", fixture->tmp_dir);
+  run_batch (first);
+
+  g_assert_cmpuint (emerge_batch_convert_get_n_done (first), ==, 2);
+  g_assert_cmpuint (emerge_batch_convert_get_n_failed (first), ==, 0);
+
+  output_name = emerge_batch_convert_output_name (model, "q8_0");
+  output = g_build_filename (fixture->tmp_dir, output_name, NULL);
+  g_assert_true (g_file_get_contents (output, &contents, NULL, NULL));
+  g_assert_true (g_str_has_prefix (contents, "GGUF"));
+
+  /* Nothing changed, so the second pass must not run sd at all */
+  g_setenv ("MOCK_SD_FAIL_AT", "1", TRUE);
+  second = emerge_batch_convert_new (fixture->manager, fixture->sd_path);
+  emerge_batch_convert_add (second, model, "q8_0", fixture->tmp_dir);
+  run_batch (second);
+
+  g_assert_cmpuint (emerge_batch_convert_get_n_failed (second), ==, 0);
+}
+
+static void
+test_upscale_split (void)
+{
+  g_autofree guint *single = NULL;
+  guint n_tiles;
+
+  single = emerge_upscale_split (200, 256, 32, &n_tiles);
+  g_assert_cmpuint (n_tiles, ==, 1);
+  g_assert_cmpuint (single[0], ==, 0);
+
+  for (guint length = 257; length < 2000; length += 37) {
+    g_autofree guint *starts = emerge_upscale_split (length, 256, 32, &n_tiles);
+
+    g_assert_cmpuint (starts[0], ==, 0);
+    g_assert_cmpuint (starts[n_tiles - 1] + 256, ==, length);
+    for (guint i = 1; i < n_tiles; i++)
+      g_assert_cmpuint (starts[i] - starts[i - 1], <=, 256 - 32);
+
+    /* And no more tiles than that needs */
+    g_assert_cmpuint ((n_tiles - 2) * (256 - 32) + 256, <, length);
+  }
+}
+
+static void
+quit_upscale_cb (EmergeUpscale *upscale G_GNUC_UNUSED,
+                 GMainLoop     *loop)
+{
+  g_main_loop_quit (loop);
+}
+
+static gboolean
+run_upscale (EmergeUpscale  *upscale,
+             const char     *input,
+             const char     *output)
+{
+  GMainLoop *loop = g_main_loop_new (NULL, FALSE);
+  GError *error = NULL;
+  gboolean started;
+
+  g_signal_connect (upscale, "finished", G_CALLBACK (quit_upscale_cb), loop);
+  started = emerge_upscale_start (upscale, input, output, &error);
+  if (started)
+    g_main_loop_run (loop);
+  else
+    g_error_free (error);
+  g_signal_handlers_disconnect_by_data (upscale, loop);
+  g_main_loop_unref (loop);
+
+  return started;
+}
+
+static gchar *
+write_upscale_input (Fixture *fixture,
+                     int      width,
+                     int      height)
+{
+  GdkPixbuf *pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, FALSE, 8, width, height);
+  guchar *pixels = gdk_pixbuf_get_pixels (pixbuf);
+  int rowstride = gdk_pixbuf_get_rowstride (pixbuf);
+  gchar *path = g_build_filename (fixture->tmp_dir, "input.png", NULL);
+
+  for (int y = 0; y < height; y++)
+    for (int x = 0; x < width * 3; x++)
+      pixels[y * rowstride + x] = (x * 7 + y * 13 + x * y) & 0xff;
+
+  g_assert_true (gdk_pixbuf_save (pixbuf, path, "png", NULL, NULL));
+  g_object_unref (pixbuf);
+
+  return path;
+}
+
+static void
+test_upscale_tiles (Fixture       *fixture,
+                    gconstpointer  data G_GNUC_UNUSED)
+{
+  g_autofree gchar *input = write_upscale_input (fixture, 150, 100);
+  g_autofree gchar *output = g_build_filename (fixture->tmp_dir, "output.png", NULL);
+  g_autoptr(EmergeUpscale) upscale = emerge_upscale_new (fixture->manager, fixture->sd_path,
+                                                         "mock-esrgan.pth");
+  g_autoptr(GdkPixbuf) source = NULL;
+  g_autoptr(GdkPixbuf) result = NULL;
+
+  /* 3x2 tiles, three at a time */
+  emerge_upscale_set_tile_size (upscale, 64);
+  emerge_upscale_set_overlap (upscale, 8);
+  emerge_upscale_set_max_parallel (upscale, 3);
+  g_assert_true (run_upscale (upscale, input, output));
+
+  g_assert_null (emerge_upscale_get_error (upscale));
+  g_assert_cmpuint (emerge_upscale_get_n_tiles (upscale), ==, 6);
+  g_assert_cmpuint (emerge_upscale_get_n_done (upscale), ==, 6);
+
+  source = gdk_pixbuf_new_from_file (input, NULL);
+  result = gdk_pixbuf_new_from_file (output, NULL);
+  g_assert_nonnull (result);
+  g_assert_cmpint (gdk_pixbuf_get_width (result), ==, 600);
+  g_assert_cmpint (gdk_pixbuf_get_height (result), ==, 400);
+
+  /* The mock replicates pixels, so overlapping tiles agree exactly and
+   * blending them must not show */
+  for (int y = 0; y < 400; y++) {
+    const guchar *row = gdk_pixbuf_read_pixels (result) + y * gdk_pixbuf_get_rowstride (result);
+    const guchar *expected = gdk_pixbuf_read_pixels (source) + (y / 4) * gdk_pixbuf_get_rowstride (source);
+
+    for (int x = 0; x < 600 * 3; x++)
+      g_assert_cmpuint (row[x], ==, expected[(x / 12) * 3 + x % 3]);
+  }
+
+  g_unlink (input);
+  g_unlink (output);
+}
+
+static void
+test_upscale_fails (Fixture       *fixture,
+                    gconstpointer  data G_GNUC_UNUSED)
+{
+  g_autofree gchar *input = write_upscale_input (fixture, 100, 100);
+  g_autofree gchar *output = g_build_filename (fixture->tmp_dir, "output.png", NULL);
+  g_autoptr(EmergeUpscale) upscale = emerge_upscale_new (fixture->manager, fixture->sd_path,
+                                                         "mock-esrgan.pth");
+
+  g_setenv ("MOCK_SD_FAIL_AT", "0", TRUE);
+  emerge_upscale_set_tile_size (upscale, 64);
+  run_upscale (upscale, input, output);
+
+  g_assert_false (emerge_upscale_is_running (upscale));
+  g_assert_error (emerge_upscale_get_error (upscale), G_IO_ERROR, G_IO_ERROR_FAILED);
+  g_assert_false (g_file_test (output, G_FILE_TEST_EXISTS));
+
+  g_unlink (input);
+}
+
+int
+main (int argc, char *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add ("/process/job-succeeds", Fixture, NULL,
+              fixture_set_up, test_job_succeeds, fixture_tear_down);
+  g_test_add ("/process/job-memory-output", Fixture, NULL,
+              fixture_set_up, test_job_memory_output, fixture_tear_down);
+  g_test_add ("/process/job-fails", Fixture, NULL,
+              fixture_set_up, test_job_fails, fixture_tear_down);
+  g_test_add ("/process/job-cancelled", Fixture, NULL,
+              fixture_set_up, test_job_cancelled, fixture_tear_down);
+  g_test_add ("/process/job-previews", Fixture, NULL,
+              fixture_set_up, test_job_previews, fixture_tear_down);
+  g_test_add ("/process/job-paused", Fixture, NULL,
+              fixture_set_up, test_job_paused, fixture_tear_down);
+  g_test_add ("/process/batch-convert-skips-up-to-date", Fixture, NULL,
+              fixture_set_up, test_batch_convert_skips_up_to_date, fixture_tear_down);
+  g_test_add ("/process/upscale-tiles", Fixture, NULL,
+              fixture_set_up, test_upscale_tiles, fixture_tear_down);
+  g_test_add ("/process/upscale-fails", Fixture, NULL,
+              fixture_set_up, test_upscale_fails, fixture_tear_down);
+  g_test_add_func ("/job/argv", test_job_argv);
+  g_test_add_func ("/job/draft-refine", test_job_draft_refine);
+  g_test_add_func ("/job/validate-json", test_job_validate_json);
+  g_test_add_func ("/sd/stats", test_sd_stats);
+  g_test_add_func ("/upscale/split", test_upscale_split);
+
+  return g_test_run ();
+}
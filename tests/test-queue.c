@@ -0,0 +1,131 @@
+#include <glib/gstdio.h>
+
+#include "emerge-queue.h"
+
+static EmergeJob *
+make_job (gint64 seed)
+{
+  EmergeJob *job = emerge_job_new ();
+
+  job->model_path = g_strdup ("/models/test.safetensors");
+  job->prompt = g_strdup ("a lighthouse");
+  job->seed = seed;
+
+  return job;
+}
+
+static void
+test_resume (void)
+{
+  g_autofree gchar *dir = g_dir_make_tmp ("emerge-test-XXXXXX", NULL);
+  g_autofree gchar *path = g_build_filename (dir, "queue.journal", NULL);
+  EmergeQueue *queue = emerge_queue_new (path);
+  gint64 seeds[] = { 1, 2, 1 };
+  EmergeJob *job;
+  guint64 first_id;
+
+  g_assert_true (emerge_queue_load (queue, NULL));
+
+  for (guint i = 0; i < G_N_ELEMENTS (seeds); i++) {
+    EmergeJob *submitted = make_job (seeds[i]);
+
+    g_assert_cmpuint (emerge_queue_submit (queue, submitted, NULL), !=, 0);
+    emerge_job_unref (submitted);
+  }
+  g_assert_cmpuint (emerge_queue_get_n_pending (queue), ==, 3);
+
+  job = emerge_queue_start_next (queue);
+  g_assert_nonnull (job);
+  first_id = job->id;
+  emerge_queue_finish (queue, job->id, EMERGE_JOB_SUCCEEDED);
+  emerge_job_unref (job);
+
+  /* The second job is cut off halfway, as if the app went away */
+  job = emerge_queue_start_next (queue);
+  g_assert_nonnull (job);
+  g_assert_cmpint (job->seed, ==, 2);
+  emerge_queue_checkpoint (queue, job->id, 10);
+  emerge_job_unref (job);
+  g_object_unref (queue);
+
+  queue = emerge_queue_new (path);
+  g_assert_true (emerge_queue_load (queue, NULL));
+  g_assert_cmpuint (emerge_queue_get_n_pending (queue), ==, 2);
+  g_assert_cmpuint (emerge_queue_get_n_finished (queue), ==, 1);
+
+  job = emerge_queue_start_next (queue);
+  g_assert_nonnull (job);
+  g_assert_cmpint (job->seed, ==, 2);
+  g_assert_cmpuint (job->id, >, first_id);
+  emerge_queue_finish (queue, job->id, EMERGE_JOB_SUCCEEDED);
+  emerge_job_unref (job);
+
+  /* The last job would make the first image again */
+  g_assert_null (emerge_queue_start_next (queue));
+  g_assert_cmpuint (emerge_queue_get_n_pending (queue), ==, 0);
+  g_assert_cmpuint (emerge_queue_get_n_records (queue), ==, 1);
+  g_object_unref (queue);
+
+  g_unlink (path);
+  g_rmdir (dir);
+}
+
+static void
+test_cancel (void)
+{
+  g_autofree gchar *dir = g_dir_make_tmp ("emerge-test-XXXXXX", NULL);
+  g_autofree gchar *path = g_build_filename (dir, "queue.journal", NULL);
+  EmergeQueue *queue = emerge_queue_new (path);
+  EmergeJob *submitted = make_job (1);
+  EmergeJob *job;
+  JsonNode *status;
+  JsonArray *jobs;
+  guint64 first_id, second_id;
+
+  first_id = emerge_queue_submit (queue, submitted, NULL);
+  submitted->seed = 2;
+  second_id = emerge_queue_submit (queue, submitted, NULL);
+  emerge_job_unref (submitted);
+
+  job = emerge_queue_start_next (queue);
+  g_assert_cmpuint (job->id, ==, first_id);
+
+  /* The running job is left to whoever runs it */
+  g_assert_false (emerge_queue_cancel (queue, first_id));
+  g_assert_true (emerge_queue_cancel (queue, second_id));
+  g_assert_false (emerge_queue_cancel (queue, second_id));
+
+  status = emerge_queue_get_status (queue);
+  jobs = json_object_get_array_member (json_node_get_object (status), "jobs");
+  g_assert_cmpuint (json_array_get_length (jobs), ==, 1);
+  g_assert_cmpstr (json_object_get_string_member (json_array_get_object_element (jobs, 0), "state"),
+                   ==, "running");
+  json_node_unref (status);
+
+  emerge_queue_finish (queue, job->id, EMERGE_JOB_SUCCEEDED);
+  emerge_job_unref (job);
+  g_object_unref (queue);
+
+  /* Nothing comes back after a restart, and ids aren't handed out again */
+  queue = emerge_queue_new (path);
+  g_assert_true (emerge_queue_load (queue, NULL));
+  g_assert_cmpuint (emerge_queue_get_n_pending (queue), ==, 0);
+  submitted = make_job (3);
+  g_assert_cmpuint (emerge_queue_submit (queue, submitted, NULL), >, second_id);
+  emerge_job_unref (submitted);
+  g_object_unref (queue);
+
+  g_unlink (path);
+  g_rmdir (dir);
+}
+
+int
+main (int argc, char *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/queue/resume", test_resume);
+  g_test_add_func ("/queue/cancel", test_cancel);
+
+  return g_test_run ();
+}
@@ -0,0 +1,80 @@
+#include <string.h>
+#include <glib/gstdio.h>
+
+#include "emerge-store.h"
+
+static void
+test_coalesced (void)
+{
+  g_autoptr(EmergeStore) store = emerge_store_new (10000);
+  g_autofree gchar *dir = g_dir_make_tmp ("emerge-test-XXXXXX", NULL);
+  g_autofree gchar *path = g_build_filename (dir, "state", "config.json", NULL);
+  g_autofree gchar *state_dir = g_path_get_dirname (path);
+  g_autofree gchar *contents = NULL;
+
+  for (int i = 0; i < 5; i++) {
+    g_autofree gchar *text = g_strdup_printf ("{\"version\": %d}", i);
+    g_autoptr(GBytes) bytes = g_bytes_new (text, strlen (text));
+
+    emerge_store_write (store, path, bytes);
+  }
+
+  /* Nothing happens until the delay is over */
+  g_assert_false (g_file_test (path, G_FILE_TEST_EXISTS));
+
+  emerge_store_flush (store);
+  g_assert_cmpuint (emerge_store_get_n_writes (store), ==, 1);
+  g_assert_true (g_file_get_contents (path, &contents, NULL, NULL));
+  g_assert_cmpstr (contents, ==, "{\"version\": 4}");
+
+  g_unlink (path);
+  g_rmdir (state_dir);
+  g_rmdir (dir);
+}
+
+static gboolean
+quit_loop_cb (gpointer user_data)
+{
+  g_main_loop_quit (user_data);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+test_delayed (void)
+{
+  g_autoptr(EmergeStore) store = emerge_store_new (20);
+  g_autofree gchar *dir = g_dir_make_tmp ("emerge-test-XXXXXX", NULL);
+  g_autofree gchar *a = g_build_filename (dir, "a", NULL);
+  g_autofree gchar *b = g_build_filename (dir, "b", NULL);
+  g_autoptr(GBytes) bytes = g_bytes_new_static ("x", 1);
+  GMainLoop *loop = g_main_loop_new (NULL, FALSE);
+
+  emerge_store_write (store, a, bytes);
+  emerge_store_write (store, b, bytes);
+
+  /* Written by the timeout alone, both in the same batch */
+  g_timeout_add (200, quit_loop_cb, loop);
+  g_main_loop_run (loop);
+  g_main_loop_unref (loop);
+
+  while (emerge_store_get_n_writes (store) < 2)
+    g_usleep (1000);
+  g_assert_true (g_file_test (a, G_FILE_TEST_IS_REGULAR));
+  g_assert_true (g_file_test (b, G_FILE_TEST_IS_REGULAR));
+
+  g_unlink (a);
+  g_unlink (b);
+  g_rmdir (dir);
+}
+
+int
+main (int argc, char *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/store/coalesced", test_coalesced);
+  g_test_add_func ("/store/delayed", test_delayed);
+
+  return g_test_run ();
+}
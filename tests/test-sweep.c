@@ -0,0 +1,96 @@
+#include "emerge-sweep.h"
+
+static JsonObject *
+parse_object (const char *text)
+{
+  g_autoptr(JsonParser) parser = json_parser_new ();
+
+  g_assert_true (json_parser_load_from_data (parser, text, -1, NULL));
+
+  return json_object_ref (json_node_get_object (json_parser_get_root (parser)));
+}
+
+static void
+test_combinations (void)
+{
+  JsonObject *template = parse_object ("{\"positive_prompt\": \"a fox\","
+                                       " \"seed\": {\"from\": 1, \"to\": 3},"
+                                       " \"sampling_method\": [\"euler\", \"dpm++2m\"],"
+                                       " \"cfg_scale\": {\"from\": 3, \"to\": 4, \"step\": 0.5}}");
+  g_autoptr(EmergeSweep) sweep = emerge_sweep_new (template, NULL);
+  EmergeJob *base = emerge_job_new ();
+  EmergeJob *job;
+  guint n_jobs = 0;
+
+  g_assert_nonnull (sweep);
+  g_assert_cmpuint (emerge_sweep_get_n_jobs (sweep), ==, 18);
+
+  /* The last member changes fastest */
+  job = emerge_sweep_next (sweep, base);
+  g_assert_cmpstr (job->prompt, ==, "a fox");
+  g_assert_cmpint (job->seed, ==, 1);
+  g_assert_cmpstr (job->sampling_method, ==, "euler");
+  g_assert_cmpfloat (job->cfg_scale, ==, 3.0);
+  emerge_job_unref (job);
+  n_jobs++;
+
+  job = emerge_sweep_next (sweep, base);
+  g_assert_cmpint (job->seed, ==, 1);
+  g_assert_cmpfloat (job->cfg_scale, ==, 3.5);
+  emerge_job_unref (job);
+  n_jobs++;
+
+  while ((job = emerge_sweep_next (sweep, base)) != NULL) {
+    n_jobs++;
+    if (n_jobs == 18) {
+      g_assert_cmpint (job->seed, ==, 3);
+      g_assert_cmpstr (job->sampling_method, ==, "dpm++2m");
+      g_assert_cmpfloat (job->cfg_scale, ==, 4.0);
+    }
+    emerge_job_unref (job);
+  }
+  g_assert_cmpuint (n_jobs, ==, 18);
+  g_assert_cmpuint (emerge_sweep_get_position (sweep), ==, 18);
+
+  emerge_job_unref (base);
+  json_object_unref (template);
+}
+
+static void
+test_invalid (void)
+{
+  const char *templates[] = {
+    "{\"seed\": []}",
+    "{\"seed\": {\"from\": 5, \"to\": 1}}",
+    "{\"cfg_scale\": {\"from\": 1, \"to\": 2, \"step\": 0}}",
+    "{\"steps\": [[10, 20]]}",
+    "{\"steps\": {\"min\": 10}}",
+    "{\"seed\": [\"a\"]}",
+    "{\"width\": {\"from\": 0, \"to\": 512, \"step\": 64}}",
+    "{\"steps\": \"20\"}",
+    "{\"strength\": {\"from\": 0.5, \"to\": 1.5, \"step\": 0.5}}",
+    "{\"steps\": {\"from\": -10, \"to\": 20, \"step\": 10}}",
+    "{\"sampling_method\": [\"euler\", \"euler_b\"]}",
+  };
+
+  for (guint i = 0; i < G_N_ELEMENTS (templates); i++) {
+    JsonObject *template = parse_object (templates[i]);
+    GError *error = NULL;
+
+    g_assert_null (emerge_sweep_new (template, &error));
+    g_assert_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA);
+    g_error_free (error);
+    json_object_unref (template);
+  }
+}
+
+int
+main (int argc, char *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/sweep/combinations", test_combinations);
+  g_test_add_func ("/sweep/invalid", test_invalid);
+
+  return g_test_run ();
+}
@@ -0,0 +1,140 @@
+#include <unistd.h>
+#include <glib/gstdio.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+#include "emerge-tile-pyramid.h"
+
+#define WIDTH  600
+#define HEIGHT 301
+
+static guchar
+pattern (int x,
+         int y,
+         int c)
+{
+  return (x * 3 + y * 5 + c * 70) & 0xff;
+}
+
+static gchar *
+write_image (void)
+{
+  GdkPixbuf *pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, FALSE, 8, WIDTH, HEIGHT);
+  guchar *pixels = gdk_pixbuf_get_pixels (pixbuf);
+  int rowstride = gdk_pixbuf_get_rowstride (pixbuf);
+  gchar *path;
+  int fd;
+
+  fd = g_file_open_tmp ("emerge-test-XXXXXX.png", &path, NULL);
+  g_assert_cmpint (fd, >=, 0);
+  close (fd);
+
+  for (int y = 0; y < HEIGHT; y++)
+    for (int x = 0; x < WIDTH; x++)
+      for (int c = 0; c < 3; c++)
+        pixels[y * rowstride + x * 3 + c] = pattern (x, y, c);
+
+  g_assert_true (gdk_pixbuf_save (pixbuf, path, "png", NULL, NULL));
+  g_object_unref (pixbuf);
+
+  return path;
+}
+
+static void
+test_levels (void)
+{
+  gchar *path = write_image ();
+  GError *error = NULL;
+  g_autoptr(EmergeTilePyramid) pyramid = emerge_tile_pyramid_new_for_file (path, NULL, &error);
+  int width, height, n_columns, n_rows;
+
+  g_assert_no_error (error);
+  g_assert_cmpuint (emerge_tile_pyramid_get_n_channels (pyramid), ==, 3);
+
+  /* 600x301, 300x151, then 150x76 fits in one tile... */
+  g_assert_cmpuint (emerge_tile_pyramid_get_n_levels (pyramid), ==, 3);
+  emerge_tile_pyramid_get_size (pyramid, 1, &width, &height);
+  g_assert_cmpint (width, ==, 300);
+  g_assert_cmpint (height, ==, 151);
+  emerge_tile_pyramid_get_size (pyramid, 2, &width, &height);
+  g_assert_cmpint (width, ==, 150);
+  g_assert_cmpint (height, ==, 76);
+
+  /* ...which the full size takes six of */
+  emerge_tile_pyramid_get_n_tiles (pyramid, 0, &n_columns, &n_rows);
+  g_assert_cmpint (n_columns, ==, 3);
+  g_assert_cmpint (n_rows, ==, 2);
+
+  g_unlink (path);
+  g_free (path);
+}
+
+static void
+test_tile_contents (void)
+{
+  gchar *path = write_image ();
+  g_autoptr(EmergeTilePyramid) pyramid = emerge_tile_pyramid_new_for_file (path, NULL, NULL);
+  GBytes *bytes;
+  const guchar *tile;
+  int width, height;
+
+  /* The bottom right corner tile is clipped to the image */
+  bytes = emerge_tile_pyramid_get_tile (pyramid, 0, 2, 1, &width, &height);
+  g_assert_cmpint (width, ==, WIDTH - 2 * EMERGE_TILE_SIZE);
+  g_assert_cmpint (height, ==, HEIGHT - EMERGE_TILE_SIZE);
+  g_assert_cmpuint (g_bytes_get_size (bytes), ==, (gsize) width * height * 3);
+
+  tile = g_bytes_get_data (bytes, NULL);
+  for (int y = 0; y < height; y++)
+    for (int x = 0; x < width; x++)
+      g_assert_cmpuint (tile[(y * width + x) * 3 + 1], ==,
+                        pattern (2 * EMERGE_TILE_SIZE + x, EMERGE_TILE_SIZE + y, 1));
+  g_bytes_unref (bytes);
+
+  /* A level up, each pixel is the rounded mean of four; the odd last row
+   * is averaged with itself */
+  bytes = emerge_tile_pyramid_get_tile (pyramid, 1, 0, 0, &width, &height);
+  tile = g_bytes_get_data (bytes, NULL);
+  for (int y = 0; y < height; y++) {
+    int y1 = MIN (2 * y + 1, HEIGHT - 1);
+
+    for (int x = 0; x < width; x += 7) {
+      guint sum = pattern (2 * x, 2 * y, 0) + pattern (2 * x + 1, 2 * y, 0) +
+                  pattern (2 * x, y1, 0) + pattern (2 * x + 1, y1, 0);
+
+      g_assert_cmpuint (tile[(y * width + x) * 3], ==, (sum + 2) / 4);
+    }
+  }
+  g_bytes_unref (bytes);
+
+  g_unlink (path);
+  g_free (path);
+}
+
+static void
+test_cancelled (void)
+{
+  gchar *path = write_image ();
+  GCancellable *cancellable = g_cancellable_new ();
+  GError *error = NULL;
+
+  g_cancellable_cancel (cancellable);
+  g_assert_null (emerge_tile_pyramid_new_for_file (path, cancellable, &error));
+  g_assert_error (error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+
+  g_error_free (error);
+  g_object_unref (cancellable);
+  g_unlink (path);
+  g_free (path);
+}
+
+int
+main (int argc, char *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/tile-pyramid/levels", test_levels);
+  g_test_add_func ("/tile-pyramid/tile-contents", test_tile_contents);
+  g_test_add_func ("/tile-pyramid/cancelled", test_cancelled);
+
+  return g_test_run ();
+}